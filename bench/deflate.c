@@ -0,0 +1,93 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "deflate.h"
+
+/* compress a file (or a synthetic HTML-like corpus) at every level and
+   report ratio and throughput */
+
+#define CORPUS_LEN (4ul << 20)
+#define MIN_SECONDS 0.5
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static unsigned char *synthetic(size_t len) {
+	static const char *words[] = {"<div class=\"row\">", "</div>\n",
+		"<a href=\"/docs/", "\">", "</a>", "aster ", "static ", "server ",
+		"response ", "the ", "of ", "cache ", "Content-Length: ", "2024 "};
+	unsigned char *data = malloc(len);
+	uint32_t state = 1;
+	size_t pos = 0;
+
+	if (data == NULL) {
+		perror("synthetic");
+		exit(1);
+	}
+	while (pos < len) {
+		const char *word;
+		state = state * 1103515245u + 12345u;
+		word = words[(state >> 16) % (sizeof words / sizeof words[0])];
+		while (*word && pos < len) data[pos++] = (unsigned char)*word++;
+	}
+	return data;
+}
+
+static unsigned char *slurp(const char *path, size_t *len) {
+	FILE *f = fopen(path, "rb");
+	unsigned char *data;
+	long size;
+
+	if (f == NULL || fseek(f, 0, SEEK_END) == -1 || (size = ftell(f)) < 0) {
+		perror(path);
+		exit(1);
+	}
+	rewind(f);
+	data = malloc(size ? (size_t)size : 1);
+	if (data == NULL || fread(data, 1, (size_t)size, f) != (size_t)size) {
+		perror(path);
+		exit(1);
+	}
+	fclose(f);
+	*len = (size_t)size;
+	return data;
+}
+
+int main(int argc, char *argv[]) {
+	unsigned char *data, *out;
+	size_t len, out_len = 0;
+	int level;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: %s [file]\n", argv[0]);
+		return 1;
+	}
+	data = argc == 2 ? slurp(argv[1], &len) : synthetic(len = CORPUS_LEN);
+
+	printf("input: %s, %lu bytes\n", argc == 2 ? argv[1] : "synthetic",
+		(unsigned long)len);
+	printf("level     output   ratio     MB/s\n");
+	for (level = DEFLATE_MIN_LEVEL; level <= DEFLATE_MAX_LEVEL; ++level) {
+		double start = now(), elapsed;
+		unsigned runs = 0;
+		do {
+			out = NULL;
+			out_len = 0;
+			gzip_compress(data, len, level, &out, &out_len);
+			free(out);
+			runs++;
+			elapsed = now() - start;
+		} while (elapsed < MIN_SECONDS);
+		printf("%5d %10lu %6.2f%% %8.1f\n", level, (unsigned long)out_len,
+			len ? 100.0 * (double)out_len / (double)len : 0.0,
+			(double)len * runs / elapsed / 1e6);
+	}
+	free(data);
+	return 0;
+}
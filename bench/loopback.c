@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "listener.h"
+#include "parser.h"
+#include "str.h"
+
+/* keep-alive round trips over TCP loopback and a Unix socket, to a
+   responder forked here or, given their addresses, to a running server */
+
+#define MIN_SECONDS 0.5
+#define BODY_MAX (256ul << 10)
+
+static const size_t body_sizes[] = {2, 16ul << 10, BODY_MAX};
+
+static char body[BODY_MAX];
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void send_all(int fd, const char *buf, size_t len) {
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, buf, len, MSG_NOSIGNAL);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) {
+			perror("send");
+			exit(1);
+		}
+		buf += n;
+		len -= (size_t)n;
+	}
+}
+
+static void no_delay(int fd, const struct sockaddr_storage *addr) {
+	int yes = 1;
+	if (addr->ss_family != AF_UNIX) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+}
+
+/* answer the requests of one client, the body as long as the path says,
+   the way the server parses them */
+static void respond(int listener_fd, const struct sockaddr_storage *addr) {
+	struct http_request req = new_request();
+	struct parse_ctx ctx = parse_ctx_init(&req);
+	char buf[4096], head[128];
+	ssize_t n;
+	size_t len;
+	int fd;
+
+	fcntl(listener_fd, F_SETFL, fcntl(listener_fd, F_GETFL) & ~O_NONBLOCK);
+	fd = accept(listener_fd, NULL, NULL);
+	if (fd == -1) {
+		perror("accept");
+		exit(1);
+	}
+	no_delay(fd, addr);
+	while ((n = recv(fd, buf, sizeof buf, 0)) > 0) {
+		feed(&ctx, buf, (size_t)n);
+		while (ctx.state == PS_DONE) {
+			len = req.path.len > 1 ? (size_t)strtoul(req.path.ptr + 1, NULL, 10) : 0;
+			if (len > BODY_MAX) len = BODY_MAX;
+			sprintf(head, "HTTP/1.1 200 OK" CRLF "Content-Length: %lu" CRLF CRLF,
+				(unsigned long)len);
+			send_all(fd, head, strlen(head));
+			send_all(fd, body, len);
+			http_request_free(&req);
+			req = new_request();
+			parse_ctx_reset(&ctx, &req, ctx.pos);
+			feed(&ctx, "", 0);
+		}
+		if (ctx.state == PS_ERROR) break;
+	}
+	close(fd);
+	parse_ctx_free(&ctx);
+	http_request_free(&req);
+}
+
+/* read one response whole: the length of its body, -1 if it is not one */
+static long read_response(int fd, char *buf, size_t cap) {
+	size_t len = 0, head_len, want;
+	const char *end, *cl;
+	ssize_t n;
+
+	while (1) {
+		n = recv(fd, buf + len, cap - len - 1, 0);
+		if (n <= 0) return -1;
+		len += (size_t)n;
+		buf[len] = '\0';
+		if ((end = strstr(buf, CRLF CRLF)) != NULL) break;
+		if (len == cap - 1) return -1;
+	}
+	head_len = (size_t)(end - buf) + 4;
+	cl = strstr(buf, "Content-Length: ");
+	want = cl != NULL && cl < end ? (size_t)strtoul(cl + 16, NULL, 10) : 0;
+	want += head_len;
+	while (len < want) {
+		n = recv(fd, buf, want - len < cap ? want - len : cap, 0);
+		if (n <= 0) return -1;
+		len += (size_t)n;
+	}
+	return (long)(want - head_len);
+}
+
+/* requests one at a time for MIN_SECONDS, their number per second; the
+   length of the last body in `len` */
+static double round_trips(
+		const struct sockaddr_storage *addr,
+		socklen_t addr_len,
+		const char *target,
+		size_t *len
+) {
+	static char buf[BODY_MAX + 4096];
+	char request[256];
+	double start, elapsed;
+	unsigned long runs = 0;
+	long n;
+	int fd = socket(addr->ss_family, SOCK_STREAM, 0);
+
+	if (fd == -1 || connect(fd, (const struct sockaddr *)addr, addr_len) == -1) {
+		perror("connect");
+		exit(1);
+	}
+	no_delay(fd, addr);
+	sprintf(request, "GET %s HTTP/1.1" CRLF "Host: bench" CRLF CRLF, target);
+	start = now();
+	do {
+		send_all(fd, request, strlen(request));
+		if ((n = read_response(fd, buf, sizeof buf)) == -1) {
+			fprintf(stderr, "bench: bad response to %s\n", target);
+			exit(1);
+		}
+		runs++;
+		elapsed = now() - start;
+	} while (elapsed < MIN_SECONDS);
+	close(fd);
+	*len = (size_t)n;
+	return (double)runs / elapsed;
+}
+
+static void report(const char *transport, size_t len, double rate) {
+	printf("%-10s %8lu %10.0f %8.1f %8.1f\n", transport, (unsigned long)len, rate,
+		1e6 / rate, (double)len * rate / 1e6);
+}
+
+/* against the forked responder, every body size in turn */
+static void compare(struct listener *tcp, struct listener *local) {
+	struct listener *sides[2];
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	char target[32];
+	size_t i, j, len;
+	double rate;
+	pid_t pid;
+
+	sides[0] = tcp;
+	sides[1] = local;
+	for (i = 0; i < sizeof body_sizes / sizeof body_sizes[0]; ++i) {
+		sprintf(target, "/%lu", (unsigned long)body_sizes[i]);
+		for (j = 0; j < 2; ++j) {
+			addr_len = sizeof addr;
+			getsockname(sides[j]->src.fd, (void *)&addr, &addr_len);
+			/* or the child would print it again */
+			fflush(stdout);
+			pid = fork();
+			if (pid == -1) {
+				perror("fork");
+				exit(1);
+			}
+			if (pid == 0) {
+				respond(sides[j]->src.fd, &addr);
+				_exit(0);
+			}
+			rate = round_trips(&addr, addr_len, target, &len);
+			report(j == 0 ? "tcp" : "unix", len, rate);
+			waitpid(pid, NULL, 0);
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	struct listener tcp, local;
+	const char *target = argc == 4 ? argv[3] : "/";
+	char name[64];
+	size_t len;
+	double rate;
+
+	if (argc != 1 && argc != 3 && argc != 4) {
+		fprintf(stderr, "usage: %s [host:port unix:/path [target]]\n", argv[0]);
+		return 1;
+	}
+	printf("transport      body      req/s   us/req     MB/s\n");
+	if (argc > 1) {
+		/* a running server, listening on both */
+		if (listener_init(&tcp, argv[1]) == -1 || listener_init(&local, argv[2]) == -1) {
+			fprintf(stderr, "bench: bad address\n");
+			return 1;
+		}
+		rate = round_trips(&tcp.addr, tcp.addr_len, target, &len);
+		report("tcp", len, rate);
+		rate = round_trips(&local.addr, local.addr_len, target, &len);
+		report("unix", len, rate);
+		return 0;
+	}
+
+	memset(body, 'a', sizeof body);
+	sprintf(name, "unix:@aster-bench-%ld", (long)getpid());
+	if (listener_init(&tcp, "127.0.0.1:0") == -1 || listener_open(&tcp) == -1 ||
+			listener_init(&local, name) == -1 || listener_open(&local) == -1) {
+		perror("listen");
+		return 1;
+	}
+	compare(&tcp, &local);
+	listener_close(&tcp);
+	listener_close(&local);
+	return 0;
+}
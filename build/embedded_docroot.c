@@ -0,0 +1,5 @@
+/* generated by tools/embed.c from nothing, do not edit */
+
+#include "embedded.h"
+
+const struct embedded_table embedded_docroot = {NULL, 0, NULL, 0, 0x811c9dc5u};
@@ -0,0 +1,123 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "acl.h"
+
+void acl_init(struct acl *acl) {
+	acl->nets = NULL;
+	acl->num = 0;
+}
+
+void acl_free(struct acl *acl) {
+	free(acl->nets);
+	acl->nets = NULL;
+	acl->num = 0;
+}
+
+int acl_add(struct acl *acl, const char *net) {
+	struct acl_net n;
+	const char *slash = strchr(net, '/');
+	char addr[INET6_ADDRSTRLEN];
+	size_t len = slash != NULL ? (size_t)(slash - net) : strlen(net);
+	unsigned max;
+	char *end;
+	long bits;
+
+	if (len == 0 || len >= sizeof addr) return -1;
+	memcpy(addr, net, len);
+	addr[len] = '\0';
+	memset(&n, 0, sizeof n);
+	if (inet_pton(AF_INET, addr, n.addr) == 1) {
+		n.family = AF_INET;
+		max = 32;
+	} else if (inet_pton(AF_INET6, addr, n.addr) == 1) {
+		n.family = AF_INET6;
+		max = 128;
+	} else {
+		return -1;
+	}
+	n.bits = max;
+	if (slash != NULL) {
+		bits = strtol(slash + 1, &end, 10);
+		if (end == slash + 1 || *end != '\0' || bits < 0 || bits > (long)max) return -1;
+		n.bits = (unsigned)bits;
+	}
+
+	acl->nets = realloc(acl->nets, (acl->num + 1) * sizeof *acl->nets);
+	if (acl->nets == NULL) {
+		perror("acl_add");
+		exit(1);
+	}
+	acl->nets[acl->num++] = n;
+	return 0;
+}
+
+/* the family and bytes of `addr`, IPv4-mapped IPv6 as IPv4; 0 if it has
+   none, a local socket */
+static int address_of(const struct sockaddr *addr, const unsigned char **bytes) {
+	static const unsigned char mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+	const struct sockaddr_in *in;
+	const struct sockaddr_in6 *in6;
+
+	if (addr->sa_family == AF_INET) {
+		in = (const void *)addr;
+		*bytes = (const unsigned char *)&in->sin_addr;
+		return AF_INET;
+	}
+	if (addr->sa_family != AF_INET6) return 0;
+	in6 = (const void *)addr;
+	*bytes = in6->sin6_addr.s6_addr;
+	if (memcmp(*bytes, mapped, sizeof mapped) == 0) {
+		*bytes += sizeof mapped;
+		return AF_INET;
+	}
+	return AF_INET6;
+}
+
+/* whether the first `bits` bits of `a` and `b` are the same */
+static int prefix_eq(const unsigned char *a, const unsigned char *b, unsigned bits) {
+	unsigned whole = bits / 8, rest = bits % 8;
+	unsigned char mask;
+
+	if (memcmp(a, b, whole) != 0) return 0;
+	if (rest == 0) return 1;
+	mask = (unsigned char)(0xff << (8 - rest));
+	return (a[whole] & mask) == (b[whole] & mask);
+}
+
+int acl_match(const struct acl *acl, const struct sockaddr *addr) {
+	const unsigned char *bytes;
+	int family = address_of(addr, &bytes);
+	size_t i;
+
+	if (family == 0) return 0;
+	for (i = 0; i < acl->num; ++i) {
+		if (acl->nets[i].family == family &&
+				prefix_eq(acl->nets[i].addr, bytes, acl->nets[i].bits)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int acl_internal(const struct sockaddr *addr) {
+	static const unsigned char zero[16] = {0};
+	static const unsigned char link_local4[2] = {169, 254};
+	static const unsigned char link_local6[2] = {0xfe, 0x80};
+	const unsigned char *bytes;
+	int family = address_of(addr, &bytes);
+
+	if (family == AF_INET) {
+		/* 127.0.0.0/8, 0.0.0.0/8 and 169.254.0.0/16 */
+		return bytes[0] == 127 || bytes[0] == 0 || prefix_eq(bytes, link_local4, 16);
+	}
+	if (family == AF_INET6) {
+		/* ::1, :: and fe80::/10 */
+		return prefix_eq(bytes, zero, 120) ? bytes[15] <= 1 : prefix_eq(bytes, link_local6, 10);
+	}
+	return 0;
+}
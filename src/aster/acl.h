@@ -0,0 +1,34 @@
+#ifndef ACL_H
+#define ACL_H
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+/* an address block: "10.0.0.0/8", "fd00::/8" or an address alone */
+struct acl_net {
+	int family; /* AF_INET or AF_INET6 */
+	unsigned char addr[16];
+	unsigned bits;
+};
+
+/* the sources or destinations a forward proxy takes, IPv4-mapped IPv6
+   addresses matching as the IPv4 address they carry */
+struct acl {
+	struct acl_net *nets;
+	size_t num;
+};
+
+void acl_init(struct acl *acl);
+void acl_free(struct acl *acl);
+
+/* -1 if `net` is malformed */
+int acl_add(struct acl *acl, const char *net);
+
+/* whether `addr`, of any family, is in one of the blocks */
+int acl_match(const struct acl *acl, const struct sockaddr *addr);
+
+/* whether `addr` reaches this host or its link only: loopback, link-local
+   and unspecified addresses */
+int acl_internal(const struct sockaddr *addr);
+
+#endif
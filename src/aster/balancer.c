@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "balancer.h"
+#include "str.h"
+
+static const char *const policy_names[] = {
+	"least",
+	"p2c",
+	"hash-path",
+	"hash-host"
+};
+
+/* FNV-1a alone leaves nearby keys close together on the ring */
+static uint32_t mix(uint32_t h) {
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+static int point_cmp(const void *a, const void *b) {
+	const struct ring_point *pa = a, *pb = b;
+	if (pa->hash != pb->hash) return pa->hash < pb->hash ? -1 : 1;
+	return pa->backend < pb->backend ? -1 : pa->backend > pb->backend;
+}
+
+static void build_ring(struct balancer *b) {
+	char vnode[16];
+	uint32_t h;
+	size_t i, v;
+
+	b->ring_len = b->num_backends * BALANCER_VNODES;
+	b->ring = malloc(b->ring_len * sizeof *b->ring);
+	if (b->ring == NULL) {
+		perror("balancer_init");
+		exit(1);
+	}
+	/* named after the backends, so that every worker and every restart
+	   agree on where a key goes */
+	for (i = 0; i < b->num_backends; ++i) {
+		h = hash_bytes(b->backends[i].name, strlen(b->backends[i].name), HASH_SEED);
+		for (v = 0; v < BALANCER_VNODES; ++v) {
+			sprintf(vnode, "#%lu", (unsigned long)v);
+			b->ring[i * BALANCER_VNODES + v].hash = mix(hash_bytes(vnode, strlen(vnode), h));
+			b->ring[i * BALANCER_VNODES + v].backend = i;
+		}
+	}
+	qsort(b->ring, b->ring_len, sizeof *b->ring, point_cmp);
+}
+
+int balancer_init(struct balancer *b, const char *spec) {
+	const char *policy = strchr(spec, ';'), *pos, *end;
+	size_t list_len = policy != NULL ? (size_t)(policy - spec) : strlen(spec), n, i;
+	char name[300];
+
+	memset(b, 0, sizeof *b);
+	if (policy != NULL) {
+		policy++;
+		for (i = 0; i < sizeof policy_names / sizeof policy_names[0]; ++i) {
+			if (!strcmp(policy, policy_names[i])) break;
+		}
+		if (i == sizeof policy_names / sizeof policy_names[0]) return -1;
+		b->policy = (enum lb_policy)i;
+	}
+
+	for (n = 1, i = 0; i < list_len; ++i) {
+		if (spec[i] == ',') n++;
+	}
+	b->backends = malloc(n * sizeof *b->backends);
+	if (b->backends == NULL) {
+		perror("balancer_init");
+		exit(1);
+	}
+	for (pos = spec; b->num_backends < n; pos = end + 1) {
+		end = memchr(pos, ',', (size_t)(spec + list_len - pos));
+		if (end == NULL) end = spec + list_len;
+		if ((size_t)(end - pos) >= sizeof name) break;
+		memcpy(name, pos, (size_t)(end - pos));
+		name[end - pos] = '\0';
+		if (upstream_init(b->backends + b->num_backends, name) == -1) break;
+		b->num_backends++;
+	}
+	if (b->num_backends < n) {
+		balancer_free(b);
+		return -1;
+	}
+	if (b->policy == LB_HASH_PATH || b->policy == LB_HASH_HOST) build_ring(b);
+	return 0;
+}
+
+void balancer_free(struct balancer *b) {
+	size_t i;
+	for (i = 0; i < b->num_backends; ++i) {
+		upstream_free(b->backends + i);
+	}
+	free(b->backends);
+	free(b->ring);
+	b->backends = NULL;
+	b->ring = NULL;
+	b->num_backends = 0;
+}
+
+/* the backend with the fewest requests in flight, ties taking turns */
+static struct upstream *least(struct balancer *b, int any) {
+	struct upstream *best = NULL, *up;
+	size_t i;
+
+	for (i = 0; i < b->num_backends; ++i) {
+		up = b->backends + (b->next + i) % b->num_backends;
+		if (up->down && !any) continue;
+		if (best == NULL || up->outstanding < best->outstanding) best = up;
+	}
+	b->next = (b->next + 1) % b->num_backends;
+	return best;
+}
+
+static uint32_t next_random(struct balancer *b) {
+	/* workers fork from one balancer, each needs its own sequence */
+	if (b->rng == 0) b->rng = (uint32_t)getpid() ^ (uint32_t)time(NULL) ^ 0x9e3779b9u;
+	b->rng ^= b->rng << 13;
+	b->rng ^= b->rng >> 17;
+	b->rng ^= b->rng << 5;
+	return b->rng;
+}
+
+static struct upstream *two_choices(struct balancer *b) {
+	struct upstream *first, *second;
+	size_t i, j;
+
+	if (b->num_backends == 1) return b->backends;
+	i = next_random(b) % b->num_backends;
+	j = next_random(b) % (b->num_backends - 1);
+	if (j >= i) j++;
+	first = b->backends + i;
+	second = b->backends + j;
+	if (first->down && second->down) return least(b, 0);
+	if (first->down) return second;
+	if (second->down) return first;
+	return second->outstanding < first->outstanding ? second : first;
+}
+
+/* the first backend up past the key on the ring, so that ejecting one only
+   moves the keys it had */
+static struct upstream *hashed(struct balancer *b, const struct slice *key, int fold_case) {
+	uint32_t h = HASH_SEED;
+	size_t lo = 0, hi = b->ring_len, i;
+	struct upstream *up;
+
+	for (i = 0; i < key->len; ++i) {
+		h ^= (unsigned char)(fold_case && key->ptr[i] >= 'A' && key->ptr[i] <= 'Z' ?
+			key->ptr[i] - 'A' + 'a' : key->ptr[i]);
+		h *= 16777619u;
+	}
+	h = mix(h);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (b->ring[mid].hash < h) lo = mid + 1;
+		else hi = mid;
+	}
+	for (i = 0; i < b->ring_len; ++i) {
+		up = b->backends + b->ring[(lo + i) % b->ring_len].backend;
+		if (!up->down) return up;
+	}
+	return NULL;
+}
+
+struct upstream *balancer_pick(struct balancer *b, const struct http_request *req) {
+	struct upstream *up = NULL;
+
+	switch (b->policy) {
+	case LB_LEAST:
+		up = least(b, 0);
+		break;
+	case LB_P2C:
+		up = two_choices(b);
+		break;
+	case LB_HASH_PATH:
+		up = hashed(b, &req->path, 0);
+		break;
+	case LB_HASH_HOST:
+		up = hashed(b, &req->host, 1);
+		break;
+	}
+	/* with every backend ejected, one of them may still answer */
+	return up != NULL ? up : least(b, 1);
+}
@@ -0,0 +1,46 @@
+#ifndef BALANCER_H
+#define BALANCER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "request.h"
+#include "upstream.h"
+
+/* points each backend gets on the hash ring, enough for an even spread */
+#define BALANCER_VNODES 160
+
+enum lb_policy {
+	LB_LEAST = 0, /* fewest requests in flight */
+	LB_P2C, /* the less busy of two picked at random */
+	LB_HASH_PATH, /* a consistent hash of the path, for cache affinity */
+	LB_HASH_HOST /* the same, of the Host */
+};
+
+struct ring_point {
+	uint32_t hash;
+	size_t backend;
+};
+
+/* the backends one route spreads its requests over */
+struct balancer {
+	struct upstream *backends;
+	size_t num_backends;
+	enum lb_policy policy;
+
+	struct ring_point *ring; /* sorted, for the hashing policies */
+	size_t ring_len;
+
+	size_t next; /* where ties start, for least */
+	uint32_t rng; /* for p2c, seeded on first use */
+};
+
+/* parse "host:port[,host:port]...[;policy]", the policy being least (the
+   default), p2c, hash-path or hash-host; -1 if malformed or some backend
+   does not resolve */
+int balancer_init(struct balancer *b, const char *spec);
+void balancer_free(struct balancer *b);
+
+/* the backend to send `req` to, passing over ejected ones unless all are */
+struct upstream *balancer_pick(struct balancer *b, const struct http_request *req);
+
+#endif
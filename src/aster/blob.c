@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "blob.h"
+
+struct blob *blob_new(unsigned char *data, size_t len) {
+	struct blob *blob = malloc(sizeof *blob);
+	if (blob == NULL) {
+		perror("blob_new");
+		exit(1);
+	}
+	blob->data = data;
+	blob->len = len;
+	blob->refs = 1;
+	return blob;
+}
+
+struct blob *blob_ref(struct blob *blob) {
+	blob->refs++;
+	return blob;
+}
+
+void blob_unref(struct blob *blob) {
+	if (blob == NULL || --blob->refs > 0) return;
+	free(blob->data);
+	free(blob);
+}
@@ -0,0 +1,20 @@
+#ifndef BLOB_H
+#define BLOB_H
+
+#include <stddef.h>
+
+/* reference counted bytes, for cache entries that may be evicted while a
+   connection still has them queued */
+struct blob {
+	unsigned char *data;
+	size_t len;
+	size_t refs;
+};
+
+/* wrap malloc'd `data` with one reference */
+struct blob *blob_new(unsigned char *data, size_t len);
+struct blob *blob_ref(struct blob *blob);
+/* free the bytes with the last reference; NULL is ignored */
+void blob_unref(struct blob *blob);
+
+#endif
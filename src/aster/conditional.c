@@ -0,0 +1,101 @@
+#include <string.h>
+#include "conditional.h"
+#include "datetime.h"
+#include "str.h"
+
+static int is_etagc(char ch) {
+	unsigned char uch = (unsigned char)ch;
+	return uch == 0x21 || (uch >= 0x23 && uch != 0x7F);
+}
+
+int etag_list_matches(const struct slice *list, const char *etag, size_t etag_len, int weak) {
+	const char *ptr = list->ptr;
+	const char *end = list->ptr + list->len;
+	int found = 0, items = 0;
+
+	while (ptr < end) {
+		const char *tag;
+		int is_weak = 0;
+
+		while (ptr < end && (*ptr == SYM_SP || *ptr == SYM_HTAB || *ptr == ',')) ptr++;
+		if (ptr == end) break;
+
+		if (*ptr == '*') {
+			ptr++;
+			found = 1;
+		} else {
+			if (end - ptr >= 2 && ptr[0] == 'W' && ptr[1] == '/') {
+				is_weak = 1;
+				ptr += 2;
+			}
+			tag = ptr;
+			if (ptr == end || *ptr++ != '"') return -1;
+			while (ptr < end && is_etagc(*ptr)) ptr++;
+			if (ptr == end || *ptr++ != '"') return -1;
+			if ((weak || !is_weak) && (size_t)(ptr - tag) == etag_len &&
+					!memcmp(tag, etag, etag_len)) {
+				found = 1;
+			}
+		}
+		items++;
+
+		while (ptr < end && (*ptr == SYM_SP || *ptr == SYM_HTAB)) ptr++;
+		if (ptr < end && *ptr != ',') return -1;
+	}
+	return items == 0 ? -1 : found;
+}
+
+int is_not_modified(
+		const struct http_request *req,
+		const char *etag,
+		size_t etag_len,
+		time_t mtime
+) {
+	size_t idx;
+	time_t since;
+
+	if (req->method != HM_GET && req->method != HM_HEAD) return 0;
+
+	if (headers_count(req, HH_IF_NONE_MATCH) > 0) {
+		/* field lines combine into one list */
+		for (idx = headers_first(req, HH_IF_NONE_MATCH); idx != SIZE_MAX;
+				idx = headers_next(req, idx)) {
+			if (etag_list_matches(&req->headers[idx].value, etag, etag_len, 1) == 1) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	if (headers_count(req, HH_IF_MODIFIED_SINCE) == 1) {
+		const struct slice *value =
+			&req->headers[headers_first(req, HH_IF_MODIFIED_SINCE)].value;
+		if (parse_http_date(value->ptr, value->len, &since) == 0) {
+			return mtime <= since;
+		}
+	}
+	return 0;
+}
+
+int if_range_holds(
+		const struct http_request *req,
+		const char *etag,
+		size_t etag_len,
+		time_t mtime,
+		time_t now
+) {
+	const struct slice *value;
+	time_t date;
+
+	if (headers_count(req, HH_IF_RANGE) == 0) return 1;
+	if (headers_count(req, HH_IF_RANGE) > 1) return 0;
+
+	value = &req->headers[headers_first(req, HH_IF_RANGE)].value;
+	if (value->len > 0 && value->ptr[0] == '"') {
+		return value->len == etag_len && !memcmp(value->ptr, etag, etag_len);
+	}
+	if (parse_http_date(value->ptr, value->len, &date) == 0) {
+		return date == mtime && mtime < now - 1;
+	}
+	return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef CONDITIONAL_H
+#define CONDITIONAL_H
+
+#include <stddef.h>
+#include <time.h>
+#include "request.h"
+
+/* 1 if `list` ("*" or 1#entity-tag) holds the strong tag `etag`, 0 if not,
+   -1 if malformed. Weak comparison ignores the "W/" of listed tags */
+int etag_list_matches(const struct slice *list, const char *etag, size_t etag_len, int weak);
+
+/* If-None-Match, or If-Modified-Since in its absence (RFC 9110 section
+   13.2.2): 1 if the client's copy of a GET or HEAD is current */
+int is_not_modified(
+		const struct http_request *req,
+		const char *etag,
+		size_t etag_len,
+		time_t mtime
+);
+
+/* 1 if Range is to be honoured: no If-Range, or one naming the current
+   strong tag, or the exact Last-Modified date when that is a strong
+   validator (older than a second at `now`) */
+int if_range_holds(
+		const struct http_request *req,
+		const char *etag,
+		size_t etag_len,
+		time_t mtime,
+		time_t now
+);
+
+#endif
@@ -1,16 +1,104 @@
-#include <time.h>
+#include <string.h>
 #include "datetime.h"
+#include "str.h"
 
-/* IMF-fixdate
-   Example:
-   Sun, 06 Nov 1994 08:49:37 GMT
- */
-void get_current_time(char buf[29]) {
-	time_t rawtime;
-	struct tm *timeinfo;
+static const char days[7][4] = {"Thu", "Fri", "Sat", "Sun", "Mon", "Tue", "Wed"};
+static const char months[12][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
 
-	time(&rawtime);
-	timeinfo = localtime(&rawtime);
+/* days since 1970-01-01 of a proleptic Gregorian date, month 1..12 */
+static long days_from_civil(long y, unsigned m, unsigned d) {
+	long era;
+	unsigned yoe, doy, doe;
 
-	strftime(buf, 30, "%a, %d %b %Y %H:%M:%S GMT", timeinfo);
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = (unsigned)(y - era * 400);
+	doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (long)doe - 719468;
+}
+
+static void civil_from_days(long z, long *y, unsigned *m, unsigned *d) {
+	long era;
+	unsigned doe, yoe, doy, mp;
+
+	z += 719468;
+	era = (z >= 0 ? z : z - 146096) / 146097;
+	doe = (unsigned)(z - era * 146097);
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+	*d = doy - (153 * mp + 2) / 5 + 1;
+	*m = mp < 10 ? mp + 3 : mp - 9;
+	*y = (long)yoe + era * 400 + (*m <= 2);
+}
+
+static void put2(char *buf, unsigned value) {
+	buf[0] = (char)('0' + value / 10 % 10);
+	buf[1] = (char)('0' + value % 10);
+}
+
+void format_http_date(time_t t, char buf[HTTP_DATE_LEN + 1]) {
+	long secs = (long)t;
+	long z = (secs >= 0 ? secs : secs - 86399) / 86400;
+	long rem = secs - z * 86400;
+	long y;
+	unsigned m, d;
+
+	civil_from_days(z, &y, &m, &d);
+	memcpy(buf, days[((z % 7) + 7) % 7], 3);
+	memcpy(buf + 3, ", ", 2);
+	put2(buf + 5, d);
+	buf[7] = ' ';
+	memcpy(buf + 8, months[m - 1], 3);
+	buf[11] = ' ';
+	put2(buf + 12, (unsigned)(y / 100));
+	put2(buf + 14, (unsigned)(y % 100));
+	buf[16] = ' ';
+	put2(buf + 17, (unsigned)(rem / 3600));
+	buf[19] = ':';
+	put2(buf + 20, (unsigned)(rem / 60 % 60));
+	buf[22] = ':';
+	put2(buf + 23, (unsigned)(rem % 60));
+	memcpy(buf + 25, " GMT", 5);
+}
+
+void get_current_time(char buf[HTTP_DATE_LEN + 1]) {
+	format_http_date(time(NULL), buf);
+}
+
+static int digits(const char *ptr, size_t n, unsigned *out) {
+	size_t i;
+	*out = 0;
+	for (i = 0; i < n; ++i) {
+		if (!is_digit(ptr[i])) return -1;
+		*out = *out * 10 + to_digit(ptr[i]);
+	}
+	return 0;
+}
+
+/* fixed layout, so every field sits at a known offset */
+int parse_http_date(const char *ptr, size_t len, time_t *out) {
+	unsigned day, year, hour, min, sec, month;
+
+	if (len != HTTP_DATE_LEN || ptr[3] != ',' || ptr[4] != ' ' ||
+			ptr[7] != ' ' || ptr[11] != ' ' || ptr[16] != ' ' ||
+			ptr[19] != ':' || ptr[22] != ':' || memcmp(ptr + 25, " GMT", 4)) {
+		return -1;
+	}
+	if (digits(ptr + 5, 2, &day) || digits(ptr + 12, 4, &year) ||
+			digits(ptr + 17, 2, &hour) || digits(ptr + 20, 2, &min) ||
+			digits(ptr + 23, 2, &sec)) {
+		return -1;
+	}
+	month = 0;
+	while (month < 12 && memcmp(ptr + 8, months[month], 3)) month++;
+	if (month == 12 || day < 1 || day > 31 || hour > 23 || min > 59 || sec > 60) {
+		return -1;
+	}
+
+	*out = (time_t)(days_from_civil((long)year, month + 1, day) * 86400 +
+		(long)(hour * 3600 + min * 60 + sec));
+	return 0;
 }
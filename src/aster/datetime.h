@@ -1 +1,23 @@
-void get_current_time(char buf[29]);
+#ifndef DATETIME_H
+#define DATETIME_H
+
+#include <stddef.h>
+#include <time.h>
+
+/* IMF-fixdate
+   Example:
+   Sun, 06 Nov 1994 08:49:37 GMT
+ */
+#define HTTP_DATE_LEN 29
+
+/* current time as IMF-fixdate, NUL-terminated */
+void get_current_time(char buf[HTTP_DATE_LEN + 1]);
+
+/* `t` as IMF-fixdate, NUL-terminated */
+void format_http_date(time_t t, char buf[HTTP_DATE_LEN + 1]);
+
+/* parse an IMF-fixdate, -1 otherwise; the obsolete RFC 850 and asctime forms
+   count as invalid, so the fields carrying them get ignored */
+int parse_http_date(const char *ptr, size_t len, time_t *out);
+
+#endif
@@ -0,0 +1,719 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "deflate.h"
+
+#define WSIZE 32768
+#define WMASK (WSIZE - 1)
+#define HASH_BITS 15
+#define HASH_SIZE (1 << HASH_BITS)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define TOO_FAR 4096 /* length 3 matches further away cost more than literals */
+
+#define BLOCK_SYMBOLS 16384
+#define END_BLOCK 256
+#define LITLEN_CODES 286
+#define DIST_CODES 30
+#define CLEN_CODES 19
+#define MAX_BITS 15
+#define MAX_CLEN_BITS 7
+#define MAX_STORED 65535
+
+struct level_config {
+	unsigned good_length; /* reduce lazy search above this match length */
+	unsigned max_lazy; /* do not look for a better match above this */
+	unsigned nice_length; /* stop searching above this match length */
+	unsigned max_chain;
+	int lazy;
+};
+
+/* after zlib's configuration table */
+static const struct level_config levels[DEFLATE_MAX_LEVEL + 1] = {
+	{0, 0, 0, 0, 0},
+	{4, 4, 8, 4, 0},
+	{4, 5, 16, 8, 0},
+	{4, 6, 32, 32, 0},
+	{4, 4, 16, 16, 1},
+	{8, 16, 32, 32, 1},
+	{8, 16, 128, 128, 1},
+	{8, 32, 128, 256, 1},
+	{32, 128, 258, 1024, 1},
+	{32, 258, 258, 4096, 1}
+};
+
+static const unsigned short length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short dist_base[DIST_CODES] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+static const unsigned char dist_extra[DIST_CODES] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const unsigned char clen_order[CLEN_CODES] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static unsigned char length_code[MAX_MATCH + 1]; /* match length to code */
+static unsigned char dist_code_lo[256]; /* distance - 1 < 256 */
+static unsigned char dist_code_hi[256]; /* (distance - 1) >> 7 */
+static uint32_t crc_table[256];
+static int tables_ready = 0;
+
+static void init_tables(void) {
+	unsigned code, len, dist;
+	uint32_t c;
+	int k;
+
+	for (code = 0; code < 29; ++code) {
+		for (len = length_base[code];
+				len < length_base[code] + (1u << length_extra[code]) &&
+				len <= MAX_MATCH; ++len) {
+			length_code[len] = (unsigned char)code;
+		}
+	}
+	length_code[MAX_MATCH] = 28;
+
+	for (code = 0; code < DIST_CODES; ++code) {
+		for (dist = dist_base[code];
+				dist < dist_base[code] + (1u << dist_extra[code]); ++dist) {
+			if (dist <= 256) {
+				dist_code_lo[dist - 1] = (unsigned char)code;
+			} else {
+				dist_code_hi[(dist - 1) >> 7] = (unsigned char)code;
+			}
+		}
+	}
+
+	for (c = 0; c < 256; ++c) {
+		uint32_t r = c;
+		for (k = 0; k < 8; ++k) {
+			r = r & 1 ? 0xEDB88320u ^ (r >> 1) : r >> 1;
+		}
+		crc_table[c] = r;
+	}
+	tables_ready = 1;
+}
+
+static unsigned dist_code(unsigned dist) {
+	return dist <= 256 ? dist_code_lo[dist - 1] : dist_code_hi[(dist - 1) >> 7];
+}
+
+uint32_t crc32_update(uint32_t crc, const unsigned char *data, size_t len) {
+	size_t i;
+	if (!tables_ready) init_tables();
+	crc = ~crc;
+	for (i = 0; i < len; ++i) {
+		crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+/* LSB-first bit sink, as deflate packs its fields */
+struct bit_writer {
+	unsigned char *buf;
+	size_t len, cap;
+	uint32_t bits;
+	unsigned count;
+};
+
+static void reserve(struct bit_writer *bw, size_t n) {
+	if (bw->len + n <= bw->cap) return;
+	while (bw->len + n > bw->cap) bw->cap = bw->cap ? bw->cap * 2 : 1024;
+	bw->buf = realloc(bw->buf, bw->cap);
+	if (bw->buf == NULL) {
+		perror("deflate");
+		exit(1);
+	}
+}
+
+static void put_bits(struct bit_writer *bw, uint32_t value, unsigned n) {
+	bw->bits |= value << bw->count;
+	bw->count += n;
+	if (bw->count >= 16) {
+		reserve(bw, 2);
+		bw->buf[bw->len++] = (unsigned char)bw->bits;
+		bw->buf[bw->len++] = (unsigned char)(bw->bits >> 8);
+		bw->bits >>= 16;
+		bw->count -= 16;
+	}
+}
+
+static void align_byte(struct bit_writer *bw) {
+	reserve(bw, 2);
+	while (bw->count > 0) {
+		bw->buf[bw->len++] = (unsigned char)bw->bits;
+		bw->bits >>= 8;
+		bw->count = bw->count > 8 ? bw->count - 8 : 0;
+	}
+	bw->bits = 0;
+}
+
+static void put_bytes(struct bit_writer *bw, const unsigned char *data, size_t n) {
+	reserve(bw, n);
+	memcpy(bw->buf + bw->len, data, n);
+	bw->len += n;
+}
+
+struct huff_node {
+	uint32_t freq;
+	int sym;
+};
+
+static int compare_nodes(const void *a, const void *b) {
+	const struct huff_node *x = a, *y = b;
+	if (x->freq != y->freq) return x->freq < y->freq ? -1 : 1;
+	return x->sym - y->sym;
+}
+
+/* Huffman code lengths no longer than `limit`; frequencies are flattened
+   until the tree fits, which costs little in practice */
+static void build_lengths(const uint32_t *freq, int n, unsigned limit, unsigned char *lengths) {
+	struct huff_node leaves[LITLEN_CODES];
+	uint32_t weight[2 * LITLEN_CODES];
+	int parent[2 * LITLEN_CODES];
+	unsigned depth[2 * LITLEN_CODES];
+	uint32_t scaled[LITLEN_CODES];
+	int m = 0, i, k;
+	int leaf, inner, next;
+	unsigned max_depth;
+
+	memset(lengths, 0, (size_t)n);
+	for (i = 0; i < n; ++i) {
+		scaled[i] = freq[i];
+		if (freq[i] > 0) m++;
+	}
+	if (m == 0) return;
+	if (m == 1) {
+		for (i = 0; i < n; ++i) {
+			if (freq[i] > 0) lengths[i] = 1;
+		}
+		return;
+	}
+
+	while (1) {
+		for (i = 0, k = 0; i < n; ++i) {
+			if (scaled[i] == 0) continue;
+			leaves[k].freq = scaled[i];
+			leaves[k].sym = i;
+			k++;
+		}
+		qsort(leaves, (size_t)m, sizeof leaves[0], compare_nodes);
+		for (i = 0; i < m; ++i) {
+			weight[i] = leaves[i].freq;
+		}
+
+		/* two-queue construction: leaves and inner nodes both come out
+		   sorted, inner nodes are appended after the leaves */
+		leaf = 0;
+		inner = m;
+		for (next = m; next < 2 * m - 1; ++next) {
+			int pick[2];
+			for (k = 0; k < 2; ++k) {
+				if (leaf < m && (inner >= next || weight[leaf] <= weight[inner])) {
+					pick[k] = leaf++;
+				} else {
+					pick[k] = inner++;
+				}
+			}
+			weight[next] = weight[pick[0]] + weight[pick[1]];
+			parent[pick[0]] = next;
+			parent[pick[1]] = next;
+		}
+
+		depth[2 * m - 2] = 0;
+		max_depth = 0;
+		for (i = 2 * m - 3; i >= 0; --i) {
+			depth[i] = depth[parent[i]] + 1;
+			if (i < m && depth[i] > max_depth) max_depth = depth[i];
+		}
+		if (max_depth <= limit) break;
+
+		for (i = 0; i < n; ++i) {
+			if (scaled[i] > 0) scaled[i] = (scaled[i] >> 1) | 1;
+		}
+	}
+
+	for (i = 0; i < m; ++i) {
+		lengths[leaves[i].sym] = (unsigned char)depth[i];
+	}
+}
+
+/* inflaters reject incomplete codes, so a lone symbol gets a sibling */
+static void complete_lengths(unsigned char *lengths, int n) {
+	int i, used = 0, last = 0;
+	for (i = 0; i < n; ++i) {
+		if (lengths[i]) {
+			used++;
+			last = i;
+		}
+	}
+	if (used == 0) {
+		lengths[0] = 1;
+		lengths[1] = 1;
+	} else if (used == 1) {
+		lengths[last == 0 ? 1 : 0] = 1;
+	}
+}
+
+/* canonical codes, bit-reversed for LSB-first output */
+static void build_codes(const unsigned char *lengths, int n, unsigned short *codes) {
+	unsigned bl_count[MAX_BITS + 1];
+	unsigned next_code[MAX_BITS + 1];
+	unsigned code = 0, bits;
+	int i;
+
+	memset(bl_count, 0, sizeof bl_count);
+	for (i = 0; i < n; ++i) {
+		bl_count[lengths[i]]++;
+	}
+	bl_count[0] = 0;
+	for (bits = 1; bits <= MAX_BITS; ++bits) {
+		code = (code + bl_count[bits - 1]) << 1;
+		next_code[bits] = code;
+	}
+	for (i = 0; i < n; ++i) {
+		unsigned len = lengths[i], c, r = 0, b;
+		if (len == 0) continue;
+		c = next_code[len]++;
+		for (b = 0; b < len; ++b) {
+			r = (r << 1) | ((c >> b) & 1);
+		}
+		codes[i] = (unsigned short)r;
+	}
+}
+
+/* symbols of the block being assembled; dist 0 marks a literal */
+struct block {
+	unsigned short litlen[BLOCK_SYMBOLS];
+	unsigned short dist[BLOCK_SYMBOLS];
+	size_t count;
+	size_t start; /* input offset of the first covered byte */
+	uint32_t lit_freq[LITLEN_CODES];
+	uint32_t dist_freq[DIST_CODES];
+};
+
+struct deflate_state {
+	const unsigned char *in;
+	size_t len;
+	const struct level_config *config;
+	int head[HASH_SIZE];
+	int prev[WSIZE];
+	struct block blk;
+	struct bit_writer bw;
+};
+
+static void write_symbols(
+		struct deflate_state *s,
+		const unsigned short *lit_codes,
+		const unsigned char *lit_lens,
+		const unsigned short *dist_codes,
+		const unsigned char *dist_lens
+) {
+	const struct block *blk = &s->blk;
+	size_t i;
+
+	for (i = 0; i < blk->count; ++i) {
+		unsigned len = blk->litlen[i];
+		unsigned dist = blk->dist[i];
+		unsigned code;
+		if (dist == 0) {
+			put_bits(&s->bw, lit_codes[len], lit_lens[len]);
+			continue;
+		}
+		code = length_code[len];
+		put_bits(&s->bw, lit_codes[257 + code], lit_lens[257 + code]);
+		if (length_extra[code]) {
+			put_bits(&s->bw, len - length_base[code], length_extra[code]);
+		}
+		code = dist_code(dist);
+		put_bits(&s->bw, dist_codes[code], dist_lens[code]);
+		if (dist_extra[code]) {
+			put_bits(&s->bw, dist - dist_base[code], dist_extra[code]);
+		}
+	}
+	put_bits(&s->bw, lit_codes[END_BLOCK], lit_lens[END_BLOCK]);
+}
+
+static size_t extra_bits(const struct block *blk) {
+	size_t bits = 0;
+	int c;
+	for (c = 0; c < 29; ++c) {
+		bits += (size_t)blk->lit_freq[257 + c] * length_extra[c];
+	}
+	for (c = 0; c < DIST_CODES; ++c) {
+		bits += (size_t)blk->dist_freq[c] * dist_extra[c];
+	}
+	return bits;
+}
+
+/* run-length encode code lengths into code length symbols, extra bits of
+   each symbol in the upper byte */
+static size_t encode_lengths(const unsigned char *lens, size_t n, unsigned short *out, uint32_t *freq) {
+	size_t i = 0, count = 0;
+
+	while (i < n) {
+		unsigned char len = lens[i];
+		size_t run = 1;
+		while (i + run < n && lens[i + run] == len) run++;
+
+		if (len == 0 && run >= 3) {
+			if (run > 138) run = 138;
+			if (run <= 10) {
+				out[count++] = (unsigned short)(17 | ((run - 3) << 8));
+				freq[17]++;
+			} else {
+				out[count++] = (unsigned short)(18 | ((run - 11) << 8));
+				freq[18]++;
+			}
+			i += run;
+			continue;
+		}
+
+		out[count++] = len;
+		freq[len]++;
+		i++;
+		run--;
+		while (len != 0 && run >= 3) {
+			size_t rep = run > 6 ? 6 : run;
+			out[count++] = (unsigned short)(16 | ((rep - 3) << 8));
+			freq[16]++;
+			i += rep;
+			run -= rep;
+		}
+	}
+	return count;
+}
+
+static void flush_block(struct deflate_state *s, size_t end, int final) {
+	struct block *blk = &s->blk;
+	unsigned char lit_lens[LITLEN_CODES], dist_lens[DIST_CODES];
+	unsigned short lit_codes[LITLEN_CODES], dist_codes[DIST_CODES];
+	unsigned char fixed_lit_lens[288], fixed_dist_lens[DIST_CODES];
+	unsigned short fixed_lit_codes[288], fixed_dist_codes[DIST_CODES];
+	unsigned char all_lens[LITLEN_CODES + DIST_CODES];
+	unsigned short clen_syms[LITLEN_CODES + DIST_CODES];
+	uint32_t clen_freq[CLEN_CODES];
+	unsigned char clen_lens[CLEN_CODES];
+	unsigned short clen_codes[CLEN_CODES];
+	size_t num_clen_syms, i;
+	size_t dyn_bits, fixed_bits, stored_bits, raw_len = end - blk->start;
+	int hlit, hdist, hclen, c;
+
+	blk->lit_freq[END_BLOCK]++;
+
+	build_lengths(blk->lit_freq, LITLEN_CODES, MAX_BITS, lit_lens);
+	build_lengths(blk->dist_freq, DIST_CODES, MAX_BITS, dist_lens);
+	complete_lengths(lit_lens, LITLEN_CODES);
+	complete_lengths(dist_lens, DIST_CODES);
+
+	for (hlit = LITLEN_CODES; hlit > 257 && lit_lens[hlit - 1] == 0; --hlit);
+	for (hdist = DIST_CODES; hdist > 1 && dist_lens[hdist - 1] == 0; --hdist);
+	memcpy(all_lens, lit_lens, (size_t)hlit);
+	memcpy(all_lens + hlit, dist_lens, (size_t)hdist);
+	memset(clen_freq, 0, sizeof clen_freq);
+	num_clen_syms = encode_lengths(all_lens, (size_t)(hlit + hdist), clen_syms, clen_freq);
+	build_lengths(clen_freq, CLEN_CODES, MAX_CLEN_BITS, clen_lens);
+	complete_lengths(clen_lens, CLEN_CODES);
+	for (hclen = CLEN_CODES; hclen > 4 && clen_lens[clen_order[hclen - 1]] == 0; --hclen);
+
+	/* cost of each block type */
+	dyn_bits = 3 + 5 + 5 + 4 + 3 * (size_t)hclen + extra_bits(blk);
+	fixed_bits = 3 + extra_bits(blk);
+	for (i = 0; i < num_clen_syms; ++i) {
+		unsigned sym = clen_syms[i] & 0xFF;
+		dyn_bits += clen_lens[sym] + (sym == 16 ? 2 : sym == 17 ? 3 : sym == 18 ? 7 : 0);
+	}
+	for (c = 0; c < LITLEN_CODES; ++c) {
+		dyn_bits += (size_t)blk->lit_freq[c] * lit_lens[c];
+		fixed_bits += (size_t)blk->lit_freq[c] * (c < 144 ? 8 : c < 256 ? 9 : c < 280 ? 7 : 8);
+	}
+	for (c = 0; c < DIST_CODES; ++c) {
+		dyn_bits += (size_t)blk->dist_freq[c] * dist_lens[c];
+		fixed_bits += (size_t)blk->dist_freq[c] * 5;
+	}
+	stored_bits = (raw_len + 5 * (raw_len / MAX_STORED + 1)) * 8 + 7;
+
+	if (stored_bits <= dyn_bits && stored_bits <= fixed_bits) {
+		size_t off = blk->start;
+		do {
+			size_t chunk = end - off > MAX_STORED ? MAX_STORED : end - off;
+			unsigned char hdr[4];
+			int last = final && off + chunk == end;
+			put_bits(&s->bw, (uint32_t)last, 3);
+			align_byte(&s->bw);
+			hdr[0] = (unsigned char)chunk;
+			hdr[1] = (unsigned char)(chunk >> 8);
+			hdr[2] = (unsigned char)~chunk;
+			hdr[3] = (unsigned char)(~chunk >> 8);
+			put_bytes(&s->bw, hdr, 4);
+			put_bytes(&s->bw, s->in + off, chunk);
+			off += chunk;
+		} while (off < end);
+	} else if (fixed_bits <= dyn_bits) {
+		for (c = 0; c < 288; ++c) {
+			fixed_lit_lens[c] = (unsigned char)(c < 144 ? 8 : c < 256 ? 9 : c < 280 ? 7 : 8);
+		}
+		memset(fixed_dist_lens, 5, sizeof fixed_dist_lens);
+		build_codes(fixed_lit_lens, 288, fixed_lit_codes);
+		build_codes(fixed_dist_lens, DIST_CODES, fixed_dist_codes);
+		put_bits(&s->bw, (uint32_t)(final | (1 << 1)), 3);
+		write_symbols(s, fixed_lit_codes, fixed_lit_lens,
+			fixed_dist_codes, fixed_dist_lens);
+	} else {
+		build_codes(lit_lens, LITLEN_CODES, lit_codes);
+		build_codes(dist_lens, DIST_CODES, dist_codes);
+		build_codes(clen_lens, CLEN_CODES, clen_codes);
+		put_bits(&s->bw, (uint32_t)(final | (2 << 1)), 3);
+		put_bits(&s->bw, (uint32_t)(hlit - 257), 5);
+		put_bits(&s->bw, (uint32_t)(hdist - 1), 5);
+		put_bits(&s->bw, (uint32_t)(hclen - 4), 4);
+		for (c = 0; c < hclen; ++c) {
+			put_bits(&s->bw, clen_lens[clen_order[c]], 3);
+		}
+		for (i = 0; i < num_clen_syms; ++i) {
+			unsigned sym = clen_syms[i] & 0xFF;
+			unsigned extra = clen_syms[i] >> 8;
+			put_bits(&s->bw, clen_codes[sym], clen_lens[sym]);
+			if (sym == 16) put_bits(&s->bw, extra, 2);
+			else if (sym == 17) put_bits(&s->bw, extra, 3);
+			else if (sym == 18) put_bits(&s->bw, extra, 7);
+		}
+		write_symbols(s, lit_codes, lit_lens, dist_codes, dist_lens);
+	}
+
+	blk->count = 0;
+	blk->start = end;
+	memset(blk->lit_freq, 0, sizeof blk->lit_freq);
+	memset(blk->dist_freq, 0, sizeof blk->dist_freq);
+}
+
+static void emit_literal(struct deflate_state *s, size_t pos) {
+	struct block *blk = &s->blk;
+	blk->litlen[blk->count] = s->in[pos];
+	blk->dist[blk->count] = 0;
+	blk->lit_freq[s->in[pos]]++;
+	if (++blk->count == BLOCK_SYMBOLS) flush_block(s, pos + 1, 0);
+}
+
+/* `pos` is the first byte after the match */
+static void emit_match(struct deflate_state *s, unsigned len, unsigned dist, size_t pos) {
+	struct block *blk = &s->blk;
+	blk->litlen[blk->count] = (unsigned short)len;
+	blk->dist[blk->count] = (unsigned short)dist;
+	blk->lit_freq[257 + length_code[len]]++;
+	blk->dist_freq[dist_code(dist)]++;
+	if (++blk->count == BLOCK_SYMBOLS) flush_block(s, pos, 0);
+}
+
+static unsigned hash3(const unsigned char *p) {
+	return (((unsigned)p[0] << 10) ^ ((unsigned)p[1] << 5) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+/* insert pos into the hash chains, return the previous chain head */
+static int insert_string(struct deflate_state *s, size_t pos) {
+	unsigned h = hash3(s->in + pos);
+	int head = s->head[h];
+	s->prev[pos & WMASK] = head;
+	s->head[h] = (int)pos;
+	return head;
+}
+
+static unsigned longest_match(
+		struct deflate_state *s,
+		size_t pos,
+		int cand,
+		unsigned prev_len,
+		unsigned *dist
+) {
+	unsigned chain = s->config->max_chain;
+	unsigned best = prev_len;
+	unsigned max_len = s->len - pos > MAX_MATCH ? MAX_MATCH : (unsigned)(s->len - pos);
+	unsigned nice = s->config->nice_length < max_len ? s->config->nice_length : max_len;
+	const unsigned char *scan = s->in + pos;
+
+	if (best >= max_len) return 0;
+	if (prev_len >= s->config->good_length) chain >>= 2;
+
+	while (cand >= 0 && pos - (size_t)cand <= WSIZE && chain-- > 0) {
+		const unsigned char *match = s->in + cand;
+		int next;
+		if (match[best] == scan[best] && match[0] == scan[0] && match[1] == scan[1]) {
+			unsigned len = 2;
+			while (len < max_len && match[len] == scan[len]) len++;
+			if (len > best) {
+				best = len;
+				*dist = (unsigned)(pos - (size_t)cand);
+				if (len >= nice) break;
+			}
+		}
+		next = s->prev[cand & WMASK];
+		if (next >= cand) break; /* slot reused by a newer position */
+		cand = next;
+	}
+	if (best == MIN_MATCH && *dist > TOO_FAR) return 0;
+	return best > prev_len ? best : 0;
+}
+
+static void deflate_greedy(struct deflate_state *s) {
+	size_t pos = 0;
+	while (pos < s->len) {
+		unsigned len = 0, dist = 0;
+		if (pos + MIN_MATCH <= s->len) {
+			int cand = insert_string(s, pos);
+			len = longest_match(s, pos, cand, MIN_MATCH - 1, &dist);
+		}
+		if (len >= MIN_MATCH) {
+			size_t end = pos + len;
+			/* index the covered positions of short matches only */
+			if (len <= s->config->max_lazy) {
+				for (pos++; pos < end && pos + MIN_MATCH <= s->len; ++pos) {
+					insert_string(s, pos);
+				}
+			}
+			pos = end;
+			emit_match(s, len, dist, end);
+		} else {
+			emit_literal(s, pos);
+			pos++;
+		}
+	}
+}
+
+static void deflate_lazy(struct deflate_state *s) {
+	size_t pos = 0;
+	unsigned prev_len = 0, prev_dist = 0;
+	int match_available = 0;
+
+	while (pos < s->len) {
+		unsigned len = 0, dist = 0;
+
+		if (pos + MIN_MATCH <= s->len) {
+			int cand = insert_string(s, pos);
+			if (prev_len < s->config->max_lazy) {
+				len = longest_match(s, pos, cand,
+					prev_len >= MIN_MATCH ? prev_len : MIN_MATCH - 1,
+					&dist);
+			}
+		}
+
+		if (prev_len >= MIN_MATCH && len <= prev_len) {
+			/* the match found at pos - 1 wins */
+			size_t end = pos - 1 + prev_len;
+			for (pos++; pos < end && pos + MIN_MATCH <= s->len; ++pos) {
+				insert_string(s, pos);
+			}
+			pos = end;
+			emit_match(s, prev_len, prev_dist, end);
+			match_available = 0;
+			prev_len = 0;
+			continue;
+		}
+		if (match_available) {
+			emit_literal(s, pos - 1);
+		}
+		match_available = 1;
+		prev_len = len;
+		prev_dist = dist;
+		pos++;
+	}
+	if (match_available) {
+		emit_literal(s, s->len - 1);
+	}
+}
+
+void deflate_compress(
+		const unsigned char *in,
+		size_t len,
+		int level,
+		unsigned char **out,
+		size_t *out_len
+) {
+	struct deflate_state *s = malloc(sizeof *s);
+
+	if (s == NULL) {
+		perror("deflate_compress");
+		exit(1);
+	}
+	if (!tables_ready) init_tables();
+	if (level < DEFLATE_MIN_LEVEL) level = DEFLATE_MIN_LEVEL;
+	if (level > DEFLATE_MAX_LEVEL) level = DEFLATE_MAX_LEVEL;
+
+	s->in = in;
+	s->len = len;
+	s->config = levels + level;
+	memset(s->head, 0xFF, sizeof s->head);
+	memset(&s->blk, 0, sizeof s->blk);
+	s->bw.buf = *out;
+	s->bw.len = *out_len;
+	s->bw.cap = *out_len;
+	s->bw.bits = 0;
+	s->bw.count = 0;
+
+	if (s->config->lazy) {
+		deflate_lazy(s);
+	} else {
+		deflate_greedy(s);
+	}
+	flush_block(s, len, 1);
+	align_byte(&s->bw);
+
+	*out = s->bw.buf;
+	*out_len = s->bw.len;
+	free(s);
+}
+
+void gzip_compress(
+		const unsigned char *in,
+		size_t len,
+		int level,
+		unsigned char **out,
+		size_t *out_len
+) {
+	unsigned char *buf = malloc(10);
+	size_t buf_len = 10;
+	uint32_t crc = crc32_update(0, in, len);
+	unsigned char *trailer;
+
+	if (buf == NULL) {
+		perror("gzip_compress");
+		exit(1);
+	}
+	/* magic, deflate, no flags, no mtime, extra flags, Unix */
+	buf[0] = 0x1F;
+	buf[1] = 0x8B;
+	buf[2] = 8;
+	memset(buf + 3, 0, 5);
+	buf[8] = (unsigned char)(level >= DEFLATE_MAX_LEVEL ? 2 :
+			level <= DEFLATE_MIN_LEVEL ? 4 : 0);
+	buf[9] = 3;
+
+	deflate_compress(in, len, level, &buf, &buf_len);
+
+	buf = realloc(buf, buf_len + 8);
+	if (buf == NULL) {
+		perror("gzip_compress");
+		exit(1);
+	}
+	trailer = buf + buf_len;
+	trailer[0] = (unsigned char)crc;
+	trailer[1] = (unsigned char)(crc >> 8);
+	trailer[2] = (unsigned char)(crc >> 16);
+	trailer[3] = (unsigned char)(crc >> 24);
+	trailer[4] = (unsigned char)len;
+	trailer[5] = (unsigned char)(len >> 8);
+	trailer[6] = (unsigned char)(len >> 16);
+	trailer[7] = (unsigned char)(len >> 24);
+
+	*out = buf;
+	*out_len = buf_len + 8;
+}
@@ -0,0 +1,33 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEFLATE_MIN_LEVEL 1
+#define DEFLATE_MAX_LEVEL 9
+#define DEFLATE_DEFAULT_LEVEL 6
+
+/* CRC-32 as used by gzip, start with crc = 0 */
+uint32_t crc32_update(uint32_t crc, const unsigned char *data, size_t len);
+
+/* raw deflate stream (RFC 1951) of `len` bytes, appended to a malloc'd
+   buffer returned through `out`; level is clamped to 1..9 */
+void deflate_compress(
+		const unsigned char *in,
+		size_t len,
+		int level,
+		unsigned char **out,
+		size_t *out_len
+);
+
+/* single gzip member (RFC 1952) wrapping deflate_compress() */
+void gzip_compress(
+		const unsigned char *in,
+		size_t len,
+		int level,
+		unsigned char **out,
+		size_t *out_len
+);
+
+#endif
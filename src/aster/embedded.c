@@ -0,0 +1,133 @@
+#include <string.h>
+#include "conditional.h"
+#include "embedded.h"
+#include "encoding.h"
+#include "path.h"
+#include "range.h"
+#include "str.h"
+
+const struct embedded_file *embedded_lookup(
+		const struct embedded_table *table,
+		const char *key,
+		size_t key_len
+) {
+	const struct embedded_file *file;
+	size_t slot;
+
+	if (table->num_slots == 0) return NULL;
+	slot = table->slots[hash_bytes(key, key_len, table->seed) & (table->num_slots - 1)];
+	if (slot == 0) return NULL;
+	file = table->files + slot - 1;
+	if (file->key_len != key_len || memcmp(file->key, key, key_len)) return NULL;
+	return file;
+}
+
+static void simple_response(
+		struct http_response *resp,
+		enum http_response_code code,
+		const char *headers,
+		const char *date
+) {
+	begin_response(resp, code, date);
+	append_to_response(resp, headers);
+	append_length_to_response(resp, 0);
+	append_to_response(resp, CRLF);
+}
+
+void embedded_serve(
+		const struct embedded_table *table,
+		const struct http_request *req,
+		struct http_response *resp,
+		const char *date
+) {
+	char key[PATH_KEY_MAX];
+	int key_len;
+	const struct embedded_file *file;
+	const struct embedded_variant *variant;
+	struct accept_codings accept;
+	struct byte_range ranges[RANGE_MAX];
+	size_t count = 0;
+	enum range_result range = RANGE_NONE;
+
+	if (req->method != HM_GET && req->method != HM_HEAD) {
+		simple_response(resp, RC_405_METHOD_NOT_ALLOWED, "Allow: GET, HEAD" CRLF, date);
+		return;
+	}
+
+	key_len = normalize_path(&req->path, key, sizeof key);
+	file = key_len == -1 ? NULL : embedded_lookup(table, key, (size_t)key_len);
+	if (file == NULL) {
+		begin_response(resp, RC_404_NOT_FOUND, date);
+		append_to_response(resp, "Content-Type: text/html; charset=utf-8" CRLF);
+		append_length_to_response(resp, sizeof NOT_FOUND - 1);
+		append_to_response(resp, CRLF);
+		if (req->method == HM_GET) append_to_response(resp, NOT_FOUND);
+		return;
+	}
+
+	variant = &file->identity;
+	if (file->gzip.body != NULL) {
+		parse_accept_encoding(req, &accept);
+		if (choose_coding(&accept, CODING_BIT(CC_GZIP)) == CC_GZIP) {
+			variant = &file->gzip;
+		}
+	}
+
+	if (is_not_modified(req, variant->etag, strlen(variant->etag), file->mtime)) {
+		begin_response(resp, RC_304_NOT_MODIFIED, date);
+		append_to_response(resp, "ETag: ");
+		append_to_response(resp, variant->etag);
+		append_to_response(resp, CRLF);
+		if (file->gzip.body != NULL) {
+			append_to_response(resp, "Vary: Accept-Encoding" CRLF);
+		}
+		append_to_response(resp, CRLF);
+		return;
+	}
+
+	/* several ranges are rare enough on embedded assets to get it all */
+	if (req->method == HM_GET && headers_count(req, HH_RANGE) == 1 &&
+			if_range_holds(req, variant->etag, strlen(variant->etag),
+				file->mtime, time(NULL))) {
+		range = parse_range(&req->headers[headers_first(req, HH_RANGE)].value,
+			variant->len, ranges, &count);
+		if (range == RANGE_OK && count > 1) range = RANGE_NONE;
+	}
+	if (range == RANGE_UNSATISFIABLE) {
+		begin_response(resp, RC_416_REQUESTED_RANGE_NOT_SATISFIABLE, date);
+		append_to_response(resp, "Content-Range: bytes */");
+		append_size_to_response(resp, variant->len);
+		append_to_response(resp, CRLF);
+		append_length_to_response(resp, 0);
+		append_to_response(resp, CRLF);
+		return;
+	}
+
+	if (range == RANGE_OK) {
+		begin_response(resp, RC_206_PARTIAL_CONTENT, date);
+		append_to_response_n(resp, variant->head, variant->length_off);
+		append_to_response(resp, "Content-Range: bytes ");
+		append_size_to_response(resp, ranges[0].first);
+		append_to_response(resp, "-");
+		append_size_to_response(resp, ranges[0].last);
+		append_to_response(resp, "/");
+		append_size_to_response(resp, variant->len);
+		append_to_response(resp, CRLF);
+		append_length_to_response(resp, ranges[0].last - ranges[0].first + 1);
+	} else {
+		begin_response(resp, RC_200_OK, date);
+		/* its Content-Length included */
+		append_to_response_n(resp, variant->head, variant->head_len);
+		resp->delimited = 1;
+		ranges[0].first = 0;
+		ranges[0].last = variant->len - 1;
+	}
+	append_to_response(resp, "Accept-Ranges: bytes" CRLF "Last-Modified: ");
+	append_to_response(resp, file->last_modified);
+	append_to_response(resp, CRLF CRLF);
+
+	if (req->method == HM_GET && variant->len > 0) {
+		resp->body_mem = variant->body;
+		add_body_part(resp, BP_MEM, ranges[0].first, ranges[0].last - ranges[0].first + 1);
+	}
+}
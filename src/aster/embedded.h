@@ -0,0 +1,58 @@
+#ifndef EMBEDDED_H
+#define EMBEDDED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "request.h"
+#include "response.h"
+
+/* one encoding of an embedded file with its header fields serialized at
+   build time, Content-Length last */
+struct embedded_variant {
+	const unsigned char *body; /* NULL if the variant does not exist */
+	size_t len;
+	const char *etag;
+	const char *head; /* Content-Type .. Content-Length, CRLF terminated */
+	size_t head_len;
+	size_t length_off; /* where Content-Length starts in head */
+};
+
+struct embedded_file {
+	const char *key; /* normalized path, see normalize_path() */
+	size_t key_len;
+	time_t mtime;
+	const char *last_modified;
+	struct embedded_variant identity, gzip;
+};
+
+/* files generated by tools/embed.c, behind a collision-free hash of their
+   keys: slots hold an index into files plus one, 0 if empty */
+struct embedded_table {
+	const struct embedded_file *files;
+	size_t num_files;
+	const size_t *slots;
+	size_t num_slots; /* power of two, 0 if there are no files */
+	uint32_t seed;
+};
+
+/* the docroot compiled into the server by make (EMBED_DIR=...) */
+extern const struct embedded_table embedded_docroot;
+
+/* the file under `key`, NULL if none */
+const struct embedded_file *embedded_lookup(
+		const struct embedded_table *table,
+		const char *key,
+		size_t key_len
+);
+
+/* static origin over the table: GET and HEAD with conditional requests,
+   single ranges and the gzip variant, no filesystem access */
+void embedded_serve(
+		const struct embedded_table *table,
+		const struct http_request *req,
+		struct http_response *resp,
+		const char *date
+);
+
+#endif
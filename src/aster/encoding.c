@@ -0,0 +1,159 @@
+#include <string.h>
+#include "encoding.h"
+#include "str.h"
+
+#define Q_UNSET 0xFFFF
+
+/* qvalue = ( "0" [ "." 0*3DIGIT ] ) / ( "1" [ "." 0*3("0") ] ), -1 if invalid */
+static int parse_qvalue(const char *ptr, size_t len) {
+	int value;
+	int scale = 100;
+	size_t pos;
+
+	if (len == 0 || (ptr[0] != '0' && ptr[0] != '1')) return -1;
+	value = ptr[0] == '1' ? 1000 : 0;
+	if (len == 1) return value;
+	if (ptr[1] != '.' || len > 5) return -1;
+	for (pos = 2; pos < len; ++pos, scale /= 10) {
+		if (!is_digit(ptr[pos])) return -1;
+		value += to_digit(ptr[pos]) * scale;
+	}
+	return value > 1000 ? -1 : value;
+}
+
+static void trim(struct slice *sl) {
+	while (sl->len > 0 && (*sl->ptr == SYM_SP || *sl->ptr == SYM_HTAB)) {
+		sl->ptr++;
+		sl->len--;
+	}
+	while (sl->len > 0 && (sl->ptr[sl->len - 1] == SYM_SP ||
+				sl->ptr[sl->len - 1] == SYM_HTAB)) {
+		sl->len--;
+	}
+}
+
+/* split "coding *( OWS ; OWS param )" into the coding and its qvalue */
+static int parse_item(struct slice item, struct slice *coding, int *q) {
+	size_t pos = 0;
+
+	while (pos < item.len && item.ptr[pos] != ';') pos++;
+	*coding = get_slice(item.ptr, pos);
+	trim(coding);
+	*q = 1000;
+
+	while (pos < item.len) {
+		struct slice param;
+		size_t start = ++pos;
+		while (pos < item.len && item.ptr[pos] != ';') pos++;
+		param = get_slice(item.ptr + start, pos - start);
+		trim(&param);
+		if (param.len >= 2 && lower(param.ptr[0]) == 'q' && param.ptr[1] == '=') {
+			*q = parse_qvalue(param.ptr + 2, param.len - 2);
+			if (*q == -1) return -1;
+		}
+	}
+	return coding->len == 0 ? -1 : 0;
+}
+
+int parse_accept_encoding(const struct http_request *req, struct accept_codings *accept) {
+	struct header_item_iter it;
+	uint16_t wildcard = Q_UNSET;
+	struct slice coding;
+	int it_ret, q;
+	size_t c;
+
+	for (c = 0; c < CC__COUNT; ++c) {
+		accept->q[c] = Q_UNSET;
+	}
+
+	if (headers_count(req, HH_ACCEPT_ENCODING) > 0) {
+		it = header_items_init(req, HH_ACCEPT_ENCODING);
+		for (it_ret = header_items_next(req, &it);
+				it.header_item.ptr != NULL && !it_ret;
+				it_ret = header_items_next(req, &it)) {
+			if (it.header_item.len == 0) continue;
+			if (parse_item(it.header_item, &coding, &q) == -1) {
+				it_ret = -1;
+				break;
+			}
+			if (!slice_str_cmp_ci_check(&coding, "br")) {
+				accept->q[CC_BR] = (uint16_t)q;
+			} else if (!slice_str_cmp_ci_check(&coding, "gzip") ||
+					!slice_str_cmp_ci_check(&coding, "x-gzip")) {
+				accept->q[CC_GZIP] = (uint16_t)q;
+			} else if (!slice_str_cmp_ci_check(&coding, "identity")) {
+				accept->q[CC_IDENTITY] = (uint16_t)q;
+			} else if (!slice_str_cmp_check(&coding, "*")) {
+				wildcard = (uint16_t)q;
+			}
+		}
+		if (it_ret == -1) {
+			accept->q[CC_BR] = 0;
+			accept->q[CC_GZIP] = 0;
+			accept->q[CC_IDENTITY] = 1000;
+			return -1;
+		}
+	}
+
+	/* "*" covers whatever was not listed; identity stays acceptable, as
+	   the last resort, unless refused explicitly or through "*" */
+	for (c = 0; c < CC_IDENTITY; ++c) {
+		if (accept->q[c] == Q_UNSET) {
+			accept->q[c] = wildcard == Q_UNSET ? 0 : wildcard;
+		}
+	}
+	if (accept->q[CC_IDENTITY] == Q_UNSET) {
+		accept->q[CC_IDENTITY] = wildcard == 0 ? 0 : 1;
+	}
+	return 0;
+}
+
+enum content_coding choose_coding(const struct accept_codings *accept, unsigned available) {
+	enum content_coding best = CC__COUNT;
+	uint16_t best_q = 0;
+	int c;
+
+	available |= CODING_BIT(CC_IDENTITY);
+	for (c = 0; c < CC__COUNT; ++c) {
+		if (!(available & CODING_BIT(c))) continue;
+		if (accept->q[c] > best_q) {
+			best_q = accept->q[c];
+			best = (enum content_coding)c;
+		}
+	}
+	return best;
+}
+
+size_t accept_encoding_key(const struct http_request *req, char *buf, size_t cap) {
+	size_t idx, len = 0, n;
+
+	for (idx = headers_first(req, HH_ACCEPT_ENCODING); idx != SIZE_MAX;
+			idx = headers_next(req, idx)) {
+		n = req->headers[idx].value.len;
+		if (n + 1 > cap - len) return cap;
+		memcpy(buf + len, req->headers[idx].value.ptr, n);
+		buf[len + n] = ',';
+		len += n + 1;
+	}
+	return len;
+}
+
+const char *coding_name(enum content_coding coding) {
+	switch (coding) {
+	case CC_BR: return "br";
+	case CC_GZIP: return "gzip";
+	case CC_IDENTITY:
+	case CC__COUNT: break;
+	}
+	return NULL;
+}
+
+const char *coding_suffix(enum content_coding coding) {
+	switch (coding) {
+	case CC_BR: return ".br";
+	case CC_GZIP: return ".gz";
+	case CC_IDENTITY:
+	case CC__COUNT: break;
+	}
+	return NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include <stdint.h>
+#include "request.h"
+
+/* content codings, in order of preference on equal qvalues */
+enum content_coding {
+	CC_BR = 0,
+	CC_GZIP,
+	CC_IDENTITY,
+	CC__COUNT
+};
+
+#define CODING_BIT(coding) (1u << (coding))
+
+/* qvalues in thousandths, indexed by content_coding */
+struct accept_codings {
+	uint16_t q[CC__COUNT];
+};
+
+/* parse Accept-Encoding; without the field only identity is acceptable.
+   Return -1 if the field is malformed (and leave identity only) */
+int parse_accept_encoding(const struct http_request *req, struct accept_codings *accept);
+
+/* pick the most preferred of the `available` codings (identity always is),
+   CC__COUNT if none is acceptable */
+enum content_coding choose_coding(const struct accept_codings *accept, unsigned available);
+
+/* all Accept-Encoding field values, each followed by a comma, copied to
+   `buf` to memoize negotiation: their length, or `cap` if they do not fit */
+size_t accept_encoding_key(const struct http_request *req, char *buf, size_t cap);
+
+/* "br", "gzip" and NULL for identity */
+const char *coding_name(enum content_coding coding);
+
+/* file name suffix of a precompressed sibling, NULL for identity */
+const char *coding_suffix(enum content_coding coding);
+
+#endif
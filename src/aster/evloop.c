@@ -0,0 +1,60 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "evloop.h"
+
+int evloop_init(struct evloop *loop) {
+	loop->retired = NULL;
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	return loop->epfd == -1 ? -1 : 0;
+}
+
+void evloop_free(struct evloop *loop) {
+	close(loop->epfd);
+}
+
+static int ctl(struct evloop *loop, int op, struct ev_source *src, unsigned events) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof ev);
+	ev.events = events;
+	ev.data.ptr = src;
+	return epoll_ctl(loop->epfd, op, src->fd, &ev);
+}
+
+int evloop_add(struct evloop *loop, struct ev_source *src, unsigned events) {
+	return ctl(loop, EPOLL_CTL_ADD, src, events);
+}
+
+int evloop_mod(struct evloop *loop, struct ev_source *src, unsigned events) {
+	return ctl(loop, EPOLL_CTL_MOD, src, events);
+}
+
+void evloop_del(struct evloop *loop, struct ev_source *src) {
+	ctl(loop, EPOLL_CTL_DEL, src, 0);
+}
+
+void evloop_retire(struct evloop *loop, struct ev_source *src, void (*destroy)(struct ev_source *src)) {
+	evloop_del(loop, src);
+	src->handle = NULL;
+	src->destroy = destroy;
+	src->next_retired = loop->retired;
+	loop->retired = src;
+}
+
+int evloop_run_once(struct evloop *loop, int timeout_ms) {
+	struct epoll_event events[EVLOOP_BATCH];
+	int n, i;
+
+	n = epoll_wait(loop->epfd, events, EVLOOP_BATCH, timeout_ms);
+	if (n == -1) return errno == EINTR ? 0 : -1;
+	for (i = 0; i < n; ++i) {
+		struct ev_source *src = events[i].data.ptr;
+		if (src->handle != NULL) src->handle(loop, src, events[i].events);
+	}
+	while (loop->retired != NULL) {
+		struct ev_source *src = loop->retired;
+		loop->retired = src->next_retired;
+		src->destroy(src);
+	}
+	return n;
+}
@@ -0,0 +1,46 @@
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <sys/epoll.h>
+
+/* events handled per epoll_wait() */
+#define EVLOOP_BATCH 64
+
+struct evloop;
+
+/* something to watch, embedded first in whatever owns the descriptor */
+struct ev_source {
+	int fd;
+	/* `events` are EPOLL* bits */
+	void (*handle)(struct evloop *loop, struct ev_source *src, unsigned events);
+
+	/* set by evloop_retire() */
+	void (*destroy)(struct ev_source *src);
+	struct ev_source *next_retired;
+};
+
+/* level-triggered epoll dispatch, one per worker */
+struct evloop {
+	int epfd;
+	struct ev_source *retired; /* destroyed after the current batch */
+};
+
+/* return 0 on success, -1 with errno set */
+int evloop_init(struct evloop *loop);
+void evloop_free(struct evloop *loop);
+
+/* watch `src` for `events` (EPOLLERR and EPOLLHUP are always reported),
+   change them, or stop watching it; -1 with errno set on failure */
+int evloop_add(struct evloop *loop, struct ev_source *src, unsigned events);
+int evloop_mod(struct evloop *loop, struct ev_source *src, unsigned events);
+void evloop_del(struct evloop *loop, struct ev_source *src);
+
+/* stop watching `src` and call `destroy` on it once no event of the current
+   batch can refer to it any more */
+void evloop_retire(struct evloop *loop, struct ev_source *src, void (*destroy)(struct ev_source *src));
+
+/* wait up to `timeout_ms` (-1 for ever) and dispatch what is ready; the
+   number of sources handled or -1 with errno set */
+int evloop_run_once(struct evloop *loop, int timeout_ms);
+
+#endif
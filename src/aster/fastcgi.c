@@ -0,0 +1,766 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "blob.h"
+#include "datetime.h"
+#include "fastcgi.h"
+#include "path.h"
+#include "str.h"
+
+/* fields of the CGI head that only concern one connection, or the status */
+static const char *const dropped[] = {
+	"status",
+	"connection",
+	"keep-alive",
+	"proxy-connection",
+	"transfer-encoding",
+	"upgrade"
+};
+
+/* the end of the stdin stream, the request id being always the same */
+static const char stdin_end[FCGI_HEADER_LEN] = {FCGI_VERSION_1, FCGI_STDIN, 0, FCGI_REQUEST_ID};
+
+/* what goes to the application is small, never worth pinning */
+static struct zerocopy no_zerocopy;
+
+void fcgi_header(unsigned char *buf, enum fcgi_record_type type, size_t len) {
+	buf[0] = FCGI_VERSION_1;
+	buf[1] = (unsigned char)type;
+	buf[2] = 0;
+	buf[3] = FCGI_REQUEST_ID;
+	buf[4] = (unsigned char)(len >> 8);
+	buf[5] = (unsigned char)(len & 0xff);
+	buf[6] = 0; /* no padding */
+	buf[7] = 0;
+}
+
+/* name-value pairs of the PARAMS stream */
+struct params {
+	char *buf;
+	size_t len, cap;
+};
+
+static void put(struct params *p, const void *ptr, size_t n) {
+	if (p->len + n > p->cap) {
+		if (p->cap == 0) p->cap = 1024;
+		while (p->len + n > p->cap) p->cap *= 2;
+		p->buf = realloc(p->buf, p->cap);
+		if (p->buf == NULL) {
+			perror("fastcgi");
+			exit(1);
+		}
+	}
+	memcpy(p->buf + p->len, ptr, n);
+	p->len += n;
+}
+
+/* one byte below 128, four with the high bit set otherwise */
+static void put_length(struct params *p, size_t n) {
+	unsigned char b[4];
+
+	if (n < 128) {
+		b[0] = (unsigned char)n;
+		put(p, b, 1);
+		return;
+	}
+	b[0] = (unsigned char)(0x80 | ((n >> 24) & 0x7f));
+	b[1] = (unsigned char)((n >> 16) & 0xff);
+	b[2] = (unsigned char)((n >> 8) & 0xff);
+	b[3] = (unsigned char)(n & 0xff);
+	put(p, b, 4);
+}
+
+static void put_pair(struct params *p, const char *name, const char *value, size_t len) {
+	put_length(p, strlen(name));
+	put_length(p, len);
+	put(p, name, strlen(name));
+	put(p, value, len);
+}
+
+static void put_str(struct params *p, const char *name, const char *value) {
+	put_pair(p, name, value, strlen(value));
+}
+
+static void put_slice(struct params *p, const char *name, const struct slice *value) {
+	put_pair(p, name, value->ptr != NULL ? value->ptr : "", value->len);
+}
+
+static void put_number(struct params *p, const char *name, unsigned long value) {
+	char num[24];
+	sprintf(num, "%lu", value);
+	put_str(p, name, num);
+}
+
+static int same_name(const struct slice *a, const struct slice *b) {
+	size_t i;
+
+	if (a->len != b->len) return 0;
+	for (i = 0; i < a->len && lower(a->ptr[i]) == lower(b->ptr[i]); ++i);
+	return i == a->len;
+}
+
+/* whether the field gets an HTTP_ variable */
+static int http_variable(const struct http_header *h) {
+	if (h->type == HH_CONTENT_LENGTH || h->type == HH_CONTENT_TYPE) return 0;
+	if (!slice_str_cmp_ci_check(&h->name, "proxy")) return 0;
+	return h->name.len > 0 && memchr(h->name.ptr, '_', h->name.len) == NULL;
+}
+
+/* HTTP_ and the name upper-cased, '-' as '_', the values of all the fields
+   of that name joined */
+static void put_field(struct params *p, const struct http_request *req, size_t first) {
+	const struct http_header *h = req->headers + first;
+	/* a Cookie list is split on ';' (RFC 6265 section 5.4) */
+	const char *sep = !slice_str_cmp_ci_check(&h->name, "cookie") ? "; " : ", ";
+	size_t len = 0, i, j;
+	char ch;
+
+	for (i = first; i < req->num_headers; ++i) {
+		if (!same_name(&req->headers[i].name, &h->name)) continue;
+		len += (len > 0 ? 2 : 0) + req->headers[i].value.len;
+	}
+	put_length(p, 5 + h->name.len);
+	put_length(p, len);
+	put(p, "HTTP_", 5);
+	for (j = 0; j < h->name.len; ++j) {
+		ch = h->name.ptr[j];
+		ch = ch == '-' ? '_' : ch >= 'a' && ch <= 'z' ? (char)(ch - 'a' + 'A') : ch;
+		put(p, &ch, 1);
+	}
+	for (i = first, j = 0; i < req->num_headers; ++i) {
+		if (!same_name(&req->headers[i].name, &h->name)) continue;
+		if (j++ > 0) put(p, sep, 2);
+		put(p, req->headers[i].value.ptr, req->headers[i].value.len);
+	}
+}
+
+/* the Host without its port */
+static struct slice server_name(const struct http_request *req) {
+	struct slice host = req->host;
+	size_t i = host.len;
+
+	while (i > 0 && is_digit(host.ptr[i - 1])) i--;
+	if (i > 0 && host.ptr[i - 1] == ':') host.len = i - 1;
+	return host;
+}
+
+void fcgi_push_params(struct outq *q, const struct http_request *req, const struct fcgi_script *script) {
+	struct params p = {NULL, 0, 0};
+	struct slice name;
+	char key[PATH_KEY_MAX];
+	const char *type;
+	int key_len = normalize_path(&req->path, key, sizeof key);
+	size_t root_len, total, pos, off, n, i, j;
+	unsigned char *out;
+
+	put_str(&p, "GATEWAY_INTERFACE", "CGI/1.1");
+	put_str(&p, "SERVER_SOFTWARE", SERVER);
+	put_str(&p, "SERVER_PROTOCOL", req->http_minor >= 1 ? "HTTP/1.1" : "HTTP/1.0");
+	name = server_name(req);
+	put_slice(&p, "SERVER_NAME", &name);
+	put_number(&p, "SERVER_PORT", script->server_port);
+	put_str(&p, "REMOTE_ADDR", script->remote_addr);
+	put_number(&p, "REMOTE_PORT", script->remote_port);
+	type = method_name(req->method);
+	put_str(&p, "REQUEST_METHOD", type != NULL ? type : "");
+	put_slice(&p, "REQUEST_URI", &req->raw_target);
+	put_slice(&p, "QUERY_STRING", &req->query);
+	/* the script is the file the path names, as a static site would */
+	if (key_len != -1) {
+		put_length(&p, strlen("SCRIPT_NAME"));
+		put_length(&p, 1 + (size_t)key_len);
+		put(&p, "SCRIPT_NAME", strlen("SCRIPT_NAME"));
+		put(&p, "/", 1);
+		put(&p, key, (size_t)key_len);
+	}
+	if (key_len != -1 && script->docroot != NULL) {
+		root_len = strlen(script->docroot);
+		while (root_len > 0 && script->docroot[root_len - 1] == '/') root_len--;
+		put_pair(&p, "DOCUMENT_ROOT", script->docroot, root_len);
+		put_length(&p, strlen("SCRIPT_FILENAME"));
+		put_length(&p, root_len + 1 + (size_t)key_len);
+		put(&p, "SCRIPT_FILENAME", strlen("SCRIPT_FILENAME"));
+		put(&p, script->docroot, root_len);
+		put(&p, "/", 1);
+		put(&p, key, (size_t)key_len);
+	}
+	if (req->content_length > 0) put_number(&p, "CONTENT_LENGTH", (unsigned long)req->content_length);
+	i = headers_first(req, HH_CONTENT_TYPE);
+	if (i != SIZE_MAX) put_slice(&p, "CONTENT_TYPE", &req->headers[i].value);
+	for (i = 0; i < req->num_headers; ++i) {
+		if (!http_variable(req->headers + i)) continue;
+		for (j = 0; j < i && !same_name(&req->headers[j].name, &req->headers[i].name); ++j);
+		if (j == i) put_field(&p, req, i);
+	}
+
+	/* BEGIN_REQUEST, then PARAMS records and the empty one ending them */
+	total = 2 * FCGI_HEADER_LEN + (p.len + FCGI_MAX_CONTENT - 1) / FCGI_MAX_CONTENT * FCGI_HEADER_LEN +
+		p.len + FCGI_HEADER_LEN;
+	out = malloc(total);
+	if (out == NULL) {
+		perror("fastcgi");
+		exit(1);
+	}
+	fcgi_header(out, FCGI_BEGIN_REQUEST, 8);
+	memset(out + FCGI_HEADER_LEN, 0, 8);
+	out[FCGI_HEADER_LEN + 1] = FCGI_RESPONDER;
+	out[FCGI_HEADER_LEN + 2] = FCGI_KEEP_CONN;
+	pos = 2 * FCGI_HEADER_LEN;
+	for (off = 0; off < p.len; off += n) {
+		n = p.len - off < FCGI_MAX_CONTENT ? p.len - off : FCGI_MAX_CONTENT;
+		fcgi_header(out + pos, FCGI_PARAMS, n);
+		memcpy(out + pos + FCGI_HEADER_LEN, p.buf + off, n);
+		pos += FCGI_HEADER_LEN + n;
+	}
+	fcgi_header(out + pos, FCGI_PARAMS, 0);
+	outq_push_mem(q, (const char *)out, total, (char *)out, NULL);
+	free(p.buf);
+}
+
+long fcgi_scan_next(struct fcgi_scan *scan, const char *buf, size_t len, size_t *n) {
+	size_t pos = 0, take;
+
+	*n = 0;
+	scan->complete = 0;
+	while (pos < len) {
+		if (scan->have < FCGI_HEADER_LEN) {
+			scan->header[scan->have++] = (unsigned char)buf[pos++];
+			if (scan->have < FCGI_HEADER_LEN) continue;
+			if (scan->header[0] != FCGI_VERSION_1) return -1;
+			scan->type = (enum fcgi_record_type)scan->header[1];
+			scan->id = (unsigned)scan->header[2] << 8 | scan->header[3];
+			scan->content_left = (size_t)scan->header[4] << 8 | scan->header[5];
+			scan->padding_left = scan->header[6];
+		} else if (scan->content_left > 0) {
+			take = len - pos < scan->content_left ? len - pos : scan->content_left;
+			scan->content_left -= take;
+			pos += take;
+			*n = take;
+		} else {
+			take = len - pos < scan->padding_left ? len - pos : scan->padding_left;
+			scan->padding_left -= take;
+			pos += take;
+		}
+		if (scan->content_left == 0 && scan->padding_left == 0) {
+			scan->have = 0;
+			scan->complete = 1;
+		}
+		if (*n > 0 || scan->complete) break;
+	}
+	return (long)pos;
+}
+
+static void trim(struct slice *sl) {
+	while (sl->len > 0 && (*sl->ptr == SYM_SP || *sl->ptr == SYM_HTAB)) {
+		sl->ptr++;
+		sl->len--;
+	}
+	while (sl->len > 0 && (sl->ptr[sl->len - 1] == SYM_SP || sl->ptr[sl->len - 1] == SYM_HTAB)) {
+		sl->len--;
+	}
+}
+
+/* the line at `pos`, without its end: where the next one starts, 0 if it
+   does not end within `len` */
+static size_t next_line(const char *buf, size_t pos, size_t len, struct slice *line) {
+	const char *eol = memchr(buf + pos, SYM_LF, len - pos);
+	size_t end;
+
+	if (eol == NULL) return 0;
+	end = (size_t)(eol - buf);
+	*line = get_slice(buf + pos, end > pos && buf[end - 1] == SYM_CR ? end - pos - 1 : end - pos);
+	return end + 1;
+}
+
+/* a field line split in name and trimmed value, -1 if it is not one or
+   the value has controls that would break the line */
+static int split_field(const struct slice *line, struct slice *name, struct slice *value) {
+	size_t i = 0;
+	unsigned char ch;
+
+	while (i < line->len && is_tchar(line->ptr[i])) i++;
+	if (i == 0 || i == line->len || line->ptr[i] != ':') return -1;
+	*name = get_slice(line->ptr, i);
+	*value = get_slice(line->ptr + i + 1, line->len - i - 1);
+	trim(value);
+	for (i = 0; i < value->len; ++i) {
+		ch = (unsigned char)value->ptr[i];
+		if (ch != SYM_HTAB && (ch < 0x20 || ch == 0x7f)) return -1;
+	}
+	return 0;
+}
+
+static int is_dropped(const struct slice *name) {
+	size_t i;
+	for (i = 0; i < sizeof dropped / sizeof dropped[0]; ++i) {
+		if (!slice_str_cmp_ci_check(name, dropped[i])) return 1;
+	}
+	return 0;
+}
+
+long fcgi_parse_head(const char *buf, size_t len, const char *date, struct http_response *resp, unsigned *status) {
+	struct slice line, name, value, reason = {NULL, 0};
+	size_t pos, next, end;
+	int has_date = 0, has_server = 0, has_location = 0;
+	unsigned code = 0;
+	const char *phrase;
+
+	/* all of it is checked before anything is written */
+	for (pos = 0; ; pos = next) {
+		next = next_line(buf, pos, len, &line);
+		if (next == 0) return 0;
+		if (line.len == 0) break;
+		if (split_field(&line, &name, &value) == -1) return -1;
+		if (!slice_str_cmp_ci_check(&name, "status")) {
+			if (code != 0 || value.len < 3 || !is_digit(value.ptr[0]) || !is_digit(value.ptr[1]) ||
+					!is_digit(value.ptr[2]) || (value.len > 3 && value.ptr[3] != SYM_SP)) {
+				return -1;
+			}
+			code = (unsigned)(to_digit(value.ptr[0]) * 100 + to_digit(value.ptr[1]) * 10 +
+				to_digit(value.ptr[2]));
+			/* an interim response would need a final one after it */
+			if (code < 200 || code > 599) return -1;
+			reason = get_slice(value.ptr + 3, value.len - 3);
+			trim(&reason);
+		} else if (!slice_str_cmp_ci_check(&name, "location")) {
+			has_location = 1;
+		} else if (!slice_str_cmp_ci_check(&name, "date")) {
+			has_date = 1;
+		} else if (!slice_str_cmp_ci_check(&name, "server")) {
+			has_server = 1;
+		}
+	}
+	end = next;
+	if (code == 0) code = has_location ? RC_302_FOUND : RC_200_OK;
+
+	append_to_response(resp, "HTTP/1.1 ");
+	append_size_to_response(resp, code);
+	append_to_response(resp, " ");
+	phrase = reason_phrase((enum http_response_code)code);
+	if (reason.len > 0) {
+		append_to_response_n(resp, reason.ptr, reason.len);
+	} else if (phrase != NULL) {
+		append_to_response(resp, phrase);
+	}
+	append_to_response(resp, CRLF);
+	if (!has_server) append_to_response(resp, "Server: " SERVER CRLF);
+	if (!has_date) {
+		append_to_response(resp, "Date: ");
+		append_to_response(resp, date);
+		append_to_response(resp, CRLF);
+	}
+	for (pos = 0; pos < end; pos = next) {
+		next = next_line(buf, pos, len, &line);
+		if (line.len == 0) break;
+		split_field(&line, &name, &value);
+		if (is_dropped(&name)) continue;
+		append_to_response_n(resp, name.ptr, name.len);
+		append_to_response(resp, ": ");
+		append_to_response_n(resp, value.ptr, value.len);
+		append_to_response(resp, CRLF);
+	}
+	append_to_response(resp, "Connection: close" CRLF CRLF);
+	*status = code;
+	return (long)end;
+}
+
+static void app_event(struct evloop *loop, struct ev_source *src, unsigned events);
+
+void fcgi_call_init(
+		struct fcgi_call *call,
+		struct evloop *loop,
+		struct upstream *app,
+		const struct http_request *req,
+		const struct fcgi_script *script,
+		struct outq *to_client,
+		void (*notify)(struct fcgi_call *call),
+		void *owner
+) {
+	memset(call, 0, sizeof *call);
+	call->src.fd = -1;
+	call->src.handle = app_event;
+	call->loop = loop;
+	call->app = app;
+	call->req = req;
+	call->script = *script;
+	call->state = FC_CONNECTING;
+	call->reusable = 1;
+	app->outstanding++;
+	outq_init(&call->to_app);
+	call->req_pipe.rd = call->req_pipe.wr = -1;
+	call->to_client = to_client;
+	call->notify = notify;
+	call->owner = owner;
+}
+
+static size_t client_room(const struct fcgi_call *call) {
+	return call->to_client->bytes < PROXY_BUFFER ? PROXY_BUFFER - call->to_client->bytes : 0;
+}
+
+/* the watched events follow what each side has room for */
+static void update_events(struct fcgi_call *call) {
+	unsigned events = 0;
+
+	if (call->state >= FC_DONE) return;
+	if (call->state == FC_CONNECTING || call->to_app.bytes > 0) events |= EPOLLOUT;
+	if (call->state != FC_CONNECTING && client_room(call) > 0) events |= EPOLLIN;
+	if (events != call->events && evloop_mod(call->loop, &call->src, events) == 0) {
+		call->events = events;
+	}
+}
+
+/* give the connection back to the pool, or close it */
+static void release_app(struct fcgi_call *call, int reusable) {
+	if (call->src.fd == -1) return;
+	evloop_del(call->loop, &call->src);
+	upstream_release(call->app, call->src.fd, reusable);
+	call->src.fd = -1;
+	call->events = 0;
+}
+
+/* send on an idle connection, or on a new one if `fresh` */
+static int open_app(struct fcgi_call *call, int fresh) {
+	int fd = fresh ? -1 : upstream_take(call->app);
+
+	call->reused = fd != -1;
+	if (fd == -1) fd = upstream_open(call->app);
+	if (fd == -1) return -1;
+	call->src.fd = fd;
+	if (evloop_add(call->loop, &call->src, EPOLLOUT) == -1) {
+		close(fd);
+		call->src.fd = -1;
+		return -1;
+	}
+	zc_socket_init(&call->zs, fd);
+	call->events = EPOLLOUT;
+	call->state = call->reused ? FC_WAITING : FC_CONNECTING;
+	return 0;
+}
+
+/* no longer in flight on the application */
+static void leave(struct fcgi_call *call) {
+	if (call->state < FC_DONE) call->app->outstanding--;
+}
+
+static void drop_head(struct fcgi_call *call) {
+	free(call->head);
+	call->head = NULL;
+	call->head_len = 0;
+}
+
+/* before the head the client gets a 502, past it a truncated response */
+static void fail(struct fcgi_call *call) {
+	struct http_response resp;
+	char date[HTTP_DATE_LEN + 1] = {0};
+
+	leave(call);
+	release_app(call, 0);
+	drop_head(call);
+	if (call->state == FC_RELAYING) {
+		call->state = FC_BROKEN;
+	} else {
+		call->app->stats.failures++;
+		get_current_time(date);
+		resp = new_response();
+		empty_response(&resp, RC_502_BAD_GATEWAY, date);
+		if (outq_push_response(call->to_client, &resp) == -1) {
+			perror("dup");
+			call->state = FC_BROKEN;
+		} else {
+			call->state = FC_DONE;
+		}
+	}
+	call->notify(call);
+}
+
+/* the request and the stdin stream, the body coming next */
+static void push_request(struct fcgi_call *call) {
+	fcgi_push_params(&call->to_app, call->req, &call->script);
+}
+
+/* an idle connection may have been closed by the application just as it
+   was taken: a request that is safe to repeat goes again on a new one */
+static void retry_or_fail(struct fcgi_call *call) {
+	if (call->reused && !call->retried && call->state == FC_WAITING && call->got == 0 &&
+			call->req->content_length <= 0 && call->req->method != HM_POST) {
+		call->retried = 1;
+		call->app->stats.stale++;
+		release_app(call, 0);
+		outq_free(&call->to_app);
+		outq_init(&call->to_app);
+		push_request(call);
+		outq_push_mem(&call->to_app, stdin_end, sizeof stdin_end, NULL, NULL);
+		if (open_app(call, 1) == 0) return;
+	}
+	fail(call);
+}
+
+/* `n` (<= FCGI_MAX_CONTENT) body bytes at `data` go in a STDIN record,
+   the stream ending with the body */
+static void push_stdin(struct fcgi_call *call, const char *data, size_t n) {
+	char *record = malloc(FCGI_HEADER_LEN + n);
+
+	if (record == NULL) {
+		perror("fastcgi");
+		exit(1);
+	}
+	fcgi_header((unsigned char *)record, FCGI_STDIN, n);
+	memcpy(record + FCGI_HEADER_LEN, data, n);
+	outq_push_mem(&call->to_app, record, FCGI_HEADER_LEN + n, record, NULL);
+}
+
+void fcgi_call_start(struct fcgi_call *call, const char *body, size_t len) {
+	size_t expected = call->req->content_length > 0 ? (size_t)call->req->content_length : 0, n;
+
+	/* anything past the body is not for this request */
+	if (len > expected) len = expected;
+	push_request(call);
+	call->body_left = expected - len;
+	for (; len > 0; body += n, len -= n) {
+		n = len < FCGI_MAX_CONTENT ? len : FCGI_MAX_CONTENT;
+		push_stdin(call, body, n);
+	}
+	if (call->body_left == 0) outq_push_mem(&call->to_app, stdin_end, sizeof stdin_end, NULL, NULL);
+	if (open_app(call, 0) == -1) fail(call);
+}
+
+size_t fcgi_call_room(const struct fcgi_call *call) {
+	size_t room;
+
+	if (call->state >= FC_DONE || call->to_app.bytes >= PROXY_BUFFER) return 0;
+	room = PROXY_BUFFER - call->to_app.bytes;
+	if (room > FCGI_MAX_CONTENT) room = FCGI_MAX_CONTENT;
+	return room < call->body_left ? room : call->body_left;
+}
+
+ssize_t fcgi_call_pull(struct fcgi_call *call, int fd) {
+	size_t room = fcgi_call_room(call);
+	struct relay_pipe *p = relay_pipe_get(&call->req_pipe);
+	unsigned char *header;
+	ssize_t n;
+	char *data;
+
+	/* the record header goes ahead of the bytes spliced after it */
+	if (p != NULL) {
+		n = splice(fd, NULL, p->wr, NULL, room, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n > 0) {
+			header = malloc(FCGI_HEADER_LEN);
+			if (header == NULL) {
+				perror("fastcgi");
+				exit(1);
+			}
+			fcgi_header(header, FCGI_STDIN, (size_t)n);
+			outq_push_mem(&call->to_app, (const char *)header, FCGI_HEADER_LEN, (char *)header, NULL);
+			outq_push_pipe(&call->to_app, p->rd, (size_t)n);
+			call->app->stats.spliced += (size_t)n;
+		}
+	} else {
+		if (room > PROXY_READ) room = PROXY_READ;
+		data = malloc(FCGI_HEADER_LEN + room);
+		if (data == NULL) {
+			perror("fastcgi");
+			exit(1);
+		}
+		n = recv(fd, data + FCGI_HEADER_LEN, room, 0);
+		if (n > 0) {
+			fcgi_header((unsigned char *)data, FCGI_STDIN, (size_t)n);
+			outq_push_mem(&call->to_app, data, FCGI_HEADER_LEN + (size_t)n, data, NULL);
+		} else {
+			free(data);
+		}
+	}
+	if (n > 0) {
+		call->body_left -= (size_t)n;
+		if (call->body_left == 0) outq_push_mem(&call->to_app, stdin_end, sizeof stdin_end, NULL, NULL);
+		update_events(call);
+	}
+	return n;
+}
+
+void fcgi_call_resume(struct fcgi_call *call) {
+	update_events(call);
+}
+
+void fcgi_call_free(struct fcgi_call *call) {
+	leave(call);
+	call->state = FC_DONE;
+	release_app(call, 0);
+	outq_free(&call->to_app);
+	relay_pipe_close(&call->req_pipe);
+	drop_head(call);
+}
+
+/* the CGI head is whole once an empty line came: the client gets it as an
+   HTTP head, with the body bytes that came along */
+static void take_head(struct fcgi_call *call) {
+	struct http_response resp = new_response();
+	char date[HTTP_DATE_LEN + 1] = {0};
+	unsigned status;
+	long len;
+
+	get_current_time(date);
+	len = fcgi_parse_head(call->head, call->head_len, date, &resp, &status);
+	if (len <= 0) {
+		http_response_free(&resp);
+		if (len == -1 || call->head_len == PROXY_HEAD_MAX) fail(call);
+		return;
+	}
+	if (outq_push_response(call->to_client, &resp) == -1) perror("dup");
+	call->state = FC_RELAYING;
+	if (call->req->method == HM_HEAD || status == RC_204_NO_CONTENT || status == RC_304_NOT_MODIFIED) {
+		call->no_body = 1;
+	}
+	if (!call->no_body && call->head_len > (size_t)len) {
+		outq_push_mem(call->to_client, call->head + len, call->head_len - (size_t)len, call->head, NULL);
+		call->head = NULL;
+	}
+	drop_head(call);
+}
+
+/* stdout bytes of `buf`, which goes along with them */
+static void take_stdout(struct fcgi_call *call, const char *ptr, size_t n, struct blob *buf) {
+	size_t take;
+
+	if (call->state == FC_RELAYING) {
+		if (!call->no_body) outq_push_mem(call->to_client, ptr, n, NULL, buf);
+		return;
+	}
+	if (call->head == NULL) {
+		call->head = malloc(PROXY_HEAD_MAX);
+		if (call->head == NULL) {
+			perror("fastcgi");
+			exit(1);
+		}
+	}
+	take = n < PROXY_HEAD_MAX - call->head_len ? n : PROXY_HEAD_MAX - call->head_len;
+	memcpy(call->head + call->head_len, ptr, take);
+	call->head_len += take;
+	take_head(call);
+	/* what came past a full head buffer is body */
+	if (call->state == FC_RELAYING && take < n && !call->no_body) {
+		outq_push_mem(call->to_client, ptr + take, n - take, NULL, buf);
+	}
+}
+
+/* END_REQUEST: the connection is kept if nothing came after it and the
+   application had the whole request */
+static void end_request(struct fcgi_call *call, int last) {
+	if (call->state == FC_WAITING) {
+		/* no head at all */
+		fail(call);
+		return;
+	}
+	leave(call);
+	release_app(call, call->reusable && last && call->to_app.bytes == 0 && call->body_left == 0);
+	call->state = FC_DONE;
+}
+
+/* the records of `len` bytes read into `buf` */
+static void take_records(struct fcgi_call *call, struct blob *buf, size_t len) {
+	const char *data = (const char *)buf->data, *piece;
+	size_t pos = 0, n;
+	long step;
+
+	while (pos < len && (call->state == FC_WAITING || call->state == FC_RELAYING)) {
+		step = fcgi_scan_next(&call->scan, data + pos, len - pos, &n);
+		if (step == -1) {
+			fail(call);
+			return;
+		}
+		piece = data + pos + (size_t)step - n;
+		pos += (size_t)step;
+		/* records of other requests or of the management id are ignored */
+		if (call->scan.id != FCGI_REQUEST_ID) continue;
+		if (n > 0 && call->scan.type == FCGI_STDOUT) {
+			take_stdout(call, piece, n, buf);
+		} else if (n > 0 && call->scan.type == FCGI_STDERR) {
+			fprintf(stderr, "fastcgi %s: %.*s", call->app->name, (int)n, piece);
+		} else if (call->scan.complete && call->scan.type == FCGI_END_REQUEST) {
+			end_request(call, pos == len);
+		}
+	}
+}
+
+/* the application closed its side before END_REQUEST */
+static void app_closed(struct fcgi_call *call) {
+	retry_or_fail(call);
+}
+
+static void read_app(struct fcgi_call *call, unsigned events) {
+	struct blob *buf;
+	ssize_t n;
+	char *data;
+
+	while (call->state == FC_WAITING || call->state == FC_RELAYING) {
+		if (client_room(call) == 0) {
+			/* paused on the client, an error would be reported forever */
+			if (events & (EPOLLERR | EPOLLHUP)) fail(call);
+			return;
+		}
+		data = malloc(PROXY_READ);
+		if (data == NULL) {
+			perror("fastcgi");
+			exit(1);
+		}
+		n = recv(call->src.fd, data, PROXY_READ, 0);
+		if (n <= 0) {
+			free(data);
+			if (n == -1 && errno == EINTR) continue;
+			if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+			if (n == -1) {
+				retry_or_fail(call);
+			} else {
+				app_closed(call);
+			}
+			return;
+		}
+		call->got += (size_t)n;
+		/* stdout is queued where it was read, records and all */
+		buf = blob_new((unsigned char *)data, (size_t)n);
+		take_records(call, buf, (size_t)n);
+		blob_unref(buf);
+		call->notify(call);
+	}
+}
+
+static void app_event(struct evloop *loop, struct ev_source *src, unsigned events) {
+	struct fcgi_call *call = (struct fcgi_call *)src;
+	int err = 0;
+	socklen_t err_len = sizeof err;
+
+	(void)loop;
+	if (call->state == FC_CONNECTING) {
+		if (getsockopt(src->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == -1 || err != 0) {
+			fail(call);
+			return;
+		}
+		call->state = FC_WAITING;
+	}
+
+	if (call->to_app.bytes > 0) {
+		switch (outq_flush(&call->to_app, &no_zerocopy, &call->zs)) {
+		case OUTQ_ERROR:
+			/* the application stopped reading, it may have answered though */
+			call->reusable = 0;
+			outq_free(&call->to_app);
+			outq_init(&call->to_app);
+			relay_pipe_close(&call->req_pipe);
+			call->body_left = 0;
+			events |= EPOLLIN;
+			break;
+		case OUTQ_DONE:
+			if (call->body_left > 0) call->notify(call);
+			break;
+		case OUTQ_AGAIN:
+			break;
+		}
+	}
+	if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) read_app(call, events);
+	update_events(call);
+}
@@ -0,0 +1,150 @@
+#ifndef FASTCGI_H
+#define FASTCGI_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include "evloop.h"
+#include "outq.h"
+#include "proxy.h"
+#include "request.h"
+#include "response.h"
+#include "upstream.h"
+#include "zerocopy.h"
+
+/* FastCGI 1.0 records (the FastCGI specification, section 3.3) */
+#define FCGI_VERSION_1 1
+#define FCGI_HEADER_LEN 8
+#define FCGI_MAX_CONTENT 65535ul
+
+enum fcgi_record_type {
+	FCGI_BEGIN_REQUEST = 1,
+	FCGI_ABORT_REQUEST,
+	FCGI_END_REQUEST,
+	FCGI_PARAMS,
+	FCGI_STDIN,
+	FCGI_STDOUT,
+	FCGI_STDERR,
+	FCGI_DATA,
+	FCGI_GET_VALUES,
+	FCGI_GET_VALUES_RESULT,
+	FCGI_UNKNOWN_TYPE
+};
+
+#define FCGI_RESPONDER 1
+#define FCGI_KEEP_CONN 1 /* BEGIN_REQUEST flag: the application keeps the connection */
+#define FCGI_REQUEST_COMPLETE 0 /* END_REQUEST protocolStatus */
+
+/* a connection carries one request at a time, always with this id */
+#define FCGI_REQUEST_ID 1
+
+/* the header of a record of `type` with `len` content bytes, unpadded */
+void fcgi_header(unsigned char *buf, enum fcgi_record_type type, size_t len);
+
+/* what the request came through, for the CGI variables */
+struct fcgi_script {
+	const char *docroot; /* the site's, NULL if none: no SCRIPT_FILENAME */
+	char remote_addr[INET6_ADDRSTRLEN];
+	unsigned remote_port;
+	unsigned server_port;
+};
+
+/* queue BEGIN_REQUEST and the PARAMS stream for `req`: the variables of
+   CGI/1.1 (RFC 3875 section 4.1), the script being the path under the
+   docroot, and one HTTP_ variable per field name, repeated fields joined.
+   Names with '_' are left out, they would pass for others once mapped,
+   and so is Proxy, which would pass for the HTTP_PROXY of the environment */
+void fcgi_push_params(struct outq *q, const struct http_request *req, const struct fcgi_script *script);
+
+/* walks the records an application sends */
+struct fcgi_scan {
+	unsigned char header[FCGI_HEADER_LEN];
+	size_t have; /* header bytes so far */
+	enum fcgi_record_type type;
+	unsigned id;
+	size_t content_left, padding_left;
+	int complete; /* the record just ended */
+};
+
+/* consume `buf` up to the next piece of record content or the end of a
+   record: the bytes consumed, the piece being the last `*n` of them, of a
+   record of scan->type; -1 if malformed */
+long fcgi_scan_next(struct fcgi_scan *scan, const char *buf, size_t len, size_t *n);
+
+/* turn the CGI head at the start of `buf` (RFC 3875 section 6.3), lines
+   ended by LF or CRLF, into the HTTP head of `resp`: Status for the status
+   line, 302 for a Location without one, 200 otherwise, other fields kept
+   but those of the connection, `status` set. Its length, 0 if incomplete,
+   -1 if malformed */
+long fcgi_parse_head(const char *buf, size_t len, const char *date, struct http_response *resp,
+		unsigned *status);
+
+enum fcgi_state {
+	FC_CONNECTING = 0,
+	FC_WAITING, /* sending the request, waiting for the CGI head */
+	FC_RELAYING, /* the head is queued, relaying stdout */
+	FC_DONE, /* the response is queued whole, a 502 if it failed early */
+	FC_BROKEN /* failed past the head, the client must not take it whole */
+};
+
+/* one request handed to a FastCGI application on behalf of a client
+   connection, over a pooled connection kept with FCGI_KEEP_CONN; its
+   stdout is queued for the client as it arrives */
+struct fcgi_call {
+	struct ev_source src; /* the application connection, -1 once released */
+	struct evloop *loop;
+	struct upstream *app;
+	const struct http_request *req;
+	struct fcgi_script script;
+	enum fcgi_state state;
+	int reused, retried;
+	unsigned events; /* watched on src */
+
+	struct outq to_app;
+	struct zc_socket zs;
+	size_t body_left; /* request body the client has yet to send */
+	struct relay_pipe req_pipe;
+
+	struct outq *to_client;
+	struct fcgi_scan scan;
+	size_t got; /* bytes the application sent */
+	char *head; /* stdout until the end of the CGI head */
+	size_t head_len;
+	int no_body; /* HEAD, 204 or 304: stdout past the head is dropped */
+	int reusable; /* the connection may serve another request */
+
+	/* the client queue got bytes or room, or the call ended */
+	void (*notify)(struct fcgi_call *call);
+	void *owner;
+};
+
+void fcgi_call_init(
+		struct fcgi_call *call,
+		struct evloop *loop,
+		struct upstream *app,
+		const struct http_request *req,
+		const struct fcgi_script *script,
+		struct outq *to_client,
+		void (*notify)(struct fcgi_call *call),
+		void *owner
+);
+
+/* send the request with the `len` body bytes the client sent along with
+   the head, on an idle connection if the application has one */
+void fcgi_call_start(struct fcgi_call *call, const char *body, size_t len);
+
+/* request body bytes the call takes now */
+size_t fcgi_call_room(const struct fcgi_call *call);
+
+/* move request body bytes from the client socket `fd` into STDIN records,
+   while fcgi_call_room() is positive; returns as recv() does */
+ssize_t fcgi_call_pull(struct fcgi_call *call, int fd);
+
+/* read the application again if the client queue has room */
+void fcgi_call_resume(struct fcgi_call *call);
+
+/* close the connection unless it was released, and the pipe; the client
+   queue must be done with it */
+void fcgi_call_free(struct fcgi_call *call);
+
+#endif
@@ -0,0 +1,577 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/openat2.h>
+#include "fdcache.h"
+#include "str.h"
+
+#define INDEX_FILE "index.html"
+
+#define WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | \
+		IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | \
+		IN_MOVE_SELF | IN_ONLYDIR)
+
+int walk_beneath(int dir_fd, const char *path) {
+	char name[NAME_MAX + 1];
+	const char *end;
+	size_t len;
+	int fd = dir_fd, next, flags, err;
+
+	if (path[0] == '/') {
+		errno = EXDEV;
+		return -1;
+	}
+	if (path[0] == '\0') path = ".";
+	while (*path != '\0') {
+		end = path + strcspn(path, "/");
+		len = (size_t)(end - path);
+		while (*end == '/') end++;
+		flags = O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NOFOLLOW;
+		if (*end != '\0') flags |= O_DIRECTORY;
+		if (len == 2 && path[0] == '.' && path[1] == '.') {
+			errno = EXDEV;
+			next = -1;
+		} else if (len > NAME_MAX) {
+			errno = ENAMETOOLONG;
+			next = -1;
+		} else {
+			memcpy(name, path, len);
+			name[len] = '\0';
+			next = openat(fd, name, flags);
+		}
+		if (fd != dir_fd) {
+			err = errno;
+			close(fd);
+			errno = err;
+		}
+		if (next == -1) return -1;
+		fd = next;
+		path = end;
+	}
+	return fd;
+}
+
+int open_beneath(int dir_fd, const char *path) {
+	struct open_how how;
+	long fd;
+
+	memset(&how, 0, sizeof how);
+	how.flags = O_RDONLY | O_CLOEXEC | O_NOCTTY;
+	how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+
+	fd = syscall(SYS_openat2, dir_fd, path, &how, sizeof how);
+	if (fd == -1 && errno == ENOSYS) return walk_beneath(dir_fd, path);
+	return (int)fd;
+}
+
+static void release_miss_watch(void *data, size_t watch);
+
+int fd_cache_init(struct fd_cache *cache, const char *docroot, size_t cap) {
+	size_t i;
+	struct stat st;
+
+	memset(cache, 0, sizeof *cache);
+
+	cache->root_fd = open(docroot, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (cache->root_fd == -1) {
+		return -1;
+	}
+	if (fstat(cache->root_fd, &st) == -1 || !S_ISDIR(st.st_mode)) {
+		close(cache->root_fd);
+		errno = ENOTDIR;
+		return -1;
+	}
+
+	cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (cache->inotify_fd == -1) {
+		perror("inotify_init1");
+	}
+
+	cache->root = malloc(strlen(docroot) + 1);
+	cache->cap = cap;
+	cache->entries = malloc((cap ? cap : 1) * sizeof(struct fd_entry));
+	if (cache->root == NULL || cache->entries == NULL) {
+		perror("fd_cache_init");
+		exit(1);
+	}
+	strcpy(cache->root, docroot);
+
+	lru_init(&cache->lru, cap);
+	for (i = cap; i > 0; --i) {
+		cache->entries[i - 1].fd = -1;
+		cache->entries[i - 1].key = NULL;
+		lru_put_free(&cache->lru, &cache->entries[i - 1].node);
+	}
+
+	neg_cache_init(&cache->misses, NEG_CACHE_DEFAULT_CAP, release_miss_watch, cache);
+
+	return 0;
+}
+
+static void release_watch(struct fd_cache *cache, size_t w) {
+	struct fd_watch *watch;
+
+	if (w == FD_NONE) return;
+	watch = cache->watches + w;
+	if (--watch->refs > 0) return;
+
+	if (watch->wd != -1) {
+		inotify_rm_watch(cache->inotify_fd, watch->wd);
+	}
+	free(watch->dir);
+	watch->dir = NULL;
+	watch->wd = -1;
+}
+
+static void release_miss_watch(void *data, size_t watch) {
+	release_watch((struct fd_cache *)data, watch);
+}
+
+/* watch the directory of a file key, FD_NONE if inotify is unavailable */
+static size_t acquire_watch(struct fd_cache *cache, const char *dir, size_t dir_len) {
+	size_t i, free_slot = FD_NONE;
+	char *full;
+	int wd;
+
+	if (cache->inotify_fd == -1) return FD_NONE;
+
+	for (i = 0; i < cache->num_watches; ++i) {
+		struct fd_watch *watch = cache->watches + i;
+		if (watch->dir == NULL) {
+			if (free_slot == FD_NONE) free_slot = i;
+			continue;
+		}
+		if (watch->dir_len == dir_len && !memcmp(watch->dir, dir, dir_len)) {
+			watch->refs++;
+			return i;
+		}
+	}
+
+	full = malloc(strlen(cache->root) + dir_len + 2);
+	if (full == NULL) {
+		perror("acquire_watch");
+		exit(1);
+	}
+	sprintf(full, "%s/%.*s", cache->root, (int)dir_len, dir);
+	wd = inotify_add_watch(cache->inotify_fd, full, WATCH_MASK);
+	free(full);
+	if (wd == -1) {
+		return FD_NONE;
+	}
+
+	if (free_slot == FD_NONE) {
+		if (cache->num_watches == cache->cap_watches) {
+			cache->cap_watches = cache->cap_watches ? cache->cap_watches * 2 : 16;
+			cache->watches = realloc(cache->watches,
+				cache->cap_watches * sizeof(struct fd_watch));
+			if (cache->watches == NULL) {
+				perror("acquire_watch");
+				exit(1);
+			}
+		}
+		free_slot = cache->num_watches++;
+	}
+
+	cache->watches[free_slot].wd = wd;
+	cache->watches[free_slot].dir = malloc(dir_len + 1);
+	if (cache->watches[free_slot].dir == NULL) {
+		perror("acquire_watch");
+		exit(1);
+	}
+	memcpy(cache->watches[free_slot].dir, dir, dir_len);
+	cache->watches[free_slot].dir[dir_len] = '\0';
+	cache->watches[free_slot].dir_len = dir_len;
+	cache->watches[free_slot].refs = 1;
+	return free_slot;
+}
+
+/* strong validator: any rewrite changes the size, the mtime or the inode */
+static void set_validators(struct fd_variant *v) {
+	v->etag_len = (size_t)sprintf(v->etag, "\"%lx-%lx-%lx%08lx\"",
+		(unsigned long)v->st.st_ino,
+		(unsigned long)v->st.st_size,
+		(unsigned long)v->st.st_mtim.tv_sec,
+		(unsigned long)v->st.st_mtim.tv_nsec);
+	format_http_date(v->st.st_mtime, v->last_modified);
+}
+
+/* large files read sequentially get a bigger kernel readahead window */
+static void init_advice(struct fd_cache *cache, struct fd_variant *v) {
+	v->pages = NULL;
+	if ((size_t)v->st.st_size >= RA_MIN_FILE) {
+		posix_fadvise(v->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		v->pages = ra_file_new((size_t)v->st.st_size, &cache->stats.pages);
+	}
+}
+
+static void close_variants(struct fd_entry *e) {
+	int c;
+	for (c = 0; c < CC__COUNT; ++c) {
+		ra_file_unref(e->variants[c].pages, e->variants[c].fd);
+		if (e->variants[c].fd != -1) close(e->variants[c].fd);
+		canned_free(&e->variants[c].not_modified);
+	}
+}
+
+/* an entry evicted for disuse: what this worker sent of its large files
+   leaves the page cache once no longer queued */
+static void mark_cold(struct fd_entry *e) {
+	int c;
+	for (c = 0; c < CC__COUNT; ++c) {
+		if (e->variants[c].pages != NULL) e->variants[c].pages->cold = 1;
+	}
+}
+
+/* open the precompressed siblings of an entry's file */
+static void open_variants(struct fd_cache *cache, struct fd_entry *e) {
+	size_t file_len = strlen(e->file);
+	char *sibling = malloc(file_len + 4);
+	int c;
+
+	if (sibling == NULL) {
+		perror("open_variants");
+		exit(1);
+	}
+
+	for (c = 0; c < CC__COUNT; ++c) {
+		e->variants[c].not_modified.buf = NULL;
+		e->variants[c].pages = NULL;
+	}
+	e->codings = CODING_BIT(CC_IDENTITY);
+	e->variants[CC_IDENTITY].fd = e->fd;
+	e->variants[CC_IDENTITY].st = e->st;
+	set_validators(e->variants + CC_IDENTITY);
+	init_advice(cache, e->variants + CC_IDENTITY);
+	for (c = 0; c < CC_IDENTITY; ++c) {
+		struct fd_variant *v = e->variants + c;
+		sprintf(sibling, "%s%s", e->file, coding_suffix((enum content_coding)c));
+		v->fd = open_beneath(cache->root_fd, sibling);
+		if (v->fd == -1) continue;
+		/* a sibling older than the file is a leftover, not a variant */
+		if (fstat(v->fd, &v->st) == -1 || !S_ISREG(v->st.st_mode) ||
+				v->st.st_mtime < e->st.st_mtime) {
+			close(v->fd);
+			v->fd = -1;
+			continue;
+		}
+		set_validators(v);
+		init_advice(cache, v);
+		e->codings |= CODING_BIT(c);
+	}
+	e->ae_valid = 0;
+	free(sibling);
+}
+
+static void remove_entry(struct fd_cache *cache, struct fd_entry *e) {
+	lru_remove(&cache->lru, &e->node);
+
+	close_variants(e);
+	release_watch(cache, e->watch);
+	free(e->key);
+	e->key = NULL;
+	e->fd = -1;
+	lru_put_free(&cache->lru, &e->node);
+}
+
+void fd_cache_free(struct fd_cache *cache) {
+	size_t i;
+	neg_cache_free(&cache->misses);
+	for (i = 0; i < cache->cap; ++i) {
+		if (cache->entries[i].key != NULL) {
+			close_variants(cache->entries + i);
+			free(cache->entries[i].key);
+		}
+	}
+	for (i = 0; i < cache->num_watches; ++i) {
+		free(cache->watches[i].dir);
+	}
+	if (cache->inotify_fd != -1) close(cache->inotify_fd);
+	close(cache->root_fd);
+	free(cache->watches);
+	free(cache->entries);
+	lru_free(&cache->lru);
+	free(cache->root);
+}
+
+/* open the file a key names, following directories to their index */
+static int open_key(struct fd_cache *cache, const char *key, struct stat *st, int *is_index) {
+	int fd = open_beneath(cache->root_fd, key[0] ? key : ".");
+	int index_fd;
+
+	*is_index = 0;
+	if (fd == -1) return -1;
+	if (fstat(fd, st) == -1) {
+		close(fd);
+		return -1;
+	}
+	if (S_ISREG(st->st_mode)) return fd;
+	if (!S_ISDIR(st->st_mode)) {
+		close(fd);
+		errno = EACCES;
+		return -1;
+	}
+
+	index_fd = open_beneath(fd, INDEX_FILE);
+	close(fd);
+	if (index_fd == -1) return -1;
+	if (fstat(index_fd, st) == -1 || !S_ISREG(st->st_mode)) {
+		close(index_fd);
+		errno = ENOENT;
+		return -1;
+	}
+	*is_index = 1;
+	return index_fd;
+}
+
+/* watch the deepest existing directory on the way to a missing key, which
+   is where it would have to be created */
+static size_t watch_missing(struct fd_cache *cache, const char *key, size_t key_len) {
+	char *dir = malloc(key_len + 1);
+	size_t len = key_len;
+	size_t watch = FD_NONE;
+	struct stat st;
+
+	if (dir == NULL) {
+		perror("watch_missing");
+		exit(1);
+	}
+	memcpy(dir, key, key_len);
+
+	while (1) {
+		dir[len] = '\0';
+		if (fstatat(cache->root_fd, len ? dir : ".", &st, 0) == 0 &&
+				S_ISDIR(st.st_mode)) {
+			watch = acquire_watch(cache, dir, len);
+			break;
+		}
+		if (len == 0) break;
+		while (len > 0 && dir[len - 1] != '/') len--;
+		if (len > 0) len--;
+	}
+
+	free(dir);
+	return watch;
+}
+
+struct fd_entry *fd_cache_get(struct fd_cache *cache, const char *key, size_t key_len) {
+	uint32_t hash = hash_bytes(key, key_len, HASH_SEED);
+	struct lru_node *node = lru_bucket(&cache->lru, hash);
+	struct fd_entry *e;
+	struct stat st;
+	const char *slash;
+	size_t dir_len;
+	int fd, is_index;
+
+	for (; node != NULL; node = node->chain_next) {
+		e = LRU_ENTRY(node, struct fd_entry, node);
+		if (node->hash != hash || e->key_len != key_len ||
+				memcmp(e->key, key, key_len)) {
+			continue;
+		}
+		if (e->watch == FD_NONE) {
+			/* no watch available, fall back to re-stat'ing */
+			if (fstat(e->fd, &st) == -1 || st.st_nlink == 0 ||
+					st.st_mtime != e->st.st_mtime ||
+					st.st_size != e->st.st_size) {
+				remove_entry(cache, e);
+				cache->stats.invalidations++;
+				break;
+			}
+		}
+		lru_touch(&cache->lru, node);
+		cache->stats.hits++;
+		return e;
+	}
+
+	if (neg_cache_contains(&cache->misses, key, key_len, hash)) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	cache->stats.misses++;
+	fd = open_key(cache, key, &st, &is_index);
+	if (fd == -1) {
+		if (errno == ENOENT || errno == ENOTDIR) {
+			int saved_errno = errno;
+			size_t watch = watch_missing(cache, key, key_len);
+			if (watch != FD_NONE) {
+				neg_cache_insert(&cache->misses, key, key_len, hash, watch);
+			}
+			errno = saved_errno;
+		}
+		return NULL;
+	}
+
+	if (cache->cap == 0) {
+		close(fd);
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (cache->lru.free_head == NULL) {
+		e = LRU_ENTRY(cache->lru.lru_tail, struct fd_entry, node);
+		mark_cold(e);
+		remove_entry(cache, e);
+		cache->stats.evictions++;
+	}
+
+	node = lru_take_free(&cache->lru);
+	e = LRU_ENTRY(node, struct fd_entry, node);
+
+	/* "key\0file\0" where file is the key itself or "key/index.html" */
+	e->key = malloc(key_len * 2 + sizeof INDEX_FILE + 2);
+	if (e->key == NULL) {
+		perror("fd_cache_get");
+		exit(1);
+	}
+	memcpy(e->key, key, key_len);
+	e->key[key_len] = '\0';
+	e->file = e->key + key_len + 1;
+	if (is_index) {
+		sprintf(e->key + key_len + 1, "%s%s" INDEX_FILE,
+			e->key, key_len ? "/" : "");
+	} else {
+		strcpy(e->key + key_len + 1, e->key);
+	}
+	e->key_len = key_len;
+	e->fd = fd;
+	e->st = st;
+
+	open_variants(cache, e);
+
+	slash = strrchr(e->file, '/');
+	e->name = slash ? slash + 1 : e->file;
+	dir_len = slash ? (size_t)(slash - e->file) : 0;
+	e->watch = acquire_watch(cache, e->file, dir_len);
+
+	lru_insert(&cache->lru, node, hash);
+
+	return e;
+}
+
+/* drop every entry whose file lies under `dir` ("" for all) */
+static void invalidate_prefix(struct fd_cache *cache, const char *dir, size_t dir_len) {
+	size_t i;
+	for (i = 0; i < cache->cap; ++i) {
+		struct fd_entry *e = cache->entries + i;
+		if (e->key == NULL) continue;
+		if (dir_len > 0 && (strncmp(e->file, dir, dir_len) ||
+					e->file[dir_len] != '/')) {
+			continue;
+		}
+		remove_entry(cache, e);
+		cache->stats.invalidations++;
+	}
+}
+
+/* return 1 if `name` is the file itself or one of its siblings */
+static int names_entry(const struct fd_entry *e, const char *name) {
+	size_t len = strlen(e->name);
+	int c;
+
+	if (strncmp(e->name, name, len)) return 0;
+	if (name[len] == '\0') return 1;
+	for (c = 0; c < CC_IDENTITY; ++c) {
+		if (!strcmp(name + len, coding_suffix((enum content_coding)c))) return 1;
+	}
+	return 0;
+}
+
+/* drop entries of a watched directory whose file or sibling is `name` */
+static void invalidate_name(struct fd_cache *cache, size_t w, const char *name) {
+	size_t i;
+	for (i = 0; i < cache->cap; ++i) {
+		struct fd_entry *e = cache->entries + i;
+		if (e->key == NULL || e->watch != w || !names_entry(e, name)) {
+			continue;
+		}
+		remove_entry(cache, e);
+		cache->stats.invalidations++;
+	}
+}
+
+static void handle_event(struct fd_cache *cache, const struct inotify_event *ev) {
+	size_t w;
+	struct fd_watch *watch = NULL;
+	char *sub;
+	size_t dir_len, sub_len;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		invalidate_prefix(cache, "", 0);
+		neg_cache_clear(&cache->misses);
+		return;
+	}
+
+	for (w = 0; w < cache->num_watches; ++w) {
+		if (cache->watches[w].dir != NULL && cache->watches[w].wd == ev->wd) {
+			watch = cache->watches + w;
+			break;
+		}
+	}
+	if (watch == NULL) return;
+
+	/* invalidation may drop the watch, work on a copy of its path */
+	dir_len = watch->dir_len;
+	sub_len = dir_len;
+	if (ev->len > 0) {
+		sub_len += (dir_len ? 1 : 0) + strlen(ev->name);
+	}
+	sub = malloc(sub_len + 1);
+	if (sub == NULL) {
+		perror("handle_event");
+		exit(1);
+	}
+	if (ev->len == 0) {
+		strcpy(sub, watch->dir);
+	} else if (dir_len) {
+		sprintf(sub, "%s/%s", watch->dir, ev->name);
+	} else {
+		strcpy(sub, ev->name);
+	}
+
+	if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+		/* the directory itself is gone, and with it any subdirectory */
+		if (ev->mask & IN_IGNORED) watch->wd = -1;
+		invalidate_prefix(cache, sub, dir_len);
+		neg_cache_invalidate_watch(&cache->misses, w);
+	} else if (ev->len > 0) {
+		if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+			neg_cache_invalidate_path(&cache->misses, w,
+				sub, dir_len, sub, sub_len);
+		}
+		if (ev->mask & IN_ISDIR) {
+			invalidate_prefix(cache, sub, sub_len);
+		} else {
+			invalidate_name(cache, w, ev->name);
+		}
+	}
+
+	free(sub);
+}
+
+void fd_cache_sync(struct fd_cache *cache) {
+	union {
+		struct inotify_event ev;
+		char bytes[4096];
+	} buf;
+	ssize_t n;
+
+	if (cache->inotify_fd == -1) return;
+
+	while ((n = read(cache->inotify_fd, buf.bytes, sizeof buf.bytes)) > 0) {
+		ssize_t off = 0;
+		while (off < n) {
+			const struct inotify_event *ev =
+				(const struct inotify_event *)(void *)(buf.bytes + off);
+			handle_event(cache, ev);
+			off += (ssize_t)(sizeof(struct inotify_event) + ev->len);
+		}
+	}
+}
@@ -0,0 +1,120 @@
+#ifndef FDCACHE_H
+#define FDCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "datetime.h"
+#include "encoding.h"
+#include "lru.h"
+#include "negcache.h"
+#include "readahead.h"
+#include "response.h"
+
+#define FD_CACHE_DEFAULT_CAP 1024
+#define FD_NONE SIZE_MAX
+
+/* quoted strong entity tag, room for three 64-bit fields and nanoseconds */
+#define ETAG_MAX 64
+
+/* Accept-Encoding values a negotiation is remembered for, longer ones are
+   negotiated every time */
+#define AE_KEY_MAX 96
+
+struct fd_variant {
+	int fd; /* -1 if absent */
+	struct stat st;
+	char etag[ETAG_MAX]; /* from inode, size and mtime */
+	size_t etag_len;
+	char last_modified[HTTP_DATE_LEN + 1];
+
+	/* 304 for this variant, built on first use by the owner of the cache */
+	struct canned_response not_modified;
+
+	/* page-cache hints of a large file, NULL otherwise, see readahead.h */
+	struct ra_file *pages;
+};
+
+/* an open regular file, keyed by its normalized path relative to docroot;
+   directory keys resolve to their index.html */
+struct fd_entry {
+	char *key;
+	size_t key_len;
+	const char *file; /* path of the opened file, stored after `key` */
+	const char *name; /* basename of `file` */
+
+	int fd;
+	struct stat st;
+	size_t watch; /* index into watches or FD_NONE if unwatched */
+
+	/* precompressed siblings ("file.br", "file.gz") no older than the file,
+	   by content_coding; the identity slot mirrors fd and st */
+	struct fd_variant variants[CC__COUNT];
+	unsigned codings; /* CODING_BIT() of every available variant */
+
+	/* last negotiation, keyed by accept_encoding_key() */
+	char ae_key[AE_KEY_MAX];
+	size_t ae_len;
+	enum content_coding ae_choice;
+	int ae_valid;
+
+	struct lru_node node;
+};
+
+/* inotify watch on a directory holding cached files */
+struct fd_watch {
+	int wd;
+	char *dir; /* relative to docroot, "" for the root itself */
+	size_t dir_len;
+	size_t refs;
+};
+
+struct fd_cache_stats {
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t invalidations;
+	struct ra_stats pages;
+};
+
+struct fd_cache {
+	struct fd_entry *entries;
+	size_t cap;
+	struct lru_table lru;
+
+	int root_fd; /* docroot, base of every lookup */
+	char *root;
+	int inotify_fd;
+
+	struct fd_watch *watches;
+	size_t num_watches, cap_watches;
+
+	/* keys that failed with ENOENT or ENOTDIR, each holding a watch on its
+	   deepest existing directory */
+	struct neg_cache misses;
+
+	struct fd_cache_stats stats;
+};
+
+/* return 0 on success, -1 if docroot cannot be opened; the cache must not
+   move afterwards */
+int fd_cache_init(struct fd_cache *cache, const char *docroot, size_t cap);
+void fd_cache_free(struct fd_cache *cache);
+
+/* return the entry for the normalized `key`, opening it on a miss; NULL with
+   errno set if it cannot be opened (ENOENT, EACCES, EXDEV when escaping the
+   docroot). Keys known to be missing fail with ENOENT without a lookup. The
+   entry is valid until the next call into the cache */
+struct fd_entry *fd_cache_get(struct fd_cache *cache, const char *key, size_t key_len);
+
+/* drain pending inotify events and drop the entries they invalidate */
+void fd_cache_sync(struct fd_cache *cache);
+
+/* open `path` relative to `dir_fd` without leaving it, -1 with errno set */
+int open_beneath(int dir_fd, const char *path);
+
+/* the same where openat2() is missing (before Linux 5.6): one component at
+   a time, refusing ".." (EXDEV) and symlinks (ELOOP or ENOTDIR) */
+int walk_beneath(int dir_fd, const char *path);
+
+#endif
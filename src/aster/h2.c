@@ -0,0 +1,967 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "datetime.h"
+#include "h2.h"
+#include "str.h"
+
+/* the pseudo-header fields of a request, section 8.3.1 */
+enum pseudo {
+	PSEUDO_METHOD = 0,
+	PSEUDO_SCHEME,
+	PSEUDO_AUTHORITY,
+	PSEUDO_PATH
+};
+
+static const char *const pseudo_names[] = {":method", ":scheme", ":authority", ":path"};
+
+/* fields of the connection, left out both ways, section 8.2.2 */
+static const char *const connection_fields[] = {
+	"connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade"
+};
+
+static void *alloc(size_t size) {
+	void *ptr = malloc(size);
+	if (ptr == NULL) {
+		perror("h2");
+		exit(1);
+	}
+	return ptr;
+}
+
+static uint32_t get32(const unsigned char *p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void put32(unsigned char *p, uint32_t value) {
+	p[0] = (unsigned char)(value >> 24);
+	p[1] = (unsigned char)(value >> 16);
+	p[2] = (unsigned char)(value >> 8);
+	p[3] = (unsigned char)value;
+}
+
+static size_t frame_length(const unsigned char *header) {
+	return (size_t)header[0] << 16 | (size_t)header[1] << 8 | header[2];
+}
+
+static void frame_header(unsigned char *buf, size_t len, enum h2_frame_type type, int flags, uint32_t id) {
+	buf[0] = (unsigned char)(len >> 16);
+	buf[1] = (unsigned char)(len >> 8);
+	buf[2] = (unsigned char)len;
+	buf[3] = (unsigned char)type;
+	buf[4] = (unsigned char)flags;
+	put32(buf + 5, id);
+}
+
+static void queue_frame(
+		struct h2_conn *h2,
+		enum h2_frame_type type,
+		int flags,
+		uint32_t id,
+		const unsigned char *payload,
+		size_t len
+) {
+	unsigned char *frame = alloc(H2_FRAME_HEADER + len);
+
+	frame_header(frame, len, type, flags, id);
+	if (len > 0) memcpy(frame + H2_FRAME_HEADER, payload, len);
+	outq_push_mem(h2->out, (char *)frame, H2_FRAME_HEADER + len, (char *)frame, NULL);
+}
+
+static void queue_u32(struct h2_conn *h2, enum h2_frame_type type, uint32_t id, uint32_t value) {
+	unsigned char payload[4];
+
+	put32(payload, value);
+	queue_frame(h2, type, 0, id, payload, sizeof payload);
+}
+
+/* a connection error, section 5.4.1: the connection ends after GOAWAY */
+static void fail(struct h2_conn *h2, enum h2_error code) {
+	unsigned char payload[8];
+
+	if (h2->failed) return;
+	put32(payload, h2->last_id);
+	put32(payload + 4, code);
+	queue_frame(h2, H2_GOAWAY, 0, 0, payload, sizeof payload);
+	h2->failed = 1;
+	h2->going_away = 1;
+}
+
+void h2_conn_shutdown(struct h2_conn *h2) {
+	unsigned char payload[8];
+
+	if (h2->going_away) return;
+	put32(payload, h2->last_id);
+	put32(payload + 4, H2_NO_ERROR);
+	queue_frame(h2, H2_GOAWAY, 0, 0, payload, sizeof payload);
+	h2->going_away = 1;
+}
+
+int h2_conn_done(const struct h2_conn *h2) {
+	return h2->failed || (h2->going_away && h2->num_streams == 0);
+}
+
+static struct h2_stream *find_stream(const struct h2_conn *h2, uint32_t id) {
+	struct h2_stream *st;
+
+	for (st = h2->streams; st != NULL && st->id != id; st = st->next);
+	return st;
+}
+
+static struct h2_stream *open_stream(struct h2_conn *h2, uint32_t id) {
+	static const struct body_stream no_body = {NULL, NULL, NULL, 0};
+	struct h2_stream *st = alloc(sizeof *st);
+
+	st->id = id;
+	st->req = new_request();
+	st->ctx = parse_ctx_init(&st->req);
+	st->remote_closed = 0;
+	st->local_closed = 0;
+	st->responded = 0;
+	st->window = h2->initial_window;
+	st->unacked = 0;
+	outq_init(&st->body);
+	stream_init(&st->producer, &st->body, &no_body);
+	st->prev = NULL;
+	st->next = h2->streams;
+	if (h2->streams != NULL) h2->streams->prev = st;
+	h2->streams = st;
+	h2->num_streams++;
+	if (id > h2->last_id) h2->last_id = id;
+	return st;
+}
+
+static void close_stream(struct h2_conn *h2, struct h2_stream *st) {
+	if (st->prev != NULL) st->prev->next = st->next;
+	else h2->streams = st->next;
+	if (st->next != NULL) st->next->prev = st->prev;
+	if (h2->turn == st) h2->turn = st->next;
+	if (h2->fields.stream == st) h2->fields.stream = NULL;
+	h2->num_streams--;
+
+	stream_free(&st->producer);
+	outq_free(&st->body);
+	parse_ctx_free(&st->ctx);
+	http_request_free(&st->req);
+	free(st);
+}
+
+/* a stream error, section 5.4.2 */
+static void reset_stream(struct h2_conn *h2, struct h2_stream *st, enum h2_error code) {
+	queue_u32(h2, H2_RST_STREAM, st->id, code);
+	close_stream(h2, st);
+}
+
+/* the response is queued whole: the stream goes once the client ends its
+   side as well, what it still sends being dropped. Section 8.1 allows
+   RST_STREAM instead, which some clients take for a failed request */
+static void end_stream(struct h2_conn *h2, struct h2_stream *st) {
+	if (st->remote_closed) close_stream(h2, st);
+	else st->local_closed = 1;
+}
+
+void h2_conn_init(
+		struct h2_conn *h2,
+		struct outq *out,
+		int preface_read,
+		void (*serve)(struct h2_conn *h2, struct h2_stream *st),
+		void *owner
+) {
+	unsigned char settings[12];
+
+	memset(h2, 0, sizeof *h2);
+	h2->out = out;
+	hpack_decoder_init(&h2->hpack);
+	h2->preface = preface_read ? 0 : H2_PREFACE_LEN;
+	h2->max_frame = H2_FRAME_SIZE;
+	h2->initial_window = H2_WINDOW;
+	h2->window = H2_WINDOW;
+	h2->fields.reset = -1;
+	h2->serve = serve;
+	h2->owner = owner;
+
+	/* our preface, the windows and table size left as they start */
+	settings[0] = 0;
+	settings[1] = H2_MAX_CONCURRENT_STREAMS;
+	put32(settings + 2, H2_MAX_STREAMS);
+	settings[6] = 0;
+	settings[7] = H2_MAX_HEADER_LIST_SIZE;
+	put32(settings + 8, H2_MAX_FIELDS);
+	queue_frame(h2, H2_SETTINGS, 0, 0, settings, sizeof settings);
+}
+
+void h2_conn_free(struct h2_conn *h2) {
+	while (h2->streams != NULL) close_stream(h2, h2->streams);
+	hpack_decoder_free(&h2->hpack);
+	free(h2->in);
+	free(h2->block);
+	free(h2->fields.buf);
+}
+
+/* section 6.5.2; -1 once the connection failed */
+static int apply_settings(struct h2_conn *h2, const unsigned char *p, size_t len) {
+	struct h2_stream *st;
+	uint32_t value;
+	long delta;
+	size_t i;
+
+	for (i = 0; i + 6 <= len; i += 6) {
+		value = get32(p + i + 2);
+		switch ((p[i] << 8) | p[i + 1]) {
+		case H2_ENABLE_PUSH:
+			if (value > 1) {
+				fail(h2, H2_PROTOCOL_ERROR);
+				return -1;
+			}
+			break;
+		case H2_INITIAL_WINDOW_SIZE:
+			if (value > H2_MAX_WINDOW) {
+				fail(h2, H2_FLOW_CONTROL_ERROR);
+				return -1;
+			}
+			/* the streams open follow, section 6.9.2 */
+			delta = (long)value - h2->initial_window;
+			for (st = h2->streams; st != NULL; st = st->next) {
+				if (delta > 0 && st->window > (long)H2_MAX_WINDOW - delta) {
+					fail(h2, H2_FLOW_CONTROL_ERROR);
+					return -1;
+				}
+				st->window += delta;
+			}
+			h2->initial_window = (long)value;
+			break;
+		case H2_MAX_FRAME_SIZE:
+			if (value < H2_FRAME_SIZE || value > 0xffffff) {
+				fail(h2, H2_PROTOCOL_ERROR);
+				return -1;
+			}
+			h2->max_frame = value;
+			break;
+		default:
+			/* the table size is for an encoder that indexes nothing, the
+			   other limits do not bind a server that never pushes */
+			break;
+		}
+	}
+	return 0;
+}
+
+static void on_settings(struct h2_conn *h2, int flags, uint32_t id, const unsigned char *p, size_t len) {
+	if (id != 0) {
+		fail(h2, H2_PROTOCOL_ERROR);
+	} else if (flags & H2_ACK) {
+		if (len != 0) fail(h2, H2_FRAME_SIZE_ERROR);
+	} else if (len % 6 != 0) {
+		fail(h2, H2_FRAME_SIZE_ERROR);
+	} else if (apply_settings(h2, p, len) == 0) {
+		h2->settled = 1;
+		queue_frame(h2, H2_SETTINGS, H2_ACK, 0, NULL, 0);
+	}
+}
+
+/* the payload past its padding, section 6.1; -1 if the padding overflows */
+static int unpad(int flags, const unsigned char **p, size_t *len) {
+	size_t pad;
+
+	if (!(flags & H2_PADDED)) return 0;
+	if (*len == 0) return -1;
+	pad = **p;
+	if (pad >= *len) return -1;
+	(*p)++;
+	*len -= 1 + pad;
+	return 0;
+}
+
+/* a stream the client has yet to open */
+static int idle(const struct h2_conn *h2, uint32_t id) {
+	return id > h2->last_id || !(id & 1);
+}
+
+/* no handler served over HTTP/2 reads bodies: DATA is dropped, its
+   window given back as soon as half of it is used */
+static void on_data(struct h2_conn *h2, int flags, uint32_t id, const unsigned char *p, size_t len) {
+	struct h2_stream *st;
+	size_t counted = len;
+
+	if (id == 0 || idle(h2, id)) {
+		fail(h2, H2_PROTOCOL_ERROR);
+		return;
+	}
+	if (h2->unacked + counted > H2_WINDOW) {
+		fail(h2, H2_FLOW_CONTROL_ERROR);
+		return;
+	}
+	if (unpad(flags, &p, &len) == -1) {
+		fail(h2, H2_PROTOCOL_ERROR);
+		return;
+	}
+	h2->unacked += counted;
+	if (h2->unacked >= H2_WINDOW / 2) {
+		queue_u32(h2, H2_WINDOW_UPDATE, 0, (uint32_t)h2->unacked);
+		h2->unacked = 0;
+	}
+
+	/* one we reset or answered may still be sent to for a while */
+	st = find_stream(h2, id);
+	if (st == NULL) return;
+	if (st->remote_closed) {
+		reset_stream(h2, st, H2_STREAM_CLOSED);
+		return;
+	}
+	st->unacked += counted;
+	if (st->unacked > H2_WINDOW) {
+		reset_stream(h2, st, H2_FLOW_CONTROL_ERROR);
+		return;
+	}
+	if (flags & H2_END_STREAM) {
+		st->remote_closed = 1;
+		if (st->local_closed) close_stream(h2, st);
+	} else if (st->unacked >= H2_WINDOW / 2) {
+		queue_u32(h2, H2_WINDOW_UPDATE, id, (uint32_t)st->unacked);
+		st->unacked = 0;
+	}
+}
+
+static void on_window_update(struct h2_conn *h2, uint32_t id, const unsigned char *p, size_t len) {
+	struct h2_stream *st;
+	uint32_t increment;
+
+	if (len != 4) {
+		fail(h2, H2_FRAME_SIZE_ERROR);
+		return;
+	}
+	increment = get32(p) & 0x7fffffff;
+	if (id == 0) {
+		if (increment == 0) fail(h2, H2_PROTOCOL_ERROR);
+		else if (h2->window > (long)(H2_MAX_WINDOW - increment)) fail(h2, H2_FLOW_CONTROL_ERROR);
+		else h2->window += (long)increment;
+		return;
+	}
+	if (idle(h2, id)) {
+		fail(h2, H2_PROTOCOL_ERROR);
+		return;
+	}
+	st = find_stream(h2, id);
+	if (st == NULL) return;
+	if (increment == 0) reset_stream(h2, st, H2_PROTOCOL_ERROR);
+	else if (st->window > (long)(H2_MAX_WINDOW - increment)) reset_stream(h2, st, H2_FLOW_CONTROL_ERROR);
+	else st->window += (long)increment;
+}
+
+static void put_fields(struct h2_fields *f, const char *ptr, size_t len) {
+	if (f->len + len > f->cap) {
+		f->cap = f->len + len > 2 * f->cap ? f->len + len : 2 * f->cap;
+		f->buf = realloc(f->buf, f->cap);
+		if (f->buf == NULL) {
+			perror("h2");
+			exit(1);
+		}
+	}
+	memcpy(f->buf + f->len, ptr, len);
+	f->len += len;
+}
+
+static int named(struct slice name, const char *str) {
+	return !slice_str_cmp_check(&name, str);
+}
+
+/* the request line and Host, once the pseudo-header fields are all in:
+   0 if they do not make a request */
+static int start_request(struct h2_fields *f) {
+	struct parse_ctx *ctx = &f->stream->ctx;
+	const char *method = f->buf + f->off[PSEUDO_METHOD];
+	const char *authority = f->buf + f->off[PSEUDO_AUTHORITY];
+	size_t method_len = f->value_len[PSEUDO_METHOD];
+	int connect;
+
+	f->regular = 1;
+	connect = method_len == 7 && !memcmp(method, "CONNECT", 7);
+	if (!(f->seen & 1 << PSEUDO_METHOD) ||
+			(connect && f->seen != (1 << PSEUDO_METHOD | 1 << PSEUDO_AUTHORITY)) ||
+			(!connect && (!(f->seen & 1 << PSEUDO_SCHEME) || !(f->seen & 1 << PSEUDO_PATH) ||
+				f->value_len[PSEUDO_PATH] == 0))) {
+		f->malformed = 1;
+		return 0;
+	}
+
+	feed(ctx, method, method_len);
+	feed(ctx, " ", 1);
+	if (connect) feed(ctx, authority, f->value_len[PSEUDO_AUTHORITY]);
+	else feed(ctx, f->buf + f->off[PSEUDO_PATH], f->value_len[PSEUDO_PATH]);
+	feed(ctx, " HTTP/1.1" CRLF, 11);
+	if (f->seen & 1 << PSEUDO_AUTHORITY) {
+		feed(ctx, "host: ", 6);
+		feed(ctx, authority, f->value_len[PSEUDO_AUTHORITY]);
+		feed(ctx, CRLF, 2);
+	}
+	f->cookies = f->len;
+	return 1;
+}
+
+/* a field of a request, section 8.2 */
+static void take_field(void *arg, struct slice name, struct slice value) {
+	struct h2_conn *h2 = arg;
+	struct h2_fields *f = &h2->fields;
+	struct parse_ctx *ctx;
+	size_t i;
+	int p;
+
+	f->size += name.len + value.len + HPACK_ENTRY_OVERHEAD;
+	if (f->stream == NULL || f->malformed) return;
+	if (f->size > H2_MAX_FIELDS) {
+		f->malformed = 1;
+		return;
+	}
+	/* the parser would take the rest of a line for another field */
+	for (i = 0; i < value.len; ++i) {
+		if (value.ptr[i] == '\0' || value.ptr[i] == SYM_CR || value.ptr[i] == SYM_LF) break;
+	}
+	if (i < value.len || (value.len > 0 && (value.ptr[0] == SYM_SP || value.ptr[0] == SYM_HTAB ||
+			value.ptr[value.len - 1] == SYM_SP || value.ptr[value.len - 1] == SYM_HTAB))) {
+		f->malformed = 1;
+		return;
+	}
+
+	if (name.len > 0 && name.ptr[0] == ':') {
+		for (p = 0; p < 4 && !named(name, pseudo_names[p]); ++p);
+		if (p == 4 || f->regular || (f->seen & 1 << p)) {
+			f->malformed = 1;
+			return;
+		}
+		f->seen |= 1 << p;
+		f->off[p] = f->len;
+		f->value_len[p] = value.len;
+		put_fields(f, value.ptr, value.len);
+		return;
+	}
+
+	for (i = 0; i < name.len && !(name.ptr[i] >= 'A' && name.ptr[i] <= 'Z'); ++i);
+	if (i < name.len) {
+		f->malformed = 1;
+		return;
+	}
+	for (i = 0; i < sizeof connection_fields / sizeof connection_fields[0]; ++i) {
+		if (named(name, connection_fields[i])) {
+			f->malformed = 1;
+			return;
+		}
+	}
+	if (named(name, "te")) {
+		if (slice_str_cmp_check(&value, "trailers")) f->malformed = 1;
+		return;
+	}
+	if (!f->regular && !start_request(f)) return;
+
+	if (named(name, "cookie")) {
+		/* crumbs are joined back, section 8.2.3 */
+		if (f->len > f->cookies) put_fields(f, "; ", 2);
+		put_fields(f, value.ptr, value.len);
+		return;
+	}
+	if (named(name, "host") && (f->seen & 1 << PSEUDO_AUTHORITY)) {
+		if (value.len != f->value_len[PSEUDO_AUTHORITY] ||
+				memcmp(value.ptr, f->buf + f->off[PSEUDO_AUTHORITY], value.len)) {
+			f->malformed = 1;
+		}
+		return;
+	}
+	ctx = &f->stream->ctx;
+	feed(ctx, name.ptr, name.len);
+	feed(ctx, ": ", 2);
+	feed(ctx, value.ptr, value.len);
+	feed(ctx, CRLF, 2);
+}
+
+/* decode a whole header block for the fields set up by begin_block() */
+static void end_block(struct h2_conn *h2, const unsigned char *block, size_t len) {
+	struct h2_fields *f = &h2->fields;
+	struct h2_stream *st;
+
+	h2->block_id = 0;
+	h2->block_len = 0;
+	if (hpack_decode(&h2->hpack, block, len, take_field, h2) == -1) {
+		fail(h2, H2_COMPRESSION_ERROR);
+		return;
+	}
+	if (f->reset != -1) {
+		queue_u32(h2, H2_RST_STREAM, f->id, (uint32_t)f->reset);
+		st = find_stream(h2, f->id);
+		if (st != NULL) close_stream(h2, st);
+		return;
+	}
+	st = f->stream;
+	if (st == NULL) return;
+	if (!f->malformed && !f->regular) start_request(f);
+	if (f->malformed) {
+		reset_stream(h2, st, H2_PROTOCOL_ERROR);
+		return;
+	}
+	if (f->len > f->cookies) {
+		feed(&st->ctx, "cookie: ", 8);
+		feed(&st->ctx, f->buf + f->cookies, f->len - f->cookies);
+		feed(&st->ctx, CRLF, 2);
+	}
+	feed(&st->ctx, CRLF, 2);
+	f->stream = NULL;
+	h2->serve(h2, st);
+}
+
+/* what the fields of the block to come are for */
+static void begin_block(struct h2_conn *h2, struct h2_stream *st, uint32_t id, int reset) {
+	struct h2_fields *f = &h2->fields;
+
+	f->stream = st;
+	f->id = id;
+	f->reset = reset;
+	f->len = 0;
+	f->seen = 0;
+	f->regular = 0;
+	f->cookies = 0;
+	f->size = 0;
+	f->malformed = 0;
+}
+
+static void on_headers(struct h2_conn *h2, int flags, uint32_t id, const unsigned char *p, size_t len) {
+	struct h2_stream *st;
+
+	if (id == 0 || !(id & 1) || unpad(flags, &p, &len) == -1) {
+		fail(h2, H2_PROTOCOL_ERROR);
+		return;
+	}
+	if (flags & H2_PRIORITY_FLAG) {
+		/* priorities are not followed */
+		if (len < 5) {
+			fail(h2, H2_FRAME_SIZE_ERROR);
+			return;
+		}
+		p += 5;
+		len -= 5;
+	}
+
+	/* every block is decoded, the table must stay in step */
+	st = find_stream(h2, id);
+	if (st != NULL) {
+		/* trailers, which must end the stream */
+		if (st->remote_closed) begin_block(h2, NULL, id, H2_STREAM_CLOSED);
+		else if (!(flags & H2_END_STREAM)) begin_block(h2, NULL, id, H2_PROTOCOL_ERROR);
+		else begin_block(h2, NULL, id, -1);
+		st->remote_closed = 1;
+		if (st->local_closed) close_stream(h2, st);
+	} else if (id <= h2->last_id || h2->going_away) {
+		/* closed, or past our GOAWAY */
+		begin_block(h2, NULL, id, -1);
+	} else if (h2->num_streams >= H2_MAX_STREAMS) {
+		h2->last_id = id;
+		begin_block(h2, NULL, id, H2_REFUSED_STREAM);
+	} else {
+		st = open_stream(h2, id);
+		st->remote_closed = flags & H2_END_STREAM;
+		begin_block(h2, st, id, -1);
+	}
+
+	if (flags & H2_END_HEADERS) {
+		end_block(h2, p, len);
+		return;
+	}
+	h2->block_id = id;
+	h2->block_len = 0;
+	if (h2->block_cap < len) {
+		free(h2->block);
+		h2->block = alloc(len);
+		h2->block_cap = len;
+	}
+	memcpy(h2->block, p, len);
+	h2->block_len = len;
+}
+
+static void on_continuation(struct h2_conn *h2, int flags, const unsigned char *p, size_t len) {
+	size_t need = h2->block_len + len;
+
+	if (need > H2_MAX_FIELDS) {
+		fail(h2, H2_ENHANCE_YOUR_CALM);
+		return;
+	}
+	if (h2->block_cap < need) {
+		h2->block_cap = need > 2 * h2->block_cap ? need : 2 * h2->block_cap;
+		h2->block = realloc(h2->block, h2->block_cap);
+		if (h2->block == NULL) {
+			perror("h2");
+			exit(1);
+		}
+	}
+	memcpy(h2->block + h2->block_len, p, len);
+	h2->block_len += len;
+	if (flags & H2_END_HEADERS) end_block(h2, h2->block, h2->block_len);
+}
+
+/* a whole frame, its payload following the header */
+static void on_frame(struct h2_conn *h2, const unsigned char *frame) {
+	size_t len = frame_length(frame);
+	enum h2_frame_type type = (enum h2_frame_type)frame[3];
+	int flags = frame[4];
+	uint32_t id = get32(frame + 5) & 0x7fffffff;
+	const unsigned char *p = frame + H2_FRAME_HEADER;
+	struct h2_stream *st;
+
+	/* SETTINGS first, a header block without interruption */
+	if ((!h2->settled && type != H2_SETTINGS) ||
+			(h2->block_id != 0 && (type != H2_CONTINUATION || id != h2->block_id)) ||
+			(h2->block_id == 0 && type == H2_CONTINUATION)) {
+		fail(h2, H2_PROTOCOL_ERROR);
+		return;
+	}
+
+	switch (type) {
+	case H2_DATA:
+		on_data(h2, flags, id, p, len);
+		break;
+	case H2_HEADERS:
+		on_headers(h2, flags, id, p, len);
+		break;
+	case H2_PRIORITY:
+		if (id == 0) {
+			fail(h2, H2_PROTOCOL_ERROR);
+		} else if (len != 5) {
+			st = find_stream(h2, id);
+			if (st != NULL) reset_stream(h2, st, H2_FRAME_SIZE_ERROR);
+			else queue_u32(h2, H2_RST_STREAM, id, H2_FRAME_SIZE_ERROR);
+		}
+		break;
+	case H2_RST_STREAM:
+		if (id == 0 || idle(h2, id)) {
+			fail(h2, H2_PROTOCOL_ERROR);
+		} else if (len != 4) {
+			fail(h2, H2_FRAME_SIZE_ERROR);
+		} else if ((st = find_stream(h2, id)) != NULL) {
+			close_stream(h2, st);
+		}
+		break;
+	case H2_SETTINGS:
+		on_settings(h2, flags, id, p, len);
+		break;
+	case H2_PUSH_PROMISE:
+		fail(h2, H2_PROTOCOL_ERROR);
+		break;
+	case H2_PING:
+		if (id != 0) fail(h2, H2_PROTOCOL_ERROR);
+		else if (len != 8) fail(h2, H2_FRAME_SIZE_ERROR);
+		else if (!(flags & H2_ACK)) queue_frame(h2, H2_PING, H2_ACK, 0, p, len);
+		break;
+	case H2_GOAWAY:
+		if (id != 0) fail(h2, H2_PROTOCOL_ERROR);
+		else if (len < 8) fail(h2, H2_FRAME_SIZE_ERROR);
+		else h2->going_away = 1;
+		break;
+	case H2_WINDOW_UPDATE:
+		on_window_update(h2, id, p, len);
+		break;
+	case H2_CONTINUATION:
+		on_continuation(h2, flags, p, len);
+		break;
+	default:
+		/* unknown types are ignored, section 4.1 */
+		break;
+	}
+}
+
+void h2_conn_feed(struct h2_conn *h2, const char *buf, size_t len) {
+	const unsigned char *p = (const unsigned char *)buf;
+	size_t n, need;
+
+	if (h2->preface > 0) {
+		n = len < h2->preface ? len : h2->preface;
+		if (memcmp(p, H2_PREFACE + H2_PREFACE_LEN - h2->preface, n)) {
+			fail(h2, H2_PROTOCOL_ERROR);
+			return;
+		}
+		h2->preface -= n;
+		p += n;
+		len -= n;
+	}
+
+	while (len > 0 && !h2->failed) {
+		/* whole frames are taken where they are */
+		if (h2->in_len == 0 && len >= H2_FRAME_HEADER) {
+			need = H2_FRAME_HEADER + frame_length(p);
+			if (need > H2_FRAME_HEADER + H2_FRAME_SIZE) {
+				fail(h2, H2_FRAME_SIZE_ERROR);
+				return;
+			}
+			if (len >= need) {
+				on_frame(h2, p);
+				p += need;
+				len -= need;
+				continue;
+			}
+		}
+		/* the rest waits for the next read */
+		if (h2->in == NULL) h2->in = alloc(H2_FRAME_HEADER + H2_FRAME_SIZE);
+		need = h2->in_len < H2_FRAME_HEADER ? H2_FRAME_HEADER : H2_FRAME_HEADER + frame_length(h2->in);
+		n = need - h2->in_len < len ? need - h2->in_len : len;
+		memcpy(h2->in + h2->in_len, p, n);
+		h2->in_len += n;
+		p += n;
+		len -= n;
+		if (h2->in_len < H2_FRAME_HEADER) continue;
+		if (frame_length(h2->in) > H2_FRAME_SIZE) {
+			fail(h2, H2_FRAME_SIZE_ERROR);
+			return;
+		}
+		if (h2->in_len == H2_FRAME_HEADER + frame_length(h2->in)) {
+			h2->in_len = 0;
+			on_frame(h2, h2->in);
+		}
+	}
+}
+
+static int connection_field(const char *name, size_t len) {
+	struct slice sl;
+	size_t i;
+
+	sl.ptr = name;
+	sl.len = len;
+	for (i = 0; i < sizeof connection_fields / sizeof connection_fields[0]; ++i) {
+		if (!slice_str_cmp_ci_check(&sl, connection_fields[i])) return 1;
+	}
+	return 0;
+}
+
+/* queue a header block, in CONTINUATION frames past the first if it is
+   larger than the client takes; `frame` has room for a frame header ahead */
+static void queue_block(struct h2_conn *h2, uint32_t id, int flags, unsigned char *frame, size_t len) {
+	unsigned char *more;
+	size_t off, n;
+
+	if (len <= h2->max_frame) {
+		frame_header(frame, len, H2_HEADERS, flags | H2_END_HEADERS, id);
+		outq_push_mem(h2->out, (char *)frame, H2_FRAME_HEADER + len, (char *)frame, NULL);
+		return;
+	}
+	frame_header(frame, h2->max_frame, H2_HEADERS, flags, id);
+	outq_push_mem(h2->out, (char *)frame, H2_FRAME_HEADER + h2->max_frame, (char *)frame, NULL);
+	for (off = h2->max_frame; off < len; off += n) {
+		n = len - off < h2->max_frame ? len - off : h2->max_frame;
+		more = alloc(H2_FRAME_HEADER + n);
+		frame_header(more, n, H2_CONTINUATION, off + n == len ? H2_END_HEADERS : 0, id);
+		memcpy(more + H2_FRAME_HEADER, frame + H2_FRAME_HEADER + off, n);
+		outq_push_mem(h2->out, (char *)more, H2_FRAME_HEADER + n, (char *)more, NULL);
+	}
+}
+
+/* the length of the head at the start of `buf`, up to its empty line */
+static size_t head_length(const char *buf, size_t len) {
+	size_t i;
+
+	for (i = 0; i + 4 <= len; ++i) {
+		if (!memcmp(buf + i, CRLF CRLF, 4)) return i + 4;
+	}
+	return len;
+}
+
+void h2_respond(struct h2_conn *h2, struct h2_stream *st, struct http_response *resp) {
+	struct body_stream source;
+	size_t head_len, body_len = 0, n, i;
+	const char *line, *end, *colon, *value;
+	unsigned char *frame;
+	unsigned status;
+	char date[HTTP_DATE_LEN + 1];
+
+	if (resp->websocket != NULL) {
+		/* no stream is taken over by another protocol, section 8.6: the
+		   client is to retry over HTTP/1.1 */
+		get_current_time(date);
+		http_response_free(resp);
+		*resp = new_response();
+		empty_response(resp, RC_421_MISDIRECTED_REQUEST, date);
+	}
+	source = resp->stream;
+	head_len = resp->num_parts > 0 ? resp->head_len : head_length(resp->buf, resp->len);
+	for (i = 0; i < resp->num_parts; ++i) body_len += resp->parts[i].len;
+	if (resp->num_parts == 0) body_len = resp->len - head_len;
+
+	/* a field never grows by more than HPACK_FIELD_OVERHEAD, on a line of
+	   four bytes at least */
+	frame = alloc(H2_FRAME_HEADER + 4 * head_len + HPACK_FIELD_OVERHEAD);
+	status = (unsigned)(resp->buf[9] - '0') * 100 + (unsigned)(resp->buf[10] - '0') * 10 +
+		(unsigned)(resp->buf[11] - '0');
+	n = H2_FRAME_HEADER + hpack_encode_status(frame + H2_FRAME_HEADER, status);
+	line = (const char *)memchr(resp->buf, SYM_LF, head_len) + 1;
+	while (line + 2 < resp->buf + head_len) {
+		end = memchr(line, SYM_CR, (size_t)(resp->buf + head_len - line));
+		colon = end != NULL ? memchr(line, ':', (size_t)(end - line)) : NULL;
+		if (colon == NULL) break;
+		for (value = colon + 1; value < end && (*value == SYM_SP || *value == SYM_HTAB); ++value);
+		if (!connection_field(line, (size_t)(colon - line))) {
+			n += hpack_encode_field(frame + n, line, (size_t)(colon - line), value,
+				(size_t)(end - value));
+		}
+		line = end + 2;
+	}
+	queue_block(h2, st->id, body_len == 0 && source.produce == NULL ? H2_END_STREAM : 0,
+		frame, n - H2_FRAME_HEADER);
+	st->responded = 1;
+
+	/* the body alone is left for DATA frames */
+	if (resp->num_parts > 0) {
+		resp->head_len = 0;
+		if (outq_push_response(&st->body, resp) == -1) {
+			perror("dup");
+			reset_stream(h2, st, H2_INTERNAL_ERROR);
+			return;
+		}
+	} else {
+		if (body_len > 0) {
+			outq_push_mem(&st->body, resp->buf + head_len, body_len, resp->buf, NULL);
+		} else {
+			free(resp->buf);
+		}
+		resp->buf = NULL;
+		http_response_free(resp);
+	}
+	if (source.produce != NULL) {
+		/* DATA frames delimit it */
+		source.chunked = 0;
+		stream_init(&st->producer, &st->body, &source);
+	} else if (body_len == 0) {
+		end_stream(h2, st);
+	}
+}
+
+/* queue a DATA frame of `st` if it has bytes and windows allow: 1 if it
+   did, `*framed` counting its bytes */
+static int frame_data(struct h2_conn *h2, struct h2_stream *st, size_t *framed) {
+	unsigned char *header;
+	size_t n, moved;
+	long room;
+	int end;
+
+	if (!st->responded || st->local_closed) return 0;
+	if (st->producer.active && st->body.bytes < STREAM_CHUNK && stream_pump(&st->producer) == -1) {
+		reset_stream(h2, st, H2_INTERNAL_ERROR);
+		return 1;
+	}
+	room = h2->window < st->window ? h2->window : st->window;
+	n = st->body.bytes < h2->max_frame ? st->body.bytes : h2->max_frame;
+	if (room < 0) room = 0;
+	if (n > (size_t)room) n = (size_t)room;
+	end = !st->producer.active && n == st->body.bytes;
+	if (n == 0 && !end) return 0;
+
+	header = alloc(H2_FRAME_HEADER);
+	outq_push_mem(h2->out, (char *)header, H2_FRAME_HEADER, (char *)header, NULL);
+	moved = outq_move(h2->out, &st->body, n);
+	frame_header(header, moved, H2_DATA, end && moved == n ? H2_END_STREAM : 0, st->id);
+	h2->window -= (long)moved;
+	st->window -= (long)moved;
+	*framed += moved;
+	if (moved < n) {
+		perror("dup");
+		reset_stream(h2, st, H2_INTERNAL_ERROR);
+	} else if (end) {
+		end_stream(h2, st);
+	}
+	return 1;
+}
+
+size_t h2_conn_pump(struct h2_conn *h2) {
+	struct h2_stream *st;
+	size_t framed = 0, visits;
+	int progress = 1;
+
+	/* no DATA before the client's SETTINGS: after an upgrade, a client
+	   reading the 101 may not take much more than the frames with it */
+	if (!h2->settled) return 0;
+	/* a frame per stream in turn */
+	while (progress && !h2->failed && h2->out->bytes < H2_AHEAD) {
+		progress = 0;
+		for (visits = h2->num_streams; visits > 0 && h2->out->bytes < H2_AHEAD; --visits) {
+			st = h2->turn != NULL ? h2->turn : h2->streams;
+			h2->turn = st->next;
+			progress |= frame_data(h2, st, &framed);
+		}
+	}
+	return framed;
+}
+
+/* token68 of the base64url alphabet, RFC 4648 section 5, into at most
+   `max` bytes; -1 if malformed or longer */
+static long decode_base64url(const struct slice *in, unsigned char *out, size_t max) {
+	unsigned long acc = 0;
+	size_t i, n = 0, len = in->len;
+	unsigned bits = 0;
+	int v;
+	char c;
+
+	while (len > 0 && in->ptr[len - 1] == '=') len--;
+	for (i = 0; i < len; ++i) {
+		c = in->ptr[i];
+		if (c >= 'A' && c <= 'Z') v = c - 'A';
+		else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+		else if (c >= '0' && c <= '9') v = c - '0' + 52;
+		else if (c == '-') v = 62;
+		else if (c == '_') v = 63;
+		else return -1;
+		acc = (acc << 6 | (unsigned long)v) & 0xfff;
+		bits += 6;
+		if (bits >= 8) {
+			bits -= 8;
+			if (n == max) return -1;
+			out[n++] = (unsigned char)(acc >> bits);
+		}
+	}
+	return bits >= 6 ? -1 : (long)n;
+}
+
+long h2_upgrade_settings(struct http_request *req, unsigned char *settings) {
+	struct header_item_iter it;
+	struct http_header *value = NULL;
+	int h2c = 0, listed = 0, ret;
+	long len;
+	size_t i;
+
+	if (!req->upgrade || !is_http_ver(req, 1, 1) || req->method == HM_CONNECT ||
+			req->te_chunked || req->content_length != 0) {
+		return -1;
+	}
+	it = header_items_init(req, HH_UPGRADE);
+	for (ret = header_items_next(req, &it); it.header_item.ptr != NULL && !ret;
+			ret = header_items_next(req, &it)) {
+		if (!slice_str_cmp_check(&it.header_item, "h2c")) h2c = 1;
+	}
+	/* named a connection option, RFC 7540 section 3.2.1 */
+	it = header_items_init(req, HH_CONNECTION);
+	for (ret = header_items_next(req, &it); it.header_item.ptr != NULL && !ret;
+			ret = header_items_next(req, &it)) {
+		if (!slice_str_cmp_ci_check(&it.header_item, "http2-settings")) listed = 1;
+	}
+	for (i = 0; i < req->num_headers; ++i) {
+		if (slice_str_cmp_check(&req->headers[i].name, "http2-settings")) continue;
+		if (value != NULL) return -1;
+		value = req->headers + i;
+	}
+	if (!h2c || !listed || value == NULL) return -1;
+	len = decode_base64url(&value->value, settings, H2_SETTINGS_MAX);
+	return len % 6 == 0 ? len : -1;
+}
+
+void h2_conn_upgrade(
+		struct h2_conn *h2,
+		struct http_request *req,
+		struct parse_ctx *ctx,
+		const unsigned char *settings,
+		size_t len
+) {
+	struct h2_stream *st = open_stream(h2, 1);
+
+	/* half closed already, section 3.2 of RFC 7540 */
+	parse_ctx_free(&st->ctx);
+	http_request_free(&st->req);
+	st->req = *req;
+	st->ctx = *ctx;
+	st->ctx.req = &st->req;
+	st->remote_closed = 1;
+	*req = new_request();
+	*ctx = parse_ctx_init(req);
+
+	if (apply_settings(h2, settings, len) == 0) h2->serve(h2, st);
+}
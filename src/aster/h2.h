@@ -0,0 +1,186 @@
+#ifndef H2_H
+#define H2_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hpack.h"
+#include "outq.h"
+#include "parser.h"
+#include "request.h"
+#include "response.h"
+#include "stream.h"
+
+/* HTTP/2 over cleartext TCP, RFC 9113 */
+#define H2_PREFACE "PRI * HTTP/2.0" "\r\n\r\n" "SM" "\r\n\r\n"
+#define H2_PREFACE_LEN 24
+#define H2_FRAME_HEADER 9
+#define H2_FRAME_SIZE 16384 /* the largest frame either side sends unless told more */
+#define H2_WINDOW 65535 /* flow control windows to start with */
+#define H2_MAX_WINDOW 0x7ffffffful
+#define H2_MAX_STREAMS 100 /* SETTINGS_MAX_CONCURRENT_STREAMS */
+#define H2_MAX_FIELDS (64ul << 10) /* SETTINGS_MAX_HEADER_LIST_SIZE, header blocks as well */
+
+/* DATA queued for the socket before the streams are framed further */
+#define H2_AHEAD (64ul << 10)
+
+/* an HTTP2-Settings value decodes to this much at most */
+#define H2_SETTINGS_MAX 60
+
+enum h2_frame_type {
+	H2_DATA = 0,
+	H2_HEADERS,
+	H2_PRIORITY,
+	H2_RST_STREAM,
+	H2_SETTINGS,
+	H2_PUSH_PROMISE,
+	H2_PING,
+	H2_GOAWAY,
+	H2_WINDOW_UPDATE,
+	H2_CONTINUATION
+};
+
+#define H2_END_STREAM 0x1
+#define H2_ACK 0x1
+#define H2_END_HEADERS 0x4
+#define H2_PADDED 0x8
+#define H2_PRIORITY_FLAG 0x20
+
+enum h2_error {
+	H2_NO_ERROR = 0,
+	H2_PROTOCOL_ERROR,
+	H2_INTERNAL_ERROR,
+	H2_FLOW_CONTROL_ERROR,
+	H2_SETTINGS_TIMEOUT,
+	H2_STREAM_CLOSED,
+	H2_FRAME_SIZE_ERROR,
+	H2_REFUSED_STREAM,
+	H2_CANCEL,
+	H2_COMPRESSION_ERROR,
+	H2_CONNECT_ERROR,
+	H2_ENHANCE_YOUR_CALM
+};
+
+enum h2_setting {
+	H2_HEADER_TABLE_SIZE = 1,
+	H2_ENABLE_PUSH,
+	H2_MAX_CONCURRENT_STREAMS,
+	H2_INITIAL_WINDOW_SIZE,
+	H2_MAX_FRAME_SIZE,
+	H2_MAX_HEADER_LIST_SIZE
+};
+
+/* a request and its response: the request is rewritten in HTTP/1.1 syntax
+   for the parser, which validates it as it would any other */
+struct h2_stream {
+	uint32_t id;
+	struct http_request req;
+	struct parse_ctx ctx;
+	int remote_closed; /* the client ended its side */
+	int local_closed; /* the response is framed whole */
+	int responded; /* the HEADERS of the response are queued */
+	long window; /* what it may send, negative if the client shrank it */
+	size_t unacked; /* DATA taken since its last WINDOW_UPDATE */
+
+	struct outq body; /* not framed yet */
+	struct stream producer; /* a streamed body, written into `body` */
+
+	struct h2_stream *prev, *next;
+};
+
+/* the fields of the header block being decoded, for `stream` (NULL if
+   they are dropped) */
+struct h2_fields {
+	struct h2_stream *stream;
+	uint32_t id;
+	int reset; /* RST_STREAM code for `id` once decoded, -1 if none */
+	char *buf; /* the pseudo-header values, then the cookies */
+	size_t len, cap;
+	size_t off[4], value_len[4]; /* of :method, :scheme, :authority, :path */
+	int seen; /* pseudo-header fields met, a bit each */
+	int regular; /* the request line is written */
+	size_t cookies; /* where the cookies start in buf */
+	size_t size; /* of the list, as SETTINGS_MAX_HEADER_LIST_SIZE counts */
+	int malformed;
+};
+
+/* one client connection: frames are parsed from what it sends and queued
+   in `out`, the responses of every stream interleaved as flow control
+   allows */
+struct h2_conn {
+	struct outq *out;
+	struct hpack_decoder hpack;
+
+	unsigned char *in; /* a frame not whole yet */
+	size_t in_len;
+	size_t preface; /* bytes of the client preface still to come */
+	int settled; /* got the client's SETTINGS */
+
+	size_t max_frame; /* the client takes */
+	long initial_window; /* of its streams */
+	long window; /* what the connection may send */
+	size_t unacked; /* DATA taken since the last WINDOW_UPDATE */
+
+	uint32_t last_id; /* the latest stream the client opened */
+	uint32_t block_id; /* the stream whose header block goes on, 0 if none */
+	unsigned char *block; /* fragments of the header block */
+	size_t block_len, block_cap;
+	struct h2_fields fields;
+
+	struct h2_stream *streams;
+	size_t num_streams;
+	struct h2_stream *turn; /* whose DATA is framed next */
+
+	int going_away; /* GOAWAY sent or received: no new streams */
+	int failed; /* GOAWAY sent for an error, nothing more is read */
+
+	/* a stream's request is complete, to be answered with h2_respond() */
+	void (*serve)(struct h2_conn *h2, struct h2_stream *st);
+	void *owner;
+};
+
+/* queue our SETTINGS, the client preface being expected unless
+   `preface_read` */
+void h2_conn_init(
+		struct h2_conn *h2,
+		struct outq *out,
+		int preface_read,
+		void (*serve)(struct h2_conn *h2, struct h2_stream *st),
+		void *owner
+);
+void h2_conn_free(struct h2_conn *h2);
+
+/* the HTTP2-Settings of a request asking to upgrade to h2c (RFC 7540
+   section 3.2) decoded into `settings`, H2_SETTINGS_MAX bytes: its length,
+   -1 if the request does not ask or cannot be upgraded, having a body */
+long h2_upgrade_settings(struct http_request *req, unsigned char *settings);
+
+/* go on with an upgraded request as stream 1, taking `req` and `ctx` over
+   (both left empty), once 101 is queued and h2_conn_init() done */
+void h2_conn_upgrade(
+		struct h2_conn *h2,
+		struct http_request *req,
+		struct parse_ctx *ctx,
+		const unsigned char *settings,
+		size_t len
+);
+
+/* handle what the client sent, queuing replies and serving requests */
+void h2_conn_feed(struct h2_conn *h2, const char *buf, size_t len);
+
+/* frame response bodies while `out` has less than H2_AHEAD queued and
+   windows are open: the bytes framed */
+size_t h2_conn_pump(struct h2_conn *h2);
+
+/* queue GOAWAY: the streams open go on, no new one is served */
+void h2_conn_shutdown(struct h2_conn *h2);
+
+/* 1 once the connection may close after what is queued */
+int h2_conn_done(const struct h2_conn *h2);
+
+/* queue the response of a stream and free it, its head rewritten as a
+   HEADERS frame without the fields of the connection, its body framed
+   by h2_conn_pump(); one handing the connection to a WebSocket becomes
+   421 Misdirected Request */
+void h2_respond(struct h2_conn *h2, struct h2_stream *st, struct http_response *resp);
+
+#endif
@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hpack.h"
+#include "str.h"
+
+#define TABLE_CAP (HPACK_TABLE_SIZE / HPACK_ENTRY_OVERHEAD)
+#define HUFFMAN_MAX_BITS 30
+#define HUFFMAN_EOS 256
+
+#define ENTRY(name, value) {name, sizeof name - 1, value, sizeof value - 1}
+
+/* appendix A */
+static const struct {
+	const char *name;
+	size_t name_len;
+	const char *value;
+	size_t value_len;
+} static_table[HPACK_STATIC_ENTRIES] = {
+	ENTRY(":authority", ""),
+	ENTRY(":method", "GET"),
+	ENTRY(":method", "POST"),
+	ENTRY(":path", "/"),
+	ENTRY(":path", "/index.html"),
+	ENTRY(":scheme", "http"),
+	ENTRY(":scheme", "https"),
+	ENTRY(":status", "200"),
+	ENTRY(":status", "204"),
+	ENTRY(":status", "206"),
+	ENTRY(":status", "304"),
+	ENTRY(":status", "400"),
+	ENTRY(":status", "404"),
+	ENTRY(":status", "500"),
+	ENTRY("accept-charset", ""),
+	ENTRY("accept-encoding", "gzip, deflate"),
+	ENTRY("accept-language", ""),
+	ENTRY("accept-ranges", ""),
+	ENTRY("accept", ""),
+	ENTRY("access-control-allow-origin", ""),
+	ENTRY("age", ""),
+	ENTRY("allow", ""),
+	ENTRY("authorization", ""),
+	ENTRY("cache-control", ""),
+	ENTRY("content-disposition", ""),
+	ENTRY("content-encoding", ""),
+	ENTRY("content-language", ""),
+	ENTRY("content-length", ""),
+	ENTRY("content-location", ""),
+	ENTRY("content-range", ""),
+	ENTRY("content-type", ""),
+	ENTRY("cookie", ""),
+	ENTRY("date", ""),
+	ENTRY("etag", ""),
+	ENTRY("expect", ""),
+	ENTRY("expires", ""),
+	ENTRY("from", ""),
+	ENTRY("host", ""),
+	ENTRY("if-match", ""),
+	ENTRY("if-modified-since", ""),
+	ENTRY("if-none-match", ""),
+	ENTRY("if-range", ""),
+	ENTRY("if-unmodified-since", ""),
+	ENTRY("last-modified", ""),
+	ENTRY("link", ""),
+	ENTRY("location", ""),
+	ENTRY("max-forwards", ""),
+	ENTRY("proxy-authenticate", ""),
+	ENTRY("proxy-authorization", ""),
+	ENTRY("range", ""),
+	ENTRY("referer", ""),
+	ENTRY("refresh", ""),
+	ENTRY("retry-after", ""),
+	ENTRY("server", ""),
+	ENTRY("set-cookie", ""),
+	ENTRY("strict-transport-security", ""),
+	ENTRY("transfer-encoding", ""),
+	ENTRY("user-agent", ""),
+	ENTRY("vary", ""),
+	ENTRY("via", ""),
+	ENTRY("www-authenticate", "")
+};
+
+/* the first static entries of :status with a value, and those values */
+#define STATUS_INDEX 8
+static const unsigned short static_status[] = {200, 204, 206, 304, 400, 404, 500};
+
+/* appendix B is a canonical code: codes of a length follow each other in
+   the order of their symbols, so the number of codes of each length and
+   the symbols ordered by code are all it takes to decode */
+static const unsigned char huffman_count[HUFFMAN_MAX_BITS + 1] = {
+	0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+	0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+
+static const unsigned short huffman_symbol[HUFFMAN_EOS + 1] = {
+	48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51, 52, 53,
+	54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114,
+	117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79, 80, 81, 82,
+	83, 84, 85, 86, 87, 89, 106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44,
+	59, 88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62, 0, 36, 64, 91, 93, 126,
+	94, 125, 60, 96, 123, 92, 195, 208, 128, 130, 131, 162, 184, 194, 224, 226,
+	153, 161, 167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129, 132,
+	133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170, 173, 178, 181, 185,
+	186, 187, 189, 190, 196, 198, 228, 232, 233, 1, 135, 137, 138, 139, 140, 141,
+	143, 147, 149, 150, 151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180,
+	182, 183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159, 171, 206, 215,
+	225, 236, 237, 199, 207, 234, 235, 192, 193, 200, 201, 202, 205, 210, 213,
+	218, 219, 238, 240, 242, 243, 255, 203, 204, 211, 212, 214, 221, 222, 223,
+	241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5, 6, 7, 8,
+	11, 12, 14, 15, 16, 17, 18, 19, 20, 21, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+	127, 220, 249, 10, 13, 22, 256
+};
+
+void hpack_decoder_init(struct hpack_decoder *dec) {
+	memset(dec, 0, sizeof *dec);
+	dec->table.max_size = HPACK_TABLE_SIZE;
+}
+
+void hpack_decoder_free(struct hpack_decoder *dec) {
+	struct hpack_table *t = &dec->table;
+
+	while (t->count > 0) {
+		free(t->entries[(t->head + --t->count) % TABLE_CAP].name);
+	}
+	free(dec->scratch);
+	dec->scratch = NULL;
+	dec->cap_scratch = 0;
+}
+
+long hpack_huffman_decode(const unsigned char *in, size_t len, char *out) {
+	/* the code read so far, and the first code and symbol of its length */
+	unsigned long code = 0, first = 0, count;
+	size_t i, index = 0, n = 0;
+	unsigned bits = 0, sym;
+	int k;
+
+	for (i = 0; i < len; ++i) {
+		for (k = 7; k >= 0; --k) {
+			code |= (unsigned long)(in[i] >> k) & 1;
+			count = huffman_count[++bits];
+			if (code < first + count) {
+				sym = huffman_symbol[index + (code - first)];
+				if (sym == HUFFMAN_EOS) return -1;
+				out[n++] = (char)sym;
+				code = first = 0;
+				index = 0;
+				bits = 0;
+				continue;
+			}
+			index += count;
+			first = (first + count) << 1;
+			code <<= 1;
+		}
+	}
+	/* padded with the most significant bits of EOS, all ones */
+	if (bits > 7 || code >> 1 != (1ul << bits) - 1) return -1;
+	return (long)n;
+}
+
+/* an integer with an `n`-bit prefix, section 5.1; -1 if truncated or
+   larger than any length we could take */
+static int get_int(const unsigned char **p, const unsigned char *end, unsigned n, size_t *value) {
+	size_t max = ((size_t)1 << n) - 1;
+	unsigned shift = 0;
+	unsigned char b;
+
+	if (*p == end) return -1;
+	*value = *(*p)++ & max;
+	if (*value < max) return 0;
+	do {
+		if (*p == end || shift > 21) return -1;
+		b = *(*p)++;
+		*value += (size_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while (b & 0x80);
+	return 0;
+}
+
+/* a string literal, section 5.2; Huffman decoded ones go to the scratch
+   past its first `*used` bytes */
+static int get_string(
+		struct hpack_decoder *dec,
+		const unsigned char **p,
+		const unsigned char *end,
+		size_t *used,
+		struct slice *out
+) {
+	int huffman;
+	size_t len;
+	long n;
+
+	if (*p == end) return -1;
+	huffman = **p & 0x80;
+	if (get_int(p, end, 7, &len) == -1 || len > (size_t)(end - *p)) return -1;
+	if (huffman) {
+		n = hpack_huffman_decode(*p, len, dec->scratch + *used);
+		if (n == -1) return -1;
+		out->ptr = dec->scratch + *used;
+		out->len = (size_t)n;
+		*used += (size_t)n;
+	} else {
+		out->ptr = (const char *)*p;
+		out->len = len;
+	}
+	*p += len;
+	return 0;
+}
+
+/* the field at `index` of both tables, section 2.3.3 */
+static int lookup(const struct hpack_table *t, size_t index, struct slice *name, struct slice *value) {
+	const struct hpack_entry *e;
+
+	if (index == 0) return -1;
+	if (index <= HPACK_STATIC_ENTRIES) {
+		name->ptr = static_table[index - 1].name;
+		name->len = static_table[index - 1].name_len;
+		value->ptr = static_table[index - 1].value;
+		value->len = static_table[index - 1].value_len;
+		return 0;
+	}
+	index -= HPACK_STATIC_ENTRIES + 1;
+	if (index >= t->count) return -1;
+	e = t->entries + (t->head + index) % TABLE_CAP;
+	name->ptr = e->name;
+	name->len = e->name_len;
+	value->ptr = e->name + e->name_len;
+	value->len = e->value_len;
+	return 0;
+}
+
+/* drop the oldest entries until `room` more bytes fit, section 4.4 */
+static void evict(struct hpack_table *t, size_t room) {
+	struct hpack_entry *e;
+
+	while (t->count > 0 && t->size + room > t->max_size) {
+		e = t->entries + (t->head + --t->count) % TABLE_CAP;
+		t->size -= e->name_len + e->value_len + HPACK_ENTRY_OVERHEAD;
+		free(e->name);
+	}
+}
+
+static void insert(struct hpack_table *t, struct slice name, struct slice value) {
+	size_t size = name.len + value.len + HPACK_ENTRY_OVERHEAD;
+	struct hpack_entry *e;
+	char *copy;
+
+	/* copied first, the name may be an entry about to go */
+	copy = malloc(name.len + value.len + 1);
+	if (copy == NULL) {
+		perror("hpack");
+		exit(1);
+	}
+	memcpy(copy, name.ptr, name.len);
+	memcpy(copy + name.len, value.ptr, value.len);
+	evict(t, size);
+	if (size > t->max_size) {
+		free(copy);
+		return;
+	}
+	/* every entry takes HPACK_ENTRY_OVERHEAD at least, they fit the ring */
+	t->head = (t->head + TABLE_CAP - 1) % TABLE_CAP;
+	e = t->entries + t->head;
+	e->name = copy;
+	e->name_len = name.len;
+	e->value_len = value.len;
+	t->count++;
+	t->size += size;
+}
+
+int hpack_decode(
+		struct hpack_decoder *dec,
+		const unsigned char *block,
+		size_t len,
+		void (*field)(void *ctx, struct slice name, struct slice value),
+		void *ctx
+) {
+	const unsigned char *p = block, *end = block + len;
+	struct slice name, value;
+	size_t index, used, need = len * 8 / 5 + 1;
+	int fields = 0;
+	unsigned char b;
+
+	/* whatever its strings, they decode to this much at most */
+	if (dec->cap_scratch < need) {
+		free(dec->scratch);
+		dec->scratch = malloc(need);
+		if (dec->scratch == NULL) {
+			perror("hpack");
+			exit(1);
+		}
+		dec->cap_scratch = need;
+	}
+
+	while (p < end) {
+		b = *p;
+		used = 0;
+		if (b & 0x80) {
+			/* indexed, section 6.1 */
+			if (get_int(&p, end, 7, &index) == -1 ||
+					lookup(&dec->table, index, &name, &value) == -1) {
+				return -1;
+			}
+		} else if ((b & 0xe0) == 0x20) {
+			/* a table size update, only ahead of the fields, section 6.3 */
+			if (fields || get_int(&p, end, 5, &index) == -1 || index > HPACK_TABLE_SIZE) {
+				return -1;
+			}
+			dec->table.max_size = index;
+			evict(&dec->table, 0);
+			continue;
+		} else {
+			/* a literal, added to the table or not, section 6.2 */
+			if (get_int(&p, end, b & 0x40 ? 6 : 4, &index) == -1) return -1;
+			if (index == 0) {
+				if (get_string(dec, &p, end, &used, &name) == -1) return -1;
+			} else if (lookup(&dec->table, index, &name, &value) == -1) {
+				return -1;
+			}
+			if (get_string(dec, &p, end, &used, &value) == -1) return -1;
+		}
+		/* before the name may be evicted by its own insertion */
+		field(ctx, name, value);
+		fields = 1;
+		if ((b & 0xc0) == 0x40) insert(&dec->table, name, value);
+	}
+	return 0;
+}
+
+size_t hpack_encode_int(unsigned char *out, unsigned flags, unsigned n, size_t value) {
+	size_t max = ((size_t)1 << n) - 1, i = 0;
+
+	if (value < max) {
+		out[0] = (unsigned char)(flags | value);
+		return 1;
+	}
+	out[i++] = (unsigned char)(flags | max);
+	value -= max;
+	while (value >= 0x80) {
+		out[i++] = (unsigned char)(0x80 | (value & 0x7f));
+		value >>= 7;
+	}
+	out[i++] = (unsigned char)value;
+	return i;
+}
+
+size_t hpack_encode_status(unsigned char *out, unsigned status) {
+	size_t i;
+
+	for (i = 0; i < sizeof static_status / sizeof static_status[0]; ++i) {
+		if (static_status[i] == status) {
+			return hpack_encode_int(out, 0x80, 7, STATUS_INDEX + i);
+		}
+	}
+	/* without indexing, named by the first :status */
+	out[0] = STATUS_INDEX;
+	out[1] = 3;
+	out[2] = (unsigned char)('0' + status / 100 % 10);
+	out[3] = (unsigned char)('0' + status / 10 % 10);
+	out[4] = (unsigned char)('0' + status % 10);
+	return 5;
+}
+
+/* the index of the static entry named `name` in any case, 0 if none */
+static size_t static_name(const char *name, size_t len) {
+	size_t i, j;
+
+	/* past the pseudo-header fields */
+	for (i = 14; i < HPACK_STATIC_ENTRIES; ++i) {
+		if (static_table[i].name_len != len) continue;
+		for (j = 0; j < len && static_table[i].name[j] == lower(name[j]); ++j);
+		if (j == len) return i + 1;
+	}
+	return 0;
+}
+
+size_t hpack_encode_field(
+		unsigned char *out,
+		const char *name,
+		size_t name_len,
+		const char *value,
+		size_t value_len
+) {
+	size_t index = static_name(name, name_len), n, i;
+
+	/* without indexing, section 6.2.2 */
+	n = hpack_encode_int(out, 0, 4, index);
+	if (index == 0) {
+		n += hpack_encode_int(out + n, 0, 7, name_len);
+		for (i = 0; i < name_len; ++i) out[n++] = (unsigned char)lower(name[i]);
+	}
+	n += hpack_encode_int(out + n, 0, 7, value_len);
+	memcpy(out + n, value, value_len);
+	return n + value_len;
+}
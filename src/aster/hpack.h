@@ -0,0 +1,73 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+#include "request.h"
+
+/* field compression for HTTP/2, RFC 7541 */
+#define HPACK_STATIC_ENTRIES 61
+#define HPACK_ENTRY_OVERHEAD 32 /* counted per entry in table sizes */
+#define HPACK_TABLE_SIZE 4096 /* the dynamic table we keep, SETTINGS_HEADER_TABLE_SIZE */
+
+/* room an encoded field takes besides its name and value */
+#define HPACK_FIELD_OVERHEAD 13
+
+struct hpack_entry {
+	char *name; /* the value follows it in the same allocation */
+	size_t name_len, value_len;
+};
+
+/* the decoder's dynamic table, a ring of its entries, newest first */
+struct hpack_table {
+	struct hpack_entry entries[HPACK_TABLE_SIZE / HPACK_ENTRY_OVERHEAD];
+	size_t head, count;
+	size_t size; /* of the entries, section 4.1 */
+	size_t max_size; /* as last updated by the encoder, up to HPACK_TABLE_SIZE */
+};
+
+struct hpack_decoder {
+	struct hpack_table table;
+	char *scratch; /* Huffman decoded strings of the block */
+	size_t cap_scratch;
+};
+
+void hpack_decoder_init(struct hpack_decoder *dec);
+void hpack_decoder_free(struct hpack_decoder *dec);
+
+/* decode a whole header block, handing each field to `field` in order, the
+   slices valid during the call only: fields of the static table come
+   without copying, literals without Huffman coding straight from `block`.
+   -1 if the block cannot be decoded, the table then being out of step with
+   the encoder's */
+int hpack_decode(
+		struct hpack_decoder *dec,
+		const unsigned char *block,
+		size_t len,
+		void (*field)(void *ctx, struct slice name, struct slice value),
+		void *ctx
+);
+
+/* decode `len` Huffman coded bytes into `out`, room for len * 8 / 5 bytes:
+   the length, -1 if the code or its padding is malformed */
+long hpack_huffman_decode(const unsigned char *in, size_t len, char *out);
+
+/* encode `value` with an `n`-bit prefix after the `flags` above it: the
+   bytes written, at most 6 */
+size_t hpack_encode_int(unsigned char *out, unsigned flags, unsigned n, size_t value);
+
+/* encode :status, a single byte for the codes of the static table */
+size_t hpack_encode_status(unsigned char *out, unsigned status);
+
+/* encode a field as a literal left out of the table, its name (lowered as
+   it is copied) by index if the static table has it: the bytes written, at
+   most name_len + value_len + HPACK_FIELD_OVERHEAD. Our encoder keeps no
+   dynamic table, the peer's stays empty */
+size_t hpack_encode_field(
+		unsigned char *out,
+		const char *name,
+		size_t name_len,
+		const char *value,
+		size_t value_len
+);
+
+#endif
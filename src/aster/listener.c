@@ -0,0 +1,115 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netdb.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "listener.h"
+
+/* "unix:/path", or "unix:@name" without the NUL ending a path */
+static int local_addr(struct listener *l, const char *path) {
+	struct sockaddr_un un;
+	size_t len = strlen(path);
+
+	if (len == 0 || len >= sizeof un.sun_path) return -1;
+	memset(&un, 0, sizeof un);
+	un.sun_family = AF_UNIX;
+	if (path[0] == '@') {
+		if (len == 1) return -1;
+		memcpy(un.sun_path + 1, path + 1, len - 1);
+		l->addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len);
+	} else {
+		memcpy(un.sun_path, path, len + 1);
+		l->addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len + 1);
+	}
+	memcpy(&l->addr, &un, sizeof un);
+	return 0;
+}
+
+static int resolve(struct listener *l, const char *name) {
+	struct addrinfo hints, *info;
+	const char *sep = strrchr(name, ':'), *port = name;
+	char host[256];
+	size_t host_len = 0;
+	int ret;
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (sep != NULL) {
+		host_len = (size_t)(sep - name);
+		port = sep + 1;
+		if (host_len >= 2 && name[0] == '[' && name[host_len - 1] == ']') {
+			name++;
+			host_len -= 2;
+		}
+		if (host_len == 0 || host_len >= sizeof host) return -1;
+		memcpy(host, name, host_len);
+	} else {
+		hints.ai_family = AF_INET;
+	}
+	host[host_len] = '\0';
+	if (*port == '\0') return -1;
+
+	ret = getaddrinfo(host_len > 0 ? host : NULL, port, &hints, &info);
+	if (ret != 0) return -1;
+	memcpy(&l->addr, info->ai_addr, info->ai_addrlen);
+	l->addr_len = info->ai_addrlen;
+	freeaddrinfo(info);
+	return 0;
+}
+
+int listener_init(struct listener *l, const char *name) {
+	memset(l, 0, sizeof *l);
+	l->src.fd = -1;
+	l->name = name;
+	return !strncmp(name, LISTENER_UNIX, sizeof LISTENER_UNIX - 1) ?
+		local_addr(l, name + sizeof LISTENER_UNIX - 1) : resolve(l, name);
+}
+
+/* what a socket needs before it is bound; -1 with errno set */
+static int prepare(const struct listener *l, int fd) {
+	struct sockaddr_un un;
+	struct stat st;
+	int yes = 1;
+
+	if (l->addr.ss_family == AF_UNIX) {
+		memcpy(&un, &l->addr, sizeof un);
+		/* only ever a socket, a file someone keeps there stays */
+		if (un.sun_path[0] != '\0' && lstat(un.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+			unlink(un.sun_path);
+		}
+		return 0;
+	}
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes) == -1) return -1;
+	if (l->addr.ss_family != AF_INET6) return 0;
+	return setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &yes, sizeof yes);
+}
+
+int listener_open(struct listener *l) {
+	int fd, err;
+
+	fd = socket(l->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) return -1;
+	if (prepare(l, fd) == -1 ||
+			bind(fd, (const void *)&l->addr, l->addr_len) == -1 ||
+			listen(fd, SOMAXCONN) == -1) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	l->src.fd = fd;
+	return 0;
+}
+
+void listener_close(struct listener *l) {
+	if (l->src.fd == -1) return;
+	close(l->src.fd);
+	l->src.fd = -1;
+}
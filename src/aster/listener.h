@@ -0,0 +1,33 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <sys/socket.h>
+#include "evloop.h"
+
+/* the prefix of a listener on a local stream socket, "unix:@name" naming
+   one in the abstract namespace */
+#define LISTENER_UNIX "unix:"
+
+/* where clients are awaited unless told otherwise */
+#define LISTENER_DEFAULT "0.0.0.0:http"
+
+/* an address clients connect to, every worker waiting on all of them */
+struct listener {
+	struct ev_source src; /* fd -1 until opened */
+	const char *name; /* as given, not copied */
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+};
+
+/* "unix:/path", "unix:@name", "host:port", "[v6-address]:port" or a port
+   alone for every IPv4 address; -1 if malformed or not resolved */
+int listener_init(struct listener *l, const char *name);
+
+/* bind and listen, non-blocking; a socket file left at the path by a
+   previous run is replaced, and an IPv6 address takes no IPv4 clients so
+   that the same port may be listened on for both. -1 with errno set */
+int listener_open(struct listener *l);
+
+void listener_close(struct listener *l);
+
+#endif
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lru.h"
+
+void lru_init(struct lru_table *t, size_t cap) {
+	memset(t, 0, sizeof *t);
+	for (t->num_buckets = 16; t->num_buckets < cap * 2;) {
+		t->num_buckets *= 2;
+	}
+	t->buckets = calloc(t->num_buckets, sizeof *t->buckets);
+	if (t->buckets == NULL) {
+		perror("lru_init");
+		exit(1);
+	}
+}
+
+void lru_free(struct lru_table *t) {
+	free(t->buckets);
+	t->buckets = NULL;
+}
+
+struct lru_node *lru_bucket(const struct lru_table *t, uint32_t hash) {
+	return t->buckets[hash & (t->num_buckets - 1)];
+}
+
+static void lru_unlink(struct lru_table *t, struct lru_node *node) {
+	if (node->lru_prev != NULL) node->lru_prev->lru_next = node->lru_next;
+	else t->lru_head = node->lru_next;
+	if (node->lru_next != NULL) node->lru_next->lru_prev = node->lru_prev;
+	else t->lru_tail = node->lru_prev;
+}
+
+static void lru_push_front(struct lru_table *t, struct lru_node *node) {
+	node->lru_prev = NULL;
+	node->lru_next = t->lru_head;
+	if (t->lru_head != NULL) t->lru_head->lru_prev = node;
+	else t->lru_tail = node;
+	t->lru_head = node;
+}
+
+void lru_insert(struct lru_table *t, struct lru_node *node, uint32_t hash) {
+	struct lru_node **bucket = t->buckets + (hash & (t->num_buckets - 1));
+
+	node->hash = hash;
+	node->chain_next = *bucket;
+	*bucket = node;
+	lru_push_front(t, node);
+	t->count++;
+}
+
+void lru_remove(struct lru_table *t, struct lru_node *node) {
+	struct lru_node **link = t->buckets + (node->hash & (t->num_buckets - 1));
+
+	while (*link != node) {
+		link = &(*link)->chain_next;
+	}
+	*link = node->chain_next;
+	lru_unlink(t, node);
+	node->chain_next = NULL;
+	t->count--;
+}
+
+void lru_touch(struct lru_table *t, struct lru_node *node) {
+	if (t->lru_head == node) return;
+	lru_unlink(t, node);
+	lru_push_front(t, node);
+}
+
+void lru_put_free(struct lru_table *t, struct lru_node *node) {
+	node->chain_next = t->free_head;
+	t->free_head = node;
+}
+
+struct lru_node *lru_take_free(struct lru_table *t) {
+	struct lru_node *node = t->free_head;
+	if (node != NULL) t->free_head = node->chain_next;
+	return node;
+}
@@ -0,0 +1,47 @@
+#ifndef LRU_H
+#define LRU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* the entry holding an embedded `member` node */
+#define LRU_ENTRY(node, type, member) \
+	((type *)(void *)((char *)(node) - offsetof(type, member)))
+
+/* links of a cache entry, embedded in it */
+struct lru_node {
+	uint32_t hash;
+	struct lru_node *chain_next; /* hash chain, or list of unused nodes */
+	struct lru_node *lru_prev, *lru_next; /* most recently used first */
+};
+
+/* hash chains and recency order of the entries of a cache; the cache owns
+   the entries, compares keys and picks what to evict */
+struct lru_table {
+	struct lru_node **buckets; /* heads of hash chains */
+	size_t num_buckets; /* power of two */
+	struct lru_node *lru_head, *lru_tail;
+	struct lru_node *free_head; /* unused nodes of a preallocated cache */
+	size_t count;
+};
+
+/* size the chains for up to `cap` entries */
+void lru_init(struct lru_table *t, size_t cap);
+void lru_free(struct lru_table *t);
+
+/* first node of the chain `hash` falls in, NULL if empty; follow
+   chain_next and compare hashes and keys */
+struct lru_node *lru_bucket(const struct lru_table *t, uint32_t hash);
+
+/* index `node` under `hash` as the most recently used */
+void lru_insert(struct lru_table *t, struct lru_node *node, uint32_t hash);
+void lru_remove(struct lru_table *t, struct lru_node *node);
+
+/* make `node` the most recently used */
+void lru_touch(struct lru_table *t, struct lru_node *node);
+
+/* keep `node` for a later insert, and take one back (NULL if none) */
+void lru_put_free(struct lru_table *t, struct lru_node *node);
+struct lru_node *lru_take_free(struct lru_table *t);
+
+#endif
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "negcache.h"
+
+/* double hashing: the i-th probe is h1 + i * h2 */
+static size_t bloom_index(const struct neg_cache *cache, uint32_t hash, unsigned i) {
+	uint32_t h2 = ((hash >> 16) | (hash << 16)) * 0x9E3779B1u;
+	return (size_t)(hash + i * (h2 | 1u)) & (cache->num_counters - 1);
+}
+
+static void bloom_add(struct neg_cache *cache, uint32_t hash) {
+	unsigned i;
+	for (i = 0; i < NEG_BLOOM_HASHES; ++i) {
+		uint8_t *counter = cache->counters + bloom_index(cache, hash, i);
+		if (*counter < UINT8_MAX) (*counter)++;
+	}
+}
+
+static void bloom_remove(struct neg_cache *cache, uint32_t hash) {
+	unsigned i;
+	for (i = 0; i < NEG_BLOOM_HASHES; ++i) {
+		uint8_t *counter = cache->counters + bloom_index(cache, hash, i);
+		/* a saturated counter has lost its count, keep it set */
+		if (*counter > 0 && *counter < UINT8_MAX) (*counter)--;
+	}
+}
+
+static int bloom_maybe(const struct neg_cache *cache, uint32_t hash) {
+	unsigned i;
+	for (i = 0; i < NEG_BLOOM_HASHES; ++i) {
+		if (cache->counters[bloom_index(cache, hash, i)] == 0) return 0;
+	}
+	return 1;
+}
+
+void neg_cache_init(
+		struct neg_cache *cache,
+		size_t cap,
+		void (*on_remove)(void *data, size_t watch),
+		void *data
+) {
+	size_t i;
+
+	memset(cache, 0, sizeof *cache);
+	cache->cap = cap;
+	cache->on_remove = on_remove;
+	cache->data = data;
+
+	/* ~8 counters per key keeps false positives around 3% */
+	for (cache->num_counters = 64; cache->num_counters < cap * 8;) {
+		cache->num_counters *= 2;
+	}
+	lru_init(&cache->lru, cap);
+	cache->num_watch_buckets = cache->lru.num_buckets;
+	cache->counters = calloc(cache->num_counters, 1);
+	cache->entries = malloc((cap ? cap : 1) * sizeof(struct neg_entry));
+	cache->by_watch = calloc(cache->num_watch_buckets, sizeof *cache->by_watch);
+	if (cache->counters == NULL || cache->entries == NULL ||
+			cache->by_watch == NULL) {
+		perror("neg_cache_init");
+		exit(1);
+	}
+
+	for (i = cap; i > 0; --i) {
+		cache->entries[i - 1].key = NULL;
+		lru_put_free(&cache->lru, &cache->entries[i - 1].node);
+	}
+}
+
+void neg_cache_free(struct neg_cache *cache) {
+	size_t i;
+	for (i = 0; i < cache->cap; ++i) {
+		free(cache->entries[i].key);
+	}
+	free(cache->counters);
+	free(cache->entries);
+	free(cache->by_watch);
+	lru_free(&cache->lru);
+}
+
+static struct neg_entry **watch_bucket(struct neg_cache *cache, size_t watch) {
+	return cache->by_watch + (watch & (cache->num_watch_buckets - 1));
+}
+
+static void remove_entry(struct neg_cache *cache, struct neg_entry *e) {
+	lru_remove(&cache->lru, &e->node);
+	bloom_remove(cache, e->node.hash);
+
+	if (e->watch_prev != NULL) e->watch_prev->watch_next = e->watch_next;
+	else *watch_bucket(cache, e->watch) = e->watch_next;
+	if (e->watch_next != NULL) e->watch_next->watch_prev = e->watch_prev;
+
+	free(e->key);
+	e->key = NULL;
+	lru_put_free(&cache->lru, &e->node);
+
+	if (cache->on_remove != NULL) {
+		cache->on_remove(cache->data, e->watch);
+	}
+}
+
+int neg_cache_contains(struct neg_cache *cache, const char *key, size_t key_len, uint32_t hash) {
+	struct lru_node *node;
+
+	if (!bloom_maybe(cache, hash)) {
+		cache->stats.bloom_skips++;
+		return 0;
+	}
+
+	for (node = lru_bucket(&cache->lru, hash); node != NULL; node = node->chain_next) {
+		struct neg_entry *e = LRU_ENTRY(node, struct neg_entry, node);
+		if (node->hash == hash && e->key_len == key_len &&
+				!memcmp(e->key, key, key_len)) {
+			lru_touch(&cache->lru, node);
+			cache->stats.hits++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void neg_cache_insert(
+		struct neg_cache *cache,
+		const char *key,
+		size_t key_len,
+		uint32_t hash,
+		size_t watch
+) {
+	struct lru_node *node;
+	struct neg_entry *e, **bucket;
+
+	if (cache->cap == 0) {
+		if (cache->on_remove != NULL) cache->on_remove(cache->data, watch);
+		return;
+	}
+	if (cache->lru.free_head == NULL) {
+		remove_entry(cache, LRU_ENTRY(cache->lru.lru_tail, struct neg_entry, node));
+		cache->stats.evictions++;
+	}
+
+	node = lru_take_free(&cache->lru);
+	e = LRU_ENTRY(node, struct neg_entry, node);
+
+	e->key = malloc(key_len + 1);
+	if (e->key == NULL) {
+		perror("neg_cache_insert");
+		exit(1);
+	}
+	memcpy(e->key, key, key_len);
+	e->key[key_len] = '\0';
+	e->key_len = key_len;
+	e->watch = watch;
+
+	bucket = watch_bucket(cache, watch);
+	e->watch_prev = NULL;
+	e->watch_next = *bucket;
+	if (*bucket != NULL) (*bucket)->watch_prev = e;
+	*bucket = e;
+
+	lru_insert(&cache->lru, node, hash);
+	bloom_add(cache, hash);
+	cache->stats.inserts++;
+}
+
+void neg_cache_invalidate_path(
+		struct neg_cache *cache,
+		size_t watch,
+		const char *dir,
+		size_t dir_len,
+		const char *path,
+		size_t path_len
+) {
+	struct neg_entry *e = *watch_bucket(cache, watch), *next;
+
+	for (; e != NULL; e = next) {
+		next = e->watch_next;
+		if (e->watch != watch) continue;
+		if ((e->key_len == dir_len && !memcmp(e->key, dir, dir_len)) ||
+				(e->key_len >= path_len &&
+				!memcmp(e->key, path, path_len) &&
+				(e->key_len == path_len || e->key[path_len] == '/'))) {
+			remove_entry(cache, e);
+			cache->stats.invalidations++;
+		}
+	}
+}
+
+void neg_cache_invalidate_watch(struct neg_cache *cache, size_t watch) {
+	struct neg_entry *e = *watch_bucket(cache, watch), *next;
+
+	for (; e != NULL; e = next) {
+		next = e->watch_next;
+		if (e->watch == watch) {
+			remove_entry(cache, e);
+			cache->stats.invalidations++;
+		}
+	}
+}
+
+void neg_cache_clear(struct neg_cache *cache) {
+	while (cache->lru.lru_head != NULL) {
+		remove_entry(cache, LRU_ENTRY(cache->lru.lru_head, struct neg_entry, node));
+		cache->stats.invalidations++;
+	}
+}
@@ -0,0 +1,87 @@
+#ifndef NEGCACHE_H
+#define NEGCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lru.h"
+
+#define NEG_CACHE_DEFAULT_CAP 4096
+#define NEG_BLOOM_HASHES 3
+
+/* path known not to exist */
+struct neg_entry {
+	char *key; /* NULL if unused */
+	size_t key_len;
+	size_t watch; /* opaque to the cache, handed back on removal */
+
+	struct lru_node node;
+	struct neg_entry *watch_prev, *watch_next; /* sharing a watch bucket */
+};
+
+struct neg_cache_stats {
+	size_t hits;
+	size_t bloom_skips; /* lookups answered by the filter alone */
+	size_t inserts;
+	size_t evictions;
+	size_t invalidations;
+};
+
+/* counting Bloom filter in front of an exact LRU of missing paths; the filter
+   holds exactly the keys of the LRU, so a negative answer needs no probe */
+struct neg_cache {
+	uint8_t *counters;
+	size_t num_counters; /* power of two */
+
+	struct neg_entry *entries;
+	size_t cap;
+	struct lru_table lru;
+
+	/* entries by watch, on the deepest directory of their key that existed;
+	   only a name created there can make them exist */
+	struct neg_entry **by_watch;
+	size_t num_watch_buckets; /* power of two */
+
+	/* called with the watch of every removed entry */
+	void (*on_remove)(void *data, size_t watch);
+	void *data;
+
+	struct neg_cache_stats stats;
+};
+
+void neg_cache_init(
+		struct neg_cache *cache,
+		size_t cap,
+		void (*on_remove)(void *data, size_t watch),
+		void *data
+);
+void neg_cache_free(struct neg_cache *cache);
+
+/* return 1 if `key` is known to be missing, 0 otherwise */
+int neg_cache_contains(struct neg_cache *cache, const char *key, size_t key_len, uint32_t hash);
+
+void neg_cache_insert(
+		struct neg_cache *cache,
+		const char *key,
+		size_t key_len,
+		uint32_t hash,
+		size_t watch
+);
+
+/* forget keys equal to `path`, or under it, or equal to its parent `dir`
+   (a directory whose index was missing); called when `path` appears in
+   `dir`, which only keys watched through `watch` can be affected by */
+void neg_cache_invalidate_path(
+		struct neg_cache *cache,
+		size_t watch,
+		const char *dir,
+		size_t dir_len,
+		const char *path,
+		size_t path_len
+);
+
+/* forget keys that were watched through `watch` */
+void neg_cache_invalidate_watch(struct neg_cache *cache, size_t watch);
+
+void neg_cache_clear(struct neg_cache *cache);
+
+#endif
@@ -0,0 +1,434 @@
+#define _XOPEN_SOURCE 500
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "conditional.h"
+#include "deflate.h"
+#include "origin.h"
+#include "path.h"
+#include "range.h"
+#include "str.h"
+
+struct mime_type {
+	const char *ext;
+	const char *type;
+};
+
+static const struct mime_type mime_types[] = {
+	{"html", "text/html; charset=utf-8"},
+	{"htm", "text/html; charset=utf-8"},
+	{"css", "text/css; charset=utf-8"},
+	{"js", "text/javascript; charset=utf-8"},
+	{"mjs", "text/javascript; charset=utf-8"},
+	{"json", "application/json"},
+	{"txt", "text/plain; charset=utf-8"},
+	{"xml", "application/xml"},
+	{"svg", "image/svg+xml"},
+	{"png", "image/png"},
+	{"jpg", "image/jpeg"},
+	{"jpeg", "image/jpeg"},
+	{"gif", "image/gif"},
+	{"webp", "image/webp"},
+	{"avif", "image/avif"},
+	{"ico", "image/x-icon"},
+	{"wasm", "application/wasm"},
+	{"pdf", "application/pdf"},
+	{"woff", "font/woff"},
+	{"woff2", "font/woff2"},
+	{"mp4", "video/mp4"},
+	{"webm", "video/webm"},
+	{"mp3", "audio/mpeg"},
+	{"ogg", "audio/ogg"}
+};
+
+int origin_init(struct origin *origin, const char *docroot) {
+	if (fd_cache_init(&origin->files, docroot, FD_CACHE_DEFAULT_CAP) == -1) {
+		return -1;
+	}
+	zcache_init(&origin->gzipped, ZCACHE_DEFAULT_CAP, ZCACHE_DEFAULT_BYTES);
+	canned_init(&origin->not_found, RC_404_NOT_FOUND,
+		"Content-Type: text/html; charset=utf-8" CRLF, NOT_FOUND);
+	return 0;
+}
+
+void origin_free(struct origin *origin) {
+	fd_cache_free(&origin->files);
+	zcache_free(&origin->gzipped);
+	canned_free(&origin->not_found);
+}
+
+const char *content_type(const char *name) {
+	const char *dot = strrchr(name, '.');
+	size_t i;
+
+	if (dot != NULL) {
+		struct slice ext = get_slice(dot + 1, strlen(dot + 1));
+		for (i = 0; i < sizeof mime_types / sizeof mime_types[0]; ++i) {
+			if (!slice_str_cmp_ci_check(&ext, mime_types[i].ext)) {
+				return mime_types[i].type;
+			}
+		}
+	}
+	return "application/octet-stream";
+}
+
+/* textual types shrink well, everything else is already compressed */
+static int compressible(const char *type) {
+	return !strncmp(type, "text/", 5) ||
+		!strcmp(type, "application/json") ||
+		!strcmp(type, "application/xml") ||
+		!strcmp(type, "application/wasm") ||
+		!strcmp(type, "image/svg+xml");
+}
+
+/* codings the file can be served with, gzip included when it can be made
+   on the fly */
+static unsigned available_codings(const struct fd_entry *file) {
+	unsigned codings = file->codings;
+	if (file->st.st_size >= ZCACHE_MIN_INPUT &&
+			(unsigned long)file->st.st_size <= ZCACHE_MAX_INPUT &&
+			compressible(content_type(file->name))) {
+		codings |= CODING_BIT(CC_GZIP);
+	}
+	return codings;
+}
+
+static int read_whole(int fd, unsigned char *buf, size_t len) {
+	size_t done = 0;
+	ssize_t got;
+	while (done < len) {
+		got = pread(fd, buf + done, len - done, (off_t)done);
+		if (got == -1 && errno == EINTR) continue;
+		if (got <= 0) return -1;
+		done += (size_t)got;
+	}
+	return 0;
+}
+
+/* gzip the file once per entity tag; NULL if it cannot be read or does not
+   get smaller, so identity is served instead */
+static const struct zcache_entry *gzip_file(struct origin *origin, const struct fd_entry *file) {
+	const struct fd_variant *identity = file->variants + CC_IDENTITY;
+	const struct zcache_entry *z;
+	size_t len = (size_t)file->st.st_size;
+	unsigned char *plain, *packed = NULL;
+	size_t packed_len = 0;
+
+	z = zcache_get(&origin->gzipped, identity->etag, identity->etag_len);
+	if (z != NULL) return z->data != NULL ? z : NULL;
+
+	plain = malloc(len);
+	if (plain == NULL) {
+		perror("gzip_file");
+		exit(1);
+	}
+	if (read_whole(file->fd, plain, len) == -1) {
+		free(plain);
+		return NULL;
+	}
+	gzip_compress(plain, len, DEFLATE_DEFAULT_LEVEL, &packed, &packed_len);
+	free(plain);
+	if (packed_len >= len) {
+		free(packed);
+		packed = NULL;
+	}
+
+	z = zcache_put(&origin->gzipped, identity->etag, identity->etag_len,
+		packed, packed_len);
+	return z != NULL && z->data != NULL ? z : NULL;
+}
+
+static void error_response(
+		struct http_response *resp,
+		enum http_response_code code,
+		const char *date
+) {
+	begin_response(resp, code, date);
+	if (code == RC_405_METHOD_NOT_ALLOWED) {
+		append_to_response(resp, "Allow: GET, HEAD" CRLF);
+	}
+	append_length_to_response(resp, 0);
+	append_to_response(resp, CRLF);
+}
+
+/* choose among the file's variants, reusing the previous outcome when the
+   client sent the same Accept-Encoding */
+static enum content_coding negotiate(struct fd_entry *file, const struct http_request *req) {
+	struct accept_codings accept;
+	unsigned available = available_codings(file);
+	char key[AE_KEY_MAX];
+	size_t len;
+
+	if (available == CODING_BIT(CC_IDENTITY)) return CC_IDENTITY;
+
+	len = accept_encoding_key(req, key, sizeof key);
+	if (file->ae_valid && file->ae_len == len && !memcmp(file->ae_key, key, len)) {
+		return file->ae_choice;
+	}
+
+	parse_accept_encoding(req, &accept);
+	file->ae_choice = choose_coding(&accept, available);
+	if (file->ae_choice == CC__COUNT) {
+		/* nothing acceptable, identity is the least surprising answer */
+		file->ae_choice = CC_IDENTITY;
+	}
+	/* fields too long to be kept are negotiated every time */
+	file->ae_valid = len < sizeof key;
+	if (file->ae_valid) memcpy(file->ae_key, key, len);
+	file->ae_len = len;
+	return file->ae_choice;
+}
+
+/* strong tag of the served representation; gzip made on the fly derives
+   its tag from the file's */
+static size_t representation_etag(
+		const struct fd_entry *file,
+		enum content_coding coding,
+		int on_the_fly,
+		char etag[ETAG_MAX + 8]
+) {
+	const struct fd_variant *variant = file->variants + coding;
+	if (!on_the_fly) {
+		memcpy(etag, variant->etag, variant->etag_len + 1);
+		return variant->etag_len;
+	}
+	variant = file->variants + CC_IDENTITY;
+	memcpy(etag, variant->etag, variant->etag_len - 1);
+	strcpy(etag + variant->etag_len - 1, "-gzip\"");
+	return variant->etag_len + 5;
+}
+
+/* 304 of a variant: the fields a 200 would carry that caches update from */
+static void not_modified_init(
+		const struct fd_entry *file,
+		struct fd_variant *variant,
+		const char *etag
+) {
+	char headers[ETAG_MAX + 64];
+	sprintf(headers, "ETag: %s" CRLF "%s", etag,
+		available_codings(file) != CODING_BIT(CC_IDENTITY) ?
+		"Vary: Accept-Encoding" CRLF : "");
+	canned_init(&variant->not_modified, RC_304_NOT_MODIFIED, headers, NULL);
+}
+
+static void append_content_range(
+		struct http_response *resp,
+		const struct byte_range *range,
+		size_t size
+) {
+	append_to_response(resp, "Content-Range: bytes ");
+	if (range != NULL) {
+		append_size_to_response(resp, range->first);
+		append_to_response(resp, "-");
+		append_size_to_response(resp, range->last);
+	} else {
+		append_to_response(resp, "*");
+	}
+	append_to_response(resp, "/");
+	append_size_to_response(resp, size);
+	append_to_response(resp, CRLF);
+}
+
+/* the `len` bytes at `off` of whatever holds the representation */
+static void add_representation(
+		struct http_response *resp,
+		const struct zcache_entry *gzipped,
+		const struct fd_variant *variant,
+		size_t off,
+		size_t len
+) {
+	if (gzipped != NULL) {
+		resp->body_mem = gzipped->data;
+		resp->body_blob = gzipped->blob;
+		add_body_part(resp, BP_MEM, off, len);
+	} else {
+		if (variant->pages != NULL) {
+			ra_file_queued(variant->pages, variant->fd, off, len);
+		}
+		resp->body_fd = variant->fd;
+		resp->body_pages = variant->pages;
+		add_body_part(resp, BP_FILE, off, len);
+	}
+}
+
+/* multipart/byteranges body (RFC 9110 section 14.6): the framing between
+   ranges is laid out first to get the Content-Length, then every range is
+   added as a part of its own so that file data still goes out through
+   sendfile() */
+static void multipart_response(
+		struct http_response *resp,
+		const struct byte_range *ranges,
+		size_t count,
+		size_t size,
+		const char *type,
+		const struct zcache_entry *gzipped,
+		const struct fd_variant *variant
+) {
+	static unsigned long serial;
+	struct http_response framing = new_response();
+	size_t offs[RANGE_MAX + 1];
+	size_t i, total = 0;
+	char boundary[32];
+
+	sprintf(boundary, "aster-%08lx%08lx",
+		(unsigned long)hash_bytes(variant->etag, variant->etag_len, HASH_SEED),
+		++serial & 0xFFFFFFFFul);
+	for (i = 0; i < count; ++i) {
+		offs[i] = framing.len;
+		append_to_response(&framing, i == 0 ? "--" : CRLF "--");
+		append_to_response(&framing, boundary);
+		append_to_response(&framing, CRLF "Content-Type: ");
+		append_to_response(&framing, type);
+		append_to_response(&framing, CRLF);
+		append_content_range(&framing, ranges + i, size);
+		append_to_response(&framing, CRLF);
+		total += ranges[i].last - ranges[i].first + 1;
+	}
+	offs[count] = framing.len;
+	append_to_response(&framing, CRLF "--");
+	append_to_response(&framing, boundary);
+	append_to_response(&framing, "--" CRLF);
+	total += framing.len;
+
+	append_to_response(resp, "Content-Type: multipart/byteranges; boundary=");
+	append_to_response(resp, boundary);
+	append_to_response(resp, CRLF);
+	append_length_to_response(resp, total);
+	append_to_response(resp, CRLF);
+
+	for (i = 0; i < count; ++i) {
+		add_body_buf(resp, framing.buf + offs[i], offs[i + 1] - offs[i]);
+		add_representation(resp, gzipped, variant, ranges[i].first,
+			ranges[i].last - ranges[i].first + 1);
+	}
+	add_body_buf(resp, framing.buf + offs[count], framing.len - offs[count]);
+	http_response_free(&framing);
+}
+
+void origin_serve(
+		struct origin *origin,
+		const struct http_request *req,
+		struct http_response *resp,
+		const char *date
+) {
+	char key[PATH_KEY_MAX];
+	int key_len;
+	struct fd_entry *file;
+	enum content_coding coding;
+	struct fd_variant *variant;
+	const struct zcache_entry *gzipped = NULL;
+	size_t size;
+	char etag[ETAG_MAX + 8];
+	size_t etag_len;
+	const struct fd_variant *validators;
+	struct byte_range ranges[RANGE_MAX];
+	size_t count = 0;
+	enum range_result range = RANGE_NONE;
+	const char *type;
+
+	if (req->method != HM_GET && req->method != HM_HEAD) {
+		error_response(resp, RC_405_METHOD_NOT_ALLOWED, date);
+		return;
+	}
+
+	key_len = normalize_path(&req->path, key, sizeof key);
+	if (key_len == -1) {
+		canned_serve(&origin->not_found, req->method != HM_HEAD, resp, date);
+		return;
+	}
+
+	fd_cache_sync(&origin->files);
+	file = fd_cache_get(&origin->files, key, (size_t)key_len);
+	if (file == NULL) {
+		switch (errno) {
+		case ENOENT:
+		case ENOTDIR:
+		case ENAMETOOLONG:
+		case EXDEV:
+		case ELOOP:
+			canned_serve(&origin->not_found, req->method != HM_HEAD, resp, date);
+			break;
+		case EACCES:
+		case EPERM:
+			error_response(resp, RC_403_FORBIDDEN, date);
+			break;
+		default:
+			error_response(resp, RC_500_INTERNAL_SERVER_ERROR, date);
+		}
+		return;
+	}
+
+	coding = negotiate(file, req);
+	if (coding == CC_GZIP && file->variants[CC_GZIP].fd == -1) {
+		gzipped = gzip_file(origin, file);
+		if (gzipped == NULL) coding = CC_IDENTITY;
+	}
+	variant = file->variants + coding;
+	size = gzipped != NULL ? gzipped->len : (size_t)variant->st.st_size;
+	etag_len = representation_etag(file, coding, gzipped != NULL, etag);
+	validators = gzipped != NULL ? file->variants + CC_IDENTITY : variant;
+	type = content_type(file->name);
+
+	if (is_not_modified(req, etag, etag_len, validators->st.st_mtime)) {
+		if (variant->not_modified.buf == NULL) {
+			not_modified_init(file, variant, etag);
+		}
+		canned_serve(&variant->not_modified, 0, resp, date);
+		return;
+	}
+
+	/* Range only applies to GET, and is ignored when repeated */
+	if (req->method == HM_GET && headers_count(req, HH_RANGE) == 1 &&
+			if_range_holds(req, etag, etag_len, validators->st.st_mtime, time(NULL))) {
+		range = parse_range(&req->headers[headers_first(req, HH_RANGE)].value,
+			size, ranges, &count);
+	}
+	if (range == RANGE_UNSATISFIABLE) {
+		begin_response(resp, RC_416_REQUESTED_RANGE_NOT_SATISFIABLE, date);
+		append_content_range(resp, NULL, size);
+		append_length_to_response(resp, 0);
+		append_to_response(resp, CRLF);
+		return;
+	}
+
+	begin_response(resp, range == RANGE_OK ? RC_206_PARTIAL_CONTENT : RC_200_OK, date);
+	append_to_response(resp, "Accept-Ranges: bytes" CRLF "ETag: ");
+	append_to_response_n(resp, etag, etag_len);
+	append_to_response(resp, CRLF "Last-Modified: ");
+	append_to_response(resp, validators->last_modified);
+	append_to_response(resp, CRLF);
+	if (coding != CC_IDENTITY) {
+		append_to_response(resp, "Content-Encoding: ");
+		append_to_response(resp, coding_name(coding));
+		append_to_response(resp, CRLF);
+	}
+	if (available_codings(file) != CODING_BIT(CC_IDENTITY)) {
+		append_to_response(resp, "Vary: Accept-Encoding" CRLF);
+	}
+
+	if (range == RANGE_OK && count > 1) {
+		multipart_response(resp, ranges, count, size, type, gzipped, variant);
+		return;
+	}
+
+	append_to_response(resp, "Content-Type: ");
+	append_to_response(resp, type);
+	append_to_response(resp, CRLF);
+	if (range == RANGE_OK) {
+		append_content_range(resp, ranges, size);
+	} else {
+		ranges[0].first = 0;
+		ranges[0].last = size - 1;
+	}
+	append_length_to_response(resp, range == RANGE_OK ?
+		ranges[0].last - ranges[0].first + 1 : size);
+	append_to_response(resp, CRLF);
+
+	if (req->method == HM_GET && size > 0) {
+		add_representation(resp, gzipped, variant, ranges[0].first,
+			ranges[0].last - ranges[0].first + 1);
+	}
+}
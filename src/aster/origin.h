@@ -0,0 +1,32 @@
+#ifndef ORIGIN_H
+#define ORIGIN_H
+
+#include "fdcache.h"
+#include "request.h"
+#include "response.h"
+#include "zcache.h"
+
+/* static origin serving files under a docroot */
+struct origin {
+	struct fd_cache files;
+	struct zcache gzipped; /* on-the-fly gzip of files without a .gz sibling */
+	struct canned_response not_found;
+};
+
+/* return 0 on success, -1 if docroot is not an accessible directory */
+int origin_init(struct origin *origin, const char *docroot);
+void origin_free(struct origin *origin);
+
+/* content type by file extension */
+const char *content_type(const char *name);
+
+/* build the response for a parsed request, honouring Range; bodies stay in
+   the caches (open files, gzipped copies) and are referenced by resp parts */
+void origin_serve(
+		struct origin *origin,
+		const struct http_request *req,
+		struct http_response *resp,
+		const char *date
+);
+
+#endif
@@ -0,0 +1,308 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "outq.h"
+
+void outq_init(struct outq *q) {
+	memset(q, 0, sizeof *q);
+}
+
+static struct outq_seg *seg_at(struct outq *q, size_t i) {
+	return q->segs + (q->head + i) % q->cap;
+}
+
+/* the segment is done with: pinned memory waits for the kernel */
+static void release(struct outq *q, struct outq_seg *seg) {
+	if (seg->kind == OQ_FILE) {
+		ra_file_unref(seg->pages, seg->fd);
+		close(seg->fd);
+	}
+	if (seg->pinned && (seg->owned != NULL || seg->blob != NULL)) {
+		if (q->num_pins == q->cap_pins) {
+			q->cap_pins = q->cap_pins ? q->cap_pins * 2 : 4;
+			q->pins = realloc(q->pins, q->cap_pins * sizeof(struct outq_pin));
+			if (q->pins == NULL) {
+				perror("outq");
+				exit(1);
+			}
+		}
+		q->pins[q->num_pins].owned = seg->owned;
+		q->pins[q->num_pins].blob = seg->blob;
+		q->num_pins++;
+		return;
+	}
+	free(seg->owned);
+	blob_unref(seg->blob);
+}
+
+void outq_unpin(struct outq *q) {
+	size_t i;
+	for (i = 0; i < q->num_pins; ++i) {
+		free(q->pins[i].owned);
+		blob_unref(q->pins[i].blob);
+	}
+	q->num_pins = 0;
+}
+
+void outq_shrink(struct outq *q) {
+	if (q->count > 0) return;
+	free(q->segs);
+	q->segs = NULL;
+	q->head = q->cap = 0;
+	if (q->num_pins == 0) {
+		free(q->pins);
+		q->pins = NULL;
+		q->cap_pins = 0;
+	}
+}
+
+void outq_free(struct outq *q) {
+	while (q->count > 0) {
+		release(q, seg_at(q, 0));
+		q->head = (q->head + 1) % q->cap;
+		q->count--;
+	}
+	outq_unpin(q);
+	free(q->segs);
+	free(q->pins);
+}
+
+static struct outq_seg *push(struct outq *q) {
+	struct outq_seg *seg;
+
+	if (q->count == q->cap) {
+		size_t cap = q->cap ? q->cap * 2 : 8, i;
+		struct outq_seg *segs = malloc(cap * sizeof(struct outq_seg));
+		if (segs == NULL) {
+			perror("outq");
+			exit(1);
+		}
+		for (i = 0; i < q->count; ++i) {
+			segs[i] = *seg_at(q, i);
+		}
+		free(q->segs);
+		q->segs = segs;
+		q->cap = cap;
+		q->head = 0;
+	}
+	seg = seg_at(q, q->count++);
+	memset(seg, 0, sizeof *seg);
+	seg->fd = -1;
+	return seg;
+}
+
+void outq_push_mem(struct outq *q, const char *ptr, size_t len, char *owned, struct blob *blob) {
+	struct outq_seg *seg = push(q);
+	seg->kind = OQ_MEM;
+	seg->ptr = ptr;
+	seg->len = len;
+	seg->owned = owned;
+	seg->blob = blob != NULL ? blob_ref(blob) : NULL;
+	q->bytes += len;
+}
+
+int outq_push_file(struct outq *q, int fd, off_t off, size_t len) {
+	struct outq_seg *seg;
+	int dup_fd = dup(fd);
+
+	if (dup_fd == -1) return -1;
+	seg = push(q);
+	seg->kind = OQ_FILE;
+	seg->fd = dup_fd;
+	seg->off = off;
+	seg->len = len;
+	q->bytes += len;
+	return 0;
+}
+
+void outq_push_pipe(struct outq *q, int fd, size_t len) {
+	struct outq_seg *seg = q->count > 0 ? seg_at(q, q->count - 1) : NULL;
+
+	/* the pipe keeps the order, one segment does */
+	if (seg == NULL || seg->kind != OQ_PIPE || seg->fd != fd) {
+		seg = push(q);
+		seg->kind = OQ_PIPE;
+		seg->fd = fd;
+	}
+	seg->len += len;
+	q->bytes += len;
+}
+
+/* a file segment hinting `pages`, its reads so far being `ra` */
+static void follow_pages(struct outq_seg *seg, struct ra_file *pages, struct ra_state ra) {
+	seg->pages = ra_file_ref(pages);
+	seg->ra = ra;
+}
+
+size_t outq_move(struct outq *dst, struct outq *src, size_t max) {
+	struct outq_seg *seg;
+	size_t moved = 0, step;
+
+	while (src->count > 0 && moved < max) {
+		seg = seg_at(src, 0);
+		step = seg->len < max - moved ? seg->len : max - moved;
+		if (step == seg->len) {
+			/* whole, with what it owns */
+			*push(dst) = *seg;
+			dst->bytes += step;
+			src->head = (src->head + 1) % src->cap;
+			src->count--;
+		} else if (seg->kind == OQ_MEM) {
+			/* both parts keep what either would free */
+			if (seg->owned != NULL) {
+				seg->blob = blob_new((unsigned char *)seg->owned, 0);
+				seg->owned = NULL;
+			}
+			outq_push_mem(dst, seg->ptr, step, NULL, seg->blob);
+			seg->ptr += step;
+			seg->len -= step;
+		} else if (seg->kind == OQ_FILE) {
+			if (outq_push_file(dst, seg->fd, seg->off, step) == -1) break;
+			if (seg->blob != NULL) seg_at(dst, dst->count - 1)->blob = blob_ref(seg->blob);
+			if (seg->pages != NULL) follow_pages(seg_at(dst, dst->count - 1), seg->pages, seg->ra);
+			seg->off += (off_t)step;
+			seg->len -= step;
+		} else {
+			/* the pipe keeps the order */
+			outq_push_pipe(dst, seg->fd, step);
+			seg->len -= step;
+		}
+		src->bytes -= step;
+		moved += step;
+	}
+	return moved;
+}
+
+int outq_push_response(struct outq *q, struct http_response *resp) {
+	size_t i, owner = q->count;
+	const struct body_part *part;
+	int ret = 0;
+
+	if (resp->num_parts == 0) {
+		outq_push_mem(q, resp->buf, resp->len, resp->buf, NULL);
+		resp->buf = NULL;
+		http_response_free(resp);
+		return 0;
+	}
+
+	outq_push_mem(q, resp->buf, resp->head_len, NULL, NULL);
+	for (i = 0; i < resp->num_parts && ret == 0; ++i) {
+		part = resp->parts + i;
+		if (part->len == 0) continue;
+		switch (part->type) {
+		case BP_BUF:
+			owner = q->count;
+			outq_push_mem(q, resp->buf + part->off, part->len, NULL, NULL);
+			break;
+		case BP_MEM:
+			outq_push_mem(q, (const char *)resp->body_mem + part->off, part->len,
+				NULL, resp->body_blob);
+			break;
+		default:
+			ret = outq_push_file(q, resp->body_fd, (off_t)part->off, part->len);
+			/* a file a cache may overwrite stays pinned as well */
+			if (ret == 0 && resp->body_blob != NULL) {
+				seg_at(q, q->count - 1)->blob = blob_ref(resp->body_blob);
+			}
+			if (ret == 0 && resp->body_pages != NULL) {
+				/* carrying on from the hints given as this part was queued,
+				   if they were the last */
+				struct ra_state ra = resp->body_pages->ra;
+				if (ra.next != part->off + part->len) ra_init(&ra);
+				ra.next = part->off;
+				follow_pages(seg_at(q, q->count - 1), resp->body_pages, ra);
+			}
+		}
+	}
+	/* buf goes with the last segment pointing into it */
+	seg_at(q, owner)->owned = resp->buf;
+	resp->buf = NULL;
+	http_response_free(resp);
+	return ret;
+}
+
+/* account for `n` bytes sent from the head */
+static void consume(struct outq *q, size_t n) {
+	q->bytes -= n;
+	while (n > 0 || (q->count > 0 && seg_at(q, 0)->len == 0)) {
+		struct outq_seg *seg = seg_at(q, 0);
+		size_t step = n < seg->len ? n : seg->len;
+
+		seg->ptr += seg->kind == OQ_MEM ? step : 0;
+		seg->off += seg->kind == OQ_FILE ? (off_t)step : 0;
+		seg->len -= step;
+		n -= step;
+		if (seg->len > 0) break;
+		release(q, seg);
+		q->head = (q->head + 1) % q->cap;
+		q->count--;
+	}
+}
+
+static int wants_zerocopy(const struct zerocopy *zc, const struct outq_seg *seg) {
+	return zc->enabled && seg->kind == OQ_MEM && seg->len >= ZC_MIN_BYTES;
+}
+
+enum outq_status outq_flush(struct outq *q, struct zerocopy *zc, struct zc_socket *s) {
+	struct iovec iov[OUTQ_IOV_MAX];
+	struct msghdr msg;
+	struct outq_seg *seg;
+	ssize_t sent;
+	size_t n;
+	uint32_t before;
+
+	while (q->count > 0) {
+		seg = seg_at(q, 0);
+		if (seg->len == 0) {
+			consume(q, 0);
+			continue;
+		}
+
+		if (seg->kind == OQ_FILE) {
+			sent = sendfile(s->fd, seg->fd, &seg->off, seg->len);
+			if (sent > 0) {
+				/* sendfile() moved the offset already */
+				seg->off -= sent;
+				if (seg->pages != NULL) {
+					ra_file_sent(seg->pages, &seg->ra, seg->fd, (size_t)seg->off, (size_t)sent);
+				}
+			} else if (sent == 0) {
+				return OUTQ_ERROR; /* the file shrank */
+			}
+		} else if (seg->kind == OQ_PIPE) {
+			sent = splice(seg->fd, NULL, s->fd, NULL, seg->len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (sent == 0) return OUTQ_ERROR; /* the pipe lost its bytes */
+		} else if (wants_zerocopy(zc, seg)) {
+			before = s->sent;
+			sent = zc_write(zc, s, seg->ptr, seg->len);
+			if (s->sent != before) seg->pinned = 1;
+		} else {
+			/* gather the memory up to the next file or zerocopy segment */
+			for (n = 0; n < q->count && n < OUTQ_IOV_MAX; ++n) {
+				const struct outq_seg *next = seg_at(q, n);
+				if (next->kind != OQ_MEM || (n > 0 && wants_zerocopy(zc, next))) break;
+				iov[n].iov_base = (void *)next->ptr;
+				iov[n].iov_len = next->len;
+			}
+			memset(&msg, 0, sizeof msg);
+			msg.msg_iov = iov;
+			msg.msg_iovlen = n;
+			sent = sendmsg(s->fd, &msg, MSG_NOSIGNAL);
+		}
+
+		if (sent == -1) {
+			if (errno == EINTR) continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK ? OUTQ_AGAIN : OUTQ_ERROR;
+		}
+		consume(q, (size_t)sent);
+	}
+	return OUTQ_DONE;
+}
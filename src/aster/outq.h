@@ -0,0 +1,98 @@
+#ifndef OUTQ_H
+#define OUTQ_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "blob.h"
+#include "readahead.h"
+#include "response.h"
+#include "zerocopy.h"
+
+/* segments gathered into one sendmsg() */
+#define OUTQ_IOV_MAX 64
+
+enum outq_kind {
+	OQ_MEM = 0,
+	OQ_FILE, /* sent with sendfile() */
+	OQ_PIPE /* waiting in a pipe, sent with splice() */
+};
+
+struct outq_seg {
+	enum outq_kind kind;
+	const char *ptr; /* OQ_MEM: next byte to send */
+	int fd; /* OQ_FILE: a duplicate owned by the segment, OQ_PIPE: the
+	           read end, not owned */
+	off_t off; /* OQ_FILE: next byte to send */
+	size_t len; /* left to send */
+
+	char *owned; /* freed once sent, NULL if none */
+	struct blob *blob; /* referenced until sent, NULL if none */
+	int pinned; /* some of it went out with MSG_ZEROCOPY */
+
+	/* OQ_FILE: hints the page cache ahead of sendfile(), referenced, NULL
+	   if none; `ra` follows this segment's own reads */
+	struct ra_file *pages;
+	struct ra_state ra;
+};
+
+/* memory sent with MSG_ZEROCOPY, kept until the kernel is done with it */
+struct outq_pin {
+	char *owned;
+	struct blob *blob;
+};
+
+/* bytes waiting for a non-blocking socket, in order; whatever a segment
+   points to stays valid while it is queued */
+struct outq {
+	struct outq_seg *segs; /* ring of cap segments */
+	size_t head, count, cap;
+	size_t bytes; /* left to send */
+
+	struct outq_pin *pins;
+	size_t num_pins, cap_pins;
+};
+
+enum outq_status {
+	OUTQ_DONE = 0, /* empty */
+	OUTQ_AGAIN, /* the socket is full, flush again once writable */
+	OUTQ_ERROR /* the peer went away */
+};
+
+void outq_init(struct outq *q);
+/* drop everything, pinned memory included */
+void outq_free(struct outq *q);
+
+/* queue `len` bytes at `ptr`, taking `owned` over and a reference on `blob`
+   (either may be NULL) */
+void outq_push_mem(struct outq *q, const char *ptr, size_t len, char *owned, struct blob *blob);
+
+/* queue `len` bytes at `off` of `fd`, which is duplicated so that it may be
+   closed meanwhile; -1 if it cannot be */
+int outq_push_file(struct outq *q, int fd, off_t off, size_t len);
+
+/* queue `len` bytes written to the pipe read from `fd`, which must stay
+   open while they are queued */
+void outq_push_pipe(struct outq *q, int fd, size_t len);
+
+/* move up to `max` bytes from the front of `src` to the back of `dst`,
+   splitting a segment that does not fit whole: the bytes moved, fewer if a
+   file cannot be duplicated. `src` must not have been flushed */
+size_t outq_move(struct outq *dst, struct outq *src, size_t max);
+
+/* queue a whole response and free it, its buffer moving into the queue;
+   -1 if its file cannot be duplicated. Its file segments take a reference
+   on body_pages */
+int outq_push_response(struct outq *q, struct http_response *resp);
+
+/* send as much as the socket takes, large memory segments going out with
+   MSG_ZEROCOPY if `zc` allows */
+enum outq_status outq_flush(struct outq *q, struct zerocopy *zc, struct zc_socket *s);
+
+/* release pinned memory, once the kernel completed every zerocopy send */
+void outq_unpin(struct outq *q);
+
+/* free what an empty queue holds on to, for connections idle for long;
+   pinned memory stays */
+void outq_shrink(struct outq *q);
+
+#endif
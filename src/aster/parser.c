@@ -32,15 +32,53 @@ void parse_ctx_free(struct parse_ctx *ctx) {
 	free(ctx->buf);
 }
 
+void parse_ctx_reset(struct parse_ctx *ctx, struct http_request *req, size_t consumed) {
+	if (consumed > ctx->len) consumed = ctx->len;
+	memmove(ctx->buf, ctx->buf + consumed, ctx->len - consumed);
+	ctx->len -= consumed;
+	ctx->state = PS_REQ_LINE_METHOD;
+	ctx->pos = 0;
+	ctx->mark = MARK_NONE;
+	ctx->code = 0;
+	ctx->req = req;
+}
+
+static void rebase(struct slice *sl, const char *old_buf, const char *new_buf) {
+	if (sl->ptr != NULL) sl->ptr = new_buf + (sl->ptr - old_buf);
+}
+
+/* slices point into the buffer, they follow it when it moves */
+static void rebase_request(struct http_request *req, const char *old_buf, const char *new_buf) {
+	size_t i;
+
+	rebase(&req->raw_target, old_buf, new_buf);
+	rebase(&req->scheme, old_buf, new_buf);
+	rebase(&req->authority, old_buf, new_buf);
+	rebase(&req->host, old_buf, new_buf);
+	rebase(&req->path, old_buf, new_buf);
+	rebase(&req->query, old_buf, new_buf);
+	for (i = 0; i < req->num_headers; ++i) {
+		rebase(&req->headers[i].name, old_buf, new_buf);
+		rebase(&req->headers[i].value, old_buf, new_buf);
+	}
+}
+
 /* expect data to be allocated up to (data+n) */
 static void append_to_buf(struct parse_ctx *ctx, const char* data, size_t n) {
-	while (n + ctx->len > ctx->cap) {
-		size_t new_cap = ctx->cap * 2;
-		ctx->buf = realloc(ctx->buf, new_cap);
-		if (ctx->buf == NULL) {
+	size_t new_cap = ctx->cap;
+	char *new_buf;
+
+	while (n + ctx->len > new_cap) new_cap *= 2;
+	if (new_cap != ctx->cap) {
+		new_buf = malloc(new_cap);
+		if (new_buf == NULL) {
 			perror("append_to_buf");
 			exit(1);
 		}
+		memcpy(new_buf, ctx->buf, ctx->len);
+		rebase_request(ctx->req, ctx->buf, new_buf);
+		free(ctx->buf);
+		ctx->buf = new_buf;
 		ctx->cap = new_cap;
 	}
 	memcpy(ctx->buf + ctx->len, data, n);
@@ -132,6 +170,8 @@ static enum parse_result parse_req_line_method(struct parse_ctx *ctx) {
 	case 7:
 		if (!slice_str_cmp(&method, "OPTIONS"))
 			parsed_method = HM_OPTIONS;
+		else if (!slice_str_cmp(&method, "CONNECT"))
+			parsed_method = HM_CONNECT;
 		break;
 	}
 	if (parsed_method == HM_UNK) {
@@ -147,6 +187,10 @@ static void parse_asterisk_form(struct parse_ctx *ctx) {
 	assert(ctx->req->raw_target.len == 1);
 	assert(ctx->req->raw_target.ptr[0] == '*');
 
+	if (ctx->req->method == HM_CONNECT) { /* authority-form only */
+		ctx->state = PS_ERROR;
+		return;
+	}
 	ctx->state = PS_REQ_LINE_HTTP_NAME;
 }
 
@@ -160,6 +204,11 @@ static void parse_origin_form(struct parse_ctx *ctx) {
 	assert(ctx->req->raw_target.len > 0);
 	assert(ctx->req->raw_target.ptr[0] == '/');
 
+	if (ctx->req->method == HM_CONNECT) { /* authority-form only */
+		ctx->state = PS_ERROR;
+		return;
+	}
+
 	/* absolute-path */
 	while (pos < target.len) {
 		if (buf[pos] == '/') {
@@ -333,6 +382,46 @@ static void parse_absolute_form(struct parse_ctx *ctx) {
 	return;
 }
 
+/* authority-form, only for CONNECT: host ":" port, the port being
+   required (RFC 9112 section 3.2.3) */
+static void parse_authority_form(struct parse_ctx *ctx) {
+	const struct slice target = ctx->req->raw_target;
+	const char *buf = target.ptr;
+	size_t pos = 0;
+	size_t mark;
+	unsigned long port = 0;
+
+	assert(ctx->req->target_form == TF_UNK);
+
+	ctx->req->target_form = TF_AUTHORITY;
+	ctx->state = PS_ERROR;
+
+	if (buf[0] == '[') { /* IP-literal */
+		do { /* TODO: parse IPv6 */
+			pos++;
+			if (pos >= target.len) return;
+		} while (is_hexdig(buf[pos]) || buf[pos] == ':' || buf[pos] == '.');
+		if (buf[pos] != ']' || pos == 1) return;
+		pos++;
+	} else {
+		while (pos < target.len && is_regchar(buf[pos])) pos++;
+		if (pos == 0) return; /* Empty host */
+	}
+	if (pos >= target.len || buf[pos] != ':') return;
+	ctx->req->host = get_slice(buf, pos);
+
+	mark = ++pos;
+	while (pos < target.len && is_digit(buf[pos]) && pos - mark < 5) {
+		port = port * 10 + to_digit(buf[pos]);
+		pos++;
+	}
+	if (pos == mark || pos < target.len || port == 0 || port > 65535) return;
+
+	ctx->req->port = (uint16_t)port;
+	ctx->req->authority = target;
+	ctx->state = PS_REQ_LINE_HTTP_NAME;
+}
+
 static enum parse_result parse_req_line_target(struct parse_ctx *ctx) {
 	char ch;
 
@@ -373,11 +462,15 @@ static enum parse_result parse_req_line_target(struct parse_ctx *ctx) {
 		case TF_ORIGIN:
 			parse_origin_form(ctx);
 			break;
-		case TF_ABSOLUTE:
-			parse_absolute_form(ctx);
+		case TF_UNK:
+			if (ctx->req->method == HM_CONNECT) {
+				parse_authority_form(ctx);
+			} else {
+				parse_absolute_form(ctx);
+			}
 			break;
 		case TF_AUTHORITY:
-		case TF_UNK: assert(0);
+		case TF_ABSOLUTE: assert(0);
 		}
 		return PR_COMPLETE;
 	}
@@ -428,7 +521,7 @@ static enum parse_result parse_req_line_target(struct parse_ctx *ctx) {
 		return PR_COMPLETE;
 
 	case TF_UNK: /* TF_AUTHORITY or TF_ABSOLUTE */
-		while (ch == '/' || ch == '?' || is_pchar(ch)) {
+		while (ch == '/' || ch == '?' || ch == '[' || ch == ']' || is_pchar(ch)) {
 			if (ch == '%' && !consume_pct_enc(ctx)) {
 				ctx->state = PS_ERROR;
 				return PR_COMPLETE;
@@ -448,7 +541,11 @@ static enum parse_result parse_req_line_target(struct parse_ctx *ctx) {
 		);
 		ctx->mark = MARK_NONE;
 		ctx->pos++;
-		parse_absolute_form(ctx);
+		if (ctx->req->method == HM_CONNECT) {
+			parse_authority_form(ctx);
+		} else {
+			parse_absolute_form(ctx);
+		}
 		return PR_COMPLETE;
 
 	case TF_AUTHORITY:
@@ -776,7 +873,9 @@ static void parse_host(struct parse_ctx *ctx) {
 	/* TODO: validate host */
 	struct http_header *host = get_header(ctx->req, HH_HOST);
 	if (!host) {
-		ctx->state = PS_ERROR;
+		/* only HTTP/1.1 requires it, RFC 9112 section 3.2; a 1.0 request
+		   without one goes to the default site */
+		if (!is_http_ver(ctx->req, 1, 0)) ctx->state = PS_ERROR;
 		return;
 	}
 
@@ -864,25 +963,54 @@ static void parse_framing(struct parse_ctx *ctx) {
 }
 
 static void parse_connection(struct parse_ctx *ctx) {
-	struct http_header *con = get_header(ctx->req, HH_CONNECTION);
-	ctx->req->keep_alive = 1;
-	if (con) {
-		if (!slice_str_cmp_ci_check(&con->value, "close")) {
-			ctx->req->keep_alive = 0;
-		} else if (!slice_str_cmp_ci_check(&con->value, "upgrade")) {
-			/* TODO: parse_upgrade() */
+	struct header_item_iter it = header_items_init(ctx->req, HH_CONNECTION);
+	int it_ret, closing = 0;
+
+	/* persistence, RFC 9112 section 9.3: HTTP/1.0 clients opt in with the
+	   keep-alive option of RFC 2068 section 19.7.1, close always wins */
+	ctx->req->keep_alive = !is_http_ver(ctx->req, 1, 0);
+	/* connection options, RFC 9110 section 7.6.1 */
+	for (it_ret = header_items_next(ctx->req, &it);
+			it.header_item.ptr != NULL && !it_ret;
+			it_ret = header_items_next(ctx->req, &it)) {
+		if (!slice_str_cmp_ci_check(&it.header_item, "close")) {
+			closing = 1;
+		} else if (!slice_str_cmp_ci_check(&it.header_item, "keep-alive")) {
+			ctx->req->keep_alive = 1;
+		} else if (!slice_str_cmp_ci_check(&it.header_item, "upgrade")) {
+			/* the protocols offered are for the handler to pick */
 			ctx->req->upgrade = 1;
 		}
 	}
+	if (closing) ctx->req->keep_alive = 0;
+}
+
+/* expectations, RFC 9110 section 10.1.1: only 100-continue is known, and
+   ignored from HTTP/1.0 clients */
+static void parse_expect(struct parse_ctx *ctx) {
+	struct header_item_iter it;
+	int it_ret;
+
+	ctx->req->expect_100 = 0;
+	if (is_http_ver(ctx->req, 1, 0)) return;
+	it = header_items_init(ctx->req, HH_EXPECT);
+	for (it_ret = header_items_next(ctx->req, &it);
+			it.header_item.ptr != NULL && !it_ret;
+			it_ret = header_items_next(ctx->req, &it)) {
+		if (!slice_str_cmp_ci_check(&it.header_item, "100-continue")) {
+			ctx->req->expect_100 = 1;
+		}
+	}
 }
 
 /* expect request_bytes to be allocated up to (request_bytes+n) */
 enum parse_result feed(struct parse_ctx *ctx, const char *req_bytes, size_t n) {
 	enum parse_result res = PR_NEED_MORE;
-	void (*const postprocess[3])(struct parse_ctx *) = {
+	void (*const postprocess[4])(struct parse_ctx *) = {
 		parse_host,
 		parse_framing,
-		parse_connection
+		parse_connection,
+		parse_expect
 	};
 	size_t static_count = sizeof(postprocess)/sizeof(postprocess[0]);
 	size_t i;
@@ -47,6 +47,10 @@ struct parse_ctx {
 struct parse_ctx parse_ctx_init(struct http_request *req);
 void parse_ctx_free(struct parse_ctx *ctx);
 
+/* start on the next request of a persistent connection, `req` being new,
+   the bytes past the first `consumed` (pipelined ones) kept for it */
+void parse_ctx_reset(struct parse_ctx *ctx, struct http_request *req, size_t consumed);
+
 enum parse_result feed(struct parse_ctx *ctx, const char *req_bytes, size_t n);
 
 #endif
@@ -0,0 +1,61 @@
+#include "path.h"
+#include "str.h"
+
+static int hex_value(char ch) {
+	if (is_digit(ch)) return ch - '0';
+	return lower(ch) - 'a' + 10;
+}
+
+int normalize_path(const struct slice *path, char *out, size_t cap) {
+	size_t pos = 0;
+	size_t len = 0;
+
+	if (path->len == 0 || path->ptr[0] != '/') return -1;
+
+	while (pos < path->len) {
+		size_t seg_start;
+		size_t seg_len;
+
+		while (pos < path->len && path->ptr[pos] == '/') pos++;
+		if (pos >= path->len) break;
+
+		/* segment is decoded right after the separator */
+		seg_start = len == 0 ? 0 : len + 1;
+		seg_len = 0;
+		while (pos < path->len && path->ptr[pos] != '/') {
+			char ch = path->ptr[pos];
+			if (ch == '%') {
+				if (pos + 2 >= path->len ||
+						!is_hexdig(path->ptr[pos + 1]) ||
+						!is_hexdig(path->ptr[pos + 2])) {
+					return -1;
+				}
+				ch = (char)(hex_value(path->ptr[pos + 1]) * 16 +
+						hex_value(path->ptr[pos + 2]));
+				/* NUL and encoded separators never name a file */
+				if (ch == '\0' || ch == '/') return -1;
+				pos += 3;
+			} else {
+				pos++;
+			}
+			if (seg_start + seg_len + 1 >= cap) return -1;
+			out[seg_start + seg_len++] = ch;
+		}
+
+		if (seg_len == 1 && out[seg_start] == '.') {
+			continue;
+		}
+		if (seg_len == 2 && out[seg_start] == '.' &&
+				out[seg_start + 1] == '.') {
+			/* pop the last segment, the root has no parent */
+			while (len > 0 && out[len - 1] != '/') len--;
+			if (len > 0) len--;
+			continue;
+		}
+		if (len > 0) out[len] = '/';
+		len = seg_start + seg_len;
+	}
+
+	out[len] = '\0';
+	return (int)len;
+}
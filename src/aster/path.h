@@ -0,0 +1,14 @@
+#ifndef PATH_H
+#define PATH_H
+
+#include <stddef.h>
+#include "request.h"
+
+#define PATH_KEY_MAX 1024
+
+/* decode percent-encoding and remove dot segments (RFC 3986 section 5.2.4)
+   of an absolute path, writing it to `out` without the leading slash ("" for
+   the root); returns the key length or -1 if the path cannot name a file */
+int normalize_path(const struct slice *path, char *out, size_t cap);
+
+#endif
@@ -0,0 +1,955 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "conditional.h"
+#include "datetime.h"
+#include "pcache.h"
+#include "proxy.h"
+#include "str.h"
+
+/* delta-seconds past this are taken as this (RFC 9111 section 1.2.2) */
+#define DELTA_MAX 2147483647L
+
+/* heuristic freshness is a tenth of the time since Last-Modified, up to a day */
+#define HEURISTIC_MAX 86400L
+
+/* fields of the stored response a 304 carries (RFC 9110 section 15.4.5) */
+static const char *const not_modified_fields[] = {
+	"cache-control",
+	"content-location",
+	"date",
+	"etag",
+	"expires",
+	"vary"
+};
+
+/* a NUL-terminated string being built */
+struct text {
+	char *ptr;
+	size_t len, cap;
+};
+
+static void text_add(struct text *t, const char *ptr, size_t n) {
+	if (t->len + n + 1 > t->cap) {
+		size_t cap = t->cap ? t->cap * 2 : 256;
+		while (t->len + n + 1 > cap) cap *= 2;
+		t->ptr = realloc(t->ptr, cap);
+		if (t->ptr == NULL) {
+			perror("pcache");
+			exit(1);
+		}
+		t->cap = cap;
+	}
+	memcpy(t->ptr + t->len, ptr, n);
+	t->len += n;
+	t->ptr[t->len] = '\0';
+}
+
+static void text_puts(struct text *t, const char *str) {
+	text_add(t, str, strlen(str));
+}
+
+void cache_control_init(struct cache_control *cc) {
+	memset(cc, 0, sizeof *cc);
+	cc->max_age = -1;
+	cc->s_maxage = -1;
+	cc->stale_while_revalidate = -1;
+}
+
+static long delta_seconds(const char *ptr, size_t len) {
+	long value = 0;
+	size_t i;
+
+	/* the quoted form is not to be sent, but to be understood */
+	if (len >= 2 && ptr[0] == '"' && ptr[len - 1] == '"') {
+		ptr++;
+		len -= 2;
+	}
+	if (len == 0) return -1;
+	for (i = 0; i < len; ++i) {
+		if (!is_digit(ptr[i])) return -1;
+		value = value > (DELTA_MAX - 9) / 10 ? DELTA_MAX : value * 10 + (ptr[i] - '0');
+	}
+	return value;
+}
+
+static void directive(struct cache_control *cc, const struct slice *name, const char *arg, size_t arg_len) {
+	if (!slice_str_cmp_ci_check(name, "max-age")) {
+		cc->max_age = delta_seconds(arg, arg_len);
+	} else if (!slice_str_cmp_ci_check(name, "s-maxage")) {
+		cc->s_maxage = delta_seconds(arg, arg_len);
+	} else if (!slice_str_cmp_ci_check(name, "stale-while-revalidate")) {
+		cc->stale_while_revalidate = delta_seconds(arg, arg_len);
+	} else if (!slice_str_cmp_ci_check(name, "no-store")) {
+		cc->no_store = 1;
+	} else if (!slice_str_cmp_ci_check(name, "no-cache")) {
+		/* with field names it could be stored without them, it is not */
+		cc->no_cache = 1;
+	} else if (!slice_str_cmp_ci_check(name, "private")) {
+		cc->is_private = 1;
+	} else if (!slice_str_cmp_ci_check(name, "public")) {
+		cc->is_public = 1;
+	} else if (!slice_str_cmp_ci_check(name, "must-revalidate") ||
+			!slice_str_cmp_ci_check(name, "proxy-revalidate")) {
+		cc->must_revalidate = 1;
+	}
+}
+
+void cache_control_parse(struct cache_control *cc, const struct slice *value) {
+	const char *pos = value->ptr, *end = value->ptr + value->len, *arg;
+	struct slice name;
+
+	while (pos < end) {
+		while (pos < end && (*pos == ',' || *pos == SYM_SP || *pos == SYM_HTAB)) pos++;
+		name.ptr = pos;
+		while (pos < end && is_tchar(*pos)) pos++;
+		name.len = (size_t)(pos - name.ptr);
+		arg = pos;
+		if (pos < end && *pos == '=') {
+			arg = ++pos;
+			if (pos < end && *pos == '"') {
+				for (++pos; pos < end && *pos != '"'; ++pos) {
+					if (*pos == '\\' && pos + 1 < end) pos++;
+				}
+				if (pos < end) pos++;
+			} else {
+				while (pos < end && is_tchar(*pos)) pos++;
+			}
+		}
+		if (name.len > 0) directive(cc, &name, arg, (size_t)(pos - arg));
+		/* whatever is left of a malformed directive */
+		while (pos < end && *pos != ',') pos++;
+	}
+}
+
+static void request_cache_control(const struct http_request *req, struct cache_control *cc) {
+	size_t i;
+
+	cache_control_init(cc);
+	for (i = headers_first(req, HH_CACHE_CONTROL); i != SIZE_MAX; i = headers_next(req, i)) {
+		cache_control_parse(cc, &req->headers[i].value);
+	}
+	/* Pragma: no-cache only counts without Cache-Control */
+	if (headers_count(req, HH_CACHE_CONTROL) > 0) return;
+	for (i = headers_first(req, HH_PRAGMA); i != SIZE_MAX; i = headers_next(req, i)) {
+		cache_control_parse(cc, &req->headers[i].value);
+	}
+}
+
+static unsigned status_of(const char *head) {
+	return (unsigned)((head[9] - '0') * 100 + (head[10] - '0') * 10 + head[11] - '0');
+}
+
+/* where the field lines of a head start */
+static size_t fields_of(const char *head, size_t len) {
+	const char *lf = memchr(head, SYM_LF, len);
+	return lf != NULL ? (size_t)(lf + 1 - head) : len;
+}
+
+/* statuses stored without explicit freshness (RFC 9110 section 15.1) */
+static int heuristic(unsigned status) {
+	switch (status) {
+	case RC_200_OK:
+	case RC_203_NON_AUTHORITATIVE_INFORMATION:
+	case RC_204_NO_CONTENT:
+	case RC_300_MULTIPLE_CHOICES:
+	case RC_301_MOVED_PERMANENTLY:
+	case 308:
+	case RC_404_NOT_FOUND:
+	case RC_405_METHOD_NOT_ALLOWED:
+	case RC_410_GONE:
+	case RC_414_REQUEST_URI_TOO_LONG:
+	case RC_501_NOT_IMPLEMENTED:
+		return 1;
+	}
+	return 0;
+}
+
+/* those and the ones stored with explicit freshness only */
+static int understood(unsigned status) {
+	return heuristic(status) || status == RC_302_FOUND || status == RC_307_TEMPORARY_REDIRECT;
+}
+
+/* fields describing the message rather than the representation, sent anew
+   with each response */
+static int framing(const struct slice *name) {
+	return !slice_str_cmp_ci_check(name, "content-length") ||
+		!slice_str_cmp_ci_check(name, "transfer-encoding") ||
+		!slice_str_cmp_ci_check(name, "age");
+}
+
+static int same_name(const struct slice *a, const struct slice *b) {
+	size_t i;
+
+	if (a->len != b->len) return 0;
+	for (i = 0; i < a->len && lower(a->ptr[i]) == lower(b->ptr[i]); ++i);
+	return i == a->len;
+}
+
+static int has_field(const char *head, size_t len, const struct slice *name) {
+	struct slice other, value;
+	size_t pos;
+
+	for (pos = fields_of(head, len); pos < len; ) {
+		pos = proxy_next_field(head, pos, len, &other, &value);
+		if (pos == 0) return 0;
+		if (same_name(&other, name)) return 1;
+	}
+	return 0;
+}
+
+/* append the field lines of `head` but framing ones and those `except`
+   (NULL if none) has */
+static void add_fields(struct text *t, const char *head, size_t len, const char *except, size_t except_len) {
+	struct slice name, value;
+	size_t pos, next;
+
+	for (pos = fields_of(head, len); pos < len; pos = next) {
+		next = proxy_next_field(head, pos, len, &name, &value);
+		if (next == 0) return;
+		if (framing(&name) || (except != NULL && has_field(except, except_len, &name))) continue;
+		text_add(t, head + pos, next - pos);
+	}
+}
+
+int pcache_storable(const struct http_request *req, const char *head, size_t head_len) {
+	static const struct slice star = {"*", 1};
+	struct cache_control cc;
+	struct slice name, value;
+	size_t pos;
+	unsigned status;
+	int expires = 0;
+
+	if (req->method != HM_GET || head_len < 12) return 0;
+	status = status_of(head);
+	if (!understood(status)) return 0;
+	request_cache_control(req, &cc);
+	if (cc.no_store) return 0;
+
+	cache_control_init(&cc);
+	for (pos = fields_of(head, head_len); pos < head_len; ) {
+		pos = proxy_next_field(head, pos, head_len, &name, &value);
+		if (pos == 0) return 0;
+		if (!slice_str_cmp_ci_check(&name, "cache-control")) {
+			cache_control_parse(&cc, &value);
+		} else if (!slice_str_cmp_ci_check(&name, "vary")) {
+			if (proxy_list_has(&value, &star)) return 0;
+		} else if (!slice_str_cmp_ci_check(&name, "set-cookie")) {
+			/* meant for one client, whatever the directives say */
+			return 0;
+		} else if (!slice_str_cmp_ci_check(&name, "expires")) {
+			expires = 1;
+		}
+	}
+	if (cc.no_store || cc.is_private) return 0;
+	if (headers_count(req, HH_AUTHORIZATION) > 0 && !cc.is_public && cc.s_maxage < 0 &&
+			!cc.must_revalidate) {
+		return 0;
+	}
+	return heuristic(status) || expires || cc.max_age >= 0 || cc.s_maxage >= 0;
+}
+
+/* the Age a head has, 0 if none */
+static long age_of(const char *head, size_t len) {
+	struct slice name, value;
+	size_t pos;
+	long age;
+
+	for (pos = fields_of(head, len); pos < len; ) {
+		pos = proxy_next_field(head, pos, len, &name, &value);
+		if (pos == 0) break;
+		if (!slice_str_cmp_ci_check(&name, "age")) {
+			age = delta_seconds(value.ptr, value.len);
+			return age > 0 ? age : 0;
+		}
+	}
+	return 0;
+}
+
+/* validators and freshness from the stored head (RFC 9111 section 4.2) */
+static void read_head(
+		struct pcache_entry *e,
+		long age,
+		time_t request_time,
+		time_t response_time
+) {
+	struct cache_control cc;
+	struct slice name, value;
+	size_t pos;
+	time_t date = -1, expires = -1;
+	long apparent, corrected;
+	int has_expires = 0;
+
+	free(e->etag);
+	e->etag = NULL;
+	e->etag_len = 0;
+	e->last_modified = -1;
+	cache_control_init(&cc);
+	for (pos = fields_of(e->head, e->head_len); pos < e->head_len; ) {
+		pos = proxy_next_field(e->head, pos, e->head_len, &name, &value);
+		if (pos == 0) break;
+		if (!slice_str_cmp_ci_check(&name, "cache-control")) {
+			cache_control_parse(&cc, &value);
+		} else if (!slice_str_cmp_ci_check(&name, "date")) {
+			if (parse_http_date(value.ptr, value.len, &date) == -1) date = -1;
+		} else if (!slice_str_cmp_ci_check(&name, "expires")) {
+			/* an invalid date means already expired */
+			has_expires = 1;
+			if (parse_http_date(value.ptr, value.len, &expires) == -1) expires = 0;
+		} else if (!slice_str_cmp_ci_check(&name, "last-modified")) {
+			if (parse_http_date(value.ptr, value.len, &e->last_modified) == -1) {
+				e->last_modified = -1;
+			}
+		} else if (!slice_str_cmp_ci_check(&name, "etag") && e->etag == NULL && value.len > 0) {
+			e->etag = malloc(value.len + 1);
+			if (e->etag == NULL) {
+				perror("pcache");
+				exit(1);
+			}
+			memcpy(e->etag, value.ptr, value.len);
+			e->etag[value.len] = '\0';
+			e->etag_len = value.len;
+		}
+	}
+
+	if (date == -1) date = response_time;
+	apparent = response_time > date ? (long)(response_time - date) : 0;
+	corrected = age + (response_time > request_time ? (long)(response_time - request_time) : 0);
+	e->initial_age = apparent > corrected ? apparent : corrected;
+	e->response_time = response_time;
+
+	if (cc.s_maxage >= 0) {
+		e->lifetime = cc.s_maxage;
+	} else if (cc.max_age >= 0) {
+		e->lifetime = cc.max_age;
+	} else if (has_expires) {
+		e->lifetime = expires > date ? (long)(expires - date) : 0;
+	} else if (e->last_modified != -1 && e->last_modified < date && heuristic(e->status)) {
+		e->lifetime = (long)(date - e->last_modified) / 10;
+		if (e->lifetime > HEURISTIC_MAX) e->lifetime = HEURISTIC_MAX;
+	} else {
+		e->lifetime = 0;
+	}
+	if (cc.no_cache) e->lifetime = 0;
+	/* s-maxage asks shared caches for proxy-revalidate as well */
+	e->must_revalidate = cc.must_revalidate || cc.no_cache || cc.s_maxage >= 0;
+	e->swr = e->must_revalidate || cc.stale_while_revalidate < 0 ? 0 : cc.stale_while_revalidate;
+}
+
+static long current_age(const struct pcache_entry *e, time_t now) {
+	return e->initial_age + (now > e->response_time ? (long)(now - e->response_time) : 0);
+}
+
+/* the Host and the target in origin-form, what a response is stored under;
+   an absolute-form target has its own authority, port included */
+static char *key_of(const struct http_request *req, size_t *len) {
+	struct text key = {NULL, 0, 0};
+	const char *target_end = req->raw_target.ptr + req->raw_target.len;
+	const struct slice *host = req->target_form == TF_ABSOLUTE ? &req->authority : &req->host;
+	char ch;
+	size_t i;
+
+	for (i = 0; i < host->len; ++i) {
+		ch = lower(host->ptr[i]);
+		text_add(&key, &ch, 1);
+	}
+	text_add(&key, " ", 1);
+	if (req->target_form == TF_ABSOLUTE) {
+		if (req->path.ptr == NULL || req->path.len == 0) text_add(&key, "/", 1);
+		if (req->path.ptr != NULL) {
+			text_add(&key, req->path.ptr, (size_t)(target_end - req->path.ptr));
+		}
+	} else {
+		text_add(&key, req->raw_target.ptr, req->raw_target.len);
+	}
+	*len = key.len;
+	return key.ptr;
+}
+
+/* the fields Vary names as `req` has them, "name:value\n" each, the values
+   of repeated lines joined */
+static char *variant_of(const char *vary, const struct http_request *req, size_t *len) {
+	struct text variant = {NULL, 0, 0};
+	struct slice name;
+	const char *end;
+	size_t i;
+	int first;
+
+	while (*vary != '\0') {
+		end = strchr(vary, ',');
+		if (end == NULL) end = vary + strlen(vary);
+		name = get_slice(vary, (size_t)(end - vary));
+		text_add(&variant, name.ptr, name.len);
+		text_add(&variant, ":", 1);
+		first = 1;
+		for (i = 0; i < req->num_headers; ++i) {
+			if (!same_name(&req->headers[i].name, &name)) continue;
+			if (!first) text_add(&variant, ",", 1);
+			text_add(&variant, req->headers[i].value.ptr, req->headers[i].value.len);
+			first = 0;
+		}
+		text_add(&variant, "\n", 1);
+		vary = *end == ',' ? end + 1 : end;
+	}
+	*len = variant.len;
+	return variant.ptr;
+}
+
+/* the names in the Vary fields of `head`, lowercased and comma separated;
+   NULL if none */
+static char *vary_of(const char *head, size_t len) {
+	struct text vary = {NULL, 0, 0};
+	struct slice name, value, item;
+	size_t pos, start, end, i;
+	char ch;
+
+	for (pos = fields_of(head, len); pos < len; ) {
+		pos = proxy_next_field(head, pos, len, &name, &value);
+		if (pos == 0) break;
+		if (slice_str_cmp_ci_check(&name, "vary")) continue;
+		for (start = 0; start < value.len; start = end + 1) {
+			for (end = start; end < value.len && value.ptr[end] != ','; ++end);
+			item = get_slice(value.ptr + start, end - start);
+			while (item.len > 0 && (*item.ptr == SYM_SP || *item.ptr == SYM_HTAB)) {
+				item.ptr++;
+				item.len--;
+			}
+			while (item.len > 0 && (item.ptr[item.len - 1] == SYM_SP ||
+					item.ptr[item.len - 1] == SYM_HTAB)) {
+				item.len--;
+			}
+			if (item.len == 0) continue;
+			if (vary.len > 0) text_add(&vary, ",", 1);
+			for (i = 0; i < item.len; ++i) {
+				ch = lower(item.ptr[i]);
+				text_add(&vary, &ch, 1);
+			}
+		}
+	}
+	return vary.ptr;
+}
+
+/* whether `e`, stored under the key of `req`, is the variant it selects */
+static int selects(const struct pcache_entry *e, const struct http_request *req) {
+	char *variant;
+	size_t len;
+	int same;
+
+	if (e->vary == NULL) return 1;
+	variant = variant_of(e->vary, req, &len);
+	same = len == e->variant_len && !memcmp(variant, e->variant, len);
+	free(variant);
+	return same;
+}
+
+static struct pcache_entry *find(
+		struct pcache *cache,
+		const struct http_request *req,
+		const char *key,
+		size_t key_len,
+		uint32_t hash
+) {
+	struct lru_node *node = lru_bucket(&cache->lru, hash);
+
+	for (; node != NULL; node = node->chain_next) {
+		struct pcache_entry *e = LRU_ENTRY(node, struct pcache_entry, node);
+		if (node->hash == hash && e->key_len == key_len && !memcmp(e->key, key, key_len) &&
+				selects(e, req)) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+void pcache_init(struct pcache *cache, size_t max_entries, size_t max_bytes) {
+	memset(cache, 0, sizeof *cache);
+	cache->max_entries = max_entries;
+	cache->max_bytes = max_bytes;
+	cache->slab_fd = -1;
+
+	lru_init(&cache->lru, max_entries);
+	cache->fetches = calloc(cache->lru.num_buckets, sizeof *cache->fetches);
+	if (cache->fetches == NULL) {
+		perror("pcache_init");
+		exit(1);
+	}
+}
+
+/* take `e` out of the index, it is freed unless held */
+static void drop(struct pcache *cache, struct pcache_entry *e) {
+	lru_remove(&cache->lru, &e->node);
+	cache->bytes -= e->size;
+	e->cached = 0;
+	pcache_unref(e);
+}
+
+void pcache_free(struct pcache *cache) {
+	struct slab_region *r;
+
+	while (cache->lru.lru_head != NULL) {
+		drop(cache, LRU_ENTRY(cache->lru.lru_head, struct pcache_entry, node));
+	}
+	while (cache->oldest != NULL) {
+		r = cache->oldest;
+		cache->oldest = r->next;
+		blob_unref(r->pin);
+		free(r);
+	}
+	if (cache->slab_fd != -1) close(cache->slab_fd);
+	lru_free(&cache->lru);
+	free(cache->fetches);
+}
+
+int pcache_open_slab(struct pcache *cache, const char *dir, size_t size) {
+	char path[4096];
+	int fd = open(dir, O_RDWR | O_TMPFILE | O_CLOEXEC, 0600);
+
+	if (fd == -1) {
+		/* no O_TMPFILE there: a file unlinked right away does as well */
+		if (strlen(dir) > sizeof path - 16) return -1;
+		sprintf(path, "%s/pcache.XXXXXX", dir);
+		fd = mkstemp(path);
+		if (fd == -1) return -1;
+		unlink(path);
+	}
+	if (ftruncate(fd, (off_t)size) == -1) {
+		close(fd);
+		return -1;
+	}
+	if (cache->slab_fd != -1) close(cache->slab_fd);
+	cache->slab_fd = fd;
+	cache->slab_size = size;
+	cache->slab_head = 0;
+	return 0;
+}
+
+/* whether writing `len` bytes at `off` overwrites `r` */
+static int in_the_way(const struct pcache *cache, const struct slab_region *r, size_t off, size_t len) {
+	/* wrapping around drops what lies past the head first, the oldest */
+	if (off < cache->slab_head && (size_t)r->off >= cache->slab_head) return 1;
+	return (size_t)r->off < off + len && (size_t)r->off + r->len > off;
+}
+
+/* a region no queue sends from, whose entry only the cache holds */
+static int reclaimable(const struct slab_region *r) {
+	if (r->entry == NULL) return r->pin->refs == 1;
+	return r->entry->cached && r->entry->refs == 1 && r->pin->refs == 2;
+}
+
+/* room for `len` bytes past the newest region, the oldest ones making way;
+   NULL if one of them is still in use */
+static struct slab_region *slab_alloc(struct pcache *cache, size_t len) {
+	struct slab_region *r;
+	size_t off = cache->slab_head;
+
+	if (len > cache->slab_size) return NULL;
+	if (off + len > cache->slab_size) off = 0;
+	for (r = cache->oldest; r != NULL && in_the_way(cache, r, off, len); r = r->next) {
+		if (!reclaimable(r)) return NULL;
+	}
+	while (cache->oldest != NULL && in_the_way(cache, cache->oldest, off, len)) {
+		r = cache->oldest;
+		cache->oldest = r->next;
+		if (cache->oldest == NULL) cache->newest = NULL;
+		if (r->entry != NULL) {
+			drop(cache, r->entry);
+			cache->stats.evictions++;
+		}
+		blob_unref(r->pin);
+		free(r);
+	}
+
+	r = malloc(sizeof *r);
+	if (r == NULL) {
+		perror("pcache");
+		exit(1);
+	}
+	r->off = (off_t)off;
+	r->len = len;
+	r->pin = blob_new(NULL, 0);
+	r->entry = NULL;
+	r->next = NULL;
+	if (cache->newest != NULL) cache->newest->next = r;
+	else cache->oldest = r;
+	cache->newest = r;
+	cache->slab_head = off + len;
+	return r;
+}
+
+static int write_all(int fd, const char *data, size_t len, off_t off) {
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(fd, data, len, off);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		data += n;
+		len -= (size_t)n;
+		off += n;
+	}
+	return 0;
+}
+
+static void account(struct pcache_entry *e) {
+	e->size = e->key_len + e->variant_len + e->head_len + (e->body != NULL ? e->body->len : 0);
+}
+
+struct pcache_entry *pcache_store(
+		struct pcache *cache,
+		const struct http_request *req,
+		char *data,
+		size_t head_len,
+		size_t body_len,
+		time_t request_time,
+		time_t response_time
+) {
+	struct text head = {NULL, 0, 0};
+	struct pcache_entry *e, *old;
+	struct slab_region *r = NULL;
+	uint32_t hash;
+
+	if (cache->max_entries == 0 || !pcache_storable(req, data, head_len)) {
+		free(data);
+		return NULL;
+	}
+	e = calloc(1, sizeof *e);
+	if (e == NULL) {
+		perror("pcache_store");
+		exit(1);
+	}
+	e->refs = 1;
+	e->status = status_of(data);
+	text_add(&head, data, fields_of(data, head_len));
+	add_fields(&head, data, head_len, NULL, 0);
+	e->head = head.ptr;
+	e->head_len = head.len;
+	read_head(e, age_of(data, head_len), request_time, response_time);
+	/* nothing to serve it for nor to revalidate it with */
+	if (e->lifetime <= 0 && e->etag == NULL && e->last_modified == -1) {
+		free(data);
+		pcache_unref(e);
+		return NULL;
+	}
+
+	e->key = key_of(req, &e->key_len);
+	hash = hash_bytes(e->key, e->key_len, HASH_SEED);
+	e->vary = vary_of(data, head_len);
+	if (e->vary != NULL) e->variant = variant_of(e->vary, req, &e->variant_len);
+	old = find(cache, req, e->key, e->key_len, hash);
+	if (old != NULL) drop(cache, old);
+
+	if (cache->slab_fd != -1 && body_len >= PCACHE_SLAB_MIN) r = slab_alloc(cache, body_len);
+	if (r != NULL && write_all(cache->slab_fd, data + head_len, body_len, r->off) == 0) {
+		e->region = r;
+		r->entry = e;
+		blob_ref(r->pin);
+		e->body_off = 0;
+		free(data);
+	} else {
+		/* a region that could not be written stays empty */
+		e->body = blob_new((unsigned char *)data, head_len + body_len);
+		e->body_off = head_len;
+	}
+	e->body_len = body_len;
+	account(e);
+	if (e->size > cache->max_bytes) {
+		pcache_unref(e);
+		return NULL;
+	}
+
+	lru_insert(&cache->lru, &e->node, hash);
+	e->cached = 1;
+	cache->bytes += e->size;
+	cache->stats.stored++;
+	while (cache->lru.count > cache->max_entries || cache->bytes > cache->max_bytes) {
+		drop(cache, LRU_ENTRY(cache->lru.lru_tail, struct pcache_entry, node));
+		cache->stats.evictions++;
+	}
+	return e;
+}
+
+int pcache_shares(
+		const struct http_request *req,
+		const struct http_request *other,
+		const char *head,
+		size_t head_len
+) {
+	char *vary, *variant, *other_variant;
+	size_t len, other_len;
+	int same;
+
+	if (!pcache_storable(req, head, head_len) || !pcache_storable(other, head, head_len)) return 0;
+	vary = vary_of(head, head_len);
+	if (vary == NULL) return 1;
+	variant = variant_of(vary, req, &len);
+	other_variant = variant_of(vary, other, &other_len);
+	same = len == other_len && !memcmp(variant, other_variant, len);
+	free(vary);
+	free(variant);
+	free(other_variant);
+	return same;
+}
+
+void pcache_refresh(
+		struct pcache *cache,
+		struct pcache_entry *e,
+		const char *head,
+		size_t head_len,
+		time_t request_time,
+		time_t response_time
+) {
+	struct text merged = {NULL, 0, 0};
+
+	/* the fields the 304 has replace the stored ones (RFC 9111 section
+	   3.2) */
+	text_add(&merged, e->head, fields_of(e->head, e->head_len));
+	add_fields(&merged, e->head, e->head_len, head, head_len);
+	add_fields(&merged, head, head_len, NULL, 0);
+	free(e->head);
+	e->head = merged.ptr;
+	e->head_len = merged.len;
+	read_head(e, age_of(head, head_len), request_time, response_time);
+
+	cache->stats.revalidated++;
+	if (!e->cached) return;
+	cache->bytes -= e->size;
+	account(e);
+	cache->bytes += e->size;
+	lru_touch(&cache->lru, &e->node);
+}
+
+enum pcache_result pcache_freshness(
+		const struct pcache_entry *e,
+		const struct http_request *req,
+		time_t now
+) {
+	struct cache_control cc;
+	long age = current_age(e, now);
+
+	request_cache_control(req, &cc);
+	if (cc.no_cache || (cc.max_age >= 0 && age > cc.max_age)) return PC_STALE;
+	if (age < e->lifetime) return PC_FRESH;
+	if (req->method == HM_GET && age - e->lifetime < e->swr) return PC_STALE_OK;
+	return PC_STALE;
+}
+
+enum pcache_result pcache_lookup(
+		struct pcache *cache,
+		const struct http_request *req,
+		time_t now,
+		struct pcache_entry **entry
+) {
+	enum pcache_result result = PC_MISS;
+	struct pcache_entry *e = NULL;
+	size_t key_len;
+	char *key;
+
+	if (cache->lru.count > 0) {
+		key = key_of(req, &key_len);
+		e = find(cache, req, key, key_len, hash_bytes(key, key_len, HASH_SEED));
+		free(key);
+	}
+	if (e != NULL) {
+		result = pcache_freshness(e, req, now);
+		lru_touch(&cache->lru, &e->node);
+	}
+	switch (result) {
+	case PC_FRESH:
+		cache->stats.hits++;
+		break;
+	case PC_STALE_OK:
+		cache->stats.stale_hits++;
+		break;
+	default:
+		cache->stats.misses++;
+	}
+	*entry = e;
+	return result;
+}
+
+static int not_modified_field(const struct slice *name) {
+	size_t i;
+	for (i = 0; i < sizeof not_modified_fields / sizeof not_modified_fields[0]; ++i) {
+		if (!slice_str_cmp_ci_check(name, not_modified_fields[i])) return 1;
+	}
+	return 0;
+}
+
+void pcache_respond(
+		const struct pcache *cache,
+		const struct pcache_entry *e,
+		const struct http_request *req,
+		struct http_response *resp,
+		time_t now
+) {
+	struct slice name, value;
+	size_t pos, next;
+	const char *etag = e->etag;
+	size_t etag_len = e->etag_len;
+
+	/* weak comparison, the listed tags lose their W/ too */
+	if (etag != NULL && etag_len > 2 && etag[0] == 'W' && etag[1] == '/') {
+		etag += 2;
+		etag_len -= 2;
+	}
+	if (e->status == RC_200_OK && (etag != NULL || e->last_modified != -1) &&
+			is_not_modified(req, etag != NULL ? etag : "", etag_len,
+				e->last_modified != -1 ? e->last_modified : (time_t)LONG_MAX)) {
+		append_to_response(resp, "HTTP/1.1 304 Not Modified" CRLF);
+		for (pos = fields_of(e->head, e->head_len); pos < e->head_len; pos = next) {
+			next = proxy_next_field(e->head, pos, e->head_len, &name, &value);
+			if (next == 0) break;
+			if (not_modified_field(&name)) append_to_response_n(resp, e->head + pos, next - pos);
+		}
+		append_connection_to_response(resp);
+		append_to_response(resp, CRLF);
+		resp->delimited = 1;
+		return;
+	}
+
+	append_to_response_n(resp, e->head, e->head_len);
+	append_to_response(resp, "Age: ");
+	append_size_to_response(resp, (size_t)current_age(e, now));
+	append_to_response(resp, CRLF);
+	append_length_to_response(resp, e->body_len);
+	append_connection_to_response(resp);
+	append_to_response(resp, CRLF);
+	if (req->method == HM_HEAD || e->body_len == 0) return;
+
+	/* queued like a static file: sendfile() from the slab, or memory sent
+	   with MSG_ZEROCOPY if large enough */
+	if (e->region != NULL) {
+		resp->body_fd = cache->slab_fd;
+		resp->body_blob = e->region->pin;
+		add_body_part(resp, BP_FILE, (size_t)e->region->off, e->body_len);
+	} else {
+		resp->body_mem = e->body->data;
+		resp->body_blob = e->body;
+		add_body_part(resp, BP_MEM, e->body_off, e->body_len);
+	}
+}
+
+char *pcache_validators(const struct pcache_entry *e) {
+	struct text lines = {NULL, 0, 0};
+	char date[HTTP_DATE_LEN + 1];
+
+	if (e->etag != NULL) {
+		text_puts(&lines, "If-None-Match: ");
+		text_add(&lines, e->etag, e->etag_len);
+		text_puts(&lines, CRLF);
+	}
+	if (e->last_modified != -1) {
+		format_http_date(e->last_modified, date);
+		text_puts(&lines, "If-Modified-Since: ");
+		text_puts(&lines, date);
+		text_puts(&lines, CRLF);
+	}
+	return lines.ptr;
+}
+
+void pcache_invalidate(struct pcache *cache, const struct http_request *req) {
+	struct lru_node *node, *next;
+	size_t key_len;
+	char *key;
+	uint32_t hash;
+
+	if (cache->lru.count == 0) return;
+	key = key_of(req, &key_len);
+	hash = hash_bytes(key, key_len, HASH_SEED);
+	for (node = lru_bucket(&cache->lru, hash); node != NULL; node = next) {
+		struct pcache_entry *e = LRU_ENTRY(node, struct pcache_entry, node);
+		next = node->chain_next;
+		if (node->hash == hash && e->key_len == key_len && !memcmp(e->key, key, key_len)) {
+			drop(cache, e);
+		}
+	}
+	free(key);
+}
+
+void pcache_remove(struct pcache *cache, struct pcache_entry *e) {
+	if (e->cached) drop(cache, e);
+}
+
+static struct pcache_fetch **fetch_link(
+		const struct pcache *cache,
+		const char *key,
+		size_t key_len,
+		uint32_t hash
+) {
+	struct pcache_fetch **link = cache->fetches + (hash & (cache->lru.num_buckets - 1));
+
+	while (*link != NULL && ((*link)->hash != hash || (*link)->key_len != key_len ||
+			memcmp((*link)->key, key, key_len))) {
+		link = &(*link)->next;
+	}
+	return link;
+}
+
+struct pcache_fetch *pcache_fetch_begin(struct pcache *cache, const struct http_request *req, void *owner) {
+	struct pcache_fetch *fetch, **link;
+	size_t key_len;
+	char *key = key_of(req, &key_len);
+	uint32_t hash = hash_bytes(key, key_len, HASH_SEED);
+
+	link = fetch_link(cache, key, key_len, hash);
+	if (*link != NULL) {
+		free(key);
+		return NULL;
+	}
+	fetch = malloc(sizeof *fetch);
+	if (fetch == NULL) {
+		perror("pcache_fetch_begin");
+		exit(1);
+	}
+	fetch->key = key;
+	fetch->key_len = key_len;
+	fetch->hash = hash;
+	fetch->owner = owner;
+	fetch->next = NULL;
+	*link = fetch;
+	return fetch;
+}
+
+void *pcache_fetching(const struct pcache *cache, const struct http_request *req) {
+	struct pcache_fetch *fetch;
+	size_t key_len;
+	char *key = key_of(req, &key_len);
+
+	fetch = *fetch_link(cache, key, key_len, hash_bytes(key, key_len, HASH_SEED));
+	free(key);
+	return fetch != NULL ? fetch->owner : NULL;
+}
+
+void pcache_fetch_end(struct pcache *cache, struct pcache_fetch *fetch) {
+	struct pcache_fetch **link = fetch_link(cache, fetch->key, fetch->key_len, fetch->hash);
+
+	*link = fetch->next;
+	free(fetch->key);
+	free(fetch);
+}
+
+struct pcache_entry *pcache_ref(struct pcache_entry *e) {
+	e->refs++;
+	return e;
+}
+
+void pcache_unref(struct pcache_entry *e) {
+	if (e == NULL || --e->refs > 0) return;
+	free(e->key);
+	free(e->vary);
+	free(e->variant);
+	free(e->head);
+	free(e->etag);
+	blob_unref(e->body);
+	if (e->region != NULL) {
+		e->region->entry = NULL;
+		blob_unref(e->region->pin);
+	}
+	free(e);
+}
@@ -0,0 +1,214 @@
+#ifndef PCACHE_H
+#define PCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include "blob.h"
+#include "lru.h"
+#include "request.h"
+#include "response.h"
+
+#define PCACHE_DEFAULT_ENTRIES 4096
+#define PCACHE_DEFAULT_BYTES (64ul << 20)
+
+/* largest body stored, it is gathered in memory first */
+#define PCACHE_MAX_BODY (16ul << 20)
+
+/* bodies from this size go to the slab file when there is one */
+#define PCACHE_SLAB_MIN (256ul << 10)
+
+/* Cache-Control directives a shared cache cares about */
+struct cache_control {
+	long max_age; /* -1 if absent */
+	long s_maxage;
+	long stale_while_revalidate;
+	unsigned no_store:1;
+	unsigned no_cache:1;
+	unsigned is_private:1;
+	unsigned is_public:1;
+	unsigned must_revalidate:1; /* or proxy-revalidate */
+};
+
+void cache_control_init(struct cache_control *cc);
+/* add the directives of one field value; unknown ones are ignored */
+void cache_control_parse(struct cache_control *cc, const struct slice *value);
+
+/* a span of the slab file, kept as long as queues send from it */
+struct slab_region {
+	off_t off;
+	size_t len;
+	struct blob *pin; /* one reference of ours, one per queued segment */
+	struct pcache_entry *entry; /* NULL once dropped */
+	struct slab_region *next; /* newer */
+};
+
+/* a stored response; one request may select it among the variants of its
+   key by the fields its Vary names */
+struct pcache_entry {
+	char *key;
+	size_t key_len;
+	char *vary; /* lowercased field names, comma separated; NULL if none */
+	char *variant; /* those fields as the storing request had them */
+	size_t variant_len;
+
+	unsigned status;
+	char *head; /* status line and fields, without framing, Age and the
+	               empty line */
+	size_t head_len;
+	struct blob *body; /* in memory, NULL if on the slab */
+	size_t body_off, body_len;
+	struct slab_region *region; /* NULL if in memory */
+
+	char *etag; /* NULL if none */
+	size_t etag_len;
+	time_t last_modified; /* -1 if none */
+
+	/* freshness, RFC 9111 section 4.2 */
+	time_t response_time;
+	long initial_age;
+	long lifetime;
+	long swr; /* stale-while-revalidate window, 0 if none */
+	unsigned must_revalidate:1;
+	unsigned revalidating:1; /* in the background, see proxy.h */
+
+	size_t size; /* counted against max_bytes, the slab aside */
+	size_t refs; /* the cache's one while indexed, and holders' */
+	int cached;
+	struct lru_node node;
+};
+
+struct pcache_stats {
+	size_t hits;
+	size_t stale_hits; /* served while revalidating */
+	size_t misses;
+	size_t revalidated; /* confirmed by a 304 */
+	size_t stored;
+	size_t evictions;
+	size_t coalesced; /* answered by the fetch of an identical request */
+};
+
+/* a response being fetched for a key, identical requests waiting on it */
+struct pcache_fetch {
+	char *key;
+	size_t key_len;
+	uint32_t hash;
+	void *owner;
+	struct pcache_fetch *next;
+};
+
+/* responses of every proxied route, bounded by entry count and by the
+   bytes held in memory; large bodies may go to a slab file written as a
+   ring, oldest first */
+struct pcache {
+	struct lru_table lru;
+	size_t max_entries;
+	size_t bytes, max_bytes;
+
+	int slab_fd; /* -1 if none */
+	size_t slab_size, slab_head;
+	struct slab_region *oldest, *newest;
+
+	struct pcache_fetch **fetches; /* lru.num_buckets of them */
+
+	struct pcache_stats stats;
+};
+
+void pcache_init(struct pcache *cache, size_t max_entries, size_t max_bytes);
+void pcache_free(struct pcache *cache);
+
+/* back large bodies with an unlinked file of `size` bytes in `dir`; -1 if
+   it cannot be created */
+int pcache_open_slab(struct pcache *cache, const char *dir, size_t size);
+
+enum pcache_result {
+	PC_MISS = 0,
+	PC_FRESH,
+	PC_STALE_OK, /* a GET within stale-while-revalidate */
+	PC_STALE /* to be revalidated first, counted as a miss */
+};
+
+/* how usable `e` is for `req` at `now`, request directives included */
+enum pcache_result pcache_freshness(
+		const struct pcache_entry *e,
+		const struct http_request *req,
+		time_t now
+);
+
+/* the variant `req` selects into `entry` (NULL on a miss) and how usable it
+   is; the entry stays valid until the cache changes unless referenced */
+enum pcache_result pcache_lookup(
+		struct pcache *cache,
+		const struct http_request *req,
+		time_t now,
+		struct pcache_entry **entry
+);
+
+/* answer `req` with `e`: a 304 if the client's copy is current, the head
+   alone for HEAD */
+void pcache_respond(
+		const struct pcache *cache,
+		const struct pcache_entry *e,
+		const struct http_request *req,
+		struct http_response *resp,
+		time_t now
+);
+
+/* 1 if a response to `req` with the head `head` (as proxied, without the
+   empty line) may be stored */
+int pcache_storable(const struct http_request *req, const char *head, size_t head_len);
+
+/* store the response in `data` (malloc'd, taken over): its head as for
+   pcache_storable() then `body_len` bytes of body; it replaces the variant
+   `req` selected. `request_time` and `response_time` are when the request
+   went and when the head came back. The new entry or NULL if not kept */
+struct pcache_entry *pcache_store(
+		struct pcache *cache,
+		const struct http_request *req,
+		char *data,
+		size_t head_len,
+		size_t body_len,
+		time_t request_time,
+		time_t response_time
+);
+
+/* 1 if the response with head `head` (as for pcache_storable()) to `req`
+   may answer `other`, a request for the same key, as well: storable for
+   both, they agree on the fields its Vary names */
+int pcache_shares(
+		const struct http_request *req,
+		const struct http_request *other,
+		const char *head,
+		size_t head_len
+);
+
+/* a 304 with head `head` confirmed `e` */
+void pcache_refresh(
+		struct pcache *cache,
+		struct pcache_entry *e,
+		const char *head,
+		size_t head_len,
+		time_t request_time,
+		time_t response_time
+);
+
+/* If-None-Match and If-Modified-Since lines (CRLF terminated, malloc'd) to
+   revalidate `e`, NULL if it has no validator */
+char *pcache_validators(const struct pcache_entry *e);
+
+/* drop every variant of the key of `req`, which changes the resource */
+void pcache_invalidate(struct pcache *cache, const struct http_request *req);
+/* drop `e` if still there */
+void pcache_remove(struct pcache *cache, struct pcache_entry *e);
+
+/* note that `owner` fetches the key of `req`, NULL if some other one does */
+struct pcache_fetch *pcache_fetch_begin(struct pcache *cache, const struct http_request *req, void *owner);
+/* the owner of the fetch of the key of `req`, NULL if none */
+void *pcache_fetching(const struct pcache *cache, const struct http_request *req);
+void pcache_fetch_end(struct pcache *cache, struct pcache_fetch *fetch);
+
+struct pcache_entry *pcache_ref(struct pcache_entry *e);
+void pcache_unref(struct pcache_entry *e);
+
+#endif
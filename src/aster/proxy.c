@@ -0,0 +1,1058 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "datetime.h"
+#include "pcache.h"
+#include "proxy.h"
+#include "response.h"
+#include "str.h"
+
+/* fields that only concern one connection, besides those Connection names;
+   Transfer-Encoding stays as chunked bodies are relayed with their framing */
+static const char *const hop_by_hop[] = {
+	"connection",
+	"keep-alive",
+	"proxy-connection",
+	"te",
+	"upgrade"
+};
+
+/* what goes upstream is small, never worth pinning */
+static struct zerocopy no_zerocopy;
+
+static void trim(struct slice *sl) {
+	while (sl->len > 0 && (*sl->ptr == SYM_SP || *sl->ptr == SYM_HTAB)) {
+		sl->ptr++;
+		sl->len--;
+	}
+	while (sl->len > 0 && (sl->ptr[sl->len - 1] == SYM_SP || sl->ptr[sl->len - 1] == SYM_HTAB)) {
+		sl->len--;
+	}
+}
+
+int proxy_list_has(const struct slice *list, const struct slice *token) {
+	struct slice item;
+	size_t pos = 0, end, i;
+
+	while (pos <= list->len) {
+		for (end = pos; end < list->len && list->ptr[end] != ','; ++end);
+		item = get_slice(list->ptr + pos, end - pos);
+		trim(&item);
+		if (item.len == token->len) {
+			for (i = 0; i < item.len && lower(item.ptr[i]) == lower(token->ptr[i]); ++i);
+			if (i == item.len) return 1;
+		}
+		pos = end + 1;
+	}
+	return 0;
+}
+
+static int is_hop_by_hop(const struct slice *name) {
+	size_t i;
+	for (i = 0; i < sizeof hop_by_hop / sizeof hop_by_hop[0]; ++i) {
+		if (!slice_str_cmp_ci_check(name, hop_by_hop[i])) return 1;
+	}
+	return 0;
+}
+
+size_t proxy_next_field(const char *buf, size_t pos, size_t end, struct slice *name, struct slice *value) {
+	const char *line = buf + pos, *eol, *colon;
+	size_t i;
+
+	eol = memchr(line, SYM_LF, end - pos);
+	if (eol == NULL || eol == line || eol[-1] != SYM_CR) return 0;
+	colon = memchr(line, ':', (size_t)(eol - line));
+	if (colon == NULL || colon == line) return 0;
+	*name = get_slice(line, (size_t)(colon - line));
+	for (i = 0; i < name->len; ++i) {
+		if (!is_tchar(name->ptr[i])) return 0;
+	}
+	*value = get_slice(colon + 1, (size_t)(eol - 1 - (colon + 1)));
+	trim(value);
+	return (size_t)(eol + 1 - buf);
+}
+
+static int digits_value(const struct slice *sl, size_t *out) {
+	size_t value = 0, i;
+
+	if (sl->len == 0) return -1;
+	for (i = 0; i < sl->len; ++i) {
+		if (!is_digit(sl->ptr[i]) || value > ((size_t)-1 >> 1) / 10) return -1;
+		value = value * 10 + (size_t)(sl->ptr[i] - '0');
+	}
+	*out = value;
+	return 0;
+}
+
+long proxy_parse_head(const char *buf, size_t len, struct proxy_head *head) {
+	static const struct slice close_token = {"close", 5};
+	static const struct slice keep_alive_token = {"keep-alive", 10};
+	const char *end = NULL;
+	struct slice name, value, last;
+	size_t pos, head_len, length, i;
+	int has_te = 0;
+
+	for (pos = 3; pos < len; ++pos) {
+		if (!memcmp(buf + pos - 3, CRLF CRLF, 4)) {
+			end = buf + pos + 1;
+			break;
+		}
+	}
+	if (end == NULL) return 0;
+	head_len = (size_t)(end - buf);
+
+	/* HTTP/1.x SP 3DIGIT SP reason CRLF */
+	if (head_len < 16 || memcmp(buf, "HTTP/1.", 7) || !is_digit(buf[7]) ||
+			buf[8] != SYM_SP || !is_digit(buf[9]) || !is_digit(buf[10]) ||
+			!is_digit(buf[11]) || (buf[12] != SYM_SP && buf[12] != SYM_CR)) {
+		return -1;
+	}
+	head->http_minor = (uint8_t)(buf[7] - '0');
+	head->status = (unsigned)((buf[9] - '0') * 100 + (buf[10] - '0') * 10 + buf[11] - '0');
+	head->content_length = -1;
+	head->chunked = 0;
+	head->keep_alive = head->http_minor >= 1;
+	head->fields = (size_t)((const char *)memchr(buf, SYM_LF, head_len) - buf) + 1;
+	head->len = head_len;
+	if (buf[head->fields - 2] != SYM_CR) return -1;
+
+	for (pos = head->fields; pos < head_len - 2; ) {
+		pos = proxy_next_field(buf, pos, head_len, &name, &value);
+		if (pos == 0) return -1;
+		if (!slice_str_cmp_ci_check(&name, "content-length")) {
+			if (digits_value(&value, &length) == -1) return -1;
+			if (head->content_length != -1 && (size_t)head->content_length != length) {
+				return -1;
+			}
+			head->content_length = (ssize_t)length;
+		} else if (!slice_str_cmp_ci_check(&name, "transfer-encoding")) {
+			/* chunked has to be the last coding, the body ends at close
+			   otherwise */
+			has_te = 1;
+			last = value;
+			for (i = value.len; i > 0 && value.ptr[i - 1] != ','; --i);
+			last.ptr += i;
+			last.len -= i;
+			trim(&last);
+			head->chunked = !slice_str_cmp_ci_check(&last, "chunked");
+		} else if (!slice_str_cmp_ci_check(&name, "connection")) {
+			if (proxy_list_has(&value, &close_token)) head->keep_alive = 0;
+			else if (proxy_list_has(&value, &keep_alive_token)) head->keep_alive = 1;
+		}
+	}
+	if (has_te) {
+		/* Transfer-Encoding overrides Content-Length, which makes the
+		   connection suspect */
+		if (head->content_length != -1) head->keep_alive = 0;
+		head->content_length = -1;
+		if (!head->chunked) head->keep_alive = 0;
+	}
+	return (long)head_len;
+}
+
+static unsigned hex_value(char ch) {
+	return ch <= '9' ? (unsigned)(ch - '0') : (unsigned)(lower(ch) - 'a' + 10);
+}
+
+long chunk_scan(struct chunk_scan *scan, const char *buf, size_t len) {
+	size_t pos = 0, n;
+	char ch;
+
+	while (pos < len && scan->state != CK_DONE) {
+		ch = buf[pos];
+		switch (scan->state) {
+		case CK_SIZE:
+			if (is_hexdig(ch)) {
+				if (scan->left > ((size_t)-1 >> 4)) return -1;
+				scan->left = scan->left << 4 | hex_value(ch);
+				scan->digits++;
+			} else if (scan->digits == 0) {
+				return -1;
+			} else if (ch == ';' || ch == SYM_SP || ch == SYM_HTAB) {
+				scan->state = CK_EXT;
+			} else if (ch == SYM_CR) {
+				scan->state = CK_SIZE_LF;
+			} else {
+				return -1;
+			}
+			break;
+		case CK_EXT:
+			if (ch == SYM_LF) return -1;
+			if (ch == SYM_CR) scan->state = CK_SIZE_LF;
+			break;
+		case CK_SIZE_LF:
+			if (ch != SYM_LF) return -1;
+			scan->state = scan->left > 0 ? CK_DATA : CK_TRAILER;
+			break;
+		case CK_DATA:
+			n = len - pos < scan->left ? len - pos : scan->left;
+			scan->left -= n;
+			pos += n;
+			if (scan->left == 0) scan->state = CK_DATA_CR;
+			continue;
+		case CK_DATA_CR:
+			if (ch != SYM_CR) return -1;
+			scan->state = CK_DATA_LF;
+			break;
+		case CK_DATA_LF:
+			if (ch != SYM_LF) return -1;
+			scan->state = CK_SIZE;
+			scan->digits = 0;
+			break;
+		case CK_TRAILER:
+			scan->state = ch == SYM_CR ? CK_END_LF : CK_TRAILER_LINE;
+			break;
+		case CK_TRAILER_LINE:
+			if (ch == SYM_LF) scan->state = CK_TRAILER;
+			break;
+		case CK_END_LF:
+			if (ch != SYM_LF) return -1;
+			scan->state = CK_DONE;
+			break;
+		case CK_DONE:
+			break;
+		}
+		pos++;
+	}
+	return (long)pos;
+}
+
+static void push_str(struct outq *q, const char *str) {
+	outq_push_mem(q, str, strlen(str), NULL, NULL);
+}
+
+/* whether the request field is for this hop only */
+static int request_hop(const struct http_request *req, const struct http_header *header) {
+	size_t i;
+
+	if (is_hop_by_hop(&header->name)) return 1;
+	for (i = headers_first(req, HH_CONNECTION); i != SIZE_MAX; i = headers_next(req, i)) {
+		if (proxy_list_has(&req->headers[i].value, &header->name)) return 1;
+	}
+	return 0;
+}
+
+void proxy_push_request(struct outq *q, const struct http_request *req, const char *validators) {
+	const struct http_header *header, *first = NULL, *last = NULL;
+	const char *target_end;
+	size_t i;
+
+	push_str(q, method_name(req->method));
+	push_str(q, " ");
+	if (req->target_form == TF_ABSOLUTE) {
+		/* origin-form for the origin server */
+		target_end = req->raw_target.ptr + req->raw_target.len;
+		if (req->path.ptr == NULL || req->path.len == 0) push_str(q, "/");
+		if (req->path.ptr != NULL) {
+			outq_push_mem(q, req->path.ptr, (size_t)(target_end - req->path.ptr), NULL, NULL);
+		}
+	} else {
+		outq_push_mem(q, req->raw_target.ptr, req->raw_target.len, NULL, NULL);
+	}
+	/* a 1.0 client could not take a chunked body, which 1.1 allows */
+	push_str(q, req->http_minor >= 1 ? " HTTP/1.1" CRLF : " HTTP/1.0" CRLF "Connection: keep-alive" CRLF);
+	/* the target names the origin, whatever the Host (RFC 9112 section 3.2.2) */
+	if (req->target_form == TF_ABSOLUTE) {
+		push_str(q, "Host: ");
+		outq_push_mem(q, req->authority.ptr, req->authority.len, NULL, NULL);
+		push_str(q, CRLF);
+	}
+
+	/* runs of kept fields go out as the client sent them, OWS and CRLF
+	   in between */
+	for (i = 0; i <= req->num_headers; ++i) {
+		header = i < req->num_headers ? req->headers + i : NULL;
+		if (header != NULL && !request_hop(req, header) && (validators == NULL ||
+				(header->type != HH_IF_NONE_MATCH && header->type != HH_IF_MODIFIED_SINCE)) &&
+				(header->type != HH_HOST || req->target_form != TF_ABSOLUTE)) {
+			if (first == NULL) first = header;
+			last = header;
+			continue;
+		}
+		if (first != NULL) {
+			outq_push_mem(q, first->name.ptr,
+				(size_t)(last->value.ptr + last->value.len - first->name.ptr), NULL, NULL);
+			push_str(q, CRLF);
+			first = NULL;
+		}
+	}
+	if (validators != NULL) push_str(q, validators);
+	push_str(q, CRLF);
+}
+
+static void upstream_event(struct evloop *loop, struct ev_source *src, unsigned events);
+
+void proxy_call_init(
+		struct proxy_call *call,
+		struct evloop *loop,
+		struct upstream *up,
+		const struct http_request *req,
+		struct outq *to_client,
+		void (*notify)(struct proxy_call *call),
+		void *owner
+) {
+	memset(call, 0, sizeof *call);
+	call->src.fd = -1;
+	call->src.handle = upstream_event;
+	call->loop = loop;
+	call->up = up;
+	call->req = req;
+	call->state = PX_CONNECTING;
+	call->reusable = 1;
+	up->outstanding++;
+	outq_init(&call->to_upstream);
+	call->req_pipe.rd = call->req_pipe.wr = -1;
+	call->resp_pipe.rd = call->resp_pipe.wr = -1;
+	call->to_client = to_client;
+	call->notify = notify;
+	call->owner = owner;
+}
+
+/* response bytes the client takes now, none while a follower lags */
+static size_t client_room(const struct proxy_call *call) {
+	const struct proxy_follower *f;
+
+	if (call->to_client->bytes >= PROXY_BUFFER) return 0;
+	for (f = call->followers; f != NULL; f = f->next) {
+		if (f->state == FW_STREAMING && f->to_client->bytes >= PROXY_FOLLOW_LAG) return 0;
+	}
+	return PROXY_BUFFER - call->to_client->bytes;
+}
+
+/* the watched events follow what each side has room for */
+static void update_events(struct proxy_call *call) {
+	unsigned events = 0;
+
+	if (call->state >= PX_DONE) return;
+	if (call->state == PX_CONNECTING || call->to_upstream.bytes > 0) events |= EPOLLOUT;
+	if (call->state != PX_CONNECTING && client_room(call) > 0) events |= EPOLLIN;
+	if (events != call->events && evloop_mod(call->loop, &call->src, events) == 0) {
+		call->events = events;
+	}
+}
+
+struct relay_pipe *relay_pipe_get(struct relay_pipe *p) {
+	int fds[2];
+
+	if (p->rd != -1) return p;
+	if (p->failed) return NULL;
+	if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+		p->failed = 1;
+		return NULL;
+	}
+	/* whatever may be queued must fit, a full pipe would stall the relay */
+	if (fcntl(fds[1], F_SETPIPE_SZ, (int)PROXY_BUFFER) < (int)PROXY_BUFFER) {
+		close(fds[0]);
+		close(fds[1]);
+		p->failed = 1;
+		return NULL;
+	}
+	p->rd = fds[0];
+	p->wr = fds[1];
+	return p;
+}
+
+void relay_pipe_close(struct relay_pipe *p) {
+	if (p->rd == -1) return;
+	close(p->rd);
+	close(p->wr);
+	p->rd = p->wr = -1;
+}
+
+/* give the connection back to the pool, or close it */
+static void release_upstream(struct proxy_call *call, int reusable) {
+	if (call->src.fd == -1) return;
+	evloop_del(call->loop, &call->src);
+	upstream_release(call->up, call->src.fd, reusable);
+	call->src.fd = -1;
+	call->events = 0;
+}
+
+/* send on an idle connection, or on a new one if `fresh` */
+static int open_upstream(struct proxy_call *call, int fresh) {
+	int fd = fresh ? -1 : upstream_take(call->up);
+
+	call->reused = fd != -1;
+	if (fd == -1) fd = upstream_open(call->up);
+	if (fd == -1) return -1;
+	call->src.fd = fd;
+	if (evloop_add(call->loop, &call->src, EPOLLOUT) == -1) {
+		close(fd);
+		call->src.fd = -1;
+		return -1;
+	}
+	zc_socket_init(&call->zs, fd);
+	call->events = EPOLLOUT;
+	call->state = call->reused ? PX_WAITING : PX_CONNECTING;
+	return 0;
+}
+
+static void keep_add(struct proxy_call *call, const char *ptr, size_t n) {
+	if (call->keep_len + n > call->keep_cap) {
+		while (call->keep_len + n > call->keep_cap) call->keep_cap *= 2;
+		call->keep = realloc(call->keep, call->keep_cap);
+		if (call->keep == NULL) {
+			perror("proxy");
+			exit(1);
+		}
+	}
+	memcpy(call->keep + call->keep_len, ptr, n);
+	call->keep_len += n;
+}
+
+static void drop_keep(struct proxy_call *call) {
+	free(call->keep);
+	call->keep = NULL;
+}
+
+/* start keeping the response, sized for the head and a known body */
+static void start_keep(struct proxy_call *call) {
+	call->keep_cap = call->head.len;
+	if (call->head.content_length > 0) call->keep_cap += (size_t)call->head.content_length;
+	call->keep = malloc(call->keep_cap);
+	if (call->keep == NULL) {
+		perror("proxy");
+		exit(1);
+	}
+	call->keep_len = 0;
+	call->keep_head = 0;
+}
+
+/* body bytes for the cache, past PCACHE_MAX_BODY the response is not kept */
+static void keep_body(struct proxy_call *call, const char *ptr, size_t n) {
+	if (call->keep == NULL) return;
+	if (call->keep_len - call->keep_head + n > PCACHE_MAX_BODY) {
+		drop_keep(call);
+		return;
+	}
+	keep_add(call, ptr, n);
+}
+
+static void unlink_follower(struct proxy_follower *f) {
+	if (f->prev != NULL) f->prev->next = f->next;
+	else f->leader->followers = f->next;
+	if (f->next != NULL) f->next->prev = f->prev;
+	f->leader = NULL;
+	f->prev = f->next = NULL;
+}
+
+/* let go of `f`, which is in `state` now */
+static void unfollow(struct proxy_follower *f, enum follow_state state) {
+	unlink_follower(f);
+	f->state = state;
+	f->notify(f);
+}
+
+static void notify_followers(struct proxy_call *call) {
+	struct proxy_follower *f;
+	for (f = call->followers; f != NULL; f = f->next) {
+		f->notify(f);
+	}
+}
+
+/* no more followers once the head came */
+static void stop_leading(struct proxy_call *call) {
+	if (call->fetch == NULL) return;
+	pcache_fetch_end(call->cache, call->fetch);
+	call->fetch = NULL;
+}
+
+static void bad_gateway(struct http_response *resp) {
+	char date[HTTP_DATE_LEN + 1] = {0};
+
+	get_current_time(date);
+	empty_response(resp, RC_502_BAD_GATEWAY, date);
+}
+
+/* the call ended before its head: the followers get what its client got,
+   `e` answering each as its request asks, a 502 if NULL */
+static void answer_followers(struct proxy_call *call, const struct pcache_entry *e) {
+	struct http_response resp;
+	time_t now = time(NULL);
+
+	while (call->followers != NULL) {
+		resp = new_response();
+		if (e != NULL) {
+			pcache_respond(call->cache, e, call->followers->req, &resp, now);
+		} else {
+			bad_gateway(&resp);
+		}
+		call->cache->stats.coalesced++;
+		if (outq_push_response(call->followers->to_client, &resp) == -1) {
+			/* a body from the slab not queued whole */
+			perror("dup");
+			unfollow(call->followers, FW_BROKEN);
+		} else {
+			unfollow(call->followers, FW_DONE);
+		}
+	}
+}
+
+/* the followers the response may answer as well get its head, the others
+   have to go alone */
+static void share_head(struct proxy_call *call) {
+	static const char end[] = "Connection: close" CRLF CRLF;
+	struct proxy_follower *f, *next;
+	struct blob *head = NULL;
+	unsigned char *data;
+
+	if (call->keep != NULL) {
+		data = malloc(call->keep_head + sizeof end - 1);
+		if (data == NULL) {
+			perror("proxy");
+			exit(1);
+		}
+		memcpy(data, call->keep, call->keep_head);
+		memcpy(data + call->keep_head, end, sizeof end - 1);
+		head = blob_new(data, call->keep_head + sizeof end - 1);
+	}
+	for (f = call->followers; f != NULL; f = next) {
+		next = f->next;
+		if (head != NULL && pcache_shares(call->req, f->req, call->keep, call->keep_head)) {
+			outq_push_mem(f->to_client, (const char *)head->data, head->len, NULL, head);
+			f->state = FW_STREAMING;
+			call->cache->stats.coalesced++;
+			f->notify(f);
+		} else {
+			unfollow(f, FW_RELEASED);
+		}
+	}
+	blob_unref(head);
+}
+
+/* the backend is done with the call, as far as balancing goes */
+static void leave(struct proxy_call *call) {
+	if (call->state < PX_DONE) call->up->outstanding--;
+}
+
+static void finish(struct proxy_call *call) {
+	if (call->keep != NULL && call->state == PX_RELAYING) {
+		pcache_store(call->cache, call->req, call->keep, call->keep_head,
+			call->keep_len - call->keep_head, call->sent_at, call->head_at);
+		call->keep = NULL;
+	}
+	stop_leading(call);
+	leave(call);
+	release_upstream(call, call->reusable && call->head.keep_alive &&
+		call->to_upstream.bytes == 0 && call->body_left == 0);
+	if (call->state != PX_BROKEN) call->state = PX_DONE;
+	while (call->followers != NULL) {
+		unfollow(call->followers, FW_DONE);
+	}
+	call->notify(call);
+}
+
+/* before the head the client gets a 502, past it a truncated response */
+static void fail(struct proxy_call *call) {
+	struct http_response resp;
+	struct pcache_entry *stale = NULL;
+
+	stop_leading(call);
+	leave(call);
+	release_upstream(call, 0);
+	free(call->buf);
+	call->buf = NULL;
+	drop_keep(call);
+	upstream_failed(call->up, time(NULL));
+	if (call->state == PX_RELAYING) {
+		call->state = PX_BROKEN;
+		while (call->followers != NULL) {
+			unfollow(call->followers, FW_BROKEN);
+		}
+	} else {
+		call->up->stats.failures++;
+		resp = new_response();
+		/* a stale response beats none (RFC 9111 section 4.2.4) */
+		if (call->stale != NULL && !call->stale->must_revalidate) stale = call->stale;
+		if (stale != NULL) {
+			pcache_respond(call->cache, stale, call->req, &resp, time(NULL));
+		} else {
+			bad_gateway(&resp);
+		}
+		if (outq_push_response(call->to_client, &resp) == -1) {
+			perror("dup");
+			call->state = PX_BROKEN;
+		} else {
+			call->state = PX_DONE;
+		}
+		answer_followers(call, stale);
+	}
+	call->notify(call);
+}
+
+/* an idle connection may have been closed by the backend just as it was
+   taken: a request that is safe to repeat goes again on a new one */
+static void retry_or_fail(struct proxy_call *call) {
+	if (call->reused && !call->retried && call->state == PX_WAITING && call->len == 0 &&
+			call->req->content_length == 0 && call->req->method != HM_POST) {
+		call->retried = 1;
+		call->up->stats.stale++;
+		release_upstream(call, 0);
+		outq_free(&call->to_upstream);
+		outq_init(&call->to_upstream);
+		proxy_push_request(&call->to_upstream, call->req, call->validators);
+		if (open_upstream(call, 1) == 0) return;
+	}
+	fail(call);
+}
+
+void proxy_call_cache(struct proxy_call *call, struct pcache *cache, struct pcache_entry *stale) {
+	call->cache = cache;
+	call->stale = stale;
+	if (stale != NULL) call->validators = pcache_validators(stale);
+}
+
+int proxy_call_lead(struct proxy_call *call) {
+	call->fetch = pcache_fetch_begin(call->cache, call->req, call);
+	return call->fetch != NULL ? 0 : -1;
+}
+
+struct proxy_call *proxy_call_leading(struct pcache *cache, const struct http_request *req) {
+	return pcache_fetching(cache, req);
+}
+
+void proxy_follow(
+		struct proxy_call *leader,
+		struct proxy_follower *f,
+		const struct http_request *req,
+		struct outq *to_client,
+		void (*notify)(struct proxy_follower *f),
+		void *owner
+) {
+	f->loop = leader->loop;
+	f->req = req;
+	f->to_client = to_client;
+	f->state = FW_WAITING;
+	f->leader = leader;
+	f->prev = NULL;
+	f->next = leader->followers;
+	if (leader->followers != NULL) leader->followers->prev = f;
+	leader->followers = f;
+	f->up = NULL;
+	f->stale = NULL;
+	f->since = time(NULL);
+	f->notify = notify;
+	f->owner = owner;
+}
+
+void proxy_unfollow(struct proxy_follower *f) {
+	struct proxy_call *call = f->leader;
+
+	if (call == NULL) return;
+	unlink_follower(f);
+	/* it may have held the upstream back */
+	update_events(call);
+}
+
+void proxy_call_start(struct proxy_call *call, const char *body, size_t len) {
+	size_t expected = call->req->content_length > 0 ? (size_t)call->req->content_length : 0;
+
+	/* anything past the body is not for this request */
+	if (len > expected) len = expected;
+	call->sent_at = time(NULL);
+	proxy_push_request(&call->to_upstream, call->req, call->validators);
+	if (len > 0) outq_push_mem(&call->to_upstream, body, len, NULL, NULL);
+	call->body_left = expected - len;
+	if (open_upstream(call, 0) == -1) fail(call);
+}
+
+size_t proxy_call_room(const struct proxy_call *call) {
+	size_t room;
+
+	if (call->state >= PX_DONE || call->to_upstream.bytes >= PROXY_BUFFER) return 0;
+	room = PROXY_BUFFER - call->to_upstream.bytes;
+	return room < call->body_left ? room : call->body_left;
+}
+
+ssize_t proxy_call_pull(struct proxy_call *call, int fd) {
+	size_t room = proxy_call_room(call);
+	struct relay_pipe *p = relay_pipe_get(&call->req_pipe);
+	ssize_t n;
+	char *data;
+
+	if (p != NULL) {
+		n = splice(fd, NULL, p->wr, NULL, room, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n > 0) {
+			outq_push_pipe(&call->to_upstream, p->rd, (size_t)n);
+			call->up->stats.spliced += (size_t)n;
+		}
+	} else {
+		if (room > PROXY_READ) room = PROXY_READ;
+		data = malloc(room);
+		if (data == NULL) {
+			perror("proxy");
+			exit(1);
+		}
+		n = recv(fd, data, room, 0);
+		if (n > 0) {
+			outq_push_mem(&call->to_upstream, data, (size_t)n, data, NULL);
+		} else {
+			free(data);
+		}
+	}
+	if (n > 0) {
+		call->body_left -= (size_t)n;
+		update_events(call);
+	}
+	return n;
+}
+
+void proxy_call_resume(struct proxy_call *call) {
+	update_events(call);
+}
+
+void proxy_call_free(struct proxy_call *call) {
+	leave(call);
+	call->state = PX_DONE;
+	release_upstream(call, 0);
+	outq_free(&call->to_upstream);
+	relay_pipe_close(&call->req_pipe);
+	relay_pipe_close(&call->resp_pipe);
+	free(call->buf);
+	call->buf = NULL;
+	drop_keep(call);
+	free(call->validators);
+	call->validators = NULL;
+	pcache_unref(call->stale);
+	call->stale = NULL;
+	stop_leading(call);
+	while (call->followers != NULL) {
+		unfollow(call->followers,
+			call->followers->state == FW_WAITING ? FW_RELEASED : FW_BROKEN);
+	}
+}
+
+/* a run of the head, for the client unless `q` is NULL, and for the cache */
+static void emit(struct proxy_call *call, struct outq *q, const char *ptr, size_t n) {
+	if (q != NULL) outq_push_mem(q, ptr, n, NULL, NULL);
+	if (call->keep != NULL) keep_add(call, ptr, n);
+}
+
+/* the head minus hop-by-hop fields, whole lines at a time */
+static void push_head(struct proxy_call *call, struct outq *q) {
+	static const struct slice connection = {"connection", 10};
+	const char *buf = call->buf;
+	size_t end = call->head.len - 2, pos, next, run, p;
+	struct slice name, value, other_name, other_value;
+	int drop;
+
+	emit(call, q, "HTTP/1.1", 8);
+	run = 8;
+	for (pos = call->head.fields; pos < end; pos = next) {
+		next = proxy_next_field(buf, pos, call->head.len, &name, &value);
+		drop = is_hop_by_hop(&name);
+		for (p = call->head.fields; !drop && p < end; ) {
+			p = proxy_next_field(buf, p, call->head.len, &other_name, &other_value);
+			drop = !slice_str_cmp_ci_check(&other_name, connection.ptr) &&
+				proxy_list_has(&other_value, &name);
+		}
+		if (!drop) continue;
+		if (pos > run) emit(call, q, buf + run, pos - run);
+		run = next;
+	}
+	if (end > run) emit(call, q, buf + run, end - run);
+	if (q != NULL) push_str(q, "Connection: close" CRLF CRLF);
+}
+
+/* chunk_scan() keeping the data of the chunks */
+static long scan_kept(struct proxy_call *call, const char *buf, size_t len) {
+	size_t pos = 0, n;
+	long step;
+	int data;
+
+	while (pos < len && call->scan.state != CK_DONE) {
+		/* the framing goes a byte at a time, so that data is seen as such */
+		data = call->scan.state == CK_DATA;
+		n = !data ? 1 : len - pos < call->scan.left ? len - pos : call->scan.left;
+		step = chunk_scan(&call->scan, buf + pos, n);
+		if (step == -1) return -1;
+		if (data) keep_body(call, buf + pos, (size_t)step);
+		pos += (size_t)step;
+	}
+	return (long)pos;
+}
+
+/* queue `n` bytes of buf for the client and the followers alike, buf
+   going along */
+static void fan_out(struct proxy_call *call, const char *ptr, size_t n) {
+	struct blob *buf = blob_new((unsigned char *)call->buf, n);
+	struct proxy_follower *f;
+
+	outq_push_mem(call->to_client, ptr, n, NULL, buf);
+	for (f = call->followers; f != NULL; f = f->next) {
+		outq_push_mem(f->to_client, ptr, n, NULL, buf);
+	}
+	blob_unref(buf);
+}
+
+/* queue the body bytes of buf from `off` for the client, buf going along;
+   the call ends with the response */
+static void relay(struct proxy_call *call, size_t off) {
+	size_t n = call->len - off, take = n;
+	long scanned;
+	int complete = 0;
+
+	if (call->head.chunked) {
+		scanned = call->keep != NULL ? scan_kept(call, call->buf + off, n) :
+			chunk_scan(&call->scan, call->buf + off, n);
+		if (scanned == -1) {
+			fail(call);
+			return;
+		}
+		take = (size_t)scanned;
+		complete = call->scan.state == CK_DONE;
+	} else if (call->head.content_length >= 0) {
+		take = n < call->resp_left ? n : call->resp_left;
+		call->resp_left -= take;
+		complete = call->resp_left == 0;
+	}
+	if (!call->head.chunked) keep_body(call, call->buf + off, take);
+	/* a backend sending more than the response is not to be trusted */
+	if (take < n) call->reusable = 0;
+
+	if (call->followers != NULL) {
+		fan_out(call, call->buf + off, take);
+	} else {
+		outq_push_mem(call->to_client, call->buf + off, take, call->buf, NULL);
+	}
+	call->buf = NULL;
+	call->len = 0;
+	if (complete) {
+		finish(call);
+	} else {
+		call->notify(call);
+		notify_followers(call);
+	}
+}
+
+/* the upstream confirmed the stale response, the client gets it from the
+   cache */
+static void revalidated(struct proxy_call *call) {
+	struct http_response resp = new_response();
+
+	start_keep(call);
+	push_head(call, NULL);
+	pcache_refresh(call->cache, call->stale, call->keep, call->keep_len,
+		call->sent_at, call->head_at);
+	drop_keep(call);
+	pcache_respond(call->cache, call->stale, call->req, &resp, call->head_at);
+	if (outq_push_response(call->to_client, &resp) == -1) {
+		/* finish() leaves it so, the client is dropped */
+		perror("dup");
+		call->state = PX_BROKEN;
+	}
+	answer_followers(call, call->stale);
+	/* a 304 has no body */
+	if (call->len > call->head.len) call->reusable = 0;
+	free(call->buf);
+	call->buf = NULL;
+	call->len = 0;
+	finish(call);
+}
+
+static void take_head(struct proxy_call *call) {
+	long len;
+
+	while (1) {
+		len = proxy_parse_head(call->buf, call->len, &call->head);
+		if (len == 0 && call->len < call->cap) return;
+		if (len <= 0) {
+			fail(call);
+			return;
+		}
+		if (call->head.status >= 200) break;
+		/* interim responses end here, 100 Continue included */
+		call->len -= (size_t)len;
+		memmove(call->buf, call->buf + len, call->len);
+	}
+
+	/* a 1.0 request got no chunked body unless the backend is broken */
+	if (call->head.chunked && call->req->http_minor == 0) {
+		fail(call);
+		return;
+	}
+	if (call->req->method == HM_HEAD || call->head.status == RC_204_NO_CONTENT ||
+			call->head.status == RC_304_NOT_MODIFIED) {
+		call->head.chunked = 0;
+		call->head.content_length = 0;
+	}
+	if (call->head.content_length >= 0) call->resp_left = (size_t)call->head.content_length;
+	/* those say the backend, not the request, is in trouble */
+	if (call->head.status >= RC_502_BAD_GATEWAY && call->head.status <= RC_504_GATEWAY_TIMEOUT) {
+		upstream_failed(call->up, time(NULL));
+	} else {
+		upstream_succeeded(call->up);
+	}
+
+	call->head_at = time(NULL);
+	stop_leading(call);
+	if (call->stale != NULL && call->head.status == RC_304_NOT_MODIFIED) {
+		revalidated(call);
+		return;
+	}
+	if (call->stale != NULL && call->req->method == HM_GET &&
+			call->head.status < RC_500_INTERNAL_SERVER_ERROR) {
+		/* replaced, or not to be served any more */
+		pcache_remove(call->cache, call->stale);
+	}
+	if (call->cache != NULL && call->req->method == HM_GET &&
+			call->head.content_length <= (ssize_t)PCACHE_MAX_BODY) {
+		start_keep(call);
+	}
+	push_head(call, call->to_client);
+	if (call->keep != NULL) {
+		call->keep_head = call->keep_len;
+		if (!pcache_storable(call->req, call->keep, call->keep_len)) drop_keep(call);
+	}
+	if (call->followers != NULL) share_head(call);
+	call->state = PX_RELAYING;
+	relay(call, call->head.len);
+}
+
+/* body bytes the upstream may send straight into the pipe; the framing of
+   a chunked body goes through user space, to be scanned */
+static size_t spliceable(const struct proxy_call *call) {
+	size_t room = client_room(call), left;
+
+	/* what is kept or fanned out has to be read */
+	if (call->keep != NULL || call->followers != NULL) return 0;
+	if (call->head.chunked) {
+		if (call->scan.state != CK_DATA) return 0;
+		left = call->scan.left;
+	} else if (call->head.content_length >= 0) {
+		left = call->resp_left;
+	} else {
+		return room;
+	}
+	return left < room ? left : room;
+}
+
+/* `n` body bytes went into the pipe */
+static void relay_spliced(struct proxy_call *call, size_t n) {
+	outq_push_pipe(call->to_client, call->resp_pipe.rd, n);
+	call->up->stats.spliced += n;
+	if (call->head.chunked) {
+		call->scan.left -= n;
+		if (call->scan.left == 0) call->scan.state = CK_DATA_CR;
+	} else if (call->head.content_length >= 0) {
+		call->resp_left -= n;
+		if (call->resp_left == 0) {
+			finish(call);
+			return;
+		}
+	}
+	call->notify(call);
+}
+
+/* the upstream closed its side */
+static void upstream_closed(struct proxy_call *call) {
+	if (call->state == PX_RELAYING && !call->head.chunked && call->head.content_length == -1) {
+		/* the body ends with the connection */
+		call->reusable = 0;
+		free(call->buf);
+		call->buf = NULL;
+		finish(call);
+	} else {
+		retry_or_fail(call);
+	}
+}
+
+static void read_upstream(struct proxy_call *call, unsigned events) {
+	struct relay_pipe *p;
+	size_t want;
+	ssize_t n;
+
+	while (call->state == PX_WAITING || call->state == PX_RELAYING) {
+		if (client_room(call) == 0) {
+			/* paused on the clients, an error would be reported forever */
+			if (events & (EPOLLERR | EPOLLHUP)) fail(call);
+			return;
+		}
+
+		want = call->state == PX_RELAYING ? spliceable(call) : 0;
+		p = want > 0 ? relay_pipe_get(&call->resp_pipe) : NULL;
+		if (p != NULL) {
+			n = splice(call->src.fd, NULL, p->wr, NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		} else {
+			if (call->buf == NULL) {
+				if (call->state == PX_WAITING) {
+					call->cap = PROXY_HEAD_MAX;
+				} else if (call->head.chunked && call->resp_pipe.rd != -1) {
+					/* up to the next chunk data, to be spliced */
+					call->cap = PROXY_FRAMING;
+				} else {
+					call->cap = PROXY_READ;
+				}
+				call->buf = malloc(call->cap);
+				if (call->buf == NULL) {
+					perror("proxy");
+					exit(1);
+				}
+				call->len = 0;
+			}
+			n = recv(call->src.fd, call->buf + call->len, call->cap - call->len, 0);
+		}
+
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) retry_or_fail(call);
+			return;
+		}
+		if (n == 0) {
+			upstream_closed(call);
+			return;
+		}
+		if (p != NULL) {
+			relay_spliced(call, (size_t)n);
+			continue;
+		}
+		call->len += (size_t)n;
+		if (call->state == PX_WAITING) {
+			take_head(call);
+		} else {
+			relay(call, 0);
+		}
+	}
+}
+
+static void upstream_event(struct evloop *loop, struct ev_source *src, unsigned events) {
+	struct proxy_call *call = (struct proxy_call *)src;
+	int err = 0;
+	socklen_t err_len = sizeof err;
+
+	(void)loop;
+	if (call->state == PX_CONNECTING) {
+		if (getsockopt(src->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == -1 || err != 0) {
+			fail(call);
+			return;
+		}
+		call->state = PX_WAITING;
+	}
+
+	if (call->to_upstream.bytes > 0) {
+		switch (outq_flush(&call->to_upstream, &no_zerocopy, &call->zs)) {
+		case OUTQ_ERROR:
+			/* the backend stopped reading, it may have answered though */
+			call->reusable = 0;
+			outq_free(&call->to_upstream);
+			outq_init(&call->to_upstream);
+			relay_pipe_close(&call->req_pipe);
+			call->body_left = 0;
+			events |= EPOLLIN;
+			break;
+		case OUTQ_DONE:
+			if (call->body_left > 0) call->notify(call);
+			break;
+		case OUTQ_AGAIN:
+			break;
+		}
+	}
+	if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) read_upstream(call, events);
+	update_events(call);
+}
@@ -0,0 +1,233 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include "evloop.h"
+#include "outq.h"
+#include "request.h"
+#include "upstream.h"
+#include "zerocopy.h"
+
+/* bytes queued towards one side before the other one is no longer read */
+#define PROXY_BUFFER (64ul << 10)
+
+/* bytes read from a socket at once */
+#define PROXY_READ (16ul << 10)
+
+/* largest upstream response head */
+#define PROXY_HEAD_MAX (16ul << 10)
+
+/* bytes read at once for the framing of a chunked body being spliced */
+#define PROXY_FRAMING 64ul
+
+/* bytes a follower may lag behind before the upstream is no longer read */
+#define PROXY_FOLLOW_LAG (1ul << 20)
+
+/* a response head as sent by an upstream */
+struct proxy_head {
+	unsigned status;
+	uint8_t http_minor;
+	ssize_t content_length; /* -1 if none */
+	unsigned chunked:1;
+	unsigned keep_alive:1;
+	size_t fields; /* where the field lines start */
+	size_t len; /* up to and including the empty line */
+};
+
+/* parse the head at the start of `buf`: its length, 0 if incomplete, -1
+   if malformed */
+long proxy_parse_head(const char *buf, size_t len, struct proxy_head *head);
+
+/* the field line at `pos` of a head ending at `end`: where the next one
+   starts, 0 if malformed; the value is trimmed */
+size_t proxy_next_field(const char *buf, size_t pos, size_t end, struct slice *name, struct slice *value);
+
+/* whether the comma separated `list` has `token`, case-insensitively */
+int proxy_list_has(const struct slice *list, const struct slice *token);
+
+enum chunk_state {
+	CK_SIZE = 0,
+	CK_EXT,
+	CK_SIZE_LF,
+	CK_DATA,
+	CK_DATA_CR,
+	CK_DATA_LF,
+	CK_TRAILER, /* at the start of a trailer line */
+	CK_TRAILER_LINE,
+	CK_END_LF,
+	CK_DONE
+};
+
+/* finds where a chunked body ends without decoding it */
+struct chunk_scan {
+	enum chunk_state state;
+	size_t left; /* chunk size, then data bytes left */
+	int digits;
+};
+
+/* bytes of `buf` that belong to the body, all of them unless it ends
+   there (the state is CK_DONE then); -1 if malformed */
+long chunk_scan(struct chunk_scan *scan, const char *buf, size_t len);
+
+/* queue the request to send upstream, re-serialized from the slices of
+   `req` without hop-by-hop fields, the conditional lines `validators` (NULL
+   if none) replacing the client's; both must outlive the queue. An
+   absolute-form target goes in origin-form, its authority as the Host */
+void proxy_push_request(struct outq *q, const struct http_request *req, const char *validators);
+
+/* a pipe body bytes cross between two sockets without being copied to
+   user space, holding up to PROXY_BUFFER bytes */
+struct relay_pipe {
+	int rd, wr; /* -1 until needed */
+	int failed; /* could not be set up, bytes are copied instead */
+};
+
+/* the pipe to splice through, set up on first use; NULL if there cannot
+   be one */
+struct relay_pipe *relay_pipe_get(struct relay_pipe *p);
+void relay_pipe_close(struct relay_pipe *p);
+
+enum proxy_state {
+	PX_CONNECTING = 0,
+	PX_WAITING, /* sending the request, waiting for the response head */
+	PX_RELAYING, /* the head is queued, relaying the body */
+	PX_DONE, /* the response is queued whole, a 502 if it failed early */
+	PX_BROKEN /* failed past the head, the client must not take it whole */
+};
+
+struct pcache;
+struct pcache_entry;
+struct pcache_fetch;
+struct proxy_follower;
+
+/* one request forwarded to an upstream on behalf of a client connection,
+   the response being queued for the client as it arrives */
+struct proxy_call {
+	struct ev_source src; /* the upstream connection, -1 once released */
+	struct evloop *loop;
+	struct upstream *up;
+	const struct http_request *req;
+	enum proxy_state state;
+	int reused, retried;
+	unsigned events; /* watched on src */
+
+	struct outq to_upstream;
+	struct zc_socket zs;
+	size_t body_left; /* request body the client has yet to send */
+	struct relay_pipe req_pipe;
+
+	struct outq *to_client;
+	char *buf; /* upstream bytes not queued yet */
+	size_t len, cap;
+	struct proxy_head head;
+	size_t resp_left; /* of a Content-Length body */
+	struct chunk_scan scan;
+	struct relay_pipe resp_pipe; /* read from by to_client */
+	int reusable; /* the connection may serve another request */
+
+	/* a response the cache may take is kept, not spliced, to be stored
+	   once whole */
+	struct pcache *cache; /* NULL if not caching */
+	struct pcache_entry *stale; /* to be confirmed, referenced; NULL if none */
+	char *validators; /* sent instead of the client's, NULL if none */
+	char *keep; /* the head, then the body without chunked framing */
+	size_t keep_len, keep_cap, keep_head;
+	time_t sent_at, head_at; /* when the request went and the head came */
+
+	/* identical requests waiting on this one, see proxy_call_lead() */
+	struct pcache_fetch *fetch; /* NULL unless leading */
+	struct proxy_follower *followers;
+
+	/* the client queue got bytes or room, or the call ended */
+	void (*notify)(struct proxy_call *call);
+	void *owner;
+};
+
+void proxy_call_init(
+		struct proxy_call *call,
+		struct evloop *loop,
+		struct upstream *up,
+		const struct http_request *req,
+		struct outq *to_client,
+		void (*notify)(struct proxy_call *call),
+		void *owner
+);
+
+/* store the response in `cache` if it may be; with `stale` (the call takes
+   the reference) have the upstream confirm it rather, a 304 being answered
+   from it. Before proxy_call_start() */
+void proxy_call_cache(struct proxy_call *call, struct pcache *cache, struct pcache_entry *stale);
+
+/* let identical requests follow the call until its head comes, see
+   proxy_call_leading(); after proxy_call_cache(), for a GET without a body.
+   0 if it leads, -1 if another call does */
+int proxy_call_lead(struct proxy_call *call);
+
+/* the call whose response a request for the same key may wait on, NULL if
+   none */
+struct proxy_call *proxy_call_leading(struct pcache *cache, const struct http_request *req);
+
+enum follow_state {
+	FW_WAITING = 0, /* for the head of the leader */
+	FW_STREAMING, /* getting what the leader's client gets */
+	FW_DONE, /* the response is queued whole */
+	FW_BROKEN, /* the leader failed past the head */
+	FW_RELEASED /* the response is not for it, it has to go alone */
+};
+
+/* a request answered with the response to another identical one, which is
+   fanned out to it as the upstream sends it; a response one of them may not
+   share releases the followers */
+struct proxy_follower {
+	struct evloop *loop;
+	const struct http_request *req;
+	struct outq *to_client;
+	enum follow_state state;
+	struct proxy_call *leader; /* NULL once done, broken or released */
+	struct proxy_follower *prev, *next;
+
+	/* where the request would go alone: the owner's, set aside */
+	struct upstream *up;
+	struct pcache_entry *stale;
+	time_t since;
+
+	/* the client queue got bytes, or the state changed */
+	void (*notify)(struct proxy_follower *f);
+	void *owner;
+};
+
+void proxy_follow(
+		struct proxy_call *leader,
+		struct proxy_follower *f,
+		const struct http_request *req,
+		struct outq *to_client,
+		void (*notify)(struct proxy_follower *f),
+		void *owner
+);
+
+/* stop following, the leader going on without it */
+void proxy_unfollow(struct proxy_follower *f);
+
+/* send the request with the `len` body bytes the client sent along with
+   the head, on an idle connection if the upstream has one */
+void proxy_call_start(struct proxy_call *call, const char *body, size_t len);
+
+/* request body bytes the call takes now */
+size_t proxy_call_room(const struct proxy_call *call);
+
+/* move request body bytes from the client socket `fd` towards the upstream,
+   while proxy_call_room() is positive; returns as recv() does */
+ssize_t proxy_call_pull(struct proxy_call *call, int fd);
+
+/* read the upstream again if the client queue has room */
+void proxy_call_resume(struct proxy_call *call);
+
+/* close the upstream connection unless it was released, and the pipes; the
+   client queue must be done with them. Followers still waiting are
+   released, streaming ones broken */
+void proxy_call_free(struct proxy_call *call);
+
+#endif
@@ -0,0 +1,96 @@
+#include <stdint.h>
+#include "range.h"
+#include "str.h"
+
+#define POS_NONE SIZE_MAX
+
+/* 1*DIGIT saturating at SIZE_MAX - 1, POS_NONE if empty */
+static size_t parse_pos(const char **ptr, const char *end) {
+	size_t value = 0;
+	const char *start = *ptr;
+
+	for (; *ptr < end && is_digit(**ptr); ++*ptr) {
+		size_t digit = to_digit(**ptr);
+		value = value > (SIZE_MAX - 1 - digit) / 10 ? SIZE_MAX - 1 : value * 10 + digit;
+	}
+	return *ptr == start ? POS_NONE : value;
+}
+
+static int is_ows(char ch) {
+	return ch == SYM_SP || ch == SYM_HTAB;
+}
+
+static void sort_and_coalesce(struct byte_range *ranges, size_t *count) {
+	size_t i, j, n = 0;
+
+	for (i = 1; i < *count; ++i) {
+		struct byte_range r = ranges[i];
+		for (j = i; j > 0 && ranges[j - 1].first > r.first; --j) {
+			ranges[j] = ranges[j - 1];
+		}
+		ranges[j] = r;
+	}
+	for (i = 1; i < *count; ++i) {
+		if (ranges[i].first <= ranges[n].last + 1) {
+			if (ranges[i].last > ranges[n].last) ranges[n].last = ranges[i].last;
+		} else {
+			ranges[++n] = ranges[i];
+		}
+	}
+	*count = n + 1;
+}
+
+enum range_result parse_range(
+		const struct slice *value,
+		size_t size,
+		struct byte_range ranges[RANGE_MAX],
+		size_t *count
+) {
+	const char *ptr = value->ptr;
+	const char *end = value->ptr + value->len;
+	struct slice unit;
+	size_t specs = 0;
+
+	*count = 0;
+	while (ptr < end && *ptr != '=') ptr++;
+	unit = get_slice(value->ptr, (size_t)(ptr - value->ptr));
+	if (ptr == end || slice_str_cmp_ci_check(&unit, "bytes")) return RANGE_NONE;
+	ptr++;
+
+	/* range-set = 1#range-spec, empty list elements allowed */
+	while (ptr < end) {
+		size_t first, last;
+
+		while (ptr < end && (is_ows(*ptr) || *ptr == ',')) ptr++;
+		if (ptr == end) break;
+
+		first = parse_pos(&ptr, end);
+		if (ptr == end || *ptr != '-') return RANGE_NONE;
+		ptr++;
+		last = parse_pos(&ptr, end);
+		if (first == POS_NONE && last == POS_NONE) return RANGE_NONE;
+		if (first != POS_NONE && last != POS_NONE && last < first) return RANGE_NONE;
+
+		while (ptr < end && is_ows(*ptr)) ptr++;
+		if (ptr < end && *ptr != ',') return RANGE_NONE;
+		if (++specs > RANGE_MAX) return RANGE_NONE;
+
+		if (first == POS_NONE) {
+			/* suffix-range: the last `last` bytes */
+			if (last == 0 || size == 0) continue;
+			first = last >= size ? 0 : size - last;
+			last = size - 1;
+		} else {
+			if (first >= size) continue;
+			if (last == POS_NONE || last >= size) last = size - 1;
+		}
+		ranges[*count].first = first;
+		ranges[*count].last = last;
+		++*count;
+	}
+
+	if (specs == 0) return RANGE_NONE;
+	if (*count == 0) return RANGE_UNSATISFIABLE;
+	sort_and_coalesce(ranges, count);
+	return RANGE_OK;
+}
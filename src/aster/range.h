@@ -0,0 +1,34 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+#include <stddef.h>
+#include "request.h"
+
+/* more ranges than this are ignored, as a cheap guard against requests
+   made of many tiny ranges */
+#define RANGE_MAX 16
+
+/* inclusive byte positions */
+struct byte_range {
+	size_t first, last;
+};
+
+enum range_result {
+	RANGE_NONE = 0, /* serve the whole representation */
+	RANGE_OK,
+	RANGE_UNSATISFIABLE
+};
+
+/* parse a Range field value (RFC 9110 section 14.1) against a representation
+   of `size` bytes. RANGE_NONE if the field is to be ignored (malformed, other
+   unit, too many ranges), RANGE_UNSATISFIABLE if no range overlaps the
+   representation, else RANGE_OK with `count` ranges, sorted, clamped to the
+   size and coalesced when overlapping or adjacent */
+enum range_result parse_range(
+		const struct slice *value,
+		size_t size,
+		struct byte_range ranges[RANGE_MAX],
+		size_t *count
+);
+
+#endif
@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include "readahead.h"
+
+void ra_init(struct ra_state *ra) {
+	ra->next = 0;
+	ra->ahead = 0;
+	ra->window = 0;
+}
+
+enum ra_advice ra_plan(
+		struct ra_state *ra,
+		size_t off,
+		size_t len,
+		size_t size,
+		size_t *ra_off,
+		size_t *ra_len
+) {
+	size_t end = off + len, stop;
+	enum ra_advice advice;
+
+	*ra_off = off;
+	*ra_len = 0;
+	if (size < RA_MIN_FILE || len == 0 || end > size) return RA_NONE;
+
+	if (off == ra->next && ra->window > 0) {
+		if (ra->ahead >= end + ra->window / 2 || ra->ahead >= size) {
+			/* still well ahead */
+			ra->next = end;
+			return RA_NONE;
+		}
+		ra->window = ra->window * 2 > RA_MAX_WINDOW ? RA_MAX_WINDOW : ra->window * 2;
+		if (ra->ahead > off) *ra_off = ra->ahead;
+		stop = end + ra->window > size ? size : end + ra->window;
+		advice = RA_READAHEAD;
+	} else if (off == 0 || off == ra->next) {
+		/* a new pass, or the first continuation of a random read */
+		ra->window = RA_MIN_WINDOW;
+		if (off == ra->next && ra->ahead > off) *ra_off = ra->ahead;
+		stop = end + ra->window > size ? size : end + ra->window;
+		advice = RA_READAHEAD;
+	} else {
+		ra->window = 0;
+		stop = end;
+		advice = RA_WILLNEED;
+	}
+	ra->next = end;
+
+	if (stop <= *ra_off) return RA_NONE;
+	*ra_len = stop - *ra_off > RA_MAX_WINDOW ? RA_MAX_WINDOW : stop - *ra_off;
+	ra->ahead = *ra_off + *ra_len;
+	return advice;
+}
+
+struct ra_file *ra_file_new(size_t size, struct ra_stats *stats) {
+	struct ra_file *f = malloc(sizeof *f);
+	if (f == NULL) {
+		perror("ra_file_new");
+		exit(1);
+	}
+	f->size = size;
+	ra_init(&f->ra);
+	f->stats = stats;
+	f->sent_off = f->sent_end = 0;
+	f->cold = 0;
+	f->refs = 1;
+	return f;
+}
+
+struct ra_file *ra_file_ref(struct ra_file *f) {
+	f->refs++;
+	return f;
+}
+
+void ra_file_unref(struct ra_file *f, int fd) {
+	if (f == NULL || --f->refs > 0) return;
+	if (f->cold && f->sent_end > f->sent_off &&
+			posix_fadvise(fd, (off_t)f->sent_off,
+				(off_t)(f->sent_end - f->sent_off), POSIX_FADV_DONTNEED) == 0) {
+		f->stats->dontneeds++;
+	}
+	free(f);
+}
+
+/* plan with `ra` and hint; POSIX_FADV_WILLNEED starts the reads without
+   waiting for them, unlike readahead() */
+static void advise(struct ra_file *f, struct ra_state *ra, int fd, size_t off, size_t len) {
+	size_t ra_off, ra_len;
+	enum ra_advice advice = ra_plan(ra, off, len, f->size, &ra_off, &ra_len);
+
+	if (advice == RA_NONE ||
+			posix_fadvise(fd, (off_t)ra_off, (off_t)ra_len, POSIX_FADV_WILLNEED) != 0) {
+		return;
+	}
+	if (advice == RA_READAHEAD) {
+		f->stats->readaheads++;
+	} else {
+		f->stats->willneeds++;
+	}
+	f->stats->prefetched += ra_len;
+}
+
+void ra_file_queued(struct ra_file *f, int fd, size_t off, size_t len) {
+	char byte;
+	struct iovec iov;
+
+	/* a one byte read that fails rather than wait for the disk */
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	if (preadv2(fd, &iov, 1, (off_t)off, RWF_NOWAIT) == 1) {
+		f->stats->resident++;
+	} else if (errno == EAGAIN) {
+		f->stats->nonresident++;
+	}
+	advise(f, &f->ra, fd, off, len);
+}
+
+void ra_file_sent(struct ra_file *f, struct ra_state *ra, int fd, size_t off, size_t len) {
+	size_t end = off + len;
+
+	if (f->sent_end == f->sent_off || (off <= f->sent_end && end >= f->sent_off)) {
+		/* empty so far, or touching: one span */
+		if (f->sent_end == f->sent_off || off < f->sent_off) f->sent_off = off;
+		if (end > f->sent_end) f->sent_end = end;
+	} else if (len > f->sent_end - f->sent_off) {
+		f->sent_off = off;
+		f->sent_end = end;
+	}
+	advise(f, ra, fd, off, len);
+}
@@ -0,0 +1,86 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stddef.h>
+
+/* smaller files are read in one go and left to the kernel's heuristics */
+#define RA_MIN_FILE (1ul << 20)
+
+/* prefetch window of a file read sequentially, doubling on every read that
+   continues the previous one */
+#define RA_MIN_WINDOW (128ul << 10)
+#define RA_MAX_WINDOW (4ul << 20)
+
+/* access pattern of one open file, as seen by the worker serving it */
+struct ra_state {
+	size_t next; /* where a read continuing the last one starts */
+	size_t ahead; /* prefetched up to here */
+	size_t window; /* 0 while reads look random */
+};
+
+enum ra_advice {
+	RA_NONE = 0,
+	RA_READAHEAD, /* sequential: hint the window past the read */
+	RA_WILLNEED /* random: hint the range itself */
+};
+
+void ra_init(struct ra_state *ra);
+
+/* record a read of `len` bytes at `off` of a `size` byte file and return how
+   to prefetch [*ra_off, *ra_off + *ra_len), never more than RA_MAX_WINDOW.
+   A read from the start or continuing the previous one is sequential and
+   also covers the window past its end, once less than half of it is left
+   prefetched */
+enum ra_advice ra_plan(
+		struct ra_state *ra,
+		size_t off,
+		size_t len,
+		size_t size,
+		size_t *ra_off,
+		size_t *ra_len
+);
+
+/* page cache, for files of RA_MIN_FILE bytes or more */
+struct ra_stats {
+	/* whether the first page of a queued range was already resident */
+	size_t resident;
+	size_t nonresident;
+	/* hints given, all POSIX_FADV_WILLNEED and so asynchronous */
+	size_t readaheads;
+	size_t willneeds;
+	size_t prefetched; /* bytes */
+	size_t dontneeds; /* spans of cold files dropped */
+};
+
+/* page-cache state of a large open file, shared by the cache entry that
+   opened it and the queued segments sending it, each holding a reference */
+struct ra_file {
+	size_t size;
+	struct ra_state ra; /* reads as they are queued */
+	struct ra_stats *stats; /* must outlive the file */
+
+	/* the longest span this worker sent, dropped from the page cache with
+	   the last reference if the cache let the file go for disuse: nothing
+	   else of it is queued here then */
+	size_t sent_off, sent_end;
+	int cold;
+
+	size_t refs;
+};
+
+/* one reference, the file having `size` bytes */
+struct ra_file *ra_file_new(size_t size, struct ra_stats *stats);
+struct ra_file *ra_file_ref(struct ra_file *f);
+/* `fd` is the file, still open; NULL is ignored */
+void ra_file_unref(struct ra_file *f, int fd);
+
+/* before `len` bytes at `off` are queued: samples whether they are cached
+   and hints them, plus a growing window while queued reads continue each
+   other */
+void ra_file_queued(struct ra_file *f, int fd, size_t off, size_t len);
+
+/* `len` bytes at `off` went out, `ra` following the segment sending them
+   so that its window keeps growing ahead of sendfile() */
+void ra_file_sent(struct ra_file *f, struct ra_state *ra, int fd, size_t off, size_t len);
+
+#endif
@@ -134,13 +134,13 @@ struct http_header *get_header(
 }
 
 void strip_postfix_ows(struct slice *header_value) {
-	const char *end = header_value->ptr + header_value->len - 1;
-	while (*end == ' ' || *end == '\t') end--;
-	assert(end >= header_value->ptr);
-	header_value->len = (size_t)(end - header_value->ptr + 1);
+	while (header_value->len > 0 && (header_value->ptr[header_value->len - 1] == ' ' ||
+			header_value->ptr[header_value->len - 1] == '\t')) {
+		header_value->len--;
+	}
 }
 
-int is_http_ver(struct http_request *req, uint8_t major, uint8_t minor) {
+int is_http_ver(const struct http_request *req, uint8_t major, uint8_t minor) {
 	return req->http_major == major && req->http_minor == minor;
 }
 
@@ -181,13 +181,14 @@ int header_items_next(
 		struct header_item_iter *it
 ) {
 	size_t pos;
-	struct slice hval = req->headers[it->header_index].value;
+	struct slice hval;
 	int is_quoting = 0;
 
 	if (it->header_index == SIZE_MAX) {
 		it->header_item.ptr = NULL;
 		return 0;
 	}
+	hval = req->headers[it->header_index].value;
 
 	if (it->header_item.ptr == NULL) {
 		pos = 0;
@@ -266,3 +267,18 @@ int header_items_next(
 
 	return 0;
 }
+
+const char *method_name(enum http_method method) {
+	switch (method) {
+	case HM_GET: return "GET";
+	case HM_HEAD: return "HEAD";
+	case HM_POST: return "POST";
+	case HM_PUT: return "PUT";
+	case HM_DELETE: return "DELETE";
+	case HM_OPTIONS: return "OPTIONS";
+	case HM_TRACE: return "TRACE";
+	case HM_CONNECT: return "CONNECT";
+	case HM_UNK: break;
+	}
+	return NULL;
+}
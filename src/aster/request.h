@@ -75,7 +75,8 @@ enum http_method {
 	HM_PUT,
 	HM_DELETE,
 	HM_OPTIONS,
-	HM_TRACE
+	HM_TRACE,
+	HM_CONNECT /* never routed */
 };
 
 enum request_target_form {
@@ -136,8 +137,11 @@ struct http_header *get_header(struct http_request *req, enum http_header_type t
 
 void strip_postfix_ows(struct slice *header_value);
 
+/* method token, NULL for HM_UNK */
+const char *method_name(enum http_method method);
+
 /* return 1 if http versions match, 0 otherwise */
-int is_http_ver(struct http_request *req, uint8_t major, uint8_t minor);
+int is_http_ver(const struct http_request *req, uint8_t major, uint8_t minor);
 
 /* O(1) lookup */
 size_t headers_count(const struct http_request *req, enum http_header_type htype);
@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "resolver.h"
+
+/* what goes to the processes and back, one datagram each */
+struct lookup_msg {
+	uint32_t slot;
+	char name[RESOLVER_NAME_MAX];
+};
+
+struct answer_msg {
+	uint32_t slot;
+	int ok;
+	socklen_t addr_len;
+	struct sockaddr_storage addr;
+};
+
+int resolve_name(const char *name, int numeric, struct sockaddr_storage *addr, socklen_t *addr_len) {
+	struct addrinfo hints, *info;
+	const char *sep = strrchr(name, ':');
+	char host[256];
+	size_t host_len;
+	int ret;
+
+	if (sep == NULL || sep == name || sep[1] == '\0') return -1;
+	host_len = (size_t)(sep - name);
+	if (name[0] == '[' && name[host_len - 1] == ']') {
+		name++;
+		host_len -= 2;
+	}
+	if (host_len == 0 || host_len >= sizeof host) return -1;
+	memcpy(host, name, host_len);
+	host[host_len] = '\0';
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (numeric) hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+	ret = getaddrinfo(host, sep + 1, &hints, &info);
+	if (ret != 0) return -1;
+	memcpy(addr, info->ai_addr, info->ai_addrlen);
+	*addr_len = info->ai_addrlen;
+	freeaddrinfo(info);
+	return 0;
+}
+
+/* a process: answer lookups until the worker's end closes */
+static void serve_lookups(int fd) {
+	struct lookup_msg in;
+	struct answer_msg out;
+	ssize_t n;
+
+	while ((n = recv(fd, &in, sizeof in, 0)) != 0) {
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		in.name[sizeof in.name - 1] = '\0';
+		memset(&out, 0, sizeof out);
+		out.slot = in.slot;
+		out.ok = resolve_name(in.name, 0, &out.addr, &out.addr_len) == 0;
+		if (send(fd, &out, sizeof out, MSG_NOSIGNAL) == -1) break;
+	}
+	_exit(0);
+}
+
+/* hand an answer to whoever still waits for it */
+static void answer(struct resolver *r, size_t slot, const struct answer_msg *msg) {
+	struct resolver_query *q = r->slots[slot];
+
+	r->slots[slot] = NULL;
+	r->busy[slot] = 0;
+	if (msg == NULL || !msg->ok) r->stats.failures++;
+	if (q == NULL) return;
+	if (msg != NULL && msg->ok) {
+		q->done(q, (const void *)&msg->addr, msg->addr_len);
+	} else {
+		q->done(q, NULL, 0);
+	}
+}
+
+static void resolver_event(struct evloop *loop, struct ev_source *src, unsigned events) {
+	struct resolver *r = (struct resolver *)src;
+	struct answer_msg msg;
+	ssize_t n;
+	size_t i;
+
+	while ((n = recv(src->fd, &msg, sizeof msg, MSG_DONTWAIT)) > 0) {
+		if ((size_t)n == sizeof msg && msg.slot < RESOLVER_MAX && r->busy[msg.slot]) {
+			answer(r, msg.slot, &msg);
+		}
+	}
+	if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) &&
+			!(events & (EPOLLHUP | EPOLLERR))) {
+		return;
+	}
+
+	/* the processes are gone: what they were asked fails, as does what
+	   comes next */
+	fprintf(stderr, "resolver: lookups stopped\n");
+	evloop_del(loop, src);
+	close(src->fd);
+	src->fd = -1;
+	for (i = 0; i < RESOLVER_MAX; ++i) {
+		if (r->busy[i]) answer(r, i, NULL);
+	}
+}
+
+int resolver_start(struct resolver *r, struct evloop *loop) {
+	int fds[2];
+	size_t i;
+
+	memset(r, 0, sizeof *r);
+	r->src.fd = -1;
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == -1) return -1;
+	for (i = 0; i < RESOLVER_PROCS; ++i) {
+		r->pids[i] = fork();
+		if (r->pids[i] == -1) {
+			close(fds[0]);
+			close(fds[1]);
+			return -1;
+		}
+		if (r->pids[i] == 0) {
+			close(fds[0]);
+			serve_lookups(fds[1]);
+		}
+	}
+	close(fds[1]);
+	r->src.fd = fds[0];
+	r->src.handle = resolver_event;
+	if (evloop_add(loop, &r->src, EPOLLIN) == -1) {
+		close(fds[0]);
+		r->src.fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+void resolver_stop(struct resolver *r, struct evloop *loop) {
+	size_t i;
+
+	if (r->src.fd != -1) {
+		evloop_del(loop, &r->src);
+		close(r->src.fd);
+		r->src.fd = -1;
+	}
+	for (i = 0; i < RESOLVER_PROCS; ++i) {
+		if (r->pids[i] > 0) waitpid(r->pids[i], NULL, 0);
+		r->pids[i] = 0;
+	}
+}
+
+int resolver_query(struct resolver *r, struct resolver_query *q) {
+	struct lookup_msg msg;
+	size_t slot;
+
+	if (r->src.fd == -1) return -1;
+	for (slot = 0; slot < RESOLVER_MAX && r->busy[slot]; ++slot);
+	if (slot == RESOLVER_MAX) return -1;
+
+	msg.slot = (uint32_t)slot;
+	strncpy(msg.name, q->name, sizeof msg.name);
+	msg.name[sizeof msg.name - 1] = '\0';
+	/* a full socket means the processes are far behind already */
+	if (send(r->src.fd, &msg, sizeof msg, MSG_DONTWAIT | MSG_NOSIGNAL) == -1) return -1;
+	q->slot = slot;
+	r->slots[slot] = q;
+	r->busy[slot] = 1;
+	r->stats.lookups++;
+	return 0;
+}
+
+void resolver_cancel(struct resolver *r, struct resolver_query *q) {
+	if (q->slot < RESOLVER_MAX && r->slots[q->slot] == q) r->slots[q->slot] = NULL;
+}
@@ -0,0 +1,64 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include "evloop.h"
+
+/* processes a worker forks to run getaddrinfo(), which blocks, each one
+   resolving a name at a time */
+#define RESOLVER_PROCS 4
+
+/* lookups a worker has in flight, more fail at once */
+#define RESOLVER_MAX 256
+
+/* room for the longest "host:port" looked up */
+#define RESOLVER_NAME_MAX 300
+
+/* resolve "host:port" or "[v6]:port" into `addr`, only if it is a literal
+   address when `numeric`, blocking otherwise; -1 if it does not */
+int resolve_name(const char *name, int numeric, struct sockaddr_storage *addr, socklen_t *addr_len);
+
+struct resolver_query;
+
+/* `addr` being NULL if the name did not resolve */
+typedef void (*resolver_done)(struct resolver_query *q, const struct sockaddr *addr, socklen_t addr_len);
+
+/* a lookup, owned by whoever waits for it */
+struct resolver_query {
+	char name[RESOLVER_NAME_MAX];
+	resolver_done done;
+	void *owner;
+	size_t slot; /* set by resolver_query() */
+};
+
+struct resolver_stats {
+	size_t lookups;
+	size_t failures; /* names that did not resolve */
+};
+
+/* the worker's end of the processes, answers coming back through a socket
+   pair its loop watches */
+struct resolver {
+	struct ev_source src; /* first, fd -1 unless started */
+	pid_t pids[RESOLVER_PROCS];
+	struct resolver_query *slots[RESOLVER_MAX]; /* NULL if free or cancelled */
+	unsigned char busy[RESOLVER_MAX]; /* asked, not answered yet */
+	struct resolver_stats stats;
+};
+
+/* fork the processes and watch for their answers on `loop`, -1 with errno
+   set if they cannot be */
+int resolver_start(struct resolver *r, struct evloop *loop);
+/* have the processes exit and reap them; pending lookups are dropped */
+void resolver_stop(struct resolver *r, struct evloop *loop);
+
+/* look `q->name` up, `q->done` being called from the loop with the answer;
+   -1 if it cannot be asked, too many being in flight */
+int resolver_query(struct resolver *r, struct resolver_query *q);
+
+/* the owner of `q` is going away, its answer is dropped */
+void resolver_cancel(struct resolver *r, struct resolver_query *q);
+
+#endif
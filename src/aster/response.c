@@ -2,6 +2,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include "datetime.h"
+#include "str.h"
+
+#define DATE_PLACEHOLDER "Thu, 01 Jan 1970 00:00:00 GMT"
 
 struct http_response new_response(void) {
 	struct http_response new_resp = {0};
@@ -15,14 +19,28 @@ struct http_response new_response(void) {
 		exit(1);
 	}
 	new_resp.buf[0] = '\0';
+	new_resp.body_fd = -1;
+	new_resp.body_mem = NULL;
+	new_resp.body_blob = NULL;
+	new_resp.body_pages = NULL;
+	new_resp.upstream = NULL;
+	new_resp.stale = NULL;
+	new_resp.script_root = NULL;
+	new_resp.websocket = NULL;
+	new_resp.connection = CD_CLOSE;
+	new_resp.parts = NULL;
 
 	return new_resp;
 }
 
 void append_to_response(struct http_response *resp, const char *str) {
-	size_t to_append = strlen(str);
-	if (resp->len + to_append + 1 > resp->cap) {
+	append_to_response_n(resp, str, strlen(str));
+}
+
+void append_to_response_n(struct http_response *resp, const char *str, size_t n) {
+	if (resp->len + n + 1 > resp->cap) {
 		size_t new_cap = resp->cap * 2;
+		while (resp->len + n + 1 > new_cap) new_cap *= 2;
 		resp->buf = realloc(resp->buf, new_cap);
 		if (resp->buf == NULL) {
 			perror("append_to_response");
@@ -30,10 +48,209 @@ void append_to_response(struct http_response *resp, const char *str) {
 		}
 		resp->cap = new_cap;
 	}
-	strcat(resp->buf, str);
-	resp->len += to_append;
+	memcpy(resp->buf + resp->len, str, n);
+	resp->len += n;
+	resp->buf[resp->len] = '\0';
+}
+
+void append_size_to_response(struct http_response *resp, size_t value) {
+	char digits[24];
+	size_t pos = sizeof digits;
+	do {
+		digits[--pos] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value > 0);
+	append_to_response_n(resp, digits + pos, sizeof digits - pos);
+}
+
+void append_length_to_response(struct http_response *resp, size_t len) {
+	append_to_response(resp, "Content-Length: ");
+	append_size_to_response(resp, len);
+	append_to_response(resp, CRLF);
+	resp->delimited = 1;
+}
+
+void append_connection_to_response(struct http_response *resp) {
+	switch (resp->connection) {
+	case CD_CLOSE:
+		append_to_response(resp, "Connection: close" CRLF);
+		break;
+	case CD_KEEP_ALIVE_10:
+		append_to_response(resp, "Connection: keep-alive" CRLF);
+		break;
+	default:
+		break;
+	}
 }
 
 void http_response_free(struct http_response *resp) {
 	free(resp->buf);
+	free(resp->parts);
+}
+
+static void push_part(
+		struct http_response *resp,
+		enum body_part_type type,
+		size_t off,
+		size_t len
+) {
+	struct body_part *part;
+
+	if (resp->num_parts == resp->cap_parts) {
+		resp->cap_parts = resp->cap_parts ? resp->cap_parts * 2 : 4;
+		resp->parts = realloc(resp->parts, resp->cap_parts * sizeof *resp->parts);
+		if (resp->parts == NULL) {
+			perror("add_body_part");
+			exit(1);
+		}
+	}
+	part = resp->parts + resp->num_parts++;
+	part->type = type;
+	part->off = off;
+	part->len = len;
+}
+
+void add_body_part(
+		struct http_response *resp,
+		enum body_part_type type,
+		size_t off,
+		size_t len
+) {
+	if (resp->num_parts == 0) resp->head_len = resp->len;
+	push_part(resp, type, off, len);
+}
+
+void add_body_buf(struct http_response *resp, const char *str, size_t n) {
+	size_t off = resp->len;
+	if (resp->num_parts == 0) resp->head_len = resp->len;
+	append_to_response_n(resp, str, n);
+	push_part(resp, BP_BUF, off, n);
+}
+
+const char *reason_phrase(enum http_response_code code) {
+	switch (code) {
+	case RC_100_CONTINUE: return "Continue";
+	case RC_101_SWITCHING_PROTOCOLS: return "Switching Protocols";
+	case RC_200_OK: return "OK";
+	case RC_201_CREATED: return "Created";
+	case RC_203_NON_AUTHORITATIVE_INFORMATION: return "Non-Authoritative Information";
+	case RC_204_NO_CONTENT: return "No Content";
+	case RC_205_RESET_CONTENT: return "Reset Content";
+	case RC_206_PARTIAL_CONTENT: return "Partial Content";
+	case RC_300_MULTIPLE_CHOICES: return "Multiple Choices";
+	case RC_301_MOVED_PERMANENTLY: return "Moved Permanently";
+	case RC_302_FOUND: return "Found";
+	case RC_303_SEE_OTHER: return "See Other";
+	case RC_304_NOT_MODIFIED: return "Not Modified";
+	case RC_305_USE_PROXY: return "Use Proxy";
+	case RC_307_TEMPORARY_REDIRECT: return "Temporary Redirect";
+	case RC_400_BAD_REQUEST: return "Bad Request";
+	case RC_401_UNAUTHORIZED: return "Unauthorized";
+	case RC_402_PAYMENT_REQUIRED: return "Payment Required";
+	case RC_403_FORBIDDEN: return "Forbidden";
+	case RC_404_NOT_FOUND: return "Not Found";
+	case RC_405_METHOD_NOT_ALLOWED: return "Method Not Allowed";
+	case RC_406_NOT_ACCEPTABLE: return "Not Acceptable";
+	case RC_407_PROXY_AUTHENTICATION_REQUIRED: return "Proxy Authentication Required";
+	case RC_408_REQUEST_TIMEOUT: return "Request Timeout";
+	case RC_409_CONFLICT: return "Conflict";
+	case RC_410_GONE: return "Gone";
+	case RC_411_LENGTH_REQUIRED: return "Length Required";
+	case RC_412_PRECONDITION_FAILED: return "Precondition Failed";
+	case RC_413_REQUEST_ENTITY_TOO_LARGE: return "Content Too Large";
+	case RC_414_REQUEST_URI_TOO_LONG: return "URI Too Long";
+	case RC_415_UNSUPPORTED_MEDIA_TYPE: return "Unsupported Media Type";
+	case RC_416_REQUESTED_RANGE_NOT_SATISFIABLE: return "Range Not Satisfiable";
+	case RC_417_EXPECTATION_FAILED: return "Expectation Failed";
+	case RC_421_MISDIRECTED_REQUEST: return "Misdirected Request";
+	case RC_426_UPGRADE_REQUIRED: return "Upgrade Required";
+	case RC_500_INTERNAL_SERVER_ERROR: return "Internal Server Error";
+	case RC_501_NOT_IMPLEMENTED: return "Not Implemented";
+	case RC_502_BAD_GATEWAY: return "Bad Gateway";
+	case RC_503_SERVICE_UNAVAILABLE: return "Service Unavailable";
+	case RC_504_GATEWAY_TIMEOUT: return "Gateway Timeout";
+	case RC_505_HTTP_VERSION_NOT_SUPPORTED: return "HTTP Version Not Supported";
+	}
+	return NULL;
+}
+
+void begin_response(
+		struct http_response *resp,
+		enum http_response_code code,
+		const char *date
+) {
+	append_to_response(resp, "HTTP/1.1 ");
+	append_size_to_response(resp, (size_t)code);
+	append_to_response(resp, " ");
+	append_to_response(resp, reason_phrase(code));
+	append_to_response(resp,
+		CRLF
+		"Server: " SERVER CRLF
+		"Date: ");
+	append_to_response(resp, date);
+	append_to_response(resp, CRLF);
+	append_connection_to_response(resp);
+	/* RFC 9112 section 6.3 */
+	if (code < 200 || code == RC_204_NO_CONTENT || code == RC_304_NOT_MODIFIED) {
+		resp->delimited = 1;
+	}
+}
+
+void empty_response(
+		struct http_response *resp,
+		enum http_response_code code,
+		const char *date
+) {
+	begin_response(resp, code, date);
+	append_length_to_response(resp, 0);
+	append_to_response(resp, CRLF);
+}
+
+void canned_init(
+		struct canned_response *canned,
+		enum http_response_code code,
+		const char *headers,
+		const char *body
+) {
+	struct http_response all = new_response(), resp;
+	int d;
+
+	for (d = 0; d < CD__COUNT; ++d) {
+		resp = new_response();
+		resp.connection = (enum conn_disposition)d;
+		begin_response(&resp, code, DATE_PLACEHOLDER);
+		append_to_response(&resp, headers);
+		if (body != NULL) append_length_to_response(&resp, strlen(body));
+		append_to_response(&resp, CRLF);
+		canned->off[d] = all.len;
+		canned->head_len[d] = resp.len;
+		if (body != NULL) append_to_response(&resp, body);
+		canned->len[d] = resp.len;
+		canned->date_off = (size_t)(strstr(resp.buf, DATE_PLACEHOLDER) - resp.buf);
+		canned->delimited = resp.delimited;
+		append_to_response_n(&all, resp.buf, resp.len);
+		http_response_free(&resp);
+	}
+	canned->buf = all.buf;
+}
+
+void canned_free(struct canned_response *canned) {
+	free(canned->buf);
+	canned->buf = NULL;
+}
+
+void canned_serve(
+		struct canned_response *canned,
+		int with_body,
+		struct http_response *resp,
+		const char *date
+) {
+	char *copy = canned->buf + canned->off[resp->connection];
+
+	if (memcmp(copy + canned->date_off, date, HTTP_DATE_LEN)) {
+		memcpy(copy + canned->date_off, date, HTTP_DATE_LEN);
+	}
+	append_to_response_n(resp, copy, with_body ? canned->len[resp->connection] :
+		canned->head_len[resp->connection]);
+	resp->delimited = canned->delimited;
 }
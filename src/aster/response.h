@@ -2,6 +2,13 @@
 #define RESPONSE_H
 
 #include <stddef.h>
+#include <sys/types.h>
+
+#define SERVER "aster/0.0.0-alpha"
+#define NOT_FOUND "<!DOCTYPE html><html>" \
+		"<head><title>not found</title></head>" \
+		"<body>not found</body>" \
+		"</html>"
 
 enum http_response_code {
 	/* Informational 1xx */
@@ -44,6 +51,8 @@ enum http_response_code {
 	RC_415_UNSUPPORTED_MEDIA_TYPE = 415,
 	RC_416_REQUESTED_RANGE_NOT_SATISFIABLE = 416,
 	RC_417_EXPECTATION_FAILED = 417,
+	RC_421_MISDIRECTED_REQUEST = 421,
+	RC_426_UPGRADE_REQUIRED = 426,
 
 	/* Server Error 5xx */
 	RC_500_INTERNAL_SERVER_ERROR = 500,
@@ -54,14 +63,160 @@ enum http_response_code {
 	RC_505_HTTP_VERSION_NOT_SUPPORTED = 505
 };
 
+enum body_part_type {
+	BP_BUF = 0, /* bytes of buf past head_len */
+	BP_MEM, /* bytes of body_mem */
+	BP_FILE /* bytes of body_fd, sent with sendfile() */
+};
+
+/* a piece of the body, `off` being relative to what `type` refers to */
+struct body_part {
+	enum body_part_type type;
+	size_t off;
+	size_t len;
+};
+
+struct blob;
+struct pcache_entry;
+struct ra_file;
+struct stream;
+struct upstream;
+struct ws_handler;
+
+/* what a response tells the client of the connection, decided before its
+   head is written */
+enum conn_disposition {
+	CD_CLOSE = 0, /* Connection: close */
+	CD_KEEP_ALIVE, /* no field, HTTP/1.1 connections persist by default */
+	CD_KEEP_ALIVE_10, /* Connection: keep-alive, for HTTP/1.0 clients */
+	CD__COUNT
+};
+
+/* body written while the connection drains, see stream.h */
+struct body_stream {
+	int (*produce)(struct stream *st, void *ctx); /* NULL if none */
+	void (*release)(void *ctx);
+	void *ctx;
+	int chunked;
+};
+
 struct http_response {
 	char *buf;
 	size_t len;
 	size_t cap;
+
+	/* set before the head is begun, CD_CLOSE unless the connection may
+	   persist; the connection only does if the builder delimited the body
+	   too, with a Content-Length or chunked framing, or it has none */
+	enum conn_disposition connection;
+	int delimited;
+
+	/* without parts all of buf is sent, otherwise its first head_len bytes
+	   followed by every part in order */
+	size_t head_len;
+	struct body_part *parts;
+	size_t num_parts, cap_parts;
+
+	int body_fd; /* -1 if none, left open by its owner */
+	const unsigned char *body_mem; /* held by a cache, NULL if none */
+
+	/* what body_mem points into when a cache may free it, or what pins the
+	   span of body_fd a cache may overwrite, for queues that outlive the call
+	   to take a reference; NULL if static */
+	struct blob *body_blob;
+
+	/* page-cache hints for body_fd as it goes out, NULL if none */
+	struct ra_file *body_pages;
+
+	struct body_stream stream;
+
+	/* forward the request there rather than send this, see proxy.h */
+	struct upstream *upstream;
+	/* with `upstream`, hand it to that FastCGI application instead, see
+	   fastcgi.h, its scripts under `script_root` (NULL if none) */
+	int fastcgi;
+	const char *script_root;
+	/* a cached response the upstream is to confirm, referenced; with
+	   `background` this is sent meanwhile and the request forwarded only to
+	   refresh it */
+	struct pcache_entry *stale;
+	int background;
+
+	/* a 101 to WebSocket: the connection goes to it once this is queued,
+	   see ws.h */
+	const struct ws_handler *websocket;
 };
 
 struct http_response new_response(void);
 void append_to_response(struct http_response *resp, const char *str);
+void append_to_response_n(struct http_response *resp, const char *str, size_t n);
+void append_size_to_response(struct http_response *resp, size_t value);
+
+/* the Content-Length field, the body being delimited */
+void append_length_to_response(struct http_response *resp, size_t len);
+
+/* the Connection field `resp->connection` calls for, if any */
+void append_connection_to_response(struct http_response *resp);
+
 void http_response_free(struct http_response *resp);
 
+/* append a body part; the head ends where the first part is added */
+void add_body_part(
+		struct http_response *resp,
+		enum body_part_type type,
+		size_t off,
+		size_t len
+);
+
+/* append `n` bytes to buf as a BP_BUF part */
+void add_body_buf(struct http_response *resp, const char *str, size_t n);
+
+/* pre-serialized response whose Date is patched in place, one copy per
+   disposition of the connection */
+struct canned_response {
+	char *buf; /* every copy, NULL if not built */
+	size_t off[CD__COUNT]; /* of each copy in buf */
+	size_t len[CD__COUNT];
+	size_t head_len[CD__COUNT]; /* up to and including the empty line */
+	size_t date_off; /* from the start of a copy */
+	int delimited;
+};
+
+/* serialize a response with `headers` (CRLF terminated) and `body`, or
+   without Content-Length and body if `body` is NULL */
+void canned_init(
+		struct canned_response *canned,
+		enum http_response_code code,
+		const char *headers,
+		const char *body
+);
+void canned_free(struct canned_response *canned);
+
+/* append the copy for `resp->connection` with the current date, the body
+   only if asked */
+void canned_serve(
+		struct canned_response *canned,
+		int with_body,
+		struct http_response *resp,
+		const char *date
+);
+
+/* NULL if the code is unknown */
+const char *reason_phrase(enum http_response_code code);
+
+/* status line followed by Server, Date and, as `resp->connection` says,
+   Connection fields; statuses that never have a body are delimited */
+void begin_response(
+		struct http_response *resp,
+		enum http_response_code code,
+		const char *date
+);
+
+/* begin_response() for a response without other fields or body */
+void empty_response(
+		struct http_response *resp,
+		enum http_response_code code,
+		const char *date
+);
+
 #endif
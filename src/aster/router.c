@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "router.h"
+
+/* node of the trie under construction, children in a sibling list */
+struct route_build {
+	size_t label_off, label_len;
+	size_t first_child, next_sibling;
+	size_t param;
+
+	const void *exact[ROUTE_METHODS];
+	const void *prefix[ROUTE_METHODS];
+	unsigned exact_methods, prefix_methods;
+};
+
+/* state of one lookup, on the caller's stack */
+struct walk {
+	const struct router *router;
+	const char *path;
+	size_t len;
+	struct slice params[ROUTE_MAX_PARAMS];
+	size_t num_params;
+
+	struct route_match *match;
+	size_t exact_node;
+	size_t prefix_node, prefix_pos;
+};
+
+static size_t new_node(struct router *router, size_t label_off, size_t label_len) {
+	struct route_build *b;
+
+	if (router->num_build == router->cap_build) {
+		router->cap_build = router->cap_build ? router->cap_build * 2 : 16;
+		router->build = realloc(router->build,
+			router->cap_build * sizeof(struct route_build));
+		if (router->build == NULL) {
+			perror("router_add");
+			exit(1);
+		}
+	}
+	b = router->build + router->num_build;
+	memset(b, 0, sizeof *b);
+	b->label_off = label_off;
+	b->label_len = label_len;
+	b->first_child = ROUTE_NONE;
+	b->next_sibling = ROUTE_NONE;
+	b->param = ROUTE_NONE;
+	return router->num_build++;
+}
+
+static size_t add_label(struct router *router, const char *str, size_t len) {
+	size_t off = router->labels_len;
+
+	if (router->labels_len + len > router->labels_cap) {
+		while (router->labels_len + len > router->labels_cap) {
+			router->labels_cap = router->labels_cap ? router->labels_cap * 2 : 256;
+		}
+		router->labels = realloc(router->labels, router->labels_cap);
+		if (router->labels == NULL) {
+			perror("router_add");
+			exit(1);
+		}
+	}
+	memcpy(router->labels + off, str, len);
+	router->labels_len += len;
+	return off;
+}
+
+void router_init(struct router *router) {
+	memset(router, 0, sizeof *router);
+	new_node(router, 0, 0);
+}
+
+void router_free(struct router *router) {
+	free(router->nodes);
+	free(router->labels);
+	free(router->build);
+}
+
+/* descend from `node` along `len` static bytes, splitting edges that only
+   share a part of them, and return the node where they end */
+static size_t insert_static(struct router *router, size_t node, const char *str, size_t len) {
+	while (len > 0) {
+		size_t child = router->build[node].first_child;
+		size_t mid, k;
+		struct route_build *c;
+
+		while (child != ROUTE_NONE &&
+				router->labels[router->build[child].label_off] != *str) {
+			child = router->build[child].next_sibling;
+		}
+		if (child == ROUTE_NONE) {
+			size_t off = add_label(router, str, len);
+			child = new_node(router, off, len);
+			router->build[child].next_sibling = router->build[node].first_child;
+			router->build[node].first_child = child;
+			return child;
+		}
+
+		c = router->build + child;
+		for (k = 1; k < c->label_len && k < len &&
+				router->labels[c->label_off + k] == str[k]; ++k);
+
+		if (k < c->label_len) {
+			size_t prev = ROUTE_NONE, it;
+			for (it = router->build[node].first_child; it != child;
+					it = router->build[it].next_sibling) {
+				prev = it;
+			}
+			mid = new_node(router, router->build[child].label_off, k);
+			c = router->build + child;
+			router->build[mid].first_child = child;
+			router->build[mid].next_sibling = c->next_sibling;
+			if (prev == ROUTE_NONE) {
+				router->build[node].first_child = mid;
+			} else {
+				router->build[prev].next_sibling = mid;
+			}
+			c->label_off += k;
+			c->label_len -= k;
+			c->next_sibling = ROUTE_NONE;
+			child = mid;
+		}
+		node = child;
+		str += k;
+		len -= k;
+	}
+	return node;
+}
+
+static int set_targets(
+		const void **targets,
+		unsigned *mask,
+		unsigned methods,
+		const void *target
+) {
+	int m;
+	if (*mask & methods) return -1;
+	for (m = 0; m < ROUTE_METHODS; ++m) {
+		if (methods & METHOD_BIT(m)) targets[m] = target;
+	}
+	*mask |= methods;
+	return 0;
+}
+
+/* ':' opens a parameter and a final '*' a prefix, right after a slash */
+static int is_special(const char *pattern, size_t pos, size_t len) {
+	return pattern[pos - 1] == '/' &&
+		(pattern[pos] == ':' || (pattern[pos] == '*' && pos == len - 1));
+}
+
+int router_add(struct router *router, unsigned methods, const char *pattern, const void *target) {
+	size_t len = strlen(pattern);
+	size_t pos = 0, end, node = 0;
+	struct route_build *b;
+
+	methods &= ROUTE_ANY_METHOD;
+	if (router->nodes != NULL || len == 0 || pattern[0] != '/' || methods == 0) {
+		return -1;
+	}
+
+	while (pos < len) {
+		if (pos > 0 && pattern[pos] == '*' && is_special(pattern, pos, len)) {
+			b = router->build + node;
+			return set_targets(b->prefix, &b->prefix_methods, methods, target);
+		}
+		if (pos > 0 && pattern[pos] == ':' && is_special(pattern, pos, len)) {
+			for (end = pos + 1; end < len && pattern[end] != '/'; ++end);
+			if (end == pos + 1) return -1;
+			if (router->build[node].param == ROUTE_NONE) {
+				size_t param = new_node(router, 0, 0);
+				router->build[node].param = param;
+			}
+			node = router->build[node].param;
+			pos = end;
+			continue;
+		}
+		for (end = pos + 1; end < len && !is_special(pattern, end, len); ++end);
+		node = insert_static(router, node, pattern + pos, end - pos);
+		pos = end;
+	}
+
+	b = router->build + node;
+	return set_targets(b->exact, &b->exact_methods, methods, target);
+}
+
+void router_compile(struct router *router) {
+	size_t *order = malloc(router->num_build * sizeof(size_t));
+	size_t head, count = 1;
+
+	router->nodes = malloc(router->num_build * sizeof(struct route_node));
+	if (order == NULL || router->nodes == NULL) {
+		perror("router_compile");
+		exit(1);
+	}
+
+	/* breadth first, so that the children of a node are contiguous */
+	order[0] = 0;
+	for (head = 0; head < count; ++head) {
+		const struct route_build *b = router->build + order[head];
+		struct route_node *n = router->nodes + head;
+		size_t c;
+
+		n->label_off = b->label_off;
+		n->label_len = b->label_len;
+		memcpy(n->exact, b->exact, sizeof n->exact);
+		memcpy(n->prefix, b->prefix, sizeof n->prefix);
+		n->exact_methods = b->exact_methods;
+		n->prefix_methods = b->prefix_methods;
+
+		n->children = count;
+		n->num_children = 0;
+		for (c = b->first_child; c != ROUTE_NONE; c = router->build[c].next_sibling) {
+			unsigned char first = (unsigned char)router->labels[router->build[c].label_off];
+			size_t at = count + n->num_children++;
+			while (at > count && (unsigned char)router->labels[
+					router->build[order[at - 1]].label_off] > first) {
+				order[at] = order[at - 1];
+				at--;
+			}
+			order[at] = c;
+		}
+		count += n->num_children;
+
+		n->param = ROUTE_NONE;
+		if (b->param != ROUTE_NONE) {
+			n->param = count;
+			order[count++] = b->param;
+		}
+	}
+	router->num_nodes = count;
+
+	free(order);
+	free(router->build);
+	router->build = NULL;
+	router->num_build = router->cap_build = 0;
+}
+
+static size_t find_child(const struct router *router, const struct route_node *node, char ch) {
+	size_t lo = node->children, hi = node->children + node->num_children;
+	unsigned char key = (unsigned char)ch;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		unsigned char first = (unsigned char)router->labels[router->nodes[mid].label_off];
+		if (first == key) return mid;
+		if (first < key) lo = mid + 1;
+		else hi = mid;
+	}
+	return ROUTE_NONE;
+}
+
+static void keep_params(struct walk *w) {
+	memcpy(w->match->params, w->params, w->num_params * sizeof(struct slice));
+	w->match->num_params = w->num_params;
+}
+
+/* depth first, static edges before the parameter; 1 once an exact route
+   matched, the deepest prefix route being remembered on the way */
+static int walk(struct walk *w, size_t idx, size_t pos) {
+	const struct route_node *node = w->router->nodes + idx;
+	size_t child, end;
+
+	if (node->prefix_methods && (w->prefix_node == ROUTE_NONE || pos >= w->prefix_pos)) {
+		w->prefix_node = idx;
+		w->prefix_pos = pos;
+		keep_params(w);
+	}
+	if (pos == w->len) {
+		if (!node->exact_methods) return 0;
+		w->exact_node = idx;
+		keep_params(w);
+		return 1;
+	}
+
+	child = find_child(w->router, node, w->path[pos]);
+	if (child != ROUTE_NONE) {
+		const struct route_node *c = w->router->nodes + child;
+		if (w->len - pos >= c->label_len &&
+				!memcmp(w->path + pos, w->router->labels + c->label_off, c->label_len) &&
+				walk(w, child, pos + c->label_len)) {
+			return 1;
+		}
+	}
+
+	if (node->param != ROUTE_NONE && w->num_params < ROUTE_MAX_PARAMS) {
+		for (end = pos; end < w->len && w->path[end] != '/'; ++end);
+		if (end > pos) {
+			w->params[w->num_params].ptr = w->path + pos;
+			w->params[w->num_params].len = end - pos;
+			w->num_params++;
+			if (walk(w, node->param, end)) return 1;
+			w->num_params--;
+		}
+	}
+	return 0;
+}
+
+enum route_status router_lookup(
+		const struct router *router,
+		enum http_method method,
+		const struct slice *path,
+		struct route_match *match
+) {
+	struct walk w;
+	const struct route_node *node;
+	const void *const *targets;
+	unsigned mask;
+
+	match->target = NULL;
+	match->num_params = 0;
+	match->rest.ptr = path->ptr + path->len;
+	match->rest.len = 0;
+	match->allowed = 0;
+	if (router->nodes == NULL) return ROUTE_NOT_FOUND;
+
+	w.router = router;
+	w.path = path->ptr;
+	w.len = path->len;
+	w.num_params = 0;
+	w.match = match;
+	w.exact_node = ROUTE_NONE;
+	w.prefix_node = ROUTE_NONE;
+	w.prefix_pos = 0;
+
+	if (walk(&w, 0, 0)) {
+		node = router->nodes + w.exact_node;
+		targets = node->exact;
+		mask = node->exact_methods;
+	} else if (w.prefix_node != ROUTE_NONE) {
+		node = router->nodes + w.prefix_node;
+		targets = node->prefix;
+		mask = node->prefix_methods;
+		match->rest.ptr = path->ptr + w.prefix_pos;
+		match->rest.len = path->len - w.prefix_pos;
+	} else {
+		return ROUTE_NOT_FOUND;
+	}
+
+	if (mask & METHOD_BIT(HM_GET)) mask |= METHOD_BIT(HM_HEAD);
+	match->allowed = mask;
+	if (!(mask & METHOD_BIT(method))) return ROUTE_METHOD_NOT_ALLOWED;
+	match->target = targets[method] != NULL ? targets[method] : targets[HM_GET];
+	return ROUTE_FOUND;
+}
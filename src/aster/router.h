@@ -0,0 +1,79 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "request.h"
+
+#define ROUTE_NONE SIZE_MAX
+#define ROUTE_MAX_PARAMS 8
+#define ROUTE_METHODS (HM_TRACE + 1)
+
+#define METHOD_BIT(method) (1u << (method))
+#define ROUTE_ANY_METHOD (((1u << ROUTE_METHODS) - 1) & ~METHOD_BIT(HM_UNK))
+
+/* node of the compiled trie; the edge into a node is a run of path bytes,
+   or a whole segment for parameter nodes */
+struct route_node {
+	size_t label_off, label_len; /* into labels, empty for parameter nodes */
+	size_t children, num_children; /* static children, sorted by first byte */
+	size_t param; /* ":name" child or ROUTE_NONE */
+
+	/* targets by method of the routes ending here, and of the "*" routes
+	   whose prefix ends here */
+	const void *exact[ROUTE_METHODS];
+	const void *prefix[ROUTE_METHODS];
+	unsigned exact_methods, prefix_methods;
+};
+
+struct route_build;
+
+/* routes are added first, then compiled into a flat radix trie that lookups
+   walk without allocating */
+struct router {
+	struct route_node *nodes; /* root first, NULL until compiled */
+	size_t num_nodes;
+	char *labels;
+	size_t labels_len, labels_cap;
+
+	struct route_build *build; /* trie under construction */
+	size_t num_build, cap_build;
+};
+
+enum route_status {
+	ROUTE_FOUND = 0,
+	ROUTE_NOT_FOUND,
+	ROUTE_METHOD_NOT_ALLOWED
+};
+
+struct route_match {
+	const void *target;
+	struct slice params[ROUTE_MAX_PARAMS]; /* ":name" segments, in order */
+	size_t num_params;
+	struct slice rest; /* path past the prefix of a "*" route */
+	unsigned allowed; /* METHOD_BIT()s of the matched path */
+};
+
+void router_init(struct router *router);
+void router_free(struct router *router);
+
+/* add a route for `methods` (METHOD_BIT()s). A pattern is an absolute path
+   whose segments may be ":name" parameters, matching one non-empty segment;
+   a last segment "*" matches every path under the preceding ones. Return -1
+   if the pattern is malformed or a method is already routed for it */
+int router_add(struct router *router, unsigned methods, const char *pattern, const void *target);
+
+/* lay the routes out for lookups; no route can be added afterwards */
+void router_compile(struct router *router);
+
+/* resolve a request path: an exact route wins over a "*" one, static
+   segments over parameters, longer prefixes over shorter ones. The most
+   specific matching path decides the methods; HEAD falls back to GET */
+enum route_status router_lookup(
+		const struct router *router,
+		enum http_method method,
+		const struct slice *path,
+		struct route_match *match
+);
+
+#endif
@@ -0,0 +1,123 @@
+#include <string.h>
+#include "sha1.h"
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+void sha1_init(struct sha1 *s) {
+	s->h[0] = 0x67452301ul;
+	s->h[1] = 0xefcdab89ul;
+	s->h[2] = 0x98badcfeul;
+	s->h[3] = 0x10325476ul;
+	s->h[4] = 0xc3d2e1f0ul;
+	s->block_len = 0;
+	s->bytes = 0;
+}
+
+static void compress(struct sha1 *s, const unsigned char *p) {
+	uint32_t w[80], a, b, c, d, e, f, k, t;
+	int i;
+
+	for (i = 0; i < 16; ++i) {
+		w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+			(uint32_t)p[4 * i + 2] << 8 | (uint32_t)p[4 * i + 3];
+	}
+	for (i = 16; i < 80; ++i) {
+		t = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+		w[i] = ROL(t, 1);
+	}
+	a = s->h[0];
+	b = s->h[1];
+	c = s->h[2];
+	d = s->h[3];
+	e = s->h[4];
+	for (i = 0; i < 80; ++i) {
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999ul;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1ul;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdcul;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6ul;
+		}
+		t = ROL(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROL(b, 30);
+		b = a;
+		a = t;
+	}
+	s->h[0] += a;
+	s->h[1] += b;
+	s->h[2] += c;
+	s->h[3] += d;
+	s->h[4] += e;
+}
+
+void sha1_update(struct sha1 *s, const void *data, size_t len) {
+	const unsigned char *p = data;
+	size_t n;
+
+	s->bytes += len;
+	while (len > 0) {
+		n = SHA1_BLOCK - s->block_len;
+		if (n > len) n = len;
+		memcpy(s->block + s->block_len, p, n);
+		s->block_len += n;
+		p += n;
+		len -= n;
+		if (s->block_len == SHA1_BLOCK) {
+			compress(s, s->block);
+			s->block_len = 0;
+		}
+	}
+}
+
+void sha1_final(struct sha1 *s, unsigned char digest[SHA1_DIGEST_LEN]) {
+	/* the length in bits, big-endian, after a one bit and zeros */
+	unsigned long bits_hi = s->bytes >> 29, bits_lo = s->bytes << 3;
+	unsigned char pad[SHA1_BLOCK + 8];
+	size_t n;
+	int i;
+
+	n = s->block_len < 56 ? 56 - s->block_len : 120 - s->block_len;
+	memset(pad, 0, n);
+	pad[0] = 0x80;
+	for (i = 0; i < 4; ++i) {
+		pad[n + i] = (unsigned char)(bits_hi >> (24 - 8 * i));
+		pad[n + 4 + i] = (unsigned char)(bits_lo >> (24 - 8 * i));
+	}
+	sha1_update(s, pad, n + 8);
+	for (i = 0; i < SHA1_DIGEST_LEN; ++i) {
+		digest[i] = (unsigned char)(s->h[i / 4] >> (24 - 8 * (i % 4)));
+	}
+}
+
+size_t base64_encode(const unsigned char *in, size_t len, char *out) {
+	static const char alphabet[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	unsigned long v;
+	size_t i, n = 0;
+
+	for (i = 0; i + 2 < len; i += 3) {
+		v = (unsigned long)in[i] << 16 | (unsigned long)in[i + 1] << 8 | in[i + 2];
+		out[n++] = alphabet[v >> 18];
+		out[n++] = alphabet[v >> 12 & 0x3f];
+		out[n++] = alphabet[v >> 6 & 0x3f];
+		out[n++] = alphabet[v & 0x3f];
+	}
+	if (i < len) {
+		v = (unsigned long)in[i] << 16;
+		if (i + 1 < len) v |= (unsigned long)in[i + 1] << 8;
+		out[n++] = alphabet[v >> 18];
+		out[n++] = alphabet[v >> 12 & 0x3f];
+		out[n++] = i + 1 < len ? alphabet[v >> 6 & 0x3f] : '=';
+		out[n++] = '=';
+	}
+	out[n] = '\0';
+	return n;
+}
@@ -0,0 +1,28 @@
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* SHA-1, RFC 3174: for the WebSocket handshake only, which uses it as a
+   checksum rather than for security */
+#define SHA1_DIGEST_LEN 20
+#define SHA1_BLOCK 64
+
+struct sha1 {
+	uint32_t h[5];
+	unsigned char block[SHA1_BLOCK];
+	size_t block_len;
+	unsigned long bytes; /* hashed so far, messages being short */
+};
+
+void sha1_init(struct sha1 *s);
+void sha1_update(struct sha1 *s, const void *data, size_t len);
+void sha1_final(struct sha1 *s, unsigned char digest[SHA1_DIGEST_LEN]);
+
+/* encode `len` bytes in base64, RFC 4648 section 4, with padding into
+   `out`, room for 4 * ((len + 2) / 3) + 1 bytes: the length, `out` being
+   terminated */
+size_t base64_encode(const unsigned char *in, size_t len, char *out);
+
+#endif
@@ -71,3 +71,13 @@ int is_qdtext(char ch) {
 	if (!is_vchar(ch) && !is_obs_text(ch) && ch != SYM_SP && ch != SYM_HTAB) return 0;
 	return ch != '\"' && ch != '\\';
 }
+
+uint32_t hash_bytes(const char *ptr, size_t len, uint32_t seed) {
+	uint32_t hash = seed;
+	size_t pos;
+	for (pos = 0; pos < len; ++pos) {
+		hash ^= (unsigned char)ptr[pos];
+		hash *= 16777619u;
+	}
+	return hash;
+}
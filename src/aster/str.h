@@ -1,6 +1,7 @@
 #ifndef HTTP_STR_H
 #define HTTP_STR_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define SYM_SP ' '
@@ -42,4 +43,9 @@ uint8_t to_digit(char ch);
 /* return 1 if qdtext, 0 otherwise */
 int is_qdtext(char ch);
 
+#define HASH_SEED 2166136261u
+
+/* FNV-1a over `len` bytes, starting from `seed` (HASH_SEED by default) */
+uint32_t hash_bytes(const char *ptr, size_t len, uint32_t seed);
+
 #endif
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "str.h"
+#include "stream.h"
+
+#define LAST_CHUNK "0" CRLF CRLF
+
+void stream_response(
+		struct http_response *resp,
+		const struct http_request *req,
+		enum http_response_code code,
+		const char *headers,
+		const char *date,
+		int (*produce)(struct stream *st, void *ctx),
+		void (*release)(void *ctx),
+		void *ctx
+) {
+	int chunked = req->http_major == 1 && req->http_minor >= 1;
+
+	if (!chunked) resp->connection = CD_CLOSE;
+	begin_response(resp, code, date);
+	append_to_response(resp, headers);
+	if (chunked) {
+		append_to_response(resp, "Transfer-Encoding: chunked" CRLF);
+		resp->delimited = 1;
+	}
+	append_to_response(resp, CRLF);
+
+	if (req->method == HM_HEAD) {
+		if (release != NULL) release(ctx);
+		return;
+	}
+	resp->stream.produce = produce;
+	resp->stream.release = release;
+	resp->stream.ctx = ctx;
+	resp->stream.chunked = chunked;
+}
+
+void stream_init(struct stream *st, struct outq *out, const struct body_stream *source) {
+	st->out = out;
+	st->source = *source;
+	st->buf = NULL;
+	st->len = 0;
+	st->written = 0;
+	st->active = source->produce != NULL;
+}
+
+void stream_free(struct stream *st) {
+	free(st->buf);
+	st->buf = NULL;
+	if (st->source.release != NULL) st->source.release(st->source.ctx);
+	st->source.release = NULL;
+	st->active = 0;
+}
+
+/* frame the chunk being filled and hand it to the queue */
+static void queue_chunk(struct stream *st) {
+	char size[STREAM_HEAD_ROOM + 1];
+	size_t size_len;
+	char *head;
+
+	if (st->buf == NULL || st->len == 0) return;
+	if (st->source.chunked) {
+		size_len = (size_t)sprintf(size, "%lx" CRLF, (unsigned long)st->len);
+		head = st->buf + STREAM_HEAD_ROOM - size_len;
+		memcpy(head, size, size_len);
+		memcpy(st->buf + STREAM_HEAD_ROOM + st->len, CRLF, 2);
+		outq_push_mem(st->out, head, size_len + st->len + 2, st->buf, NULL);
+	} else {
+		outq_push_mem(st->out, st->buf + STREAM_HEAD_ROOM, st->len, st->buf, NULL);
+	}
+	st->buf = NULL;
+	st->len = 0;
+}
+
+void stream_write(struct stream *st, const char *data, size_t len) {
+	size_t n;
+
+	st->written += len;
+	while (len > 0) {
+		if (st->buf == NULL) {
+			st->buf = malloc(STREAM_HEAD_ROOM + STREAM_CHUNK + 2);
+			if (st->buf == NULL) {
+				perror("stream_write");
+				exit(1);
+			}
+		}
+		n = STREAM_CHUNK - st->len < len ? STREAM_CHUNK - st->len : len;
+		memcpy(st->buf + STREAM_HEAD_ROOM + st->len, data, n);
+		st->len += n;
+		data += n;
+		len -= n;
+		if (st->len == STREAM_CHUNK) queue_chunk(st);
+	}
+}
+
+void stream_puts(struct stream *st, const char *str) {
+	stream_write(st, str, strlen(str));
+}
+
+int stream_pump(struct stream *st) {
+	int ret = 1;
+
+	while (st->active && ret == 1 && st->out->bytes + st->len < STREAM_CHUNK) {
+		ret = st->source.produce(st, st->source.ctx);
+	}
+	if (!st->active) return 0;
+
+	/* what was produced goes out now, however small */
+	queue_chunk(st);
+	if (ret == 0 && st->source.chunked) {
+		outq_push_mem(st->out, LAST_CHUNK, sizeof LAST_CHUNK - 1, NULL, NULL);
+	}
+	if (ret != 1) stream_free(st);
+	return ret == -1 ? -1 : 0;
+}
@@ -0,0 +1,59 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+#include "outq.h"
+#include "request.h"
+#include "response.h"
+
+/* body bytes per chunk, and how much a stream lets pile up in the queue
+   before it asks its producer for more */
+#define STREAM_CHUNK (16ul << 10)
+
+/* room ahead of a chunk for its size line, hex digits and CRLF */
+#define STREAM_HEAD_ROOM 8
+
+/* a body written as it is produced: chunked for HTTP/1.1, delimited by
+   closing the connection for HTTP/1.0. Writes are gathered into chunk
+   buffers whose framing is filled in place before they are queued */
+struct stream {
+	struct outq *out;
+	struct body_stream source;
+	char *buf; /* chunk being filled, NULL if none */
+	size_t len;
+	size_t written; /* body bytes so far */
+	int active;
+};
+
+/* write the head of `resp` with `headers` (CRLF terminated) for a body
+   that `produce` will write; the response then carries no parts. A body
+   not chunked has the connection close, whatever `resp->connection`
+   offered. HEAD requests get the head only, `release` being called at
+   once */
+void stream_response(
+		struct http_response *resp,
+		const struct http_request *req,
+		enum http_response_code code,
+		const char *headers,
+		const char *date,
+		int (*produce)(struct stream *st, void *ctx),
+		void (*release)(void *ctx),
+		void *ctx
+);
+
+/* start streaming into `out` what `source` produces, after its head */
+void stream_init(struct stream *st, struct outq *out, const struct body_stream *source);
+
+/* release the producer, written or not */
+void stream_free(struct stream *st);
+
+/* append body bytes, queuing every chunk that fills up */
+void stream_write(struct stream *st, const char *data, size_t len);
+void stream_puts(struct stream *st, const char *str);
+
+/* have the producer write until STREAM_CHUNK bytes are queued or it is
+   done, then queue what it wrote; the stream ends when it returns 0 and
+   -1 is returned if it failed */
+int stream_pump(struct stream *st);
+
+#endif
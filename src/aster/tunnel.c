@@ -0,0 +1,272 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "datetime.h"
+#include "response.h"
+#include "str.h"
+#include "tunnel.h"
+
+/* what is read is at most PROXY_READ at once, never worth pinning */
+static struct zerocopy no_zerocopy;
+
+static void tunnel_event(struct evloop *loop, struct ev_source *src, unsigned events);
+
+void tunnel_init(
+		struct tunnel *t,
+		struct evloop *loop,
+		struct upstream *up,
+		int client_fd,
+		struct outq *to_client,
+		void (*notify)(struct tunnel *t),
+		void *owner
+) {
+	memset(t, 0, sizeof *t);
+	t->src.fd = -1;
+	t->src.handle = tunnel_event;
+	t->loop = loop;
+	t->up = up;
+	t->state = TN_CONNECTING;
+	outq_init(&t->to_upstream);
+	t->up_pipe.rd = t->up_pipe.wr = -1;
+	t->down_pipe.rd = t->down_pipe.wr = -1;
+	t->client_fd = client_fd;
+	t->to_client = to_client;
+	t->notify = notify;
+	t->owner = owner;
+	up->outstanding++;
+}
+
+static void close_upstream(struct tunnel *t) {
+	if (t->src.fd == -1) return;
+	evloop_del(t->loop, &t->src);
+	close(t->src.fd);
+	t->src.fd = -1;
+	t->events = 0;
+}
+
+/* no longer in flight on the upstream */
+static void leave(struct tunnel *t) {
+	if (t->state < TN_DONE) t->up->outstanding--;
+}
+
+/* nothing more goes upstream */
+static void drop_upstream(struct tunnel *t) {
+	close_upstream(t);
+	outq_free(&t->to_upstream);
+	outq_init(&t->to_upstream);
+	relay_pipe_close(&t->up_pipe);
+}
+
+static void fail(struct tunnel *t) {
+	struct http_response resp;
+	char date[HTTP_DATE_LEN + 1] = {0};
+
+	leave(t);
+	drop_upstream(t);
+	if (t->state != TN_CONNECTING) {
+		t->state = TN_BROKEN;
+		return;
+	}
+	t->up->stats.failures++;
+	get_current_time(date);
+	resp = new_response();
+	empty_response(&resp, RC_502_BAD_GATEWAY, date);
+	if (outq_push_response(t->to_client, &resp) == -1) {
+		/* not whole, the client is not to take it */
+		perror("dup");
+		t->state = TN_BROKEN;
+		return;
+	}
+	t->state = TN_DONE;
+}
+
+/* both ways ended upstream: the client gets what is left, then the end */
+static void check_done(struct tunnel *t) {
+	if (t->state != TN_OPEN || !t->upstream_eof || !t->upstream_shut) return;
+	leave(t);
+	drop_upstream(t);
+	t->state = TN_DONE;
+}
+
+static void update_events(struct tunnel *t) {
+	unsigned events = 0;
+
+	if (t->state >= TN_DONE) return;
+	if (t->state == TN_CONNECTING || t->to_upstream.bytes > 0) events |= EPOLLOUT;
+	if (t->state == TN_OPEN && !t->upstream_eof && t->to_client->bytes < PROXY_BUFFER) {
+		events |= EPOLLIN;
+	}
+	if (events != t->events && evloop_mod(t->loop, &t->src, events) == 0) {
+		t->events = events;
+	}
+}
+
+void tunnel_start(struct tunnel *t, const char *early, size_t len) {
+	char *copy;
+	int fd;
+
+	if (len > 0) {
+		copy = malloc(len);
+		if (copy == NULL) {
+			perror("tunnel");
+			exit(1);
+		}
+		memcpy(copy, early, len);
+		outq_push_mem(&t->to_upstream, copy, len, copy, NULL);
+	}
+	fd = upstream_open(t->up);
+	if (fd != -1) {
+		t->src.fd = fd;
+		if (evloop_add(t->loop, &t->src, EPOLLOUT) == 0) {
+			zc_socket_init(&t->zs, fd);
+			t->events = EPOLLOUT;
+			return;
+		}
+		close(fd);
+		t->src.fd = -1;
+	}
+	fail(t);
+	t->notify(t);
+}
+
+size_t tunnel_room(const struct tunnel *t) {
+	if (t->state >= TN_DONE || t->client_eof || t->to_upstream.bytes >= PROXY_BUFFER) return 0;
+	return PROXY_BUFFER - t->to_upstream.bytes;
+}
+
+/* `room` bytes of `fd` queued on `q`, through `pipe` unless there cannot
+   be one */
+static ssize_t move(int fd, struct outq *q, struct relay_pipe *pipe, size_t room, struct upstream *up) {
+	struct relay_pipe *p = pipe != NULL ? relay_pipe_get(pipe) : NULL;
+	ssize_t n;
+	char *data;
+
+	if (p != NULL) {
+		n = splice(fd, NULL, p->wr, NULL, room, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n > 0) {
+			outq_push_pipe(q, p->rd, (size_t)n);
+			up->stats.spliced += (size_t)n;
+		}
+		return n;
+	}
+	if (room > PROXY_READ) room = PROXY_READ;
+	data = malloc(room);
+	if (data == NULL) {
+		perror("tunnel");
+		exit(1);
+	}
+	n = recv(fd, data, room, 0);
+	if (n > 0) {
+		outq_push_mem(q, data, (size_t)n, data, NULL);
+	} else {
+		free(data);
+	}
+	return n;
+}
+
+ssize_t tunnel_pull(struct tunnel *t, int fd) {
+	ssize_t n = move(fd, &t->to_upstream, &t->up_pipe, tunnel_room(t), t->up);
+
+	if (n == 0) {
+		t->client_eof = 1;
+		/* or once connected, or once what is queued is sent */
+		if (t->state == TN_OPEN && t->to_upstream.bytes == 0) {
+			shutdown(t->src.fd, SHUT_WR);
+			t->upstream_shut = 1;
+			check_done(t);
+		}
+	}
+	if (n >= 0) update_events(t);
+	return n;
+}
+
+void tunnel_drained(struct tunnel *t) {
+	if (t->state != TN_OPEN || !t->upstream_eof || t->client_shut) return;
+	shutdown(t->client_fd, SHUT_WR);
+	t->client_shut = 1;
+}
+
+void tunnel_resume(struct tunnel *t) {
+	update_events(t);
+}
+
+void tunnel_free(struct tunnel *t) {
+	leave(t);
+	t->state = TN_DONE;
+	drop_upstream(t);
+	relay_pipe_close(&t->down_pipe);
+}
+
+/* send what the client sent, then its end */
+static void flush_upstream(struct tunnel *t) {
+	if (t->to_upstream.bytes > 0) {
+		switch (outq_flush(&t->to_upstream, &no_zerocopy, &t->zs)) {
+		case OUTQ_ERROR:
+			fail(t);
+			return;
+		case OUTQ_AGAIN:
+			return;
+		case OUTQ_DONE:
+			break;
+		}
+	}
+	if (t->client_eof && !t->upstream_shut) {
+		shutdown(t->src.fd, SHUT_WR);
+		t->upstream_shut = 1;
+	}
+}
+
+static void read_upstream(struct tunnel *t, unsigned events) {
+	size_t room;
+	ssize_t n;
+
+	while (!t->upstream_eof) {
+		room = t->to_client->bytes < PROXY_BUFFER ? PROXY_BUFFER - t->to_client->bytes : 0;
+		/* closed both ways, it would be reported forever: what is left in
+		   the socket is taken whatever the room */
+		if (room == 0 && !(events & EPOLLHUP)) return;
+		n = move(t->src.fd, t->to_client, room > 0 ? &t->down_pipe : NULL,
+			room > 0 ? room : PROXY_READ, t->up);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) fail(t);
+			return;
+		}
+		if (n == 0) t->upstream_eof = 1;
+	}
+}
+
+static void tunnel_event(struct evloop *loop, struct ev_source *src, unsigned events) {
+	struct tunnel *t = (struct tunnel *)src;
+	int err = 0;
+	socklen_t err_len = sizeof err;
+
+	(void)loop;
+	if (t->state == TN_CONNECTING) {
+		if (getsockopt(src->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == -1 || err != 0) {
+			fail(t);
+			t->notify(t);
+			return;
+		}
+		t->state = TN_OPEN;
+		outq_push_mem(t->to_client, TUNNEL_ESTABLISHED, sizeof TUNNEL_ESTABLISHED - 1, NULL, NULL);
+	}
+
+	flush_upstream(t);
+	if (t->state == TN_OPEN && (events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+		read_upstream(t, events);
+	}
+	if (t->state == TN_OPEN && t->upstream_eof && (events & (EPOLLERR | EPOLLHUP))) {
+		/* gone both ways, whatever the client sends goes nowhere */
+		t->upstream_shut = 1;
+	}
+	check_done(t);
+	update_events(t);
+	t->notify(t);
+}
@@ -0,0 +1,84 @@
+#ifndef TUNNEL_H
+#define TUNNEL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "evloop.h"
+#include "outq.h"
+#include "proxy.h"
+#include "str.h"
+#include "upstream.h"
+#include "zerocopy.h"
+
+/* the reply to a CONNECT once the upstream accepted the connection */
+#define TUNNEL_ESTABLISHED "HTTP/1.1 200 Connection Established" CRLF CRLF
+
+enum tunnel_state {
+	TN_CONNECTING = 0,
+	TN_OPEN, /* relaying both ways until each has ended */
+	TN_DONE, /* both ways ended upstream, or the 502 is queued */
+	TN_BROKEN /* a side failed, the client must be dropped */
+};
+
+/* the bytes of a CONNECT relayed to an upstream and back untouched, each
+   way ending on its own: spliced through a pipe per direction, each side
+   read only while the other has room */
+struct tunnel {
+	struct ev_source src; /* the upstream connection, -1 once closed */
+	struct evloop *loop;
+	struct upstream *up;
+	enum tunnel_state state;
+	unsigned events; /* watched on src */
+
+	struct outq to_upstream;
+	struct zc_socket zs;
+	struct relay_pipe up_pipe;
+	int client_eof; /* the client sends no more */
+	int upstream_shut; /* and the upstream was told so */
+
+	int client_fd; /* read and written by the owner, shut down here */
+	struct outq *to_client;
+	struct relay_pipe down_pipe;
+	int upstream_eof; /* the upstream sends no more */
+	int client_shut; /* and the client was told so */
+
+	/* bytes moved, the tunnel ended or failed */
+	void (*notify)(struct tunnel *t);
+	void *owner;
+};
+
+/* `to_client` is the queue the owner flushes to `client_fd` */
+void tunnel_init(
+		struct tunnel *t,
+		struct evloop *loop,
+		struct upstream *up,
+		int client_fd,
+		struct outq *to_client,
+		void (*notify)(struct tunnel *t),
+		void *owner
+);
+
+/* connect to the upstream, `early` (copied) being what the client sent
+   past its request; the client gets TUNNEL_ESTABLISHED once connected,
+   a 502 if it cannot be */
+void tunnel_start(struct tunnel *t, const char *early, size_t len);
+
+/* client bytes that may be read now */
+size_t tunnel_room(const struct tunnel *t);
+
+/* move what the client sent towards the upstream: > 0 if some came, 0 at
+   its end, which is passed on, -1 with errno set */
+ssize_t tunnel_pull(struct tunnel *t, int fd);
+
+/* the owner flushed the client queue: the client learns of the upstream's
+   end once it has everything before it */
+void tunnel_drained(struct tunnel *t);
+
+/* the client queue drained some, the upstream may be read again */
+void tunnel_resume(struct tunnel *t);
+
+/* close the upstream side; the client queue, which may read from its
+   pipe, must be freed first */
+void tunnel_free(struct tunnel *t);
+
+#endif
@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include "resolver.h"
+#include "upstream.h"
+
+/* "unix:/path" names a local socket */
+static int local_addr(struct upstream *up, const char *path) {
+	struct sockaddr_un un;
+	size_t len = strlen(path);
+
+	if (len == 0 || len >= sizeof un.sun_path) return -1;
+	memset(&un, 0, sizeof un);
+	un.sun_family = AF_UNIX;
+	memcpy(un.sun_path, path, len + 1);
+	memcpy(&up->addr, &un, sizeof un);
+	up->addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len + 1);
+	return 0;
+}
+
+/* the rest of an upstream whose address is set */
+static void name_upstream(struct upstream *up, const char *name) {
+	up->name = malloc(strlen(name) + 1);
+	if (up->name == NULL) {
+		perror("upstream_init");
+		exit(1);
+	}
+	strcpy(up->name, name);
+	up->probe.src.fd = -1;
+	up->probe.up = up;
+}
+
+int upstream_init(struct upstream *up, const char *name) {
+	int ret;
+
+	memset(up, 0, sizeof *up);
+	ret = !strncmp(name, UPSTREAM_UNIX, sizeof UPSTREAM_UNIX - 1) ?
+		local_addr(up, name + sizeof UPSTREAM_UNIX - 1) :
+		resolve_name(name, 0, &up->addr, &up->addr_len);
+	if (ret == -1) return -1;
+	name_upstream(up, name);
+	return 0;
+}
+
+void upstream_free(struct upstream *up) {
+	while (up->num_idle > 0) close(up->idle[--up->num_idle].fd);
+	if (up->probe.src.fd != -1) {
+		evloop_del(up->probe.loop, &up->probe.src);
+		close(up->probe.src.fd);
+		up->probe.src.fd = -1;
+	}
+	free(up->name);
+	up->name = NULL;
+}
+
+int upstream_take(struct upstream *up) {
+	char byte;
+	ssize_t n;
+	int fd;
+
+	while (up->num_idle > 0) {
+		fd = up->idle[--up->num_idle].fd;
+		/* an idle backend has nothing to say but its closing */
+		n = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			up->stats.reuses++;
+			return fd;
+		}
+		up->stats.stale++;
+		close(fd);
+	}
+	return -1;
+}
+
+/* a non-blocking connection on its way, -1 if it failed already */
+static int start_connect(const struct upstream *up) {
+	int fd = socket(up->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (fd == -1) return -1;
+	if (connect(fd, (const void *)&up->addr, up->addr_len) == -1 &&
+			errno != EINPROGRESS) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int upstream_open(struct upstream *up) {
+	int fd = start_connect(up), yes = 1;
+
+	if (fd == -1) return -1;
+	/* heads and small bodies go out in one write each */
+	if (up->addr.ss_family != AF_UNIX) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+	up->stats.connects++;
+	return fd;
+}
+
+void upstream_release(struct upstream *up, int fd, int reusable) {
+	if (!reusable) {
+		close(fd);
+		return;
+	}
+	if (up->num_idle == UPSTREAM_IDLE_MAX) {
+		close(up->idle[0].fd);
+		memmove(up->idle, up->idle + 1, (UPSTREAM_IDLE_MAX - 1) * sizeof up->idle[0]);
+		up->num_idle--;
+	}
+	up->idle[up->num_idle].fd = fd;
+	up->idle[up->num_idle].since = time(NULL);
+	up->num_idle++;
+}
+
+void upstream_expire(struct upstream *up, time_t now) {
+	size_t expired = 0, i;
+
+	while (expired < up->num_idle && now - up->idle[expired].since >= UPSTREAM_IDLE_TIMEOUT) {
+		close(up->idle[expired].fd);
+		expired++;
+	}
+	for (i = expired; i < up->num_idle; ++i) {
+		up->idle[i - expired] = up->idle[i];
+	}
+	up->num_idle -= expired;
+}
+
+static void eject(struct upstream *up, time_t now) {
+	time_t wait = UPSTREAM_EJECT_MAX;
+
+	if (up->strikes < 8 && (UPSTREAM_EJECT << up->strikes) < UPSTREAM_EJECT_MAX) {
+		wait = UPSTREAM_EJECT << up->strikes;
+	}
+	if (!up->down) up->stats.ejections++;
+	up->down = 1;
+	up->strikes++;
+	up->retry_at = now + wait;
+	/* its idle connections are likely as sick */
+	while (up->num_idle > 0) close(up->idle[--up->num_idle].fd);
+}
+
+void upstream_failed(struct upstream *up, time_t now) {
+	up->fails++;
+	if (!up->down && up->fails >= UPSTREAM_MAX_FAILS) eject(up, now);
+}
+
+void upstream_succeeded(struct upstream *up) {
+	up->fails = 0;
+	up->strikes = 0;
+	up->down = 0;
+}
+
+static void end_probe(struct upstream *up, int ok, time_t now) {
+	evloop_del(up->probe.loop, &up->probe.src);
+	close(up->probe.src.fd);
+	up->probe.src.fd = -1;
+	if (ok) {
+		/* back in rotation, on probation until a response resets strikes */
+		up->down = 0;
+		up->fails = 0;
+	} else {
+		eject(up, now);
+	}
+}
+
+static void probe_event(struct evloop *loop, struct ev_source *src, unsigned events) {
+	struct upstream_probe *probe = (struct upstream_probe *)src;
+	int err = 0;
+	socklen_t err_len = sizeof err;
+
+	(void)loop;
+	(void)events;
+	if (src->fd == -1) return;
+	if (getsockopt(src->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == -1) err = errno;
+	end_probe(probe->up, err == 0, time(NULL));
+}
+
+void upstream_check(struct upstream *up, struct evloop *loop, time_t now) {
+	struct upstream_probe *probe = &up->probe;
+
+	if (probe->src.fd != -1) {
+		if (now - probe->started < UPSTREAM_CHECK_INTERVAL) return;
+		/* not accepted in time */
+		end_probe(up, 0, now);
+		return;
+	}
+	if (up->down ? now < up->retry_at : now - probe->started < UPSTREAM_CHECK_INTERVAL) return;
+
+	probe->loop = loop;
+	probe->started = now;
+	probe->src.handle = probe_event;
+	probe->src.fd = start_connect(up);
+	if (probe->src.fd == -1) {
+		eject(up, now);
+	} else if (evloop_add(loop, &probe->src, EPOLLOUT) == -1) {
+		close(probe->src.fd);
+		probe->src.fd = -1;
+	}
+}
+
+void upstream_set_init(struct upstream_set *set) {
+	set->ups = malloc(UPSTREAM_SET_MAX * sizeof *set->ups);
+	if (set->ups == NULL) {
+		perror("upstream_set_init");
+		exit(1);
+	}
+	set->num = 0;
+}
+
+void upstream_set_free(struct upstream_set *set) {
+	while (set->num > 0) {
+		upstream_free(set->ups[--set->num]);
+		free(set->ups[set->num]);
+	}
+	free(set->ups);
+	set->ups = NULL;
+}
+
+/* whether nothing refers to `up` but the set */
+static int unused(const struct upstream *up) {
+	return up->outstanding == 0 && up->num_idle == 0 && up->probe.src.fd == -1;
+}
+
+static void set_remove(struct upstream_set *set, size_t i) {
+	upstream_free(set->ups[i]);
+	free(set->ups[i]);
+	set->ups[i] = set->ups[--set->num];
+}
+
+struct upstream *upstream_set_find(struct upstream_set *set, const char *name) {
+	size_t i;
+
+	for (i = 0; i < set->num; ++i) {
+		if (!strcmp(set->ups[i]->name, name)) return set->ups[i];
+	}
+	return NULL;
+}
+
+struct upstream *upstream_set_add(
+		struct upstream_set *set,
+		const char *name,
+		const struct sockaddr *addr,
+		socklen_t addr_len
+) {
+	struct upstream *up = upstream_set_find(set, name);
+	size_t i;
+
+	if (up != NULL) return up;
+	if (addr_len > sizeof up->addr) return NULL;
+	if (set->num == UPSTREAM_SET_MAX) {
+		/* one whose idle connections are all that keep it */
+		for (i = 0; i < set->num && set->ups[i]->outstanding > 0; ++i);
+		if (i == set->num) return NULL;
+		set_remove(set, i);
+	}
+	up = malloc(sizeof *up);
+	if (up == NULL) {
+		perror("upstream_set_add");
+		exit(1);
+	}
+	memset(up, 0, sizeof *up);
+	memcpy(&up->addr, addr, addr_len);
+	up->addr_len = addr_len;
+	name_upstream(up, name);
+	set->ups[set->num++] = up;
+	return up;
+}
+
+void upstream_set_expire(struct upstream_set *set, time_t now) {
+	size_t i = 0;
+
+	while (i < set->num) {
+		upstream_expire(set->ups[i], now);
+		if (unused(set->ups[i])) {
+			set_remove(set, i);
+		} else {
+			++i;
+		}
+	}
+}
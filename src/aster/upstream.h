@@ -0,0 +1,134 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/socket.h>
+#include "evloop.h"
+
+/* idle connections kept per upstream in each worker */
+#define UPSTREAM_IDLE_MAX 32
+
+/* seconds an idle connection is kept, below the keep-alive timeout of
+   common backends so that they rarely close one under us */
+#define UPSTREAM_IDLE_TIMEOUT 4
+
+/* failures in a row, of requests or probes, that eject a backend */
+#define UPSTREAM_MAX_FAILS 3
+
+/* seconds an ejected backend is left alone before it is probed again,
+   doubled each time it fails again until UPSTREAM_EJECT_MAX */
+#define UPSTREAM_EJECT 1
+#define UPSTREAM_EJECT_MAX 32
+
+/* seconds between probes of a healthy backend, which also has that long
+   to accept one */
+#define UPSTREAM_CHECK_INTERVAL 1
+
+/* the prefix of an upstream name for a local socket */
+#define UPSTREAM_UNIX "unix:"
+
+/* destinations a forward proxy keeps in each worker, each resolved once */
+#define UPSTREAM_SET_MAX 256
+
+struct upstream_idle {
+	int fd;
+	time_t since;
+};
+
+struct upstream_stats {
+	size_t connects; /* new connections */
+	size_t reuses; /* requests sent on an idle connection */
+	size_t stale; /* idle connections found closed by the backend */
+	size_t failures; /* connections that failed before a response */
+	size_t spliced; /* body bytes relayed through a pipe, either way */
+	size_t ejections;
+};
+
+struct upstream;
+
+/* a connection opened only to see the backend accept it */
+struct upstream_probe {
+	struct ev_source src; /* fd -1 unless in flight */
+	struct evloop *loop;
+	struct upstream *up;
+	time_t started;
+};
+
+/* a backend address with its pool of idle keep-alive connections; pools
+   belong to the worker that opened them */
+struct upstream {
+	char *name; /* host:port or unix:/path as configured */
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+
+	struct upstream_idle idle[UPSTREAM_IDLE_MAX]; /* oldest first */
+	size_t num_idle;
+
+	/* health, from requests and probes */
+	size_t outstanding; /* requests in flight */
+	unsigned fails; /* in a row */
+	unsigned strikes; /* ejections since the last good response */
+	int down; /* ejected, until a probe gets through */
+	time_t retry_at; /* when to probe it again */
+	struct upstream_probe probe;
+
+	struct upstream_stats stats;
+};
+
+/* resolve `name`, "host:port", "[v6]:port" or "unix:/path" for a local
+   socket; -1 if it does not */
+int upstream_init(struct upstream *up, const char *name);
+/* close the idle connections and the probe */
+void upstream_free(struct upstream *up);
+
+/* the most recently idled connection still open, -1 if none */
+int upstream_take(struct upstream *up);
+
+/* start a non-blocking connection, -1 with errno set if it cannot be */
+int upstream_open(struct upstream *up);
+
+/* hand a connection back: pooled if `reusable`, closed otherwise */
+void upstream_release(struct upstream *up, int fd, int reusable);
+
+/* close connections idle for UPSTREAM_IDLE_TIMEOUT seconds */
+void upstream_expire(struct upstream *up, time_t now);
+
+/* a request could not get a response, or got one telling the backend is
+   in trouble; it is ejected after UPSTREAM_MAX_FAILS in a row */
+void upstream_failed(struct upstream *up, time_t now);
+/* a request got a sound response */
+void upstream_succeeded(struct upstream *up);
+
+/* probe the backend if it is time to, on `loop`; an ejected one comes back
+   once a probe gets through, a healthy one is ejected as soon as one does
+   not */
+void upstream_check(struct upstream *up, struct evloop *loop, time_t now);
+
+/* the upstreams a forward proxy meets, named by the requests themselves;
+   each one is kept while it has requests in flight or idle connections */
+struct upstream_set {
+	struct upstream **ups;
+	size_t num;
+};
+
+void upstream_set_init(struct upstream_set *set);
+void upstream_set_free(struct upstream_set *set);
+
+/* the upstream for "host:port", NULL if not met yet */
+struct upstream *upstream_set_find(struct upstream_set *set, const char *name);
+
+/* the upstream for "host:port", made at `addr` if not met yet, which the
+   caller resolved; NULL if UPSTREAM_SET_MAX others are in use */
+struct upstream *upstream_set_add(
+		struct upstream_set *set,
+		const char *name,
+		const struct sockaddr *addr,
+		socklen_t addr_len
+);
+
+/* close connections idle for too long and forget the upstreams left
+   with none and no request */
+void upstream_set_expire(struct upstream_set *set, time_t now);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "str.h"
+#include "vhost.h"
+
+#define SEED_TRIES 64
+
+void vhost_table_init(struct vhost_table *table) {
+	memset(table, 0, sizeof *table);
+	table->fallback = VHOST_NONE;
+}
+
+void vhost_table_free(struct vhost_table *table) {
+	size_t i;
+	for (i = 0; i < table->num_hosts; ++i) {
+		free(table->hosts[i].name);
+	}
+	free(table->hosts);
+	free(table->slots);
+}
+
+/* lowercase `host` into `out` without port or final dot, -1 if too long */
+static int host_key(const char *host, size_t len, char out[VHOST_NAME_MAX]) {
+	size_t end = 0, i;
+
+	if (len > 0 && host[0] == '[') {
+		while (end < len && host[end] != ']') end++;
+		if (end < len) end++;
+	} else {
+		while (end < len && host[end] != ':') end++;
+	}
+	if (end > 1 && host[end - 1] == '.') end--;
+	if (end > VHOST_NAME_MAX) return -1;
+
+	for (i = 0; i < end; ++i) {
+		out[i] = lower(host[i]);
+	}
+	return (int)end;
+}
+
+int vhost_add(struct vhost_table *table, const char *name, const char *docroot) {
+	char key[VHOST_NAME_MAX];
+	struct vhost *host;
+	int key_len = 0;
+	size_t name_len, i;
+
+	if (name == NULL) {
+		if (table->fallback != VHOST_NONE) return -1;
+	} else {
+		/* a port in the name would never match */
+		name_len = strlen(name);
+		if (name_len > 1 && name[name_len - 1] == '.') name_len--;
+		key_len = host_key(name, name_len, key);
+		if (key_len <= 0 || (size_t)key_len != name_len) return -1;
+		for (i = 0; i < table->num_hosts; ++i) {
+			host = table->hosts + i;
+			if (host->name != NULL && host->name_len == (size_t)key_len &&
+					!memcmp(host->name, key, host->name_len)) {
+				return -1;
+			}
+		}
+	}
+
+	if (table->num_hosts == table->cap_hosts) {
+		table->cap_hosts = table->cap_hosts ? table->cap_hosts * 2 : 4;
+		table->hosts = realloc(table->hosts, table->cap_hosts * sizeof(struct vhost));
+		if (table->hosts == NULL) {
+			perror("vhost_add");
+			exit(1);
+		}
+	}
+	host = table->hosts + table->num_hosts;
+	memset(host, 0, sizeof *host);
+	host->docroot = docroot;
+	if (name != NULL) {
+		host->name = malloc((size_t)key_len + 1);
+		if (host->name == NULL) {
+			perror("vhost_add");
+			exit(1);
+		}
+		memcpy(host->name, key, (size_t)key_len);
+		host->name[key_len] = '\0';
+		host->name_len = (size_t)key_len;
+	} else {
+		table->fallback = table->num_hosts;
+	}
+	table->num_hosts++;
+	return 0;
+}
+
+static size_t slot_of(const struct vhost_table *table, const char *key, size_t len) {
+	return hash_bytes(key, len, table->seed) & (table->num_slots - 1);
+}
+
+/* 1 if every name hashes to a slot of its own with the current seed */
+static int fill_slots(struct vhost_table *table) {
+	size_t i, slot;
+
+	memset(table->slots, 0xFF, table->num_slots * sizeof(size_t));
+	for (i = 0; i < table->num_hosts; ++i) {
+		const struct vhost *host = table->hosts + i;
+		if (host->name == NULL) continue;
+		slot = slot_of(table, host->name, host->name_len);
+		if (table->slots[slot] != VHOST_NONE) return 0;
+		table->slots[slot] = i;
+	}
+	return 1;
+}
+
+void vhost_table_build(struct vhost_table *table) {
+	unsigned tries;
+
+	for (table->num_slots = 8; table->num_slots < table->num_hosts * 2;) {
+		table->num_slots *= 2;
+	}
+	while (1) {
+		free(table->slots);
+		table->slots = malloc(table->num_slots * sizeof(size_t));
+		if (table->slots == NULL) {
+			perror("vhost_table_build");
+			exit(1);
+		}
+		for (tries = 0; tries < SEED_TRIES; ++tries) {
+			table->seed = HASH_SEED ^ (tries * 0x9E3779B9u);
+			if (fill_slots(table)) return;
+		}
+		/* too crowded for any seed we tried, spread out */
+		table->num_slots *= 2;
+	}
+}
+
+struct vhost *vhost_lookup(const struct vhost_table *table, const struct slice *host) {
+	char key[VHOST_NAME_MAX];
+	int key_len = -1;
+	size_t idx;
+
+	if (table->slots != NULL && host->ptr != NULL) {
+		key_len = host_key(host->ptr, host->len, key);
+	}
+	if (key_len > 0) {
+		idx = table->slots[slot_of(table, key, (size_t)key_len)];
+		if (idx != VHOST_NONE && table->hosts[idx].name_len == (size_t)key_len &&
+				!memcmp(table->hosts[idx].name, key, (size_t)key_len)) {
+			return table->hosts + idx;
+		}
+	}
+	return table->fallback != VHOST_NONE ? table->hosts + table->fallback : NULL;
+}
@@ -0,0 +1,52 @@
+#ifndef VHOST_H
+#define VHOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "origin.h"
+#include "request.h"
+#include "router.h"
+
+#define VHOST_NONE SIZE_MAX
+#define VHOST_NAME_MAX 255
+
+/* a site; its origin and routes are set up by whoever serves it */
+struct vhost {
+	char *name; /* lowercase, without port; NULL for the default host */
+	size_t name_len;
+	const char *docroot; /* NULL to serve the built-in page */
+
+	struct origin origin;
+	struct router routes;
+};
+
+/* hosts by name behind a collision-free hash: the seed is chosen so that
+   every name owns its slot, and dispatch is one hash and one comparison */
+struct vhost_table {
+	struct vhost *hosts;
+	size_t num_hosts, cap_hosts;
+	size_t fallback; /* the default host, VHOST_NONE until added */
+
+	size_t *slots; /* index into hosts or VHOST_NONE */
+	size_t num_slots; /* power of two */
+	uint32_t seed;
+};
+
+void vhost_table_init(struct vhost_table *table);
+
+/* free the names and the table, not what the hosts serve */
+void vhost_table_free(struct vhost_table *table);
+
+/* add a host named `name` (matched case-insensitively, NULL for the default
+   host); return -1 if the name is invalid or taken. Hosts do not move once
+   the table is built */
+int vhost_add(struct vhost_table *table, const char *name, const char *docroot);
+
+/* choose the seed and fill the slots, after every host was added */
+void vhost_table_build(struct vhost_table *table);
+
+/* the host serving a Host value (any port and final dot ignored), the
+   default host if none is named so */
+struct vhost *vhost_lookup(const struct vhost_table *table, const struct slice *host);
+
+#endif
@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sha1.h"
+#include "str.h"
+#include "ws.h"
+
+static void *alloc(size_t size) {
+	void *ptr = malloc(size);
+	if (ptr == NULL) {
+		perror("ws");
+		exit(1);
+	}
+	return ptr;
+}
+
+void ws_accept_key(const char *key, size_t len, char *accept) {
+	unsigned char digest[SHA1_DIGEST_LEN];
+	struct sha1 s;
+
+	sha1_init(&s);
+	sha1_update(&s, key, len);
+	sha1_update(&s, WS_GUID, sizeof WS_GUID - 1);
+	sha1_final(&s, digest);
+	base64_encode(digest, sizeof digest, accept);
+}
+
+static int is_base64(char ch) {
+	return is_alpha(ch) || is_digit(ch) || ch == '+' || ch == '/';
+}
+
+/* 16 bytes in base64, section 4.1 */
+static int valid_key(const struct slice *key) {
+	size_t i;
+
+	if (key->len != 24 || key->ptr[22] != '=' || key->ptr[23] != '=') return 0;
+	for (i = 0; i < 22; ++i) {
+		if (!is_base64(key->ptr[i])) return 0;
+	}
+	/* the last digit carries two bits, the rest being padding */
+	return strchr("AQgw", key->ptr[21]) != NULL;
+}
+
+int ws_handshake(const struct http_request *req, char *accept) {
+	struct header_item_iter it;
+	const struct http_header *key = NULL, *version = NULL;
+	int websocket = 0, ret;
+	size_t i;
+
+	if (req->upgrade) {
+		it = header_items_init(req, HH_UPGRADE);
+		for (ret = header_items_next(req, &it); it.header_item.ptr != NULL && !ret;
+				ret = header_items_next(req, &it)) {
+			if (!slice_str_cmp_ci_check(&it.header_item, "websocket")) websocket = 1;
+		}
+	}
+	if (!websocket) return RC_426_UPGRADE_REQUIRED;
+	if (req->method != HM_GET || !is_http_ver(req, 1, 1) || req->te_chunked ||
+			req->content_length != 0) {
+		return RC_400_BAD_REQUEST;
+	}
+	for (i = 0; i < req->num_headers; ++i) {
+		if (!slice_str_cmp_check(&req->headers[i].name, "sec-websocket-key")) {
+			if (key != NULL) return RC_400_BAD_REQUEST;
+			key = req->headers + i;
+		} else if (!slice_str_cmp_check(&req->headers[i].name, "sec-websocket-version")) {
+			if (version != NULL) return RC_400_BAD_REQUEST;
+			version = req->headers + i;
+		}
+	}
+	if (version == NULL || slice_str_cmp_check(&version->value, WS_VERSION)) {
+		return RC_426_UPGRADE_REQUIRED;
+	}
+	if (key == NULL || !valid_key(&key->value)) return RC_400_BAD_REQUEST;
+	ws_accept_key(key->value.ptr, key->value.len, accept);
+	return 0;
+}
+
+void ws_unmask(unsigned char *p, size_t len, const unsigned char *mask, size_t offset) {
+	unsigned char key[sizeof(unsigned long)];
+	unsigned long word, wkey;
+	size_t i = 0, j;
+
+	/* bytes up to a word boundary, then whole words: a word being a
+	   multiple of the mask, the key is the same for all of them */
+	while (i < len && (unsigned long)(p + i) % sizeof word != 0) {
+		p[i] ^= mask[(offset + i) & 3];
+		++i;
+	}
+	for (j = 0; j < sizeof key; ++j) {
+		key[j] = mask[(offset + i + j) & 3];
+	}
+	memcpy(&wkey, key, sizeof wkey);
+	for (; i + sizeof word <= len; i += sizeof word) {
+		memcpy(&word, p + i, sizeof word);
+		word ^= wkey;
+		memcpy(p + i, &word, sizeof word);
+	}
+	for (; i < len; ++i) {
+		p[i] ^= mask[(offset + i) & 3];
+	}
+}
+
+int ws_utf8_valid(const unsigned char *p, size_t len) {
+	unsigned long word, high, cp, min;
+	size_t i = 0, n, j;
+
+	memset(&high, 0x80, sizeof high);
+	while (i < len) {
+		/* ASCII a word at a time */
+		if (i + sizeof word <= len) {
+			memcpy(&word, p + i, sizeof word);
+			if (!(word & high)) {
+				i += sizeof word;
+				continue;
+			}
+		}
+		if (p[i] < 0x80) {
+			++i;
+			continue;
+		}
+		if ((p[i] & 0xe0) == 0xc0) {
+			n = 1;
+			cp = p[i] & 0x1f;
+			min = 0x80;
+		} else if ((p[i] & 0xf0) == 0xe0) {
+			n = 2;
+			cp = p[i] & 0x0f;
+			min = 0x800;
+		} else if ((p[i] & 0xf8) == 0xf0) {
+			n = 3;
+			cp = p[i] & 0x07;
+			min = 0x10000;
+		} else {
+			return 0;
+		}
+		if (len - i <= n) return 0;
+		for (j = 1; j <= n; ++j) {
+			if ((p[i + j] & 0xc0) != 0x80) return 0;
+			cp = cp << 6 | (p[i + j] & 0x3f);
+		}
+		/* overlong, a surrogate or past Unicode */
+		if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)) return 0;
+		i += n + 1;
+	}
+	return 1;
+}
+
+/* bytes of a frame's head, as its second byte tells */
+static size_t head_size(const unsigned char *head) {
+	switch (head[1] & 0x7f) {
+	case 126: return 2 + 2 + 4;
+	case 127: return 2 + 8 + 4;
+	default: return 2 + 4;
+	}
+}
+
+/* a frame from the server, never masked */
+static void queue_frame(struct ws_conn *ws, enum ws_opcode opcode, const char *data, size_t len) {
+	unsigned char *frame = alloc(10 + len);
+	size_t n, v = len;
+	int i;
+
+	frame[0] = (unsigned char)(0x80 | opcode);
+	if (len < 126) {
+		frame[1] = (unsigned char)len;
+		n = 2;
+	} else if (len < 0x10000ul) {
+		frame[1] = 126;
+		frame[2] = (unsigned char)(len >> 8);
+		frame[3] = (unsigned char)len;
+		n = 4;
+	} else {
+		frame[1] = 127;
+		for (i = 9; i >= 2; --i) {
+			frame[i] = (unsigned char)v;
+			v >>= 8;
+		}
+		n = 10;
+	}
+	if (len > 0) memcpy(frame + n, data, len);
+	outq_push_mem(ws->out, (char *)frame, n + len, (char *)frame, NULL);
+}
+
+/* the owner flushes after ws_conn_feed() itself */
+static void wake(struct ws_conn *ws) {
+	if (!ws->feeding && ws->notify != NULL) ws->notify(ws);
+}
+
+/* close for an error, nothing more is read */
+static void fail(struct ws_conn *ws, enum ws_status status) {
+	unsigned char payload[2];
+
+	if (!ws->closing) {
+		payload[0] = (unsigned char)(status >> 8);
+		payload[1] = (unsigned char)status;
+		queue_frame(ws, WS_CLOSE, (const char *)payload, 2);
+		ws->closing = 1;
+	}
+	ws->failed = 1;
+}
+
+/* the head is whole: check it and start the payload, -1 if failed */
+static int begin_frame(struct ws_conn *ws) {
+	const unsigned char *head = ws->head;
+	size_t size = head_size(head), len = head[1] & 0x7f;
+	int i;
+
+	ws->opcode = head[0] & 0x0f;
+	ws->fin = head[0] >> 7;
+	memcpy(ws->mask, head + size - 4, 4);
+	if (len == 126) {
+		len = (size_t)head[2] << 8 | head[3];
+	} else if (len == 127) {
+		/* anything past 32 bits is too much already */
+		if (head[2] | head[3] | head[4] | head[5]) {
+			fail(ws, head[2] & 0x80 ? WS_PROTOCOL_ERROR : WS_TOO_BIG);
+			return -1;
+		}
+		for (len = 0, i = 6; i < 10; ++i) {
+			len = len << 8 | head[i];
+		}
+	}
+	switch (ws->opcode) {
+	case WS_CLOSE:
+	case WS_PING:
+	case WS_PONG:
+		/* between the fragments of a message as well, never fragmented */
+		if (!ws->fin || len > WS_CONTROL_MAX) {
+			fail(ws, WS_PROTOCOL_ERROR);
+			return -1;
+		}
+		break;
+	case WS_TEXT:
+	case WS_BINARY:
+		if (ws->type != WS_CONTINUATION) {
+			fail(ws, WS_PROTOCOL_ERROR);
+			return -1;
+		}
+		ws->type = (enum ws_opcode)ws->opcode;
+		break;
+	case WS_CONTINUATION:
+		if (ws->type == WS_CONTINUATION) {
+			fail(ws, WS_PROTOCOL_ERROR);
+			return -1;
+		}
+		break;
+	default:
+		fail(ws, WS_PROTOCOL_ERROR);
+		return -1;
+	}
+	if (ws->opcode < WS_CLOSE && len > WS_MESSAGE_MAX - ws->msg_len) {
+		fail(ws, WS_TOO_BIG);
+		return -1;
+	}
+	ws->need = len;
+	ws->offset = 0;
+	return 0;
+}
+
+/* a close code a frame may carry, section 7.4 */
+static int valid_status(unsigned status) {
+	if (status >= 3000 && status <= 4999) return 1;
+	return status >= 1000 && status <= 1014 && (status < 1004 || status > 1006);
+}
+
+static void control(struct ws_conn *ws, const unsigned char *data, size_t len) {
+	switch (ws->opcode) {
+	case WS_PING:
+		if (!ws->closing) queue_frame(ws, WS_PONG, (const char *)data, len);
+		break;
+	case WS_CLOSE:
+		if (len == 1 || (len >= 2 && !valid_status((unsigned)data[0] << 8 | data[1]))) {
+			fail(ws, WS_PROTOCOL_ERROR);
+			return;
+		}
+		if (len > 2 && !ws_utf8_valid(data + 2, len - 2)) {
+			fail(ws, WS_INVALID_DATA);
+			return;
+		}
+		/* its status echoed, section 5.5.1 */
+		if (!ws->closing) queue_frame(ws, WS_CLOSE, (const char *)data, len >= 2 ? 2 : 0);
+		ws->closing = 1;
+		ws->closed = 1;
+		break;
+	default:
+		break;
+	}
+}
+
+/* a whole message, assembled or straight from the read */
+static void deliver(struct ws_conn *ws, const unsigned char *data, size_t len) {
+	enum ws_opcode type = ws->type;
+
+	ws->type = WS_CONTINUATION;
+	if (type == WS_TEXT && !ws_utf8_valid(data, len)) {
+		fail(ws, WS_INVALID_DATA);
+	} else if (!ws->closing) {
+		ws->handler->message(ws, type, (const char *)data, len);
+	}
+	free(ws->msg);
+	ws->msg = NULL;
+	ws->msg_len = ws->msg_cap = 0;
+}
+
+/* copy what the frame cannot be handled without */
+static void keep(struct ws_conn *ws, const unsigned char *p, size_t n) {
+	if (ws->opcode >= WS_CLOSE) {
+		if (ws->control == NULL) {
+			ws->control = alloc(WS_CONTROL_MAX);
+			ws->control_len = 0;
+		}
+		memcpy(ws->control + ws->control_len, p, n);
+		ws->control_len += n;
+		return;
+	}
+	if (ws->msg_len + ws->need > ws->msg_cap) {
+		/* the whole frame at once, its length being known */
+		ws->msg_cap = ws->msg_len + ws->need;
+		ws->msg = realloc(ws->msg, ws->msg_cap);
+		if (ws->msg == NULL) {
+			perror("ws");
+			exit(1);
+		}
+	}
+	memcpy(ws->msg + ws->msg_len, p, n);
+	ws->msg_len += n;
+}
+
+/* the payload is in: what was kept of it, else `data` */
+static void end_frame(struct ws_conn *ws, const unsigned char *data, size_t len) {
+	ws->head_len = 0;
+	if (ws->opcode >= WS_CLOSE) {
+		if (ws->control != NULL) {
+			data = ws->control;
+			len = ws->control_len;
+		}
+		control(ws, data, len);
+		free(ws->control);
+		ws->control = NULL;
+		return;
+	}
+	if (!ws->fin) return;
+	if (ws->msg_len > 0) {
+		data = (const unsigned char *)ws->msg;
+		len = ws->msg_len;
+	}
+	deliver(ws, data, len);
+}
+
+void ws_conn_feed(struct ws_conn *ws, char *buf, size_t len) {
+	unsigned char *p = (unsigned char *)buf;
+	size_t n, size;
+	int direct;
+
+	if (len > 0) ws->pinged = 0;
+	ws->feeding = 1;
+	while (len > 0 && !ws->failed && !ws->closed) {
+		size = ws->head_len < 2 ? 2 : head_size(ws->head);
+		if (ws->head_len < size) {
+			n = size - ws->head_len < len ? size - ws->head_len : len;
+			memcpy(ws->head + ws->head_len, p, n);
+			ws->head_len += (unsigned char)n;
+			p += n;
+			len -= n;
+			if (ws->head_len < 2) continue;
+			/* no extension was agreed on, clients mask everything */
+			if ((ws->head[0] & 0x70) || !(ws->head[1] & 0x80)) {
+				fail(ws, WS_PROTOCOL_ERROR);
+				break;
+			}
+			if (ws->head_len < head_size(ws->head)) continue;
+			if (begin_frame(ws) == -1) break;
+			if (ws->need == 0) end_frame(ws, p, 0);
+			continue;
+		}
+
+		n = ws->need < len ? ws->need : len;
+		ws_unmask(p, n, ws->mask, ws->offset);
+		/* a frame read whole is handled where it lies, unless it ends a
+		   message begun in another one */
+		direct = ws->offset == 0 && n == ws->need &&
+			(ws->opcode >= WS_CLOSE || (ws->fin && ws->msg_len == 0));
+		if (!direct) keep(ws, p, n);
+		ws->offset += n;
+		ws->need -= n;
+		if (ws->need == 0) end_frame(ws, direct ? p : NULL, n);
+		p += n;
+		len -= n;
+	}
+	ws->feeding = 0;
+}
+
+void ws_conn_init(
+		struct ws_conn *ws,
+		struct outq *out,
+		const struct ws_handler *handler,
+		void (*notify)(struct ws_conn *ws),
+		void *owner
+) {
+	memset(ws, 0, sizeof *ws);
+	ws->out = out;
+	ws->handler = handler;
+	ws->type = WS_CONTINUATION;
+	ws->notify = notify;
+	ws->owner = owner;
+	if (handler->open != NULL) {
+		ws->feeding = 1;
+		handler->open(ws);
+		ws->feeding = 0;
+	}
+}
+
+void ws_conn_free(struct ws_conn *ws) {
+	/* the connection is gone, nothing is sent anymore */
+	ws->closing = 1;
+	if (ws->handler->close != NULL) ws->handler->close(ws);
+	free(ws->msg);
+	free(ws->control);
+}
+
+void ws_send(struct ws_conn *ws, enum ws_opcode type, const char *data, size_t len) {
+	if (ws->closing) return;
+	queue_frame(ws, type, data, len);
+	wake(ws);
+}
+
+void ws_close(struct ws_conn *ws, enum ws_status status) {
+	unsigned char payload[2];
+
+	if (ws->closing) return;
+	payload[0] = (unsigned char)(status >> 8);
+	payload[1] = (unsigned char)status;
+	queue_frame(ws, WS_CLOSE, (const char *)payload, status != 0 ? 2 : 0);
+	ws->closing = 1;
+	wake(ws);
+}
+
+void ws_ping(struct ws_conn *ws) {
+	if (ws->closing) return;
+	queue_frame(ws, WS_PING, NULL, 0);
+	ws->pinged = 1;
+	wake(ws);
+}
+
+int ws_conn_done(const struct ws_conn *ws) {
+	return ws->failed || (ws->closing && ws->closed);
+}
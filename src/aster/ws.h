@@ -0,0 +1,127 @@
+#ifndef WS_H
+#define WS_H
+
+#include <stddef.h>
+#include "outq.h"
+#include "request.h"
+
+/* WebSocket, RFC 6455 */
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_ACCEPT_LEN 28 /* Sec-WebSocket-Accept, a digest in base64 */
+#define WS_VERSION "13"
+#define WS_HEAD_MAX 14 /* of a frame, with the longest length and a mask */
+#define WS_CONTROL_MAX 125 /* payload of a control frame */
+#define WS_MESSAGE_MAX (1ul << 20) /* largest message taken */
+
+/* frames queued for the socket before the client is read further */
+#define WS_AHEAD (64ul << 10)
+
+enum ws_opcode {
+	WS_CONTINUATION = 0x0,
+	WS_TEXT = 0x1,
+	WS_BINARY = 0x2,
+	WS_CLOSE = 0x8,
+	WS_PING = 0x9,
+	WS_PONG = 0xa
+};
+
+/* status codes of a close frame, section 7.4.1 */
+enum ws_status {
+	WS_NORMAL = 1000,
+	WS_GOING_AWAY = 1001,
+	WS_PROTOCOL_ERROR = 1002,
+	WS_UNACCEPTABLE = 1003,
+	WS_INVALID_DATA = 1007,
+	WS_POLICY = 1008,
+	WS_TOO_BIG = 1009,
+	WS_INTERNAL_ERROR = 1011
+};
+
+struct ws_conn;
+
+/* what an endpoint does with its clients; a message is whole, text being
+   valid UTF-8, and valid during the call only */
+struct ws_handler {
+	void (*open)(struct ws_conn *ws); /* NULL if nothing */
+	void (*message)(struct ws_conn *ws, enum ws_opcode type, const char *data, size_t len);
+	void (*close)(struct ws_conn *ws); /* once it ends, NULL if nothing */
+};
+
+/* a client past its handshake. Frames are unmasked in the buffer read
+   into and handed over from there: an idle connection holds no memory
+   besides this, only messages spanning reads or frames being copied */
+struct ws_conn {
+	struct outq *out;
+	const struct ws_handler *handler;
+	void *data; /* the handler's */
+
+	unsigned char head[WS_HEAD_MAX]; /* of the frame being read */
+	unsigned char head_len;
+	unsigned char opcode; /* of that frame, once its head is whole */
+	unsigned char fin;
+	unsigned char mask[4];
+	size_t need; /* of its payload, still to come */
+	size_t offset; /* into its payload, where the mask goes on */
+
+	/* the message being assembled, or a control frame spanning reads */
+	enum ws_opcode type; /* WS_CONTINUATION unless one is */
+	char *msg;
+	size_t msg_len, msg_cap;
+	unsigned char *control; /* WS_CONTROL_MAX bytes, NULL unless spanning */
+	size_t control_len;
+
+	int feeding; /* in ws_conn_feed(), its caller flushes */
+	int pinged; /* nothing came since ws_ping() */
+	int closing; /* sent a close frame, nothing more is */
+	int closed; /* got the client's, nothing more is read */
+	int failed; /* closed for an error, nothing more is read */
+
+	/* something was queued outside of ws_conn_feed() */
+	void (*notify)(struct ws_conn *ws);
+	void *owner;
+};
+
+/* check a request opening a WebSocket, section 4.2.1, and write the
+   Sec-WebSocket-Accept of its key into `accept`, WS_ACCEPT_LEN + 1 bytes:
+   0 if it may be upgraded, 426 if it does not ask to or for another
+   version, 400 if it is malformed */
+int ws_handshake(const struct http_request *req, char *accept);
+
+/* the accept value of a Sec-WebSocket-Key, section 4.2.2 */
+void ws_accept_key(const char *key, size_t len, char *accept);
+
+/* go on once the 101 is queued, telling the handler */
+void ws_conn_init(
+		struct ws_conn *ws,
+		struct outq *out,
+		const struct ws_handler *handler,
+		void (*notify)(struct ws_conn *ws),
+		void *owner
+);
+/* tells the handler too, which may no longer send */
+void ws_conn_free(struct ws_conn *ws);
+
+/* handle what the client sent, unmasked in place */
+void ws_conn_feed(struct ws_conn *ws, char *buf, size_t len);
+
+/* queue a message unfragmented; ignored once closing */
+void ws_send(struct ws_conn *ws, enum ws_opcode type, const char *data, size_t len);
+
+/* queue a close frame with `status` (0 for none), the client's being
+   awaited */
+void ws_close(struct ws_conn *ws, enum ws_status status);
+
+/* queue a ping, to tell whether an idle client is still there */
+void ws_ping(struct ws_conn *ws);
+
+/* 1 once the connection may close after what is queued */
+int ws_conn_done(const struct ws_conn *ws);
+
+/* XOR `len` bytes with `mask`, starting `offset` bytes into it, a word at
+   a time */
+void ws_unmask(unsigned char *p, size_t len, const unsigned char *mask, size_t offset);
+
+/* 1 if `len` bytes are UTF-8, section 8.1 */
+int ws_utf8_valid(const unsigned char *p, size_t len);
+
+#endif
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "str.h"
+#include "zcache.h"
+
+void zcache_init(struct zcache *cache, size_t cap, size_t max_bytes) {
+	size_t i;
+
+	memset(cache, 0, sizeof *cache);
+	cache->cap = cap;
+	cache->max_bytes = max_bytes;
+
+	lru_init(&cache->lru, cap);
+	cache->entries = malloc((cap ? cap : 1) * sizeof(struct zcache_entry));
+	if (cache->entries == NULL) {
+		perror("zcache_init");
+		exit(1);
+	}
+
+	for (i = cap; i > 0; --i) {
+		cache->entries[i - 1].key = NULL;
+		cache->entries[i - 1].data = NULL;
+		cache->entries[i - 1].blob = NULL;
+		lru_put_free(&cache->lru, &cache->entries[i - 1].node);
+	}
+}
+
+void zcache_free(struct zcache *cache) {
+	size_t i;
+	for (i = 0; i < cache->cap; ++i) {
+		free(cache->entries[i].key);
+		blob_unref(cache->entries[i].blob);
+	}
+	free(cache->entries);
+	lru_free(&cache->lru);
+}
+
+static void remove_entry(struct zcache *cache, struct zcache_entry *e) {
+	lru_remove(&cache->lru, &e->node);
+
+	cache->bytes -= e->len;
+	free(e->key);
+	blob_unref(e->blob);
+	e->key = NULL;
+	e->data = NULL;
+	e->blob = NULL;
+	lru_put_free(&cache->lru, &e->node);
+}
+
+const struct zcache_entry *zcache_get(struct zcache *cache, const char *key, size_t key_len) {
+	uint32_t hash = hash_bytes(key, key_len, HASH_SEED);
+	struct lru_node *node = lru_bucket(&cache->lru, hash);
+
+	for (; node != NULL; node = node->chain_next) {
+		struct zcache_entry *e = LRU_ENTRY(node, struct zcache_entry, node);
+		if (node->hash == hash && e->key_len == key_len &&
+				!memcmp(e->key, key, key_len)) {
+			lru_touch(&cache->lru, node);
+			cache->stats.hits++;
+			return e;
+		}
+	}
+	cache->stats.misses++;
+	return NULL;
+}
+
+const struct zcache_entry *zcache_put(
+		struct zcache *cache,
+		const char *key,
+		size_t key_len,
+		unsigned char *data,
+		size_t len
+) {
+	uint32_t hash = hash_bytes(key, key_len, HASH_SEED);
+	struct lru_node *node;
+	struct zcache_entry *e;
+
+	if (data == NULL) {
+		len = 0;
+		cache->stats.incompressible++;
+	}
+	if (cache->cap == 0 || len > cache->max_bytes) {
+		free(data);
+		return NULL;
+	}
+	while (cache->lru.free_head == NULL ||
+			cache->bytes + len > cache->max_bytes) {
+		remove_entry(cache, LRU_ENTRY(cache->lru.lru_tail, struct zcache_entry, node));
+		cache->stats.evictions++;
+	}
+
+	node = lru_take_free(&cache->lru);
+	e = LRU_ENTRY(node, struct zcache_entry, node);
+
+	e->key = malloc(key_len + 1);
+	if (e->key == NULL) {
+		perror("zcache_put");
+		exit(1);
+	}
+	memcpy(e->key, key, key_len);
+	e->key[key_len] = '\0';
+	e->key_len = key_len;
+	e->blob = data != NULL ? blob_new(data, len) : NULL;
+	e->data = data;
+	e->len = len;
+
+	lru_insert(&cache->lru, node, hash);
+	cache->bytes += len;
+	return e;
+}
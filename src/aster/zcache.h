@@ -0,0 +1,64 @@
+#ifndef ZCACHE_H
+#define ZCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "blob.h"
+#include "lru.h"
+
+#define ZCACHE_DEFAULT_CAP 1024
+#define ZCACHE_DEFAULT_BYTES (32ul << 20)
+
+/* files outside these bounds are not worth compressing on the fly: larger
+   ones would stall the worker's every connection while a miss is deflated,
+   they go out as identity unless a .gz sibling is there */
+#define ZCACHE_MIN_INPUT 256
+#define ZCACHE_MAX_INPUT (256ul << 10)
+
+/* compressed body of one representation, keyed by its entity tag; a changed
+   file gets a new tag, so stale entries are never hit and just age out */
+struct zcache_entry {
+	char *key; /* NULL if unused */
+	size_t key_len;
+	unsigned char *data; /* NULL if compression did not pay off */
+	size_t len;
+	struct blob *blob; /* owns data, outliving the entry while referenced */
+
+	struct lru_node node;
+};
+
+struct zcache_stats {
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+	size_t incompressible;
+};
+
+/* LRU bounded by entry count and by the total of compressed bytes */
+struct zcache {
+	struct zcache_entry *entries;
+	size_t cap;
+	struct lru_table lru;
+
+	size_t bytes, max_bytes;
+
+	struct zcache_stats stats;
+};
+
+void zcache_init(struct zcache *cache, size_t cap, size_t max_bytes);
+void zcache_free(struct zcache *cache);
+
+/* return the entry for `key` or NULL; valid until the next zcache_put() */
+const struct zcache_entry *zcache_get(struct zcache *cache, const char *key, size_t key_len);
+
+/* store `data` (malloc'd, owned by the cache from now on, NULL to remember
+   that the representation is incompressible) and return its entry */
+const struct zcache_entry *zcache_put(
+		struct zcache *cache,
+		const char *key,
+		size_t key_len,
+		unsigned char *data,
+		size_t len
+);
+
+#endif
@@ -0,0 +1,93 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+#include "zerocopy.h"
+
+void zerocopy_init(struct zerocopy *zc, int enabled) {
+	memset(zc, 0, sizeof *zc);
+	zc->enabled = enabled;
+}
+
+void zc_socket_init(struct zc_socket *s, int fd) {
+	s->fd = fd;
+	s->armed = 0;
+	s->sent = 0;
+	s->done = 0;
+}
+
+void zc_completed(struct zerocopy *zc, size_t count, int copied) {
+	zc->stats.completions += count;
+	if (!copied) {
+		zc->copied_run = 0;
+		return;
+	}
+	zc->stats.copied += count;
+	zc->copied_run += (unsigned)count;
+	if (zc->copied_run >= ZC_COPIED_LIMIT) zc->enabled = 0;
+}
+
+static int arm(struct zc_socket *s) {
+	int one = 1;
+	if (s->armed == 0) {
+		s->armed = setsockopt(s->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof one) == 0 ? 1 : -1;
+	}
+	return s->armed == 1;
+}
+
+ssize_t zc_write(struct zerocopy *zc, struct zc_socket *s, const char *buf, size_t len) {
+	int zerocopy = zc->enabled && len >= ZC_MIN_BYTES && arm(s);
+	ssize_t sent;
+
+	while (1) {
+		sent = send(s->fd, buf, len, MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+		if (sent != -1) break;
+		if (errno == EINTR) continue;
+		/* out of optmem for pinned pages: copy this one */
+		if (errno == ENOBUFS && zerocopy) {
+			zerocopy = 0;
+			zc->stats.fallbacks++;
+			continue;
+		}
+		return -1;
+	}
+	if (zerocopy) {
+		s->sent++;
+		zc->stats.sends++;
+		zc->stats.bytes += (size_t)sent;
+	}
+	return sent;
+}
+
+int zc_poll(struct zerocopy *zc, struct zc_socket *s) {
+	char control[128];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	const struct sock_extended_err *serr;
+	int got = 0;
+
+	while (s->done != s->sent) {
+		memset(&msg, 0, sizeof msg);
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof control;
+		if (recvmsg(s->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+			if (errno == EINTR) continue;
+			return errno == EAGAIN ? got : -1;
+		}
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			uint32_t count;
+			serr = (const struct sock_extended_err *)(const void *)CMSG_DATA(cmsg);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+				continue;
+			}
+			/* ids [ee_info, ee_data], coalesced by the kernel */
+			count = serr->ee_data - serr->ee_info + 1;
+			s->done += count;
+			zc_completed(zc, count, serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+			got = 1;
+		}
+	}
+	return got;
+}
@@ -0,0 +1,56 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* smaller sends are cheaper to copy than to pin and get notified about */
+#define ZC_MIN_BYTES (64ul << 10)
+
+/* completions in a row the kernel had to copy anyway (loopback, devices
+   without scatter-gather) after which zerocopy is turned off */
+#define ZC_COPIED_LIMIT 8
+
+struct zc_stats {
+	size_t sends; /* send() calls with MSG_ZEROCOPY */
+	size_t bytes;
+	size_t completions; /* sends the kernel is done with */
+	size_t copied; /* of which it copied the data after all */
+	size_t fallbacks; /* sends copied for lack of socket memory */
+	size_t aborts; /* connections reset to release their buffers */
+};
+
+/* MSG_ZEROCOPY policy of a worker, off unless enabled */
+struct zerocopy {
+	int enabled;
+	unsigned copied_run;
+	struct zc_stats stats;
+};
+
+/* zerocopy sends of one connection; the buffers they point to must not
+   change until zc_poll() has counted every one of them done */
+struct zc_socket {
+	int fd;
+	int armed; /* 1 once SO_ZEROCOPY is set, -1 if the socket refused it */
+	uint32_t sent; /* notification ids handed out so far */
+	uint32_t done; /* of which completed */
+};
+
+void zerocopy_init(struct zerocopy *zc, int enabled);
+void zc_socket_init(struct zc_socket *s, int fd);
+
+/* one send() of `buf`, with MSG_ZEROCOPY when it is enabled and `len` is
+   at least ZC_MIN_BYTES; the bytes sent or -1 with errno set (EAGAIN on a
+   full non-blocking socket) */
+ssize_t zc_write(struct zerocopy *zc, struct zc_socket *s, const char *buf, size_t len);
+
+/* read the notifications already queued, without blocking; 1 if some
+   were, 0 if none, -1 on error */
+int zc_poll(struct zerocopy *zc, struct zc_socket *s);
+
+/* account for `count` completed sends, turning zerocopy off once the kernel
+   keeps copying */
+void zc_completed(struct zerocopy *zc, size_t count, int copied);
+
+#endif
@@ -1,11 +1,12 @@
-#define _POSIX_C_SOURCE 200112L
-#define _XOPEN_SOURCE 600
+#define _GNU_SOURCE
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
@@ -13,21 +14,127 @@
 #include <sys/wait.h>
 #include <netdb.h>
 #include <assert.h>
+#include <time.h>
 #include "aster/parser.h"
 #include "aster/response.h"
+#include "aster/acl.h"
+#include "aster/balancer.h"
 #include "aster/datetime.h"
+#include "aster/embedded.h"
+#include "aster/evloop.h"
+#include "aster/fastcgi.h"
+#include "aster/h2.h"
+#include "aster/listener.h"
+#include "aster/origin.h"
+#include "aster/path.h"
+#include "aster/outq.h"
+#include "aster/pcache.h"
+#include "aster/proxy.h"
+#include "aster/resolver.h"
+#include "aster/router.h"
 #include "aster/str.h"
+#include "aster/stream.h"
+#include "aster/tunnel.h"
+#include "aster/upstream.h"
+#include "aster/vhost.h"
+#include "aster/ws.h"
+#include "aster/zerocopy.h"
 
 #define MAXDATASIZE 1024
-#define SERVER "aster/0.0.0-alpha"
+#define CONN_TIMEOUT 30 /* seconds without progress */
+#define FOLLOW_WAIT 5 /* seconds a request waits for the head of an identical one */
+#define DRAIN_WAIT 2 /* seconds a body no one reads is drained for after the response */
+#define IDLE_WAIT 5 /* seconds a persistent connection waits for its next request */
+#define NOTSENT_LOWAT (16 << 10)
+#define CONTINUE "HTTP/1.1 100 Continue" CRLF CRLF
+#define SWITCHING_TO_H2 "HTTP/1.1 101 Switching Protocols" CRLF \
+		"Connection: Upgrade" CRLF \
+		"Upgrade: h2c" CRLF CRLF
 #define ENTITY "<!DOCTYPE html><html>" \
 		"<head><title>main</title></head>" \
 		"<body>hello</body>" \
 		"</html>"
-#define NOT_FOUND "<!DOCTYPE html><html>" \
-		"<head><title>not found</title></head>" \
-		"<body>not found</body>" \
-		"</html>"
+
+/* sites by Host; the default one serves -r docroot, or if unset the docroot
+   compiled in with EMBED_DIR, or the built-in page */
+static struct vhost_table hosts;
+
+/* the built-in page and the 404 of unrouted paths, serialized once */
+static struct canned_response entity_page, not_found_page;
+
+/* MSG_ZEROCOPY for large bodies held in memory, with -z */
+static struct zerocopy zerocopy;
+
+/* where every host reports the worker's cache counters, with -s */
+static const char *status_path;
+
+/* what a route resolves to */
+struct route_handler {
+	void (*serve)(
+			struct vhost *host,
+			const struct http_request *req,
+			const struct route_match *match,
+			struct http_response *resp,
+			const char *date);
+};
+
+/* requests forwarded to backends on every host, with
+   -p pattern=host:port[,host:port]...[;policy] */
+struct proxy_route {
+	struct route_handler handler; /* first, routes point to it */
+	const char *pattern;
+	struct balancer balancer; /* idle connections and health are the worker's */
+};
+
+static struct proxy_route *proxies;
+static size_t num_proxies;
+
+/* requests handed to a FastCGI application on every host, with
+   -F pattern=unix:/path or pattern=host:port */
+struct fastcgi_route {
+	struct route_handler handler; /* first, routes point to it */
+	const char *pattern;
+	struct upstream app; /* idle connections are the worker's */
+};
+
+static struct fastcgi_route *fastcgis;
+static size_t num_fastcgis;
+
+/* responses of the proxied routes, each worker keeping its own; -c sets
+   the memory it takes, -C dir=size a slab file for large bodies */
+static struct pcache cache;
+static size_t cache_bytes; /* 0 without a cache */
+static const char *slab_dir;
+static size_t slab_bytes;
+
+/* the largest request body relayed upstream, with -b; 0 if any is */
+static size_t max_body;
+
+/* with -f, absolute-form requests go to the origin they name and CONNECT
+   opens a tunnel, on upstreams made as they are met */
+static int forwarding;
+static struct upstream_set destinations;
+
+/* resolves the names of destinations away from the worker's loop */
+static struct resolver resolver;
+
+/* who may use the forward proxy and where to: clients in the blocks of -A
+   (loopback ones if none) or on a local socket, CONNECT to the ports of -P
+   (443 if none), never to this host or its link unless -L */
+static struct acl forward_clients;
+static unsigned short *connect_ports;
+static size_t num_connect_ports;
+static int forward_internal;
+
+/* WebSocket endpoints on every host, sending each message back, with
+   -W pattern */
+static const char **websockets;
+static size_t num_websockets;
+
+/* where clients connect, with -l address (LISTENER_DEFAULT without any);
+   opened before the workers are forked, each waiting on all of them */
+static struct listener *listeners;
+static size_t num_listeners;
 
 /*
  * ai_ for AddrInfo
@@ -38,128 +145,1217 @@
  * PF_ for Protocol Family
  */
 
-/* prune dead forked processes */
-static void zombie_killer(int s) {
-	int saved_errno;
+/* retrieve socket address (v4 or v6) from a generic sockaddr storage,
+   where it sits as in either sockaddr_in or sockaddr_in6 */
+static const void *get_sockaddr_in(const struct sockaddr_storage *ss) {
+	if (ss->ss_family == AF_INET) {
+		return (const char *)ss + offsetof(struct sockaddr_in, sin_addr);
+	}
+	return (const char *)ss + offsetof(struct sockaddr_in6, sin6_addr);
+}
+
+static void serve_static(
+		struct vhost *host,
+		const struct http_request *req,
+		const struct route_match *match,
+		struct http_response *resp,
+		const char *date
+) {
+	(void)match;
+	origin_serve(&host->origin, req, resp, date);
+}
 
-	(void)s; /* unused parameter warning */
+static void serve_entity(
+		struct vhost *host,
+		const struct http_request *req,
+		const struct route_match *match,
+		struct http_response *resp,
+		const char *date
+) {
+	(void)host;
+	(void)match;
+	canned_serve(&entity_page, req->method != HM_HEAD, resp, date);
+}
 
-	saved_errno = errno; /* errno may be overwritten during waitpid */
+static void serve_embedded(
+		struct vhost *host,
+		const struct http_request *req,
+		const struct route_match *match,
+		struct http_response *resp,
+		const char *date
+) {
+	(void)host;
+	(void)match;
+	embedded_serve(&embedded_docroot, req, resp, date);
+}
 
-	while (waitpid(-1, NULL, WNOHANG) > 0);
+/* the status page is written one host at a time as the client reads it */
+static int produce_status(struct stream *st, void *ctx) {
+	size_t *next = ctx;
+	const struct vhost *host;
+	const struct fd_cache_stats *files;
+	const struct zcache_stats *gzipped;
+	char line[256];
+	size_t i;
 
-	errno = saved_errno;
+	if (*next >= hosts.num_hosts && *next < hosts.num_hosts + num_proxies) {
+		const struct proxy_route *route = &proxies[*next - hosts.num_hosts];
+		for (i = 0; i < route->balancer.num_backends; ++i) {
+			const struct upstream *up = route->balancer.backends + i;
+			stream_puts(st, "upstream ");
+			stream_puts(st, up->name);
+			sprintf(line, " %s outstanding %lu connects %lu reuses %lu stale %lu"
+				" failures %lu ejections %lu spliced %lu idle %lu\n",
+				up->down ? "down" : "up",
+				(unsigned long)up->outstanding,
+				(unsigned long)up->stats.connects,
+				(unsigned long)up->stats.reuses,
+				(unsigned long)up->stats.stale,
+				(unsigned long)up->stats.failures,
+				(unsigned long)up->stats.ejections,
+				(unsigned long)up->stats.spliced,
+				(unsigned long)up->num_idle);
+			stream_puts(st, line);
+		}
+		++*next;
+		return 1;
+	}
+	if (*next == hosts.num_hosts + num_proxies) {
+		if (cache.max_entries > 0) {
+			sprintf(line, "cache entries %lu bytes %lu hits %lu stale %lu misses %lu"
+				" revalidated %lu stored %lu evictions %lu coalesced %lu\n",
+				(unsigned long)cache.lru.count,
+				(unsigned long)cache.bytes,
+				(unsigned long)cache.stats.hits,
+				(unsigned long)cache.stats.stale_hits,
+				(unsigned long)cache.stats.misses,
+				(unsigned long)cache.stats.revalidated,
+				(unsigned long)cache.stats.stored,
+				(unsigned long)cache.stats.evictions,
+				(unsigned long)cache.stats.coalesced);
+			stream_puts(st, line);
+		}
+		if (forwarding) {
+			sprintf(line, "destinations %lu lookups %lu failures %lu\n",
+				(unsigned long)destinations.num,
+				(unsigned long)resolver.stats.lookups,
+				(unsigned long)resolver.stats.failures);
+			stream_puts(st, line);
+		}
+		sprintf(line, "zerocopy %s sends %lu bytes %lu completions %lu"
+			" copied %lu fallbacks %lu aborts %lu\n",
+			zerocopy.enabled ? "on" : "off",
+			(unsigned long)zerocopy.stats.sends,
+			(unsigned long)zerocopy.stats.bytes,
+			(unsigned long)zerocopy.stats.completions,
+			(unsigned long)zerocopy.stats.copied,
+			(unsigned long)zerocopy.stats.fallbacks,
+			(unsigned long)zerocopy.stats.aborts);
+		stream_puts(st, line);
+		return 0;
+	}
+
+	host = hosts.hosts + (*next)++;
+	stream_puts(st, "host ");
+	stream_puts(st, host->name != NULL ? host->name : "*");
+	if (host->docroot == NULL) {
+		stream_puts(st, " built-in\n");
+		return 1;
+	}
+	stream_puts(st, " docroot ");
+	stream_puts(st, host->docroot);
+
+	files = &host->origin.files.stats;
+	sprintf(line, "\n\tfiles hits %lu misses %lu evictions %lu invalidations %lu\n",
+		(unsigned long)files->hits,
+		(unsigned long)files->misses,
+		(unsigned long)files->evictions,
+		(unsigned long)files->invalidations);
+	stream_puts(st, line);
+	sprintf(line, "\tpages resident %lu nonresident %lu readaheads %lu"
+		" willneeds %lu prefetched %lu dontneeds %lu\n",
+		(unsigned long)files->pages.resident,
+		(unsigned long)files->pages.nonresident,
+		(unsigned long)files->pages.readaheads,
+		(unsigned long)files->pages.willneeds,
+		(unsigned long)files->pages.prefetched,
+		(unsigned long)files->pages.dontneeds);
+	stream_puts(st, line);
+
+	gzipped = &host->origin.gzipped.stats;
+	sprintf(line, "\tgzip hits %lu misses %lu evictions %lu incompressible %lu bytes %lu\n",
+		(unsigned long)gzipped->hits,
+		(unsigned long)gzipped->misses,
+		(unsigned long)gzipped->evictions,
+		(unsigned long)gzipped->incompressible,
+		(unsigned long)host->origin.gzipped.bytes);
+	stream_puts(st, line);
+	return 1;
 }
 
-/* retrieve socket address (v4 or v6) from a generic sockaddr struct
-   cast to either sockaddr_in* or sockaddr_in6* */
-static void *get_sockaddr_in(struct sockaddr *sa) {
-	if (sa->sa_family == AF_INET) {
-		return &(((struct sockaddr_in *)((void *)sa))->sin_addr);
+static void serve_status(
+		struct vhost *host,
+		const struct http_request *req,
+		const struct route_match *match,
+		struct http_response *resp,
+		const char *date
+) {
+	size_t *next = malloc(sizeof *next);
+
+	(void)host;
+	(void)match;
+	if (next == NULL) {
+		perror("serve_status");
+		exit(1);
 	}
-	return &(((struct sockaddr_in6 *)((void *)sa))->sin6_addr);
+	*next = 0;
+	stream_response(resp, req, RC_200_OK,
+		"Content-Type: text/plain; charset=utf-8" CRLF
+		"Cache-Control: no-store" CRLF,
+		date, produce_status, free, next);
 }
 
-/* bind the socket to the first available bindable address, returns the fd of
-   the socket or -1 on error */
-static int bind_local_address(void) {
-	struct addrinfo addr_hints, *server_info, *addr;
-	int listener_fd = -1;
-	int yes = 1;
-	int retval;
-	char addrstr[INET6_ADDRSTRLEN];
+/* answer from the cache if it can, 1 then; otherwise the request is to be
+   forwarded, with a stale response to revalidate or to refresh in the
+   background */
+static int cache_answers(const struct http_request *req, struct http_response *resp) {
+	struct pcache_entry *e;
+	time_t now = time(NULL);
 
-	memset(&addr_hints, 0, sizeof addr_hints);
-	addr_hints.ai_family = AF_INET; /* IPv4 */
-	addr_hints.ai_socktype = SOCK_STREAM; /* TCP */
-	addr_hints.ai_flags = AI_PASSIVE; /* `bind()`able */
+	if (cache.max_entries == 0) return 0;
+	if (req->method != HM_GET && req->method != HM_HEAD) {
+		/* it may change what is stored (RFC 9111 section 4.4) */
+		pcache_invalidate(&cache, req);
+		return 0;
+	}
+	switch (pcache_lookup(&cache, req, now, &e)) {
+	case PC_FRESH:
+		pcache_respond(&cache, e, req, resp, now);
+		return 1;
+	case PC_STALE_OK:
+		pcache_respond(&cache, e, req, resp, now);
+		/* one refresh at a time, the others are served stale */
+		if (e->revalidating) return 1;
+		resp->stale = pcache_ref(e);
+		resp->background = 1;
+		break;
+	case PC_STALE:
+		if (e->etag != NULL || e->last_modified != -1) resp->stale = pcache_ref(e);
+		break;
+	case PC_MISS:
+		break;
+	}
+	return 0;
+}
 
-	retval = getaddrinfo(NULL, "http", &addr_hints, &server_info);
-	if (retval != 0) {
-		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(retval));
-		return -1;
+static void length_required(struct http_response *resp, const char *date) {
+	empty_response(resp, RC_411_LENGTH_REQUIRED, date);
+}
+
+static void serve_proxy(
+		struct vhost *host,
+		const struct http_request *req,
+		const struct route_match *match,
+		struct http_response *resp,
+		const char *date
+) {
+	struct proxy_route *route = (struct proxy_route *)match->target;
+
+	(void)host;
+	if (req->te_chunked) {
+		/* request bodies are relayed by length */
+		length_required(resp, date);
+		return;
 	}
+	if (cache_answers(req, resp)) return;
+	resp->upstream = balancer_pick(&route->balancer, req);
+}
 
-	for (addr = server_info; addr != NULL; addr = addr->ai_next) {
-		listener_fd = socket(addr->ai_family,
-				addr->ai_socktype,
-				addr->ai_protocol);
-		if (listener_fd == -1) {
-			perror("socket");
-			continue;
+static void serve_fastcgi(
+		struct vhost *host,
+		const struct http_request *req,
+		const struct route_match *match,
+		struct http_response *resp,
+		const char *date
+) {
+	struct fastcgi_route *route = (struct fastcgi_route *)match->target;
+	char key[PATH_KEY_MAX];
+
+	if (req->te_chunked) {
+		/* CONTENT_LENGTH is to be known up front (RFC 3875 section 4.1.2) */
+		length_required(resp, date);
+		return;
+	}
+	if (normalize_path(&req->path, key, sizeof key) == -1) {
+		/* it cannot name a script */
+		empty_response(resp, RC_404_NOT_FOUND, date);
+		return;
+	}
+	resp->upstream = &route->app;
+	resp->fastcgi = 1;
+	resp->script_root = host->docroot;
+}
+
+/* whether a CONNECT may go to `port` */
+static int connect_port_allowed(uint16_t port) {
+	size_t i;
+	for (i = 0; i < num_connect_ports; ++i) {
+		if (connect_ports[i] == port) return 1;
+	}
+	return 0;
+}
+
+struct conn;
+static int conn_resolve(struct evloop *loop, struct conn *conn, const char *name);
+static int conn_unresolved(struct conn *conn);
+
+/* the upstream an absolute-form target or a CONNECT of `conn` names into
+   `*up`, RC_200_OK unless it cannot be had or is not to be reached; a name
+   met for the first time leaves `*up` NULL, the connection waiting in
+   CS_RESOLVING to be answered again once it is resolved. Requests waiting
+   on another one's response name the same, so it stays while they do */
+static enum http_response_code destination(
+		struct evloop *loop,
+		struct conn *conn,
+		const struct http_request *req,
+		struct upstream **up
+) {
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	char name[RESOLVER_NAME_MAX];
+
+	*up = NULL;
+	if (req->method == HM_CONNECT && !connect_port_allowed(req->port)) return RC_403_FORBIDDEN;
+	if (req->target_form == TF_AUTHORITY || req->port != 0) {
+		if (req->authority.len >= sizeof name) return RC_502_BAD_GATEWAY;
+		memcpy(name, req->authority.ptr, req->authority.len);
+		name[req->authority.len] = '\0';
+	} else {
+		if (req->host.len + sizeof ":80" > sizeof name) return RC_502_BAD_GATEWAY;
+		memcpy(name, req->host.ptr, req->host.len);
+		strcpy(name + req->host.len, ":80");
+	}
+	if (conn_unresolved(conn)) return RC_502_BAD_GATEWAY;
+
+	*up = upstream_set_find(&destinations, name);
+	if (*up == NULL && resolve_name(name, 1, &addr, &addr_len) == 0) {
+		/* a literal address needs no lookup */
+		*up = upstream_set_add(&destinations, name, (void *)&addr, addr_len);
+	} else if (*up == NULL) {
+		return conn_resolve(loop, conn, name) == 0 ? RC_200_OK : RC_502_BAD_GATEWAY;
+	}
+	if (*up == NULL) return RC_502_BAD_GATEWAY;
+	if (!forward_internal && acl_internal((const void *)&(*up)->addr)) return RC_403_FORBIDDEN;
+	return RC_200_OK;
+}
+
+static void serve_forward(
+		struct evloop *loop,
+		struct conn *conn,
+		const struct http_request *req,
+		struct http_response *resp,
+		const char *date
+) {
+	struct upstream *up = NULL;
+	enum http_response_code code;
+
+	if (req->te_chunked) {
+		length_required(resp, date);
+		return;
+	}
+	if (slice_str_cmp_check(&req->scheme, "http")) {
+		/* no TLS to the origin, clients CONNECT for https */
+		empty_response(resp, RC_501_NOT_IMPLEMENTED, date);
+		return;
+	}
+	code = destination(loop, conn, req, &up);
+	if (code != RC_200_OK) {
+		empty_response(resp, code, date);
+		return;
+	}
+	if (up == NULL || cache_answers(req, resp)) return;
+	resp->upstream = up;
+}
+
+/* a message sent back as it came */
+static void echo_message(struct ws_conn *ws, enum ws_opcode type, const char *data, size_t len) {
+	ws_send(ws, type, data, len);
+}
+
+static const struct ws_handler echo_handler = {NULL, echo_message, NULL};
+
+static void serve_websocket(
+		struct vhost *host,
+		const struct http_request *req,
+		const struct route_match *match,
+		struct http_response *resp,
+		const char *date
+) {
+	char accept[WS_ACCEPT_LEN + 1];
+	int status;
+
+	(void)host;
+	(void)match;
+	status = ws_handshake(req, accept);
+	if (status == 0) {
+		append_to_response(resp,
+			"HTTP/1.1 101 Switching Protocols" CRLF
+			"Upgrade: websocket" CRLF
+			"Connection: Upgrade" CRLF
+			"Sec-WebSocket-Accept: ");
+		append_to_response(resp, accept);
+		append_to_response(resp, CRLF CRLF);
+		resp->websocket = &echo_handler;
+		return;
+	}
+	begin_response(resp, (enum http_response_code)status, date);
+	if (status == RC_426_UPGRADE_REQUIRED) {
+		append_to_response(resp,
+			"Upgrade: websocket" CRLF
+			"Sec-WebSocket-Version: " WS_VERSION CRLF);
+	}
+	append_length_to_response(resp, 0);
+	append_to_response(resp, CRLF);
+}
+
+static const struct route_handler static_handler = {serve_static};
+static const struct route_handler entity_handler = {serve_entity};
+static const struct route_handler embedded_handler = {serve_embedded};
+static const struct route_handler status_handler = {serve_status};
+static const struct route_handler websocket_handler = {serve_websocket};
+
+/* routes every host has besides its content; -1 if one is malformed or
+   taken by another */
+static int add_common_routes(struct router *routes) {
+	size_t i;
+
+	if (status_path != NULL && router_add(routes, METHOD_BIT(HM_GET) | METHOD_BIT(HM_HEAD),
+			status_path, &status_handler) == -1) {
+		fprintf(stderr, "server: bad status path %s\n", status_path);
+		return -1;
+	}
+	for (i = 0; i < num_proxies; ++i) {
+		if (router_add(routes, ROUTE_ANY_METHOD, proxies[i].pattern, &proxies[i]) == -1) {
+			fprintf(stderr, "server: bad proxy route %s\n", proxies[i].pattern);
+			return -1;
 		}
-		retval = setsockopt(listener_fd,
-				SOL_SOCKET,
-				SO_REUSEADDR,
-				&yes, sizeof yes);
-		if (retval == -1) {
-			perror("setsockopt");
+	}
+	for (i = 0; i < num_fastcgis; ++i) {
+		if (router_add(routes, ROUTE_ANY_METHOD, fastcgis[i].pattern, &fastcgis[i]) == -1) {
+			fprintf(stderr, "server: bad fastcgi route %s\n", fastcgis[i].pattern);
 			return -1;
 		}
-		retval = bind(listener_fd, addr->ai_addr, addr->ai_addrlen);
-		if (retval == -1) {
-			close(listener_fd);
-			listener_fd = -1;
-			perror("bind");
-			continue;
+	}
+	for (i = 0; i < num_websockets; ++i) {
+		if (router_add(routes, METHOD_BIT(HM_GET), websockets[i], &websocket_handler) == -1) {
+			fprintf(stderr, "server: bad websocket route %s\n", websockets[i]);
+			return -1;
 		}
+	}
+	return 0;
+}
+
+/* open the host's docroot and compile its routes, in every worker */
+static void host_init(struct vhost *host) {
+	int ret;
+
+	if (host->docroot != NULL && origin_init(&host->origin, host->docroot) == -1) {
+		perror(host->docroot);
+		exit(1);
+	}
+
+	router_init(&host->routes);
+	if (add_common_routes(&host->routes) == -1) exit(1);
+	/* a proxy, an application or an endpoint may take over the whole site */
+	if (host->docroot != NULL) {
+		ret = router_add(&host->routes, METHOD_BIT(HM_GET) | METHOD_BIT(HM_HEAD),
+			"/*", &static_handler);
+	} else if (embedded_docroot.num_files > 0) {
+		ret = router_add(&host->routes, METHOD_BIT(HM_GET) | METHOD_BIT(HM_HEAD),
+			"/*", &embedded_handler);
+	} else {
+		ret = num_proxies + num_fastcgis + num_websockets > 0 ? 0 : router_add(&host->routes,
+			METHOD_BIT(HM_GET) | METHOD_BIT(HM_HEAD), "/", &entity_handler);
+	}
+	assert(ret == 0 || num_proxies + num_fastcgis + num_websockets > 0);
+	(void)ret;
+	router_compile(&host->routes);
+}
+
+static void dispatch(
+		const struct http_request *req,
+		struct http_response *resp,
+		const char *date
+) {
+	struct vhost *host = vhost_lookup(&hosts, &req->host);
+	struct route_match match;
+	int m, first = 1;
+
+	switch (router_lookup(&host->routes, req->method, &req->path, &match)) {
+	case ROUTE_FOUND:
+		((const struct route_handler *)match.target)->serve(host, req, &match, resp, date);
+		break;
+	case ROUTE_METHOD_NOT_ALLOWED:
+		begin_response(resp, RC_405_METHOD_NOT_ALLOWED, date);
+		append_to_response(resp, "Allow: ");
+		for (m = 0; m < ROUTE_METHODS; ++m) {
+			if (!(match.allowed & METHOD_BIT(m))) continue;
+			append_to_response(resp, first ? "" : ", ");
+			append_to_response(resp, method_name((enum http_method)m));
+			first = 0;
+		}
+		append_to_response(resp, CRLF);
+		append_length_to_response(resp, 0);
+		append_to_response(resp, CRLF);
+		break;
+	case ROUTE_NOT_FOUND:
+		canned_serve(&not_found_page, req->method != HM_HEAD, resp, date);
 		break;
 	}
+}
 
-	if (listener_fd == -1) {
-		return -1;
+/* a client connection: the request is read and parsed, then the response
+   is flushed from its queue as the socket drains */
+enum conn_state {
+	CS_READING,
+	CS_PROXYING, /* relaying between the client and an upstream */
+	CS_FOLLOWING, /* sent the response to an identical request */
+	CS_RESOLVING, /* waiting for the name of the destination of a forward proxy */
+	CS_TUNNELING, /* relaying bytes both ways for a CONNECT */
+	CS_SCRIPTING, /* relaying between the client and a FastCGI application */
+	CS_MULTIPLEXING, /* speaking HTTP/2, any number of requests at once */
+	CS_WEBSOCKET, /* exchanging messages both ways, mostly idle */
+	CS_WRITING,
+	CS_DRAINING, /* sent, a body the response did not need is read to the void */
+	CS_REAPING /* sent, the kernel still holds zerocopy buffers */
+};
+
+struct conn {
+	struct ev_source src; /* first, so that handlers get the conn back */
+	enum conn_state state;
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct outq out;
+	struct stream body; /* produced as the queue drains, if streamed */
+	struct zc_socket zs;
+	struct proxy_call *call; /* NULL unless proxying */
+	struct proxy_follower *follower; /* NULL unless following */
+	struct tunnel *tunnel; /* NULL unless tunneling */
+	struct fcgi_call *script; /* NULL unless scripting */
+	struct h2_conn *h2; /* NULL unless multiplexing */
+	struct ws_conn *ws; /* NULL unless a WebSocket */
+	struct resolver_query *lookup; /* NULL unless resolving */
+	int unresolved; /* the name looked up for it did not resolve */
+	size_t sniffed; /* bytes of the HTTP/2 preface read, SIZE_MAX once it is not */
+	int persistent; /* read the next request once the response is sent */
+	int may_forward; /* the client may use the forward proxy */
+	size_t served; /* requests answered before the one being read */
+	struct evloop *loop; /* for what its streams start */
+	unsigned events; /* watched while proxying */
+	time_t deadline;
+	struct conn *prev, *next;
+};
+
+/* every connection of the worker, for timeouts */
+static struct conn *conns;
+
+static const struct body_stream no_body = {NULL, NULL, NULL, 0};
+
+static void conn_destroy(struct ev_source *src) {
+	struct conn *conn = (struct conn *)src;
+
+	if (conn->prev != NULL) conn->prev->next = conn->next;
+	else conns = conn->next;
+	if (conn->next != NULL) conn->next->prev = conn->prev;
+
+	close(conn->src.fd);
+	parse_ctx_free(&conn->ctx);
+	http_request_free(&conn->req);
+	stream_free(&conn->body);
+	/* before the call, whose pipe the queue may read from */
+	outq_free(&conn->out);
+	if (conn->call != NULL) {
+		proxy_call_free(conn->call);
+		free(conn->call);
 	}
+	if (conn->follower != NULL) {
+		proxy_unfollow(conn->follower);
+		pcache_unref(conn->follower->stale);
+		free(conn->follower);
+	}
+	if (conn->tunnel != NULL) {
+		tunnel_free(conn->tunnel);
+		free(conn->tunnel);
+	}
+	if (conn->script != NULL) {
+		fcgi_call_free(conn->script);
+		free(conn->script);
+	}
+	if (conn->h2 != NULL) {
+		h2_conn_free(conn->h2);
+		free(conn->h2);
+	}
+	if (conn->ws != NULL) {
+		ws_conn_free(conn->ws);
+		free(conn->ws);
+	}
+	if (conn->lookup != NULL) {
+		resolver_cancel(&resolver, conn->lookup);
+		free(conn->lookup);
+	}
+	free(conn);
+}
 
-	if (listen(listener_fd, SOMAXCONN) == -1) {
-		perror("listen");
-		close(listener_fd);
-		return -1;
+/* a reset makes the kernel drop buffers a stalled peer still pins */
+static void conn_abort(struct evloop *loop, struct conn *conn) {
+	struct linger abort_close = {1, 0};
+	setsockopt(conn->src.fd, SOL_SOCKET, SO_LINGER, &abort_close, sizeof abort_close);
+	evloop_retire(loop, &conn->src, conn_destroy);
+}
+
+/* EPOLLERR also reports zerocopy completions: 1 if the peer is gone */
+static int conn_failed(struct conn *conn, unsigned events) {
+	if (events & EPOLLHUP) return 1;
+	if (!(events & EPOLLERR)) return 0;
+	return conn->zs.done == conn->zs.sent || zc_poll(&zerocopy, &conn->zs) != 1;
+}
+
+static void proxy_notify(struct proxy_call *call);
+
+/* whether the request may share the response to an identical one */
+static int coalesces(const struct conn *conn) {
+	return cache.max_entries > 0 && conn->req.method == HM_GET && conn->req.content_length == 0;
+}
+
+/* forward the request, with whatever of its body came along, to have
+   `stale` (referenced, NULL if none) confirmed if given */
+static void conn_forward(
+		struct evloop *loop,
+		struct conn *conn,
+		struct upstream *up,
+		struct pcache_entry *stale
+) {
+	conn->call = malloc(sizeof *conn->call);
+	if (conn->call == NULL) {
+		perror("conn_forward");
+		exit(1);
 	}
+	proxy_call_init(conn->call, loop, up, &conn->req, &conn->out, proxy_notify, conn);
+	if (cache.max_entries > 0) proxy_call_cache(conn->call, &cache, stale);
+	/* unless another call fetches it already, one timed out on */
+	if (coalesces(conn)) proxy_call_lead(conn->call);
+	conn->state = CS_PROXYING;
+	conn->events = EPOLLIN;
+	proxy_call_start(conn->call, conn->ctx.buf + conn->ctx.pos, conn->ctx.len - conn->ctx.pos);
+}
 
-	inet_ntop(addr->ai_addr->sa_family,
-			get_sockaddr_in(addr->ai_addr),
-			addrstr, sizeof addrstr);
+static void follow_notify(struct proxy_follower *f);
+static void conn_done(struct evloop *loop, struct conn *conn);
 
-	printf("server: listening on %s...\n", addrstr);
+/* have the response `leader` fetches sent to the client too, keeping `up`
+   and `stale` (referenced, NULL if none) for the request to go alone */
+static void conn_follow(
+		struct evloop *loop,
+		struct conn *conn,
+		struct proxy_call *leader,
+		struct upstream *up,
+		struct pcache_entry *stale
+) {
+	conn->follower = malloc(sizeof *conn->follower);
+	if (conn->follower == NULL) {
+		perror("conn_follow");
+		exit(1);
+	}
+	proxy_follow(leader, conn->follower, &conn->req, &conn->out, follow_notify, conn);
+	conn->follower->up = up;
+	conn->follower->stale = stale;
+	conn->state = CS_FOLLOWING;
+	/* nothing to read nor to send until the head comes */
+	if (evloop_mod(loop, &conn->src, 0) == 0) conn->events = 0;
+}
 
-	freeaddrinfo(server_info);
+/* forward the request after all, the response being no use to it or
+   taking too long */
+static void conn_go_alone(struct evloop *loop, struct conn *conn) {
+	struct proxy_follower *f = conn->follower;
+	struct upstream *up = f->up;
+	struct pcache_entry *stale = f->stale;
 
-	return listener_fd;
+	proxy_unfollow(f);
+	free(f);
+	conn->follower = NULL;
+	evloop_mod(loop, &conn->src, EPOLLIN);
+	conn_forward(loop, conn, up, stale);
 }
 
-static void handle_client(int client_fd) {
-	char buf[MAXDATASIZE];
+/* send what was fanned out so far */
+static void conn_following(struct evloop *loop, struct conn *conn, unsigned events) {
+	struct proxy_follower *f = conn->follower;
+	enum outq_status status;
+	unsigned watch;
 
-	struct http_request req = new_request();
-	struct parse_ctx ctx = parse_ctx_init(&req);
-	enum parse_result res;
+	if (conn->src.handle == NULL) return;
+	if (f->state == FW_BROKEN || conn_failed(conn, events)) {
+		conn_abort(loop, conn);
+		return;
+	}
+	if (f->state == FW_WAITING) return;
+	status = outq_flush(&conn->out, &zerocopy, &conn->zs);
+	if (status == OUTQ_ERROR) {
+		conn_abort(loop, conn);
+		return;
+	}
+	if (f->state == FW_DONE && status == OUTQ_DONE) {
+		conn_done(loop, conn);
+		return;
+	}
+	/* it may have held the leader back */
+	if (f->leader != NULL) proxy_call_resume(f->leader);
 
-	struct http_response reply = new_response();
-	char datetime[30] = {0};
+	watch = status == OUTQ_AGAIN ? EPOLLOUT : 0;
+	if (watch != conn->events && evloop_mod(loop, &conn->src, watch) == 0) {
+		conn->events = watch;
+	}
+}
+
+static void follow_notify(struct proxy_follower *f) {
+	struct conn *conn = f->owner;
+
+	if (conn->src.handle == NULL) return;
+	conn->deadline = time(NULL) + CONN_TIMEOUT;
+	if (f->state == FW_RELEASED) {
+		conn_go_alone(f->loop, conn);
+	} else {
+		conn_following(f->loop, conn, 0);
+	}
+}
 
-	ssize_t num_bytes = recv(client_fd, buf, MAXDATASIZE - 1, 0);
-	if (num_bytes == -1) {
-		perror("recv");
-		parse_ctx_free(&ctx);
-		http_request_free(&req);
+static void tunnel_notify(struct tunnel *t);
+
+/* relay the bytes of a CONNECT to `up` and back */
+static void conn_tunnel(struct evloop *loop, struct conn *conn, struct upstream *up) {
+	conn->tunnel = malloc(sizeof *conn->tunnel);
+	if (conn->tunnel == NULL) {
+		perror("conn_tunnel");
 		exit(1);
 	}
+	tunnel_init(conn->tunnel, loop, up, conn->src.fd, &conn->out, tunnel_notify, conn);
+	conn->state = CS_TUNNELING;
+	conn->events = EPOLLIN;
+	tunnel_start(conn->tunnel, conn->ctx.buf + conn->ctx.pos, conn->ctx.len - conn->ctx.pos);
+}
 
-	printf("request:\n%.*s\n", (int)num_bytes, buf);
+/* move client bytes up and upstream ones down, each way until it ends */
+static void conn_tunneling(struct evloop *loop, struct conn *conn, unsigned events) {
+	struct tunnel *t = conn->tunnel;
+	enum outq_status status;
+	unsigned watch = 0;
+	ssize_t n;
 
-	while ((res = feed(&ctx, buf, (size_t)num_bytes)) != PR_COMPLETE) {
-		num_bytes = recv(client_fd, buf, MAXDATASIZE - 1, 0);
-		if (num_bytes == -1) {
-			perror("recv");
-			parse_ctx_free(&ctx);
-			http_request_free(&req);
+	if (conn->src.handle == NULL) return;
+	if (conn_failed(conn, events & EPOLLERR)) {
+		conn_abort(loop, conn);
+		return;
+	}
+	/* closed both ways: what it sent before is passed on still */
+	if (events & EPOLLHUP) events |= EPOLLIN;
+	while ((events & EPOLLIN) && tunnel_room(t) > 0) {
+		n = tunnel_pull(t, conn->src.fd);
+		if (n > 0) continue;
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+		if (n == -1) {
+			conn_abort(loop, conn);
+			return;
+		}
+		break;
+	}
+
+	if (t->state == TN_BROKEN) {
+		conn_abort(loop, conn);
+		return;
+	}
+	status = outq_flush(&conn->out, &zerocopy, &conn->zs);
+	if (status == OUTQ_ERROR) {
+		conn_abort(loop, conn);
+		return;
+	}
+	if (status == OUTQ_DONE && (t->state == TN_DONE || (events & EPOLLHUP))) {
+		conn_done(loop, conn);
+		return;
+	}
+	if (status == OUTQ_DONE) tunnel_drained(t);
+	tunnel_resume(t);
+
+	if (status == OUTQ_AGAIN) watch |= EPOLLOUT;
+	if (tunnel_room(t) > 0) watch |= EPOLLIN;
+	if (watch != conn->events && evloop_mod(loop, &conn->src, watch) == 0) {
+		conn->events = watch;
+	}
+}
+
+static void tunnel_notify(struct tunnel *t) {
+	struct conn *conn = t->owner;
+
+	conn->deadline = time(NULL) + CONN_TIMEOUT;
+	if (conn->state == CS_TUNNELING) conn_tunneling(t->loop, conn, 0);
+}
+
+static void script_notify(struct fcgi_call *call);
+
+/* the port of an IPv4 or IPv6 address, in host order */
+static unsigned short sockaddr_port(const struct sockaddr_storage *ss) {
+	struct sockaddr_in in;
+	struct sockaddr_in6 in6;
+
+	if (ss->ss_family == AF_INET) {
+		memcpy(&in, ss, sizeof in);
+		return ntohs(in.sin_port);
+	}
+	memcpy(&in6, ss, sizeof in6);
+	return ntohs(in6.sin6_port);
+}
+
+/* the addresses of the connection, for the CGI variables */
+static void conn_addresses(const struct conn *conn, struct fcgi_script *script) {
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof addr;
+
+	script->remote_addr[0] = '\0';
+	script->remote_port = script->server_port = 0;
+	if (getpeername(conn->src.fd, (void *)&addr, &len) == 0 &&
+			(addr.ss_family == AF_INET || addr.ss_family == AF_INET6)) {
+		inet_ntop(addr.ss_family, get_sockaddr_in(&addr),
+			script->remote_addr, sizeof script->remote_addr);
+		script->remote_port = sockaddr_port(&addr);
+	}
+	len = sizeof addr;
+	if (getsockname(conn->src.fd, (void *)&addr, &len) == 0 &&
+			(addr.ss_family == AF_INET || addr.ss_family == AF_INET6)) {
+		script->server_port = sockaddr_port(&addr);
+	}
+}
+
+/* hand the request, with whatever of its body came along, to the FastCGI
+   application `app`, its scripts under `root` */
+static void conn_script(struct evloop *loop, struct conn *conn, struct upstream *app, const char *root) {
+	struct fcgi_script script;
+
+	conn->script = malloc(sizeof *conn->script);
+	if (conn->script == NULL) {
+		perror("conn_script");
+		exit(1);
+	}
+	script.docroot = root;
+	conn_addresses(conn, &script);
+	fcgi_call_init(conn->script, loop, app, &conn->req, &script, &conn->out, script_notify, conn);
+	conn->state = CS_SCRIPTING;
+	conn->events = EPOLLIN;
+	fcgi_call_start(conn->script, conn->ctx.buf + conn->ctx.pos, conn->ctx.len - conn->ctx.pos);
+}
+
+/* move the request body to the application and its stdout down, each
+   side being read only while the other has room */
+static void conn_scripting(struct evloop *loop, struct conn *conn, unsigned events) {
+	struct fcgi_call *call = conn->script;
+	enum outq_status status;
+	unsigned watch = 0;
+	ssize_t n;
+
+	if (conn->src.handle == NULL) return;
+	if (conn_failed(conn, events)) {
+		conn_abort(loop, conn);
+		return;
+	}
+	while ((events & EPOLLIN) && fcgi_call_room(call) > 0) {
+		n = fcgi_call_pull(call, conn->src.fd);
+		if (n > 0) continue;
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+		/* gone before the whole body */
+		conn_abort(loop, conn);
+		return;
+	}
+
+	if (call->state == FC_BROKEN) {
+		conn_abort(loop, conn);
+		return;
+	}
+	status = outq_flush(&conn->out, &zerocopy, &conn->zs);
+	if (status == OUTQ_ERROR) {
+		conn_abort(loop, conn);
+		return;
+	}
+	if (call->state == FC_DONE && status == OUTQ_DONE) {
+		conn_done(loop, conn);
+		return;
+	}
+	fcgi_call_resume(call);
+
+	if (status == OUTQ_AGAIN) watch |= EPOLLOUT;
+	if (fcgi_call_room(call) > 0) watch |= EPOLLIN;
+	if (watch != conn->events && evloop_mod(loop, &conn->src, watch) == 0) {
+		conn->events = watch;
+	}
+}
+
+/* the application queued something for the client, took some body or
+   ended */
+static void script_notify(struct fcgi_call *call) {
+	struct conn *conn = call->owner;
+
+	conn->deadline = time(NULL) + CONN_TIMEOUT;
+	if (conn->state == CS_SCRIPTING) conn_scripting(call->loop, conn, 0);
+}
+
+/* a request repeated upstream to refresh a response served stale, its
+   answer going nowhere but in the cache */
+struct refresh {
+	struct proxy_call call; /* first, its source is retired */
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct outq sink; /* what the client would have got, dropped */
+	struct pcache_entry *entry; /* marked as revalidating */
+	time_t deadline;
+	struct refresh *prev, *next;
+};
+
+/* every refresh of the worker, for timeouts */
+static struct refresh *refreshes;
+
+static void refresh_destroy(struct ev_source *src) {
+	struct refresh *r = (struct refresh *)src;
+
+	if (r->prev != NULL) r->prev->next = r->next;
+	else refreshes = r->next;
+	if (r->next != NULL) r->next->prev = r->prev;
+
+	r->entry->revalidating = 0;
+	pcache_unref(r->entry);
+	outq_free(&r->sink);
+	proxy_call_free(&r->call);
+	parse_ctx_free(&r->ctx);
+	http_request_free(&r->req);
+	free(r);
+}
+
+static void refresh_notify(struct proxy_call *call) {
+	struct refresh *r = call->owner;
+
+	outq_free(&r->sink);
+	outq_init(&r->sink);
+	if (call->state >= PX_DONE && call->src.handle != NULL) {
+		evloop_retire(call->loop, &call->src, refresh_destroy);
+	}
+}
+
+/* send the request parsed by `ctx` again to refresh `stale` (referenced),
+   once the client has been answered with it */
+static void refresh_start(
+		struct evloop *loop,
+		const struct parse_ctx *ctx,
+		struct upstream *up,
+		struct pcache_entry *stale
+) {
+	struct refresh *r = malloc(sizeof *r);
+
+	if (r == NULL) {
+		perror("refresh_start");
+		exit(1);
+	}
+	/* the client's copy goes with its connection */
+	r->req = new_request();
+	r->ctx = parse_ctx_init(&r->req);
+	feed(&r->ctx, ctx->buf, ctx->pos);
+	outq_init(&r->sink);
+	r->entry = pcache_ref(stale);
+	stale->revalidating = 1;
+	r->deadline = time(NULL) + CONN_TIMEOUT;
+	r->prev = NULL;
+	r->next = refreshes;
+	if (refreshes != NULL) refreshes->prev = r;
+	refreshes = r;
+
+	proxy_call_init(&r->call, loop, up, &r->req, &r->sink, refresh_notify, r);
+	/* nothing may be left in a pipe when the sink is emptied */
+	r->call.resp_pipe.failed = 1;
+	proxy_call_cache(&r->call, &cache, stale);
+	proxy_call_start(&r->call, NULL, 0);
+}
+
+/* answer a request the parser gave up on */
+static void reject(
+		const struct parse_ctx *ctx,
+		const struct http_request *req,
+		struct http_response *reply,
+		const char *datetime
+) {
+	if (ctx->state == PS_ERROR) {
+		append_to_response(reply,
+			"HTTP/1.1 400 Bad Request" CRLF
+			"Server: " SERVER CRLF
+			"Content-Length: 0" CRLF
+			"Connection: close" CRLF
+			"Date: ");
+		append_to_response(reply, datetime);
+		append_to_response(reply,
+			CRLF CRLF);
+	} else if (req->method == HM_UNK) {
+		append_to_response(reply,
+			"HTTP/1.1 501 Not Implemented" CRLF
+			"Server: " SERVER CRLF
+			"Content-Length: 0" CRLF
+			"Connection: close" CRLF
+			"Date: ");
+		append_to_response(reply, datetime);
+		append_to_response(reply,
+			CRLF CRLF);
+	} else {
+		assert(0);
+	}
+}
+
+/* answer the request of an HTTP/2 stream; the relays to upstreams and
+   FastCGI applications frame their responses in HTTP/1.1, such requests
+   get 421 for the client to retry them over a connection of their own,
+   as h2_respond() answers those of WebSocket routes */
+static void h2_serve(struct h2_conn *h2, struct h2_stream *st) {
+	struct conn *conn = h2->owner;
+	struct http_response reply = new_response();
+	char datetime[HTTP_DATE_LEN + 1] = {0};
+
+	get_current_time(datetime);
+	if (st->ctx.state > PS_DONE) {
+		reject(&st->ctx, &st->req, &reply, datetime);
+	} else if (st->req.method == HM_CONNECT) {
+		empty_response(&reply, forwarding ? RC_421_MISDIRECTED_REQUEST : RC_501_NOT_IMPLEMENTED,
+			datetime);
+	} else {
+		dispatch(&st->req, &reply, datetime);
+	}
+
+	if (reply.upstream != NULL && reply.background) {
+		refresh_start(conn->loop, &st->ctx, reply.upstream, reply.stale);
+	} else if (reply.upstream != NULL) {
+		pcache_unref(reply.stale);
+		http_response_free(&reply);
+		reply = new_response();
+		empty_response(&reply, RC_421_MISDIRECTED_REQUEST, datetime);
+	}
+	h2_respond(h2, st, &reply);
+}
+
+/* read frames while the queue has room, frame the streams' DATA as it
+   drains */
+static void conn_multiplexing(struct evloop *loop, struct conn *conn, unsigned events) {
+	struct h2_conn *h2 = conn->h2;
+	char buf[H2_FRAME_HEADER + H2_FRAME_SIZE];
+	enum outq_status status;
+	unsigned watch = 0;
+	ssize_t n;
+
+	if (conn->src.handle == NULL) return;
+	if (conn_failed(conn, events)) {
+		conn_abort(loop, conn);
+		return;
+	}
+	while ((events & EPOLLIN) && !h2->failed && conn->out.bytes < H2_AHEAD) {
+		n = recv(conn->src.fd, buf, sizeof buf, 0);
+		if (n > 0) {
+			h2_conn_feed(h2, buf, (size_t)n);
+			continue;
+		}
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+		if (n == 0) {
+			/* the client is done with the connection */
+			evloop_retire(loop, &conn->src, conn_destroy);
+		} else {
+			conn_abort(loop, conn);
+		}
+		return;
+	}
+
+	/* streams are framed into a drained queue, not to outrun the socket */
+	status = outq_flush(&conn->out, &zerocopy, &conn->zs);
+	while (status == OUTQ_DONE) {
+		h2_conn_pump(h2);
+		if (conn->out.bytes == 0) break;
+		status = outq_flush(&conn->out, &zerocopy, &conn->zs);
+	}
+	if (status == OUTQ_ERROR) {
+		conn_abort(loop, conn);
+		return;
+	}
+	if (status == OUTQ_DONE && h2_conn_done(h2)) {
+		conn_done(loop, conn);
+		return;
+	}
+
+	if (status == OUTQ_AGAIN) watch |= EPOLLOUT;
+	if (!h2->failed && conn->out.bytes < H2_AHEAD) watch |= EPOLLIN;
+	if (watch != conn->events && evloop_mod(loop, &conn->src, watch) == 0) {
+		conn->events = watch;
+	}
+}
+
+/* speak HTTP/2 from now on, `buf` having been read past the client
+   preface; or, given the `settings` of a request asking to upgrade, past
+   that request, which gets 101 and is answered as stream 1 */
+static void conn_h2(
+		struct evloop *loop,
+		struct conn *conn,
+		const unsigned char *settings,
+		size_t settings_len,
+		const char *buf,
+		size_t len
+) {
+	char *rest = NULL;
+
+	conn->h2 = malloc(sizeof *conn->h2);
+	if (conn->h2 == NULL) {
+		perror("conn_h2");
+		exit(1);
+	}
+	conn->state = CS_MULTIPLEXING;
+	if (settings == NULL) {
+		h2_conn_init(conn->h2, &conn->out, 1, h2_serve, conn);
+	} else {
+		/* the request goes with its parser, not what came after it */
+		len = conn->ctx.len - conn->ctx.pos;
+		rest = malloc(len + 1);
+		if (rest == NULL) {
+			perror("conn_h2");
 			exit(1);
 		}
-		if (num_bytes == 0) {
-			break;
+		memcpy(rest, conn->ctx.buf + conn->ctx.pos, len);
+		buf = rest;
+		outq_push_mem(&conn->out, SWITCHING_TO_H2, sizeof SWITCHING_TO_H2 - 1, NULL, NULL);
+		h2_conn_init(conn->h2, &conn->out, 0, h2_serve, conn);
+		h2_conn_upgrade(conn->h2, &conn->req, &conn->ctx, settings, settings_len);
+	}
+	if (len > 0) h2_conn_feed(conn->h2, buf, len);
+	free(rest);
+	conn_multiplexing(loop, conn, 0);
+}
+
+/* read frames while the queue has room, into a buffer of the stack: an
+   idle connection keeps none */
+static void conn_websocketing(struct evloop *loop, struct conn *conn, unsigned events) {
+	struct ws_conn *ws = conn->ws;
+	char buf[16 << 10];
+	enum outq_status status;
+	unsigned watch = 0;
+	ssize_t n;
+
+	if (conn->src.handle == NULL) return;
+	if (conn_failed(conn, events)) {
+		conn_abort(loop, conn);
+		return;
+	}
+	while ((events & EPOLLIN) && !ws->failed && !ws->closed && conn->out.bytes < WS_AHEAD) {
+		n = recv(conn->src.fd, buf, sizeof buf, 0);
+		if (n > 0) {
+			ws_conn_feed(ws, buf, (size_t)n);
+			continue;
+		}
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+		/* gone without a close frame */
+		if (n == 0) {
+			evloop_retire(loop, &conn->src, conn_destroy);
+		} else {
+			conn_abort(loop, conn);
 		}
+		return;
 	}
+
+	status = outq_flush(&conn->out, &zerocopy, &conn->zs);
+	if (status == OUTQ_ERROR) {
+		conn_abort(loop, conn);
+		return;
+	}
+	if (status == OUTQ_DONE && ws_conn_done(ws)) {
+		conn_done(loop, conn);
+		return;
+	}
+	if (status == OUTQ_DONE) outq_shrink(&conn->out);
+
+	if (status == OUTQ_AGAIN) watch |= EPOLLOUT;
+	if (!ws->failed && !ws->closed && conn->out.bytes < WS_AHEAD) watch |= EPOLLIN;
+	if (watch != conn->events && evloop_mod(loop, &conn->src, watch) == 0) {
+		conn->events = watch;
+	}
+}
+
+/* the handler sent something outside of a read */
+static void ws_notify(struct ws_conn *ws) {
+	struct conn *conn = ws->owner;
+
+	if (conn->state == CS_WEBSOCKET) conn_websocketing(conn->loop, conn, 0);
+}
+
+/* hand the connection to `reply`'s WebSocket handler once its 101 is
+   queued, with the frames that came along with the request; the request
+   is let go of */
+static void conn_websocket(struct evloop *loop, struct conn *conn, struct http_response *reply) {
+	const struct ws_handler *handler = reply->websocket;
+
+	conn->ws = malloc(sizeof *conn->ws);
+	if (conn->ws == NULL) {
+		perror("conn_websocket");
+		exit(1);
+	}
+	outq_push_response(&conn->out, reply);
+	conn->state = CS_WEBSOCKET;
+	ws_conn_init(conn->ws, &conn->out, handler, ws_notify, conn);
+	ws_conn_feed(conn->ws, conn->ctx.buf + conn->ctx.pos, conn->ctx.len - conn->ctx.pos);
+	parse_ctx_free(&conn->ctx);
+	http_request_free(&conn->req);
+	memset(&conn->ctx, 0, sizeof conn->ctx);
+	memset(&conn->req, 0, sizeof conn->req);
+	conn_websocketing(loop, conn, 0);
+}
+
+/* the body is to be relayed: a client waiting for leave to send it gets
+   it, unless some came along already (RFC 9110 section 10.1.1) */
+static void conn_continue(struct conn *conn) {
+	if (!conn->req.expect_100 || conn->req.content_length == 0 ||
+			conn->ctx.len > conn->ctx.pos) {
+		return;
+	}
+	outq_push_mem(&conn->out, CONTINUE, sizeof CONTINUE - 1, NULL, NULL);
+	outq_flush(&conn->out, &zerocopy, &conn->zs);
+}
+
+static int body_unread(const struct conn *conn);
+
+/* whether the connection may carry another request after the response,
+   told before its head is written: the client asks for it and the end of
+   the request is found without a close, RFC 9112 section 9.3; the
+   response is yet to delimit its body */
+static enum conn_disposition offered(const struct conn *conn) {
+	if (conn->ctx.state != PS_DONE || conn->req.http_major != 1 ||
+			!conn->req.keep_alive || body_unread(conn)) {
+		return CD_CLOSE;
+	}
+	return is_http_ver(&conn->req, 1, 0) ? CD_KEEP_ALIVE_10 : CD_KEEP_ALIVE;
+}
+
+static void conn_respond(struct evloop *loop, struct conn *conn, enum parse_result res) {
+	struct http_response reply = new_response();
+	struct upstream *up = NULL;
+	struct pcache_entry *stale;
+	struct proxy_call *leader;
+	enum http_response_code code;
+	struct body_stream source;
+	const char *root;
+	unsigned char settings[H2_SETTINGS_MAX];
+	long settings_len;
+	char datetime[HTTP_DATE_LEN + 1] = {0};
+
 	get_current_time(datetime);
+	reply.connection = offered(conn);
 	if (res == PR_NEED_MORE) {
 		append_to_response(&reply,
 			"HTTP/1.1 400 Bad Request" CRLF
@@ -170,122 +1366,857 @@ static void handle_client(int client_fd) {
 		append_to_response(&reply, datetime);
 		append_to_response(&reply,
 			CRLF CRLF);
-	} else if (ctx.state > PS_DONE) {
-		if (ctx.state == PS_ERROR) {
-			append_to_response(&reply,
-				"HTTP/1.1 400 Bad Request" CRLF
-				"Server: " SERVER CRLF
-				"Content-Length: 0" CRLF
-				"Connection: close" CRLF
-				"Date: ");
-			append_to_response(&reply, datetime);
-			append_to_response(&reply,
-				CRLF CRLF);
-		} else if (req.method == HM_UNK) {
-			append_to_response(&reply,
-				"HTTP/1.1 501 Not Implemented" CRLF
-				"Server: " SERVER CRLF
-				"Content-Length: 0" CRLF
-				"Connection: close" CRLF
-				"Date: ");
-			append_to_response(&reply, datetime);
-			append_to_response(&reply,
-				CRLF CRLF);
-		} else {
-			assert(0);
+	} else if (conn->ctx.state > PS_DONE) {
+		reject(&conn->ctx, &conn->req, &reply, datetime);
+	} else if ((settings_len = h2_upgrade_settings(&conn->req, settings)) >= 0) {
+		http_response_free(&reply);
+		conn_h2(loop, conn, settings, (size_t)settings_len, NULL, 0);
+		return;
+	} else if (forwarding && !conn->may_forward &&
+			(conn->req.method == HM_CONNECT || conn->req.target_form == TF_ABSOLUTE)) {
+		empty_response(&reply, RC_403_FORBIDDEN, datetime);
+	} else if (forwarding && conn->req.method == HM_CONNECT) {
+		code = destination(loop, conn, &conn->req, &up);
+		if (code == RC_200_OK && up != NULL) {
+			http_response_free(&reply);
+			conn_tunnel(loop, conn, up);
+			return;
 		}
+		if (code != RC_200_OK) empty_response(&reply, code, datetime);
+	} else if (conn->req.method == HM_CONNECT) {
+		empty_response(&reply, RC_501_NOT_IMPLEMENTED, datetime);
+	} else if (forwarding && conn->req.target_form == TF_ABSOLUTE) {
+		serve_forward(loop, conn, &conn->req, &reply, datetime);
 	} else {
-		if (!slice_str_cmp_check(&req.path, "/")) {
-			append_to_response(&reply,
-				"HTTP/1.1 200 OK" CRLF
-				"Server: " SERVER CRLF
-				"Content-Length: 78" CRLF
-				"Connection: close" CRLF
-				"Date: ");
-			append_to_response(&reply, datetime);
-			append_to_response(&reply,
-				CRLF CRLF
-				ENTITY);
+		dispatch(&conn->req, &reply, datetime);
+	}
+
+	if (conn->state == CS_RESOLVING) {
+		http_response_free(&reply);
+		return;
+	}
+	if (reply.websocket != NULL) {
+		conn_websocket(loop, conn, &reply);
+		return;
+	}
+	up = reply.upstream;
+	stale = reply.stale;
+	if (up != NULL && !reply.background && max_body > 0 && conn->req.content_length > 0 &&
+			(size_t)conn->req.content_length > max_body) {
+		/* refused before the client sends it, if it waits to be told */
+		pcache_unref(stale);
+		http_response_free(&reply);
+		reply = new_response();
+		empty_response(&reply, RC_413_REQUEST_ENTITY_TOO_LARGE, datetime);
+		up = NULL;
+	}
+	if (up != NULL && reply.fastcgi) {
+		root = reply.script_root;
+		http_response_free(&reply);
+		conn_continue(conn);
+		conn_script(loop, conn, up, root);
+		return;
+	}
+	if (up != NULL && !reply.background) {
+		http_response_free(&reply);
+		conn_continue(conn);
+		/* misses on the same key wait for the first one's response */
+		leader = coalesces(conn) ? proxy_call_leading(&cache, &conn->req) : NULL;
+		if (leader != NULL) {
+			conn_follow(loop, conn, leader, up, stale);
 		} else {
-			append_to_response(&reply,
-				"HTTP/1.1 404 Not Found" CRLF
-				"Server: " SERVER CRLF
-				"Content-Length: 88" CRLF
-				"Connection: close" CRLF
-				"Date: ");
-			append_to_response(&reply, datetime);
-			append_to_response(&reply,
-				CRLF CRLF
-				NOT_FOUND);
+			conn_forward(loop, conn, up, stale);
+		}
+		return;
+	}
+	if (up != NULL) refresh_start(loop, &conn->ctx, up, stale);
+
+	conn->persistent = reply.connection != CD_CLOSE && reply.delimited;
+
+	/* files are duplicated, so caches may close theirs meanwhile */
+	source = reply.stream;
+	if (outq_push_response(&conn->out, &reply) == -1) {
+		/* the head promises more body than went in: the client must not
+		   take it, nor read the next response as the rest of it */
+		perror("dup");
+		if (source.release != NULL) source.release(source.ctx);
+		conn_abort(loop, conn);
+		return;
+	}
+	stream_init(&conn->body, &conn->out, &source);
+	conn->state = CS_WRITING;
+}
+
+/* read what arrived, -1 once the connection is to be dropped */
+static int conn_read(struct evloop *loop, struct conn *conn) {
+	/* room ahead for the part of the HTTP/2 preface held back */
+	char buf[H2_PREFACE_LEN + MAXDATASIZE];
+	char *data;
+	ssize_t num_bytes;
+	size_t len, n;
+
+	/* dropped if its response could not be queued */
+	while (conn->state == CS_READING && conn->src.handle != NULL) {
+		num_bytes = recv(conn->src.fd, buf + H2_PREFACE_LEN, MAXDATASIZE - 1, 0);
+		if (num_bytes == -1) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+			perror("recv");
+			return -1;
+		}
+		if (num_bytes == 0) {
+			/* a persistent connection may end between requests */
+			if (conn->served > 0 && conn->ctx.len == 0) return -1;
+			conn_respond(loop, conn, PR_NEED_MORE);
+			break;
 		}
+		data = buf + H2_PREFACE_LEN;
+		len = (size_t)num_bytes;
+		if (conn->sniffed != SIZE_MAX) {
+			/* a client with prior knowledge starts with the preface */
+			n = H2_PREFACE_LEN - conn->sniffed;
+			if (n > len) n = len;
+			if (memcmp(data, H2_PREFACE + conn->sniffed, n) == 0) {
+				conn->sniffed += n;
+				if (conn->sniffed == H2_PREFACE_LEN) {
+					conn_h2(loop, conn, NULL, 0, data + n, len - n);
+				}
+				continue;
+			}
+			data -= conn->sniffed;
+			memcpy(data, H2_PREFACE, conn->sniffed);
+			len += conn->sniffed;
+			conn->sniffed = SIZE_MAX;
+		}
+		printf("request:\n%.*s\n", (int)len, data);
+		/* a read may end right after a field line */
+		if (feed(&conn->ctx, data, len) == PR_COMPLETE &&
+				conn->ctx.state >= PS_DONE) {
+			conn_respond(loop, conn, PR_COMPLETE);
+		}
+	}
+	return 0;
+}
+
+/* everything is sent: the connection ends once the kernel let go of its
+   zerocopy buffers */
+static void conn_done(struct evloop *loop, struct conn *conn) {
+	if (conn->zs.done != conn->zs.sent) {
+		/* zerocopy completions raise EPOLLERR */
+		conn->state = CS_REAPING;
+		evloop_mod(loop, &conn->src, 0);
+	} else {
+		evloop_retire(loop, &conn->src, conn_destroy);
+	}
+}
+
+/* the response is sent on a persistent connection: on to the next
+   request, parsed at once from the bytes that came after this one's body;
+   1 if there are some */
+static int conn_next(struct evloop *loop, struct conn *conn) {
+	size_t consumed = conn->ctx.pos;
+
+	if (conn->req.content_length > 0) consumed += (size_t)conn->req.content_length;
+	stream_free(&conn->body);
+	stream_init(&conn->body, &conn->out, &no_body);
+	outq_shrink(&conn->out);
+	http_request_free(&conn->req);
+	conn->req = new_request();
+	parse_ctx_reset(&conn->ctx, &conn->req, consumed);
+	conn->state = CS_READING;
+	conn->persistent = 0;
+	conn->served++;
+	/* the preface only opens a connection */
+	conn->sniffed = SIZE_MAX;
+	conn->deadline = time(NULL) + IDLE_WAIT;
+	evloop_mod(loop, &conn->src, EPOLLIN);
+	if (conn->ctx.len == 0) return 0;
+	if (feed(&conn->ctx, "", 0) == PR_COMPLETE && conn->ctx.state >= PS_DONE) {
+		conn_respond(loop, conn, PR_COMPLETE);
 	}
+	return 1;
+}
 
-	send(client_fd, reply.buf, reply.len, 0);
-	parse_ctx_free(&ctx);
-	http_request_free(&req);
-	http_response_free(&reply);
+/* whether the client may still be sending a body no one read */
+static int body_unread(const struct conn *conn) {
+	if (conn->ctx.state == PS_ERROR || conn->req.te_chunked) return 1;
+	return conn->req.content_length > 0 &&
+		(size_t)conn->req.content_length > conn->ctx.len - conn->ctx.pos;
 }
 
-int main(void) {
-	int listener_fd, client_fd;
+/* read and drop what comes until the client is done, the connection
+   ending then */
+static void conn_draining(struct evloop *loop, struct conn *conn, unsigned events) {
+	char buf[16 << 10];
+	ssize_t n;
+
+	/* zerocopy completions of the response */
+	if (events & EPOLLERR) zc_poll(&zerocopy, &conn->zs);
+	while (1) {
+		n = recv(conn->src.fd, buf, sizeof buf, 0);
+		if (n > 0) continue;
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+		break;
+	}
+	conn_done(loop, conn);
+}
+
+/* the response is sent before the body it did not need: closing with the
+   body unread would reset the connection, losing the response on its way
+   to the client, so its side is drained for DRAIN_WAIT seconds at most */
+static void conn_drain(struct evloop *loop, struct conn *conn) {
+	shutdown(conn->src.fd, SHUT_WR);
+	conn->state = CS_DRAINING;
+	conn->deadline = time(NULL) + DRAIN_WAIT;
+	evloop_mod(loop, &conn->src, EPOLLIN);
+	conn_draining(loop, conn, 0);
+}
+
+/* move the request body up and the response down, each side being read
+   only while the other has room */
+static void conn_proxy(struct evloop *loop, struct conn *conn, unsigned events) {
+	struct proxy_call *call = conn->call;
+	enum outq_status status;
+	unsigned watch = 0;
+	ssize_t n;
+
+	if (conn->src.handle == NULL) return;
+	/* only a response from the cache may go with MSG_ZEROCOPY */
+	if (conn_failed(conn, events)) {
+		conn_abort(loop, conn);
+		return;
+	}
+	while ((events & EPOLLIN) && proxy_call_room(call) > 0) {
+		n = proxy_call_pull(call, conn->src.fd);
+		if (n > 0) continue;
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+		/* gone before the whole body */
+		conn_abort(loop, conn);
+		return;
+	}
+
+	if (call->state == PX_BROKEN) {
+		conn_abort(loop, conn);
+		return;
+	}
+	status = outq_flush(&conn->out, &zerocopy, &conn->zs);
+	if (status == OUTQ_ERROR) {
+		conn_abort(loop, conn);
+		return;
+	}
+	if (call->state == PX_DONE && status == OUTQ_DONE) {
+		conn_done(loop, conn);
+		return;
+	}
+	proxy_call_resume(call);
+
+	if (status == OUTQ_AGAIN) watch |= EPOLLOUT;
+	if (proxy_call_room(call) > 0) watch |= EPOLLIN;
+	if (watch != conn->events && evloop_mod(loop, &conn->src, watch) == 0) {
+		conn->events = watch;
+	}
+}
+
+/* the upstream queued something for the client, took some body or ended */
+static void proxy_notify(struct proxy_call *call) {
+	struct conn *conn = call->owner;
+
+	conn->deadline = time(NULL) + CONN_TIMEOUT;
+	if (conn->state == CS_PROXYING) conn_proxy(call->loop, conn, 0);
+}
+
+static void conn_event(struct evloop *loop, struct ev_source *src, unsigned events) {
+	struct conn *conn = (struct conn *)src;
+	enum outq_status status;
+	int ret;
+
+	if (conn->state == CS_DRAINING) {
+		conn_draining(loop, conn, events);
+		return;
+	}
+	if (conn->state == CS_RESOLVING) {
+		/* unwatched, woken by a hang up or by zerocopy completions */
+		if (conn_failed(conn, events)) {
+			conn_abort(loop, conn);
+		} else if (conn->zs.done == conn->zs.sent) {
+			outq_unpin(&conn->out);
+		}
+		return;
+	}
+	conn->deadline = time(NULL) + CONN_TIMEOUT;
+
+	if (conn->state == CS_REAPING) {
+		ret = zc_poll(&zerocopy, &conn->zs);
+		if (conn->zs.done == conn->zs.sent) {
+			outq_unpin(&conn->out);
+			evloop_retire(loop, src, conn_destroy);
+		} else if (ret == -1 || (ret == 0 && (events & EPOLLHUP))) {
+			/* hung up with nothing to report, it would wake us forever */
+			conn_abort(loop, conn);
+		}
+		return;
+	}
+
+	/* zerocopy completions of a response sent before this request */
+	if (conn->state == CS_READING && (events & EPOLLERR)) {
+		if (conn_failed(conn, events)) {
+			conn_abort(loop, conn);
+			return;
+		}
+		if (conn->zs.done == conn->zs.sent) outq_unpin(&conn->out);
+	}
+
+	/* requests a persistent connection pipelined are answered in turn */
+	do {
+		if (conn->state == CS_READING && conn_read(loop, conn) == -1) {
+			evloop_retire(loop, src, conn_destroy);
+			return;
+		}
+		if (src->handle == NULL) return;
+		if (conn->state == CS_PROXYING) {
+			conn_proxy(loop, conn, events);
+			return;
+		}
+		if (conn->state == CS_FOLLOWING) {
+			conn_following(loop, conn, events);
+			return;
+		}
+		if (conn->state == CS_TUNNELING) {
+			conn_tunneling(loop, conn, events);
+			return;
+		}
+		if (conn->state == CS_SCRIPTING) {
+			conn_scripting(loop, conn, events);
+			return;
+		}
+		if (conn->state == CS_MULTIPLEXING) {
+			conn_multiplexing(loop, conn, events);
+			return;
+		}
+		if (conn->state == CS_WEBSOCKET) {
+			conn_websocketing(loop, conn, events);
+			return;
+		}
+		if (conn->state != CS_WRITING) return;
+
+		/* a streamed body is produced a chunk ahead of the socket */
+		do {
+			if (stream_pump(&conn->body) == -1) {
+				/* a clean close would pass for the end of the body */
+				conn_abort(loop, conn);
+				return;
+			}
+			status = outq_flush(&conn->out, &zerocopy, &conn->zs);
+		} while (status == OUTQ_DONE && conn->body.active);
+		if (status == OUTQ_AGAIN) {
+			evloop_mod(loop, src, EPOLLOUT);
+			return;
+		}
+		if (status == OUTQ_ERROR) {
+			conn_abort(loop, conn);
+			return;
+		}
+		if (body_unread(conn)) {
+			conn_drain(loop, conn);
+			return;
+		}
+		if (!conn->persistent) {
+			conn_done(loop, conn);
+			return;
+		}
+		events = 0;
+	} while (conn_next(loop, conn));
+}
+
+/* the destination of the request is resolved, or not: it is answered as
+   if it just came */
+static void conn_resolved(struct resolver_query *q, const struct sockaddr *addr, socklen_t addr_len) {
+	struct conn *conn = q->owner;
+	struct evloop *loop = conn->loop;
+
+	if (addr == NULL || upstream_set_add(&destinations, q->name, addr, addr_len) == NULL) {
+		conn->unresolved = 1;
+	}
+	free(conn->lookup);
+	conn->lookup = NULL;
+	conn->state = CS_READING;
+	conn->deadline = time(NULL) + CONN_TIMEOUT;
+	if (evloop_mod(loop, &conn->src, EPOLLIN) == 0) conn->events = EPOLLIN;
+	conn_respond(loop, conn, PR_COMPLETE);
+	if (conn->src.handle != NULL) conn_event(loop, &conn->src, 0);
+}
+
+/* have `name` resolved for the request, the connection left unwatched
+   meanwhile; -1 if it cannot be looked up */
+static int conn_resolve(struct evloop *loop, struct conn *conn, const char *name) {
+	conn->lookup = malloc(sizeof *conn->lookup);
+	if (conn->lookup == NULL) {
+		perror("conn_resolve");
+		exit(1);
+	}
+	strcpy(conn->lookup->name, name);
+	conn->lookup->done = conn_resolved;
+	conn->lookup->owner = conn;
+	if (resolver_query(&resolver, conn->lookup) == -1) {
+		free(conn->lookup);
+		conn->lookup = NULL;
+		return -1;
+	}
+	conn->state = CS_RESOLVING;
+	if (evloop_mod(loop, &conn->src, 0) == 0) conn->events = 0;
+	return 0;
+}
+
+/* whether the last lookup for the request failed, told once */
+static int conn_unresolved(struct conn *conn) {
+	int unresolved = conn->unresolved;
+	conn->unresolved = 0;
+	return unresolved;
+}
+
+static void accept_clients(struct evloop *loop, struct ev_source *src, unsigned events) {
+	const struct listener *l = (const struct listener *)src;
 	struct sockaddr_storage client_addr;
-	struct sigaction sigact;
 	socklen_t sin_size;
 	char addrstr[INET6_ADDRSTRLEN];
-	pid_t fork_pid;
+	int client_fd, lowat = NOTSENT_LOWAT, yes = 1;
+	struct conn *conn;
 
-	listener_fd = bind_local_address();
+	(void)events;
+	while (1) {
+		sin_size = sizeof client_addr;
+		client_fd = accept4(src->fd, (void *)&client_addr, &sin_size,
+			SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (client_fd == -1) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+			return;
+		}
 
-	if (listener_fd == -1) {
-		fprintf(stderr, "server: failed to bind\n");
-		close(listener_fd);
-		return 1;
+		if (client_addr.ss_family == AF_UNIX) {
+			printf("server: received connection on %s\n", l->name);
+		} else {
+			inet_ntop(client_addr.ss_family,
+					get_sockaddr_in(&client_addr),
+					addrstr, sizeof addrstr);
+			printf("server: received connection from %s\n", addrstr);
+
+			/* keep unsent data in the queue rather than in kernel buffers, so
+			   that slow clients do not hold memory others could use */
+			setsockopt(client_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof lowat);
+			/* a head and a file body go out in two sends: on a persistent
+			   connection Nagle would hold the second until the client acks */
+			setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+		}
+
+		conn = malloc(sizeof *conn);
+		if (conn == NULL) {
+			perror("accept_clients");
+			exit(1);
+		}
+		conn->src.fd = client_fd;
+		conn->src.handle = conn_event;
+		conn->state = CS_READING;
+		conn->req = new_request();
+		conn->ctx = parse_ctx_init(&conn->req);
+		outq_init(&conn->out);
+		stream_init(&conn->body, &conn->out, &no_body);
+		zc_socket_init(&conn->zs, client_fd);
+		conn->call = NULL;
+		conn->follower = NULL;
+		conn->tunnel = NULL;
+		conn->script = NULL;
+		conn->h2 = NULL;
+		conn->ws = NULL;
+		conn->lookup = NULL;
+		conn->unresolved = 0;
+		conn->sniffed = 0;
+		conn->persistent = 0;
+		conn->may_forward = client_addr.ss_family == AF_UNIX ||
+			acl_match(&forward_clients, (void *)&client_addr);
+		conn->served = 0;
+		conn->loop = loop;
+		conn->events = EPOLLIN;
+		conn->deadline = time(NULL) + CONN_TIMEOUT;
+		conn->prev = NULL;
+		conn->next = conns;
+		if (conns != NULL) conns->prev = conn;
+		conns = conn;
+
+		if (evloop_add(loop, &conn->src, EPOLLIN) == -1) {
+			perror("epoll_ctl");
+			evloop_retire(loop, &conn->src, conn_destroy);
+		}
 	}
+}
+
+/* drop connections that made no progress for CONN_TIMEOUT seconds, or
+   waited IDLE_WAIT for their next request, as well as refreshes taking as long, and upstream ones idle for too long; let
+   requests waiting on another's response for FOLLOW_WAIT go alone; probe
+   backends, forget the destinations no longer used */
+static void expire_conns(struct evloop *loop, time_t now) {
+	struct conn *conn;
+	struct refresh *r;
+	struct upstream *up;
+	size_t i, j;
 
-	sigact.sa_handler = zombie_killer;
+	for (i = 0; i < num_proxies; ++i) {
+		for (j = 0; j < proxies[i].balancer.num_backends; ++j) {
+			up = proxies[i].balancer.backends + j;
+			upstream_expire(up, now);
+			upstream_check(up, loop, now);
+		}
+	}
+	for (i = 0; i < num_fastcgis; ++i) {
+		upstream_expire(&fastcgis[i].app, now);
+	}
+	upstream_set_expire(&destinations, now);
+
+	for (conn = conns; conn != NULL; conn = conn->next) {
+		if (conn->src.handle == NULL) continue;
+		if (conn->state == CS_FOLLOWING && conn->follower->state == FW_WAITING &&
+				conn->follower->since + FOLLOW_WAIT <= now) {
+			conn_go_alone(loop, conn);
+			continue;
+		}
+		if (conn->deadline > now) continue;
+		if (conn->state == CS_MULTIPLEXING && conn->h2->num_streams == 0 &&
+				conn->out.bytes == 0) {
+			/* idle, told why it is closed */
+			h2_conn_shutdown(conn->h2);
+			outq_flush(&conn->out, &zerocopy, &conn->zs);
+			evloop_retire(loop, &conn->src, conn_destroy);
+			continue;
+		}
+		if (conn->state == CS_READING && conn->served > 0 && conn->ctx.len == 0) {
+			/* idle between requests, a reset could lose one on its way */
+			evloop_retire(loop, &conn->src, conn_destroy);
+			continue;
+		}
+		if (conn->state == CS_WEBSOCKET && !conn->ws->closing && !conn->ws->pinged) {
+			/* idle rather than gone, as long as it answers */
+			conn->deadline = now + CONN_TIMEOUT;
+			ws_ping(conn->ws);
+			continue;
+		}
+		if (conn->state == CS_REAPING) zerocopy.stats.aborts++;
+		conn_abort(loop, conn);
+	}
+	for (r = refreshes; r != NULL; r = r->next) {
+		if (r->call.src.handle == NULL || r->deadline > now) continue;
+		evloop_retire(loop, &r->call.src, refresh_destroy);
+	}
+}
+
+/* serve connections as their sockets get ready, caches live as long as
+   the worker */
+static void worker_loop(void) {
+	struct sigaction sigact;
+	struct evloop loop;
+	time_t last_sweep = time(NULL), now;
+	size_t i;
+
+	sigact.sa_handler = SIG_IGN;
 	sigemptyset(&sigact.sa_mask);
-	sigact.sa_flags = SA_RESTART;
-	if (sigaction(SIGCHLD, &sigact, NULL) == -1) {
+	sigact.sa_flags = 0;
+	if (sigaction(SIGPIPE, &sigact, NULL) == -1) {
 		perror("sigaction");
-		close(listener_fd);
-		return 1;
+		exit(1);
 	}
 
-	while (1) {
-		sin_size = sizeof client_addr;
-		client_fd = accept(listener_fd,
-				(struct sockaddr*)&client_addr,
-				&sin_size);
+	canned_init(&entity_page, RC_200_OK, "", ENTITY);
+	canned_init(&not_found_page, RC_404_NOT_FOUND, "", NOT_FOUND);
+	for (i = 0; i < hosts.num_hosts; ++i) {
+		host_init(hosts.hosts + i);
+	}
+	pcache_init(&cache, cache_bytes > 0 ? PCACHE_DEFAULT_ENTRIES : 0, cache_bytes);
+	if (slab_dir != NULL && pcache_open_slab(&cache, slab_dir, slab_bytes) == -1) {
+		perror(slab_dir);
+		exit(1);
+	}
+	upstream_set_init(&destinations);
 
-		if (client_fd == -1) {
-			perror("accept");
-			continue;
+	/* every worker waits on the listeners, one of them is woken per client */
+	if (evloop_init(&loop) == -1) {
+		perror("epoll");
+		exit(1);
+	}
+	if (forwarding && resolver_start(&resolver, &loop) == -1) {
+		perror("resolver");
+		exit(1);
+	}
+	for (i = 0; i < num_listeners; ++i) {
+		listeners[i].src.handle = accept_clients;
+		if (evloop_add(&loop, &listeners[i].src, EPOLLIN | EPOLLEXCLUSIVE) == -1) {
+			perror("epoll");
+			exit(1);
+		}
+	}
+
+	while (1) {
+		if (evloop_run_once(&loop, 1000) == -1) {
+			perror("epoll_wait");
+			exit(1);
+		}
+		now = time(NULL);
+		if (now != last_sweep) {
+			expire_conns(&loop, now);
+			last_sweep = now;
 		}
+		fflush(stdout);
+	}
+}
+
+static pid_t spawn_worker(void) {
+	pid_t fork_pid = fork();
+
+	if (fork_pid == -1) {
+		perror("fork");
+		return -1;
+	}
+	if (!fork_pid) { /* child */
+		worker_loop();
+		exit(0);
+	}
+	return fork_pid;
+}
+
+/* 1 once `name` is one more address to listen on */
+static int add_listener(const char *name) {
+	listeners = realloc(listeners, (num_listeners + 1) * sizeof *listeners);
+	if (listeners == NULL) {
+		perror("realloc");
+		exit(1);
+	}
+	if (listener_init(listeners + num_listeners, name) == -1) {
+		fprintf(stderr, "server: bad listener %s\n", name);
+		return 0;
+	}
+	num_listeners++;
+	return 1;
+}
 
-		inet_ntop(client_addr.ss_family,
-				get_sockaddr_in((struct sockaddr*)&client_addr),
-				addrstr, sizeof addrstr);
-		printf("server: received connection from %s\n", addrstr);
+/* 1 once `port` is one more a CONNECT may go to */
+static int add_connect_port(const char *port) {
+	char *end;
+	long value = strtol(port, &end, 10);
 
-		fork_pid = fork();
+	if (end == port || *end != '\0' || value < 1 || value > 65535) return 0;
+	connect_ports = realloc(connect_ports, (num_connect_ports + 1) * sizeof *connect_ports);
+	if (connect_ports == NULL) {
+		perror("realloc");
+		exit(1);
+	}
+	connect_ports[num_connect_ports++] = (unsigned short)value;
+	return 1;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr,
+		"usage: %s [-r docroot] [-v host=docroot]... [-s status-path] [-w workers] [-z]\n"
+		"\t[-p pattern=host:port[,host:port]...[;least|p2c|hash-path|hash-host]]...\n"
+		"\t[-F pattern=unix:/path|host:port]... [-c cache-MiB] [-C slab-dir=MiB]\n"
+		"\t[-f [-A client-net]... [-P connect-port]... [-L]]\n"
+		"\t[-W pattern]... [-b max-body-MiB] [-l address]...\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+	long num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	long i;
+	int opt;
+	pid_t worker_pid;
+	const char *docroot = NULL;
+	char *sep;
+	struct origin origin;
+	struct router routes;
+	size_t h;
+
+	vhost_table_init(&hosts);
+	zerocopy_init(&zerocopy, 0);
+	while ((opt = getopt(argc, argv, "A:b:C:c:F:fLl:P:p:r:s:v:W:w:z")) != -1) {
+		switch (opt) {
+		case 'A':
+			if (acl_add(&forward_clients, optarg) == -1) {
+				fprintf(stderr, "server: bad client network %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'b':
+			if (strtol(optarg, NULL, 10) < 1) {
+				usage(argv[0]);
+				return 1;
+			}
+			max_body = (size_t)strtol(optarg, NULL, 10) << 20;
+			break;
+		case 'C':
+			sep = strchr(optarg, '=');
+			if (sep == NULL || strtol(sep + 1, NULL, 10) < 1) {
+				usage(argv[0]);
+				return 1;
+			}
+			*sep = '\0';
+			slab_dir = optarg;
+			slab_bytes = (size_t)strtol(sep + 1, NULL, 10) << 20;
+			if (cache_bytes == 0) cache_bytes = PCACHE_DEFAULT_BYTES;
+			break;
+		case 'c':
+			if (strtol(optarg, NULL, 10) < 1) {
+				usage(argv[0]);
+				return 1;
+			}
+			cache_bytes = (size_t)strtol(optarg, NULL, 10) << 20;
+			break;
+		case 'F':
+			sep = strchr(optarg, '=');
+			if (sep == NULL) {
+				usage(argv[0]);
+				return 1;
+			}
+			*sep = '\0';
+			fastcgis = realloc(fastcgis, (num_fastcgis + 1) * sizeof *fastcgis);
+			if (fastcgis == NULL) {
+				perror("realloc");
+				return 1;
+			}
+			fastcgis[num_fastcgis].handler.serve = serve_fastcgi;
+			fastcgis[num_fastcgis].pattern = optarg;
+			if (upstream_init(&fastcgis[num_fastcgis].app, sep + 1) == -1) {
+				fprintf(stderr, "server: bad fastcgi application %s\n", sep + 1);
+				return 1;
+			}
+			num_fastcgis++;
+			break;
+		case 'f':
+			forwarding = 1;
+			break;
+		case 'L':
+			forward_internal = 1;
+			break;
+		case 'l':
+			if (!add_listener(optarg)) return 1;
+			break;
+		case 'P':
+			if (!add_connect_port(optarg)) {
+				fprintf(stderr, "server: bad port %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'p':
+			sep = strchr(optarg, '=');
+			if (sep == NULL) {
+				usage(argv[0]);
+				return 1;
+			}
+			*sep = '\0';
+			proxies = realloc(proxies, (num_proxies + 1) * sizeof *proxies);
+			if (proxies == NULL) {
+				perror("realloc");
+				return 1;
+			}
+			proxies[num_proxies].handler.serve = serve_proxy;
+			proxies[num_proxies].pattern = optarg;
+			if (balancer_init(&proxies[num_proxies].balancer, sep + 1) == -1) {
+				fprintf(stderr, "server: bad upstreams %s\n", sep + 1);
+				return 1;
+			}
+			num_proxies++;
+			break;
+		case 'r':
+			docroot = optarg;
+			break;
+		case 's':
+			status_path = optarg;
+			break;
+		case 'v':
+			sep = strchr(optarg, '=');
+			if (sep == NULL) {
+				usage(argv[0]);
+				return 1;
+			}
+			*sep = '\0';
+			if (vhost_add(&hosts, optarg, sep + 1) == -1) {
+				fprintf(stderr, "server: bad or duplicate host %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'W':
+			websockets = realloc(websockets, (num_websockets + 1) * sizeof *websockets);
+			if (websockets == NULL) {
+				perror("realloc");
+				return 1;
+			}
+			websockets[num_websockets++] = optarg;
+			break;
+		case 'w':
+			num_workers = strtol(optarg, NULL, 10);
+			break;
+		case 'z':
+			zerocopy.enabled = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (num_workers < 1) num_workers = 1;
+	if (forward_clients.num == 0) {
+		acl_add(&forward_clients, "127.0.0.0/8");
+		acl_add(&forward_clients, "::1");
+	}
+	if (num_connect_ports == 0) add_connect_port("443");
+	vhost_add(&hosts, NULL, docroot);
+	vhost_table_build(&hosts);
 
-		if (fork_pid == -1) {
-			perror("fork");
-			close(listener_fd);
+	/* fail early rather than in every worker */
+	router_init(&routes);
+	if (add_common_routes(&routes) == -1) return 1;
+	router_free(&routes);
+	for (h = 0; h < hosts.num_hosts; ++h) {
+		const char *root = hosts.hosts[h].docroot;
+		if (root == NULL) continue;
+		if (origin_init(&origin, root) == -1) {
+			perror(root);
+			return 1;
+		}
+		origin_free(&origin);
+	}
+	if (slab_dir != NULL) {
+		pcache_init(&cache, 0, 0);
+		if (pcache_open_slab(&cache, slab_dir, slab_bytes) == -1) {
+			perror(slab_dir);
 			return 1;
 		}
+		pcache_free(&cache);
+	}
 
-		if (!fork_pid) { /* child */
-			/* child inherits a copy of parent's file descriptors */
-			/* sockfd is passive and isn't used by the child */
-			close(listener_fd);
+	if (num_listeners == 0 && !add_listener(LISTENER_DEFAULT)) return 1;
+	for (i = 0; i < (long)num_listeners; ++i) {
+		if (listener_open(listeners + i) == -1) {
+			perror(listeners[i].name);
+			fprintf(stderr, "server: failed to bind\n");
+			return 1;
+		}
+		printf("server: listening on %s...\n", listeners[i].name);
+	}
 
-			handle_client(client_fd);
-			close(client_fd);
+	/* workers are long-lived so their caches outlast a connection */
+	fflush(stdout);
+	for (i = 0; i < num_workers; ++i) {
+		if (spawn_worker() == -1) return 1;
+	}
 
-			return 0;
-		} /* parent */
-		close(client_fd);
+	while (1) {
+		worker_pid = wait(NULL);
+		if (worker_pid == -1) {
+			if (errno == EINTR) continue;
+			perror("wait");
+			break;
+		}
+		fprintf(stderr, "server: worker %ld exited, respawning\n",
+				(long)worker_pid);
+		spawn_worker();
 	}
-	return 0;
+	return 1;
 }
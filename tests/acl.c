@@ -0,0 +1,89 @@
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+#include "acl.h"
+#include "test.h"
+
+static struct sockaddr_storage addr;
+
+/* `text` as a socket address of whichever family it is in */
+static const struct sockaddr *sa(const char *text) {
+	struct sockaddr_in in;
+	struct sockaddr_in6 in6;
+
+	memset(&addr, 0, sizeof addr);
+	if (strchr(text, ':') == NULL) {
+		memset(&in, 0, sizeof in);
+		in.sin_family = AF_INET;
+		ASSERT_EQ_INT(inet_pton(AF_INET, text, &in.sin_addr), 1);
+		memcpy(&addr, &in, sizeof in);
+	} else {
+		memset(&in6, 0, sizeof in6);
+		in6.sin6_family = AF_INET6;
+		ASSERT_EQ_INT(inet_pton(AF_INET6, text, &in6.sin6_addr), 1);
+		memcpy(&addr, &in6, sizeof in6);
+	}
+	return (const void *)&addr;
+}
+
+static void test_acl_match(void) {
+	struct acl acl;
+	struct sockaddr_un un;
+
+	acl_init(&acl);
+	ASSERT_EQ_INT(acl_match(&acl, sa("10.1.2.3")), 0);
+	ASSERT_EQ_INT(acl_add(&acl, "10.0.0.0/8"), 0);
+	ASSERT_EQ_INT(acl_add(&acl, "192.168.1.7"), 0);
+	ASSERT_EQ_INT(acl_add(&acl, "fd00::/7"), 0);
+	ASSERT_EQ_INT(acl_add(&acl, "172.16.0.0/12"), 0);
+
+	ASSERT_EQ_INT(acl_match(&acl, sa("10.1.2.3")), 1);
+	ASSERT_EQ_INT(acl_match(&acl, sa("11.0.0.1")), 0);
+	ASSERT_EQ_INT(acl_match(&acl, sa("192.168.1.7")), 1);
+	ASSERT_EQ_INT(acl_match(&acl, sa("192.168.1.8")), 0);
+	ASSERT_EQ_INT(acl_match(&acl, sa("172.31.255.255")), 1);
+	ASSERT_EQ_INT(acl_match(&acl, sa("172.32.0.0")), 0);
+	ASSERT_EQ_INT(acl_match(&acl, sa("fdab::1")), 1);
+	ASSERT_EQ_INT(acl_match(&acl, sa("fe80::1")), 0);
+	/* an IPv4 client of a dual-stack socket */
+	ASSERT_EQ_INT(acl_match(&acl, sa("::ffff:10.9.9.9")), 1);
+
+	memset(&un, 0, sizeof un);
+	un.sun_family = AF_UNIX;
+	ASSERT_EQ_INT(acl_match(&acl, (const void *)&un), 0);
+
+	ASSERT_EQ_INT(acl_add(&acl, ""), -1);
+	ASSERT_EQ_INT(acl_add(&acl, "10.0.0.0/33"), -1);
+	ASSERT_EQ_INT(acl_add(&acl, "10.0.0.0/"), -1);
+	ASSERT_EQ_INT(acl_add(&acl, "10.0.0.0/8x"), -1);
+	ASSERT_EQ_INT(acl_add(&acl, "example.com"), -1);
+	ASSERT_EQ_INT(acl_add(&acl, "::/0"), 0);
+	ASSERT_EQ_INT(acl_match(&acl, sa("2001:db8::1")), 1);
+	acl_free(&acl);
+}
+
+static void test_acl_internal(void) {
+	ASSERT_EQ_INT(acl_internal(sa("127.0.0.1")), 1);
+	ASSERT_EQ_INT(acl_internal(sa("127.255.0.9")), 1);
+	ASSERT_EQ_INT(acl_internal(sa("0.0.0.0")), 1);
+	ASSERT_EQ_INT(acl_internal(sa("169.254.169.254")), 1);
+	ASSERT_EQ_INT(acl_internal(sa("::1")), 1);
+	ASSERT_EQ_INT(acl_internal(sa("::")), 1);
+	ASSERT_EQ_INT(acl_internal(sa("fe80::1")), 1);
+	ASSERT_EQ_INT(acl_internal(sa("febf::1")), 1);
+	ASSERT_EQ_INT(acl_internal(sa("::ffff:127.0.0.1")), 1);
+
+	ASSERT_EQ_INT(acl_internal(sa("93.184.216.34")), 0);
+	ASSERT_EQ_INT(acl_internal(sa("169.255.0.1")), 0);
+	ASSERT_EQ_INT(acl_internal(sa("::2")), 0);
+	ASSERT_EQ_INT(acl_internal(sa("fec0::1")), 0);
+	ASSERT_EQ_INT(acl_internal(sa("2001:db8::1")), 0);
+}
+
+void run_acl_tests(void) {
+	RUN_TEST(test_acl_match);
+	RUN_TEST(test_acl_internal);
+}
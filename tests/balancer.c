@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "balancer.h"
+#include "resolver.h"
+#include "test.h"
+
+#define THREE "127.0.0.1:9001,127.0.0.1:9002,127.0.0.1:9003"
+
+static void test_balancer_init(void) {
+	struct balancer b;
+
+	ASSERT_EQ_INT(balancer_init(&b, "127.0.0.1:9001"), 0);
+	ASSERT_EQ_INT(b.num_backends, 1);
+	ASSERT_EQ_INT(b.policy, LB_LEAST);
+	ASSERT_TRUE(b.ring == NULL);
+	balancer_free(&b);
+
+	ASSERT_EQ_INT(balancer_init(&b, THREE ";hash-host"), 0);
+	ASSERT_EQ_INT(b.num_backends, 3);
+	ASSERT_EQ_INT(b.policy, LB_HASH_HOST);
+	ASSERT_EQ_INT(b.ring_len, 3 * BALANCER_VNODES);
+	ASSERT_TRUE(!strcmp(b.backends[2].name, "127.0.0.1:9003"));
+	balancer_free(&b);
+
+	ASSERT_EQ_INT(balancer_init(&b, THREE ";fastest"), -1);
+	ASSERT_EQ_INT(balancer_init(&b, "127.0.0.1:9001,,127.0.0.1:9002"), -1);
+	ASSERT_EQ_INT(balancer_init(&b, "127.0.0.1:9001,"), -1);
+	ASSERT_EQ_INT(balancer_init(&b, ";p2c"), -1);
+}
+
+static void test_balancer_least(void) {
+	struct balancer b;
+	struct http_request req = new_request();
+	int seen[3] = {0, 0, 0};
+	size_t i;
+
+	ASSERT_EQ_INT(balancer_init(&b, THREE), 0);
+	b.backends[0].outstanding = 2;
+	b.backends[1].outstanding = 1;
+	b.backends[2].outstanding = 2;
+	ASSERT_TRUE(balancer_pick(&b, &req) == b.backends + 1);
+
+	/* ties take turns */
+	b.backends[1].outstanding = 2;
+	for (i = 0; i < 6; ++i) {
+		seen[balancer_pick(&b, &req) - b.backends]++;
+	}
+	ASSERT_EQ_INT(seen[0], 2);
+	ASSERT_EQ_INT(seen[1], 2);
+	ASSERT_EQ_INT(seen[2], 2);
+
+	/* an ejected backend is passed over however idle */
+	b.backends[0].outstanding = 0;
+	b.backends[0].down = 1;
+	for (i = 0; i < 6; ++i) {
+		ASSERT_TRUE(balancer_pick(&b, &req) != b.backends);
+	}
+	balancer_free(&b);
+	http_request_free(&req);
+}
+
+static void test_balancer_p2c(void) {
+	struct balancer b;
+	struct http_request req = new_request();
+	int seen[3] = {0, 0, 0};
+	size_t i;
+
+	ASSERT_EQ_INT(balancer_init(&b, THREE ";p2c"), 0);
+	/* the busiest one never wins a draw */
+	b.backends[2].outstanding = 10;
+	for (i = 0; i < 300; ++i) {
+		seen[balancer_pick(&b, &req) - b.backends]++;
+	}
+	ASSERT_EQ_INT(seen[2], 0);
+	ASSERT_TRUE(seen[0] > 50 && seen[1] > 50);
+
+	b.backends[0].down = 1;
+	b.backends[1].down = 1;
+	for (i = 0; i < 20; ++i) {
+		ASSERT_TRUE(balancer_pick(&b, &req) == b.backends + 2);
+	}
+	balancer_free(&b);
+	http_request_free(&req);
+}
+
+static void test_balancer_hash(void) {
+	struct balancer b;
+	struct http_request req = new_request();
+	struct upstream *before[600];
+	int seen[3] = {0, 0, 0};
+	char path[32];
+	size_t i;
+
+	ASSERT_EQ_INT(balancer_init(&b, THREE ";hash-path"), 0);
+	for (i = 0; i < 600; ++i) {
+		sprintf(path, "/img/%lu.png", (unsigned long)i);
+		req.path = get_slice(path, strlen(path));
+		before[i] = balancer_pick(&b, &req);
+		seen[before[i] - b.backends]++;
+		ASSERT_TRUE(balancer_pick(&b, &req) == before[i]);
+	}
+	ASSERT_TRUE(seen[0] > 100 && seen[1] > 100 && seen[2] > 100);
+
+	/* only the keys of an ejected backend move */
+	b.backends[1].down = 1;
+	for (i = 0; i < 600; ++i) {
+		sprintf(path, "/img/%lu.png", (unsigned long)i);
+		req.path = get_slice(path, strlen(path));
+		if (before[i] == b.backends + 1) {
+			ASSERT_TRUE(balancer_pick(&b, &req) != b.backends + 1);
+		} else {
+			ASSERT_TRUE(balancer_pick(&b, &req) == before[i]);
+		}
+	}
+	balancer_free(&b);
+
+	/* hosts are compared without case */
+	ASSERT_EQ_INT(balancer_init(&b, THREE ";hash-host"), 0);
+	req.host = get_slice("Example.COM", 11);
+	before[0] = balancer_pick(&b, &req);
+	req.host = get_slice("example.com", 11);
+	ASSERT_TRUE(balancer_pick(&b, &req) == before[0]);
+	balancer_free(&b);
+	http_request_free(&req);
+}
+
+static void test_balancer_ejection(void) {
+	struct balancer b;
+	struct upstream *up;
+
+	ASSERT_EQ_INT(balancer_init(&b, THREE), 0);
+	up = b.backends;
+	upstream_failed(up, 100);
+	upstream_failed(up, 100);
+	ASSERT_EQ_INT(up->down, 0);
+	upstream_succeeded(up);
+	upstream_failed(up, 100);
+	upstream_failed(up, 100);
+	ASSERT_EQ_INT(up->down, 0);
+	upstream_failed(up, 100);
+	ASSERT_EQ_INT(up->down, 1);
+	ASSERT_EQ_INT(up->retry_at, 100 + UPSTREAM_EJECT);
+	ASSERT_EQ_INT(up->stats.ejections, 1);
+
+	/* every backend down: requests still go somewhere */
+	b.backends[1].down = 1;
+	b.backends[2].down = 1;
+	ASSERT_TRUE(balancer_pick(&b, NULL) != NULL);
+	balancer_free(&b);
+}
+
+static void test_balancer_probe(void) {
+	struct balancer b;
+	struct evloop loop;
+	struct sockaddr_in addr;
+	socklen_t len = sizeof addr;
+	struct upstream *up;
+	char spec[64];
+	int listener, rounds;
+	time_t now = time(NULL);
+
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_EQ_INT(bind(listener, (void *)&addr, sizeof addr), 0);
+	ASSERT_EQ_INT(listen(listener, 8), 0);
+	ASSERT_EQ_INT(getsockname(listener, (void *)&addr, &len), 0);
+	sprintf(spec, "127.0.0.1:%u", (unsigned)ntohs(addr.sin_port));
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	ASSERT_EQ_INT(balancer_init(&b, spec), 0);
+	up = b.backends;
+
+	/* an ejected backend that accepts again is back */
+	up->down = 1;
+	up->retry_at = now + 1;
+	upstream_check(up, &loop, now);
+	ASSERT_EQ_INT(up->probe.src.fd, -1);
+	upstream_check(up, &loop, now + 1);
+	ASSERT_TRUE(up->probe.src.fd != -1);
+	for (rounds = 0; up->probe.src.fd != -1 && rounds < 50; ++rounds) {
+		ASSERT_TRUE(evloop_run_once(&loop, 10) >= 0);
+	}
+	ASSERT_EQ_INT(up->down, 0);
+	ASSERT_EQ_INT(up->stats.connects, 0);
+
+	/* one that stopped listening is ejected at once */
+	close(listener);
+	upstream_check(up, &loop, now + 2);
+	for (rounds = 0; up->probe.src.fd != -1 && rounds < 50; ++rounds) {
+		ASSERT_TRUE(evloop_run_once(&loop, 10) >= 0);
+	}
+	ASSERT_EQ_INT(up->down, 1);
+	ASSERT_TRUE(up->retry_at >= now + UPSTREAM_EJECT);
+
+	balancer_free(&b);
+	evloop_free(&loop);
+}
+
+/* what a forward proxy does with a name once it is resolved */
+static struct upstream *set_get(struct upstream_set *set, const char *name) {
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+
+	if (resolve_name(name, 1, &addr, &addr_len) == -1) return NULL;
+	return upstream_set_add(set, name, (void *)&addr, addr_len);
+}
+
+/* upstreams met by a forward proxy are kept while in use */
+static void test_upstream_set(void) {
+	struct upstream_set set;
+	struct upstream *a, *b;
+	char name[32];
+	size_t i;
+
+	upstream_set_init(&set);
+	a = set_get(&set, "127.0.0.1:9001");
+	ASSERT_TRUE(a != NULL);
+	ASSERT_TRUE(set_get(&set, "127.0.0.1:9001") == a);
+	b = set_get(&set, "[::1]:9001");
+	ASSERT_TRUE(b != NULL && b != a);
+	ASSERT_TRUE(set_get(&set, "127.0.0.1") == NULL);
+	ASSERT_EQ_INT(set.num, 2);
+	ASSERT_TRUE(upstream_set_find(&set, "[::1]:9001") == b);
+	ASSERT_TRUE(upstream_set_find(&set, "[::1]:9002") == NULL);
+
+	a->outstanding++;
+	upstream_set_expire(&set, time(NULL));
+	ASSERT_EQ_INT(set.num, 1);
+	ASSERT_TRUE(set.ups[0] == a);
+
+	/* full, an unused one makes room */
+	for (i = 1; i < UPSTREAM_SET_MAX; ++i) {
+		sprintf(name, "127.0.0.1:%lu", (unsigned long)(10000 + i));
+		ASSERT_TRUE(set_get(&set, name) != NULL);
+	}
+	ASSERT_EQ_INT(set.num, UPSTREAM_SET_MAX);
+	ASSERT_TRUE(set_get(&set, "127.0.0.2:80") != NULL);
+	ASSERT_EQ_INT(set.num, UPSTREAM_SET_MAX);
+	ASSERT_TRUE(set_get(&set, "127.0.0.1:9001") == a);
+	for (i = 0; i < set.num; ++i) set.ups[i]->outstanding = 1;
+	ASSERT_TRUE(set_get(&set, "127.0.0.3:80") == NULL);
+	for (i = 0; i < set.num; ++i) set.ups[i]->outstanding = 0;
+	upstream_set_free(&set);
+}
+
+void run_balancer_tests(void) {
+	RUN_TEST(test_balancer_init);
+	RUN_TEST(test_balancer_least);
+	RUN_TEST(test_balancer_p2c);
+	RUN_TEST(test_balancer_hash);
+	RUN_TEST(test_balancer_ejection);
+	RUN_TEST(test_balancer_probe);
+	RUN_TEST(test_upstream_set);
+}
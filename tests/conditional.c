@@ -0,0 +1,92 @@
+#include "test.h"
+#include "conditional.h"
+
+#define TAG "\"1f-2a-5f5e1000\""
+#define LAST_MODIFIED "Sun, 06 Nov 1994 08:49:37 GMT"
+#define MTIME 784111777
+
+static int list_matches(const char *list, int weak) {
+	struct slice value = get_slice(list, strlen(list));
+	return etag_list_matches(&value, TAG, strlen(TAG), weak);
+}
+
+static int not_modified(const char *raw_req) {
+	struct http_request req;
+	struct parse_ctx ctx;
+	int ret;
+
+	ASSERT_TRUE(parse_ok(raw_req, &req, &ctx) == 0);
+	ret = is_not_modified(&req, TAG, strlen(TAG), MTIME);
+	END_TEST(ctx, req);
+	return ret;
+}
+
+static int range_holds(const char *raw_req, time_t now) {
+	struct http_request req;
+	struct parse_ctx ctx;
+	int ret;
+
+	ASSERT_TRUE(parse_ok(raw_req, &req, &ctx) == 0);
+	ret = if_range_holds(&req, TAG, strlen(TAG), MTIME, now);
+	END_TEST(ctx, req);
+	return ret;
+}
+
+static void test_etag_list(void) {
+	ASSERT_EQ_INT(list_matches(TAG, 0), 1);
+	ASSERT_EQ_INT(list_matches("*", 0), 1);
+	ASSERT_EQ_INT(list_matches("\"a\", " TAG, 0), 1);
+	ASSERT_EQ_INT(list_matches("\"a\",,\"b,c\"", 0), 0);
+	ASSERT_EQ_INT(list_matches("W/" TAG, 1), 1);
+	ASSERT_EQ_INT(list_matches("W/" TAG, 0), 0);
+	ASSERT_EQ_INT(list_matches("1f-2a-5f5e1000", 1), -1);
+	ASSERT_EQ_INT(list_matches("\"a\" \"b\"", 1), -1);
+	ASSERT_EQ_INT(list_matches("\"a", 1), -1);
+	ASSERT_EQ_INT(list_matches("", 1), -1);
+}
+
+static void test_not_modified(void) {
+	ASSERT_TRUE(!not_modified(RL11("GET", "/") HOST("ex.com") END));
+	ASSERT_TRUE(not_modified(RL11("GET", "/") HOST("ex.com")
+		H("If-None-Match", "\"x\"") H("If-None-Match", "W/" TAG) END));
+	ASSERT_TRUE(not_modified(RL11("HEAD", "/") HOST("ex.com")
+		H("If-None-Match", "*") END));
+	ASSERT_TRUE(!not_modified(RL11("POST", "/") HOST("ex.com")
+		H("If-None-Match", "*") H("Content-Length", "0") END));
+
+	ASSERT_TRUE(not_modified(RL11("GET", "/") HOST("ex.com")
+		H("If-Modified-Since", LAST_MODIFIED) END));
+	ASSERT_TRUE(not_modified(RL11("GET", "/") HOST("ex.com")
+		H("If-Modified-Since", "Sun, 06 Nov 1994 08:49:38 GMT") END));
+	ASSERT_TRUE(!not_modified(RL11("GET", "/") HOST("ex.com")
+		H("If-Modified-Since", "Sun, 06 Nov 1994 08:49:36 GMT") END));
+	ASSERT_TRUE(!not_modified(RL11("GET", "/") HOST("ex.com")
+		H("If-Modified-Since", "Sunday, 06-Nov-94 08:49:37 GMT") END));
+
+	/* If-None-Match takes precedence over If-Modified-Since */
+	ASSERT_TRUE(!not_modified(RL11("GET", "/") HOST("ex.com")
+		H("If-None-Match", "\"x\"") H("If-Modified-Since", LAST_MODIFIED) END));
+}
+
+static void test_if_range(void) {
+	time_t later = MTIME + 60;
+
+	ASSERT_TRUE(range_holds(RL11("GET", "/") HOST("ex.com") END, later));
+	ASSERT_TRUE(range_holds(RL11("GET", "/") HOST("ex.com")
+		H("If-Range", TAG) END, later));
+	ASSERT_TRUE(!range_holds(RL11("GET", "/") HOST("ex.com")
+		H("If-Range", "W/" TAG) END, later));
+	ASSERT_TRUE(range_holds(RL11("GET", "/") HOST("ex.com")
+		H("If-Range", LAST_MODIFIED) END, later));
+	/* a date within the same second as the change is only weak */
+	ASSERT_TRUE(!range_holds(RL11("GET", "/") HOST("ex.com")
+		H("If-Range", LAST_MODIFIED) END, MTIME));
+	ASSERT_TRUE(!range_holds(RL11("GET", "/") HOST("ex.com")
+		H("If-Range", "Sun, 06 Nov 1994 08:49:38 GMT") END, later));
+}
+
+void run_conditional_tests(void) {
+	RUN_TEST(test_etag_list);
+	RUN_TEST(test_not_modified);
+	RUN_TEST(test_if_range);
+}
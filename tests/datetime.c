@@ -0,0 +1,48 @@
+#include "test.h"
+#include "datetime.h"
+
+static time_t parse(const char *raw) {
+	time_t t = (time_t)-1;
+	ASSERT_EQ_INT(parse_http_date(raw, strlen(raw), &t), 0);
+	return t;
+}
+
+static void assert_invalid(const char *raw) {
+	time_t t;
+	ASSERT_EQ_INT(parse_http_date(raw, strlen(raw), &t), -1);
+}
+
+static void assert_format(time_t t, const char *expect) {
+	char buf[HTTP_DATE_LEN + 1];
+	format_http_date(t, buf);
+	ASSERT_EQ_MEM(buf, strlen(buf), expect, strlen(expect));
+}
+
+static void test_http_date_format(void) {
+	assert_format(0, "Thu, 01 Jan 1970 00:00:00 GMT");
+	assert_format(784111777, "Sun, 06 Nov 1994 08:49:37 GMT");
+	assert_format(951782400, "Tue, 29 Feb 2000 00:00:00 GMT");
+	assert_format(2147483647, "Tue, 19 Jan 2038 03:14:07 GMT");
+}
+
+static void test_http_date_parse(void) {
+	ASSERT_TRUE(parse("Thu, 01 Jan 1970 00:00:00 GMT") == 0);
+	ASSERT_TRUE(parse("Sun, 06 Nov 1994 08:49:37 GMT") == 784111777);
+	ASSERT_TRUE(parse("Tue, 29 Feb 2000 00:00:00 GMT") == 951782400);
+	ASSERT_TRUE(parse("Wed, 31 Dec 2025 23:59:59 GMT") == 1767225599);
+
+	/* obsolete forms are not accepted */
+	assert_invalid("Sunday, 06-Nov-94 08:49:37 GMT");
+	assert_invalid("Sun Nov  6 08:49:37 1994");
+	assert_invalid("Sun, 06 Nov 1994 08:49:37 UTC");
+	assert_invalid("Sun, 06 Foo 1994 08:49:37 GMT");
+	assert_invalid("Sun, 32 Nov 1994 08:49:37 GMT");
+	assert_invalid("Sun, 06 Nov 1994 24:49:37 GMT");
+	assert_invalid("Sun, 6 Nov 1994 08:49:37 GMT");
+	assert_invalid("");
+}
+
+void run_datetime_tests(void) {
+	RUN_TEST(test_http_date_format);
+	RUN_TEST(test_http_date_parse);
+}
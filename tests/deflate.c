@@ -0,0 +1,279 @@
+#include "test.h"
+#include "deflate.h"
+
+/* minimal inflater (RFC 1951), enough to check what the encoder emits */
+
+struct bits {
+	const unsigned char *in;
+	size_t len, pos;
+	unsigned buf, cnt;
+	unsigned char *out;
+	size_t out_len, out_cap;
+};
+
+struct huff {
+	short count[16];
+	short symbol[288];
+};
+
+static int need(struct bits *s, unsigned n) {
+	unsigned val = s->buf;
+	while (s->cnt < n) {
+		ASSERT_TRUE(s->pos < s->len);
+		val |= (unsigned)s->in[s->pos++] << s->cnt;
+		s->cnt += 8;
+	}
+	s->buf = val >> n;
+	s->cnt -= n;
+	return (int)(val & ((1u << n) - 1));
+}
+
+static void build(struct huff *h, const short *lengths, int n) {
+	short offs[16];
+	int len, sym, left = 1;
+
+	memset(h->count, 0, sizeof h->count);
+	for (sym = 0; sym < n; ++sym) h->count[lengths[sym]]++;
+	for (len = 1; len < 16; ++len) {
+		left = left * 2 - h->count[len];
+		ASSERT_TRUE(left >= 0); /* over-subscribed */
+	}
+	offs[1] = 0;
+	for (len = 1; len < 15; ++len) offs[len + 1] = (short)(offs[len] + h->count[len]);
+	for (sym = 0; sym < n; ++sym) {
+		if (lengths[sym] != 0) h->symbol[offs[lengths[sym]]++] = (short)sym;
+	}
+}
+
+static int decode(struct bits *s, const struct huff *h) {
+	int code = 0, first = 0, index = 0, len, count;
+	for (len = 1; len < 16; ++len) {
+		code |= need(s, 1);
+		count = h->count[len];
+		if (code - count < first) return h->symbol[index + (code - first)];
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	ASSERT_TRUE(0);
+	return -1;
+}
+
+static void put(struct bits *s, unsigned char byte) {
+	if (s->out_len == s->out_cap) {
+		s->out_cap = s->out_cap ? s->out_cap * 2 : 1024;
+		s->out = realloc(s->out, s->out_cap);
+		ASSERT_TRUE(s->out != NULL);
+	}
+	s->out[s->out_len++] = byte;
+}
+
+static const short len_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17,
+	19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const short len_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2,
+	2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const short dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49,
+	65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577};
+static const short dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5,
+	6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static void codes(struct bits *s, const struct huff *lit, const struct huff *dist) {
+	int sym, len;
+	size_t d;
+
+	while ((sym = decode(s, lit)) != 256) {
+		if (sym < 256) {
+			put(s, (unsigned char)sym);
+			continue;
+		}
+		sym -= 257;
+		ASSERT_TRUE(sym < 29);
+		len = len_base[sym] + need(s, (unsigned)len_extra[sym]);
+		sym = decode(s, dist);
+		ASSERT_TRUE(sym < 30);
+		d = (size_t)(dist_base[sym] + need(s, (unsigned)dist_extra[sym]));
+		ASSERT_TRUE(d <= s->out_len);
+		while (len-- > 0) put(s, s->out[s->out_len - d]);
+	}
+}
+
+static void dynamic(struct bits *s) {
+	static const short order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4,
+		12, 3, 13, 2, 14, 1, 15};
+	short lengths[320];
+	struct huff lencode, lit, dist;
+	int nlen = need(s, 5) + 257;
+	int ndist = need(s, 5) + 1;
+	int ncode = need(s, 4) + 4;
+	int index, sym, len, rep;
+
+	memset(lengths, 0, sizeof lengths);
+	for (index = 0; index < ncode; ++index) {
+		lengths[order[index]] = (short)need(s, 3);
+	}
+	build(&lencode, lengths, 19);
+
+	for (index = 0; index < nlen + ndist;) {
+		sym = decode(s, &lencode);
+		if (sym < 16) {
+			lengths[index++] = (short)sym;
+			continue;
+		}
+		len = 0;
+		if (sym == 16) {
+			ASSERT_TRUE(index > 0);
+			len = lengths[index - 1];
+			rep = 3 + need(s, 2);
+		} else if (sym == 17) {
+			rep = 3 + need(s, 3);
+		} else {
+			rep = 11 + need(s, 7);
+		}
+		ASSERT_TRUE(index + rep <= nlen + ndist);
+		while (rep-- > 0) lengths[index++] = (short)len;
+	}
+	ASSERT_TRUE(lengths[256] != 0);
+	build(&lit, lengths, nlen);
+	build(&dist, lengths + nlen, ndist);
+	codes(s, &lit, &dist);
+}
+
+static void fixed(struct bits *s) {
+	short lengths[320];
+	struct huff lit, dist;
+	int sym;
+
+	for (sym = 0; sym < 144; ++sym) lengths[sym] = 8;
+	for (; sym < 256; ++sym) lengths[sym] = 9;
+	for (; sym < 280; ++sym) lengths[sym] = 7;
+	for (; sym < 288; ++sym) lengths[sym] = 8;
+	build(&lit, lengths, 288);
+	for (sym = 0; sym < 30; ++sym) lengths[sym] = 5;
+	build(&dist, lengths, 30);
+	codes(s, &lit, &dist);
+}
+
+static void stored(struct bits *s) {
+	unsigned len;
+	s->buf = 0;
+	s->cnt = 0;
+	ASSERT_TRUE(s->pos + 4 <= s->len);
+	len = s->in[s->pos] | (unsigned)s->in[s->pos + 1] << 8;
+	ASSERT_EQ_INT(len ^ 0xFFFF,
+		s->in[s->pos + 2] | (unsigned)s->in[s->pos + 3] << 8);
+	s->pos += 4;
+	ASSERT_TRUE(s->pos + len <= s->len);
+	while (len-- > 0) put(s, s->in[s->pos++]);
+}
+
+/* inflate a gzip member, checking its trailer; return the malloc'd output */
+static unsigned char *gunzip(const unsigned char *in, size_t len, size_t *out_len) {
+	struct bits s;
+	int last, type;
+	uint32_t crc, isize;
+
+	ASSERT_TRUE(len >= 18);
+	ASSERT_TRUE(in[0] == 0x1f && in[1] == 0x8b && in[2] == 8 && in[3] == 0);
+
+	memset(&s, 0, sizeof s);
+	s.in = in;
+	s.len = len - 8;
+	s.pos = 10;
+	do {
+		last = need(&s, 1);
+		type = need(&s, 2);
+		if (type == 0) stored(&s);
+		else if (type == 1) fixed(&s);
+		else if (type == 2) dynamic(&s);
+		else ASSERT_TRUE(0);
+	} while (!last);
+	ASSERT_EQ_INT(s.pos, s.len);
+
+	crc = in[len - 8] | (uint32_t)in[len - 7] << 8 |
+		(uint32_t)in[len - 6] << 16 | (uint32_t)in[len - 5] << 24;
+	isize = in[len - 4] | (uint32_t)in[len - 3] << 8 |
+		(uint32_t)in[len - 2] << 16 | (uint32_t)in[len - 1] << 24;
+	ASSERT_TRUE(crc == crc32_update(0, s.out, s.out_len));
+	ASSERT_TRUE(isize == (uint32_t)s.out_len);
+
+	*out_len = s.out_len;
+	return s.out;
+}
+
+static void round_trip(const unsigned char *data, size_t len, int level) {
+	unsigned char *packed = NULL, *plain;
+	size_t packed_len = 0, plain_len;
+
+	gzip_compress(data, len, level, &packed, &packed_len);
+	plain = gunzip(packed, packed_len, &plain_len);
+	ASSERT_EQ_MEM(plain, plain_len, data, len);
+	free(plain);
+	free(packed);
+}
+
+static void test_crc32(void) {
+	const char *check = "123456789";
+	ASSERT_TRUE(crc32_update(0, (const unsigned char *)check, 9) == 0xCBF43926u);
+	/* incremental updates match one pass */
+	ASSERT_TRUE(crc32_update(crc32_update(0, (const unsigned char *)check, 4),
+		(const unsigned char *)check + 4, 5) == 0xCBF43926u);
+	ASSERT_TRUE(crc32_update(0, NULL, 0) == 0);
+}
+
+static void test_deflate_round_trip(void) {
+	static const char *words[] = {"<div class=\"row\">", "</div>", "aster",
+		"static", "server", " ", "\n", "content-length", "0123456789"};
+	size_t text_len = 200000, random_len = 70000, pos;
+	unsigned char *text = malloc(text_len);
+	unsigned char *random = malloc(random_len);
+	uint32_t state = 12345;
+	int level;
+
+	ASSERT_TRUE(text != NULL && random != NULL);
+	/* words picked by an LCG: matches at many distances plus literals */
+	for (pos = 0; pos < text_len;) {
+		const char *word;
+		state = state * 1103515245u + 12345u;
+		word = words[(state >> 16) % (sizeof words / sizeof words[0])];
+		while (*word && pos < text_len) text[pos++] = (unsigned char)*word++;
+	}
+	for (pos = 0; pos < random_len; ++pos) {
+		state = state * 1103515245u + 12345u;
+		random[pos] = (unsigned char)(state >> 24);
+	}
+
+	for (level = DEFLATE_MIN_LEVEL; level <= DEFLATE_MAX_LEVEL; ++level) {
+		round_trip(text, text_len, level);
+		round_trip(random, random_len, level);
+		round_trip(text, 1, level);
+		round_trip(text, 0, level);
+	}
+
+	/* a single repeated byte, matches overlapping their own output */
+	memset(text, 'a', text_len);
+	round_trip(text, text_len, DEFLATE_DEFAULT_LEVEL);
+
+	free(text);
+	free(random);
+}
+
+static void test_deflate_ratio(void) {
+	size_t len = 64 * 1024, packed_len = 0;
+	unsigned char *data = malloc(len);
+	unsigned char *packed = NULL;
+	size_t pos;
+
+	ASSERT_TRUE(data != NULL);
+	for (pos = 0; pos < len; ++pos) data[pos] = (unsigned char)"abcdefgh"[pos % 8];
+	gzip_compress(data, len, DEFLATE_DEFAULT_LEVEL, &packed, &packed_len);
+	ASSERT_TRUE(packed_len < len / 100);
+	free(packed);
+	free(data);
+}
+
+void run_deflate_tests(void) {
+	RUN_TEST(test_crc32);
+	RUN_TEST(test_deflate_round_trip);
+	RUN_TEST(test_deflate_ratio);
+}
@@ -0,0 +1,114 @@
+#include "embedded.h"
+#include "str.h"
+#include "test.h"
+
+#define HELLO "hello, embedded"
+#define HEAD_ID "Content-Type: text/plain" CRLF "ETag: \"e1\"" CRLF
+#define HEAD "Content-Length: 15" CRLF
+
+static const struct embedded_file files[] = {
+	{"a.txt", 5, 1000, "Thu, 01 Jan 1970 00:16:40 GMT",
+		{(const unsigned char *)HELLO, 15, "\"e1\"", HEAD_ID HEAD,
+			sizeof HEAD_ID HEAD - 1, sizeof HEAD_ID - 1},
+		{NULL, 0, NULL, NULL, 0, 0}},
+	{"dir", 3, 1000, "Thu, 01 Jan 1970 00:16:40 GMT",
+		{(const unsigned char *)HELLO, 15, "\"e1\"", HEAD_ID HEAD,
+			sizeof HEAD_ID HEAD - 1, sizeof HEAD_ID - 1},
+		{NULL, 0, NULL, NULL, 0, 0}}
+};
+
+static size_t slots[8];
+
+/* lay the two keys out the way tools/embed.c does */
+static struct embedded_table make_table(void) {
+	struct embedded_table table;
+	uint32_t seed;
+	size_t a, b;
+
+	for (seed = HASH_SEED;; ++seed) {
+		a = hash_bytes("a.txt", 5, seed) & 7;
+		b = hash_bytes("dir", 3, seed) & 7;
+		if (a != b) break;
+	}
+	memset(slots, 0, sizeof slots);
+	slots[a] = 1;
+	slots[b] = 2;
+	table.files = files;
+	table.num_files = 2;
+	table.slots = slots;
+	table.num_slots = 8;
+	table.seed = seed;
+	return table;
+}
+
+static void serve(const struct embedded_table *table, const char *raw, struct http_response *resp) {
+	struct http_request req;
+	struct parse_ctx ctx;
+
+	ASSERT_EQ_INT(parse_ok(raw, &req, &ctx), 0);
+	*resp = new_response();
+	embedded_serve(table, &req, resp, "Thu, 01 Jan 1970 00:00:00 GMT");
+	END_TEST(ctx, req);
+}
+
+static int has(const struct http_response *resp, const char *str) {
+	size_t len = resp->num_parts ? resp->head_len : resp->len, n = strlen(str), i;
+	for (i = 0; i + n <= len; ++i) {
+		if (!memcmp(resp->buf + i, str, n)) return 1;
+	}
+	return 0;
+}
+
+static void test_embedded_lookup(void) {
+	struct embedded_table table = make_table();
+	struct embedded_table empty = {NULL, 0, NULL, 0, HASH_SEED};
+
+	ASSERT_TRUE(embedded_lookup(&table, "a.txt", 5) == files);
+	ASSERT_TRUE(embedded_lookup(&table, "dir", 3) == files + 1);
+	ASSERT_TRUE(embedded_lookup(&table, "a.tx", 4) == NULL);
+	ASSERT_TRUE(embedded_lookup(&table, "", 0) == NULL);
+	ASSERT_TRUE(embedded_lookup(&empty, "a.txt", 5) == NULL);
+}
+
+static void test_embedded_serve(void) {
+	struct embedded_table table = make_table();
+	struct http_response resp;
+
+	serve(&table, RL11("GET", "/dir/./") HOST("a") END, &resp);
+	ASSERT_TRUE(has(&resp, "200 OK"));
+	ASSERT_TRUE(has(&resp, HEAD_ID HEAD));
+	ASSERT_EQ_INT(resp.num_parts, 1);
+	ASSERT_TRUE(resp.body_mem == (const unsigned char *)HELLO);
+	ASSERT_EQ_INT(resp.parts[0].len, 15);
+	http_response_free(&resp);
+
+	serve(&table, RL11("HEAD", "/a.txt") HOST("a") END, &resp);
+	ASSERT_TRUE(has(&resp, "Content-Length: 15"));
+	ASSERT_EQ_INT(resp.num_parts, 0);
+	http_response_free(&resp);
+
+	serve(&table, RL11("GET", "/a.txt") HOST("a") H("If-None-Match", "\"e1\"") END, &resp);
+	ASSERT_TRUE(has(&resp, "304 Not Modified"));
+	ASSERT_EQ_INT(resp.num_parts, 0);
+	http_response_free(&resp);
+
+	serve(&table, RL11("GET", "/a.txt") HOST("a") H("Range", "bytes=7-") END, &resp);
+	ASSERT_TRUE(has(&resp, "206 Partial Content"));
+	ASSERT_TRUE(has(&resp, "Content-Range: bytes 7-14/15" CRLF "Content-Length: 8"));
+	ASSERT_EQ_INT(resp.parts[0].off, 7);
+	ASSERT_EQ_INT(resp.parts[0].len, 8);
+	http_response_free(&resp);
+
+	serve(&table, RL11("GET", "/a.txt") HOST("a") H("Range", "bytes=20-") END, &resp);
+	ASSERT_TRUE(has(&resp, "416"));
+	http_response_free(&resp);
+
+	serve(&table, RL11("GET", "/b.txt") HOST("a") END, &resp);
+	ASSERT_TRUE(has(&resp, "404 Not Found"));
+	http_response_free(&resp);
+}
+
+void run_embedded_tests(void) {
+	RUN_TEST(test_embedded_lookup);
+	RUN_TEST(test_embedded_serve);
+}
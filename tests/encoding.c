@@ -0,0 +1,80 @@
+#include "test.h"
+#include "encoding.h"
+
+static enum content_coding negotiate(const char *raw_req, unsigned available) {
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct accept_codings accept;
+	enum content_coding coding;
+
+	ASSERT_TRUE(parse_ok(raw_req, &req, &ctx) == 0);
+	parse_accept_encoding(&req, &accept);
+	coding = choose_coding(&accept, available);
+	END_TEST(ctx, req);
+	return coding;
+}
+
+static void test_accept_encoding_qvalues(void) {
+	const char *firefox = RL11("GET", "/") HOST("ex.com")
+		H("Accept-Encoding", "gzip, deflate, br, zstd") END;
+	const char *weighted = RL11("GET", "/") HOST("ex.com")
+		H("Accept-Encoding", "br;q=0.5, gzip;q=0.8") END;
+	const char *split = RL11("GET", "/") HOST("ex.com")
+		H("Accept-Encoding", "gzip ; q=0") H("Accept-Encoding", "br") END;
+	unsigned both = CODING_BIT(CC_BR) | CODING_BIT(CC_GZIP);
+
+	ASSERT_EQ_INT(negotiate(firefox, both), CC_BR);
+	ASSERT_EQ_INT(negotiate(firefox, CODING_BIT(CC_GZIP)), CC_GZIP);
+	ASSERT_EQ_INT(negotiate(firefox, 0), CC_IDENTITY);
+	ASSERT_EQ_INT(negotiate(weighted, both), CC_GZIP);
+	ASSERT_EQ_INT(negotiate(split, CODING_BIT(CC_GZIP)), CC_IDENTITY);
+	ASSERT_EQ_INT(negotiate(split, both), CC_BR);
+}
+
+static void test_accept_encoding_identity(void) {
+	const char *none = RL11("GET", "/") HOST("ex.com") END;
+	const char *wildcard = RL11("GET", "/") HOST("ex.com")
+		H("Accept-Encoding", "*") END;
+	const char *refused = RL11("GET", "/") HOST("ex.com")
+		H("Accept-Encoding", "gzip;q=0.1, *;q=0") END;
+	const char *malformed = RL11("GET", "/") HOST("ex.com")
+		H("Accept-Encoding", "gzip;q=2") END;
+	unsigned both = CODING_BIT(CC_BR) | CODING_BIT(CC_GZIP);
+
+	ASSERT_EQ_INT(negotiate(none, both), CC_IDENTITY);
+	ASSERT_EQ_INT(negotiate(wildcard, both), CC_BR);
+	ASSERT_EQ_INT(negotiate(refused, both), CC_GZIP);
+	ASSERT_EQ_INT(negotiate(refused, 0), CC__COUNT);
+	ASSERT_EQ_INT(negotiate(malformed, both), CC_IDENTITY);
+}
+
+static size_t key_of(const char *raw_req, char *key, size_t cap) {
+	struct http_request req;
+	struct parse_ctx ctx;
+	size_t len;
+
+	ASSERT_TRUE(parse_ok(raw_req, &req, &ctx) == 0);
+	len = accept_encoding_key(&req, key, cap);
+	END_TEST(ctx, req);
+	return len;
+}
+
+/* negotiation is memoized by the field values themselves */
+static void test_accept_encoding_key(void) {
+	const char *split = RL11("GET", "/") HOST("ex.com")
+		H("Accept-Encoding", "gzip;q=0") H("Accept-Encoding", "br") END;
+	const char *none = RL11("GET", "/") HOST("ex.com") END;
+	char key[16];
+
+	ASSERT_EQ_INT(key_of(split, key, sizeof key), 12);
+	ASSERT_EQ_MEM(key, 12, "gzip;q=0,br,", 12);
+	ASSERT_EQ_INT(key_of(none, key, sizeof key), 0);
+	/* too long to be kept */
+	ASSERT_EQ_INT(key_of(split, key, 11), 11);
+}
+
+void run_encoding_tests(void) {
+	RUN_TEST(test_accept_encoding_qvalues);
+	RUN_TEST(test_accept_encoding_identity);
+	RUN_TEST(test_accept_encoding_key);
+}
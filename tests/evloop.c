@@ -0,0 +1,89 @@
+#include <unistd.h>
+#include "evloop.h"
+#include "test.h"
+
+struct counter {
+	struct ev_source src;
+	int calls;
+	int destroyed;
+};
+
+static void mark_destroyed(struct ev_source *src) {
+	((struct counter *)src)->destroyed = 1;
+}
+
+static void count_event(struct evloop *loop, struct ev_source *src, unsigned events) {
+	struct counter *c = (struct counter *)src;
+	char byte;
+
+	ASSERT_TRUE(events & EPOLLIN);
+	ASSERT_EQ_INT(read(src->fd, &byte, 1), 1);
+	if (++c->calls == 2) evloop_retire(loop, src, mark_destroyed);
+}
+
+static void retire_other(struct evloop *loop, struct ev_source *src, unsigned events) {
+	struct counter *c = (struct counter *)src;
+	(void)events;
+	c->calls++;
+	evloop_del(loop, src);
+}
+
+static void test_evloop_dispatch(void) {
+	struct evloop loop;
+	struct counter c;
+	int fds[2];
+
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	ASSERT_EQ_INT(pipe(fds), 0);
+	memset(&c, 0, sizeof c);
+	c.src.fd = fds[0];
+	c.src.handle = count_event;
+	ASSERT_EQ_INT(evloop_add(&loop, &c.src, EPOLLIN), 0);
+
+	ASSERT_EQ_INT(evloop_run_once(&loop, 0), 0);
+	ASSERT_EQ_INT(write(fds[1], "ab", 2), 2);
+	ASSERT_EQ_INT(evloop_run_once(&loop, 0), 1);
+	ASSERT_EQ_INT(c.calls, 1);
+
+	/* retired sources are destroyed after the batch, and never seen again */
+	ASSERT_EQ_INT(evloop_run_once(&loop, 0), 1);
+	ASSERT_EQ_INT(c.calls, 2);
+	ASSERT_EQ_INT(c.destroyed, 1);
+	ASSERT_EQ_INT(write(fds[1], "c", 1), 1);
+	ASSERT_EQ_INT(evloop_run_once(&loop, 0), 0);
+
+	close(fds[0]);
+	close(fds[1]);
+	evloop_free(&loop);
+}
+
+static void test_evloop_retire(void) {
+	struct evloop loop;
+	struct counter a, b;
+	int fds[2];
+
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	ASSERT_EQ_INT(pipe(fds), 0);
+	memset(&a, 0, sizeof a);
+	memset(&b, 0, sizeof b);
+	a.src.fd = fds[1];
+	a.src.handle = retire_other;
+	b.src.fd = fds[0];
+	b.src.handle = count_event;
+	ASSERT_EQ_INT(evloop_add(&loop, &a.src, EPOLLOUT), 0);
+
+	evloop_retire(&loop, &b.src, mark_destroyed);
+	ASSERT_EQ_INT(b.destroyed, 0);
+	ASSERT_EQ_INT(evloop_run_once(&loop, 0), 1);
+	ASSERT_EQ_INT(a.calls, 1);
+	ASSERT_EQ_INT(b.destroyed, 1);
+
+	close(fds[0]);
+	close(fds[1]);
+	evloop_free(&loop);
+}
+
+void run_evloop_tests(void) {
+	RUN_TEST(test_evloop_dispatch);
+	RUN_TEST(test_evloop_retire);
+}
@@ -0,0 +1,601 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "fastcgi.h"
+#include "str.h"
+#include "test.h"
+
+static char flat[1 << 16];
+
+/* what the queue would send, queue emptied */
+static size_t flatten(struct outq *q) {
+	struct zerocopy zc;
+	struct zc_socket s;
+	int fds[2], big = 1 << 17;
+	size_t total = 0;
+	ssize_t n;
+
+	ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &big, sizeof big);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	zerocopy_init(&zc, 0);
+	zc_socket_init(&s, fds[0]);
+	ASSERT_EQ_INT(outq_flush(q, &zc, &s), OUTQ_DONE);
+	while ((n = read(fds[1], flat + total, sizeof flat - 1 - total)) > 0) {
+		total += (size_t)n;
+	}
+	flat[total] = '\0';
+	close(fds[0]);
+	close(fds[1]);
+	return total;
+}
+
+/* what a request sent, by stream */
+struct received {
+	unsigned char begin[8];
+	char params[4096];
+	size_t params_len;
+	char in[1 << 17];
+	size_t in_len;
+	int done; /* the stdin stream ended */
+};
+
+static void receive(struct received *r, const char *buf, size_t len, struct fcgi_scan *scan) {
+	size_t pos = 0, n;
+	long step;
+	const char *piece;
+
+	while (pos < len) {
+		step = fcgi_scan_next(scan, buf + pos, len - pos, &n);
+		ASSERT_TRUE(step > 0);
+		ASSERT_EQ_INT(scan->id, FCGI_REQUEST_ID);
+		piece = buf + pos + step - n;
+		pos += (size_t)step;
+		if (scan->type == FCGI_BEGIN_REQUEST && n > 0) {
+			memcpy(r->begin + 8 - scan->content_left - n, piece, n);
+		} else if (scan->type == FCGI_PARAMS) {
+			memcpy(r->params + r->params_len, piece, n);
+			r->params_len += n;
+		} else if (scan->type == FCGI_STDIN) {
+			memcpy(r->in + r->in_len, piece, n);
+			r->in_len += n;
+			if (scan->complete && n == 0) r->done = 1;
+		}
+	}
+}
+
+static size_t get_length(const char *buf, size_t *pos) {
+	const unsigned char *b = (const unsigned char *)buf + *pos;
+
+	if (b[0] < 128) {
+		*pos += 1;
+		return b[0];
+	}
+	*pos += 4;
+	return (size_t)(b[0] & 0x7f) << 24 | (size_t)b[1] << 16 | (size_t)b[2] << 8 | b[3];
+}
+
+/* the value of the param `name`, ptr NULL if it was not sent */
+static struct slice param(const struct received *r, const char *name) {
+	struct slice none = {NULL, 0};
+	size_t pos = 0, name_len, value_len;
+
+	while (pos < r->params_len) {
+		name_len = get_length(r->params, &pos);
+		value_len = get_length(r->params, &pos);
+		if (name_len == strlen(name) && !memcmp(r->params + pos, name, name_len)) {
+			return get_slice(r->params + pos + name_len, value_len);
+		}
+		pos += name_len + value_len;
+	}
+	return none;
+}
+
+static void test_fastcgi_params(void) {
+	const char *raw = RL11("POST", "/app/index.php?x=1&y")
+		H("Host", "example.com:8080")
+		H("Content-Type", "text/plain")
+		H("Content-Length", "4")
+		H("Cookie", "a=1")
+		H("X-Multi", "one")
+		H("Cookie", "b=2")
+		H("x-multi", "two")
+		H("X_Multi", "smuggled")
+		H("Proxy", "evil:1") END "data";
+	struct fcgi_script script = {"/srv/www/", "10.0.0.7", 5000, 80};
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct received r;
+	struct fcgi_scan scan;
+	struct outq q;
+	size_t len;
+	struct slice v;
+
+	ASSERT_EQ_INT(parse_ok(raw, &req, &ctx), 0);
+	outq_init(&q);
+	fcgi_push_params(&q, &req, &script);
+	len = flatten(&q);
+	memset(&r, 0, sizeof r);
+	memset(&scan, 0, sizeof scan);
+	receive(&r, flat, len, &scan);
+	/* a responder, the connection kept */
+	ASSERT_EQ_INT(r.begin[1], FCGI_RESPONDER);
+	ASSERT_EQ_INT(r.begin[2], FCGI_KEEP_CONN);
+	ASSERT_EQ_INT(scan.type, FCGI_PARAMS);
+	ASSERT_EQ_INT(scan.complete, 1);
+
+	v = param(&r, "REQUEST_METHOD");
+	ASSERT_EQ_SLICE(v, "POST");
+	v = param(&r, "REQUEST_URI");
+	ASSERT_EQ_SLICE(v, "/app/index.php?x=1&y");
+	v = param(&r, "QUERY_STRING");
+	ASSERT_EQ_SLICE(v, "x=1&y");
+	v = param(&r, "SCRIPT_NAME");
+	ASSERT_EQ_SLICE(v, "/app/index.php");
+	v = param(&r, "SCRIPT_FILENAME");
+	ASSERT_EQ_SLICE(v, "/srv/www/app/index.php");
+	v = param(&r, "SERVER_NAME");
+	ASSERT_EQ_SLICE(v, "example.com");
+	v = param(&r, "SERVER_PORT");
+	ASSERT_EQ_SLICE(v, "80");
+	v = param(&r, "REMOTE_ADDR");
+	ASSERT_EQ_SLICE(v, "10.0.0.7");
+	v = param(&r, "CONTENT_LENGTH");
+	ASSERT_EQ_SLICE(v, "4");
+	v = param(&r, "CONTENT_TYPE");
+	ASSERT_EQ_SLICE(v, "text/plain");
+	v = param(&r, "HTTP_HOST");
+	ASSERT_EQ_SLICE(v, "example.com:8080");
+	/* repeated fields are joined, names that would collide dropped */
+	v = param(&r, "HTTP_COOKIE");
+	ASSERT_EQ_SLICE(v, "a=1; b=2");
+	v = param(&r, "HTTP_X_MULTI");
+	ASSERT_EQ_SLICE(v, "one, two");
+	v = param(&r, "HTTP_PROXY");
+	ASSERT_TRUE(v.ptr == NULL);
+	v = param(&r, "HTTP_CONTENT_LENGTH");
+	ASSERT_TRUE(v.ptr == NULL);
+	outq_free(&q);
+	END_TEST(ctx, req);
+
+	/* no docroot, no file */
+	script.docroot = NULL;
+	ASSERT_EQ_INT(parse_ok(RL11("GET", "/") HOST("h") END, &req, &ctx), 0);
+	outq_init(&q);
+	fcgi_push_params(&q, &req, &script);
+	len = flatten(&q);
+	memset(&r, 0, sizeof r);
+	memset(&scan, 0, sizeof scan);
+	receive(&r, flat, len, &scan);
+	v = param(&r, "SCRIPT_NAME");
+	ASSERT_EQ_SLICE(v, "/");
+	v = param(&r, "SCRIPT_FILENAME");
+	ASSERT_TRUE(v.ptr == NULL);
+	v = param(&r, "QUERY_STRING");
+	ASSERT_EQ_SLICE(v, "");
+	v = param(&r, "CONTENT_LENGTH");
+	ASSERT_TRUE(v.ptr == NULL);
+	outq_free(&q);
+	END_TEST(ctx, req);
+}
+
+static void test_fastcgi_scan(void) {
+	/* a STDOUT record with padding, then an END_REQUEST */
+	const char rec[] = "\1\6\0\1\0\3\2\0abc\0\0" "\1\3\0\1\0\10\0\0\0\0\0\0\0\0\0\0";
+	size_t len = sizeof rec - 1, pos, n;
+	struct fcgi_scan scan;
+	long step;
+
+	memset(&scan, 0, sizeof scan);
+	step = fcgi_scan_next(&scan, rec, len, &n);
+	ASSERT_EQ_INT(step, 11);
+	ASSERT_EQ_INT(n, 3);
+	ASSERT_EQ_INT(scan.type, FCGI_STDOUT);
+	ASSERT_EQ_INT(scan.complete, 0);
+	step = fcgi_scan_next(&scan, rec + 11, len - 11, &n);
+	ASSERT_EQ_INT(step, 2);
+	ASSERT_EQ_INT(n, 0);
+	ASSERT_EQ_INT(scan.complete, 1);
+
+	/* a byte at a time comes to the same */
+	memset(&scan, 0, sizeof scan);
+	for (pos = 13; pos < len; ++pos) {
+		step = fcgi_scan_next(&scan, rec + pos, 1, &n);
+		ASSERT_EQ_INT(step, 1);
+	}
+	ASSERT_EQ_INT(scan.type, FCGI_END_REQUEST);
+	ASSERT_EQ_INT(scan.complete, 1);
+
+	memset(&scan, 0, sizeof scan);
+	step = fcgi_scan_next(&scan, "\2\6\0\1\0\0\0\0", 8, &n);
+	ASSERT_EQ_INT(step, -1);
+}
+
+static void test_fastcgi_parse_head(void) {
+	const char *cgi = "Status: 404 Gone Fishing\n" "Content-Type: text/html\r\n"
+		"Connection: keep-alive\n" "X-A:  b  \n\n" "body";
+	const char *expect = "HTTP/1.1 404 Gone Fishing" CRLF "Server: " SERVER CRLF
+		"Date: D" CRLF "Content-Type: text/html" CRLF "X-A: b" CRLF "Connection: close" CRLF CRLF;
+	struct http_response resp = new_response();
+	unsigned status = 0;
+	long len;
+
+	len = fcgi_parse_head(cgi, strlen(cgi), "D", &resp, &status);
+	ASSERT_EQ_INT(len, (long)strlen(cgi) - 4);
+	ASSERT_EQ_INT(status, 404);
+	ASSERT_EQ_MEM(resp.buf, resp.len, expect, strlen(expect));
+	http_response_free(&resp);
+
+	/* a redirect unless told otherwise, the application's Date kept */
+	resp = new_response();
+	len = fcgi_parse_head("Location: /x\r\nDate: T\r\n\r\n", 25, "D", &resp, &status);
+	ASSERT_EQ_INT(len, 25);
+	ASSERT_EQ_INT(status, 302);
+	expect = "HTTP/1.1 302 Found" CRLF "Server: " SERVER CRLF "Location: /x" CRLF "Date: T" CRLF
+		"Connection: close" CRLF CRLF;
+	ASSERT_EQ_MEM(resp.buf, resp.len, expect, strlen(expect));
+	http_response_free(&resp);
+
+	resp = new_response();
+	len = fcgi_parse_head("\n", 1, "D", &resp, &status);
+	ASSERT_EQ_INT(len, 1);
+	ASSERT_EQ_INT(status, 200);
+	http_response_free(&resp);
+
+	/* incomplete, then malformed: nothing written */
+	resp = new_response();
+	len = fcgi_parse_head("Content-Type: text/html\n", 24, "D", &resp, &status);
+	ASSERT_EQ_INT(len, 0);
+	len = fcgi_parse_head("Status: 100 Continue\n\n", 22, "D", &resp, &status);
+	ASSERT_EQ_INT(len, -1);
+	len = fcgi_parse_head("Status: 20x\n\n", 13, "D", &resp, &status);
+	ASSERT_EQ_INT(len, -1);
+	len = fcgi_parse_head("no colon\n\n", 10, "D", &resp, &status);
+	ASSERT_EQ_INT(len, -1);
+	len = fcgi_parse_head("X: a\rb\n\n", 8, "D", &resp, &status);
+	ASSERT_EQ_INT(len, -1);
+	ASSERT_EQ_INT(resp.len, 0);
+	http_response_free(&resp);
+}
+
+/* a stand-in application on a local socket, answering by hand */
+struct app {
+	int listener;
+	int conn;
+	char path[64];
+	char name[80];
+	struct fcgi_scan scan;
+};
+
+static void app_init(struct app *a) {
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	sprintf(a->path, "/tmp/aster-fcgi-%ld.sock", (long)getpid());
+	strcpy(addr.sun_path, a->path);
+	unlink(a->path);
+	a->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	ASSERT_TRUE(a->listener != -1);
+	ASSERT_EQ_INT(bind(a->listener, (void *)&addr, sizeof addr), 0);
+	ASSERT_EQ_INT(listen(a->listener, 8), 0);
+	sprintf(a->name, UPSTREAM_UNIX "%s", a->path);
+	a->conn = -1;
+}
+
+static void app_free(struct app *a) {
+	if (a->conn != -1) close(a->conn);
+	close(a->listener);
+	unlink(a->path);
+}
+
+/* run the loop until the application has the whole request */
+static void app_receive(struct evloop *loop, struct app *a, struct received *r) {
+	char buf[4096];
+	ssize_t n;
+	int rounds = 0;
+
+	memset(r, 0, sizeof *r);
+	if (a->conn == -1) {
+		while (rounds++ < 50) {
+			ASSERT_TRUE(evloop_run_once(loop, 10) >= 0);
+			a->conn = accept(a->listener, NULL, NULL);
+			if (a->conn != -1) break;
+		}
+		ASSERT_TRUE(a->conn != -1);
+		fcntl(a->conn, F_SETFL, O_NONBLOCK);
+		memset(&a->scan, 0, sizeof a->scan);
+	}
+	for (rounds = 0; !r->done && rounds < 50; ++rounds) {
+		ASSERT_TRUE(evloop_run_once(loop, 10) >= 0);
+		while ((n = read(a->conn, buf, sizeof buf)) > 0) receive(r, buf, (size_t)n, &a->scan);
+	}
+	ASSERT_TRUE(r->done);
+}
+
+static void app_send(struct app *a, enum fcgi_record_type type, const char *data, size_t len) {
+	unsigned char header[FCGI_HEADER_LEN];
+
+	fcgi_header(header, type, len);
+	ASSERT_EQ_INT(write(a->conn, header, sizeof header), (ssize_t)sizeof header);
+	if (len > 0) ASSERT_EQ_INT(write(a->conn, data, len), (ssize_t)len);
+}
+
+static void app_end(struct app *a) {
+	app_send(a, FCGI_STDOUT, NULL, 0);
+	app_send(a, FCGI_END_REQUEST, "\0\0\0\0\0\0\0\0", 8);
+}
+
+static int notified;
+
+static void count_notify(struct fcgi_call *call) {
+	(void)call;
+	notified++;
+}
+
+/* run the loop until the call is over */
+static void run_call(struct evloop *loop, struct fcgi_call *call) {
+	int rounds = 0;
+	while (call->state < FC_DONE && rounds++ < 50) {
+		ASSERT_TRUE(evloop_run_once(loop, 100) >= 0);
+	}
+	ASSERT_TRUE(call->state >= FC_DONE);
+}
+
+static void call_init(
+		struct fcgi_call *call,
+		struct evloop *loop,
+		struct upstream *app,
+		const char *raw,
+		struct http_request *req,
+		struct parse_ctx *ctx,
+		struct outq *to_client
+) {
+	struct fcgi_script script = {NULL, "127.0.0.1", 4000, 80};
+
+	ASSERT_EQ_INT(parse_ok(raw, req, ctx), 0);
+	outq_init(to_client);
+	fcgi_call_init(call, loop, app, req, &script, to_client, count_notify, NULL);
+	fcgi_call_start(call, ctx->buf + ctx->pos, ctx->len - ctx->pos);
+}
+
+static void test_fastcgi_call_pooled(void) {
+	struct evloop loop;
+	struct app a;
+	struct upstream up;
+	struct fcgi_call call;
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct outq out;
+	struct received r;
+	const char *expect;
+	size_t len;
+
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	app_init(&a);
+	ASSERT_EQ_INT(upstream_init(&up, a.name), 0);
+
+	/* the body sent along with the head goes in STDIN records; stdout is
+	   relayed as it comes, stderr logged */
+	call_init(&call, &loop, &up, "POST /a HTTP/1.1" CRLF "Host: h" CRLF
+		"Content-Length: 4" CRLF CRLF "data", &req, &ctx, &out);
+	app_receive(&loop, &a, &r);
+	ASSERT_EQ_MEM(r.in, r.in_len, "data", 4);
+	app_send(&a, FCGI_STDOUT, "Status: 201 Created\r\nContent-Type: text/plain\r\n\r\nhel", 52);
+	app_send(&a, FCGI_STDERR, "warn\n", 5);
+	app_send(&a, FCGI_STDOUT, "lo", 2);
+	app_end(&a);
+	run_call(&loop, &call);
+	ASSERT_EQ_INT(call.state, FC_DONE);
+	len = flatten(&out);
+	ASSERT_TRUE(!memcmp(flat, "HTTP/1.1 201 Created" CRLF, 22));
+	ASSERT_TRUE(strstr(flat, CRLF "Content-Type: text/plain" CRLF "Connection: close" CRLF CRLF) != NULL);
+	ASSERT_EQ_MEM(flat + len - 5, 5, "hello", 5);
+	ASSERT_EQ_INT(up.num_idle, 1);
+	ASSERT_EQ_INT(up.outstanding, 0);
+	fcgi_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	/* the next one goes on the same connection; a HEAD gets no body */
+	call_init(&call, &loop, &up, "HEAD /b HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx, &out);
+	ASSERT_EQ_INT(call.reused, 1);
+	app_receive(&loop, &a, &r);
+	ASSERT_EQ_INT(r.in_len, 0);
+	app_send(&a, FCGI_STDOUT, "Content-Length: 3\n\nabc", 22);
+	app_end(&a);
+	run_call(&loop, &call);
+	len = flatten(&out);
+	ASSERT_TRUE(!memcmp(flat, "HTTP/1.1 200 OK" CRLF, 17));
+	expect = "Content-Length: 3" CRLF "Connection: close" CRLF CRLF;
+	ASSERT_EQ_MEM(flat + len - strlen(expect), strlen(expect), expect, strlen(expect));
+	ASSERT_EQ_INT(up.stats.connects, 1);
+	ASSERT_EQ_INT(up.stats.reuses, 1);
+	ASSERT_EQ_INT(up.num_idle, 1);
+	fcgi_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	/* the application closed the idle connection: a new one is opened */
+	close(a.conn);
+	a.conn = -1;
+	call_init(&call, &loop, &up, "GET /c HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx, &out);
+	app_receive(&loop, &a, &r);
+	app_send(&a, FCGI_STDOUT, "\n", 1);
+	app_end(&a);
+	run_call(&loop, &call);
+	ASSERT_EQ_INT(call.state, FC_DONE);
+	ASSERT_EQ_INT(up.stats.stale, 1);
+	ASSERT_EQ_INT(up.stats.connects, 2);
+	flatten(&out);
+	ASSERT_TRUE(!memcmp(flat, "HTTP/1.1 200 OK" CRLF, 17));
+	fcgi_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	app_free(&a);
+	upstream_free(&up);
+	evloop_free(&loop);
+}
+
+#define BIG (100ul << 10)
+
+static char big[BIG];
+
+static void test_fastcgi_call_body(void) {
+	struct evloop loop;
+	struct app a;
+	struct upstream up;
+	struct fcgi_call call;
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct outq out;
+	struct received r;
+	char head[128], buf[4096];
+	int fds[2], rounds;
+	size_t sent = 0, i;
+	ssize_t n;
+
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	app_init(&a);
+	ASSERT_EQ_INT(upstream_init(&up, a.name), 0);
+	ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	for (i = 0; i < BIG; ++i) big[i] = (char)('a' + i % 26);
+
+	/* the rest of the body is pulled from the client as it comes */
+	sprintf(head, "PUT /up HTTP/1.1" CRLF "Host: h" CRLF "Content-Length: %lu" CRLF CRLF "ab",
+		(unsigned long)BIG + 2);
+	call_init(&call, &loop, &up, head, &req, &ctx, &out);
+	memset(&r, 0, sizeof r);
+	for (rounds = 0; !r.done && rounds < 500; ++rounds) {
+		if (sent < BIG && (n = write(fds[1], big + sent, BIG - sent)) > 0) sent += (size_t)n;
+		while (fcgi_call_room(&call) > 0 && fcgi_call_pull(&call, fds[0]) > 0);
+		ASSERT_TRUE(evloop_run_once(&loop, 10) >= 0);
+		if (a.conn == -1) {
+			a.conn = accept(a.listener, NULL, NULL);
+			if (a.conn != -1) fcntl(a.conn, F_SETFL, O_NONBLOCK);
+			memset(&a.scan, 0, sizeof a.scan);
+		}
+		while (a.conn != -1 && (n = read(a.conn, buf, sizeof buf)) > 0) {
+			receive(&r, buf, (size_t)n, &a.scan);
+		}
+	}
+	ASSERT_TRUE(r.done);
+	ASSERT_EQ_INT(r.in_len, BIG + 2);
+	ASSERT_EQ_MEM(r.in, 2, "ab", 2);
+	ASSERT_EQ_MEM(r.in + 2, BIG, big, BIG);
+	ASSERT_EQ_INT(fcgi_call_room(&call), 0);
+	app_send(&a, FCGI_STDOUT, "Status: 204\n\n", 13);
+	app_end(&a);
+	run_call(&loop, &call);
+	flatten(&out);
+	ASSERT_TRUE(!memcmp(flat, "HTTP/1.1 204 No Content" CRLF, 25));
+	ASSERT_EQ_INT(up.num_idle, 1);
+	fcgi_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	close(fds[0]);
+	close(fds[1]);
+	app_free(&a);
+	upstream_free(&up);
+	evloop_free(&loop);
+}
+
+static void test_fastcgi_call_failures(void) {
+	struct evloop loop;
+	struct app a;
+	struct upstream up;
+	struct fcgi_call call;
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct outq out;
+	struct received r;
+
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	app_init(&a);
+	ASSERT_EQ_INT(upstream_init(&up, a.name), 0);
+
+	/* closed before the head: the client gets a 502 */
+	call_init(&call, &loop, &up, "GET /a HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx, &out);
+	app_receive(&loop, &a, &r);
+	app_send(&a, FCGI_STDOUT, "Content-Type: te", 16);
+	close(a.conn);
+	a.conn = -1;
+	run_call(&loop, &call);
+	ASSERT_EQ_INT(call.state, FC_DONE);
+	flatten(&out);
+	ASSERT_TRUE(!memcmp(flat, "HTTP/1.1 502 Bad Gateway" CRLF, 26));
+	ASSERT_EQ_INT(up.stats.failures, 1);
+	fcgi_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	/* ended without a head, or with a malformed one */
+	call_init(&call, &loop, &up, "GET /b HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx, &out);
+	app_receive(&loop, &a, &r);
+	app_end(&a);
+	run_call(&loop, &call);
+	flatten(&out);
+	ASSERT_TRUE(!memcmp(flat, "HTTP/1.1 502 Bad Gateway" CRLF, 26));
+	ASSERT_EQ_INT(up.num_idle, 0);
+	fcgi_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+	close(a.conn);
+	a.conn = -1;
+
+	call_init(&call, &loop, &up, "GET /c HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx, &out);
+	app_receive(&loop, &a, &r);
+	app_send(&a, FCGI_STDOUT, "bad head\n\n", 10);
+	run_call(&loop, &call);
+	flatten(&out);
+	ASSERT_TRUE(!memcmp(flat, "HTTP/1.1 502 Bad Gateway" CRLF, 26));
+	fcgi_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+	close(a.conn);
+	a.conn = -1;
+
+	/* past the head the response is cut short */
+	call_init(&call, &loop, &up, "GET /d HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx, &out);
+	app_receive(&loop, &a, &r);
+	app_send(&a, FCGI_STDOUT, "Content-Length: 5\n\nhe", 21);
+	close(a.conn);
+	a.conn = -1;
+	run_call(&loop, &call);
+	ASSERT_EQ_INT(call.state, FC_BROKEN);
+	ASSERT_EQ_INT(up.num_idle, 0);
+	ASSERT_EQ_INT(up.outstanding, 0);
+	fcgi_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	/* nobody listens */
+	app_free(&a);
+	call_init(&call, &loop, &up, "GET /e HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx, &out);
+	run_call(&loop, &call);
+	ASSERT_EQ_INT(call.state, FC_DONE);
+	flatten(&out);
+	ASSERT_TRUE(!memcmp(flat, "HTTP/1.1 502 Bad Gateway" CRLF, 26));
+	ASSERT_TRUE(notified > 0);
+	fcgi_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	upstream_free(&up);
+	evloop_free(&loop);
+}
+
+void run_fastcgi_tests(void) {
+	RUN_TEST(test_fastcgi_params);
+	RUN_TEST(test_fastcgi_scan);
+	RUN_TEST(test_fastcgi_parse_head);
+	RUN_TEST(test_fastcgi_call_pooled);
+	RUN_TEST(test_fastcgi_call_body);
+	RUN_TEST(test_fastcgi_call_failures);
+}
@@ -0,0 +1,108 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "fdcache.h"
+#include "test.h"
+
+/* root/sub/file, with secret next to root and links to both */
+static int make_tree(char *dir) {
+	char path[128];
+	int fd;
+
+	ASSERT_TRUE(mkdtemp(dir) != NULL);
+	sprintf(path, "%s/secret", dir);
+	fd = open(path, O_CREAT | O_WRONLY, 0600);
+	ASSERT_TRUE(fd != -1);
+	close(fd);
+	sprintf(path, "%s/root", dir);
+	ASSERT_EQ_INT(mkdir(path, 0700), 0);
+	sprintf(path, "%s/root/sub", dir);
+	ASSERT_EQ_INT(mkdir(path, 0700), 0);
+	sprintf(path, "%s/root/sub/file", dir);
+	fd = open(path, O_CREAT | O_WRONLY, 0600);
+	ASSERT_TRUE(fd != -1);
+	close(fd);
+	sprintf(path, "%s/root/out", dir);
+	ASSERT_EQ_INT(symlink("../secret", path), 0);
+	sprintf(path, "%s/root/up", dir);
+	ASSERT_EQ_INT(symlink("..", path), 0);
+
+	sprintf(path, "%s/root", dir);
+	fd = open(path, O_RDONLY | O_DIRECTORY);
+	ASSERT_TRUE(fd != -1);
+	return fd;
+}
+
+static void remove_tree(const char *dir) {
+	const char *names[] = {"root/up", "root/out", "root/sub/file", "secret"};
+	const char *dirs[] = {"root/sub", "root", ""};
+	char path[128];
+	size_t i;
+
+	for (i = 0; i < sizeof names / sizeof names[0]; ++i) {
+		sprintf(path, "%s/%s", dir, names[i]);
+		unlink(path);
+	}
+	for (i = 0; i < sizeof dirs / sizeof dirs[0]; ++i) {
+		sprintf(path, "%s/%s", dir, dirs[i]);
+		rmdir(path);
+	}
+}
+
+/* -1 if `path` cannot be opened, with errno set */
+static int try_open(int (*open_fn)(int, const char *), int root, const char *path) {
+	int fd = open_fn(root, path);
+	if (fd != -1) close(fd);
+	return fd == -1 ? -1 : 0;
+}
+
+static void test_open_beneath(void) {
+	char dir[] = "/tmp/aster-beneath-XXXXXX";
+	int root = make_tree(dir);
+
+	ASSERT_EQ_INT(try_open(open_beneath, root, "sub/file"), 0);
+	ASSERT_EQ_INT(try_open(open_beneath, root, "."), 0);
+	ASSERT_EQ_INT(try_open(open_beneath, root, "../secret"), -1);
+	ASSERT_EQ_INT(try_open(open_beneath, root, "out"), -1);
+	ASSERT_EQ_INT(try_open(open_beneath, root, "up/secret"), -1);
+	ASSERT_EQ_INT(try_open(open_beneath, root, "/etc/passwd"), -1);
+
+	close(root);
+	remove_tree(dir);
+}
+
+/* what older kernels fall back to */
+static void test_walk_beneath(void) {
+	char dir[] = "/tmp/aster-beneath-XXXXXX";
+	int root = make_tree(dir);
+
+	ASSERT_EQ_INT(try_open(walk_beneath, root, "sub/file"), 0);
+	ASSERT_EQ_INT(try_open(walk_beneath, root, "sub//file"), 0);
+	ASSERT_EQ_INT(try_open(walk_beneath, root, "sub"), 0);
+	ASSERT_EQ_INT(try_open(walk_beneath, root, "."), 0);
+	ASSERT_EQ_INT(try_open(walk_beneath, root, "sub/missing"), -1);
+	ASSERT_EQ_INT(errno, ENOENT);
+
+	ASSERT_EQ_INT(try_open(walk_beneath, root, "../secret"), -1);
+	ASSERT_EQ_INT(errno, EXDEV);
+	ASSERT_EQ_INT(try_open(walk_beneath, root, "sub/../../secret"), -1);
+	ASSERT_EQ_INT(errno, EXDEV);
+	ASSERT_EQ_INT(try_open(walk_beneath, root, "/etc/passwd"), -1);
+	ASSERT_EQ_INT(errno, EXDEV);
+	ASSERT_EQ_INT(try_open(walk_beneath, root, "out"), -1);
+	ASSERT_EQ_INT(errno, ELOOP);
+	ASSERT_EQ_INT(try_open(walk_beneath, root, "up/secret"), -1);
+	ASSERT_TRUE(errno == ELOOP || errno == ENOTDIR);
+
+	close(root);
+	remove_tree(dir);
+}
+
+void run_fdcache_tests(void) {
+	RUN_TEST(test_open_beneath);
+	RUN_TEST(test_walk_beneath);
+}
@@ -0,0 +1,362 @@
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "h2.h"
+#include "test.h"
+#include "ws.h"
+
+#define RESPONSE(body) \
+	"HTTP/1.1 200 OK" CRLF \
+	"Content-Length: 10" CRLF \
+	"Connection: close" CRLF CRLF \
+	body
+
+/* the client's end of a connection, with what the server sent */
+struct h2_client {
+	int fds[2];
+	struct outq out;
+	struct zerocopy zc;
+	struct zc_socket zs;
+	struct h2_conn h2;
+	unsigned char got[4096];
+	size_t len, pos;
+	int served; /* requests complete, each answered with RESPONSE */
+	struct http_request last; /* the latest of them */
+	int upgrading; /* answered with 101 instead, as a WebSocket route does */
+};
+
+static const struct ws_handler no_handler = {NULL, NULL, NULL};
+
+static void serve(struct h2_conn *h2, struct h2_stream *st) {
+	struct h2_client *c = h2->owner;
+	struct http_response resp = new_response();
+
+	c->served++;
+	http_request_free(&c->last);
+	c->last = st->req;
+	st->req = new_request();
+	if (c->upgrading) {
+		append_to_response(&resp,
+			"HTTP/1.1 101 Switching Protocols" CRLF
+			"Upgrade: websocket" CRLF
+			"Connection: Upgrade" CRLF CRLF);
+		resp.websocket = &no_handler;
+	} else {
+		append_to_response(&resp, RESPONSE("0123456789"));
+	}
+	h2_respond(h2, st, &resp);
+}
+
+static void client_init(struct h2_client *c, int preface_read) {
+	ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, c->fds), 0);
+	fcntl(c->fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(c->fds[1], F_SETFL, O_NONBLOCK);
+	outq_init(&c->out);
+	zerocopy_init(&c->zc, 0);
+	zc_socket_init(&c->zs, c->fds[0]);
+	h2_conn_init(&c->h2, &c->out, preface_read, serve, c);
+	c->len = 0;
+	c->pos = 0;
+	c->served = 0;
+	c->last = new_request();
+	c->upgrading = 0;
+}
+
+static void client_free(struct h2_client *c) {
+	h2_conn_free(&c->h2);
+	outq_free(&c->out);
+	http_request_free(&c->last);
+	close(c->fds[0]);
+	close(c->fds[1]);
+}
+
+/* frame what windows allow and take in what reached the client */
+static void receive(struct h2_client *c) {
+	ssize_t n;
+
+	do {
+		ASSERT_EQ_INT(outq_flush(&c->out, &c->zc, &c->zs), OUTQ_DONE);
+	} while (h2_conn_pump(&c->h2) > 0);
+	while ((n = read(c->fds[1], c->got + c->len, sizeof c->got - c->len)) > 0) {
+		c->len += (size_t)n;
+	}
+}
+
+/* the next frame the client got: 1 if there is one */
+static int next_frame(
+		struct h2_client *c,
+		int *type,
+		int *flags,
+		unsigned *id,
+		const unsigned char **payload,
+		size_t *len
+) {
+	const unsigned char *p = c->got + c->pos;
+
+	if (c->pos + H2_FRAME_HEADER > c->len) return 0;
+	*len = (size_t)p[0] << 16 | (size_t)p[1] << 8 | p[2];
+	*type = p[3];
+	*flags = p[4];
+	*id = (unsigned)(p[5] & 0x7f) << 24 | (unsigned)p[6] << 16 | (unsigned)p[7] << 8 | p[8];
+	*payload = p + H2_FRAME_HEADER;
+	ASSERT_TRUE(c->pos + H2_FRAME_HEADER + *len <= c->len);
+	c->pos += H2_FRAME_HEADER + *len;
+	return 1;
+}
+
+#define EXPECT_FRAME(c, type_, flags_, id_) do { \
+	ASSERT_TRUE(next_frame(c, &type, &flags, &id, &payload, &len)); \
+	ASSERT_EQ_INT(type, type_); \
+	ASSERT_EQ_INT(flags, flags_); \
+	ASSERT_EQ_INT(id, id_); \
+} while (0)
+
+/* send a frame from the client */
+static void send_frame(
+		struct h2_client *c,
+		int type,
+		int flags,
+		unsigned id,
+		const void *payload,
+		size_t len
+) {
+	unsigned char frame[H2_FRAME_HEADER + 256];
+
+	ASSERT_TRUE(len <= 256);
+	frame[0] = 0;
+	frame[1] = (unsigned char)(len >> 8);
+	frame[2] = (unsigned char)len;
+	frame[3] = (unsigned char)type;
+	frame[4] = (unsigned char)flags;
+	frame[5] = (unsigned char)(id >> 24);
+	frame[6] = (unsigned char)(id >> 16);
+	frame[7] = (unsigned char)(id >> 8);
+	frame[8] = (unsigned char)id;
+	if (len > 0) memcpy(frame + H2_FRAME_HEADER, payload, len);
+	h2_conn_feed(&c->h2, (const char *)frame, H2_FRAME_HEADER + len);
+}
+
+/* GET / of localhost: :method GET, :scheme http, :path /, then
+   :authority as a literal */
+static const unsigned char get_root[] = {
+	0x82, 0x86, 0x84, 0x41, 0x09, 'l', 'o', 'c', 'a', 'l', 'h', 'o', 's', 't'
+};
+
+/* our SETTINGS, then the ack of the client's */
+static void expect_settled(struct h2_client *c) {
+	const unsigned char *payload;
+	int type, flags;
+	unsigned id;
+	size_t len;
+
+	EXPECT_FRAME(c, H2_SETTINGS, 0, 0);
+	ASSERT_EQ_INT(len, 12);
+	EXPECT_FRAME(c, H2_SETTINGS, H2_ACK, 0);
+}
+
+static void test_h2_request(void) {
+	struct h2_client c;
+	const unsigned char *payload;
+	unsigned char frames[H2_PREFACE_LEN + 2 * H2_FRAME_HEADER + sizeof get_root];
+	int type, flags;
+	unsigned id;
+	size_t len, i;
+
+	/* a frame header for the SETTINGS, then for the HEADERS */
+	memcpy(frames, H2_PREFACE, H2_PREFACE_LEN);
+	memcpy(frames + H2_PREFACE_LEN, "\0\0\0\x04\0\0\0\0\0", H2_FRAME_HEADER);
+	memcpy(frames + H2_PREFACE_LEN + H2_FRAME_HEADER, "\0\0\x0e\x01\x05\0\0\0\x01",
+		H2_FRAME_HEADER);
+	memcpy(frames + H2_PREFACE_LEN + 2 * H2_FRAME_HEADER, get_root, sizeof get_root);
+
+	/* frames are put together however they are split */
+	client_init(&c, 0);
+	for (i = 0; i < sizeof frames; ++i) {
+		h2_conn_feed(&c.h2, (const char *)frames + i, 1);
+	}
+	ASSERT_EQ_INT(c.served, 1);
+	ASSERT_EQ_INT(c.last.method, HM_GET);
+	ASSERT_EQ_SLICE(c.last.path, "/");
+	ASSERT_EQ_SLICE(c.last.host, "localhost");
+
+	receive(&c);
+	expect_settled(&c);
+	EXPECT_FRAME(&c, H2_HEADERS, H2_END_HEADERS, 1);
+	/* :status 200 by index, the fields of the connection left out */
+	ASSERT_EQ_INT(payload[0], 0x88);
+	ASSERT_EQ_MEM(payload + 1, len - 1, "\x0f\x0d\x02" "10", 5);
+	EXPECT_FRAME(&c, H2_DATA, H2_END_STREAM, 1);
+	ASSERT_EQ_MEM(payload, len, "0123456789", 10);
+	ASSERT_TRUE(!next_frame(&c, &type, &flags, &id, &payload, &len));
+	ASSERT_EQ_INT(c.h2.num_streams, 0);
+
+	/* a stream id may not go back */
+	send_frame(&c, H2_HEADERS, H2_END_STREAM | H2_END_HEADERS, 1, get_root, sizeof get_root);
+	receive(&c);
+	ASSERT_EQ_INT(c.served, 1);
+	send_frame(&c, H2_HEADERS, H2_END_STREAM | H2_END_HEADERS, 3, get_root, sizeof get_root);
+	receive(&c);
+	ASSERT_EQ_INT(c.served, 2);
+	client_free(&c);
+}
+
+static void test_h2_flow_control(void) {
+	static const unsigned char small_window[] = {0, H2_INITIAL_WINDOW_SIZE, 0, 0, 0, 4};
+	static const unsigned char larger_window[] = {0, H2_INITIAL_WINDOW_SIZE, 0, 0, 0, 100};
+	static const unsigned char increment[] = {0, 0, 0, 3};
+	struct h2_client c;
+	const unsigned char *payload;
+	int type, flags;
+	unsigned id;
+	size_t len;
+
+	client_init(&c, 1);
+	send_frame(&c, H2_SETTINGS, 0, 0, small_window, sizeof small_window);
+	send_frame(&c, H2_HEADERS, H2_END_STREAM | H2_END_HEADERS, 1, get_root, sizeof get_root);
+	receive(&c);
+	expect_settled(&c);
+	EXPECT_FRAME(&c, H2_HEADERS, H2_END_HEADERS, 1);
+	EXPECT_FRAME(&c, H2_DATA, 0, 1);
+	ASSERT_EQ_MEM(payload, len, "0123", 4);
+	ASSERT_TRUE(!next_frame(&c, &type, &flags, &id, &payload, &len));
+
+	send_frame(&c, H2_WINDOW_UPDATE, 0, 1, increment, sizeof increment);
+	receive(&c);
+	EXPECT_FRAME(&c, H2_DATA, 0, 1);
+	ASSERT_EQ_MEM(payload, len, "456", 3);
+	ASSERT_TRUE(!next_frame(&c, &type, &flags, &id, &payload, &len));
+
+	/* the streams open follow the new initial window */
+	send_frame(&c, H2_SETTINGS, 0, 0, larger_window, sizeof larger_window);
+	receive(&c);
+	EXPECT_FRAME(&c, H2_SETTINGS, H2_ACK, 0);
+	EXPECT_FRAME(&c, H2_DATA, H2_END_STREAM, 1);
+	ASSERT_EQ_MEM(payload, len, "789", 3);
+	ASSERT_EQ_INT(c.h2.window, H2_WINDOW - 10);
+	client_free(&c);
+}
+
+static void test_h2_ping_and_errors(void) {
+	static const unsigned char uppercase[] = {
+		0x82, 0x86, 0x84, 0x41, 0x01, 'x', 0x40, 0x01, 'X', 0x01, 'y'
+	};
+	static const unsigned char no_path[] = {0x82, 0x86, 0x41, 0x01, 'x'};
+	struct h2_client c;
+	const unsigned char *payload;
+	int type, flags;
+	unsigned id;
+	size_t len;
+
+	client_init(&c, 1);
+	send_frame(&c, H2_SETTINGS, 0, 0, NULL, 0);
+	send_frame(&c, H2_PING, 0, 0, "12345678", 8);
+	receive(&c);
+	expect_settled(&c);
+	EXPECT_FRAME(&c, H2_PING, H2_ACK, 0);
+	ASSERT_EQ_MEM(payload, len, "12345678", 8);
+
+	/* malformed requests reset their stream alone */
+	send_frame(&c, H2_HEADERS, H2_END_STREAM | H2_END_HEADERS, 1, uppercase, sizeof uppercase);
+	send_frame(&c, H2_HEADERS, H2_END_STREAM | H2_END_HEADERS, 3, no_path, sizeof no_path);
+	receive(&c);
+	EXPECT_FRAME(&c, H2_RST_STREAM, 0, 1);
+	ASSERT_EQ_MEM(payload, len, "\0\0\0\x01", 4);
+	EXPECT_FRAME(&c, H2_RST_STREAM, 0, 3);
+	ASSERT_EQ_MEM(payload, len, "\0\0\0\x01", 4);
+	ASSERT_EQ_INT(c.served, 0);
+	ASSERT_TRUE(!c.h2.failed);
+
+	/* HEADERS on the connection fails it, nothing more is read */
+	send_frame(&c, H2_HEADERS, H2_END_STREAM | H2_END_HEADERS, 0, get_root, sizeof get_root);
+	send_frame(&c, H2_PING, 0, 0, "12345678", 8);
+	receive(&c);
+	EXPECT_FRAME(&c, H2_GOAWAY, 0, 0);
+	ASSERT_EQ_MEM(payload, len, "\0\0\0\x03\0\0\0\x01", 8);
+	ASSERT_TRUE(!next_frame(&c, &type, &flags, &id, &payload, &len));
+	ASSERT_TRUE(h2_conn_done(&c.h2));
+	client_free(&c);
+}
+
+static void test_h2_upgrade(void) {
+	struct h2_client c;
+	struct http_request req;
+	struct parse_ctx ctx;
+	unsigned char settings[H2_SETTINGS_MAX];
+	const unsigned char *payload;
+	int type, flags;
+	unsigned id;
+	size_t len;
+	long n;
+
+	/* without HTTP2-Settings among the connection options */
+	ASSERT_EQ_INT(parse_ok(RL11("GET", "/") HOST("localhost")
+		H("Connection", "Upgrade")
+		H("Upgrade", "h2c")
+		H("HTTP2-Settings", "AAMAAABkAAQAAP__") END, &req, &ctx), 0);
+	n = h2_upgrade_settings(&req, settings);
+	ASSERT_EQ_INT(n, -1);
+	END_TEST(ctx, req);
+
+	ASSERT_EQ_INT(parse_ok(RL11("GET", "/") HOST("localhost")
+		H("Connection", "Upgrade, HTTP2-Settings")
+		H("Upgrade", "websocket, h2c")
+		H("HTTP2-Settings", "AAMAAABkAAQAAP__") END, &req, &ctx), 0);
+	n = h2_upgrade_settings(&req, settings);
+	ASSERT_EQ_INT(n, 12);
+
+	/* the request is answered as stream 1, its body once the client is
+	   settled */
+	client_init(&c, 0);
+	h2_conn_upgrade(&c.h2, &req, &ctx, settings, (size_t)n);
+	ASSERT_EQ_INT(c.served, 1);
+	ASSERT_EQ_SLICE(c.last.host, "localhost");
+	ASSERT_EQ_INT(c.h2.initial_window, 0xffff);
+	receive(&c);
+	EXPECT_FRAME(&c, H2_SETTINGS, 0, 0);
+	EXPECT_FRAME(&c, H2_HEADERS, H2_END_HEADERS, 1);
+	ASSERT_TRUE(!next_frame(&c, &type, &flags, &id, &payload, &len));
+
+	h2_conn_feed(&c.h2, H2_PREFACE, H2_PREFACE_LEN);
+	send_frame(&c, H2_SETTINGS, 0, 0, NULL, 0);
+	receive(&c);
+	EXPECT_FRAME(&c, H2_SETTINGS, H2_ACK, 0);
+	EXPECT_FRAME(&c, H2_DATA, H2_END_STREAM, 1);
+	ASSERT_EQ_INT(c.h2.num_streams, 0);
+	END_TEST(ctx, req);
+	client_free(&c);
+}
+
+/* a prior-knowledge request to a WebSocket route is sent elsewhere */
+static void test_h2_websocket_route(void) {
+	static const unsigned char get_echo[] = {
+		0x82, 0x86, 0x44, 0x05, '/', 'e', 'c', 'h', 'o', 0x41, 0x01, 'x'
+	};
+	struct h2_client c;
+	const unsigned char *payload;
+	int type, flags;
+	unsigned id;
+	size_t len;
+
+	client_init(&c, 0);
+	c.upgrading = 1;
+	h2_conn_feed(&c.h2, H2_PREFACE, H2_PREFACE_LEN);
+	send_frame(&c, H2_SETTINGS, 0, 0, NULL, 0);
+	send_frame(&c, H2_HEADERS, H2_END_STREAM | H2_END_HEADERS, 1, get_echo, sizeof get_echo);
+	ASSERT_EQ_INT(c.served, 1);
+	receive(&c);
+	expect_settled(&c);
+	EXPECT_FRAME(&c, H2_HEADERS, H2_END_STREAM | H2_END_HEADERS, 1);
+	/* :status 421 as a literal, with no body */
+	ASSERT_EQ_MEM(payload, 5, "\x08\x03" "421", 5);
+	ASSERT_TRUE(!next_frame(&c, &type, &flags, &id, &payload, &len));
+	ASSERT_EQ_INT(c.h2.num_streams, 0);
+	client_free(&c);
+}
+
+void run_h2_tests(void) {
+	RUN_TEST(test_h2_request);
+	RUN_TEST(test_h2_flow_control);
+	RUN_TEST(test_h2_ping_and_errors);
+	RUN_TEST(test_h2_upgrade);
+	RUN_TEST(test_h2_websocket_route);
+}
@@ -0,0 +1,215 @@
+#include "hpack.h"
+#include "test.h"
+
+/* the fields of a block, "name: value\n" each */
+struct collected {
+	char text[1024];
+	size_t len;
+};
+
+static void collect(void *ctx, struct slice name, struct slice value) {
+	struct collected *c = ctx;
+
+	ASSERT_TRUE(c->len + name.len + value.len + 3 <= sizeof c->text);
+	memcpy(c->text + c->len, name.ptr, name.len);
+	c->len += name.len;
+	memcpy(c->text + c->len, ": ", 2);
+	c->len += 2;
+	memcpy(c->text + c->len, value.ptr, value.len);
+	c->len += value.len;
+	c->text[c->len++] = '\n';
+}
+
+static int decode(struct hpack_decoder *dec, const unsigned char *block, size_t len, struct collected *c) {
+	c->len = 0;
+	return hpack_decode(dec, block, len, collect, c);
+}
+
+#define ASSERT_COLLECTED(c, str) ASSERT_EQ_MEM((c).text, (c).len, str, sizeof str - 1)
+
+static void test_hpack_huffman(void) {
+	static const unsigned char host[] = {
+		0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff
+	};
+	static const unsigned char padded[] = {0xf1, 0xe3, 0xc7};
+	static const unsigned char zero_padded[] = {0xf1, 0xe3, 0xc0};
+	static const unsigned char long_padded[] = {0xf1, 0xff};
+	static const unsigned char eos[] = {0xff, 0xff, 0xff, 0xfc};
+	char out[sizeof host * 8 / 5 + 1];
+	long n;
+
+	/* RFC 7541 C.4.1 */
+	n = hpack_huffman_decode(host, sizeof host, out);
+	ASSERT_EQ_MEM(out, (size_t)n, "www.example.com", 15);
+	n = hpack_huffman_decode(host, 0, out);
+	ASSERT_EQ_INT(n, 0);
+
+	/* padding is the most significant bits of EOS, shorter than a byte */
+	n = hpack_huffman_decode(padded, sizeof padded, out);
+	ASSERT_EQ_MEM(out, (size_t)n, "www", 3);
+	n = hpack_huffman_decode(zero_padded, sizeof zero_padded, out);
+	ASSERT_EQ_INT(n, -1);
+	n = hpack_huffman_decode(long_padded, sizeof long_padded, out);
+	ASSERT_EQ_INT(n, -1);
+	n = hpack_huffman_decode(eos, sizeof eos, out);
+	ASSERT_EQ_INT(n, -1);
+}
+
+/* RFC 7541 C.4, requests sharing the dynamic table */
+static void test_hpack_requests(void) {
+	static const unsigned char first[] = {
+		0x82, 0x86, 0x84, 0x41, 0x8c, 0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a, 0x6b,
+		0xa0, 0xab, 0x90, 0xf4, 0xff
+	};
+	static const unsigned char second[] = {
+		0x82, 0x86, 0x84, 0xbe, 0x58, 0x86, 0xa8, 0xeb, 0x10, 0x64, 0x9c, 0xbf
+	};
+	static const unsigned char third[] = {
+		0x82, 0x87, 0x85, 0xbf, 0x40, 0x88, 0x25, 0xa8, 0x49, 0xe9, 0x5b, 0xa9,
+		0x7d, 0x7f, 0x89, 0x25, 0xa8, 0x49, 0xe9, 0x5b, 0xb8, 0xe8, 0xb4, 0xbf
+	};
+	struct hpack_decoder dec;
+	struct collected c;
+	int ret;
+
+	hpack_decoder_init(&dec);
+	ret = decode(&dec, first, sizeof first, &c);
+	ASSERT_EQ_INT(ret, 0);
+	ASSERT_COLLECTED(c,
+		":method: GET\n"
+		":scheme: http\n"
+		":path: /\n"
+		":authority: www.example.com\n");
+	ASSERT_EQ_INT(dec.table.size, 57);
+
+	ret = decode(&dec, second, sizeof second, &c);
+	ASSERT_EQ_INT(ret, 0);
+	ASSERT_COLLECTED(c,
+		":method: GET\n"
+		":scheme: http\n"
+		":path: /\n"
+		":authority: www.example.com\n"
+		"cache-control: no-cache\n");
+	ASSERT_EQ_INT(dec.table.size, 110);
+
+	ret = decode(&dec, third, sizeof third, &c);
+	ASSERT_EQ_INT(ret, 0);
+	ASSERT_COLLECTED(c,
+		":method: GET\n"
+		":scheme: https\n"
+		":path: /index.html\n"
+		":authority: www.example.com\n"
+		"custom-key: custom-value\n");
+	ASSERT_EQ_INT(dec.table.size, 164);
+	ASSERT_EQ_INT(dec.table.count, 3);
+	hpack_decoder_free(&dec);
+}
+
+/* RFC 7541 C.5, in a table the encoder shrinks to 256 bytes */
+static void test_hpack_eviction(void) {
+	static const unsigned char first[] = {
+		0x3f, 0xe1, 0x01, /* size update to 256 */
+		0x48, 0x03, 0x33, 0x30, 0x32, 0x58, 0x07, 0x70, 0x72, 0x69, 0x76, 0x61,
+		0x74, 0x65, 0x61, 0x1d, 0x4d, 0x6f, 0x6e, 0x2c, 0x20, 0x32, 0x31, 0x20,
+		0x4f, 0x63, 0x74, 0x20, 0x32, 0x30, 0x31, 0x33, 0x20, 0x32, 0x30, 0x3a,
+		0x31, 0x33, 0x3a, 0x32, 0x31, 0x20, 0x47, 0x4d, 0x54, 0x6e, 0x17, 0x68,
+		0x74, 0x74, 0x70, 0x73, 0x3a, 0x2f, 0x2f, 0x77, 0x77, 0x77, 0x2e, 0x65,
+		0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x2e, 0x63, 0x6f, 0x6d
+	};
+	static const unsigned char second[] = {0x48, 0x03, 0x33, 0x30, 0x37, 0xc1, 0xc0, 0xbf};
+	struct hpack_decoder dec;
+	struct collected c;
+	int ret;
+
+	hpack_decoder_init(&dec);
+	ret = decode(&dec, first, sizeof first, &c);
+	ASSERT_EQ_INT(ret, 0);
+	ASSERT_COLLECTED(c,
+		":status: 302\n"
+		"cache-control: private\n"
+		"date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+		"location: https://www.example.com\n");
+	ASSERT_EQ_INT(dec.table.size, 222);
+
+	/* ":status: 302" makes room for ":status: 307" */
+	ret = decode(&dec, second, sizeof second, &c);
+	ASSERT_EQ_INT(ret, 0);
+	ASSERT_COLLECTED(c,
+		":status: 307\n"
+		"cache-control: private\n"
+		"date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+		"location: https://www.example.com\n");
+	ASSERT_EQ_INT(dec.table.size, 222);
+	ASSERT_EQ_INT(dec.table.count, 4);
+	hpack_decoder_free(&dec);
+}
+
+static void test_hpack_malformed(void) {
+	static const unsigned char index_zero[] = {0x80};
+	static const unsigned char past_table[] = {0xbe};
+	static const unsigned char too_large[] = {0x3f, 0xe2, 0x1f}; /* 4097 */
+	static const unsigned char late_update[] = {0x82, 0x20};
+	static const unsigned char short_string[] = {0x40, 0x03, 'a', 'b'};
+	static const unsigned char long_int[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01};
+	struct hpack_decoder dec;
+	struct collected c;
+	int ret;
+
+	hpack_decoder_init(&dec);
+	ret = decode(&dec, index_zero, sizeof index_zero, &c);
+	ASSERT_EQ_INT(ret, -1);
+	ret = decode(&dec, past_table, sizeof past_table, &c);
+	ASSERT_EQ_INT(ret, -1);
+	ret = decode(&dec, too_large, sizeof too_large, &c);
+	ASSERT_EQ_INT(ret, -1);
+	ret = decode(&dec, late_update, sizeof late_update, &c);
+	ASSERT_EQ_INT(ret, -1);
+	ret = decode(&dec, short_string, sizeof short_string, &c);
+	ASSERT_EQ_INT(ret, -1);
+	ret = decode(&dec, long_int, sizeof long_int, &c);
+	ASSERT_EQ_INT(ret, -1);
+	hpack_decoder_free(&dec);
+}
+
+static void test_hpack_encode(void) {
+	unsigned char out[64];
+	struct hpack_decoder dec;
+	struct collected c;
+	size_t n;
+	int ret;
+
+	/* RFC 7541 C.1 */
+	n = hpack_encode_int(out, 0, 5, 10);
+	ASSERT_EQ_MEM(out, n, "\x0a", 1);
+	n = hpack_encode_int(out, 0, 5, 1337);
+	ASSERT_EQ_MEM(out, n, "\x1f\x9a\x0a", 3);
+	n = hpack_encode_int(out, 0x80, 7, 8);
+	ASSERT_EQ_MEM(out, n, "\x88", 1);
+
+	n = hpack_encode_status(out, 404);
+	ASSERT_EQ_MEM(out, n, "\x8d", 1);
+	n = hpack_encode_status(out, 302);
+	ASSERT_EQ_MEM(out, n, "\x08\x03" "302", 5);
+
+	/* what is encoded decodes back, the table untouched */
+	hpack_decoder_init(&dec);
+	n = hpack_encode_status(out, 200);
+	n += hpack_encode_field(out + n, "Content-Type", 12, "text/html", 9);
+	n += hpack_encode_field(out + n, "X-Served-By", 11, "aster", 5);
+	ret = decode(&dec, out, n, &c);
+	ASSERT_EQ_INT(ret, 0);
+	ASSERT_COLLECTED(c,
+		":status: 200\n"
+		"content-type: text/html\n"
+		"x-served-by: aster\n");
+	ASSERT_EQ_INT(dec.table.count, 0);
+	hpack_decoder_free(&dec);
+}
+
+void run_hpack_tests(void) {
+	RUN_TEST(test_hpack_huffman);
+	RUN_TEST(test_hpack_requests);
+	RUN_TEST(test_hpack_eviction);
+	RUN_TEST(test_hpack_malformed);
+	RUN_TEST(test_hpack_encode);
+}
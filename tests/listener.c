@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "listener.h"
+#include "test.h"
+
+/* connect to an open listener and have it accept, 0 if it went through */
+static int round_trip(struct listener *l) {
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof addr;
+	int client, server;
+	char byte = 'x';
+
+	ASSERT_EQ_INT(getsockname(l->src.fd, (void *)&addr, &len), 0);
+	client = socket(addr.ss_family, SOCK_STREAM, 0);
+	ASSERT_TRUE(client != -1);
+	ASSERT_EQ_INT(connect(client, (void *)&addr, len), 0);
+	server = accept(l->src.fd, NULL, NULL);
+	ASSERT_TRUE(server != -1);
+	ASSERT_EQ_INT(write(client, &byte, 1), 1);
+	byte = 0;
+	ASSERT_EQ_INT(read(server, &byte, 1), 1);
+	close(client);
+	close(server);
+	return byte == 'x' ? 0 : -1;
+}
+
+static void test_listener_names(void) {
+	struct listener l;
+	struct sockaddr_un un;
+	struct sockaddr_in in;
+	struct sockaddr_in6 in6;
+
+	ASSERT_EQ_INT(listener_init(&l, "unix:/run/aster.sock"), 0);
+	ASSERT_EQ_INT(l.addr.ss_family, AF_UNIX);
+	memcpy(&un, &l.addr, sizeof un);
+	ASSERT_TRUE(!strcmp(un.sun_path, "/run/aster.sock"));
+	ASSERT_EQ_INT(l.addr_len, offsetof(struct sockaddr_un, sun_path) + sizeof "/run/aster.sock");
+
+	/* abstract, its name counted exactly */
+	ASSERT_EQ_INT(listener_init(&l, "unix:@aster"), 0);
+	memcpy(&un, &l.addr, sizeof un);
+	ASSERT_EQ_INT(un.sun_path[0], '\0');
+	ASSERT_EQ_MEM(un.sun_path + 1, 5, "aster", 5);
+	ASSERT_EQ_INT(l.addr_len, offsetof(struct sockaddr_un, sun_path) + 6);
+
+	ASSERT_EQ_INT(listener_init(&l, "127.0.0.1:8080"), 0);
+	ASSERT_EQ_INT(l.addr.ss_family, AF_INET);
+	memcpy(&in, &l.addr, sizeof in);
+	ASSERT_EQ_INT(ntohs(in.sin_port), 8080);
+	ASSERT_EQ_INT(ntohl(in.sin_addr.s_addr), INADDR_LOOPBACK);
+
+	/* a port alone is every IPv4 address */
+	ASSERT_EQ_INT(listener_init(&l, "8080"), 0);
+	ASSERT_EQ_INT(l.addr.ss_family, AF_INET);
+	memcpy(&in, &l.addr, sizeof in);
+	ASSERT_EQ_INT(ntohs(in.sin_port), 8080);
+	ASSERT_EQ_INT(in.sin_addr.s_addr, htonl(INADDR_ANY));
+
+	ASSERT_EQ_INT(listener_init(&l, "[::1]:8443"), 0);
+	ASSERT_EQ_INT(l.addr.ss_family, AF_INET6);
+	memcpy(&in6, &l.addr, sizeof in6);
+	ASSERT_EQ_INT(ntohs(in6.sin6_port), 8443);
+	ASSERT_TRUE(!memcmp(&in6.sin6_addr, &in6addr_loopback, sizeof in6addr_loopback));
+
+	ASSERT_EQ_INT(listener_init(&l, "unix:"), -1);
+	ASSERT_EQ_INT(listener_init(&l, "unix:@"), -1);
+	ASSERT_EQ_INT(listener_init(&l, "127.0.0.1:"), -1);
+	ASSERT_EQ_INT(listener_init(&l, ":80"), -1);
+	ASSERT_EQ_INT(listener_init(&l, "[]:80"), -1);
+}
+
+static void test_listener_tcp(void) {
+	struct listener v4, v6;
+
+	ASSERT_EQ_INT(listener_init(&v4, "127.0.0.1:0"), 0);
+	ASSERT_EQ_INT(listener_open(&v4), 0);
+	ASSERT_TRUE(fcntl(v4.src.fd, F_GETFL) & O_NONBLOCK);
+	ASSERT_EQ_INT(round_trip(&v4), 0);
+
+	/* hosts without IPv6 are left alone */
+	ASSERT_EQ_INT(listener_init(&v6, "[::1]:0"), 0);
+	if (listener_open(&v6) == 0) {
+		ASSERT_EQ_INT(round_trip(&v6), 0);
+		listener_close(&v6);
+	} else {
+		ASSERT_TRUE(errno == EAFNOSUPPORT || errno == EADDRNOTAVAIL);
+	}
+	listener_close(&v4);
+	ASSERT_EQ_INT(v4.src.fd, -1);
+}
+
+static void test_listener_unix(void) {
+	struct listener l, abstract;
+	char path[64], name[64];
+	struct stat st;
+	int fd;
+
+	sprintf(path, "unix:/tmp/aster-listener-%ld.sock", (long)getpid());
+	ASSERT_EQ_INT(listener_init(&l, path), 0);
+	ASSERT_EQ_INT(listener_open(&l), 0);
+	ASSERT_EQ_INT(round_trip(&l), 0);
+	listener_close(&l);
+
+	/* the socket a previous run left is replaced */
+	ASSERT_EQ_INT(stat(path + 5, &st), 0);
+	ASSERT_EQ_INT(listener_open(&l), 0);
+	ASSERT_EQ_INT(round_trip(&l), 0);
+	listener_close(&l);
+
+	/* but not a file */
+	unlink(path + 5);
+	fd = open(path + 5, O_CREAT | O_WRONLY, 0600);
+	ASSERT_TRUE(fd != -1);
+	close(fd);
+	ASSERT_EQ_INT(listener_open(&l), -1);
+	ASSERT_EQ_INT(errno, EADDRINUSE);
+	unlink(path + 5);
+
+	/* nothing in the filesystem */
+	sprintf(name, "unix:@aster-listener-%ld", (long)getpid());
+	ASSERT_EQ_INT(listener_init(&abstract, name), 0);
+	ASSERT_EQ_INT(listener_open(&abstract), 0);
+	ASSERT_EQ_INT(round_trip(&abstract), 0);
+	ASSERT_EQ_INT(listener_open(&abstract), -1);
+	ASSERT_EQ_INT(errno, EADDRINUSE);
+	listener_close(&abstract);
+}
+
+void run_listener_tests(void) {
+	RUN_TEST(test_listener_names);
+	RUN_TEST(test_listener_tcp);
+	RUN_TEST(test_listener_unix);
+}
@@ -0,0 +1,66 @@
+#include "test.h"
+#include "lru.h"
+
+struct item {
+	int value;
+	struct lru_node node;
+};
+
+static int tail_value(const struct lru_table *t) {
+	return LRU_ENTRY(t->lru_tail, struct item, node)->value;
+}
+
+static void test_lru_order(void) {
+	struct lru_table t;
+	struct item items[3];
+	struct lru_node *node;
+	int i, found = 0;
+
+	lru_init(&t, 3);
+	for (i = 0; i < 3; ++i) {
+		items[i].value = i;
+		/* 0 and 16 share a chain among 16 buckets or more */
+		lru_insert(&t, &items[i].node, (uint32_t)(i == 2 ? 16 : i));
+	}
+	ASSERT_EQ_INT(t.count, 3);
+	ASSERT_EQ_INT(tail_value(&t), 0);
+
+	for (node = lru_bucket(&t, 16); node != NULL; node = node->chain_next) {
+		if (node->hash == 16) found = LRU_ENTRY(node, struct item, node)->value;
+	}
+	ASSERT_EQ_INT(found, 2);
+
+	lru_touch(&t, &items[0].node);
+	ASSERT_EQ_INT(tail_value(&t), 1);
+	ASSERT_TRUE(t.lru_head == &items[0].node);
+
+	lru_remove(&t, &items[1].node);
+	ASSERT_EQ_INT(tail_value(&t), 2);
+	lru_remove(&t, &items[2].node);
+	ASSERT_TRUE(lru_bucket(&t, 0) == &items[0].node);
+	ASSERT_TRUE(items[0].node.chain_next == NULL);
+	lru_remove(&t, &items[0].node);
+	ASSERT_EQ_INT(t.count, 0);
+	ASSERT_TRUE(t.lru_head == NULL && t.lru_tail == NULL);
+
+	lru_free(&t);
+}
+
+static void test_lru_free_list(void) {
+	struct lru_table t;
+	struct item items[2];
+
+	lru_init(&t, 2);
+	ASSERT_TRUE(lru_take_free(&t) == NULL);
+	lru_put_free(&t, &items[1].node);
+	lru_put_free(&t, &items[0].node);
+	ASSERT_TRUE(lru_take_free(&t) == &items[0].node);
+	ASSERT_TRUE(lru_take_free(&t) == &items[1].node);
+	ASSERT_TRUE(lru_take_free(&t) == NULL);
+	lru_free(&t);
+}
+
+void run_lru_tests(void) {
+	RUN_TEST(test_lru_order);
+	RUN_TEST(test_lru_free_list);
+}
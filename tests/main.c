@@ -0,0 +1,37 @@
+#include "test.h"
+
+int main(void) {
+	run_parser_tests();
+	run_path_tests();
+	run_fdcache_tests();
+	run_negcache_tests();
+	run_encoding_tests();
+	run_deflate_tests();
+	run_zcache_tests();
+	run_range_tests();
+	run_datetime_tests();
+	run_conditional_tests();
+	run_router_tests();
+	run_vhost_tests();
+	run_embedded_tests();
+	run_readahead_tests();
+	run_zerocopy_tests();
+	run_outq_tests();
+	run_evloop_tests();
+	run_stream_tests();
+	run_proxy_tests();
+	run_balancer_tests();
+	run_pcache_tests();
+	run_tunnel_tests();
+	run_fastcgi_tests();
+	run_hpack_tests();
+	run_h2_tests();
+	run_sha1_tests();
+	run_ws_tests();
+	run_response_tests();
+	run_listener_tests();
+	run_acl_tests();
+	run_resolver_tests();
+	run_lru_tests();
+	return 0;
+}
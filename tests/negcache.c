@@ -0,0 +1,79 @@
+#include "test.h"
+#include "negcache.h"
+#include "str.h"
+
+static size_t removed_watches;
+
+static void count_removal(void *data, size_t watch) {
+	(void)data;
+	(void)watch;
+	removed_watches++;
+}
+
+static int contains(struct neg_cache *cache, const char *key) {
+	size_t len = strlen(key);
+	return neg_cache_contains(cache, key, len, hash_bytes(key, len, HASH_SEED));
+}
+
+static void insert(struct neg_cache *cache, const char *key, size_t watch) {
+	size_t len = strlen(key);
+	neg_cache_insert(cache, key, len, hash_bytes(key, len, HASH_SEED), watch);
+}
+
+static void test_negcache_lru(void) {
+	struct neg_cache cache;
+
+	removed_watches = 0;
+	neg_cache_init(&cache, 2, count_removal, NULL);
+
+	ASSERT_TRUE(!contains(&cache, "a"));
+	ASSERT_EQ_INT(cache.stats.bloom_skips, 1);
+
+	insert(&cache, "a", 0);
+	insert(&cache, "b", 0);
+	ASSERT_TRUE(contains(&cache, "a"));
+	insert(&cache, "c", 0); /* evicts "b", "a" was touched last */
+	ASSERT_TRUE(contains(&cache, "a"));
+	ASSERT_TRUE(!contains(&cache, "b"));
+	ASSERT_TRUE(contains(&cache, "c"));
+	ASSERT_EQ_INT(removed_watches, 1);
+
+	neg_cache_clear(&cache);
+	ASSERT_TRUE(!contains(&cache, "a"));
+	ASSERT_TRUE(!contains(&cache, "c"));
+	ASSERT_EQ_INT(removed_watches, 3);
+
+	neg_cache_free(&cache);
+}
+
+static void test_negcache_invalidate(void) {
+	struct neg_cache cache;
+
+	removed_watches = 0;
+	neg_cache_init(&cache, 16, count_removal, NULL);
+
+	insert(&cache, "docs", 1);
+	insert(&cache, "docs/a/b.html", 1);
+	insert(&cache, "docs/ab", 1);
+	insert(&cache, "img/x.png", 2);
+	insert(&cache, "docs/a/c", 3); /* watched elsewhere, left alone */
+
+	/* "docs/a" created inside "docs" */
+	neg_cache_invalidate_path(&cache, 1, "docs", 4, "docs/a", 6);
+	ASSERT_TRUE(!contains(&cache, "docs"));
+	ASSERT_TRUE(!contains(&cache, "docs/a/b.html"));
+	ASSERT_TRUE(contains(&cache, "docs/ab"));
+	ASSERT_TRUE(contains(&cache, "docs/a/c"));
+
+	neg_cache_invalidate_watch(&cache, 2);
+	ASSERT_TRUE(!contains(&cache, "img/x.png"));
+	ASSERT_TRUE(contains(&cache, "docs/ab"));
+	ASSERT_EQ_INT(removed_watches, 3);
+
+	neg_cache_free(&cache);
+}
+
+void run_negcache_tests(void) {
+	RUN_TEST(test_negcache_lru);
+	RUN_TEST(test_negcache_invalidate);
+}
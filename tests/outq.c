@@ -0,0 +1,313 @@
+#define _XOPEN_SOURCE 500
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "outq.h"
+#include "test.h"
+
+#define BIG (256 << 10)
+
+static char expect[3 * BIG];
+static char got[3 * BIG];
+
+/* read what is available without blocking */
+static size_t drain(int fd, size_t total) {
+	ssize_t n;
+	while (total < sizeof got && (n = read(fd, got + total, sizeof got - total)) > 0) {
+		total += (size_t)n;
+	}
+	return total;
+}
+
+static void test_outq_partial_writes(void) {
+	struct outq q;
+	struct zerocopy zc;
+	struct zc_socket s;
+	struct http_response resp = new_response();
+	struct blob *blob;
+	unsigned char *mem = malloc(BIG);
+	char path[] = "/tmp/aster-outq-XXXXXX";
+	int fds[2], file_fd, small = 4096;
+	size_t i, total = 0, len = 0;
+	enum outq_status status;
+
+	ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof small);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	for (i = 0; i < BIG; ++i) mem[i] = (unsigned char)(i * 7);
+	blob = blob_new(mem, BIG);
+	file_fd = mkstemp(path);
+	ASSERT_TRUE(file_fd != -1);
+	unlink(path);
+	for (i = 0; i < BIG; ++i) expect[i] = (char)(i % 251);
+	ASSERT_EQ_INT(write(file_fd, expect, BIG), BIG);
+
+	/* head, a file range, a blob range and a trailer from buf */
+	append_to_response(&resp, "HEAD");
+	add_body_part(&resp, BP_FILE, 10, BIG - 10);
+	resp.body_fd = file_fd;
+	add_body_part(&resp, BP_MEM, 0, BIG);
+	resp.body_mem = mem;
+	resp.body_blob = blob;
+	add_body_buf(&resp, "TAIL", 4);
+
+	memcpy(expect + len, "HEAD", 4);
+	len += 4;
+	for (i = 10; i < BIG; ++i) expect[len++] = (char)(i % 251);
+	memcpy(expect + len, mem, BIG);
+	len += BIG;
+	memcpy(expect + len, "TAIL", 4);
+	len += 4;
+
+	outq_init(&q);
+	zerocopy_init(&zc, 0);
+	zc_socket_init(&s, fds[0]);
+	ASSERT_EQ_INT(outq_push_response(&q, &resp), 0);
+
+	/* the queue keeps what it needs once its owners let go */
+	close(file_fd);
+	blob_unref(blob);
+
+	while ((status = outq_flush(&q, &zc, &s)) == OUTQ_AGAIN) {
+		ASSERT_TRUE(q.bytes > 0);
+		total = drain(fds[1], total);
+	}
+	ASSERT_EQ_INT(status, OUTQ_DONE);
+	ASSERT_EQ_INT(q.bytes, 0);
+	total = drain(fds[1], total);
+	ASSERT_EQ_MEM(got, total, expect, len);
+
+	outq_free(&q);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+static void test_outq_peer_gone(void) {
+	struct outq q;
+	struct zerocopy zc;
+	struct zc_socket s;
+	int fds[2];
+
+	ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	close(fds[1]);
+	outq_init(&q);
+	zerocopy_init(&zc, 0);
+	zc_socket_init(&s, fds[0]);
+	outq_push_mem(&q, "lost", 4, NULL, NULL);
+	ASSERT_EQ_INT(outq_flush(&q, &zc, &s), OUTQ_ERROR);
+	outq_free(&q);
+	close(fds[0]);
+
+	/* nothing queued is done already */
+	outq_init(&q);
+	ASSERT_EQ_INT(outq_flush(&q, &zc, &s), OUTQ_DONE);
+	outq_free(&q);
+}
+
+/* a queue framed out of another, segments split where the frames end */
+static void test_outq_move(void) {
+	struct outq src, dst;
+	struct zerocopy zc;
+	struct zc_socket s;
+	char path[] = "/tmp/aster-outq-XXXXXX";
+	char *owned = malloc(6);
+	int fds[2], file_fd;
+	size_t moved, total;
+
+	ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	file_fd = mkstemp(path);
+	ASSERT_TRUE(file_fd != -1);
+	unlink(path);
+	ASSERT_EQ_INT(write(file_fd, "0123456789", 10), 10);
+
+	memcpy(owned, "abcdef", 6);
+	outq_init(&src);
+	outq_init(&dst);
+	outq_push_mem(&src, owned, 6, owned, NULL);
+	ASSERT_EQ_INT(outq_push_file(&src, file_fd, 2, 6), 0);
+	close(file_fd);
+	outq_push_mem(&src, "XYZ", 3, NULL, NULL);
+
+	/* each part of a split segment keeps what it points into */
+	moved = outq_move(&dst, &src, 4);
+	ASSERT_EQ_INT(moved, 4);
+	outq_push_mem(&dst, "|", 1, NULL, NULL);
+	moved = outq_move(&dst, &src, 5);
+	ASSERT_EQ_INT(moved, 5);
+	outq_push_mem(&dst, "|", 1, NULL, NULL);
+	ASSERT_EQ_INT(src.bytes, 6);
+	outq_free(&src);
+
+	zerocopy_init(&zc, 0);
+	zc_socket_init(&s, fds[0]);
+	ASSERT_EQ_INT(outq_flush(&dst, &zc, &s), OUTQ_DONE);
+	total = drain(fds[1], 0);
+	ASSERT_EQ_MEM(got, total, "abcd|ef234|", 11);
+
+	/* an emptied queue lets go of its ring and takes more after */
+	outq_shrink(&dst);
+	ASSERT_TRUE(dst.segs == NULL);
+	outq_push_mem(&dst, "XYZ", 3, NULL, NULL);
+	ASSERT_EQ_INT(outq_flush(&dst, &zc, &s), OUTQ_DONE);
+	total = drain(fds[1], 0);
+	ASSERT_EQ_MEM(got, total, "XYZ", 3);
+
+	outq_free(&dst);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+/* a large file keeps hinting the page cache as sendfile() moves through
+   it, and drops what it sent once cold and no longer queued */
+static void test_outq_pages(void) {
+	struct outq q;
+	struct zerocopy zc;
+	struct zc_socket s;
+	struct ra_stats stats = {0};
+	struct http_response resp = new_response();
+	char path[] = "/tmp/aster-outq-XXXXXX";
+	int fds[2], file_fd, small = 4096;
+	size_t size = 2 * RA_MIN_FILE, total = 0;
+	enum outq_status status;
+	ssize_t n;
+
+	ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof small);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	file_fd = mkstemp(path);
+	ASSERT_TRUE(file_fd != -1);
+	unlink(path);
+	ASSERT_EQ_INT(ftruncate(file_fd, (off_t)size), 0);
+
+	append_to_response(&resp, "HEAD");
+	add_body_part(&resp, BP_FILE, 0, size);
+	resp.body_fd = file_fd;
+	resp.body_pages = ra_file_new(size, &stats);
+	resp.body_pages->cold = 1;
+
+	outq_init(&q);
+	zerocopy_init(&zc, 0);
+	zc_socket_init(&s, fds[0]);
+	ASSERT_EQ_INT(outq_push_response(&q, &resp), 0);
+	ra_file_unref(resp.body_pages, file_fd);
+	close(file_fd);
+
+	while ((status = outq_flush(&q, &zc, &s)) == OUTQ_AGAIN) {
+		while ((n = read(fds[1], got, sizeof got)) > 0) total += (size_t)n;
+	}
+	ASSERT_EQ_INT(status, OUTQ_DONE);
+	while ((n = read(fds[1], got, sizeof got)) > 0) total += (size_t)n;
+	ASSERT_EQ_INT(total, size + 4);
+
+	/* windows growing ahead, each hinted once */
+	ASSERT_TRUE(stats.readaheads > 2);
+	ASSERT_TRUE(stats.prefetched >= size && stats.prefetched < size + RA_MAX_WINDOW);
+	ASSERT_EQ_INT(stats.dontneeds, 1);
+
+	outq_free(&q);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+/* a connected pair over TCP loopback, the first end non-blocking */
+static void tcp_pair(int fds[2]) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof addr;
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	ASSERT_EQ_INT(bind(listener, (void *)&addr, sizeof addr), 0);
+	ASSERT_EQ_INT(listen(listener, 1), 0);
+	ASSERT_EQ_INT(getsockname(listener, (void *)&addr, &len), 0);
+	fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_EQ_INT(connect(fds[0], (void *)&addr, len), 0);
+	fds[1] = accept(listener, NULL, NULL);
+	ASSERT_TRUE(fds[1] != -1);
+	close(listener);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+}
+
+/* send `len` bytes of memory the queue owns, what a connection does
+   before it reaps: the bytes sent with MSG_ZEROCOPY */
+static size_t send_owned(struct outq *q, struct zerocopy *zc, struct zc_socket *s, int peer, size_t len) {
+	char *mem = malloc(len);
+	enum outq_status status;
+	size_t i, total = 0;
+
+	for (i = 0; i < len; ++i) mem[i] = (char)(i % 253);
+	outq_push_mem(q, mem, len, mem, NULL);
+	while ((status = outq_flush(q, zc, s)) == OUTQ_AGAIN) total = drain(peer, total);
+	ASSERT_EQ_INT(status, OUTQ_DONE);
+	total = drain(peer, total);
+	ASSERT_EQ_INT(total, len);
+	for (i = 0; i < len; ++i) ASSERT_EQ_INT(got[i], (char)(i % 253));
+	return zc->stats.bytes;
+}
+
+/* large memory goes out with MSG_ZEROCOPY and stays pinned until the
+   kernel reports it done on the error queue, as CS_REAPING waits for */
+static void test_outq_zerocopy(void) {
+	struct outq q;
+	struct zerocopy zc;
+	struct zc_socket s;
+	struct pollfd pfd;
+	int fds[2];
+
+	tcp_pair(fds);
+	outq_init(&q);
+	zerocopy_init(&zc, 1);
+	zc_socket_init(&s, fds[0]);
+	if (send_owned(&q, &zc, &s, fds[1], BIG) > 0) {
+		ASSERT_EQ_INT(s.armed, 1);
+		ASSERT_TRUE(s.sent > 0);
+		ASSERT_EQ_INT(q.num_pins, 1);
+		while (s.done != s.sent) {
+			/* completions raise POLLERR, with nothing else asked for */
+			pfd.fd = fds[0];
+			pfd.events = 0;
+			ASSERT_EQ_INT(poll(&pfd, 1, 5000), 1);
+			ASSERT_TRUE(pfd.revents & POLLERR);
+			ASSERT_TRUE(zc_poll(&zc, &s) != -1);
+		}
+		ASSERT_EQ_INT(zc.stats.completions, s.sent);
+	}
+	outq_unpin(&q);
+	ASSERT_EQ_INT(q.num_pins, 0);
+	outq_free(&q);
+	close(fds[0]);
+	close(fds[1]);
+
+	/* Unix sockets refuse SO_ZEROCOPY: nothing pinned, nothing to reap */
+	ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	outq_init(&q);
+	zerocopy_init(&zc, 1);
+	zc_socket_init(&s, fds[0]);
+	ASSERT_EQ_INT(send_owned(&q, &zc, &s, fds[1], BIG), 0);
+	ASSERT_EQ_INT(s.armed, -1);
+	ASSERT_EQ_INT(s.sent, s.done);
+	ASSERT_EQ_INT(q.num_pins, 0);
+	outq_free(&q);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+void run_outq_tests(void) {
+	RUN_TEST(test_outq_partial_writes);
+	RUN_TEST(test_outq_peer_gone);
+	RUN_TEST(test_outq_move);
+	RUN_TEST(test_outq_pages);
+	RUN_TEST(test_outq_zerocopy);
+}
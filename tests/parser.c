@@ -48,6 +48,64 @@ static void test_get_absolute(void) {
 	END_TEST(ctx, req);
 }
 
+static void test_connect_authority(void) {
+	const char *raw_req = RL11("CONNECT", "ex.com:443") HOST("ex.com:443") END;
+	struct http_request req;
+	struct parse_ctx ctx;
+
+	ASSERT_TRUE(parse_ok(raw_req, &req, &ctx) == 0);
+	assert_req_line(&req, HM_CONNECT, 1, 1, 1);
+	assert_target_authority(&req, "ex.com:443", "ex.com", 443);
+	END_TEST(ctx, req);
+
+	ASSERT_TRUE(parse_ok(RL11("CONNECT", "[::1]:8443") HOST("[::1]:8443") END, &req, &ctx) == 0);
+	assert_target_authority(&req, "[::1]:8443", "[::1]", 8443);
+	END_TEST(ctx, req);
+
+	/* the port is required, and only authority-form goes with CONNECT */
+	ASSERT_TRUE(parse_err(RL11("CONNECT", "ex.com") HOST("ex.com") END, &req, &ctx) == 0);
+	END_TEST(ctx, req);
+	ASSERT_TRUE(parse_err(RL11("CONNECT", "ex.com:") HOST("ex.com") END, &req, &ctx) == 0);
+	END_TEST(ctx, req);
+	ASSERT_TRUE(parse_err(RL11("CONNECT", "ex.com:65536") HOST("ex.com") END, &req, &ctx) == 0);
+	END_TEST(ctx, req);
+	ASSERT_TRUE(parse_err(RL11("CONNECT", ":443") HOST("ex.com") END, &req, &ctx) == 0);
+	END_TEST(ctx, req);
+	ASSERT_TRUE(parse_err(RL11("CONNECT", "[]:443") HOST("ex.com") END, &req, &ctx) == 0);
+	END_TEST(ctx, req);
+	ASSERT_TRUE(parse_err(RL11("CONNECT", "http://ex.com:443/") HOST("ex.com") END, &req, &ctx) == 0);
+	END_TEST(ctx, req);
+	ASSERT_TRUE(parse_err(RL11("CONNECT", "/") HOST("ex.com") END, &req, &ctx) == 0);
+	END_TEST(ctx, req);
+	ASSERT_TRUE(parse_err(RL11("CONNECT", "*") HOST("ex.com") END, &req, &ctx) == 0);
+	END_TEST(ctx, req);
+	ASSERT_TRUE(parse_err(RL11("GET", "ex.com:443") HOST("ex.com") END, &req, &ctx) == 0);
+	END_TEST(ctx, req);
+}
+
+/* the read may end right before the space after the target */
+static void test_split_after_target(void) {
+	struct http_request req = new_request();
+	struct parse_ctx ctx = parse_ctx_init(&req);
+	enum parse_result res;
+
+	res = feed(&ctx, "GET http://ex.com/a", 19);
+	ASSERT_EQ_INT(res, PR_NEED_MORE);
+	feed(&ctx, " HTTP/1.1" CRLF HOST("ex.com") END, strlen(" HTTP/1.1" CRLF HOST("ex.com") END));
+	ASSERT_EQ_INT(ctx.state, PS_DONE);
+	assert_target_absolute(&req, "http://ex.com/a", "http", "ex.com", 0, "ex.com", "/a", "");
+	END_TEST(ctx, req);
+
+	req = new_request();
+	ctx = parse_ctx_init(&req);
+	res = feed(&ctx, "CONNECT ex.com:443", 18);
+	ASSERT_EQ_INT(res, PR_NEED_MORE);
+	feed(&ctx, " HTTP/1.1" CRLF HOST("ex.com:443") END, strlen(" HTTP/1.1" CRLF HOST("ex.com:443") END));
+	ASSERT_EQ_INT(ctx.state, PS_DONE);
+	assert_target_authority(&req, "ex.com:443", "ex.com", 443);
+	END_TEST(ctx, req);
+}
+
 static void test_curl_get(void) {
 	const char *raw_req =
 		"GET / HTTP/1.1" CRLF
@@ -130,13 +188,143 @@ static void test_get_one_header_no_body(void) {
 	END_TEST(ctx, req);
 }
 
-int main(void) {
+static void test_empty_header_value(void) {
+	const char *raw_req = RL11("GET", "/empty") \
+				H("Host", "a") H("X-Empty", "") H("X-Blank", "  ") END;
+	struct http_request req;
+	struct parse_ctx ctx;
+
+	ASSERT_TRUE(parse_ok(raw_req, &req, &ctx) == 0);
+	ASSERT_EQ_INT(req.num_headers, 3);
+	ASSERT_EQ_INT(req.headers[1].value.len, 0);
+	ASSERT_EQ_INT(req.headers[2].value.len, 0);
+
+	END_TEST(ctx, req);
+}
+
+static void test_expect_continue(void) {
+	struct http_request req;
+	struct parse_ctx ctx;
+
+	ASSERT_TRUE(parse_ok(RL11("POST", "/upload") HOST("a") H("Content-Length", "5")
+		H("Expect", "100-Continue") END, &req, &ctx) == 0);
+	ASSERT_TRUE(req.expect_100);
+	END_TEST(ctx, req);
+
+	/* unknown expectations are none of ours, 1.0 clients cannot mean it */
+	ASSERT_TRUE(parse_ok(RL11("POST", "/upload") HOST("a") H("Content-Length", "5")
+		H("Expect", "something-else") END, &req, &ctx) == 0);
+	ASSERT_TRUE(!req.expect_100);
+	END_TEST(ctx, req);
+	ASSERT_TRUE(parse_ok("POST /upload HTTP/1.0" CRLF HOST("a") H("Content-Length", "5")
+		H("Expect", "100-continue") END, &req, &ctx) == 0);
+	ASSERT_TRUE(!req.expect_100);
+	END_TEST(ctx, req);
+}
+
+static void test_keep_alive(void) {
+	struct http_request req;
+	struct parse_ctx ctx;
+
+	ASSERT_TRUE(parse_ok(RL11("GET", "/") HOST("a") END, &req, &ctx) == 0);
+	ASSERT_TRUE(req.keep_alive);
+	END_TEST(ctx, req);
+	ASSERT_TRUE(parse_ok(RL11("GET", "/") HOST("a") H("Connection", "close") END,
+		&req, &ctx) == 0);
+	ASSERT_TRUE(!req.keep_alive);
+	END_TEST(ctx, req);
+
+	/* HTTP/1.0 closes unless asked not to, close winning over keep-alive;
+	   it may leave out the Host */
+	ASSERT_TRUE(parse_ok("GET / HTTP/1.0" CRLF END, &req, &ctx) == 0);
+	ASSERT_TRUE(!req.keep_alive);
+	ASSERT_EQ_INT(req.host.len, 0);
+	END_TEST(ctx, req);
+	ASSERT_TRUE(parse_err(RL11("GET", "/") END, &req, &ctx) == 0);
+	END_TEST(ctx, req);
+	ASSERT_TRUE(parse_ok("GET / HTTP/1.0" CRLF HOST("a") H("Connection", "Keep-Alive") END,
+		&req, &ctx) == 0);
+	ASSERT_TRUE(req.keep_alive);
+	END_TEST(ctx, req);
+	ASSERT_TRUE(parse_ok("GET / HTTP/1.0" CRLF HOST("a") H("Connection", "keep-alive, close") END,
+		&req, &ctx) == 0);
+	ASSERT_TRUE(!req.keep_alive);
+	END_TEST(ctx, req);
+}
+
+/* the next request of a connection starts past the previous one's body */
+static void test_pipelined(void) {
+	const char *raw = RL11("POST", "/one") HOST("a") H("Content-Length", "3") END "abc"
+		RL11("GET", "/two") HOST("b") END "GET /th";
+	struct http_request req = new_request();
+	struct parse_ctx ctx = parse_ctx_init(&req);
+	enum parse_result res;
+
+	res = feed(&ctx, raw, strlen(raw));
+	ASSERT_EQ_INT(res, PR_COMPLETE);
+	assert_target_origin(&req, "/one", "/one", "");
+	ASSERT_EQ_INT(req.content_length, 3);
+
+	http_request_free(&req);
+	req = new_request();
+	parse_ctx_reset(&ctx, &req, ctx.pos + 3);
+	res = feed(&ctx, "", 0);
+	ASSERT_EQ_INT(res, PR_COMPLETE);
+	ASSERT_EQ_INT(ctx.state, PS_DONE);
+	assert_target_origin(&req, "/two", "/two", "");
+	ASSERT_EQ_HEADER(&req, HH_HOST, "b");
+
+	/* the last one is still coming */
+	http_request_free(&req);
+	req = new_request();
+	parse_ctx_reset(&ctx, &req, ctx.pos);
+	feed(&ctx, "", 0);
+	ASSERT_TRUE(ctx.state < PS_DONE);
+	res = feed(&ctx, "ree HTTP/1.1" CRLF HOST("c") END, strlen("ree HTTP/1.1" CRLF HOST("c") END));
+	ASSERT_EQ_INT(res, PR_COMPLETE);
+	assert_target_origin(&req, "/three", "/three", "");
+	ASSERT_EQ_HEADER(&req, HH_HOST, "c");
+
+	END_TEST(ctx, req);
+}
+
+/* slices stay valid when the buffer grows between reads */
+static void test_split_across_growth(void) {
+	struct http_request req = new_request();
+	struct parse_ctx ctx = parse_ctx_init(&req);
+	char filler[3000];
+
+	memset(filler, 'x', sizeof filler - 1);
+	filler[sizeof filler - 1] = '\0';
+	feed(&ctx, RL11("GET", "/grow") H("Host", "a"), strlen(RL11("GET", "/grow") H("Host", "a")));
+	feed(&ctx, "X-Filler: ", 10);
+	feed(&ctx, filler, strlen(filler));
+	ASSERT_TRUE(ctx.state < PS_DONE);
+	ASSERT_EQ_INT(feed(&ctx, "\r\n\r\n", 4), PR_COMPLETE);
+	ASSERT_EQ_INT(ctx.state, PS_DONE);
+
+	assert_target_origin(&req, "/grow", "/grow", "");
+	ASSERT_EQ_HEADER(&req, HH_HOST, "a");
+	ASSERT_TRUE(req.host.ptr == req.headers[0].value.ptr);
+	ASSERT_EQ_INT(req.headers[1].value.len, sizeof filler - 1);
+	ASSERT_TRUE(req.headers[1].value.ptr >= ctx.buf && req.headers[1].value.ptr < ctx.buf + ctx.len);
+
+	END_TEST(ctx, req);
+}
+
+void run_parser_tests(void) {
 	RUN_TEST(test_get_origin);
 	RUN_TEST(test_get_asterisk);
 	RUN_TEST(test_get_absolute);
+	RUN_TEST(test_connect_authority);
+	RUN_TEST(test_split_after_target);
 	RUN_TEST(test_curl_get);
 	RUN_TEST(test_firefox_get);
 	RUN_TEST(test_get_no_headers_no_body);
 	RUN_TEST(test_get_one_header_no_body);
-	return 0;
+	RUN_TEST(test_empty_header_value);
+	RUN_TEST(test_expect_continue);
+	RUN_TEST(test_keep_alive);
+	RUN_TEST(test_pipelined);
+	RUN_TEST(test_split_across_growth);
 }
@@ -0,0 +1,53 @@
+#include "test.h"
+#include "path.h"
+
+static void assert_key(const char *raw, const char *expect) {
+	char key[PATH_KEY_MAX];
+	struct slice path = get_slice(raw, strlen(raw));
+	int len = normalize_path(&path, key, sizeof key);
+
+	ASSERT_TRUE(len >= 0);
+	ASSERT_EQ_MEM(key, (size_t)len, expect, strlen(expect));
+}
+
+static void assert_no_key(const char *raw) {
+	char key[PATH_KEY_MAX];
+	struct slice path = get_slice(raw, strlen(raw));
+
+	ASSERT_EQ_INT(normalize_path(&path, key, sizeof key), -1);
+}
+
+static void test_path_plain(void) {
+	assert_key("/", "");
+	assert_key("/index.html", "index.html");
+	assert_key("/a/b/c.css", "a/b/c.css");
+	assert_key("/a/b/", "a/b");
+}
+
+static void test_path_slashes_and_dots(void) {
+	assert_key("//a///b", "a/b");
+	assert_key("/a/./b/.", "a/b");
+	assert_key("/a/b/../c", "a/c");
+	assert_key("/a/..", "");
+	assert_key("/..", "");
+	assert_key("/../../etc/passwd", "etc/passwd");
+	assert_key("/a/.../b", "a/.../b");
+	assert_key("/a/..b", "a/..b");
+}
+
+static void test_path_pct_encoding(void) {
+	assert_key("/hello%20world", "hello world");
+	assert_key("/%2e%2E/%2e/x", "x");
+	assert_key("/a/%2e%2e", "");
+	assert_no_key("/a%2fb");
+	assert_no_key("/a%00");
+	assert_no_key("/a%2");
+	assert_no_key("/a%zz");
+	assert_no_key("relative");
+}
+
+void run_path_tests(void) {
+	RUN_TEST(test_path_plain);
+	RUN_TEST(test_path_slashes_and_dots);
+	RUN_TEST(test_path_pct_encoding);
+}
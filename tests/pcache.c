@@ -0,0 +1,447 @@
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include "datetime.h"
+#include "pcache.h"
+#include "test.h"
+
+#define GET(target, fields) "GET " target " HTTP/1.1" CRLF "Host: h" CRLF fields CRLF
+#define HEAD200 "HTTP/1.1 200 OK" CRLF
+#define SLAB_BODY (300ul << 10)
+
+static char slab_body[SLAB_BODY];
+static char slab_read[SLAB_BODY];
+
+static struct pcache_entry *put_n(
+		struct pcache *cache,
+		const char *raw,
+		const char *head,
+		const char *body,
+		size_t body_len,
+		time_t at
+) {
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct pcache_entry *e;
+	size_t head_len = strlen(head);
+	char *data = malloc(head_len + body_len);
+
+	ASSERT_TRUE(data != NULL);
+	memcpy(data, head, head_len);
+	memcpy(data + head_len, body, body_len);
+	ASSERT_EQ_INT(parse_ok(raw, &req, &ctx), 0);
+	e = pcache_store(cache, &req, data, head_len, body_len, at, at);
+	END_TEST(ctx, req);
+	return e;
+}
+
+static struct pcache_entry *put(struct pcache *cache, const char *raw, const char *head, time_t at) {
+	return put_n(cache, raw, head, "hello", 5, at);
+}
+
+static enum pcache_result get(struct pcache *cache, const char *raw, time_t now) {
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct pcache_entry *e;
+	enum pcache_result result;
+
+	ASSERT_EQ_INT(parse_ok(raw, &req, &ctx), 0);
+	result = pcache_lookup(cache, &req, now, &e);
+	ASSERT_TRUE((result == PC_MISS) == (e == NULL));
+	END_TEST(ctx, req);
+	return result;
+}
+
+static int storable(const char *raw, const char *head) {
+	struct http_request req;
+	struct parse_ctx ctx;
+	int ret;
+
+	ASSERT_EQ_INT(parse_ok(raw, &req, &ctx), 0);
+	ret = pcache_storable(&req, head, strlen(head));
+	END_TEST(ctx, req);
+	return ret;
+}
+
+static void test_cache_control_parse(void) {
+	struct cache_control cc;
+	struct slice value;
+	const char *list;
+
+	cache_control_init(&cc);
+	list = "max-age=60, s-maxage=\"30\",no-cache=\"set-cookie, x\" ,Private";
+	value = get_slice(list, strlen(list));
+	cache_control_parse(&cc, &value);
+	ASSERT_EQ_INT(cc.max_age, 60);
+	ASSERT_EQ_INT(cc.s_maxage, 30);
+	ASSERT_EQ_INT(cc.stale_while_revalidate, -1);
+	ASSERT_EQ_INT(cc.no_cache, 1);
+	ASSERT_EQ_INT(cc.is_private, 1);
+	ASSERT_EQ_INT(cc.no_store, 0);
+	ASSERT_EQ_INT(cc.is_public, 0);
+
+	/* unknown and malformed directives are passed over */
+	cache_control_init(&cc);
+	list = "ext=\"a,b\", max-age=x1, proxy-revalidate, stale-while-revalidate=99999999999";
+	value = get_slice(list, strlen(list));
+	cache_control_parse(&cc, &value);
+	ASSERT_EQ_INT(cc.max_age, -1);
+	ASSERT_EQ_INT(cc.must_revalidate, 1);
+	ASSERT_TRUE(cc.stale_while_revalidate == 2147483647L);
+}
+
+static void test_pcache_storable(void) {
+	ASSERT_EQ_INT(storable(GET("/", ""), HEAD200), 1);
+	ASSERT_EQ_INT(storable(GET("/", ""), "HTTP/1.1 404 Not Found" CRLF), 1);
+	ASSERT_EQ_INT(storable(GET("/", ""), "HTTP/1.1 206 Partial Content" CRLF), 0);
+	ASSERT_EQ_INT(storable(GET("/", ""), "HTTP/1.1 500 Internal Server Error" CRLF), 0);
+	/* some need explicit freshness */
+	ASSERT_EQ_INT(storable(GET("/", ""), "HTTP/1.1 302 Found" CRLF), 0);
+	ASSERT_EQ_INT(storable(GET("/", ""), "HTTP/1.1 302 Found" CRLF "Cache-Control: max-age=5" CRLF), 1);
+	ASSERT_EQ_INT(storable("POST / HTTP/1.1" CRLF "Host: h" CRLF CRLF, HEAD200), 0);
+
+	ASSERT_EQ_INT(storable(GET("/", ""), HEAD200 "Cache-Control: private" CRLF), 0);
+	ASSERT_EQ_INT(storable(GET("/", ""), HEAD200 "cache-control: max-age=5, no-store" CRLF), 0);
+	ASSERT_EQ_INT(storable(GET("/", ""), HEAD200 "Vary: Accept, *" CRLF), 0);
+	ASSERT_EQ_INT(storable(GET("/", ""), HEAD200 "Set-Cookie: a=b" CRLF), 0);
+	ASSERT_EQ_INT(storable(GET("/", "Cache-Control: no-store" CRLF), HEAD200), 0);
+
+	/* answers to authorized requests only if marked shareable */
+	ASSERT_EQ_INT(storable(GET("/", "Authorization: Basic eDp5" CRLF), HEAD200), 0);
+	ASSERT_EQ_INT(storable(GET("/", "Authorization: Basic eDp5" CRLF),
+		HEAD200 "Cache-Control: public" CRLF), 1);
+	ASSERT_EQ_INT(storable(GET("/", "Authorization: Basic eDp5" CRLF),
+		HEAD200 "Cache-Control: s-maxage=5" CRLF), 1);
+}
+
+static void test_pcache_freshness(void) {
+	struct pcache cache;
+	struct pcache_entry *e;
+	char date[HTTP_DATE_LEN + 1], modified[HTTP_DATE_LEN + 1], head[256];
+
+	pcache_init(&cache, 16, 1 << 20);
+
+	ASSERT_TRUE(put(&cache, GET("/a", ""), HEAD200 "Cache-Control: max-age=10" CRLF, 1000) != NULL);
+	ASSERT_EQ_INT(get(&cache, GET("/a", ""), 1009), PC_FRESH);
+	ASSERT_EQ_INT(get(&cache, GET("/a", ""), 1010), PC_STALE);
+	ASSERT_EQ_INT(get(&cache, GET("/b", ""), 1000), PC_MISS);
+	/* the request may ask for something fresher */
+	ASSERT_EQ_INT(get(&cache, GET("/a", "Cache-Control: max-age=3" CRLF), 1005), PC_STALE);
+	ASSERT_EQ_INT(get(&cache, GET("/a", "Pragma: no-cache" CRLF), 1001), PC_STALE);
+	ASSERT_EQ_INT(get(&cache, GET("/a", "Cache-Control: max-stale" CRLF "Pragma: no-cache" CRLF),
+		1001), PC_FRESH);
+	ASSERT_EQ_INT(cache.stats.hits, 2);
+	ASSERT_EQ_INT(cache.stats.misses, 4);
+
+	/* the Age it came with counts */
+	put(&cache, GET("/a", ""), HEAD200 "Cache-Control: max-age=10" CRLF "Age: 4" CRLF, 1000);
+	ASSERT_EQ_INT(cache.lru.count, 1);
+	ASSERT_EQ_INT(get(&cache, GET("/a", ""), 1005), PC_FRESH);
+	ASSERT_EQ_INT(get(&cache, GET("/a", ""), 1006), PC_STALE);
+
+	put(&cache, GET("/a", ""), HEAD200 "Cache-Control: max-age=10, stale-while-revalidate=5" CRLF, 1000);
+	ASSERT_EQ_INT(get(&cache, GET("/a", ""), 1014), PC_STALE_OK);
+	ASSERT_EQ_INT(get(&cache, GET("/a", ""), 1015), PC_STALE);
+	ASSERT_EQ_INT(get(&cache, "HEAD /a HTTP/1.1" CRLF "Host: h" CRLF CRLF, 1014), PC_STALE);
+	ASSERT_EQ_INT(cache.stats.stale_hits, 1);
+
+	/* shared caches go by s-maxage and may not serve it stale */
+	e = put(&cache, GET("/a", ""),
+		HEAD200 "Cache-Control: max-age=5, s-maxage=20, stale-while-revalidate=60" CRLF, 1000);
+	ASSERT_EQ_INT(e->lifetime, 20);
+	ASSERT_EQ_INT(e->must_revalidate, 1);
+	ASSERT_EQ_INT(get(&cache, GET("/a", ""), 1021), PC_STALE);
+
+	format_http_date(1000000, date);
+	format_http_date(1000000 + 60, modified);
+	sprintf(head, HEAD200 "Date: %s" CRLF "Expires: %s" CRLF, date, modified);
+	e = put(&cache, GET("/a", ""), head, 1000000);
+	ASSERT_EQ_INT(e->lifetime, 60);
+	sprintf(head, HEAD200 "Date: %s" CRLF "Expires: 0" CRLF "Cache-Control: max-age=9" CRLF, date);
+	e = put(&cache, GET("/a", ""), head, 1000000);
+	ASSERT_EQ_INT(e->lifetime, 9);
+
+	/* a tenth of the time since it last changed */
+	format_http_date(1000000 - 1000, modified);
+	sprintf(head, HEAD200 "Date: %s" CRLF "Last-Modified: %s" CRLF, date, modified);
+	e = put(&cache, GET("/a", ""), head, 1000000);
+	ASSERT_EQ_INT(e->lifetime, 100);
+	ASSERT_TRUE(e->last_modified == 1000000 - 1000);
+
+	/* nothing to go by, nor to revalidate with */
+	ASSERT_TRUE(put(&cache, GET("/c", ""), HEAD200, 1000) == NULL);
+	ASSERT_TRUE(put(&cache, GET("/c", ""), HEAD200 "Cache-Control: no-cache" CRLF, 1000) == NULL);
+	e = put(&cache, GET("/c", ""), HEAD200 "Cache-Control: no-cache" CRLF "ETag: \"x\"" CRLF, 1000);
+	ASSERT_TRUE(e != NULL);
+	ASSERT_EQ_INT(get(&cache, GET("/c", ""), 1000), PC_STALE);
+
+	pcache_free(&cache);
+}
+
+static void test_pcache_vary(void) {
+	struct pcache cache;
+	struct http_request req;
+	struct parse_ctx ctx;
+	const char *head = HEAD200 "Vary: accept-language" CRLF "Cache-Control: max-age=60" CRLF;
+
+	pcache_init(&cache, 16, 1 << 20);
+	put(&cache, GET("/", "Accept-Language: en" CRLF), head, 1000);
+	put(&cache, GET("/", "Accept-Language: fr" CRLF), head, 1000);
+	put(&cache, GET("/", ""), head, 1000);
+	ASSERT_EQ_INT(cache.lru.count, 3);
+	ASSERT_EQ_INT(get(&cache, GET("/", "Accept-Language: fr" CRLF), 1001), PC_FRESH);
+	ASSERT_EQ_INT(get(&cache, GET("/", "accept-language: en" CRLF), 1001), PC_FRESH);
+	ASSERT_EQ_INT(get(&cache, GET("/", ""), 1001), PC_FRESH);
+	ASSERT_EQ_INT(get(&cache, GET("/", "Accept-Language: de" CRLF), 1001), PC_MISS);
+	/* the key is the Host and the target */
+	ASSERT_EQ_INT(get(&cache, "GET / HTTP/1.1" CRLF "Host: H" CRLF "Accept-Language: en" CRLF CRLF,
+		1001), PC_FRESH);
+	ASSERT_EQ_INT(get(&cache, "GET / HTTP/1.1" CRLF "Host: g" CRLF "Accept-Language: en" CRLF CRLF,
+		1001), PC_MISS);
+
+	/* a variant replaces the one the request selected */
+	put(&cache, GET("/", "Accept-Language: en" CRLF), head, 1000);
+	ASSERT_EQ_INT(cache.lru.count, 3);
+	put(&cache, GET("/x", ""), head, 1000);
+	ASSERT_EQ_INT(cache.lru.count, 4);
+
+	/* a change to the resource drops them all */
+	ASSERT_EQ_INT(parse_ok("POST / HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx), 0);
+	pcache_invalidate(&cache, &req);
+	END_TEST(ctx, req);
+	ASSERT_EQ_INT(cache.lru.count, 1);
+	ASSERT_EQ_INT(get(&cache, GET("/", "Accept-Language: fr" CRLF), 1001), PC_MISS);
+	pcache_free(&cache);
+}
+
+static void test_pcache_evict(void) {
+	struct pcache cache;
+	const char *head = HEAD200 "Cache-Control: max-age=60" CRLF;
+
+	pcache_init(&cache, 2, 1 << 20);
+	put(&cache, GET("/a", ""), head, 1000);
+	put(&cache, GET("/b", ""), head, 1000);
+	ASSERT_EQ_INT(get(&cache, GET("/a", ""), 1000), PC_FRESH);
+	put(&cache, GET("/c", ""), head, 1000);
+	ASSERT_EQ_INT(cache.lru.count, 2);
+	ASSERT_EQ_INT(cache.stats.evictions, 1);
+	ASSERT_EQ_INT(get(&cache, GET("/b", ""), 1000), PC_MISS);
+	ASSERT_EQ_INT(get(&cache, GET("/a", ""), 1000), PC_FRESH);
+	pcache_free(&cache);
+
+	/* by bytes: what does not fit at all is not kept */
+	pcache_init(&cache, 16, 300);
+	ASSERT_TRUE(put(&cache, GET("/a", ""), head, 1000) != NULL);
+	ASSERT_TRUE(put(&cache, GET("/b", ""), head, 1000) != NULL);
+	ASSERT_TRUE(cache.bytes <= 300);
+	ASSERT_TRUE(put_n(&cache, GET("/c", ""), head, slab_body, 300, 1000) == NULL);
+	ASSERT_EQ_INT(cache.stats.stored, 2);
+	pcache_free(&cache);
+}
+
+static void test_pcache_respond(void) {
+	struct pcache cache;
+	struct pcache_entry *e;
+	struct http_response resp;
+	struct http_request req;
+	struct parse_ctx ctx;
+	const char *expect;
+
+	pcache_init(&cache, 16, 1 << 20);
+	e = put(&cache, GET("/", ""), HEAD200 "Cache-Control: max-age=60" CRLF
+		"Content-Length: 5" CRLF "ETag: \"v1\"" CRLF "X: y" CRLF, 1000);
+	ASSERT_TRUE(e != NULL);
+
+	/* framing is written anew */
+	ASSERT_EQ_INT(parse_ok(GET("/", ""), &req, &ctx), 0);
+	resp = new_response();
+	pcache_respond(&cache, e, &req, &resp, 1003);
+	expect = HEAD200 "Cache-Control: max-age=60" CRLF "ETag: \"v1\"" CRLF "X: y" CRLF
+		"Age: 3" CRLF "Content-Length: 5" CRLF "Connection: close" CRLF CRLF;
+	ASSERT_EQ_MEM(resp.buf, resp.head_len, expect, strlen(expect));
+	ASSERT_EQ_INT(resp.num_parts, 1);
+	ASSERT_EQ_INT(resp.parts[0].type, BP_MEM);
+	ASSERT_EQ_MEM(resp.body_mem + resp.parts[0].off, resp.parts[0].len, "hello", 5);
+	ASSERT_TRUE(resp.body_blob == e->body);
+	http_response_free(&resp);
+	END_TEST(ctx, req);
+
+	ASSERT_EQ_INT(parse_ok("HEAD / HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx), 0);
+	resp = new_response();
+	pcache_respond(&cache, e, &req, &resp, 1003);
+	ASSERT_EQ_INT(resp.num_parts, 0);
+	ASSERT_EQ_MEM(resp.buf, resp.len, expect, strlen(expect));
+	http_response_free(&resp);
+	END_TEST(ctx, req);
+
+	/* the client has it already */
+	ASSERT_EQ_INT(parse_ok(GET("/", "If-None-Match: \"v0\", W/\"v1\"" CRLF), &req, &ctx), 0);
+	resp = new_response();
+	pcache_respond(&cache, e, &req, &resp, 1003);
+	expect = "HTTP/1.1 304 Not Modified" CRLF "Cache-Control: max-age=60" CRLF
+		"ETag: \"v1\"" CRLF "Connection: close" CRLF CRLF;
+	ASSERT_EQ_MEM(resp.buf, resp.len, expect, strlen(expect));
+	ASSERT_EQ_INT(resp.num_parts, 0);
+	http_response_free(&resp);
+	END_TEST(ctx, req);
+
+	pcache_free(&cache);
+}
+
+static void test_pcache_refresh(void) {
+	struct pcache cache;
+	struct pcache_entry *e;
+	char *lines;
+	const char *not_modified = "HTTP/1.1 304 Not Modified" CRLF
+		"Cache-Control: max-age=100" CRLF "ETag: \"v2\"" CRLF;
+
+	pcache_init(&cache, 16, 1 << 20);
+	e = put(&cache, GET("/", ""), HEAD200 "Cache-Control: max-age=1" CRLF "ETag: \"v1\"" CRLF
+		"Last-Modified: Thu, 01 Jan 1970 00:00:10 GMT" CRLF "X: y" CRLF, 1000);
+	ASSERT_EQ_INT(get(&cache, GET("/", ""), 1005), PC_STALE);
+
+	lines = pcache_validators(e);
+	ASSERT_TRUE(!strcmp(lines, "If-None-Match: \"v1\"" CRLF
+		"If-Modified-Since: Thu, 01 Jan 1970 00:00:10 GMT" CRLF));
+	free(lines);
+
+	/* the fields of the 304 replace the stored ones, the others stay */
+	pcache_refresh(&cache, e, not_modified, strlen(not_modified), 1005, 1005);
+	ASSERT_EQ_INT(e->lifetime, 100);
+	ASSERT_EQ_MEM(e->etag, e->etag_len, "\"v2\"", 4);
+	ASSERT_EQ_MEM(e->head, e->head_len, HEAD200 "Last-Modified: Thu, 01 Jan 1970 00:00:10 GMT" CRLF
+		"X: y" CRLF "Cache-Control: max-age=100" CRLF "ETag: \"v2\"" CRLF,
+		strlen(HEAD200 "Last-Modified: Thu, 01 Jan 1970 00:00:10 GMT" CRLF
+		"X: y" CRLF "Cache-Control: max-age=100" CRLF "ETag: \"v2\"" CRLF));
+	ASSERT_EQ_INT(cache.stats.revalidated, 1);
+	ASSERT_EQ_INT(get(&cache, GET("/", ""), 1006), PC_FRESH);
+
+	/* a holder keeps a removed entry alive */
+	pcache_ref(e);
+	pcache_remove(&cache, e);
+	ASSERT_EQ_INT(cache.lru.count, 0);
+	ASSERT_EQ_INT(e->cached, 0);
+	pcache_remove(&cache, e);
+	pcache_unref(e);
+	pcache_free(&cache);
+}
+
+static struct pcache_entry *put_big(struct pcache *cache, const char *raw, char fill) {
+	memset(slab_body, fill, sizeof slab_body);
+	return put_n(cache, raw, HEAD200 "Cache-Control: max-age=60" CRLF, slab_body, SLAB_BODY, 1000);
+}
+
+static void test_pcache_slab(void) {
+	struct pcache cache;
+	struct pcache_entry *a, *b, *d, *e;
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct http_response resp;
+
+	pcache_init(&cache, 16, 4ul << 20);
+	ASSERT_EQ_INT(pcache_open_slab(&cache, "/tmp", 1ul << 20), 0);
+
+	a = put_big(&cache, GET("/a", ""), 'a');
+	b = put_big(&cache, GET("/b", ""), 'b');
+	put_big(&cache, GET("/c", ""), 'c');
+	ASSERT_TRUE(a->region != NULL && a->body == NULL);
+	ASSERT_TRUE(b->region->off == (off_t)SLAB_BODY);
+	ASSERT_TRUE(cache.bytes < 4096);
+	ASSERT_EQ_INT(pread(cache.slab_fd, slab_read, SLAB_BODY, b->region->off), (ssize_t)SLAB_BODY);
+	ASSERT_TRUE(slab_read[0] == 'b' && slab_read[SLAB_BODY - 1] == 'b');
+
+	/* sent from the file, the span pinned meanwhile */
+	ASSERT_EQ_INT(parse_ok(GET("/b", ""), &req, &ctx), 0);
+	resp = new_response();
+	pcache_respond(&cache, b, &req, &resp, 1000);
+	ASSERT_EQ_INT(resp.body_fd, cache.slab_fd);
+	ASSERT_TRUE(resp.body_blob == b->region->pin);
+	ASSERT_EQ_INT(resp.parts[0].type, BP_FILE);
+	ASSERT_TRUE(resp.parts[0].off == SLAB_BODY);
+	http_response_free(&resp);
+	END_TEST(ctx, req);
+
+	/* the ring wraps over the oldest */
+	d = put_big(&cache, GET("/d", ""), 'd');
+	ASSERT_TRUE(d->region->off == 0);
+	ASSERT_EQ_INT(cache.lru.count, 3);
+	ASSERT_EQ_INT(get(&cache, GET("/a", ""), 1000), PC_MISS);
+	ASSERT_EQ_INT(cache.stats.evictions, 1);
+
+	/* a span still being sent is not overwritten, the body stays in memory */
+	blob_ref(b->region->pin);
+	e = put_big(&cache, GET("/e", ""), 'e');
+	ASSERT_TRUE(e->region == NULL && e->body != NULL);
+	ASSERT_EQ_INT(get(&cache, GET("/b", ""), 1000), PC_FRESH);
+	ASSERT_EQ_INT(pread(cache.slab_fd, slab_read, SLAB_BODY, b->region->off), (ssize_t)SLAB_BODY);
+	ASSERT_TRUE(slab_read[0] == 'b' && slab_read[SLAB_BODY - 1] == 'b');
+	blob_unref(b->region->pin);
+
+	/* nor is one whose entry is held */
+	pcache_ref(b);
+	put_big(&cache, GET("/f", ""), 'f');
+	ASSERT_EQ_INT(get(&cache, GET("/b", ""), 1000), PC_FRESH);
+	pcache_unref(b);
+	put_big(&cache, GET("/g", ""), 'g');
+	ASSERT_EQ_INT(get(&cache, GET("/b", ""), 1000), PC_MISS);
+
+	pcache_free(&cache);
+}
+
+static int shares(const char *raw, const char *other_raw, const char *head) {
+	struct http_request req, other;
+	struct parse_ctx ctx, other_ctx;
+	int ret;
+
+	ASSERT_EQ_INT(parse_ok(raw, &req, &ctx), 0);
+	ASSERT_EQ_INT(parse_ok(other_raw, &other, &other_ctx), 0);
+	ret = pcache_shares(&req, &other, head, strlen(head));
+	END_TEST(ctx, req);
+	END_TEST(other_ctx, other);
+	return ret;
+}
+
+static void test_pcache_fetch(void) {
+	struct pcache cache;
+	struct pcache_fetch *fetch;
+	struct http_request req, other;
+	struct parse_ctx ctx, other_ctx;
+	int owner;
+	const char *vary = HEAD200 "Vary: Accept-Language" CRLF;
+
+	pcache_init(&cache, 16, 1 << 20);
+	ASSERT_EQ_INT(parse_ok(GET("/a", ""), &req, &ctx), 0);
+	ASSERT_EQ_INT(parse_ok("GET /a HTTP/1.1" CRLF "Host: H" CRLF CRLF, &other, &other_ctx), 0);
+	ASSERT_TRUE(pcache_fetching(&cache, &other) == NULL);
+	fetch = pcache_fetch_begin(&cache, &req, &owner);
+	ASSERT_TRUE(fetch != NULL);
+	ASSERT_TRUE(pcache_fetching(&cache, &other) == &owner);
+	/* one at a time */
+	ASSERT_TRUE(pcache_fetch_begin(&cache, &other, NULL) == NULL);
+	pcache_fetch_end(&cache, fetch);
+	ASSERT_TRUE(pcache_fetching(&cache, &other) == NULL);
+	END_TEST(ctx, req);
+	END_TEST(other_ctx, other);
+	pcache_free(&cache);
+
+	ASSERT_EQ_INT(shares(GET("/", ""), GET("/", "Accept: */*" CRLF), HEAD200), 1);
+	ASSERT_EQ_INT(shares(GET("/", ""), GET("/", ""), HEAD200 "Cache-Control: private" CRLF), 0);
+	ASSERT_EQ_INT(shares(GET("/", ""), GET("/", "Cache-Control: no-store" CRLF), HEAD200), 0);
+	ASSERT_EQ_INT(shares(GET("/", "Accept-Language: en" CRLF), GET("/", "accept-language: en" CRLF),
+		vary), 1);
+	ASSERT_EQ_INT(shares(GET("/", "Accept-Language: en" CRLF), GET("/", "Accept-Language: fr" CRLF),
+		vary), 0);
+	ASSERT_EQ_INT(shares(GET("/", "Accept-Language: en" CRLF), GET("/", ""), vary), 0);
+}
+
+void run_pcache_tests(void) {
+	RUN_TEST(test_cache_control_parse);
+	RUN_TEST(test_pcache_storable);
+	RUN_TEST(test_pcache_freshness);
+	RUN_TEST(test_pcache_vary);
+	RUN_TEST(test_pcache_evict);
+	RUN_TEST(test_pcache_respond);
+	RUN_TEST(test_pcache_refresh);
+	RUN_TEST(test_pcache_slab);
+	RUN_TEST(test_pcache_fetch);
+}
@@ -0,0 +1,676 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "pcache.h"
+#include "proxy.h"
+#include "str.h"
+#include "test.h"
+
+#define OK_HEAD "HTTP/1.1 200 OK" CRLF "Content-Length: 5" CRLF CRLF
+
+static char flat[1 << 16];
+
+/* what the queue would send, queue emptied */
+static size_t flatten(struct outq *q) {
+	struct zerocopy zc;
+	struct zc_socket s;
+	int fds[2], big = 1 << 17;
+	size_t total = 0;
+	ssize_t n;
+
+	ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &big, sizeof big);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	zerocopy_init(&zc, 0);
+	zc_socket_init(&s, fds[0]);
+	ASSERT_EQ_INT(outq_flush(q, &zc, &s), OUTQ_DONE);
+	while ((n = read(fds[1], flat + total, sizeof flat - 1 - total)) > 0) {
+		total += (size_t)n;
+	}
+	flat[total] = '\0';
+	close(fds[0]);
+	close(fds[1]);
+	return total;
+}
+
+static void test_proxy_parse_head(void) {
+	struct proxy_head head;
+	const char *ok = "HTTP/1.1 200 OK" CRLF "Content-Length: 12" CRLF "X: y" CRLF CRLF "body";
+	const char *te = "HTTP/1.1 200 OK" CRLF "Content-Length: 3" CRLF
+		"Transfer-Encoding: gzip, chunked" CRLF CRLF;
+	const char *old = "HTTP/1.0 404 Not Found" CRLF "connection: Keep-Alive" CRLF CRLF;
+
+	ASSERT_EQ_INT(proxy_parse_head(ok, strlen(ok), &head), (long)strlen(ok) - 4);
+	ASSERT_EQ_INT(head.status, 200);
+	ASSERT_EQ_INT(head.content_length, 12);
+	ASSERT_EQ_INT(head.chunked, 0);
+	ASSERT_EQ_INT(head.keep_alive, 1);
+	ASSERT_EQ_INT(head.fields, strlen("HTTP/1.1 200 OK" CRLF));
+
+	ASSERT_EQ_INT(proxy_parse_head(ok, 20, &head), 0);
+
+	/* Transfer-Encoding wins, the connection is not reused after */
+	ASSERT_EQ_INT(proxy_parse_head(te, strlen(te), &head), (long)strlen(te));
+	ASSERT_EQ_INT(head.chunked, 1);
+	ASSERT_EQ_INT(head.content_length, -1);
+	ASSERT_EQ_INT(head.keep_alive, 0);
+
+	ASSERT_EQ_INT(proxy_parse_head(old, strlen(old), &head), (long)strlen(old));
+	ASSERT_EQ_INT(head.status, 404);
+	ASSERT_EQ_INT(head.keep_alive, 1);
+
+	ASSERT_EQ_INT(proxy_parse_head("HTTP/2 200 OK" CRLF CRLF, 17, &head), -1);
+	ASSERT_EQ_INT(proxy_parse_head("HTTP/1.1 200 OK" CRLF "bad line" CRLF CRLF, 29, &head), -1);
+	ASSERT_EQ_INT(proxy_parse_head("HTTP/1.1 200 OK" CRLF "Content-Length: 1" CRLF
+		"Content-Length: 2" CRLF CRLF, 57, &head), -1);
+}
+
+static void test_proxy_chunk_scan(void) {
+	const char *body = "5;ext=1" CRLF "hello" CRLF "10" CRLF "0123456789abcdef" CRLF
+		"0" CRLF "Trailer: x" CRLF CRLF "NEXT";
+	size_t len = strlen(body), i;
+	struct chunk_scan scan;
+
+	memset(&scan, 0, sizeof scan);
+	ASSERT_EQ_INT(chunk_scan(&scan, body, len), (long)len - 4);
+	ASSERT_EQ_INT(scan.state, CK_DONE);
+
+	/* any split gives the same end */
+	memset(&scan, 0, sizeof scan);
+	for (i = 0; i < len - 4; ++i) {
+		ASSERT_EQ_INT(chunk_scan(&scan, body + i, 1), 1);
+	}
+	ASSERT_EQ_INT(scan.state, CK_DONE);
+	ASSERT_EQ_INT(chunk_scan(&scan, body + i, 4), 0);
+
+	memset(&scan, 0, sizeof scan);
+	ASSERT_EQ_INT(chunk_scan(&scan, "5" CRLF "hello!", 9), -1);
+	memset(&scan, 0, sizeof scan);
+	ASSERT_EQ_INT(chunk_scan(&scan, "x" CRLF, 3), -1);
+}
+
+static void test_proxy_push_request(void) {
+	const char *raw = RL11("GET", "http://a.example/p/q?x=1")
+		H("Host", "proxy.example")
+		H("Connection", "close, X-Hop")
+		H("Accept", "*/*")
+		H("X-Hop", "secret")
+		H("Keep-Alive", "timeout=5")
+		H("User-Agent", "t  ")
+		H("X-Last", "1") END;
+	const char *expect = "GET /p/q?x=1 HTTP/1.1" CRLF
+		"Host: a.example" CRLF
+		"accept: */*" CRLF
+		"user-agent: t  " CRLF
+		"x-last: 1" CRLF CRLF;
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct outq q;
+	size_t len;
+
+	ASSERT_EQ_INT(parse_ok(raw, &req, &ctx), 0);
+	outq_init(&q);
+	proxy_push_request(&q, &req, NULL);
+	len = flatten(&q);
+	ASSERT_EQ_MEM(flat, len, expect, strlen(expect));
+	outq_free(&q);
+	END_TEST(ctx, req);
+
+	ASSERT_EQ_INT(parse_ok("GET / HTTP/1.0" CRLF "Host: a" CRLF CRLF, &req, &ctx), 0);
+	outq_init(&q);
+	proxy_push_request(&q, &req, NULL);
+	len = flatten(&q);
+	expect = "GET / HTTP/1.0" CRLF "Connection: keep-alive" CRLF "host: a" CRLF CRLF;
+	ASSERT_EQ_MEM(flat, len, expect, strlen(expect));
+	outq_free(&q);
+	END_TEST(ctx, req);
+}
+
+/* a stand-in backend, answering by hand */
+struct backend {
+	int listener;
+	int conn;
+	char name[32];
+};
+
+static void backend_init(struct backend *be) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof addr;
+
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	be->listener = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_TRUE(be->listener != -1);
+	ASSERT_EQ_INT(bind(be->listener, (void *)&addr, sizeof addr), 0);
+	ASSERT_EQ_INT(listen(be->listener, 8), 0);
+	ASSERT_EQ_INT(getsockname(be->listener, (void *)&addr, &len), 0);
+	sprintf(be->name, "127.0.0.1:%u", (unsigned)ntohs(addr.sin_port));
+	be->conn = -1;
+}
+
+static int notified;
+
+static void count_notify(struct proxy_call *call) {
+	(void)call;
+	notified++;
+}
+
+/* run the loop until the call is over */
+static void run_call(struct evloop *loop, struct proxy_call *call) {
+	int rounds = 0;
+	while (call->state < PX_DONE && rounds++ < 50) {
+		ASSERT_TRUE(evloop_run_once(loop, 100) >= 0);
+	}
+	ASSERT_TRUE(call->state >= PX_DONE);
+}
+
+/* run the loop until the backend has the whole request, then answer */
+static void backend_answer(struct evloop *loop, struct backend *be, const char *expect, const char *answer) {
+	char buf[1024];
+	size_t len = 0;
+	ssize_t n;
+	int rounds = 0;
+
+	if (be->conn == -1) {
+		while (rounds++ < 50) {
+			ASSERT_TRUE(evloop_run_once(loop, 10) >= 0);
+			be->conn = accept(be->listener, NULL, NULL);
+			if (be->conn != -1) break;
+		}
+		ASSERT_TRUE(be->conn != -1);
+		fcntl(be->conn, F_SETFL, O_NONBLOCK);
+	}
+	for (rounds = 0; len < strlen(expect) && rounds < 50; ++rounds) {
+		ASSERT_TRUE(evloop_run_once(loop, 10) >= 0);
+		while ((n = read(be->conn, buf + len, sizeof buf - len)) > 0) len += (size_t)n;
+	}
+	ASSERT_EQ_MEM(buf, len, expect, strlen(expect));
+	ASSERT_EQ_INT(write(be->conn, answer, strlen(answer)), (ssize_t)strlen(answer));
+}
+
+static void call_init(
+		struct proxy_call *call,
+		struct evloop *loop,
+		struct upstream *up,
+		const char *raw,
+		struct http_request *req,
+		struct parse_ctx *ctx,
+		struct outq *to_client
+) {
+	ASSERT_EQ_INT(parse_ok(raw, req, ctx), 0);
+	outq_init(to_client);
+	proxy_call_init(call, loop, up, req, to_client, count_notify, NULL);
+	proxy_call_start(call, ctx->buf + ctx->pos, ctx->len - ctx->pos);
+}
+
+static void test_proxy_call_pooled(void) {
+	struct evloop loop;
+	struct backend be;
+	struct upstream up;
+	struct proxy_call call;
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct outq out;
+	size_t len;
+	const char *expect;
+	const char *chunked = "HTTP/1.1 200 OK" CRLF "Transfer-Encoding: chunked" CRLF
+		"Connection: keep-alive" CRLF CRLF "3" CRLF "abc" CRLF "0" CRLF CRLF;
+
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	backend_init(&be);
+	ASSERT_EQ_INT(upstream_init(&up, be.name), 0);
+
+	/* a body sent along with the head goes first */
+	call_init(&call, &loop, &up, "POST /a HTTP/1.1" CRLF "Host: h" CRLF
+		"Content-Length: 4" CRLF CRLF "data", &req, &ctx, &out);
+	backend_answer(&loop, &be, "POST /a HTTP/1.1" CRLF "host: h" CRLF
+		"content-length: 4" CRLF CRLF "data", OK_HEAD "hello");
+	run_call(&loop, &call);
+	ASSERT_EQ_INT(call.state, PX_DONE);
+	len = flatten(&out);
+	expect = "HTTP/1.1 200 OK" CRLF "Content-Length: 5" CRLF "Connection: close" CRLF CRLF "hello";
+	ASSERT_EQ_MEM(flat, len, expect, strlen(expect));
+	ASSERT_EQ_INT(up.num_idle, 1);
+	proxy_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	/* the next one goes on the same connection, interim responses dropped */
+	call_init(&call, &loop, &up, "GET /b HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx, &out);
+	ASSERT_EQ_INT(call.reused, 1);
+	backend_answer(&loop, &be, "GET /b HTTP/1.1" CRLF "host: h" CRLF CRLF,
+		"HTTP/1.1 103 Early Hints" CRLF "Link: </s.css>" CRLF CRLF);
+	ASSERT_EQ_INT(write(be.conn, chunked, strlen(chunked)), (ssize_t)strlen(chunked));
+	run_call(&loop, &call);
+	len = flatten(&out);
+	ASSERT_TRUE(strstr(flat, "103") == NULL);
+	ASSERT_TRUE(strstr(flat, "Transfer-Encoding: chunked" CRLF) != NULL);
+	ASSERT_TRUE(strstr(flat, "keep-alive") == NULL);
+	ASSERT_EQ_MEM(flat + len - 13, 13, "3" CRLF "abc" CRLF "0" CRLF CRLF, 13);
+	ASSERT_EQ_INT(up.num_idle, 1);
+	ASSERT_EQ_INT(up.stats.connects, 1);
+	ASSERT_EQ_INT(up.stats.reuses, 1);
+	proxy_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	/* the backend closed the idle connection: a new one is opened */
+	close(be.conn);
+	be.conn = -1;
+	call_init(&call, &loop, &up, "GET /c HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx, &out);
+	backend_answer(&loop, &be, "GET /c HTTP/1.1" CRLF "host: h" CRLF CRLF,
+		"HTTP/1.1 204 No Content" CRLF "Connection: close" CRLF CRLF);
+	run_call(&loop, &call);
+	ASSERT_EQ_INT(call.state, PX_DONE);
+	ASSERT_EQ_INT(up.stats.stale, 1);
+	ASSERT_EQ_INT(up.stats.connects, 2);
+	ASSERT_EQ_INT(up.num_idle, 0);
+	len = flatten(&out);
+	ASSERT_TRUE(!memcmp(flat, "HTTP/1.1 204 No Content" CRLF, 25));
+	proxy_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	close(be.conn);
+	close(be.listener);
+	upstream_free(&up);
+	evloop_free(&loop);
+}
+
+static void test_proxy_call_failures(void) {
+	struct evloop loop;
+	struct backend be;
+	struct upstream up;
+	struct proxy_call call;
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct outq out;
+
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	backend_init(&be);
+	ASSERT_EQ_INT(upstream_init(&up, be.name), 0);
+
+	/* closed before the head: the client gets a 502 */
+	call_init(&call, &loop, &up, "GET /a HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx, &out);
+	backend_answer(&loop, &be, "GET /a HTTP/1.1" CRLF "host: h" CRLF CRLF, "HTTP/1.1 2");
+	close(be.conn);
+	be.conn = -1;
+	run_call(&loop, &call);
+	ASSERT_EQ_INT(call.state, PX_DONE);
+	flatten(&out);
+	ASSERT_TRUE(!memcmp(flat, "HTTP/1.1 502 Bad Gateway" CRLF, 26));
+	proxy_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	/* past the head the response is cut short */
+	call_init(&call, &loop, &up, "GET /b HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx, &out);
+	backend_answer(&loop, &be, "GET /b HTTP/1.1" CRLF "host: h" CRLF CRLF, OK_HEAD "he");
+	close(be.conn);
+	be.conn = -1;
+	run_call(&loop, &call);
+	ASSERT_EQ_INT(call.state, PX_BROKEN);
+	ASSERT_EQ_INT(up.num_idle, 0);
+	proxy_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	/* nobody listens */
+	close(be.listener);
+	call_init(&call, &loop, &up, "GET /c HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx, &out);
+	run_call(&loop, &call);
+	ASSERT_EQ_INT(call.state, PX_DONE);
+	flatten(&out);
+	ASSERT_TRUE(!memcmp(flat, "HTTP/1.1 502 Bad Gateway" CRLF, 26));
+	proxy_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	upstream_free(&up);
+	evloop_free(&loop);
+}
+
+#define BIG (1ul << 18)
+
+static char big[BIG];
+static char got[BIG + 1024];
+
+/* run the loop, the backend writing `send` and the client reading all
+   that is queued for it into `got`, until the call is over */
+static size_t pump(
+		struct evloop *loop,
+		struct backend *be,
+		struct proxy_call *call,
+		struct outq *out,
+		const char *send,
+		size_t send_len
+) {
+	struct zerocopy zc;
+	struct zc_socket s;
+	int fds[2], rounds = 0;
+	size_t sent = 0, total = 0;
+	ssize_t n;
+
+	ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	zerocopy_init(&zc, 0);
+	zc_socket_init(&s, fds[0]);
+	while ((call->state < PX_DONE || out->bytes > 0) && rounds++ < 10000) {
+		if (sent < send_len && (n = write(be->conn, send + sent, send_len - sent)) > 0) {
+			sent += (size_t)n;
+		}
+		ASSERT_TRUE(evloop_run_once(loop, 1) >= 0);
+		ASSERT_TRUE(outq_flush(out, &zc, &s) != OUTQ_ERROR);
+		while ((n = read(fds[1], got + total, sizeof got - total)) > 0) total += (size_t)n;
+		proxy_call_resume(call);
+	}
+	ASSERT_EQ_INT(call->state, PX_DONE);
+	close(fds[0]);
+	close(fds[1]);
+	return total;
+}
+
+static void test_proxy_call_spliced(void) {
+	struct evloop loop;
+	struct backend be;
+	struct upstream up;
+	struct proxy_call call;
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct outq out;
+	const char *head = "HTTP/1.1 200 OK" CRLF "Content-Length: 262144" CRLF CRLF;
+	const char *get = "GET /big HTTP/1.1" CRLF "host: h" CRLF CRLF;
+	size_t i, len, before;
+
+	for (i = 0; i < BIG; ++i) big[i] = (char)('a' + i % 23);
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	backend_init(&be);
+	ASSERT_EQ_INT(upstream_init(&up, be.name), 0);
+
+	/* a body of known length goes through the pipe, past what the head
+	   read took along */
+	call_init(&call, &loop, &up, "GET /big HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx, &out);
+	backend_answer(&loop, &be, get, head);
+	len = pump(&loop, &be, &call, &out, big, BIG);
+	ASSERT_TRUE(len > BIG);
+	ASSERT_EQ_MEM(got + len - BIG, BIG, big, BIG);
+	ASSERT_TRUE(up.stats.spliced >= BIG - PROXY_HEAD_MAX);
+	ASSERT_EQ_INT(up.num_idle, 1);
+	proxy_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	/* so does chunk data, the framing being scanned in between */
+	before = up.stats.spliced;
+	call_init(&call, &loop, &up, "GET /big HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx, &out);
+	backend_answer(&loop, &be, get, "HTTP/1.1 200 OK" CRLF "Transfer-Encoding: chunked" CRLF CRLF
+		"3fff9" CRLF);
+	memcpy(big + BIG - 7, CRLF "0" CRLF CRLF, 7);
+	len = pump(&loop, &be, &call, &out, big, BIG);
+	ASSERT_EQ_MEM(got + len - BIG, BIG, big, BIG);
+	ASSERT_TRUE(up.stats.spliced - before >= BIG - 7 - PROXY_HEAD_MAX);
+	ASSERT_EQ_INT(up.num_idle, 1);
+	proxy_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	/* without a pipe the bytes are copied */
+	for (i = BIG - 7; i < BIG; ++i) big[i] = 'x';
+	before = up.stats.spliced;
+	call_init(&call, &loop, &up, "GET /big HTTP/1.1" CRLF "Host: h" CRLF CRLF, &req, &ctx, &out);
+	call.resp_pipe.failed = 1;
+	backend_answer(&loop, &be, get, head);
+	len = pump(&loop, &be, &call, &out, big, BIG);
+	ASSERT_EQ_MEM(got + len - BIG, BIG, big, BIG);
+	ASSERT_EQ_INT(up.stats.spliced, before);
+	proxy_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	close(be.conn);
+	close(be.listener);
+	upstream_free(&up);
+	evloop_free(&loop);
+}
+
+static void test_proxy_call_request_body(void) {
+	struct evloop loop;
+	struct backend be;
+	struct upstream up;
+	struct proxy_call call;
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct outq out;
+	const char *post = "POST /up HTTP/1.1" CRLF "host: h" CRLF "content-length: 262144" CRLF CRLF;
+	int fds[2], rounds = 0;
+	size_t i, sent = 0, total = 0;
+	ssize_t n;
+
+	for (i = 0; i < BIG; ++i) big[i] = (char)('A' + i % 19);
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	backend_init(&be);
+	ASSERT_EQ_INT(upstream_init(&up, be.name), 0);
+	ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	/* the client writes the body as the upstream takes it */
+	call_init(&call, &loop, &up, "POST /up HTTP/1.1" CRLF "Host: h" CRLF
+		"Content-Length: 262144" CRLF CRLF, &req, &ctx, &out);
+	backend_answer(&loop, &be, post, "");
+	total = 0;
+	while (total < BIG && rounds++ < 10000) {
+		if (sent < BIG && (n = write(fds[0], big + sent, BIG - sent)) > 0) sent += (size_t)n;
+		while (proxy_call_room(&call) > 0 && proxy_call_pull(&call, fds[1]) > 0);
+		ASSERT_TRUE(call.to_upstream.bytes <= PROXY_BUFFER);
+		ASSERT_TRUE(evloop_run_once(&loop, 1) >= 0);
+		while ((n = read(be.conn, got + total, sizeof got - total)) > 0) total += (size_t)n;
+	}
+	ASSERT_EQ_MEM(got, total, big, BIG);
+	ASSERT_EQ_INT(up.stats.spliced, BIG);
+	ASSERT_EQ_INT(call.body_left, 0);
+
+	ASSERT_EQ_INT(write(be.conn, OK_HEAD "hello", strlen(OK_HEAD "hello")),
+		(ssize_t)strlen(OK_HEAD "hello"));
+	run_call(&loop, &call);
+	ASSERT_EQ_INT(up.num_idle, 1);
+	proxy_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	close(fds[0]);
+	close(fds[1]);
+	close(be.conn);
+	close(be.listener);
+	upstream_free(&up);
+	evloop_free(&loop);
+}
+
+static void test_proxy_call_cached(void) {
+	struct evloop loop;
+	struct backend be;
+	struct upstream up;
+	struct pcache cache;
+	struct pcache_entry *e;
+	struct proxy_call call;
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct outq out;
+	const char *get = "GET /k HTTP/1.1" CRLF "Host: h" CRLF CRLF;
+
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	backend_init(&be);
+	ASSERT_EQ_INT(upstream_init(&up, be.name), 0);
+	pcache_init(&cache, 16, 1 << 20);
+
+	/* kept as relayed, stored once complete */
+	ASSERT_EQ_INT(parse_ok(get, &req, &ctx), 0);
+	outq_init(&out);
+	proxy_call_init(&call, &loop, &up, &req, &out, count_notify, NULL);
+	proxy_call_cache(&call, &cache, NULL);
+	proxy_call_start(&call, NULL, 0);
+	backend_answer(&loop, &be, "GET /k HTTP/1.1" CRLF "host: h" CRLF CRLF,
+		"HTTP/1.1 200 OK" CRLF "Transfer-Encoding: chunked" CRLF "ETag: \"v1\"" CRLF
+		"Cache-Control: max-age=0" CRLF CRLF "5" CRLF "hello" CRLF "0" CRLF CRLF);
+	run_call(&loop, &call);
+	ASSERT_EQ_INT(call.state, PX_DONE);
+	ASSERT_EQ_INT(cache.stats.stored, 1);
+	ASSERT_EQ_INT(pcache_lookup(&cache, &req, time(NULL), &e), PC_STALE);
+	ASSERT_EQ_MEM(e->body->data + e->body_off, e->body_len, "hello", 5);
+	proxy_call_free(&call);
+	outq_free(&out);
+	END_TEST(ctx, req);
+
+	/* a stale one is confirmed with its validators, then served */
+	ASSERT_EQ_INT(parse_ok(get, &req, &ctx), 0);
+	outq_init(&out);
+	proxy_call_init(&call, &loop, &up, &req, &out, count_notify, NULL);
+	proxy_call_cache(&call, &cache, pcache_ref(e));
+	proxy_call_start(&call, NULL, 0);
+	backend_answer(&loop, &be, "GET /k HTTP/1.1" CRLF "host: h" CRLF "If-None-Match: \"v1\"" CRLF CRLF,
+		"HTTP/1.1 304 Not Modified" CRLF "Cache-Control: max-age=60" CRLF CRLF);
+	run_call(&loop, &call);
+	ASSERT_EQ_INT(call.state, PX_DONE);
+	ASSERT_EQ_INT(cache.stats.revalidated, 1);
+	flatten(&out);
+	ASSERT_TRUE(!memcmp(flat, "HTTP/1.1 200 OK" CRLF, 17));
+	ASSERT_TRUE(strstr(flat, "Content-Length: 5" CRLF) != NULL);
+	ASSERT_TRUE(strstr(flat, "Cache-Control: max-age=60" CRLF) != NULL);
+	ASSERT_TRUE(!strcmp(flat + strlen(flat) - 9, CRLF CRLF "hello"));
+	ASSERT_EQ_INT(up.num_idle, 1);
+	proxy_call_free(&call);
+	outq_free(&out);
+	ASSERT_EQ_INT(pcache_lookup(&cache, &req, time(NULL), &e), PC_FRESH);
+	END_TEST(ctx, req);
+
+	close(be.conn);
+	close(be.listener);
+	pcache_free(&cache);
+	upstream_free(&up);
+	evloop_free(&loop);
+}
+
+static int follower_notified;
+
+static void count_follower(struct proxy_follower *f) {
+	(void)f;
+	follower_notified++;
+}
+
+static void test_proxy_call_followed(void) {
+	struct evloop loop;
+	struct backend be;
+	struct upstream up;
+	struct pcache cache;
+	struct proxy_call call;
+	struct proxy_follower f, g;
+	struct http_request req, req_f, req_g;
+	struct parse_ctx ctx, ctx_f, ctx_g;
+	struct outq out, out_f, out_g;
+	size_t len;
+	char led[1024];
+	const char *get = "GET /k HTTP/1.1" CRLF "Host: h" CRLF CRLF;
+	const char *sent = "GET /k HTTP/1.1" CRLF "host: h" CRLF CRLF;
+
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	backend_init(&be);
+	ASSERT_EQ_INT(upstream_init(&up, be.name), 0);
+	pcache_init(&cache, 16, 1 << 20);
+
+	/* the followers get what the leader gets, as it comes */
+	ASSERT_EQ_INT(parse_ok(get, &req, &ctx), 0);
+	ASSERT_EQ_INT(parse_ok(get, &req_f, &ctx_f), 0);
+	ASSERT_EQ_INT(parse_ok("GET /k HTTP/1.1" CRLF "Host: h" CRLF "Cache-Control: no-store" CRLF CRLF,
+		&req_g, &ctx_g), 0);
+	outq_init(&out);
+	outq_init(&out_f);
+	outq_init(&out_g);
+	proxy_call_init(&call, &loop, &up, &req, &out, count_notify, NULL);
+	proxy_call_cache(&call, &cache, NULL);
+	ASSERT_EQ_INT(proxy_call_lead(&call), 0);
+	ASSERT_TRUE(proxy_call_leading(&cache, &req_f) == &call);
+	proxy_follow(&call, &f, &req_f, &out_f, count_follower, NULL);
+	proxy_follow(&call, &g, &req_g, &out_g, count_follower, NULL);
+	proxy_call_start(&call, NULL, 0);
+	backend_answer(&loop, &be, sent, "HTTP/1.1 200 OK" CRLF "Transfer-Encoding: chunked" CRLF
+		"Cache-Control: max-age=60" CRLF CRLF "3" CRLF "abc" CRLF);
+	while (out_f.bytes == 0) {
+		ASSERT_TRUE(evloop_run_once(&loop, 100) >= 0);
+	}
+	/* too late to follow, one that may not share it went alone */
+	ASSERT_TRUE(proxy_call_leading(&cache, &req_f) == NULL);
+	ASSERT_EQ_INT(f.state, FW_STREAMING);
+	ASSERT_EQ_INT(g.state, FW_RELEASED);
+	ASSERT_TRUE(g.leader == NULL);
+	ASSERT_EQ_INT(write(be.conn, "0" CRLF CRLF, 5), 5);
+	run_call(&loop, &call);
+	ASSERT_EQ_INT(call.state, PX_DONE);
+	ASSERT_EQ_INT(f.state, FW_DONE);
+	ASSERT_EQ_INT(cache.stats.coalesced, 1);
+	ASSERT_EQ_INT(cache.stats.stored, 1);
+	len = flatten(&out);
+	memcpy(led, flat, len);
+	ASSERT_EQ_INT(flatten(&out_f), len);
+	ASSERT_EQ_MEM(flat, len, led, len);
+	ASSERT_TRUE(!strcmp(flat + len - 13, "3" CRLF "abc" CRLF "0" CRLF CRLF));
+	ASSERT_EQ_INT(out_g.bytes, 0);
+	proxy_call_free(&call);
+	outq_free(&out);
+	outq_free(&out_f);
+	outq_free(&out_g);
+	END_TEST(ctx_g, req_g);
+
+	/* failing before the head, it fails them all */
+	close(be.listener);
+	close(be.conn);
+	outq_init(&out);
+	outq_init(&out_f);
+	proxy_call_init(&call, &loop, &up, &req, &out, count_notify, NULL);
+	proxy_call_cache(&call, &cache, NULL);
+	ASSERT_EQ_INT(proxy_call_lead(&call), 0);
+	proxy_follow(&call, &f, &req_f, &out_f, count_follower, NULL);
+	proxy_call_start(&call, NULL, 0);
+	run_call(&loop, &call);
+	ASSERT_EQ_INT(f.state, FW_DONE);
+	flatten(&out_f);
+	ASSERT_TRUE(!memcmp(flat, "HTTP/1.1 502 Bad Gateway" CRLF, 26));
+	proxy_call_free(&call);
+	outq_free(&out);
+	outq_free(&out_f);
+
+	/* a leader gone early lets them go alone */
+	outq_init(&out);
+	outq_init(&out_f);
+	proxy_call_init(&call, &loop, &up, &req, &out, count_notify, NULL);
+	proxy_call_cache(&call, &cache, NULL);
+	ASSERT_EQ_INT(proxy_call_lead(&call), 0);
+	proxy_follow(&call, &f, &req_f, &out_f, count_follower, NULL);
+	proxy_call_free(&call);
+	ASSERT_EQ_INT(f.state, FW_RELEASED);
+	ASSERT_TRUE(proxy_call_leading(&cache, &req_f) == NULL);
+	outq_free(&out);
+	outq_free(&out_f);
+
+	END_TEST(ctx, req);
+	END_TEST(ctx_f, req_f);
+	pcache_free(&cache);
+	upstream_free(&up);
+	evloop_free(&loop);
+}
+
+void run_proxy_tests(void) {
+	RUN_TEST(test_proxy_parse_head);
+	RUN_TEST(test_proxy_chunk_scan);
+	RUN_TEST(test_proxy_push_request);
+	RUN_TEST(test_proxy_call_pooled);
+	RUN_TEST(test_proxy_call_failures);
+	RUN_TEST(test_proxy_call_spliced);
+	RUN_TEST(test_proxy_call_request_body);
+	RUN_TEST(test_proxy_call_cached);
+	RUN_TEST(test_proxy_call_followed);
+}
@@ -0,0 +1,84 @@
+#include "test.h"
+#include "range.h"
+
+static struct byte_range ranges[RANGE_MAX];
+static size_t count;
+
+static enum range_result parse(const char *raw, size_t size) {
+	struct slice value = get_slice(raw, strlen(raw));
+	return parse_range(&value, size, ranges, &count);
+}
+
+static void assert_range(size_t idx, size_t first, size_t last) {
+	ASSERT_TRUE(idx < count);
+	ASSERT_EQ_INT(ranges[idx].first, first);
+	ASSERT_EQ_INT(ranges[idx].last, last);
+}
+
+static void test_range_single(void) {
+	ASSERT_EQ_INT(parse("bytes=0-499", 1000), RANGE_OK);
+	ASSERT_EQ_INT(count, 1);
+	assert_range(0, 0, 499);
+
+	ASSERT_EQ_INT(parse("bytes=500-", 1000), RANGE_OK);
+	assert_range(0, 500, 999);
+
+	ASSERT_EQ_INT(parse("BYTES=-200", 1000), RANGE_OK);
+	assert_range(0, 800, 999);
+
+	/* clamped to the representation */
+	ASSERT_EQ_INT(parse("bytes=900-5000", 1000), RANGE_OK);
+	assert_range(0, 900, 999);
+	ASSERT_EQ_INT(parse("bytes=-5000", 1000), RANGE_OK);
+	assert_range(0, 0, 999);
+	ASSERT_EQ_INT(parse("bytes=0-99999999999999999999999", 1000), RANGE_OK);
+	assert_range(0, 0, 999);
+}
+
+static void test_range_multiple(void) {
+	ASSERT_EQ_INT(parse("bytes=0-0, -1", 10), RANGE_OK);
+	ASSERT_EQ_INT(count, 2);
+	assert_range(0, 0, 0);
+	assert_range(1, 9, 9);
+
+	/* sorted, overlapping and adjacent ones merged, empty elements skipped */
+	ASSERT_EQ_INT(parse("bytes=50-59,,0-9, 10-19 ,5-12,100-", 60), RANGE_OK);
+	ASSERT_EQ_INT(count, 2);
+	assert_range(0, 0, 19);
+	assert_range(1, 50, 59);
+
+	/* unsatisfiable ones are dropped if another one is satisfiable */
+	ASSERT_EQ_INT(parse("bytes=100-200,1-2", 60), RANGE_OK);
+	ASSERT_EQ_INT(count, 1);
+	assert_range(0, 1, 2);
+}
+
+static void test_range_ignored(void) {
+	ASSERT_EQ_INT(parse("", 10), RANGE_NONE);
+	ASSERT_EQ_INT(parse("bytes", 10), RANGE_NONE);
+	ASSERT_EQ_INT(parse("bytes=", 10), RANGE_NONE);
+	ASSERT_EQ_INT(parse("bytes=,", 10), RANGE_NONE);
+	ASSERT_EQ_INT(parse("items=0-1", 10), RANGE_NONE);
+	ASSERT_EQ_INT(parse("bytes=-", 10), RANGE_NONE);
+	ASSERT_EQ_INT(parse("bytes=5-1", 10), RANGE_NONE);
+	ASSERT_EQ_INT(parse("bytes=1-2;x", 10), RANGE_NONE);
+	ASSERT_EQ_INT(parse("bytes=a-b", 10), RANGE_NONE);
+	ASSERT_EQ_INT(parse("bytes= 0-1", 10), RANGE_OK);
+	ASSERT_EQ_INT(parse("bytes=0-0,1-1,2-2,3-3,4-4,5-5,6-6,7-7,8-8,9-9,"
+		"10-10,11-11,12-12,13-13,14-14,15-15,16-16", 100), RANGE_NONE);
+}
+
+static void test_range_unsatisfiable(void) {
+	ASSERT_EQ_INT(parse("bytes=10-", 10), RANGE_UNSATISFIABLE);
+	ASSERT_EQ_INT(parse("bytes=-0", 10), RANGE_UNSATISFIABLE);
+	ASSERT_EQ_INT(parse("bytes=0-", 0), RANGE_UNSATISFIABLE);
+	ASSERT_EQ_INT(parse("bytes=-5", 0), RANGE_UNSATISFIABLE);
+	ASSERT_EQ_INT(parse("bytes=20-30, 40-", 10), RANGE_UNSATISFIABLE);
+}
+
+void run_range_tests(void) {
+	RUN_TEST(test_range_single);
+	RUN_TEST(test_range_multiple);
+	RUN_TEST(test_range_ignored);
+	RUN_TEST(test_range_unsatisfiable);
+}
@@ -0,0 +1,133 @@
+#define _XOPEN_SOURCE 500
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "test.h"
+#include "readahead.h"
+
+#define MIB (1ul << 20)
+
+static size_t ra_off, ra_len;
+
+static void test_readahead_sequential(void) {
+	struct ra_state ra;
+
+	ra_init(&ra);
+	ASSERT_EQ_INT(ra_plan(&ra, 0, MIB, 64 * MIB, &ra_off, &ra_len), RA_READAHEAD);
+	ASSERT_EQ_INT(ra_off, 0);
+	ASSERT_EQ_INT(ra_len, MIB + RA_MIN_WINDOW);
+
+	/* each continuation starts where the last prefetch ended, the window
+	   past the read doubling */
+	ASSERT_EQ_INT(ra_plan(&ra, MIB, MIB, 64 * MIB, &ra_off, &ra_len), RA_READAHEAD);
+	ASSERT_EQ_INT(ra_off, MIB + RA_MIN_WINDOW);
+	ASSERT_EQ_INT(ra_off + ra_len, 2 * MIB + 2 * RA_MIN_WINDOW);
+	ASSERT_EQ_INT(ra_plan(&ra, 2 * MIB, MIB, 64 * MIB, &ra_off, &ra_len), RA_READAHEAD);
+	ASSERT_EQ_INT(ra_off + ra_len, 3 * MIB + 4 * RA_MIN_WINDOW);
+
+	/* bounded by the window and the file */
+	ASSERT_EQ_INT(ra_plan(&ra, 3 * MIB, 32 * MIB, 64 * MIB, &ra_off, &ra_len), RA_READAHEAD);
+	ASSERT_EQ_INT(ra_len, RA_MAX_WINDOW);
+	ra_init(&ra);
+	ASSERT_EQ_INT(ra_plan(&ra, 0, 2 * MIB, 2 * MIB, &ra_off, &ra_len), RA_READAHEAD);
+	ASSERT_EQ_INT(ra_len, 2 * MIB);
+	ASSERT_EQ_INT(ra_plan(&ra, 0, 2 * MIB, 2 * MIB, &ra_off, &ra_len), RA_READAHEAD);
+	ASSERT_EQ_INT(ra_len, 2 * MIB);
+}
+
+static void test_readahead_random(void) {
+	struct ra_state ra;
+
+	ra_init(&ra);
+	ASSERT_EQ_INT(ra_plan(&ra, 5 * MIB, 4096, 64 * MIB, &ra_off, &ra_len), RA_WILLNEED);
+	ASSERT_EQ_INT(ra_off, 5 * MIB);
+	ASSERT_EQ_INT(ra_len, 4096);
+	ASSERT_EQ_INT(ra.window, 0);
+
+	/* continuing it starts a window */
+	ASSERT_EQ_INT(ra_plan(&ra, 5 * MIB + 4096, 4096, 64 * MIB, &ra_off, &ra_len),
+		RA_READAHEAD);
+	ASSERT_EQ_INT(ra.window, RA_MIN_WINDOW);
+	ASSERT_EQ_INT(ra_plan(&ra, 9 * MIB, 4096, 64 * MIB, &ra_off, &ra_len), RA_WILLNEED);
+	ASSERT_EQ_INT(ra.window, 0);
+
+	/* small files and empty or out of bounds reads are left alone */
+	ASSERT_EQ_INT(ra_plan(&ra, 0, 4096, RA_MIN_FILE - 1, &ra_off, &ra_len), RA_NONE);
+	ASSERT_EQ_INT(ra_plan(&ra, 0, 0, 64 * MIB, &ra_off, &ra_len), RA_NONE);
+	ASSERT_EQ_INT(ra_plan(&ra, 64 * MIB, 1, 64 * MIB, &ra_off, &ra_len), RA_NONE);
+}
+
+/* short continuations wait until less than half the window is left */
+static void test_readahead_throttled(void) {
+	struct ra_state ra;
+
+	ra_init(&ra);
+	ASSERT_EQ_INT(ra_plan(&ra, 0, 4096, 64 * MIB, &ra_off, &ra_len), RA_READAHEAD);
+	ASSERT_EQ_INT(ra.ahead, 4096 + RA_MIN_WINDOW);
+	ASSERT_EQ_INT(ra_plan(&ra, 4096, 4096, 64 * MIB, &ra_off, &ra_len), RA_NONE);
+	ASSERT_EQ_INT(ra.window, RA_MIN_WINDOW);
+	ASSERT_EQ_INT(ra.next, 8192);
+
+	ASSERT_EQ_INT(ra_plan(&ra, 8192, RA_MIN_WINDOW / 2, 64 * MIB, &ra_off, &ra_len),
+		RA_READAHEAD);
+	ASSERT_EQ_INT(ra_off, 4096 + RA_MIN_WINDOW);
+	ASSERT_EQ_INT(ra.window, 2 * RA_MIN_WINDOW);
+
+	/* nothing past the end of the file */
+	ra_init(&ra);
+	ASSERT_EQ_INT(ra_plan(&ra, 0, RA_MIN_FILE, RA_MIN_FILE, &ra_off, &ra_len), RA_READAHEAD);
+	ASSERT_EQ_INT(ra_plan(&ra, RA_MIN_FILE, 0, RA_MIN_FILE, &ra_off, &ra_len), RA_NONE);
+}
+
+static void test_readahead_file(void) {
+	struct ra_stats stats = {0};
+	struct ra_file *f;
+	struct ra_state ra;
+	char path[] = "/tmp/aster-ra-XXXXXX";
+	int fd = mkstemp(path);
+
+	ASSERT_TRUE(fd != -1);
+	unlink(path);
+	ASSERT_EQ_INT(ftruncate(fd, 4 * MIB), 0);
+
+	f = ra_file_new(4 * MIB, &stats);
+	ra_file_queued(f, fd, 0, MIB);
+	ASSERT_EQ_INT(stats.resident + stats.nonresident, 1);
+	ASSERT_EQ_INT(stats.readaheads, 1);
+	ASSERT_EQ_INT(stats.prefetched, MIB + RA_MIN_WINDOW);
+
+	/* what went out is one span while it touches, else the longest */
+	ra_init(&ra);
+	ra.next = MIB;
+	ra_file_sent(f, &ra, fd, MIB, 4096);
+	ra_file_sent(f, &ra, fd, MIB + 4096, 4096);
+	ra_file_sent(f, &ra, fd, 0, MIB);
+	ASSERT_EQ_INT(f->sent_off, 0);
+	ASSERT_EQ_INT(f->sent_end, MIB + 8192);
+	ra_file_sent(f, &ra, fd, 3 * MIB, 4096);
+	ASSERT_EQ_INT(f->sent_off, 0);
+	ra_file_sent(f, &ra, fd, 2 * MIB, MIB + 8192 + 1);
+	ASSERT_EQ_INT(f->sent_off, 2 * MIB);
+
+	/* dropped with the last reference, and only once cold */
+	ra_file_unref(ra_file_ref(f), fd);
+	f->cold = 1;
+	ra_file_unref(ra_file_ref(f), fd);
+	ASSERT_EQ_INT(stats.dontneeds, 0);
+	ra_file_unref(f, fd);
+	ASSERT_EQ_INT(stats.dontneeds, 1);
+
+	f = ra_file_new(4 * MIB, &stats);
+	ra_file_sent(f, &ra, fd, 0, MIB);
+	ra_file_unref(f, fd);
+	ASSERT_EQ_INT(stats.dontneeds, 1);
+	ra_file_unref(NULL, fd);
+	close(fd);
+}
+
+void run_readahead_tests(void) {
+	RUN_TEST(test_readahead_sequential);
+	RUN_TEST(test_readahead_random);
+	RUN_TEST(test_readahead_throttled);
+	RUN_TEST(test_readahead_file);
+}
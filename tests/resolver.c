@@ -0,0 +1,118 @@
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <string.h>
+#include <netinet/in.h>
+#include "resolver.h"
+#include "test.h"
+
+/* a query and what it was answered */
+struct lookup {
+	struct resolver_query q;
+	int answered;
+	int family; /* AF_UNSPEC if it did not resolve */
+	unsigned short port;
+};
+
+static void lookup_done(struct resolver_query *q, const struct sockaddr *addr, socklen_t addr_len) {
+	struct lookup *l = q->owner;
+	const struct sockaddr_in *in = (const void *)addr;
+
+	l->answered++;
+	l->family = addr != NULL ? addr->sa_family : AF_UNSPEC;
+	l->port = addr != NULL && addr_len >= sizeof *in ? ntohs(in->sin_port) : 0;
+}
+
+static void lookup_init(struct lookup *l, const char *name) {
+	memset(l, 0, sizeof *l);
+	strcpy(l->q.name, name);
+	l->q.done = lookup_done;
+	l->q.owner = l;
+}
+
+static void test_resolve_name(void) {
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+
+	ASSERT_EQ_INT(resolve_name("127.0.0.1:80", 1, &addr, &addr_len), 0);
+	ASSERT_EQ_INT(addr.ss_family, AF_INET);
+	ASSERT_EQ_INT(resolve_name("[::1]:443", 1, &addr, &addr_len), 0);
+	ASSERT_EQ_INT(addr.ss_family, AF_INET6);
+	/* names are left to the processes */
+	ASSERT_EQ_INT(resolve_name("localhost:80", 1, &addr, &addr_len), -1);
+	ASSERT_EQ_INT(resolve_name("127.0.0.1", 1, &addr, &addr_len), -1);
+	ASSERT_EQ_INT(resolve_name(":80", 1, &addr, &addr_len), -1);
+	ASSERT_EQ_INT(resolve_name("127.0.0.1:", 1, &addr, &addr_len), -1);
+}
+
+/* answers come through the loop, those of cancelled queries dropped */
+static void test_resolver_lookups(void) {
+	struct evloop loop;
+	struct resolver r;
+	struct lookup a, b, c, d;
+	int rounds;
+
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	ASSERT_EQ_INT(resolver_start(&r, &loop), 0);
+
+	lookup_init(&a, "localhost:8080");
+	lookup_init(&b, "127.0.0.1:81");
+	lookup_init(&c, "no-port");
+	lookup_init(&d, "localhost:82");
+	ASSERT_EQ_INT(resolver_query(&r, &a.q), 0);
+	ASSERT_EQ_INT(resolver_query(&r, &b.q), 0);
+	ASSERT_EQ_INT(resolver_query(&r, &c.q), 0);
+	ASSERT_EQ_INT(resolver_query(&r, &d.q), 0);
+	resolver_cancel(&r, &d.q);
+
+	for (rounds = 0; rounds < 50 &&
+			(a.answered + b.answered + c.answered < 3 || r.busy[d.q.slot]); ++rounds) {
+		evloop_run_once(&loop, 100);
+	}
+	ASSERT_EQ_INT(a.answered, 1);
+	ASSERT_TRUE(a.family == AF_INET || a.family == AF_INET6);
+	ASSERT_EQ_INT(a.port, 8080);
+	ASSERT_EQ_INT(b.answered, 1);
+	ASSERT_EQ_INT(b.family, AF_INET);
+	ASSERT_EQ_INT(b.port, 81);
+	ASSERT_EQ_INT(c.answered, 1);
+	ASSERT_EQ_INT(c.family, AF_UNSPEC);
+	ASSERT_EQ_INT(d.answered, 0);
+	ASSERT_EQ_INT(r.stats.lookups, 4);
+	ASSERT_EQ_INT(r.stats.failures, 1);
+
+	resolver_stop(&r, &loop);
+	lookup_init(&a, "localhost:80");
+	ASSERT_EQ_INT(resolver_query(&r, &a.q), -1);
+	evloop_free(&loop);
+}
+
+/* once the processes are gone, what they were asked fails */
+static void test_resolver_gone(void) {
+	struct evloop loop;
+	struct resolver r;
+	struct lookup a;
+	size_t i;
+	int rounds;
+
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	ASSERT_EQ_INT(resolver_start(&r, &loop), 0);
+	for (i = 0; i < RESOLVER_PROCS; ++i) kill(r.pids[i], SIGKILL);
+	lookup_init(&a, "localhost:80");
+	/* asked before or after they are found gone */
+	if (resolver_query(&r, &a.q) == 0) {
+		for (rounds = 0; rounds < 50 && a.answered == 0; ++rounds) {
+			evloop_run_once(&loop, 100);
+		}
+		ASSERT_EQ_INT(a.answered, 1);
+		ASSERT_EQ_INT(a.family, AF_UNSPEC);
+	}
+	resolver_stop(&r, &loop);
+	evloop_free(&loop);
+}
+
+void run_resolver_tests(void) {
+	RUN_TEST(test_resolve_name);
+	RUN_TEST(test_resolver_lookups);
+	RUN_TEST(test_resolver_gone);
+}
@@ -0,0 +1,129 @@
+#include "response.h"
+#include "str.h"
+#include "test.h"
+
+#define DATE "Thu, 01 Jan 1970 00:00:00 GMT"
+#define HEAD "HTTP/1.1 200 OK" CRLF "Server: " SERVER CRLF "Date: " DATE CRLF
+
+static void test_response_connection(void) {
+	struct http_response resp = new_response();
+
+	/* closing unless told otherwise */
+	begin_response(&resp, RC_200_OK, DATE);
+	ASSERT_EQ_MEM(resp.buf, resp.len, HEAD "Connection: close" CRLF,
+		strlen(HEAD "Connection: close" CRLF));
+	http_response_free(&resp);
+
+	resp = new_response();
+	resp.connection = CD_KEEP_ALIVE;
+	begin_response(&resp, RC_200_OK, DATE);
+	ASSERT_EQ_MEM(resp.buf, resp.len, HEAD, strlen(HEAD));
+	http_response_free(&resp);
+
+	resp = new_response();
+	resp.connection = CD_KEEP_ALIVE_10;
+	begin_response(&resp, RC_200_OK, DATE);
+	ASSERT_EQ_MEM(resp.buf, resp.len, HEAD "Connection: keep-alive" CRLF,
+		strlen(HEAD "Connection: keep-alive" CRLF));
+	http_response_free(&resp);
+}
+
+static void test_response_delimited(void) {
+	struct http_response resp = new_response();
+
+	begin_response(&resp, RC_200_OK, DATE);
+	ASSERT_TRUE(!resp.delimited);
+	append_length_to_response(&resp, 2);
+	ASSERT_TRUE(resp.delimited);
+	ASSERT_TRUE(strstr(resp.buf, CRLF "Content-Length: 2" CRLF) != NULL);
+	http_response_free(&resp);
+
+	/* never a body */
+	resp = new_response();
+	begin_response(&resp, RC_304_NOT_MODIFIED, DATE);
+	ASSERT_TRUE(resp.delimited);
+	http_response_free(&resp);
+
+	resp = new_response();
+	empty_response(&resp, RC_404_NOT_FOUND, DATE);
+	ASSERT_TRUE(resp.delimited);
+	http_response_free(&resp);
+}
+
+/* a copy per disposition, served with the current date */
+static void test_canned_copies(void) {
+	struct canned_response page;
+	struct http_response resp;
+	const char *date = "Fri, 02 Jan 1970 00:00:00 GMT";
+	int d;
+
+	canned_init(&page, RC_200_OK, "X: y" CRLF, "hello");
+	for (d = 0; d < CD__COUNT; ++d) {
+		resp = new_response();
+		resp.connection = (enum conn_disposition)d;
+		canned_serve(&page, 1, &resp, date);
+		ASSERT_TRUE(resp.delimited);
+		ASSERT_EQ_INT(resp.len, page.len[d]);
+		ASSERT_TRUE(strstr(resp.buf, date) != NULL);
+		ASSERT_TRUE(strstr(resp.buf, "X: y" CRLF "Content-Length: 5" CRLF CRLF "hello") != NULL);
+		ASSERT_EQ_INT(strstr(resp.buf, "Connection: close") != NULL, d == CD_CLOSE);
+		ASSERT_EQ_INT(strstr(resp.buf, "Connection: keep-alive") != NULL, d == CD_KEEP_ALIVE_10);
+		http_response_free(&resp);
+	}
+	canned_free(&page);
+
+	/* without a body, by its status */
+	canned_init(&page, RC_304_NOT_MODIFIED, "ETag: \"a\"" CRLF, NULL);
+	resp = new_response();
+	canned_serve(&page, 0, &resp, DATE);
+	ASSERT_TRUE(resp.delimited);
+	ASSERT_TRUE(strstr(resp.buf, "Content-Length") == NULL);
+	http_response_free(&resp);
+	canned_free(&page);
+}
+
+/* a HEAD answered in turn with a GET: the client, reading no body after
+   the first head, finds the second response right behind it */
+static void test_canned_pipelined_head(void) {
+	const char *raw = RL11("HEAD", "/") HOST("a") END RL11("GET", "/") HOST("a") END;
+	struct canned_response page;
+	struct http_request req = new_request();
+	struct parse_ctx ctx = parse_ctx_init(&req);
+	struct http_response resp;
+	char stream[512];
+	size_t len = 0, head_len;
+	int i;
+
+	canned_init(&page, RC_200_OK, "", "hello");
+	feed(&ctx, raw, strlen(raw));
+	for (i = 0; i < 2; ++i) {
+		ASSERT_EQ_INT(ctx.state, PS_DONE);
+		ASSERT_EQ_INT(req.method, i == 0 ? HM_HEAD : HM_GET);
+		resp = new_response();
+		resp.connection = CD_KEEP_ALIVE;
+		canned_serve(&page, req.method != HM_HEAD, &resp, DATE);
+		ASSERT_TRUE(resp.delimited);
+		memcpy(stream + len, resp.buf, resp.len);
+		len += resp.len;
+		http_response_free(&resp);
+
+		http_request_free(&req);
+		req = new_request();
+		parse_ctx_reset(&ctx, &req, ctx.pos);
+		feed(&ctx, "", 0);
+	}
+	head_len = page.head_len[CD_KEEP_ALIVE];
+	ASSERT_EQ_INT(len, 2 * head_len + 5);
+	ASSERT_EQ_MEM(stream + head_len, 15, "HTTP/1.1 200 OK", 15);
+	ASSERT_EQ_MEM(stream + len - 5, 5, "hello", 5);
+
+	canned_free(&page);
+	END_TEST(ctx, req);
+}
+
+void run_response_tests(void) {
+	RUN_TEST(test_response_connection);
+	RUN_TEST(test_response_delimited);
+	RUN_TEST(test_canned_copies);
+	RUN_TEST(test_canned_pipelined_head);
+}
@@ -0,0 +1,147 @@
+#include "test.h"
+#include "router.h"
+
+#define GET_HEAD (METHOD_BIT(HM_GET) | METHOD_BIT(HM_HEAD))
+
+static const char *const ROOT = "root";
+static const char *const USERS = "users";
+static const char *const USER = "user";
+static const char *const USER_POSTS = "user posts";
+static const char *const USER_ME = "user me";
+static const char *const CREATE_USER = "create user";
+static const char *const POST = "post";
+static const char *const STATIC = "static";
+static const char *const ASSETS = "assets";
+static const char *const FALLBACK = "fallback";
+
+static struct route_match match;
+
+static enum route_status lookup(const struct router *router, enum http_method method, const char *path) {
+	struct slice sl = get_slice(path, strlen(path));
+	return router_lookup(router, method, &sl, &match);
+}
+
+static void assert_route(
+		const struct router *router,
+		enum http_method method,
+		const char *path,
+		const char *target
+) {
+	ASSERT_EQ_INT(lookup(router, method, path), ROUTE_FOUND);
+	ASSERT_TRUE(match.target == target);
+}
+
+static void build(struct router *router) {
+	router_init(router);
+	ASSERT_EQ_INT(router_add(router, GET_HEAD, "/", ROOT), 0);
+	ASSERT_EQ_INT(router_add(router, METHOD_BIT(HM_GET), "/users", USERS), 0);
+	ASSERT_EQ_INT(router_add(router, METHOD_BIT(HM_POST), "/users", CREATE_USER), 0);
+	ASSERT_EQ_INT(router_add(router, METHOD_BIT(HM_GET), "/users/:id", USER), 0);
+	ASSERT_EQ_INT(router_add(router, METHOD_BIT(HM_GET), "/users/me", USER_ME), 0);
+	ASSERT_EQ_INT(router_add(router, METHOD_BIT(HM_GET), "/users/:id/posts", USER_POSTS), 0);
+	ASSERT_EQ_INT(router_add(router, METHOD_BIT(HM_GET), "/users/:id/posts/:post", POST), 0);
+	ASSERT_EQ_INT(router_add(router, GET_HEAD, "/static/*", STATIC), 0);
+	ASSERT_EQ_INT(router_add(router, GET_HEAD, "/static/assets/*", ASSETS), 0);
+	ASSERT_EQ_INT(router_add(router, ROUTE_ANY_METHOD, "/*", FALLBACK), 0);
+	router_compile(router);
+}
+
+static void test_router_exact(void) {
+	struct router router;
+	build(&router);
+
+	assert_route(&router, HM_GET, "/", ROOT);
+	assert_route(&router, HM_GET, "/users", USERS);
+	assert_route(&router, HM_POST, "/users", CREATE_USER);
+	assert_route(&router, HM_HEAD, "/users", USERS);
+	assert_route(&router, HM_GET, "/users/me", USER_ME);
+	ASSERT_EQ_INT(match.num_params, 0);
+
+	router_free(&router);
+}
+
+static void test_router_params(void) {
+	struct router router;
+	build(&router);
+
+	assert_route(&router, HM_GET, "/users/42", USER);
+	ASSERT_EQ_INT(match.num_params, 1);
+	ASSERT_EQ_SLICE(match.params[0], "42");
+
+	/* "me" is static, but only "/users/:id/posts" goes on */
+	assert_route(&router, HM_GET, "/users/me/posts", USER_POSTS);
+	ASSERT_EQ_SLICE(match.params[0], "me");
+
+	assert_route(&router, HM_GET, "/users/7/posts/hello", POST);
+	ASSERT_EQ_INT(match.num_params, 2);
+	ASSERT_EQ_SLICE(match.params[0], "7");
+	ASSERT_EQ_SLICE(match.params[1], "hello");
+
+	/* an empty segment is no parameter */
+	assert_route(&router, HM_GET, "/users//posts", FALLBACK);
+	ASSERT_EQ_INT(match.num_params, 0);
+
+	router_free(&router);
+}
+
+static void test_router_prefix(void) {
+	struct router router;
+	build(&router);
+
+	assert_route(&router, HM_GET, "/static/", STATIC);
+	ASSERT_EQ_SLICE(match.rest, "");
+	assert_route(&router, HM_GET, "/static/css/a.css", STATIC);
+	ASSERT_EQ_SLICE(match.rest, "css/a.css");
+	assert_route(&router, HM_GET, "/static/assets/x.png", ASSETS);
+	ASSERT_EQ_SLICE(match.rest, "x.png");
+	assert_route(&router, HM_GET, "/static", FALLBACK);
+	ASSERT_EQ_SLICE(match.rest, "static");
+	assert_route(&router, HM_GET, "/users/7/comments", FALLBACK);
+	ASSERT_EQ_INT(match.num_params, 0);
+	assert_route(&router, HM_DELETE, "/nothing/here", FALLBACK);
+
+	router_free(&router);
+}
+
+static void test_router_methods(void) {
+	struct router router;
+	build(&router);
+
+	ASSERT_EQ_INT(lookup(&router, HM_DELETE, "/users"), ROUTE_METHOD_NOT_ALLOWED);
+	ASSERT_EQ_INT(match.allowed,
+		METHOD_BIT(HM_GET) | METHOD_BIT(HM_HEAD) | METHOD_BIT(HM_POST));
+	ASSERT_EQ_INT(lookup(&router, HM_POST, "/static/a"), ROUTE_METHOD_NOT_ALLOWED);
+	ASSERT_EQ_INT(match.allowed, GET_HEAD);
+
+	router_free(&router);
+}
+
+static void test_router_bad_patterns(void) {
+	struct router router;
+
+	router_init(&router);
+	ASSERT_EQ_INT(lookup(&router, HM_GET, "/"), ROUTE_NOT_FOUND);
+	ASSERT_EQ_INT(router_add(&router, GET_HEAD, "", ROOT), -1);
+	ASSERT_EQ_INT(router_add(&router, GET_HEAD, "users", ROOT), -1);
+	ASSERT_EQ_INT(router_add(&router, GET_HEAD, "/a/:/b", ROOT), -1);
+	ASSERT_EQ_INT(router_add(&router, 0, "/a", ROOT), -1);
+	ASSERT_EQ_INT(router_add(&router, GET_HEAD, "/a", ROOT), 0);
+	ASSERT_EQ_INT(router_add(&router, METHOD_BIT(HM_GET), "/a", USERS), -1);
+	/* "*" and ":" are plain bytes away from the start of a segment */
+	ASSERT_EQ_INT(router_add(&router, GET_HEAD, "/a*b:c", USERS), 0);
+	router_compile(&router);
+
+	assert_route(&router, HM_GET, "/a*b:c", USERS);
+	ASSERT_EQ_INT(lookup(&router, HM_GET, "/ab"), ROUTE_NOT_FOUND);
+	ASSERT_EQ_INT(router_add(&router, GET_HEAD, "/late", ROOT), -1);
+
+	router_free(&router);
+}
+
+void run_router_tests(void) {
+	RUN_TEST(test_router_exact);
+	RUN_TEST(test_router_params);
+	RUN_TEST(test_router_prefix);
+	RUN_TEST(test_router_methods);
+	RUN_TEST(test_router_bad_patterns);
+}
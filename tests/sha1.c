@@ -0,0 +1,70 @@
+#include "sha1.h"
+#include "test.h"
+
+static void hex(const unsigned char *digest, char *out) {
+	static const char digits[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < SHA1_DIGEST_LEN; ++i) {
+		out[2 * i] = digits[digest[i] >> 4];
+		out[2 * i + 1] = digits[digest[i] & 0xf];
+	}
+	out[2 * SHA1_DIGEST_LEN] = '\0';
+}
+
+static void digest_of(const char *str, char *out) {
+	unsigned char digest[SHA1_DIGEST_LEN];
+	struct sha1 s;
+
+	sha1_init(&s);
+	sha1_update(&s, str, strlen(str));
+	sha1_final(&s, digest);
+	hex(digest, out);
+}
+
+/* FIPS 180-2 appendix A */
+static void test_sha1_vectors(void) {
+	unsigned char digest[SHA1_DIGEST_LEN];
+	char out[2 * SHA1_DIGEST_LEN + 1], a[1000];
+	struct sha1 s;
+	int i;
+
+	digest_of("", out);
+	ASSERT_EQ_MEM(out, strlen(out), "da39a3ee5e6b4b0d3255bfef95601890afd80709", 40);
+	digest_of("abc", out);
+	ASSERT_EQ_MEM(out, strlen(out), "a9993e364706816aba3e25717850c26c9cd0d89d", 40);
+	/* the length spills into another block */
+	digest_of("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", out);
+	ASSERT_EQ_MEM(out, strlen(out), "84983e441c3bd26ebaae4aa1f95129e5e54670f1", 40);
+
+	/* fed in pieces not lined up with blocks */
+	memset(a, 'a', sizeof a);
+	sha1_init(&s);
+	for (i = 0; i < 1000; ++i) {
+		sha1_update(&s, a, 999);
+		sha1_update(&s, a, 1);
+	}
+	sha1_final(&s, digest);
+	hex(digest, out);
+	ASSERT_EQ_MEM(out, strlen(out), "34aa973cd4c4daa4f61eeb2bdbad27316534016f", 40);
+}
+
+/* RFC 4648 section 10 */
+static void test_base64_encode(void) {
+	static const char *const encoded[] = {
+		"", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy"
+	};
+	char out[16];
+	size_t i, n;
+
+	for (i = 0; i < sizeof encoded / sizeof encoded[0]; ++i) {
+		n = base64_encode((const unsigned char *)"foobar", i, out);
+		ASSERT_EQ_MEM(out, n, encoded[i], strlen(encoded[i]));
+		ASSERT_EQ_INT(out[n], '\0');
+	}
+}
+
+void run_sha1_tests(void) {
+	RUN_TEST(test_sha1_vectors);
+	RUN_TEST(test_base64_encode);
+}
@@ -0,0 +1,180 @@
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "stream.h"
+#include "str.h"
+#include "test.h"
+
+#define PIECE 5000
+#define PIECES 10 /* three full chunks and a partial one */
+
+static char got[4 * PIECES * PIECE];
+
+struct counter {
+	size_t pieces, released;
+	int fail;
+};
+
+static int produce_pieces(struct stream *st, void *ctx) {
+	struct counter *c = ctx;
+	char piece[PIECE];
+
+	if (c->pieces == PIECES) return c->fail ? -1 : 0;
+	memset(piece, 'a' + (int)c->pieces, sizeof piece);
+	stream_write(st, piece, sizeof piece);
+	return ++c->pieces < PIECES || c->fail ? 1 : 0;
+}
+
+static void release_counter(void *ctx) {
+	((struct counter *)ctx)->released++;
+}
+
+/* stream the response for `raw` over a socketpair as the server does,
+   what the client got in `got` */
+static size_t run_stream(const char *raw, struct counter *c, int *pump_ret) {
+	struct http_request req;
+	struct parse_ctx ctx;
+	struct http_response resp;
+	struct body_stream source;
+	struct outq q;
+	struct stream st;
+	struct zerocopy zc;
+	struct zc_socket s;
+	int fds[2];
+	size_t total = 0;
+	ssize_t n;
+
+	ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+	ASSERT_EQ_INT(parse_ok(raw, &req, &ctx), 0);
+	resp = new_response();
+	/* the connection offered to persist */
+	resp.connection = CD_KEEP_ALIVE;
+	stream_response(&resp, &req, RC_200_OK, "", "Thu, 01 Jan 1970 00:00:00 GMT",
+		produce_pieces, release_counter, c);
+	END_TEST(ctx, req);
+
+	outq_init(&q);
+	zerocopy_init(&zc, 0);
+	zc_socket_init(&s, fds[0]);
+	source = resp.stream;
+	ASSERT_EQ_INT(outq_push_response(&q, &resp), 0);
+	stream_init(&st, &q, &source);
+
+	*pump_ret = 0;
+	do {
+		if (st.active) {
+			*pump_ret = stream_pump(&st);
+			/* never more than a chunk ahead of the socket */
+			ASSERT_TRUE(q.bytes <= 2 * STREAM_CHUNK);
+		}
+		ASSERT_TRUE(outq_flush(&q, &zc, &s) != OUTQ_ERROR);
+		while ((n = read(fds[1], got + total, sizeof got - total)) > 0) {
+			total += (size_t)n;
+		}
+	} while (st.active || q.bytes > 0);
+
+	stream_free(&st);
+	outq_free(&q);
+	close(fds[0]);
+	close(fds[1]);
+	return total;
+}
+
+/* the body past the head, with chunk framing undone; -1 if malformed */
+static long dechunk(const char *msg, size_t len, char *body) {
+	const char *p = strstr(msg, CRLF CRLF), *end = msg + len;
+	char *rest;
+	unsigned long size;
+	long body_len = 0;
+
+	if (p == NULL) return -1;
+	p += 4;
+	while (p < end) {
+		size = strtoul(p, &rest, 16);
+		if (rest == p || rest + 2 > end || memcmp(rest, CRLF, 2)) return -1;
+		p = rest + 2;
+		if (size == 0) return p + 2 == end && !memcmp(p, CRLF, 2) ? body_len : -1;
+		if (p + size + 2 > end || memcmp(p + size, CRLF, 2)) return -1;
+		memcpy(body + body_len, p, size);
+		body_len += (long)size;
+		p += size + 2;
+	}
+	return -1;
+}
+
+static int body_ok(const char *body, size_t len) {
+	size_t i;
+	if (len != PIECES * PIECE) return 0;
+	for (i = 0; i < len; ++i) {
+		if (body[i] != 'a' + (int)(i / PIECE)) return 0;
+	}
+	return 1;
+}
+
+static char body[PIECES * PIECE + 1];
+
+static void test_stream_chunked(void) {
+	struct counter c = {0, 0, 0};
+	int ret;
+	size_t len = run_stream("GET /s HTTP/1.1\r\nHost: a\r\n\r\n", &c, &ret);
+
+	got[len] = '\0';
+	ASSERT_EQ_INT(ret, 0);
+	ASSERT_EQ_INT(c.released, 1);
+	ASSERT_TRUE(strstr(got, "Transfer-Encoding: chunked" CRLF) != NULL);
+	ASSERT_TRUE(strstr(got, "Content-Length") == NULL);
+	ASSERT_TRUE(strstr(got, "Connection") == NULL);
+	ASSERT_EQ_INT(dechunk(got, len, body), PIECES * PIECE);
+	ASSERT_TRUE(body_ok(body, PIECES * PIECE));
+	/* full chunks carry their size in hex */
+	ASSERT_TRUE(strstr(got, CRLF CRLF "4000" CRLF) != NULL);
+}
+
+static void test_stream_close_delimited(void) {
+	struct counter c = {0, 0, 0};
+	int ret;
+	size_t len = run_stream("GET /s HTTP/1.0\r\nHost: a\r\n\r\n", &c, &ret);
+	const char *start;
+
+	got[len] = '\0';
+	ASSERT_EQ_INT(ret, 0);
+	ASSERT_EQ_INT(c.released, 1);
+	ASSERT_TRUE(strstr(got, "Transfer-Encoding") == NULL);
+	ASSERT_TRUE(strstr(got, "Connection: close" CRLF) != NULL);
+	start = strstr(got, CRLF CRLF) + 4;
+	ASSERT_TRUE(body_ok(start, len - (size_t)(start - got)));
+}
+
+static void test_stream_head(void) {
+	struct counter c = {0, 0, 0};
+	int ret;
+	size_t len = run_stream("HEAD /s HTTP/1.1\r\nHost: a\r\n\r\n", &c, &ret);
+
+	got[len] = '\0';
+	ASSERT_EQ_INT(c.pieces, 0);
+	ASSERT_EQ_INT(c.released, 1);
+	ASSERT_TRUE(strstr(got, "Transfer-Encoding: chunked" CRLF) != NULL);
+	ASSERT_EQ_INT((size_t)(strstr(got, CRLF CRLF) + 4 - got), len);
+}
+
+static void test_stream_failure(void) {
+	struct counter c = {0, 0, 1};
+	int ret;
+	size_t len = run_stream("GET /s HTTP/1.1\r\nHost: a\r\n\r\n", &c, &ret);
+
+	/* what was produced goes out, but never the last chunk */
+	ASSERT_EQ_INT(ret, -1);
+	ASSERT_EQ_INT(c.released, 1);
+	ASSERT_EQ_INT(dechunk(got, len, body), -1);
+	ASSERT_TRUE(len > PIECES * PIECE);
+}
+
+void run_stream_tests(void) {
+	RUN_TEST(test_stream_chunked);
+	RUN_TEST(test_stream_close_delimited);
+	RUN_TEST(test_stream_head);
+	RUN_TEST(test_stream_failure);
+}
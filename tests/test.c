@@ -82,6 +82,22 @@ void assert_target_absolute(
 	ASSERT_EQ_INT(req->port, port);
 }
 
+void assert_target_authority(
+		const struct http_request *req,
+		const char *raw,
+		const char *host,
+		int port
+) {
+	ASSERT_EQ_INT(req->target_form, TF_AUTHORITY);
+	ASSERT_EQ_SLICE(req->raw_target, raw);
+	ASSERT_EQ_SLICE(req->host, host);
+	ASSERT_EQ_SLICE(req->authority, raw);
+	ASSERT_SLICE_UNSET(req->scheme);
+	ASSERT_SLICE_UNSET(req->path);
+	ASSERT_SLICE_UNSET(req->query);
+	ASSERT_EQ_INT(req->port, port);
+}
+
 void assert_list_eq(
 		const struct http_request *req,
 		enum http_header_type type,
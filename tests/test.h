@@ -160,6 +160,12 @@ void assert_target_absolute(
 		const char *path,
 		const char *query
 );
+void assert_target_authority(
+		const struct http_request *req,
+		const char *raw,
+		const char *host,
+		int port
+);
 
 void assert_list_eq(
 		const struct http_request *req,
@@ -168,4 +174,38 @@ void assert_list_eq(
 		size_t n_items
 );
 
+/* test suites, one per tested module */
+void run_parser_tests(void);
+void run_path_tests(void);
+void run_fdcache_tests(void);
+void run_negcache_tests(void);
+void run_encoding_tests(void);
+void run_deflate_tests(void);
+void run_zcache_tests(void);
+void run_range_tests(void);
+void run_datetime_tests(void);
+void run_conditional_tests(void);
+void run_router_tests(void);
+void run_vhost_tests(void);
+void run_embedded_tests(void);
+void run_readahead_tests(void);
+void run_zerocopy_tests(void);
+void run_outq_tests(void);
+void run_evloop_tests(void);
+void run_stream_tests(void);
+void run_proxy_tests(void);
+void run_balancer_tests(void);
+void run_pcache_tests(void);
+void run_tunnel_tests(void);
+void run_fastcgi_tests(void);
+void run_hpack_tests(void);
+void run_h2_tests(void);
+void run_sha1_tests(void);
+void run_ws_tests(void);
+void run_response_tests(void);
+void run_listener_tests(void);
+void run_acl_tests(void);
+void run_resolver_tests(void);
+void run_lru_tests(void);
+
 #endif
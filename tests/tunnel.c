@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "tunnel.h"
+#include "test.h"
+
+/* a stand-in upstream listening on loopback */
+struct origin_end {
+	int listener;
+	int conn;
+	char name[32];
+};
+
+static void origin_init(struct origin_end *o) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof addr;
+
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	o->listener = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_TRUE(o->listener != -1);
+	ASSERT_EQ_INT(bind(o->listener, (void *)&addr, sizeof addr), 0);
+	ASSERT_EQ_INT(listen(o->listener, 8), 0);
+	ASSERT_EQ_INT(getsockname(o->listener, (void *)&addr, &len), 0);
+	sprintf(o->name, "127.0.0.1:%u", (unsigned)ntohs(addr.sin_port));
+	o->conn = -1;
+}
+
+static int notified;
+
+static void count_notify(struct tunnel *t) {
+	(void)t;
+	notified++;
+}
+
+/* the client's connection: `fds[0]` is the tunnel's end */
+struct client_end {
+	int fds[2];
+	struct outq out;
+	struct zerocopy zc;
+	struct zc_socket zs;
+	int eof; /* read 0 on fds[1] */
+};
+
+static void client_init(struct client_end *c) {
+	ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, c->fds), 0);
+	fcntl(c->fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(c->fds[1], F_SETFL, O_NONBLOCK);
+	outq_init(&c->out);
+	zerocopy_init(&c->zc, 0);
+	zc_socket_init(&c->zs, c->fds[0]);
+	c->eof = 0;
+}
+
+static void client_free(struct client_end *c) {
+	outq_free(&c->out);
+	close(c->fds[0]);
+	close(c->fds[1]);
+}
+
+/* a round of the loop, the owner's part included; what reached the
+   client is appended to `got` */
+static void step(struct evloop *loop, struct tunnel *t, struct client_end *c, char *got, size_t *got_len) {
+	ssize_t n;
+
+	ASSERT_TRUE(evloop_run_once(loop, 10) >= 0);
+	while (tunnel_room(t) > 0 && (n = tunnel_pull(t, c->fds[0])) > 0);
+	if (outq_flush(&c->out, &c->zc, &c->zs) == OUTQ_DONE) {
+		/* the owner would close the connection once done */
+		if (t->state == TN_DONE) shutdown(c->fds[0], SHUT_WR);
+		tunnel_drained(t);
+	}
+	tunnel_resume(t);
+	while ((n = read(c->fds[1], got + *got_len, 256 - *got_len)) > 0) *got_len += (size_t)n;
+	if (n == 0) c->eof = 1;
+}
+
+/* read what reached the origin into `buf`, 0 at its end; what reached
+   the client meanwhile is appended to `got` */
+static ssize_t origin_read(struct evloop *loop, struct tunnel *t, struct client_end *c,
+		struct origin_end *o, char *buf, size_t want, char *got, size_t *got_len) {
+	size_t len = 0;
+	ssize_t n = -1;
+	int rounds;
+
+	for (rounds = 0; len < want && rounds < 50; ++rounds) {
+		step(loop, t, c, got, got_len);
+		while (len < want && (n = read(o->conn, buf + len, want - len)) > 0) len += (size_t)n;
+		if (n == 0) return 0;
+	}
+	return (ssize_t)len;
+}
+
+static void test_tunnel_relay(void) {
+	struct evloop loop;
+	struct origin_end o;
+	struct upstream up;
+	struct tunnel t;
+	struct client_end c;
+	char got[256], buf[64];
+	size_t got_len = 0;
+	ssize_t n;
+	int rounds;
+
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	origin_init(&o);
+	ASSERT_EQ_INT(upstream_init(&up, o.name), 0);
+	client_init(&c);
+
+	/* what came along with the CONNECT goes first */
+	tunnel_init(&t, &loop, &up, c.fds[0], &c.out, count_notify, NULL);
+	tunnel_start(&t, "early", 5);
+	ASSERT_EQ_INT(up.outstanding, 1);
+	for (rounds = 0; t.state == TN_CONNECTING && rounds < 50; ++rounds) {
+		step(&loop, &t, &c, got, &got_len);
+	}
+	ASSERT_EQ_INT(t.state, TN_OPEN);
+	o.conn = accept(o.listener, NULL, NULL);
+	ASSERT_TRUE(o.conn != -1);
+	fcntl(o.conn, F_SETFL, O_NONBLOCK);
+	n = origin_read(&loop, &t, &c, &o, buf, 5, got, &got_len);
+	ASSERT_EQ_MEM(buf, (size_t)n, "early", 5);
+	ASSERT_EQ_MEM(got, got_len, TUNNEL_ESTABLISHED, strlen(TUNNEL_ESTABLISHED));
+	got_len = 0;
+
+	/* either way */
+	ASSERT_EQ_INT(write(c.fds[1], "ping", 4), 4);
+	n = origin_read(&loop, &t, &c, &o, buf, 4, got, &got_len);
+	ASSERT_EQ_MEM(buf, (size_t)n, "ping", 4);
+	ASSERT_EQ_INT(write(o.conn, "pong", 4), 4);
+	for (rounds = 0; got_len < 4 && rounds < 50; ++rounds) step(&loop, &t, &c, got, &got_len);
+	ASSERT_EQ_MEM(got, got_len, "pong", 4);
+	got_len = 0;
+
+	/* the client's end reaches the origin, which may still answer */
+	shutdown(c.fds[1], SHUT_WR);
+	n = origin_read(&loop, &t, &c, &o, buf, sizeof buf, got, &got_len);
+	ASSERT_EQ_INT(n, 0);
+	ASSERT_EQ_INT(t.state, TN_OPEN);
+	ASSERT_EQ_INT(write(o.conn, "late", 4), 4);
+	close(o.conn);
+	for (rounds = 0; !c.eof && rounds < 50; ++rounds) step(&loop, &t, &c, got, &got_len);
+	ASSERT_EQ_MEM(got, got_len, "late", 4);
+	ASSERT_EQ_INT(c.eof, 1);
+	ASSERT_EQ_INT(t.state, TN_DONE);
+	ASSERT_EQ_INT(t.src.fd, -1);
+	ASSERT_EQ_INT(up.outstanding, 0);
+	ASSERT_TRUE(up.stats.spliced >= 8);
+	ASSERT_EQ_INT(up.num_idle, 0);
+	ASSERT_TRUE(notified > 0);
+	client_free(&c);
+	tunnel_free(&t);
+
+	close(o.listener);
+	upstream_free(&up);
+	evloop_free(&loop);
+}
+
+static void test_tunnel_ends(void) {
+	struct evloop loop;
+	struct origin_end o;
+	struct upstream up;
+	struct tunnel t;
+	struct client_end c;
+	char got[256];
+	size_t got_len = 0;
+	int rounds;
+
+	ASSERT_EQ_INT(evloop_init(&loop), 0);
+	origin_init(&o);
+	ASSERT_EQ_INT(upstream_init(&up, o.name), 0);
+
+	/* the origin ends first: the client gets its end and may go on
+	   sending, to no one once the origin is gone */
+	client_init(&c);
+	tunnel_init(&t, &loop, &up, c.fds[0], &c.out, count_notify, NULL);
+	tunnel_start(&t, NULL, 0);
+	for (rounds = 0; o.conn == -1 && rounds < 50; ++rounds) {
+		step(&loop, &t, &c, got, &got_len);
+		o.conn = accept(o.listener, NULL, NULL);
+	}
+	ASSERT_TRUE(o.conn != -1);
+	ASSERT_EQ_INT(write(o.conn, "bye", 3), 3);
+	close(o.conn);
+	for (rounds = 0; !c.eof && rounds < 50; ++rounds) step(&loop, &t, &c, got, &got_len);
+	ASSERT_EQ_MEM(got, got_len, TUNNEL_ESTABLISHED "bye", strlen(TUNNEL_ESTABLISHED) + 3);
+	ASSERT_EQ_INT(t.client_shut, 1);
+	shutdown(c.fds[1], SHUT_WR);
+	for (rounds = 0; t.state == TN_OPEN && rounds < 50; ++rounds) {
+		step(&loop, &t, &c, got, &got_len);
+	}
+	ASSERT_EQ_INT(t.state, TN_DONE);
+	ASSERT_EQ_INT(up.outstanding, 0);
+	client_free(&c);
+	tunnel_free(&t);
+
+	/* the origin cannot be reached: the client gets a 502 */
+	close(o.listener);
+	got_len = 0;
+	client_init(&c);
+	tunnel_init(&t, &loop, &up, c.fds[0], &c.out, count_notify, NULL);
+	tunnel_start(&t, "early", 5);
+	for (rounds = 0; t.state == TN_CONNECTING && rounds < 50; ++rounds) {
+		step(&loop, &t, &c, got, &got_len);
+	}
+	ASSERT_EQ_INT(t.state, TN_DONE);
+	step(&loop, &t, &c, got, &got_len);
+	ASSERT_TRUE(got_len > 26 && !memcmp(got, "HTTP/1.1 502 Bad Gateway" CRLF, 26));
+	ASSERT_EQ_INT(tunnel_room(&t), 0);
+	ASSERT_EQ_INT(up.outstanding, 0);
+	ASSERT_EQ_INT(up.stats.failures, 1);
+	client_free(&c);
+	tunnel_free(&t);
+
+	upstream_free(&up);
+	evloop_free(&loop);
+}
+
+void run_tunnel_tests(void) {
+	RUN_TEST(test_tunnel_relay);
+	RUN_TEST(test_tunnel_ends);
+}
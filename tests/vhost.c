@@ -0,0 +1,66 @@
+#include "test.h"
+#include "vhost.h"
+
+static struct vhost *lookup(const struct vhost_table *table, const char *host) {
+	struct slice sl = get_slice(host, strlen(host));
+	return vhost_lookup(table, &sl);
+}
+
+static void test_vhost_lookup(void) {
+	struct vhost_table table;
+
+	vhost_table_init(&table);
+	ASSERT_EQ_INT(vhost_add(&table, "example.com", "/srv/a"), 0);
+	ASSERT_EQ_INT(vhost_add(&table, "WWW.Example.com.", "/srv/b"), 0);
+	ASSERT_EQ_INT(vhost_add(&table, "[::1]", "/srv/c"), 0);
+	ASSERT_EQ_INT(vhost_add(&table, NULL, "/srv/default"), 0);
+	vhost_table_build(&table);
+
+	ASSERT_TRUE(!strcmp(lookup(&table, "example.com")->docroot, "/srv/a"));
+	ASSERT_TRUE(!strcmp(lookup(&table, "EXAMPLE.com:8080")->docroot, "/srv/a"));
+	ASSERT_TRUE(!strcmp(lookup(&table, "example.com.")->docroot, "/srv/a"));
+	ASSERT_TRUE(!strcmp(lookup(&table, "www.example.com")->docroot, "/srv/b"));
+	ASSERT_TRUE(!strcmp(lookup(&table, "[::1]:80")->docroot, "/srv/c"));
+
+	ASSERT_TRUE(lookup(&table, "example.org")->name == NULL);
+	ASSERT_TRUE(lookup(&table, "")->name == NULL);
+	ASSERT_TRUE(lookup(&table, ":80")->name == NULL);
+	ASSERT_TRUE(lookup(&table, "xexample.com")->name == NULL);
+
+	vhost_table_free(&table);
+}
+
+static void test_vhost_add(void) {
+	struct vhost_table table;
+	char name[32];
+	size_t i;
+
+	vhost_table_init(&table);
+	ASSERT_EQ_INT(vhost_add(&table, "", "/srv"), -1);
+	ASSERT_EQ_INT(vhost_add(&table, "a.com:80", "/srv"), -1);
+	ASSERT_EQ_INT(vhost_add(&table, "a.com", "/srv"), 0);
+	ASSERT_EQ_INT(vhost_add(&table, "A.COM", "/srv"), -1);
+	ASSERT_EQ_INT(vhost_add(&table, NULL, NULL), 0);
+	ASSERT_EQ_INT(vhost_add(&table, NULL, NULL), -1);
+
+	/* many names still get a slot each */
+	for (i = 0; i < 200; ++i) {
+		sprintf(name, "host%lu.example", (unsigned long)i);
+		ASSERT_EQ_INT(vhost_add(&table, name, NULL), 0);
+	}
+	vhost_table_build(&table);
+	for (i = 0; i < 200; ++i) {
+		struct vhost *host;
+		sprintf(name, "host%lu.example", (unsigned long)i);
+		host = lookup(&table, name);
+		ASSERT_TRUE(host->name != NULL && !strcmp(host->name, name));
+	}
+	ASSERT_TRUE(lookup(&table, "a.com")->name != NULL);
+
+	vhost_table_free(&table);
+}
+
+void run_vhost_tests(void) {
+	RUN_TEST(test_vhost_lookup);
+	RUN_TEST(test_vhost_add);
+}
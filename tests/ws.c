@@ -0,0 +1,332 @@
+#include "ws.h"
+#include "test.h"
+
+#define UPGRADE_HEADERS \
+	HOST("example.com") \
+	H("Upgrade", "websocket") \
+	H("Connection", "Upgrade")
+
+/* an endpoint keeping what it got, "type:message|" each */
+struct received {
+	char text[512];
+	size_t len;
+	int opened, closed, notified;
+};
+
+static void on_open(struct ws_conn *ws) {
+	((struct received *)ws->owner)->opened++;
+}
+
+static void on_message(struct ws_conn *ws, enum ws_opcode type, const char *data, size_t len) {
+	struct received *r = ws->owner;
+
+	ASSERT_TRUE(r->len + len + 3 <= sizeof r->text);
+	r->text[r->len++] = type == WS_TEXT ? 't' : 'b';
+	r->text[r->len++] = ':';
+	memcpy(r->text + r->len, data, len);
+	r->len += len;
+	r->text[r->len++] = '|';
+}
+
+static void on_close(struct ws_conn *ws) {
+	((struct received *)ws->owner)->closed++;
+}
+
+static void on_notify(struct ws_conn *ws) {
+	((struct received *)ws->owner)->notified++;
+}
+
+static const struct ws_handler recorder = {on_open, on_message, on_close};
+
+/* what the server queued, all of it in memory */
+static size_t queued(const struct outq *q, unsigned char *out) {
+	const struct outq_seg *seg;
+	size_t i, n = 0;
+
+	for (i = 0; i < q->count; ++i) {
+		seg = q->segs + (q->head + i) % q->cap;
+		memcpy(out + n, seg->ptr, seg->len);
+		n += seg->len;
+	}
+	return n;
+}
+
+/* a client frame with `payload` masked, into `out`: its length */
+static size_t client_frame(unsigned char *out, int first, const char *payload, size_t len) {
+	static const unsigned char mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+	size_t n = 2, i;
+
+	out[0] = (unsigned char)first;
+	if (len < 126) {
+		out[1] = (unsigned char)(0x80 | len);
+	} else {
+		out[1] = 0x80 | 126;
+		out[2] = (unsigned char)(len >> 8);
+		out[3] = (unsigned char)len;
+		n = 4;
+	}
+	memcpy(out + n, mask, 4);
+	n += 4;
+	for (i = 0; i < len; ++i) {
+		out[n + i] = (unsigned char)(payload[i] ^ mask[i % 4]);
+	}
+	return n + len;
+}
+
+static void open_conn(struct ws_conn *ws, struct outq *out, struct received *r) {
+	memset(r, 0, sizeof *r);
+	outq_init(out);
+	ws_conn_init(ws, out, &recorder, on_notify, r);
+}
+
+static void test_ws_accept_key(void) {
+	char accept[WS_ACCEPT_LEN + 1];
+
+	/* section 1.3 */
+	ws_accept_key("dGhlIHNhbXBsZSBub25jZQ==", 24, accept);
+	ASSERT_EQ_MEM(accept, strlen(accept), "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=", WS_ACCEPT_LEN);
+}
+
+static void test_ws_handshake(void) {
+	struct http_request req;
+	struct parse_ctx ctx;
+	char accept[WS_ACCEPT_LEN + 1];
+	int ret;
+
+	ret = parse_ok(RL11("GET", "/chat") UPGRADE_HEADERS
+		H("Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==")
+		H("Sec-WebSocket-Version", "13") END, &req, &ctx);
+	ASSERT_EQ_INT(ret, 0);
+	ret = ws_handshake(&req, accept);
+	ASSERT_EQ_INT(ret, 0);
+	ASSERT_EQ_MEM(accept, strlen(accept), "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=", WS_ACCEPT_LEN);
+	END_TEST(ctx, req);
+
+	/* not asking, or for another version: the client is told what to ask */
+	ret = parse_ok(RL11("GET", "/chat") HOST("example.com") END, &req, &ctx);
+	ASSERT_EQ_INT(ret, 0);
+	ret = ws_handshake(&req, accept);
+	ASSERT_EQ_INT(ret, RC_426_UPGRADE_REQUIRED);
+	END_TEST(ctx, req);
+	ret = parse_ok(RL11("GET", "/chat") UPGRADE_HEADERS
+		H("Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==")
+		H("Sec-WebSocket-Version", "8") END, &req, &ctx);
+	ASSERT_EQ_INT(ret, 0);
+	ret = ws_handshake(&req, accept);
+	ASSERT_EQ_INT(ret, RC_426_UPGRADE_REQUIRED);
+	END_TEST(ctx, req);
+
+	/* a key that is not 16 bytes, or a body */
+	ret = parse_ok(RL11("GET", "/chat") UPGRADE_HEADERS
+		H("Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZR==")
+		H("Sec-WebSocket-Version", "13") END, &req, &ctx);
+	ASSERT_EQ_INT(ret, 0);
+	ret = ws_handshake(&req, accept);
+	ASSERT_EQ_INT(ret, RC_400_BAD_REQUEST);
+	END_TEST(ctx, req);
+	ret = parse_ok(RL11("GET", "/chat") UPGRADE_HEADERS
+		H("Sec-WebSocket-Version", "13") END, &req, &ctx);
+	ASSERT_EQ_INT(ret, 0);
+	ret = ws_handshake(&req, accept);
+	ASSERT_EQ_INT(ret, RC_400_BAD_REQUEST);
+	END_TEST(ctx, req);
+	ret = parse_ok(RL11("GET", "/chat") UPGRADE_HEADERS
+		H("Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==")
+		H("Sec-WebSocket-Version", "13")
+		H("Content-Length", "2") END "hi", &req, &ctx);
+	ASSERT_EQ_INT(ret, 0);
+	ret = ws_handshake(&req, accept);
+	ASSERT_EQ_INT(ret, RC_400_BAD_REQUEST);
+	END_TEST(ctx, req);
+}
+
+/* against a byte at a time, at every alignment and mask offset */
+static void test_ws_unmask(void) {
+	static const unsigned char mask[4] = {0x01, 0x80, 0x5a, 0xff};
+	unsigned char buf[80], expect[80];
+	size_t start, len, offset, i;
+
+	for (start = 0; start < 8; ++start) {
+		for (len = 0; len <= 64; ++len) {
+			for (offset = 0; offset < 4; ++offset) {
+				for (i = 0; i < len; ++i) {
+					buf[start + i] = (unsigned char)(i * 7);
+					expect[i] = (unsigned char)(i * 7) ^ mask[(offset + i) % 4];
+				}
+				ws_unmask(buf + start, len, mask, offset);
+				ASSERT_TRUE(memcmp(buf + start, expect, len) == 0);
+			}
+		}
+	}
+}
+
+static void test_ws_utf8(void) {
+	static const char valid[] = "h\xc3\xa9llo w\xe2\x82\xacrld, \xf0\x9f\x98\x80 and then some ASCII";
+	int ret;
+
+	ret = ws_utf8_valid((const unsigned char *)valid, sizeof valid - 1);
+	ASSERT_EQ_INT(ret, 1);
+	ret = ws_utf8_valid((const unsigned char *)"", 0);
+	ASSERT_EQ_INT(ret, 1);
+	/* truncated, overlong, a surrogate, past U+10FFFF, a stray continuation */
+	ret = ws_utf8_valid((const unsigned char *)"abcdefgh\xe2\x82", 10);
+	ASSERT_EQ_INT(ret, 0);
+	ret = ws_utf8_valid((const unsigned char *)"\xc0\xaf", 2);
+	ASSERT_EQ_INT(ret, 0);
+	ret = ws_utf8_valid((const unsigned char *)"\xed\xa0\x80", 3);
+	ASSERT_EQ_INT(ret, 0);
+	ret = ws_utf8_valid((const unsigned char *)"\xf4\x90\x80\x80", 4);
+	ASSERT_EQ_INT(ret, 0);
+	ret = ws_utf8_valid((const unsigned char *)"a\x80", 2);
+	ASSERT_EQ_INT(ret, 0);
+}
+
+static void test_ws_messages(void) {
+	unsigned char in[512], out[512], copy[512];
+	char big[300];
+	struct ws_conn ws;
+	struct outq q;
+	struct received r;
+	size_t n = 0, len, i;
+
+	/* a text message, a fragmented binary one with a ping amid it, a large
+	   one and an empty one */
+	memset(big, 'x', sizeof big);
+	n += client_frame(in + n, 0x81, "hello", 5);
+	n += client_frame(in + n, 0x02, "ab", 2);
+	n += client_frame(in + n, 0x89, "p", 1);
+	n += client_frame(in + n, 0x00, "", 0);
+	n += client_frame(in + n, 0x80, "cd", 2);
+	n += client_frame(in + n, 0x81, big, sizeof big);
+	n += client_frame(in + n, 0x81, "", 0);
+
+	/* whole, then a byte at a time */
+	open_conn(&ws, &q, &r);
+	ASSERT_EQ_INT(r.opened, 1);
+	memcpy(copy, in, n);
+	ws_conn_feed(&ws, (char *)copy, n);
+	ASSERT_EQ_MEM(r.text, 15, "t:hello|b:abcd|", 15);
+	ASSERT_EQ_INT(r.len, 15 + 2 + sizeof big + 1 + 3);
+	len = queued(&q, out);
+	ASSERT_EQ_MEM(out, len, "\x8a\x01p", 3);
+	ASSERT_EQ_INT(r.notified, 0);
+	ws_conn_free(&ws);
+	ASSERT_EQ_INT(r.closed, 1);
+	outq_free(&q);
+
+	open_conn(&ws, &q, &r);
+	memcpy(copy, in, n);
+	for (i = 0; i < n; ++i) {
+		ws_conn_feed(&ws, (char *)copy + i, 1);
+	}
+	ASSERT_EQ_INT(r.len, 15 + 2 + sizeof big + 1 + 3);
+	ASSERT_EQ_MEM(r.text + r.len - 3, 3, "t:|", 3);
+	ASSERT_TRUE(ws.msg == NULL && ws.control == NULL);
+
+	/* the client closes, its status echoed */
+	n = client_frame(in, 0x88, "\x03\xe8" "bye", 5);
+	ws_conn_feed(&ws, (char *)in, n);
+	ASSERT_TRUE(ws_conn_done(&ws));
+	len = queued(&q, out);
+	ASSERT_EQ_MEM(out + 3, len - 3, "\x88\x02\x03\xe8", 4);
+	ws_conn_free(&ws);
+	outq_free(&q);
+}
+
+/* a bad frame gets a close frame with the status saying why */
+static void assert_fails(const unsigned char *frame, size_t len, const char *close) {
+	unsigned char copy[64], out[64];
+	struct ws_conn ws;
+	struct outq q;
+	struct received r;
+	size_t n;
+
+	open_conn(&ws, &q, &r);
+	memcpy(copy, frame, len);
+	ws_conn_feed(&ws, (char *)copy, len);
+	ASSERT_TRUE(ws.failed);
+	ASSERT_TRUE(ws_conn_done(&ws));
+	ASSERT_EQ_INT(r.len, 0);
+	n = queued(&q, out);
+	ASSERT_EQ_MEM(out, n, close, 4);
+	ws_conn_free(&ws);
+	outq_free(&q);
+}
+
+static void test_ws_errors(void) {
+	static const unsigned char unmasked[] = {0x81, 0x01, 'a'};
+	static const unsigned char reserved[] = {0xc1, 0x80, 0, 0, 0, 0};
+	static const unsigned char opcode[] = {0x83, 0x80, 0, 0, 0, 0};
+	static const unsigned char fragmented_ping[] = {0x09, 0x80, 0, 0, 0, 0};
+	static const unsigned char long_ping[] = {0x89, 0xfe, 0, 126, 0, 0, 0, 0};
+	static const unsigned char continuation[] = {0x80, 0x80, 0, 0, 0, 0};
+	static const unsigned char interleaved[] = {0x01, 0x80, 0, 0, 0, 0, 0x81, 0x80, 0, 0, 0, 0};
+	static const unsigned char huge[] = {0x82, 0xff, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0};
+	static const unsigned char too_big[] = {0x82, 0xff, 0, 0, 0, 0, 0, 0x20, 0, 0, 0, 0, 0, 0};
+	static const unsigned char bad_text[] = {0x81, 0x82, 0, 0, 0, 0, 0xc0, 0xaf};
+	static const unsigned char bad_status[] = {0x88, 0x82, 0, 0, 0, 0, 0x03, 0xed};
+	static const unsigned char short_close[] = {0x88, 0x81, 0, 0, 0, 0, 0x03};
+
+	assert_fails(unmasked, sizeof unmasked, "\x88\x02\x03\xea");
+	assert_fails(reserved, sizeof reserved, "\x88\x02\x03\xea");
+	assert_fails(opcode, sizeof opcode, "\x88\x02\x03\xea");
+	assert_fails(fragmented_ping, sizeof fragmented_ping, "\x88\x02\x03\xea");
+	assert_fails(long_ping, sizeof long_ping, "\x88\x02\x03\xea");
+	assert_fails(continuation, sizeof continuation, "\x88\x02\x03\xea");
+	assert_fails(interleaved, sizeof interleaved, "\x88\x02\x03\xea");
+	assert_fails(huge, sizeof huge, "\x88\x02\x03\xf1");
+	assert_fails(too_big, sizeof too_big, "\x88\x02\x03\xf1");
+	assert_fails(bad_text, sizeof bad_text, "\x88\x02\x03\xef");
+	assert_fails(bad_status, sizeof bad_status, "\x88\x02\x03\xea");
+	assert_fails(short_close, sizeof short_close, "\x88\x02\x03\xea");
+}
+
+/* what is sent outside of a read wakes the owner, server frames unmasked */
+static void test_ws_push(void) {
+	unsigned char out[512], in[16];
+	char big[200];
+	struct ws_conn ws;
+	struct outq q;
+	struct received r;
+	size_t len, n;
+
+	open_conn(&ws, &q, &r);
+	memset(big, 'y', sizeof big);
+	ws_send(&ws, WS_TEXT, "news", 4);
+	ws_send(&ws, WS_BINARY, big, sizeof big);
+	ASSERT_EQ_INT(r.notified, 2);
+	len = queued(&q, out);
+	ASSERT_EQ_INT(len, 6 + 4 + sizeof big);
+	ASSERT_EQ_MEM(out, 6, "\x81\x04news", 6);
+	ASSERT_EQ_MEM(out + 6, 4, "\x82\x7e\x00\xc8", 4);
+
+	/* idle: pinged until the client says anything */
+	ws_ping(&ws);
+	ASSERT_TRUE(ws.pinged);
+	n = client_frame(in, 0x8a, "", 0);
+	ws_conn_feed(&ws, (char *)in, n);
+	ASSERT_TRUE(!ws.pinged);
+
+	/* closing, nothing more is sent until the client's close comes */
+	ws_close(&ws, WS_GOING_AWAY);
+	ws_send(&ws, WS_TEXT, "late", 4);
+	ASSERT_EQ_INT(r.notified, 4);
+	ASSERT_TRUE(!ws_conn_done(&ws));
+	n = client_frame(in, 0x88, "", 0);
+	ws_conn_feed(&ws, (char *)in, n);
+	ASSERT_TRUE(ws_conn_done(&ws));
+	len = queued(&q, out);
+	ASSERT_EQ_MEM(out + len - 4, 4, "\x88\x02\x03\xe9", 4);
+	ws_conn_free(&ws);
+	outq_free(&q);
+}
+
+void run_ws_tests(void) {
+	RUN_TEST(test_ws_accept_key);
+	RUN_TEST(test_ws_handshake);
+	RUN_TEST(test_ws_unmask);
+	RUN_TEST(test_ws_utf8);
+	RUN_TEST(test_ws_messages);
+	RUN_TEST(test_ws_errors);
+	RUN_TEST(test_ws_push);
+}
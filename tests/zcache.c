@@ -0,0 +1,66 @@
+#include "test.h"
+#include "zcache.h"
+
+static unsigned char *bytes(size_t len) {
+	unsigned char *data = malloc(len);
+	ASSERT_TRUE(data != NULL);
+	memset(data, 'z', len);
+	return data;
+}
+
+static const struct zcache_entry *get(struct zcache *cache, const char *key) {
+	return zcache_get(cache, key, strlen(key));
+}
+
+static void put(struct zcache *cache, const char *key, size_t len) {
+	zcache_put(cache, key, strlen(key), len ? bytes(len) : NULL, len);
+}
+
+static void test_zcache_lru(void) {
+	struct zcache cache;
+	const struct zcache_entry *e;
+
+	zcache_init(&cache, 2, 1000);
+	ASSERT_TRUE(get(&cache, "\"1\"") == NULL);
+
+	put(&cache, "\"1\"", 10);
+	put(&cache, "\"2\"", 20);
+	e = get(&cache, "\"1\"");
+	ASSERT_TRUE(e != NULL && e->len == 10 && e->data != NULL);
+	put(&cache, "\"3\"", 30); /* evicts "2", "1" was touched last */
+	ASSERT_TRUE(get(&cache, "\"1\"") != NULL);
+	ASSERT_TRUE(get(&cache, "\"2\"") == NULL);
+	ASSERT_EQ_INT(cache.bytes, 40);
+	ASSERT_EQ_INT(cache.stats.evictions, 1);
+
+	/* incompressible results are remembered without data */
+	put(&cache, "\"4\"", 0);
+	e = get(&cache, "\"4\"");
+	ASSERT_TRUE(e != NULL && e->data == NULL);
+	ASSERT_EQ_INT(cache.stats.incompressible, 1);
+
+	zcache_free(&cache);
+}
+
+static void test_zcache_bytes(void) {
+	struct zcache cache;
+
+	zcache_init(&cache, 16, 100);
+	put(&cache, "\"a\"", 40);
+	put(&cache, "\"b\"", 40);
+	put(&cache, "\"c\"", 40); /* over budget, "a" goes */
+	ASSERT_TRUE(get(&cache, "\"a\"") == NULL);
+	ASSERT_TRUE(get(&cache, "\"b\"") != NULL);
+	ASSERT_EQ_INT(cache.bytes, 80);
+
+	/* larger than the whole budget: not stored, nothing evicted */
+	ASSERT_TRUE(zcache_put(&cache, "\"d\"", 3, bytes(101), 101) == NULL);
+	ASSERT_EQ_INT(cache.lru.count, 2);
+
+	zcache_free(&cache);
+}
+
+void run_zcache_tests(void) {
+	RUN_TEST(test_zcache_lru);
+	RUN_TEST(test_zcache_bytes);
+}
@@ -0,0 +1,23 @@
+#include "test.h"
+#include "zerocopy.h"
+
+static void test_zerocopy_policy(void) {
+	struct zerocopy zc;
+	unsigned i;
+
+	zerocopy_init(&zc, 1);
+	zc_completed(&zc, ZC_COPIED_LIMIT - 1, 1);
+	ASSERT_EQ_INT(zc.enabled, 1);
+	/* a real zerocopy completion starts the count over */
+	zc_completed(&zc, 1, 0);
+	for (i = 0; i < ZC_COPIED_LIMIT - 1; ++i) zc_completed(&zc, 1, 1);
+	ASSERT_EQ_INT(zc.enabled, 1);
+	zc_completed(&zc, 1, 1);
+	ASSERT_EQ_INT(zc.enabled, 0);
+	ASSERT_EQ_INT(zc.stats.completions, 2 * ZC_COPIED_LIMIT);
+	ASSERT_EQ_INT(zc.stats.copied, 2 * ZC_COPIED_LIMIT - 1);
+}
+
+void run_zerocopy_tests(void) {
+	RUN_TEST(test_zerocopy_policy);
+}
@@ -0,0 +1,368 @@
+#define _XOPEN_SOURCE 500
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "datetime.h"
+#include "deflate.h"
+#include "origin.h"
+#include "str.h"
+#include "zcache.h"
+
+/* compile a docroot into a C translation unit defining embedded_docroot
+   (see embedded.h): every file with its gzip variant when that pays off,
+   header fields serialized and keys behind a collision-free hash */
+
+#define INDEX_FILE "index.html"
+#define SEED_TRIES 64
+#define BYTES_PER_LINE 16
+
+struct source {
+	char *path; /* on disk */
+	char *key; /* relative to the docroot */
+	time_t mtime;
+	size_t len; /* as read */
+};
+
+struct key {
+	const char *key;
+	size_t len;
+	size_t source;
+};
+
+static struct source *sources;
+static size_t num_sources, cap_sources;
+
+static void *xmalloc(size_t n) {
+	void *p = malloc(n ? n : 1);
+	if (p == NULL) {
+		perror("embed");
+		exit(1);
+	}
+	return p;
+}
+
+static char *join(const char *a, const char *b) {
+	size_t a_len = strlen(a);
+	char *out = xmalloc(a_len + strlen(b) + 2);
+	strcpy(out, a);
+	if (a_len > 0) out[a_len++] = '/';
+	strcpy(out + a_len, b);
+	return out;
+}
+
+static void add_source(char *path, char *key, time_t mtime) {
+	if (num_sources == cap_sources) {
+		cap_sources = cap_sources ? cap_sources * 2 : 64;
+		sources = realloc(sources, cap_sources * sizeof(struct source));
+		if (sources == NULL) {
+			perror("embed");
+			exit(1);
+		}
+	}
+	sources[num_sources].path = path;
+	sources[num_sources].key = key;
+	sources[num_sources].mtime = mtime;
+	num_sources++;
+}
+
+/* regular files under `path`, dot entries skipped like the server hides them */
+static int walk(const char *path, const char *key) {
+	DIR *dir = opendir(path);
+	struct dirent *ent;
+	int ret = 0;
+
+	if (dir == NULL) {
+		perror(path);
+		return -1;
+	}
+	while (ret == 0 && (ent = readdir(dir)) != NULL) {
+		char *child, *child_key;
+		struct stat st;
+
+		if (ent->d_name[0] == '.') continue;
+		child = join(path, ent->d_name);
+		child_key = join(key, ent->d_name);
+		if (stat(child, &st) == -1) {
+			perror(child);
+			ret = -1;
+		} else if (S_ISDIR(st.st_mode)) {
+			ret = walk(child, child_key);
+		} else if (S_ISREG(st.st_mode)) {
+			add_source(child, child_key, st.st_mtime);
+			continue;
+		}
+		free(child);
+		free(child_key);
+	}
+	closedir(dir);
+	return ret;
+}
+
+static unsigned char *read_file(const char *path, size_t *len) {
+	FILE *f = fopen(path, "rb");
+	unsigned char *data;
+	long size;
+
+	if (f == NULL || fseek(f, 0, SEEK_END) == -1 || (size = ftell(f)) < 0 ||
+			fseek(f, 0, SEEK_SET) == -1) {
+		perror(path);
+		exit(1);
+	}
+	data = xmalloc((size_t)size);
+	if (fread(data, 1, (size_t)size, f) != (size_t)size) {
+		perror(path);
+		exit(1);
+	}
+	fclose(f);
+	*len = (size_t)size;
+	return data;
+}
+
+/* a C string literal; '?' is escaped against trigraphs */
+static void put_literal(FILE *out, const char *str, size_t len) {
+	size_t i;
+	fputc('"', out);
+	for (i = 0; i < len; ++i) {
+		unsigned char ch = (unsigned char)str[i];
+		if (ch == '\r') fputs("\\r", out);
+		else if (ch == '\n') fputs("\\n", out);
+		else if (ch == '"' || ch == '\\' || ch == '?') fprintf(out, "\\%c", ch);
+		else if (ch < 0x20 || ch >= 0x7F) fprintf(out, "\\%03o", ch);
+		else fputc(ch, out);
+	}
+	fputc('"', out);
+}
+
+static void put_bytes(FILE *out, const char *name, const unsigned char *data, size_t len) {
+	size_t i;
+	fprintf(out, "static const unsigned char %s[] = {", name);
+	for (i = 0; i < len; ++i) {
+		if (i % BYTES_PER_LINE == 0) fputs("\n\t", out);
+		fprintf(out, "0x%02x,", data[i]);
+	}
+	if (len == 0) fputs("0", out);
+	fputs("\n};\n\n", out);
+}
+
+/* etag, head and its Content-Length offset of one variant */
+static void put_variant(
+		FILE *out,
+		const char *body,
+		size_t len,
+		const char *etag,
+		const char *type,
+		int gzip,
+		int vary
+) {
+	char head[512];
+	size_t head_len, length_off;
+
+	head_len = (size_t)sprintf(head, "Content-Type: %s" CRLF "ETag: %s" CRLF "%s%s",
+		type, etag,
+		gzip ? "Content-Encoding: gzip" CRLF : "",
+		vary ? "Vary: Accept-Encoding" CRLF : "");
+	length_off = head_len;
+	head_len += (size_t)sprintf(head + head_len, "Content-Length: %lu" CRLF,
+		(unsigned long)len);
+
+	fprintf(out, "{%s, %lu, ", body, (unsigned long)len);
+	put_literal(out, etag, strlen(etag));
+	fputs(", ", out);
+	put_literal(out, head, head_len);
+	fprintf(out, ", %lu, %lu}", (unsigned long)head_len, (unsigned long)length_off);
+}
+
+static int key_cmp(const void *a, const void *b) {
+	return strcmp(((const struct key *)a)->key, ((const struct key *)b)->key);
+}
+
+/* 1 if every key hashes to a slot of its own */
+static int fill_slots(size_t *slots, size_t num_slots, uint32_t seed,
+		const struct key *keys, size_t num_keys) {
+	size_t i, slot;
+
+	memset(slots, 0, num_slots * sizeof(size_t));
+	for (i = 0; i < num_keys; ++i) {
+		slot = hash_bytes(keys[i].key, keys[i].len, seed) & (num_slots - 1);
+		if (slots[slot] != 0) return 0;
+		slots[slot] = i + 1;
+	}
+	return 1;
+}
+
+/* keys of the sources, directories also reachable through their index */
+static struct key *collect_keys(size_t *num_keys) {
+	struct key *keys = xmalloc(2 * num_sources * sizeof(struct key));
+	size_t i, n = 0, index_len = strlen(INDEX_FILE);
+
+	for (i = 0; i < num_sources; ++i) {
+		const char *key = sources[i].key;
+		size_t len = strlen(key);
+
+		keys[n].key = key;
+		keys[n].len = len;
+		keys[n++].source = i;
+		if (len >= index_len && !strcmp(key + len - index_len, INDEX_FILE) &&
+				(len == index_len || key[len - index_len - 1] == '/')) {
+			keys[n].key = key;
+			keys[n].len = len == index_len ? 0 : len - index_len - 1;
+			keys[n++].source = i;
+		}
+	}
+	/* aliases get strings of their own so that keys sort with strcmp */
+	for (i = 0; i < n; ++i) {
+		if (keys[i].len != strlen(keys[i].key)) {
+			char *alias = xmalloc(keys[i].len + 1);
+			memcpy(alias, keys[i].key, keys[i].len);
+			alias[keys[i].len] = '\0';
+			keys[i].key = alias;
+		}
+	}
+	qsort(keys, n, sizeof(struct key), key_cmp);
+	*num_keys = n;
+	return keys;
+}
+
+static void emit(FILE *out, const char *docroot) {
+	struct key *keys;
+	size_t num_keys, num_slots, i;
+	size_t *slots, *gzip_len;
+	uint32_t seed = HASH_SEED;
+	unsigned tries;
+	char **etags;
+
+	fprintf(out, "/* generated by tools/embed.c from %s, do not edit */\n\n",
+		docroot != NULL ? docroot : "nothing");
+	fputs("#include \"embedded.h\"\n\n", out);
+
+	if (num_sources == 0) {
+		fprintf(out, "const struct embedded_table embedded_docroot = "
+			"{NULL, 0, NULL, 0, 0x%08lxu};\n", (unsigned long)seed);
+		return;
+	}
+
+	etags = xmalloc(num_sources * 2 * sizeof(char *));
+	gzip_len = xmalloc(num_sources * sizeof(size_t));
+	for (i = 0; i < num_sources; ++i) {
+		unsigned char *data, *gz = NULL;
+		size_t len, gz_len = 0;
+		char name[32];
+		uint32_t tag;
+
+		data = read_file(sources[i].path, &len);
+		sources[i].len = len;
+		tag = hash_bytes((const char *)data, len, HASH_SEED);
+		etags[2 * i] = xmalloc(40);
+		etags[2 * i + 1] = xmalloc(48);
+		sprintf(etags[2 * i], "\"e%08lx-%lx\"", (unsigned long)tag, (unsigned long)len);
+		sprintf(etags[2 * i + 1], "\"e%08lx-%lx-gzip\"", (unsigned long)tag, (unsigned long)len);
+
+		sprintf(name, "body%lu", (unsigned long)i);
+		put_bytes(out, name, data, len);
+
+		/* worth a variant only if it saves a tenth */
+		if (len >= ZCACHE_MIN_INPUT) {
+			gzip_compress(data, len, DEFLATE_MAX_LEVEL, &gz, &gz_len);
+			if (gz_len >= len - len / 10) gz_len = 0;
+		}
+		gzip_len[i] = gz_len;
+		if (gz_len > 0) {
+			sprintf(name, "body%lu_gz", (unsigned long)i);
+			put_bytes(out, name, gz, gz_len);
+		}
+		free(gz);
+		free(data);
+	}
+
+	keys = collect_keys(&num_keys);
+	fputs("static const struct embedded_file files[] = {\n", out);
+	for (i = 0; i < num_keys; ++i) {
+		size_t s = keys[i].source;
+		const char *type = content_type(sources[s].key);
+		char last_modified[HTTP_DATE_LEN + 1], body[32];
+
+		format_http_date(sources[s].mtime, last_modified);
+		fputs("\t{", out);
+		put_literal(out, keys[i].key, keys[i].len);
+		fprintf(out, ", %lu, (time_t)%ldL, \"%s\",\n\t\t",
+			(unsigned long)keys[i].len, (long)sources[s].mtime, last_modified);
+		sprintf(body, "body%lu", (unsigned long)s);
+		put_variant(out, body, sources[s].len, etags[2 * s], type, 0, gzip_len[s] > 0);
+		fputs(",\n\t\t", out);
+		if (gzip_len[s] > 0) {
+			sprintf(body, "body%lu_gz", (unsigned long)s);
+			put_variant(out, body, gzip_len[s], etags[2 * s + 1], type, 1, 1);
+		} else {
+			fputs("{NULL, 0, NULL, NULL, 0, 0}", out);
+		}
+		fputs("},\n", out);
+	}
+	fputs("};\n\n", out);
+
+	for (num_slots = 8; num_slots < num_keys * 2;) num_slots *= 2;
+	slots = NULL;
+	while (1) {
+		free(slots);
+		slots = xmalloc(num_slots * sizeof(size_t));
+		for (tries = 0; tries < SEED_TRIES; ++tries) {
+			seed = HASH_SEED ^ (tries * 0x9E3779B9u);
+			if (fill_slots(slots, num_slots, seed, keys, num_keys)) break;
+		}
+		if (tries < SEED_TRIES) break;
+		num_slots *= 2;
+	}
+
+	fputs("static const size_t slots[] = {", out);
+	for (i = 0; i < num_slots; ++i) {
+		if (i % BYTES_PER_LINE == 0) fputs("\n\t", out);
+		fprintf(out, "%lu,", (unsigned long)slots[i]);
+	}
+	fputs("\n};\n\n", out);
+	fprintf(out, "const struct embedded_table embedded_docroot = "
+		"{files, %lu, slots, %lu, 0x%08lxu};\n",
+		(unsigned long)num_keys, (unsigned long)num_slots, (unsigned long)seed);
+
+	for (i = 0; i < 2 * num_sources; ++i) free(etags[i]);
+	free(etags);
+	free(gzip_len);
+	free(slots);
+	for (i = 0; i < num_keys; ++i) {
+		if (keys[i].len != strlen(sources[keys[i].source].key)) {
+			free((char *)keys[i].key);
+		}
+	}
+	free(keys);
+}
+
+int main(int argc, char **argv) {
+	FILE *out;
+	size_t i;
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s out.c [docroot]\n", argv[0]);
+		return 2;
+	}
+	if (argc == 3 && walk(argv[2], "") == -1) return 1;
+
+	out = fopen(argv[1], "w");
+	if (out == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+	emit(out, argc == 3 ? argv[2] : NULL);
+	if (fclose(out) == EOF) {
+		perror(argv[1]);
+		remove(argv[1]);
+		return 1;
+	}
+
+	for (i = 0; i < num_sources; ++i) {
+		free(sources[i].path);
+		free(sources[i].key);
+	}
+	free(sources);
+	return 0;
+}